@@ -67,6 +67,7 @@
 #define INCLUDE_CONFIG_CC_H
 
 #include "stats.h"
+#include "fs_emitter.h"
 
 configEntry configKeysRestartCC[] = {
     {"DISABLE_TUNNELING", "N"}
@@ -129,6 +130,10 @@ configEntry configKeysRestartCC[] = {
     ,
     {"CC_IMAGE_PROXY_PATH", NULL}
     ,
+    {EMITTER_MODE_CONF_PARAM_NAME, EMITTER_MODE_CONF_PARAM_DEFAULT}
+    ,
+    {EMITTER_SOCKET_CONF_PARAM_NAME, EMITTER_SOCKET_CONF_PARAM_DEFAULT}
+    ,
     {NULL, NULL}
     ,
 };
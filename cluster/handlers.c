@@ -120,6 +120,7 @@
 #include <message_stats.h>
 #include <message_sensor.h>
 #include <service_sensor.h>
+#include <lock_sensor.h>
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -184,9 +185,8 @@ globalNetworkInfo *globalnetworkinfo = NULL;
 ccResourceCache *resourceCache = NULL; // canonical source for latest information about resources
 ccResourceCache *resourceCacheStage = NULL; // clone of resourceCache used for aggregating replies from NCs (via child procs)
 sensorResourceCache *ccSensorResourceCache = NULL;  // canonical source for latest sensor data, both local and from NCs
-char *message_stats_shared_mem = NULL; //Reference to the shared memory region
-char message_stats_cache[MESSAGE_STATS_MEMORY_REGION_SIZE]; //The proc local holder for cached copies of message_stats_shared_mem to avoid realloc for each cache copy.
-json_object *stats_cache_json = NULL;  //! Pointer to parsed stats from the cache
+message_stats_table *message_stats_shared_mem = NULL; //Reference to the shared memory region, updated lock-free by every CC process
+ipc_lock_stats *lock_stats_shared_mem = NULL; // contention statistics of the locks below, one entry per lock, updated lock-free by every CC process
 
 //! @}
 
@@ -214,6 +214,21 @@ char *SCHEDPOLICIES[SCHEDLAST] = {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Names reported in the lock statistics, the NCCALL locks are numbered instead
+static const char *lock_names[NCCALL0] = {
+    "INIT",
+    "CONFIG",
+    "NETCONFIG",
+    "INSTCACHE",
+    "RESCACHE",
+    "RESCACHESTAGE",
+    "REFRESHLOCK",
+    "BUNDLECACHE",
+    "SENSORCACHE",
+    "STATSCACHE",
+    "GLOBALNETWORKINFO",
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -228,12 +243,12 @@ static int schedule_instance_migration(ncInstance * instance, char **includeNode
 static int migration_handler(ccInstance * myInstance, char *host, char *src, char *dst, migration_states migration_state, char **node, char **instance, char **action);
 static int populateOutboundMeta(ncMetadata * pMeta);
 static int initialize_stats_system(int interval_sec);
-static json_object **message_stats_getter();
-static void message_stats_setter();
 static char *stats_service_check_call();
 static char *stats_service_state_call();
 static void lock_stats();
 static void unlock_stats();
+static int get_lock_stats(ipc_lock_stats * pStats, int max, boolean reset);
+static void polling_frequency_changed(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -300,6 +315,22 @@ static void unlock_stats()
     sem_mypost(STATSCACHE);
 }
 
+//! Lock stats collector for the lock sensor, reads the statistics every CC process
+//! accumulates in shared memory
+//! @returns the number of entries written to pStats
+static int get_lock_stats(ipc_lock_stats * pStats, int max, boolean reset)
+{
+    int i = 0;
+
+    if (lock_stats_shared_mem == NULL)
+        return (0);
+
+    for (i = 0; (i < ENDLOCK) && (i < max); i++) {
+        ipc_lock_stats_take(&(lock_stats_shared_mem[i]), &(pStats[i]), reset);
+    }
+    return (i);
+}
+
 //! Provides CC-specific initializations for the stats system of
 //! internal service sensors (state sensors, message statistics, etc)
 //! @returns EUCA_OK on success, or error code on failure
@@ -311,19 +342,13 @@ static int initialize_stats_system(int interval_sec)
 
     lock_stats();
     {
-        //Zero the cache location
-        bzero(message_stats_cache, MESSAGE_STATS_MEMORY_REGION_SIZE);
-
         //Init the message sensor with component-specific data
-        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter, message_stats_setter);
+        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_shared_mem);
         if (ret != EUCA_OK) {
             LOGERROR("Error initializing internal message sensor: %d\n", ret);
             goto cleanup;
         } else {
-            json_object **tmp = message_stats_getter();
-            const char *tmp_out = json_object_to_json_string(*tmp);
-            LOGINFO("Initialized internal message stats: %s\n", tmp_out);
-
+            LOGINFO("Initialized internal message stats\n");
         }
 
         //Init the service state sensor with component-specific data
@@ -333,6 +358,13 @@ static int initialize_stats_system(int interval_sec)
             goto cleanup;
         }
 
+        //Init the lock sensor with the lock stats shared by all CC processes
+        ret = initialize_lock_sensor(euca_this_component_name, interval_sec, stats_ttl, get_lock_stats);
+        if (ret != EUCA_OK) {
+            LOGERROR("Error initializing internal lock sensor: %d\n", ret);
+            goto cleanup;
+        }
+
         ret = init_stats(config->eucahome, euca_this_component_name, lock_stats, unlock_stats);
         if (ret != EUCA_OK) {
             LOGERROR("Could not initialize CC stats system: %d\n", ret);
@@ -954,10 +986,11 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
             int instIdsLen = va_arg(al, int);
             char **sensorIds = va_arg(al, char **);
             int sensorIdsLen = va_arg(al, int);
+            long long since_sequence_num = va_arg(al, long long);
             sensorResource ***srs = va_arg(al, sensorResource ***);
             int *srsLen = va_arg(al, int *);
 
-            rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, srs, srsLen);
+            rc = ncDescribeSensorsStub(ncs, localmeta, history_size, collection_interval_time_ms, instIds, instIdsLen, sensorIds, sensorIdsLen, since_sequence_num, srs, srsLen);
             if (timeout && srs && srsLen) {
                 if (!rc) {
                     len = *srsLen;
@@ -1302,6 +1335,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
             int instIdsLen = 0;
             char **sensorIds = NULL;
             int sensorIdsLen = 0;
+            long long since_sequence_num = 0L;
             sensorResource ***srs = NULL;
             int *srsLen = NULL;
 
@@ -1311,6 +1345,7 @@ int ncClientCall(ncMetadata * pMeta, int timeout, int ncLock, char *ncURL, char
             instIdsLen = va_arg(al, int);
             sensorIds = va_arg(al, char **);
             sensorIdsLen = va_arg(al, int);
+            since_sequence_num = va_arg(al, long long);
             srs = va_arg(al, sensorResource ***);
             srsLen = va_arg(al, int *);
 
@@ -2735,14 +2770,27 @@ int refresh_sensors(ncMetadata * pMeta, int timeout, int dolock)
 
                 sensorResource **srs;
                 int srsLen;
+                // only ask for values that are newer than what we got last time
                 int rc = ncClientCall(pMeta, nctimeout, resourceCacheStage->resources[i].lockidx, resourceCacheStage->resources[i].ncURL,
                                       "ncDescribeSensors", history_size, collection_interval_time_ms,
-                                      NULL, 0, NULL, 0, &srs, &srsLen);
+                                      NULL, 0, NULL, 0, resourceCacheStage->resources[i].sensorSequenceNum, &srs, &srsLen);
 
                 if (!rc) {
                     // update our cache
                     if (sensor_merge_records(srs, srsLen, TRUE) != EUCA_OK) {
                         LOGWARN("failed to store all sensor data due to lack of space");
+                    } else {
+                        // remember where this node is at (after an NC restart its numbers
+                        // start over and it sends everything, which resets this, too)
+                        long long last_seq = sensor_last_sequence_num(srs, srsLen);
+                        if (last_seq >= 0) {
+                            sem_mywait(RESCACHE);
+                            for (int j = 0; j < resourceCache->numResources; j++) {
+                                if (!strcmp(resourceCache->resources[j].ncURL, resourceCacheStage->resources[i].ncURL))
+                                    resourceCache->resources[j].sensorSequenceNum = last_seq;
+                            }
+                            sem_mypost(RESCACHE);
+                        }
                     }
 
                     if (srsLen > 0) {
@@ -5881,6 +5929,9 @@ int init_log(void)
         }
         // set the log file path (levels and size limits are set below)
         log_file_set(logFile, logFileReqTrack);
+        if (log_async_start() != EUCA_OK) {
+            LOGWARN("failed to start the log writer thread, logging synchronously\n");
+        }
 
         local_init = 1;
     }
@@ -5967,7 +6018,7 @@ int init_thread(void)
 
         if (ccSensorResourceCache == NULL) {
             rc = setup_shared_buffer((void **)&ccSensorResourceCache, "/eucalyptusCCSensorResourceCache",
-                                     sizeof(sensorResourceCache) + sizeof(sensorResource) * (MAX_SENSOR_RESOURCES - 1), &(locks[SENSORCACHE]),
+                                     SENSOR_CACHE_SIZE(MAX_SENSOR_RESOURCES), &(locks[SENSORCACHE]),
                                      "/eucalyptusCCSensorResourceCacheLock", SHARED_FILE);
             if (rc != 0) {
                 fprintf(stderr, "Cannot set up shared memory region for ccSensorResourceCache, exiting...\n");
@@ -5996,7 +6047,7 @@ int init_thread(void)
         }
         //setup message stats shared buffer
         if (message_stats_shared_mem == NULL) {
-            rc = setup_shared_buffer((void **)&message_stats_shared_mem, "/eucalyptusCCmessageStats", MESSAGE_STATS_MEMORY_REGION_SIZE, &(locks[STATSCACHE]),
+            rc = setup_shared_buffer((void **)&message_stats_shared_mem, "/eucalyptusCCmessageStats", sizeof(message_stats_table), &(locks[STATSCACHE]),
                                      "/eucalyptusCCmessageStatsLock", SHARED_FILE);
             if (rc != 0) {
                 fprintf(stderr, "Cannot setup shared memory region for message statistics, exiting...\n");
@@ -6004,6 +6055,24 @@ int init_thread(void)
                 exit(1);
             }
         }
+        //setup lock stats shared buffer, guarded by the same lock as the message stats
+        if (lock_stats_shared_mem == NULL) {
+            rc = setup_shared_buffer((void **)&lock_stats_shared_mem, "/eucalyptusCClockStats", (sizeof(ipc_lock_stats) * ENDLOCK), &(locks[STATSCACHE]),
+                                     "/eucalyptusCCmessageStatsLock", SHARED_FILE);
+            if (rc != 0) {
+                fprintf(stderr, "Cannot setup shared memory region for lock statistics, exiting...\n");
+                sem_mypost(INIT);
+                exit(1);
+            }
+
+            for (i = 0; i < ENDLOCK; i++) {
+                if (i < NCCALL0) {
+                    snprintf(lock_stats_shared_mem[i].name, IPC_LOCK_NAME_LEN, "%s", lock_names[i]);
+                } else {
+                    snprintf(lock_stats_shared_mem[i].name, IPC_LOCK_NAME_LEN, "NCCALL%d", (i - NCCALL0));
+                }
+            }
+        }
 
         sem_mypost(INIT);
         thread_init = 1;
@@ -6012,63 +6081,33 @@ int init_thread(void)
 }
 
 //! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies.
-//! Caller must handle necessary locks
-static json_object **message_stats_getter()
+//! The table lives in memory shared by all CC processes and is updated with atomic operations, so no lock is needed
+int cached_message_stats_update(const char *message_name, long call_time, int msg_failed)
 {
-    LOGTRACE("Fetching latest message stats from shared memory\n");
-
-    //copy the memory region into the proc-local buffer from the shared-memory region
-    euca_strncpy(message_stats_cache, message_stats_shared_mem, MESSAGE_STATS_MEMORY_REGION_SIZE);
-
-    //A process-local json cache to avoid repeated parsing
-    stats_cache_json = json_tokener_parse(message_stats_cache);
-
-    LOGTRACE("Message stats fetch complete\n");
-    return &stats_cache_json;
+    return update_message_stats(message_stats_shared_mem, message_name, call_time, msg_failed);
 }
 
-//! Write the cached value back to the shared memory region
-//! Must be called from within a lock for the memory region
-static void message_stats_setter()
+//!
+//! Refreshes a polling frequency when its value changes in the configuration files. It is
+//! invoked by readConfigFile() while update_config() holds the CONFIG semaphore.
+//!
+//! @param[in] sKey the polling frequency key that changed
+//! @param[in] sOldValue the previous value (may be NULL)
+//! @param[in] sNewValue the new value (may be NULL)
+//! @param[in] pData pointer to the matching polling frequency in the configuration
+//!
+static void polling_frequency_changed(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData)
 {
-    LOGTRACE("Updating latest message stats from shared memory\n");
-
-    if (stats_cache_json != NULL) {
-        //Write the memory back
-        const char *output = json_object_to_json_string(stats_cache_json);
-        LOGTRACE("Setting stats state to: %s\n", output);
-
-        if (strlen(output) + 1 > MESSAGE_STATS_MEMORY_REGION_SIZE) {
-            LOGERROR("Pre-allocated size for internal message stats exceeded. Stats updates will not be reflected.\n");
-        } else {
-            euca_strncpy(message_stats_shared_mem, output, strlen(output) + 1);
-        }
+    long frequency = 0;
+    long minimum = ((!strcmp(sKey, "NC_POLLING_FREQUENCY")) ? 6 : 1);
+    time_t *pFrequency = ((time_t *) pData);
 
-        json_object_put(stats_cache_json);  //Free it
+    if (!configStoreValueLong(config->configFiles, 2, sKey, &frequency) || (frequency < minimum)) {
+        frequency = 6;
     }
 
-    LOGTRACE("Message stats fetch complete\n");
-    return;
-}
-
-//! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies and locking
-int cached_message_stats_update(const char *message_name, long call_time, int msg_failed)
-{
-    LOGTRACE("Updating message stats for message %s\n", message_name);
-    lock_stats();
-
-    json_object **stats_state = message_stats_getter();
-
-    //Update the counters
-    update_message_stats(*stats_state, message_name, call_time, msg_failed);
-
-    message_stats_setter();
-
-    unlock_stats();
-    LOGTRACE("Message stats update complete\n");
-    return EUCA_OK;
+    (*pFrequency) = ((time_t) frequency);
+    LOGDEBUG("%s is now %ld seconds\n", sKey, frequency);
 }
 
 //!
@@ -6085,9 +6124,17 @@ int update_config(void)
     char *tmpstr = NULL;
     ccResource *res = NULL;
     int rc, numHosts, ret = 0;
+    static boolean listening = FALSE;
 
     sem_mywait(CONFIG);
 
+    // listeners are per process, so register them in the one that re-reads the files
+    if (!listening) {
+        configRegisterChangeCallback("CLC_POLLING_FREQUENCY", polling_frequency_changed, &(config->clcPollingFrequency));
+        configRegisterChangeCallback("NC_POLLING_FREQUENCY", polling_frequency_changed, &(config->ncPollingFrequency));
+        listening = TRUE;
+    }
+
     rc = isConfigModified(config->configFiles, 2);
     if (rc < 0) {                      // error
         sem_mypost(CONFIG);
@@ -6141,33 +6188,7 @@ int update_config(void)
                 bzero(config->arbitrators, 256);
             }
 
-            // polling frequencies
-
-            // CLC
-            tmpstr = configFileValue("CLC_POLLING_FREQUENCY");
-            if (tmpstr) {
-                if (atoi(tmpstr) > 0) {
-                    config->clcPollingFrequency = atoi(tmpstr);
-                } else {
-                    config->clcPollingFrequency = 6;
-                }
-                EUCA_FREE(tmpstr);
-            } else {
-                config->clcPollingFrequency = 6;
-            }
-
-            // NC
-            tmpstr = configFileValue("NC_POLLING_FREQUENCY");
-            if (tmpstr) {
-                if (atoi(tmpstr) > 6) {
-                    config->ncPollingFrequency = atoi(tmpstr);
-                } else {
-                    config->ncPollingFrequency = 6;
-                }
-                EUCA_FREE(tmpstr);
-            } else {
-                config->ncPollingFrequency = 6;
-            }
+            // polling frequencies were refreshed by polling_frequency_changed() during readConfigFile()
 
             // enabled sensors list -- removed since it is part of sensor cycle
             //update_sensors_list();
@@ -7858,7 +7879,9 @@ static void refresh_resourceCache(ccResourceCache * updatedResourceCache, boolea
                             LOGWARN("node '%s' not in configuration, but with instances on it\n", res_old->hostname);
                         }
                     } else {           // a configured resource, so just update cache with latest info
+                        long long sensorSequenceNum = res_old->sensorSequenceNum;   // owned by refresh_sensors(), which updates it in place
                         memcpy(res_old, res_new, sizeof(ccResource));
+                        res_old->sensorSequenceNum = sensorSequenceNum;
                     }
                     found_it = TRUE;
                     break;
@@ -7911,7 +7934,17 @@ void unlock_exit(int code)
 int sem_mywait(int lockno)
 {
     int rc;
-    rc = sem_wait(locks[lockno]);
+    u64 start = 0;
+
+    // try without blocking first, so only the callers that actually wait pay for the timing
+    if ((rc = sem_trywait(locks[lockno])) == 0) {
+        if (lock_stats_shared_mem)
+            ipc_lock_stats_acquired(&(lock_stats_shared_mem[lockno]), getpid(), FALSE, 0);
+    } else {
+        start = ipc_clock_ns();
+        if (((rc = sem_wait(locks[lockno])) == 0) && lock_stats_shared_mem)
+            ipc_lock_stats_acquired(&(lock_stats_shared_mem[lockno]), getpid(), TRUE, (ipc_clock_ns() - start));
+    }
     mylocks[lockno] = 1;
     return (rc);
 }
@@ -7930,6 +7963,8 @@ int sem_mywait(int lockno)
 int sem_mypost(int lockno)
 {
     mylocks[lockno] = 0;
+    if (lock_stats_shared_mem)
+        ipc_lock_stats_released(&(lock_stats_shared_mem[lockno]));
     return (sem_post(locks[lockno]));
 }
 
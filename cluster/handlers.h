@@ -95,7 +95,6 @@
 #define OP_TIMEOUT_MIN                            5
 #define LOG_INTERVAL_SUMMARY_SEC                 60
 #define SCHED_TIMEOUT_SEC                         8 //! timeout for user scheduler
-#define MESSAGE_STATS_MEMORY_REGION_SIZE         10485760   //! 10 MB
 
 /*
 {
@@ -300,6 +299,7 @@ typedef struct resource_t {
     char nodeStatus[24];
     boolean migrationCapable;
     char hypervisor[16];
+    long long sensorSequenceNum;       // last sensor sequence number received from the node, so only newer values are asked for
 } ccResource;
 
 typedef struct ccResourceCache_t {
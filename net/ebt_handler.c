@@ -1014,7 +1014,7 @@ int ebt_handler_print(ebt_handler * ebth)
         return (1);
     }
 
-    if (log_level_get() == EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         for (i = 0; i < ebth->max_tables; i++) {
             LOGTRACE("TABLE (%d of %d): %s\n", i, ebth->max_tables, ebth->tables[i].name);
             for (j = 0; j < ebth->tables[i].max_chains; j++) {
@@ -2582,17 +2582,19 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
 {
     int i, j;
     char *strptra = NULL;
+    boolean print = ((mode == GNI_ITERATE_PRINT) && LOG_ENABLED(EUCA_LOG_TRACE));    // only convert addresses for the log if it will be printed
 
-    strptra = hex2dot(gni->enabledCLCIp);
-    if (mode == GNI_ITERATE_PRINT)
+    if (print) {
+        strptra = hex2dot(gni->enabledCLCIp);
         LOGTRACE("enabledCLCIp: %s\n", SP(strptra));
-    EUCA_FREE(strptra);
+        EUCA_FREE(strptra);
+    }
 
     if (mode == GNI_ITERATE_PRINT)
         LOGTRACE("instanceDNSDomain: %s\n", gni->instanceDNSDomain);
 
 #ifdef USE_IP_ROUTE_HANDLER
-    if (mode == GNI_ITERATE_PRINT) {
+    if (print) {
         strptra = hex2dot(gni->publicGateway);
         LOGTRACE("publicGateway: %s\n", SP(strptra));
         EUCA_FREE(strptra);
@@ -2602,10 +2604,11 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     if (mode == GNI_ITERATE_PRINT)
         LOGTRACE("instanceDNSServers: \n");
     for (i = 0; i < gni->max_instanceDNSServers; i++) {
-        strptra = hex2dot(gni->instanceDNSServers[i]);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->instanceDNSServers[i]);
             LOGTRACE("\tdnsServer %d: %s\n", i, SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
     }
     if (mode == GNI_ITERATE_FREE) {
         EUCA_FREE(gni->instanceDNSServers);
@@ -2614,10 +2617,11 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     if (mode == GNI_ITERATE_PRINT)
         LOGTRACE("publicIps: \n");
     for (i = 0; i < gni->max_public_ips; i++) {
-        strptra = hex2dot(gni->public_ips[i]);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->public_ips[i]);
             LOGTRACE("\tip %d: %s\n", i, SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
     }
     if (mode == GNI_ITERATE_FREE) {
         EUCA_FREE(gni->public_ips);
@@ -2627,20 +2631,23 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
         LOGTRACE("subnets: \n");
     for (i = 0; i < gni->max_subnets; i++) {
 
-        strptra = hex2dot(gni->subnets[i].subnet);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->subnets[i].subnet);
             LOGTRACE("\tsubnet %d: %s\n", i, SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
-        strptra = hex2dot(gni->subnets[i].netmask);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->subnets[i].netmask);
             LOGTRACE("\t\tnetmask: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
-        strptra = hex2dot(gni->subnets[i].gateway);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->subnets[i].gateway);
             LOGTRACE("\t\tgateway: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
     }
     if (mode == GNI_ITERATE_FREE) {
@@ -2652,36 +2659,41 @@ int gni_iterate(globalNetworkInfo * gni, int mode)
     for (i = 0; i < gni->max_clusters; i++) {
         if (mode == GNI_ITERATE_PRINT)
             LOGTRACE("\tcluster %d: %s\n", i, gni->clusters[i].name);
-        strptra = hex2dot(gni->clusters[i].enabledCCIp);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->clusters[i].enabledCCIp);
             LOGTRACE("\t\tenabledCCIp: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
         if (mode == GNI_ITERATE_PRINT)
             LOGTRACE("\t\tmacPrefix: %s\n", gni->clusters[i].macPrefix);
 
-        strptra = hex2dot(gni->clusters[i].private_subnet.subnet);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->clusters[i].private_subnet.subnet);
             LOGTRACE("\t\tsubnet: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
-        strptra = hex2dot(gni->clusters[i].private_subnet.netmask);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->clusters[i].private_subnet.netmask);
             LOGTRACE("\t\t\tnetmask: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
-        strptra = hex2dot(gni->clusters[i].private_subnet.gateway);
-        if (mode == GNI_ITERATE_PRINT)
+        if (print) {
+            strptra = hex2dot(gni->clusters[i].private_subnet.gateway);
             LOGTRACE("\t\t\tgateway: %s\n", SP(strptra));
-        EUCA_FREE(strptra);
+            EUCA_FREE(strptra);
+        }
 
         if (mode == GNI_ITERATE_PRINT)
             LOGTRACE("\t\tprivate_ips \n");
         for (j = 0; j < gni->clusters[i].max_private_ips; j++) {
-            strptra = hex2dot(gni->clusters[i].private_ips[j]);
-            if (mode == GNI_ITERATE_PRINT)
+            if (print) {
+                strptra = hex2dot(gni->clusters[i].private_ips[j]);
                 LOGTRACE("\t\t\tip %d: %s\n", j, SP(strptra));
-            EUCA_FREE(strptra);
+                EUCA_FREE(strptra);
+            }
         }
         if (mode == GNI_ITERATE_PRINT)
             LOGTRACE("\t\tnodes \n");
@@ -692,7 +692,7 @@ int ipr_handler_print(ipr_handler * pIprh)
         return (1);
     }
 
-    if (log_level_get() == EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         for (i = 0; i < pIprh->nbRules; i++) {
             LOGTRACE("IPRULE NAME: %s\n", pIprh->pRuleList[i].name);
         }
@@ -757,7 +757,7 @@ int ips_handler_print(ips_handler * ipsh)
         return (1);
     }
 
-    if (log_level_get() == EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         for (i = 0; i < ipsh->max_sets; i++) {
             LOGTRACE("IPSET NAME: %s\n", ipsh->sets[i].name);
             for (j = 0; j < ipsh->sets[i].max_member_ips; j++) {
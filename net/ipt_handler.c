@@ -1109,7 +1109,7 @@ int ipt_handler_print(ipt_handler * ipth)
         return (1);
     }
 
-    if (log_level_get() == EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         for (i = 0; i < ipth->max_tables; i++) {
             LOGTRACE("TABLE (%d of %d): %s\n", i, ipth->max_tables, ipth->tables[i].name);
             for (j = 0; j < ipth->tables[i].max_chains; j++) {
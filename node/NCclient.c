@@ -843,7 +843,7 @@ static int ncClientDescribeSensors(ncStub * pStub, ncMetadata * pMeta)
     char sBuffer[102400] = "";
     sensorResource **ppResources = NULL;
 
-    if ((rc = ncDescribeSensorsStub(pStub, pMeta, 20, 5000, NULL, 0, NULL, 0, &ppResources, &nbResources)) != EUCA_OK) {
+    if ((rc = ncDescribeSensorsStub(pStub, pMeta, 20, 5000, NULL, 0, NULL, 0, -1, &ppResources, &nbResources)) != EUCA_OK) {
         printf("ncDescribeSensorsStub = %d\n", rc);
         exit(1);
     }
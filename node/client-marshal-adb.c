@@ -1388,13 +1388,14 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
 //! @param[in]  instIdsLen the number of instance identifiers in the instIds list
 //! @param[in]  sensorIds a list of sensor identifiers string
 //! @param[in]  sensorIdsLen the number of sensor identifiers string in the sensorIds list
+//! @param[in]  sinceSequenceNum only ask for values with this sequence number or newer (0 or negative for all)
 //! @param[out] outResources a list of sensor resources created by this request
 //! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
 //!
 //! @return Always return EUCA_OK
 //!
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
-                          char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen)
+                          char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen)
 {
     int i = 0;
     int status = 0;
@@ -1434,6 +1435,10 @@ int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, l
         adb_ncDescribeSensorsType_add_sensorIds(request, env, sensorIds[i]);
     }
 
+    // left out unless set, so that a full report looks the same as it always did
+    if (sinceSequenceNum > 0)
+        adb_ncDescribeSensorsType_set_sinceSequenceNum(request, env, sinceSequenceNum);
+
     adb_ncDescribeSensors_set_ncDescribeSensors(input, env, request);
 
     // do it
@@ -445,6 +445,7 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
 //! @param[in]  instIdsLen the number of instance identifiers in the instIds list
 //! @param[in]  sensorIds a list of sensor identifiers string
 //! @param[in]  sensorIdsLen the number of sensor identifiers string in the sensorIds list
+//! @param[in]  sinceSequenceNum only ask for values with this sequence number or newer (0 or negative for all)
 //! @param[out] outResources a list of sensor resources created by this request
 //! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
 //!
@@ -453,9 +454,9 @@ int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char
 //! @see doDescribeSensors()
 //!
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
-                          char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen)
+                          char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen)
 {
-    return doDescribeSensors(pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, outResources, outResourcesLen);
+    return doDescribeSensors(pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, sinceSequenceNum, outResources, outResourcesLen);
 }
 
 //!
@@ -154,7 +154,7 @@ int ncDescribeBundleTasksStub(ncStub * pStub, ncMetadata * pMeta, char **instIds
 
 int ncCreateImageStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId, char *volumeId, char *remoteDev);
 int ncDescribeSensorsStub(ncStub * pStub, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen,
-                          char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
+                          char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen);
 int ncModifyNodeStub(ncStub * pStub, ncMetadata * pMeta, char *stateName);
 int ncMigrateInstancesStub(ncStub * pStub, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
 int ncStartInstanceStub(ncStub * pStub, ncMetadata * pMeta, char *instanceId);
@@ -118,6 +118,7 @@
 #include <log.h>
 #include <euca_string.h>
 #include <euca_system.h>
+#include <hash.h>
 
 #define HANDLERS_FANOUT
 #include "handlers.h"
@@ -127,8 +128,10 @@
 #include "objectstorage.h"
 #include "stats.h"
 #include "message_sensor.h"
+#include "lock_sensor.h"
 #include "message_stats.h"
 #include "service_sensor.h"
+#include "fs_emitter.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -140,6 +143,11 @@
 #define MAX_CREATE_TRYS                              5
 #define CREATE_TIMEOUT_SEC                           60
 #define LIBVIRT_TIMEOUT_SEC                          5
+#define LIBVIRT_WATCHDOG_TRIES                       3  //!< give up on a stuck libvirt call after this many LIBVIRT_TIMEOUT_SEC periods
+#define LIBVIRT_KEEPALIVE_INTERVAL_SEC               5  //!< seconds between libvirt keepalive messages on an idle connection
+#define LIBVIRT_KEEPALIVE_COUNT                      3  //!< unanswered keepalives after which libvirt closes the connection
+#define LIBVIRT_PROBE_INTERVAL_SEC                   30 //!< how often a live connection is verified with a round-trip to libvirtd
+#define DOMAIN_LOCKS                                 64 //!< number of locks that per-domain hypervisor access is striped over
 #define PER_INSTANCE_BUFFER_MB                       20 //!< by default reserve this much extra room (in MB) per instance (for kernel, ramdisk, and metadata overhead)
 #define MAX_SENSOR_RESOURCES                         MAXINSTANCES_PER_NC
 #define SEC_PER_MB                                   ((1024 * 1024) / 512)
@@ -154,18 +162,64 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+typedef struct libvirt_watchdog_t libvirt_watchdog;
+typedef struct domain_state_t domain_state;
+typedef struct hypervisor_domains_t hypervisor_domains;
+typedef struct disk_counters_t disk_counters;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Operations performed on the hypervisor connection under the watchdog
+typedef enum libvirt_op_t {
+    LIBVIRT_OP_RECONNECT = 0,          //!< close the given connection, if any, and open a new one
+    LIBVIRT_OP_PROBE,                  //!< make a round-trip call on the given connection
+    LIBVIRT_OP_CREATE,                 //!< create a domain from XML on the given connection
+} libvirt_op;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Parameters and results of a libvirt call made in a watchdog thread
+struct libvirt_watchdog_t {
+    libvirt_op op;                     //!< what the thread should do
+    virConnectPtr conn;                //!< in: connection to probe, create on, or close; out: newly opened connection
+    char *xml;                         //!< in: domain XML for LIBVIRT_OP_CREATE (owned by the structure)
+    int rc;                            //!< out: result of the libvirt call
+    boolean done;                      //!< set by the thread when it is finished (under libvirt_watchdog_mutex)
+    boolean abandoned;                 //!< set by the waiter when it gave up (under libvirt_watchdog_mutex)
+};
+
+//! State of a single domain as reported by the hypervisor
+struct domain_state_t {
+    char name[CHAR_BUFFER_SIZE];       //!< domain name, which is the instance ID
+    int state;                         //!< libvirt domain state (maps onto instance_states)
+};
+
+//! Snapshot of the states of all domains on the hypervisor, sorted by name
+struct hypervisor_domains_t {
+    int count;                         //!< number of entries in 'domains'
+    domain_state *domains;             //!< array of domain states
+};
+
+//! Counters of one host block device, as found in /proc/diskstats
+struct disk_counters_t {
+    char name[128];                    //!< kernel name of the device (e.g., dm-3)
+    unsigned long long readOps;        //!< reads completed
+    unsigned long long readSectors;    //!< sectors read
+    unsigned long long readMs;         //!< milliseconds spent reading
+    unsigned long long writeOps;       //!< writes completed
+    unsigned long long writeSectors;   //!< sectors written
+    unsigned long long writeMs;        //!< milliseconds spent writing
+    unsigned long long iosInProgress;  //!< I/Os currently in progress
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -192,17 +246,17 @@ const char *euca_client_component_name = "cc";  //!< Name of this component's cl
 
 /* used by lower level handlers */
 
-sem *hyp_sem = NULL;                   //!< semaphore for serializing domain creation
+sem *hyp_sem = NULL;                   //!< semaphore for serializing domain creation and other hypervisor-wide operations
 sem *inst_sem = NULL;                  //!< guarding access to global instance structs
-sem *inst_copy_sem = NULL;             //!< guarding access to global instance structs
+pthread_rwlock_t inst_copy_lock = PTHREAD_RWLOCK_INITIALIZER;   //!< guarding access to the published copy of global instance structs
 sem *addkey_sem = NULL;                //!< guarding access to global instance structs
 sem *loop_sem = NULL;                  //!< created in diskutils.c for serializing 'losetup' invocations
 sem *log_sem = NULL;                   //!< used by log.c
 sem *service_state_sem = NULL;         //!< Used to guard service state updates (i.e. topology updates)
 sem *stats_sem = NULL;                 //!< Used to guard the internal message stats data on updates
 
-bunchOfInstances *global_instances = NULL;  //!< pointer to the instance list
-bunchOfInstances *global_instances_copy = NULL; //!< pointer to the copied instance list
+bunchOfInstances *global_instances = NULL;  //!< pointer to the instance table
+bunchOfInstances *global_instances_copy = NULL; //!< pointer to the published snapshot of the instance table, read-only
 
 const int default_staging_cleanup_threshold = 60 * 60 * 2;  //!< after this many seconds any STAGING domains will be cleaned up
 const int default_booting_cleanup_threshold = 60;   //!< after this many seconds any BOOTING domains will be cleaned up
@@ -218,6 +272,8 @@ configEntry configKeysRestartNC[] = {
     {"EUCALYPTUS", "/"},
     {"NC_PORT", "8775"},
     {"NC_SERVICE", "axis2/services/EucalyptusNC"},
+    {EMITTER_MODE_CONF_PARAM_NAME, EMITTER_MODE_CONF_PARAM_DEFAULT},
+    {EMITTER_SOCKET_CONF_PARAM_NAME, EMITTER_SOCKET_CONF_PARAM_DEFAULT},
     {NULL, NULL},
 };
 
@@ -257,7 +313,18 @@ static struct handlers *available_handlers[] = {
     NULL,
 };
 
-static json_object *stats_json = NULL; //!< The json object that holds all of the internal message counters
+static message_stats_table stats_table;   //!< The internal message counters, updated lock-free by the request threads
+static pthread_mutex_t libvirt_watchdog_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards hand-off between watchdog threads and their waiters
+static pthread_mutex_t libvirt_conn_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards checking and replacing nc_state.conn
+static boolean libvirt_event_loop = FALSE;  //!< set once the default libvirt event loop runs, which keepalive depends on
+static time_t libvirt_last_probe = 0;  //!< when the connection last answered a round-trip call (guarded by libvirt_conn_mutex)
+static __thread virConnectPtr thread_conn = NULL;   //!< connection reference held by this thread between lock and unlock
+static __thread int thread_conn_depth = 0;  //!< nesting depth of lock_hypervisor_conn() calls in this thread
+static pthread_mutex_t domain_locks[DOMAIN_LOCKS] = {[0 ... DOMAIN_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER };   //!< serialize hypervisor calls on the same domain
+static pthread_mutex_t monitor_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< guards monitor_wakeup
+static pthread_mutex_t copy_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< serializes publishers of global_instances_copy
+static pthread_cond_t monitor_cond = PTHREAD_COND_INITIALIZER;  //!< signaled to wake the monitoring thread up early
+static boolean monitor_wakeup = FALSE; //!< set when something happened that the monitoring thread should look at
 static int stats_sensor_interval_sec;  //!< Keeps the current value for sensor interval. Set during init
 
 /*----------------------------------------------------------------------------*\
@@ -267,7 +334,22 @@ static int stats_sensor_interval_sec;  //!< Keeps the current value for sensor i
 \*----------------------------------------------------------------------------*/
 
 static void *libvirt_thread(void *ptr);
-static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance);
+static int libvirt_watchdog_run(libvirt_op op, virConnectPtr conn, const char *xml, int timeout_sec, virConnectPtr * new_conn);
+static void *libvirt_event_thread(void *ptr);
+static int start_libvirt_event_loop(void);
+static pthread_mutex_t *domain_lock(const char *instanceId);
+static int domain_event_callback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque);
+static void monitor_wake(void);
+static void monitor_wait(int seconds);
+static int domain_state_compare(const void *p1, const void *p2);
+static hypervisor_domains *get_hypervisor_domains(void);
+static void free_hypervisor_domains(hypervisor_domains ** ppDomains);
+static int disk_counters_compare(const void *p1, const void *p2);
+static disk_counters *read_disk_counters(int *pCount);
+static int collect_instance_stats(getstat *** pstats);
+static int get_domain_state(const char *instanceId, boolean * pFound, instance_states * pState);
+static void destroy_domain(const char *instanceId);
+static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance, hypervisor_domains * domains);
 static void update_log_params(void);
 static void update_ebs_params(void);
 static void nc_signal_handler(int sig);
@@ -277,8 +359,6 @@ static void printNCServiceStateInfo(void);
 static void printMsgServiceStateInfo(ncMetadata * pMeta);
 
 //! Helpers for internal stats handling in the NC
-static json_object **message_stats_getter();
-static void message_stats_setter();
 static int initialize_stats_system(int interval_sec);
 static void *nc_run_stats(void *ignored_arg);
 
@@ -340,21 +420,6 @@ static char *stats_service_state_call()
     }
 }
 
-//! Gets the reference to the stats json object, basically a no-op for the NC
-static json_object **message_stats_getter()
-{
-    LOGTRACE("Fetching latest message stats from shared memory\n");
-    return &stats_json;
-}
-
-//! Updates the stats json data, literally a No-op for the NC (as opposed to the CC)
-static void message_stats_setter()
-{
-    LOGTRACE("Updating latest message stats from shared memory\n");
-    //No-op
-    return;
-}
-
 void nc_lock_stats()
 {
     sem_p(stats_sem);
@@ -365,22 +430,10 @@ void nc_unlock_stats()
     sem_v(stats_sem);
 }
 
-//! Update the message stat structure
-//! Wraps the message stats update with the necessary caching copies and locking
+//! Update the message stat structure. The table is updated with atomic operations, so no lock is needed
 int nc_update_message_stats(const char *message_name, long call_time, int msg_failed)
 {
-    LOGTRACE("Updating message stats for message %s\n", message_name);
-
-    nc_lock_stats();
-    json_object **stats_state = message_stats_getter();
-
-    //Update the counters
-    update_message_stats(*stats_state, message_name, call_time, msg_failed);
-    message_stats_setter();
-
-    nc_unlock_stats();
-    LOGTRACE("Message stats update complete\n");
-    return EUCA_OK;
+    return update_message_stats(&stats_table, message_name, call_time, msg_failed);
 }
 
 //! Provides NC-specific initializations for the stats system of
@@ -395,15 +448,12 @@ static int initialize_stats_system(int interval_sec)
     nc_lock_stats();
     {
         //Init the message sensor with component-specific data
-        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, message_stats_getter, message_stats_setter);
+        ret = initialize_message_sensor(euca_this_component_name, interval_sec, stats_ttl, &stats_table);
         if (ret != EUCA_OK) {
             LOGERROR("Error initializing internal message sensor: %d\n", ret);
             goto cleanup;
         } else {
-            json_object **tmp = message_stats_getter();
-            const char *tmp_out = json_object_to_json_string(*tmp);
-            LOGINFO("Initialized internal message stats: %s\n", tmp_out);
-
+            LOGINFO("Initialized internal message stats\n");
         }
 
         //Init the service state sensor with component-specific data
@@ -413,6 +463,13 @@ static int initialize_stats_system(int interval_sec)
             goto cleanup;
         }
 
+        //Init the lock sensor, reporting the semaphores of this process
+        ret = initialize_lock_sensor(euca_this_component_name, interval_sec, stats_ttl, sem_get_lock_stats);
+        if (ret != EUCA_OK) {
+            LOGERROR("Error initializing internal lock sensor: %d\n", ret);
+            goto cleanup;
+        }
+
         ret = init_stats(nc_state.home, euca_this_component_name, nc_lock_stats, nc_unlock_stats);
         if (ret != EUCA_OK) {
             LOGERROR("Could not initialize CC stats system: %d\n", ret);
@@ -532,7 +589,7 @@ static void printNCServiceStateInfo(void)
 {
     int i = 0;
     //Don't bother if not at trace logging
-    if (log_level_get() <= EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         sem_p(service_state_sem);
         LOGTRACE("Printing %d services\n", nc_state.servicesLen);
         LOGTRACE("Epoch %d\n", nc_state.ncStatus.localEpoch);
@@ -564,7 +621,7 @@ static void printMsgServiceStateInfo(ncMetadata * pMeta)
 {
     int i = 0;
     //Don't bother if not at trace logging
-    if (log_level_get() <= EUCA_LOG_TRACE) {
+    if (LOG_ENABLED(EUCA_LOG_TRACE)) {
         LOGTRACE("Printing %d services\n", pMeta->servicesLen);
         LOGTRACE("Msg-Meta epoch %d\n", pMeta->epoch);
 
@@ -841,14 +898,14 @@ int update_disk_aliases(ncInstance * instance)
 //!
 void print_running_domains(void)
 {
+    int i = 0;
     ncInstance *instance = NULL;
-    bunchOfInstances *head = NULL;
     char buf[CHAR_BUFFER_SIZE] = "";
 
     sem_p(inst_sem);
     {
-        for (head = global_instances; head; head = head->next) {
-            instance = head->instance;
+        for (i = 0; i < total_instances(&global_instances); i++) {
+            instance = global_instances->instances[i];
             if (instance->state == STAGING || instance->state == BOOTING || instance->state == RUNNING || instance->state == BLOCKED || instance->state == PAUSED) {
                 strcat(buf, " ");
                 strcat(buf, instance->instanceId);
@@ -860,141 +917,400 @@ void print_running_domains(void)
 }
 
 //!
+//! Performs a libvirt call that may block indefinitely. Runs in its own
+//! thread so that the waiter in libvirt_watchdog_run() can give up on it,
+//! nudging it with SIGUSR1. If the waiter gave up, the thread cleans up
+//! after itself.
 //!
-//!
-//! @param[in] ptr
+//! @param[in] ptr a pointer to the libvirt_watchdog structure describing the call
 //!
 static void *libvirt_thread(void *ptr)
 {
     int rc = 0;
+    unsigned long version = 0;
+    boolean abandoned = FALSE;
     sigset_t mask = { {0} };
+    virDomainPtr dom = NULL;
+    libvirt_watchdog *w = ((libvirt_watchdog *) ptr);
 
     // allow SIGUSR1 signal to be delivered to this thread and its children
     sigemptyset(&mask);
     sigaddset(&mask, SIGUSR1);
     sigprocmask(SIG_UNBLOCK, &mask, NULL);
 
-    if (nc_state.conn) {
-        if ((rc = virConnectClose(nc_state.conn)) != 0) {
-            LOGDEBUG("refcount on close was non-zero: %d\n", rc);
+    switch (w->op) {
+    case LIBVIRT_OP_RECONNECT:
+        if (w->conn) {
+            if ((rc = virConnectClose(w->conn)) != 0) {
+                LOGDEBUG("refcount on close was non-zero: %d\n", rc);
+            }
         }
+        if ((w->conn = virConnectOpen(nc_state.uri)) != NULL) {
+            // with the event loop running, libvirt will notice a dead or wedged
+            // daemon on its own and mark the connection as no longer alive
+            if (libvirt_event_loop && (virConnectSetKeepAlive(w->conn, LIBVIRT_KEEPALIVE_INTERVAL_SEC, LIBVIRT_KEEPALIVE_COUNT) < 0)) {
+                LOGWARN("failed to enable keepalive on hypervisor connection\n");
+            }
+        }
+        w->rc = ((w->conn == NULL) ? -1 : 0);
+        break;
+    case LIBVIRT_OP_PROBE:
+        w->rc = virConnectGetLibVersion(w->conn, &version);
+        virConnectClose(w->conn);      // drops the reference taken by the waiter
+        w->conn = NULL;
+        break;
+    case LIBVIRT_OP_CREATE:
+        dom = virDomainCreateLinux(w->conn, w->xml, 0);
+        w->rc = ((dom == NULL) ? -1 : 0);
+        break;
+    default:
+        w->rc = -1;
+        break;
+    }
+
+    // the waiter only frees 'w' after joining this thread, so it stays valid past 'done'
+    pthread_mutex_lock(&libvirt_watchdog_mutex);
+    {
+        if ((abandoned = w->abandoned) == FALSE)
+            w->done = TRUE;
+    }
+    pthread_mutex_unlock(&libvirt_watchdog_mutex);
+
+    if (dom != NULL) {
+        // The waiter gave up on this create and the instance has since been retried or shut
+        // off, so a domain that came up this late is owned by no one. Take it down again.
+        if (abandoned) {
+            LOGWARN("[%s] destroying domain created after the hypervisor call was abandoned\n", virDomainGetName(dom));
+            if (virDomainDestroy(dom) != 0)
+                LOGERROR("[%s] failed to destroy late domain, it must be terminated by hand\n", virDomainGetName(dom));
+        }
+        virDomainFree(dom);
+    }
+
+    if (w->op == LIBVIRT_OP_CREATE) {
+        virConnectClose(w->conn);      // drops the reference taken by the waiter
+        w->conn = NULL;
+    }
+
+    if (abandoned) {
+        if (w->conn)
+            virConnectClose(w->conn);
+        EUCA_FREE(w->xml);
+        EUCA_FREE(w);
     }
-    nc_state.conn = virConnectOpen(nc_state.uri);
     return (NULL);
 }
 
 //!
-//! Checks and reset the hypervisor connection.
+//! Runs a libvirt operation in a watchdog thread and abandons it, waking the
+//! thread up with SIGUSR1, once timeout_sec have passed, so that a hung libvirtd
+//! fails the operation rather than blocking the whole NC. Until then a slow
+//! operation is only reported, once with a warning and then at DEBUG level.
 //!
-//! @return a pointer to the hypervisor connection structure or NULL if we failed.
+//! @param[in]  op the operation to perform
+//! @param[in]  conn the connection to use or to close (ownership of this reference passes to the operation)
+//! @param[in]  xml the domain XML for LIBVIRT_OP_CREATE (may be NULL for other ops)
+//! @param[in]  timeout_sec how long to wait for the operation before abandoning it
+//! @param[out] new_conn set to the new connection for LIBVIRT_OP_RECONNECT (may be NULL for other ops)
 //!
-virConnectPtr lock_hypervisor_conn()
+//! @return EUCA_OK if the operation completed and succeeded, EUCA_TIMEOUT_ERROR if it was
+//!         abandoned, or EUCA_ERROR otherwise
+//!
+static int libvirt_watchdog_run(libvirt_op op, virConnectPtr conn, const char *xml, int timeout_sec, virConnectPtr * new_conn)
 {
     int rc = 0;
-    int status = 0;
-    pid_t cpid = 0;
+    int ret = EUCA_ERROR;
+    boolean slow = FALSE;
+    boolean abandoned = FALSE;
     pthread_t thread = { 0 };
-    long long thread_par = 0L;
-    boolean bail = FALSE;
     struct timespec ts = { 0 };
-    virConnectPtr tmp_conn = NULL;
+    struct timespec deadline = { 0 };
+    libvirt_watchdog *w = NULL;
 
-    // Acquire our hypervisor semaphore
-    sem_p(hyp_sem);
+    if (new_conn)
+        *new_conn = NULL;
 
-    if (call_hooks(NC_EVENT_PRE_HYP_CHECK, nc_state.home)) {
-        LOGFATAL("hooks prevented check on the hypervisor\n");
-        sem_v(hyp_sem);
-        return NULL;
+    if ((w = EUCA_ZALLOC(1, sizeof(libvirt_watchdog))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (EUCA_MEMORY_ERROR);
     }
-    // Fork off a process just to open and immediately close a libvirt connection.
-    // The purpose is to try to identify periods when open or close calls block indefinitely.
-    // Success in the child process does not guarantee success in the parent process, but
-    // hopefully it will flag certain bad conditions and will allow the parent to avoid them.
-
-    if ((cpid = fork()) < 0) {         // fork error
-        LOGERROR("failed to fork to check hypervisor connection\n");
-        bail = TRUE;                   // we are in big trouble if we cannot fork
-    } else if (cpid == 0) {            // child process - checks on the connection
-        if ((tmp_conn = virConnectOpen(nc_state.uri)) == NULL)
-            exit(1);
-        virConnectClose(tmp_conn);
-        exit(0);
-    } else {                           // parent process - waits for the child, kills it if necessary
-        if ((rc = timewait(cpid, &status, LIBVIRT_TIMEOUT_SEC)) < 0) {
-            LOGERROR("failed to wait for forked process: %s\n", strerror(errno));
-            bail = TRUE;
-        } else if (rc == 0) {
-            LOGERROR("timed out waiting for hypervisor checker pid=%d\n", cpid);
-            bail = TRUE;
-        } else if (WEXITSTATUS(status) != 0) {
-            LOGERROR("child process failed to connect to hypervisor\n");
-            bail = TRUE;
-        }
-        // terminate the child, if any
-        killwait(cpid);
-    }
-
-    if (bail) {
-        sem_v(hyp_sem);
-        return NULL;                   // better fail the operation than block the whole NC
+    w->op = op;
+    w->conn = conn;
+    if (xml && ((w->xml = strdup(xml)) == NULL)) {
+        LOGERROR("out of memory\n");
+        if (conn)
+            virConnectClose(conn);
+        EUCA_FREE(w);
+        return (EUCA_MEMORY_ERROR);
     }
-    LOGTRACE("process check for libvirt succeeded\n");
 
-    // At this point, the check for libvirt done in a separate process was
-    // successful, so we proceed to close and reopen the connection in a
-    // separate thread, which we will try to wake up with SIGUSR1 if it
-    // blocks for too long (as a last-resource effort). The reason we reset
-    // the connection so often is because libvirt operations have a
-    // tendency to block indefinitely if we do not do this.
+    if (pthread_create(&thread, NULL, libvirt_thread, ((void *)w)) != 0) {
+        LOGERROR("failed to create the libvirt watchdog thread\n");
+        if (conn)
+            virConnectClose(conn);     // drops the caller's reference or closes the replaced connection
+        EUCA_FREE(w->xml);
+        EUCA_FREE(w);
+        return (EUCA_ERROR);
+    }
 
-    if (pthread_create(&thread, NULL, libvirt_thread, (void *)&thread_par) != 0) {
-        LOGERROR("failed to create the libvirt refreshing thread\n");
-        bail = TRUE;
-    } else {
-        for (;;) {
-            if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
-                LOGERROR("failed to obtain time\n");
-                bail = TRUE;
-                break;
+    if (clock_gettime(CLOCK_REALTIME, &deadline) == -1) {
+        LOGERROR("failed to obtain time\n");
+        deadline.tv_sec = time(NULL);
+        deadline.tv_nsec = 0;
+    }
+    deadline.tv_sec += timeout_sec;
+
+    for (;;) {
+        if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+            ts.tv_sec = time(NULL);
+            ts.tv_nsec = 0;
+        }
+
+        // wake up every LIBVIRT_TIMEOUT_SEC to report progress, but never past the deadline
+        ts.tv_sec += LIBVIRT_TIMEOUT_SEC;
+        if ((ts.tv_sec > deadline.tv_sec) || ((ts.tv_sec == deadline.tv_sec) && (ts.tv_nsec > deadline.tv_nsec)))
+            ts = deadline;
+
+        if ((rc = pthread_timedjoin_np(thread, NULL, &ts)) == 0)
+            break;                     // thread finished
+
+        if ((rc == ETIMEDOUT) && ((ts.tv_sec < deadline.tv_sec) || ((ts.tv_sec == deadline.tv_sec) && (ts.tv_nsec < deadline.tv_nsec)))) {
+            if (!slow) {
+                LOGWARN("libvirt call is taking over %d seconds, will wait up to %d seconds\n", LIBVIRT_TIMEOUT_SEC, timeout_sec);
+                slow = TRUE;
+            } else {
+                LOGDEBUG("still waiting for libvirt watchdog thread (%ld of %d seconds left)\n", (long)(deadline.tv_sec - ts.tv_sec), timeout_sec);
             }
+            continue;
+        }
 
-            ts.tv_sec += LIBVIRT_TIMEOUT_SEC;
-            if ((rc = pthread_timedjoin_np(thread, NULL, &ts)) == 0)
-                break;                 // all is well
+        if (rc != ETIMEDOUT)
+            LOGERROR("failed to wait for libvirt watchdog thread (rc=%d)\n", rc);
 
-            if (rc != ETIMEDOUT) {     // error other than timeout
-                LOGERROR("failed to wait for libvirt refreshing thread (rc=%d)\n", rc);
-                bail = TRUE;
-                break;
+        // give up on the thread unless it finished in the meantime
+        pthread_mutex_lock(&libvirt_watchdog_mutex);
+        {
+            if (!w->done) {
+                w->abandoned = abandoned = TRUE;
             }
+        }
+        pthread_mutex_unlock(&libvirt_watchdog_mutex);
 
-            LOGERROR("timed out on libvirt refreshing thread\n");
+        if (abandoned) {
+            LOGERROR("abandoning libvirt watchdog thread stuck for over %d seconds\n", timeout_sec);
             pthread_kill(thread, SIGUSR1);
+            pthread_detach(thread);
+            return (EUCA_TIMEOUT_ERROR);   // the thread now owns and will free 'w'
+        }
+        pthread_join(thread, NULL);
+        break;
+    }
+
+    if (w->rc == 0)
+        ret = EUCA_OK;
+
+    if (new_conn)
+        *new_conn = w->conn;
+    else if (w->conn)
+        virConnectClose(w->conn);
+    EUCA_FREE(w->xml);
+    EUCA_FREE(w);
+    return (ret);
+}
+
+//!
+//! Drives the default libvirt event loop, which services keepalive
+//! messages on the hypervisor connection.
+//!
+//! @param[in] ptr unused
+//!
+static void *libvirt_event_thread(void *ptr)
+{
+    for (;;) {
+        if (virEventRunDefaultImpl() < 0) {
+            LOGWARN("failed to run an iteration of the libvirt event loop\n");
             sleep(1);
         }
     }
+    return (NULL);
+}
 
-    if (bail) {
-        sem_v(hyp_sem);
-        return NULL;
+//!
+//! Registers and starts the default libvirt event loop. Must be called
+//! before the first connection to the hypervisor is opened. Failure is
+//! not fatal: without the loop there is no keepalive and liveness of the
+//! connection rests on the periodic probes in lock_hypervisor_conn().
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int start_libvirt_event_loop(void)
+{
+    pthread_t tcb = { 0 };
+
+    if (libvirt_event_loop)
+        return (EUCA_OK);
+
+    if (virEventRegisterDefaultImpl() < 0) {
+        LOGWARN("failed to register the libvirt event loop, hypervisor keepalive is disabled\n");
+        return (EUCA_ERROR);
     }
-    LOGTRACE("thread check for libvirt succeeded\n");
 
-    if (nc_state.conn == NULL) {
-        LOGERROR("failed to connect to %s\n", nc_state.uri);
-        sem_v(hyp_sem);
+    if (pthread_create(&tcb, NULL, libvirt_event_thread, NULL) != 0) {
+        LOGWARN("failed to spawn the libvirt event thread, hypervisor keepalive is disabled\n");
+        return (EUCA_ERROR);
+    }
+    pthread_detach(tcb);
+
+    libvirt_event_loop = TRUE;
+    return (EUCA_OK);
+}
+
+//!
+//! Acquires the hypervisor connection, checking on its health first. The
+//! connection is kept open across calls: virConnectIsAlive() is consulted
+//! on every call (it does not talk to the daemon), a round-trip probe is
+//! made every LIBVIRT_PROBE_INTERVAL_SEC, and the connection is reopened
+//! only when either of these says it is broken. The probe and the reopen
+//! run under a watchdog so that a hung libvirtd cannot block the NC.
+//!
+//! The connection is shared: any number of threads may hold it at once,
+//! each with its own reference, so a reconnect does not pull it out from
+//! under a call in progress. Use lock_domain_conn() to also serialize
+//! with other callers operating on the same domain.
+//!
+//! @return a pointer to the hypervisor connection structure or NULL if we failed.
+//!         On success, the caller must release it with unlock_hypervisor_conn().
+//!
+virConnectPtr lock_hypervisor_conn()
+{
+    int rc = 0;
+    time_t now = 0;
+    virConnectPtr conn = NULL;
+
+    // nested calls in the same thread share the reference taken by the outermost one
+    if (thread_conn_depth > 0) {
+        thread_conn_depth++;
+        return (thread_conn);
+    }
+
+    if (call_hooks(NC_EVENT_PRE_HYP_CHECK, nc_state.home)) {
+        LOGFATAL("hooks prevented check on the hypervisor\n");
         return NULL;
     }
-    return nc_state.conn;
+
+    pthread_mutex_lock(&libvirt_conn_mutex);
+
+    if (nc_state.conn) {
+        if (virConnectIsAlive(nc_state.conn) == 1) {
+            now = time(NULL);
+            if ((now - libvirt_last_probe) < LIBVIRT_PROBE_INTERVAL_SEC)
+                goto done;             // the common case: nothing to do
+
+            // the probe thread gets its own reference, so that the connection
+            // survives a reconnect below even if the probe gets abandoned
+            virConnectRef(nc_state.conn);
+            if ((rc = libvirt_watchdog_run(LIBVIRT_OP_PROBE, nc_state.conn, NULL, (LIBVIRT_TIMEOUT_SEC * LIBVIRT_WATCHDOG_TRIES), NULL)) == EUCA_OK) {
+                libvirt_last_probe = now;
+                LOGTRACE("libvirt connection probe succeeded\n");
+                goto done;
+            }
+            LOGWARN("hypervisor connection failed a liveness probe (rc=%d), reconnecting\n", rc);
+        } else {
+            LOGWARN("hypervisor connection is no longer alive, reconnecting\n");
+        }
+    }
+
+    // Open a new connection (closing the old one, if any) under the watchdog.
+    // Ownership of the old connection passes to the watchdog thread; threads
+    // still using it hold their own references.
+    conn = nc_state.conn;
+    nc_state.conn = NULL;
+    if ((rc = libvirt_watchdog_run(LIBVIRT_OP_RECONNECT, conn, NULL, (LIBVIRT_TIMEOUT_SEC * LIBVIRT_WATCHDOG_TRIES), &conn)) != EUCA_OK) {
+        LOGERROR("failed to connect to %s (rc=%d)\n", nc_state.uri, rc);
+        pthread_mutex_unlock(&libvirt_conn_mutex);
+        return NULL;                   // better fail the operation than block the whole NC
+    }
+
+    LOGDEBUG("connected to hypervisor at %s\n", nc_state.uri);
+    if (libvirt_event_loop) {
+        // lifecycle events let the monitoring thread react to state changes right away;
+        // the registration goes away with the connection, so it is redone on every reconnect
+        if (virConnectDomainEventRegisterAny(conn, NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE, VIR_DOMAIN_EVENT_CALLBACK(domain_event_callback), NULL, NULL) < 0) {
+            LOGWARN("failed to subscribe to domain lifecycle events, relying on polling\n");
+        }
+    }
+    nc_state.conn = conn;
+    libvirt_last_probe = time(NULL);
+
+done:
+    virConnectRef(nc_state.conn);
+    thread_conn = nc_state.conn;
+    thread_conn_depth = 1;
+    pthread_mutex_unlock(&libvirt_conn_mutex);
+    return (thread_conn);
 }
 
 //!
-//! Closes the connection with the hypervisor
+//! Releases the reference to the hypervisor connection taken by
+//! lock_hypervisor_conn()
 //!
 void unlock_hypervisor_conn()
 {
-    sem_v(hyp_sem);
+    if (thread_conn_depth <= 0) {
+        LOGWARN("hypervisor connection released without being acquired\n");
+        return;
+    }
+
+    if (--thread_conn_depth == 0) {
+        virConnectClose(thread_conn);
+        thread_conn = NULL;
+    }
+}
+
+//!
+//! Picks the lock that serializes hypervisor calls on a given domain
+//!
+//! @param[in] instanceId the name of the domain
+//!
+//! @return a pointer to one of the domain_locks
+//!
+static pthread_mutex_t *domain_lock(const char *instanceId)
+{
+    return (&domain_locks[jenkins(instanceId, strlen(instanceId)) % DOMAIN_LOCKS]);
+}
+
+//!
+//! Acquires the hypervisor connection for calls on a single domain. Calls
+//! on the same domain are serialized, while calls on different domains
+//! proceed in parallel (the locks are striped, so unrelated domains may
+//! occasionally share one). Must not be nested.
+//!
+//! @param[in] instanceId the name of the domain
+//!
+//! @return a pointer to the hypervisor connection structure or NULL if we failed.
+//!         On success, the caller must release it with unlock_domain_conn().
+//!
+virConnectPtr lock_domain_conn(const char *instanceId)
+{
+    virConnectPtr conn = NULL;
+
+    pthread_mutex_lock(domain_lock(instanceId));
+    if ((conn = lock_hypervisor_conn()) == NULL) {
+        pthread_mutex_unlock(domain_lock(instanceId));
+        return (NULL);
+    }
+    return (conn);
+}
+
+//!
+//! Releases the hypervisor connection acquired with lock_domain_conn()
+//!
+//! @param[in] instanceId the name of the domain, as passed to lock_domain_conn()
+//!
+void unlock_domain_conn(const char *instanceId)
+{
+    unlock_hypervisor_conn();
+    pthread_mutex_unlock(domain_lock(instanceId));
 }
 
 //!
@@ -1075,6 +1391,464 @@ int wait_state_transition(ncInstance * instance, instance_states from_state, ins
     return (EUCA_ERROR);
 }
 
+//!
+//! Libvirt domain lifecycle event handler. Runs in the libvirt event loop
+//! thread, so it only notes the event and wakes up the monitoring thread,
+//! which then refreshes all instances.
+//!
+//! @param[in] conn the connection the event arrived on
+//! @param[in] dom the domain the event is about
+//! @param[in] event the virDomainEventType of the event
+//! @param[in] detail event-specific detail code
+//! @param[in] opaque unused
+//!
+//! @return Always return 0
+//!
+static int domain_event_callback(virConnectPtr conn, virDomainPtr dom, int event, int detail, void *opaque)
+{
+    const char *name = virDomainGetName(dom);
+
+    LOGDEBUG("[%s] hypervisor reported lifecycle event %d (detail %d)\n", SP(name), event, detail);
+    if (event != VIR_DOMAIN_EVENT_DEFINED)
+        monitor_wake();
+    return (0);
+}
+
+//!
+//! Wakes up the monitoring thread if it is sleeping between passes, or
+//! makes its next sleep return right away if it is not.
+//!
+static void monitor_wake(void)
+{
+    pthread_mutex_lock(&monitor_mutex);
+    {
+        monitor_wakeup = TRUE;
+        pthread_cond_signal(&monitor_cond);
+    }
+    pthread_mutex_unlock(&monitor_mutex);
+}
+
+//!
+//! Sleeps between monitoring passes until the time is up or until
+//! monitor_wake() is called, whichever comes first.
+//!
+//! @param[in] seconds maximum number of seconds to sleep
+//!
+static void monitor_wait(int seconds)
+{
+    struct timespec ts = { 0 };
+
+    if (clock_gettime(CLOCK_REALTIME, &ts) == -1) {
+        sleep(seconds);
+        return;
+    }
+    ts.tv_sec += seconds;
+
+    pthread_mutex_lock(&monitor_mutex);
+    {
+        while (!monitor_wakeup) {
+            if (pthread_cond_timedwait(&monitor_cond, &monitor_mutex, &ts) == ETIMEDOUT)
+                break;
+        }
+        monitor_wakeup = FALSE;
+    }
+    pthread_mutex_unlock(&monitor_mutex);
+}
+
+//!
+//! Compares two domain states by name, for qsort() and bsearch()
+//!
+//! @param[in] p1 a pointer to the first domain_state
+//! @param[in] p2 a pointer to the second domain_state
+//!
+//! @return the result of strcmp() on the names
+//!
+static int domain_state_compare(const void *p1, const void *p2)
+{
+    return (strcmp(((const domain_state *)p1)->name, ((const domain_state *)p2)->name));
+}
+
+//!
+//! Fetches the states of all domains on the hypervisor with a single
+//! bulk call, rather than a lookup and an info call per instance.
+//!
+//! @return a snapshot of domain states, to be freed with free_hypervisor_domains(),
+//!         or NULL if the hypervisor could not be queried in bulk
+//!
+static hypervisor_domains *get_hypervisor_domains(void)
+{
+    int i = 0;
+    int j = 0;
+    int count = 0;
+    const char *name = NULL;
+    virConnectPtr conn = NULL;
+    hypervisor_domains *domains = NULL;
+
+    if ((domains = EUCA_ZALLOC(1, sizeof(hypervisor_domains))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (NULL);
+    }
+
+    if ((conn = lock_hypervisor_conn()) == NULL) {
+        EUCA_FREE(domains);
+        return (NULL);
+    }
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    {
+        virDomainStatsRecordPtr *records = NULL;
+
+        // one round-trip for the state of every domain
+        if ((count = virConnectGetAllDomainStats(conn, VIR_DOMAIN_STATS_STATE, &records, 0)) >= 0) {
+            if ((count > 0) && ((domains->domains = EUCA_ZALLOC(count, sizeof(domain_state))) == NULL)) {
+                LOGERROR("out of memory\n");
+                virDomainStatsRecordListFree(records);
+                unlock_hypervisor_conn();
+                EUCA_FREE(domains);
+                return (NULL);
+            }
+
+            for (i = 0; i < count; i++) {
+                if ((name = virDomainGetName(records[i]->dom)) == NULL)
+                    continue;
+                euca_strncpy(domains->domains[domains->count].name, name, CHAR_BUFFER_SIZE);
+                domains->domains[domains->count].state = VIR_DOMAIN_NOSTATE;
+                for (j = 0; j < records[i]->nparams; j++) {
+                    if (!strcmp(records[i]->params[j].field, "state.state") && (records[i]->params[j].type == VIR_TYPED_PARAM_INT)) {
+                        domains->domains[domains->count].state = records[i]->params[j].value.i;
+                        break;
+                    }
+                }
+                domains->count++;
+            }
+            virDomainStatsRecordListFree(records);
+        }
+    }
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+
+    if (count < 0) {
+        virDomainPtr *doms = NULL;
+        virDomainInfo info = { 0 };
+
+        // older libvirt or daemon: list all domains at once, then get info for each
+        if ((count = virConnectListAllDomains(conn, &doms, 0)) < 0) {
+            LOGWARN("failed to list domains on the hypervisor, falling back to per-instance lookups\n");
+            unlock_hypervisor_conn();
+            EUCA_FREE(domains);
+            return (NULL);
+        }
+
+        if ((count > 0) && ((domains->domains = EUCA_ZALLOC(count, sizeof(domain_state))) == NULL)) {
+            LOGERROR("out of memory\n");
+            for (i = 0; i < count; i++)
+                virDomainFree(doms[i]);
+            EUCA_FREE(doms);
+            unlock_hypervisor_conn();
+            EUCA_FREE(domains);
+            return (NULL);
+        }
+
+        for (i = 0; i < count; i++) {
+            if ((name = virDomainGetName(doms[i])) != NULL) {
+                euca_strncpy(domains->domains[domains->count].name, name, CHAR_BUFFER_SIZE);
+                if (virDomainGetInfo(doms[i], &info) < 0)
+                    info.state = VIR_DOMAIN_NOSTATE;
+                domains->domains[domains->count].state = info.state;
+                domains->count++;
+            }
+            virDomainFree(doms[i]);
+        }
+        EUCA_FREE(doms);
+    }
+    unlock_hypervisor_conn();
+
+    qsort(domains->domains, domains->count, sizeof(domain_state), domain_state_compare);
+    return (domains);
+}
+
+//!
+//! Frees a snapshot of domain states returned by get_hypervisor_domains()
+//!
+//! @param[in,out] ppDomains a pointer to the snapshot pointer, which is set to NULL
+//!
+static void free_hypervisor_domains(hypervisor_domains ** ppDomains)
+{
+    if (ppDomains && *ppDomains) {
+        EUCA_FREE((*ppDomains)->domains);
+        EUCA_FREE(*ppDomains);
+    }
+}
+
+//!
+//! Compares two block device counters by device name, for qsort() and bsearch()
+//!
+//! @param[in] p1 pointer to the first disk_counters
+//! @param[in] p2 pointer to the second disk_counters
+//!
+//! @return the result of strcmp() on the device names
+//!
+static int disk_counters_compare(const void *p1, const void *p2)
+{
+    return (strcmp(((const disk_counters *)p1)->name, ((const disk_counters *)p2)->name));
+}
+
+//!
+//! Reads the counters of all block devices from /proc/diskstats in one go
+//!
+//! @param[out] pCount set to the number of entries in the returned array
+//!
+//! @return an array of counters sorted by device name, to be freed by the caller, or NULL
+//!
+static disk_counters *read_disk_counters(int *pCount)
+{
+    int count = 0;
+    int size = 0;
+    FILE *fp = NULL;
+    char line[1024] = "";
+    disk_counters d = { {0} };
+    disk_counters *disks = NULL;
+    disk_counters *tmp = NULL;
+    unsigned int major = 0;
+    unsigned int minor = 0;
+    unsigned long long readsMerged = 0;
+    unsigned long long writesMerged = 0;
+
+    *pCount = 0;
+    if ((fp = fopen("/proc/diskstats", "r")) == NULL) {
+        LOGWARN("failed to open /proc/diskstats: %s\n", strerror(errno));
+        return (NULL);
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        // see Documentation/iostats.txt in the kernel tree for the meaning of the fields
+        if (sscanf(line, " %u %u %127s %llu %llu %llu %llu %llu %llu %llu %llu %llu", &major, &minor, d.name, &d.readOps, &readsMerged, &d.readSectors,
+                   &d.readMs, &d.writeOps, &writesMerged, &d.writeSectors, &d.writeMs, &d.iosInProgress) != 12)
+            continue;
+
+        if (count == size) {
+            size = ((size == 0) ? 64 : (size * 2));
+            if ((tmp = EUCA_REALLOC(disks, size, sizeof(disk_counters))) == NULL) {
+                LOGERROR("out of memory\n");
+                EUCA_FREE(disks);
+                fclose(fp);
+                return (NULL);
+            }
+            disks = tmp;
+        }
+        disks[count++] = d;
+    }
+    fclose(fp);
+
+    if (count > 1)
+        qsort(disks, count, sizeof(disk_counters), disk_counters_compare);
+    *pCount = count;
+    return (disks);
+}
+
+//!
+//! Collects the CPU, network and disk counters of all running domains for
+//! the sensor subsystem, producing the same records as getstats.pl did but
+//! without a subprocess: one libvirt bulk-stats call covers every domain
+//! and /proc/diskstats is read once per pass.
+//!
+//! @param[in,out] pstats set of stats to append to (see sensor_add_stat())
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int collect_instance_stats(getstat *** pstats)
+{
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    int n = 0;
+    int ret = EUCA_OK;
+    int count = 0;
+    int ndisks = 0;
+    char *output = NULL;
+    char cmd[EUCA_MAX_PATH] = "";
+    char path[EUCA_MAX_PATH] = "";
+    char resolved[PATH_MAX] = "";
+    const char *name = NULL;
+    const char *field = NULL;
+    long long ts = 0;
+    long long disk_ts = 0;
+    double rx = 0;
+    double tx = 0;
+    boolean haveCpu = FALSE;
+    unsigned long long cpuTime = 0;
+    disk_counters key = { {0} };
+    disk_counters *disk = NULL;
+    disk_counters *disks = NULL;
+    virConnectPtr conn = NULL;
+    virTypedParameterPtr param = NULL;
+    virDomainStatsRecordPtr *records = NULL;
+
+#if LIBVIR_VERSION_NUMBER >= 1002008
+    disks = read_disk_counters(&ndisks);
+    disk_ts = time_ms();               // the moment the disk counters were taken
+
+    if ((conn = lock_hypervisor_conn()) == NULL) {
+        EUCA_FREE(disks);
+        return (EUCA_ERROR);
+    }
+    count = virConnectGetAllDomainStats(conn, (VIR_DOMAIN_STATS_CPU_TOTAL | VIR_DOMAIN_STATS_INTERFACE | VIR_DOMAIN_STATS_BLOCK), &records,
+                                        VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+    unlock_hypervisor_conn();
+    ts = time_ms();
+
+    if (count < 0) {
+        // e.g., a hypervisor driver without bulk stats: let the script do it
+        EUCA_FREE(disks);
+        if ((output = system_output("euca_rootwrap getstats.pl")) == NULL) {
+            LOGWARN("failed to invoke getstats for sensor data (%s)\n", strerror(errno));
+            return (EUCA_ERROR);
+        }
+        ret = sensor_parse_stats(output, pstats);
+        EUCA_FREE(output);
+        return (ret);
+    }
+
+    for (i = 0; (i < count) && (ret == EUCA_OK); i++) {
+        if ((name = virDomainGetName(records[i]->dom)) == NULL)
+            continue;
+
+        haveCpu = FALSE;
+        rx = tx = 0;
+        for (j = 0; j < records[i]->nparams; j++) {
+            param = &(records[i]->params[j]);
+            field = param->field;
+            if (param->type != VIR_TYPED_PARAM_ULLONG)
+                continue;
+
+            if (!strcmp(field, "cpu.time")) {
+                cpuTime = param->value.ul;
+                haveCpu = TRUE;
+            } else if (!strncmp(field, "net.", 4) && (sscanf(field, "net.%d.", &n) == 1)) {
+                if ((field = strchr(field + 4, '.')) == NULL)
+                    continue;
+                if (!strcmp(field, ".rx.bytes"))
+                    rx += param->value.ul;
+                else if (!strcmp(field, ".tx.bytes"))
+                    tx += param->value.ul;
+            }
+        }
+
+        // nanoseconds of CPU time used by the domain since it booted, reported in milliseconds
+        if (haveCpu)
+            ret |= sensor_add_stat(pstats, name, ts, "CPUUtilization", SENSOR_SUMMATION, "default", (cpuTime / 1000000.0));
+        ret |= sensor_add_stat(pstats, name, ts, "NetworkIn", SENSOR_SUMMATION, "total", rx);
+        ret |= sensor_add_stat(pstats, name, ts, "NetworkOut", SENSOR_SUMMATION, "total", tx);
+
+        // block.N.name is the guest device and block.N.path is its source on the host,
+        // only sources that resolve to a host block device have counters in /proc/diskstats
+        for (j = 0; (j < records[i]->nparams) && (disks != NULL); j++) {
+            field = records[i]->params[j].field;
+            if ((records[i]->params[j].type != VIR_TYPED_PARAM_STRING) || strncmp(field, "block.", 6) || (sscanf(field, "block.%d.", &n) != 1) || ((field = strchr(field + 6, '.')) == NULL) || strcmp(field, ".name"))
+                continue;
+
+            snprintf(path, sizeof(path), "block.%d.path", n);
+            for (k = 0, field = NULL; (k < records[i]->nparams) && (field == NULL); k++) {
+                if ((records[i]->params[k].type == VIR_TYPED_PARAM_STRING) && !strcmp(records[i]->params[k].field, path))
+                    field = records[i]->params[k].value.s;
+            }
+
+            if ((field == NULL) || (realpath(field, resolved) == NULL) || strncmp(resolved, "/dev/", 5))
+                continue;
+
+            euca_strncpy(key.name, (resolved + 5), sizeof(key.name));
+            if ((disk = bsearch(&key, disks, ndisks, sizeof(disk_counters), disk_counters_compare)) == NULL)
+                continue;
+
+            field = records[i]->params[j].value.s;
+            ret |= sensor_add_stat(pstats, name, disk_ts, "DiskReadOps", SENSOR_SUMMATION, field, disk->readOps);
+            ret |= sensor_add_stat(pstats, name, disk_ts, "DiskWriteOps", SENSOR_SUMMATION, field, disk->writeOps);
+            ret |= sensor_add_stat(pstats, name, disk_ts, "DiskReadBytes", SENSOR_SUMMATION, field, (disk->readSectors * 512.0));
+            ret |= sensor_add_stat(pstats, name, disk_ts, "DiskWriteBytes", SENSOR_SUMMATION, field, (disk->writeSectors * 512.0));
+            ret |= sensor_add_stat(pstats, name, disk_ts, "VolumeTotalReadTime", SENSOR_SUMMATION, field, (disk->readMs / 1000.0));
+            ret |= sensor_add_stat(pstats, name, disk_ts, "VolumeTotalWriteTime", SENSOR_SUMMATION, field, (disk->writeMs / 1000.0));
+            ret |= sensor_add_stat(pstats, name, disk_ts, "VolumeQueueLength", SENSOR_LATEST, field, disk->iosInProgress);
+        }
+    }
+    virDomainStatsRecordListFree(records);
+    EUCA_FREE(disks);
+
+    if (ret != EUCA_OK) {
+        LOGERROR("failed to record sensor data\n");
+        return (EUCA_ERROR);
+    }
+    // per-instance network counters live in iptables chains that eucanetd only sets up in EDGE mode
+    if ((nc_state.pEucaNet != NULL) && !strcmp(nc_state.pEucaNet->sMode, NETMODE_EDGE)) {
+        snprintf(path, sizeof(path), EUCALYPTUS_DATA_DIR "/getstats_net.pl", nc_state.home);
+        if (access(path, X_OK) == 0) {
+            snprintf(cmd, sizeof(cmd), "%s %s", nc_state.rootwrap_cmd_path, path);
+            if ((output = system_output(cmd)) != NULL) {
+                ret = sensor_parse_stats(output, pstats);
+                EUCA_FREE(output);
+            }
+        }
+    }
+    return (ret);
+#else /* LIBVIR_VERSION_NUMBER >= 1002008 */
+    if ((output = system_output("euca_rootwrap getstats.pl")) == NULL) {
+        LOGWARN("failed to invoke getstats for sensor data (%s)\n", strerror(errno));
+        return (EUCA_ERROR);
+    }
+    ret = sensor_parse_stats(output, pstats);
+    EUCA_FREE(output);
+    return (ret);
+#endif /* LIBVIR_VERSION_NUMBER >= 1002008 */
+}
+
+//!
+//! Looks up the state of a single domain on the hypervisor
+//!
+//! @param[in]  instanceId the name of the domain
+//! @param[out] pFound set to TRUE if the hypervisor knows about the domain
+//! @param[out] pState set to the state of the domain, or NO_STATE if it could not be determined
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the hypervisor could not be contacted
+//!
+static int get_domain_state(const char *instanceId, boolean * pFound, instance_states * pState)
+{
+    virDomainPtr dom = NULL;
+    virConnectPtr conn = NULL;
+    virDomainInfo info = { 0 };
+
+    *pFound = FALSE;
+    *pState = NO_STATE;
+
+    if ((conn = lock_hypervisor_conn()) == NULL)
+        return (EUCA_ERROR);
+
+    if ((dom = virDomainLookupByName(conn, instanceId)) != NULL) {
+        *pFound = TRUE;
+        if (virDomainGetInfo(dom, &info) == 0)
+            *pState = info.state;
+        virDomainFree(dom);
+    }
+    unlock_hypervisor_conn();
+    return (EUCA_OK);
+}
+
+//!
+//! Destroys a domain on the hypervisor, if it exists
+//!
+//! @param[in] instanceId the name of the domain
+//!
+static void destroy_domain(const char *instanceId)
+{
+    virDomainPtr dom = NULL;
+    virConnectPtr conn = NULL;
+
+    if ((conn = lock_hypervisor_conn()) == NULL)
+        return;
+
+    if ((dom = virDomainLookupByName(conn, instanceId)) != NULL) {
+        virDomainDestroy(dom);
+        virDomainFree(dom);
+    }
+    unlock_hypervisor_conn();
+}
+
 //!
 //! Refresh instance information.
 //!
@@ -1082,13 +1856,16 @@ int wait_state_transition(ncInstance * instance, instance_states from_state, ins
 //!
 //! @param[in] nc a pointer to the global NC state structure.
 //! @param[in] instance a pointer to the instance being refreshed
+//! @param[in] domains snapshot of all domain states from get_hypervisor_domains(), or NULL
+//!                    to look the domain up on the hypervisor individually
 //!
-static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
+static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance, hypervisor_domains * domains)
 {
-    int error = 0;
     int rc = 0;
     char *ip = NULL;
-    virDomainInfo info = { 0 };
+    boolean found = FALSE;
+    domain_state key = { {0} };
+    domain_state *pDomain = NULL;
     instance_states new_state = NO_STATE;
     instance_states old_state = instance->state;
 
@@ -1096,14 +1873,18 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
     if (old_state == TEARDOWN || old_state == STAGING || old_state == BUNDLING_SHUTOFF || old_state == CREATEIMAGE_SHUTOFF)
         return;
 
-    {                                  // all this is done while holding the hypervisor lock, with a valid connection
-        virConnectPtr conn = lock_hypervisor_conn();
-        if (conn == NULL)
-            return;
-
-        virDomainPtr dom = virDomainLookupByName(conn, instance->instanceId);
+    if (domains != NULL) {
+        euca_strncpy(key.name, instance->instanceId, CHAR_BUFFER_SIZE);
+        if ((pDomain = bsearch(&key, domains->domains, domains->count, sizeof(domain_state), domain_state_compare)) != NULL) {
+            found = TRUE;
+            new_state = pDomain->state;
+        }
+    } else if (get_domain_state(instance->instanceId, &found, &new_state) != EUCA_OK) {
+        return;
+    }
 
-        if (dom == NULL) {             // hypervisor doesn't know about it
+    {                                  // act on what the hypervisor reported about the domain
+        if (!found) {                  // hypervisor doesn't know about it
             if (old_state == BUNDLING_SHUTDOWN) {
                 LOGINFO("[%s] detected disappearance of bundled domain\n", instance->instanceId);
                 change_state(instance, BUNDLING_SHUTOFF);
@@ -1114,9 +1895,9 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
                 // If we just finished migration, then this is normal.
                 //
                 // Could this be a bad assumption if the
-                // virDomainLookupByName() call above returns NULL for
-                // some transient reason rather than because hypervisor
-                // doesn't know of the domain any more?
+                // lookup above misses the domain for some transient
+                // reason rather than because hypervisor doesn't know
+                // of the domain any more?
                 if (is_migration_src(instance)) {
                     if (instance->migration_state == MIGRATION_IN_PROGRESS) {
                         // This usually occurs when there has been some
@@ -1128,12 +1909,10 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
                         // when refresh_instance_info() is called right
                         // as the migration is completing (there's a race).
                         LOGDEBUG("[%s] possible migration anomaly, not yet assuming completion\n", instance->instanceId);
-                        unlock_hypervisor_conn();
                         return;
                     }
                     LOGINFO("[%s] migration completed (state='%s'), cleaning up\n", instance->instanceId, migration_state_names[instance->migration_state]);
                     change_state(instance, SHUTOFF);
-                    unlock_hypervisor_conn();
                     return;
                 }
                 // most likely the user has shut it down from the inside
@@ -1156,21 +1935,15 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
 
             // persist state updates to disk
             save_instance_struct(instance);
-
-            unlock_hypervisor_conn();
             return;
         }
 
-        error = virDomainGetInfo(dom, &info);
-        if ((error < 0) || (info.state == VIR_DOMAIN_NOSTATE)) {
+        if (new_state == NO_STATE) {
             LOGWARN("[%s] failed to get information for domain\n", instance->instanceId);
             // what to do? hopefully we'll find out more later
-            virDomainFree(dom);
-            unlock_hypervisor_conn();
             return;
         }
 
-        new_state = info.state;
         switch (old_state) {
         case BOOTING:
         case RUNNING:
@@ -1194,7 +1967,7 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
                     bzero(instance->migration_dst, HOSTNAME_SIZE);
                     bzero(instance->migration_credentials, CREDENTIAL_SIZE);
                     instance->migrationTime = 0;
-                    save_instance_struct(instance);
+                    flush_instance_struct(instance);
                     // copy_intances is called upon return in monitoring_thread().
                     incoming_migrations_in_progress--;
                     LOGINFO("[%s] incoming migration complete (%d other incoming migration[s] actively in progress)\n", instance->instanceId, incoming_migrations_in_progress);
@@ -1204,17 +1977,17 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
                         int incoming_migrations_pending = 0;
                         int incoming_migrations_counted = 0;
                         LOGINFO("no remaining active incoming migrations -- checking to see if there are any pending migrations\n");
-                        bunchOfInstances *head = NULL;
-                        for (head = global_instances; head; head = head->next) {
-                            if ((head->instance->migration_state == MIGRATION_PREPARING) || (head->instance->migration_state == MIGRATION_READY)) {
-                                LOGINFO("[%s] is pending migration, migration_state='%s', deferring deauthorization of migration keys\n", head->instance->instanceId,
-                                        migration_state_names[head->instance->migration_state]);
+                        for (int i = 0; i < total_instances(&global_instances); i++) {
+                            ncInstance *other = global_instances->instances[i];
+                            if ((other->migration_state == MIGRATION_PREPARING) || (other->migration_state == MIGRATION_READY)) {
+                                LOGINFO("[%s] is pending migration, migration_state='%s', deferring deauthorization of migration keys\n", other->instanceId,
+                                        migration_state_names[other->migration_state]);
                                 incoming_migrations_pending++;
                             }
                             // Belt and suspenders...
-                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
-                                LOGWARN("[%s] Possible internal bug detected: instance migration_state='%s', but incoming_migrations_in_progress=%d\n", head->instance->instanceId,
-                                        migration_state_names[head->instance->migration_state], incoming_migrations_in_progress);
+                            if ((other->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, other->migration_dst)) {
+                                LOGWARN("[%s] Possible internal bug detected: instance migration_state='%s', but incoming_migrations_in_progress=%d\n", other->instanceId,
+                                        migration_state_names[other->migration_state], incoming_migrations_in_progress);
                                 incoming_migrations_counted++;
                             }
                         }
@@ -1228,10 +2001,10 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
                         }
                     } else {
                         // Verify that our count of incoming_migrations_in_progress matches our version of reality.
-                        bunchOfInstances *head = NULL;
                         int incoming_migrations_counted = 0;
-                        for (head = global_instances; head; head = head->next) {
-                            if ((head->instance->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, head->instance->migration_dst)) {
+                        for (int i = 0; i < total_instances(&global_instances); i++) {
+                            ncInstance *other = global_instances->instances[i];
+                            if ((other->migration_state == MIGRATION_IN_PROGRESS) && !strcmp(nc_state.ip, other->migration_dst)) {
                                 incoming_migrations_counted++;
                             }
                         }
@@ -1258,7 +2031,7 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
             if (new_state == RUNNING || new_state == BLOCKED || new_state == PAUSED) {
                 // cannot go back!
                 LOGWARN("[%s] detected prodigal domain, terminating it\n", instance->instanceId);
-                virDomainDestroy(dom);
+                destroy_domain(instance->instanceId);
             } else {
                 change_state(instance, new_state);
             }
@@ -1270,9 +2043,6 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
         default:
             LOGERROR("[%s] unexpected state (%d) in refresh\n", instance->instanceId, old_state);
         }
-
-        virDomainFree(dom);
-        unlock_hypervisor_conn();
     }
 
     // if instance is running, try to find out its IP address
@@ -1298,38 +2068,59 @@ static void refresh_instance_info(struct nc_state_t *nc, ncInstance * instance)
 }
 
 //!
-//! copying the linked list for use by Describe* requests
+//! Publishes a snapshot of the instance table for use by Describe* requests. Copies of
+//! instances that did not change since the previous snapshot are carried over, so only
+//! new or modified instances are copied. Readers hold inst_copy_lock for reading while
+//! they use the snapshot; the write lock is only held to swap the table pointer.
 //!
 void copy_instances(void)
 {
-    ncInstance *instance = NULL;
+    int i = 0;
     ncInstance *src_instance = NULL;
     ncInstance *dst_instance = NULL;
-    bunchOfInstances *head = NULL;
-    bunchOfInstances *container = NULL;
+    bunchOfInstances *fresh = NULL;
+    bunchOfInstances *stale = NULL;
 
-    sem_p(inst_copy_sem);
+    pthread_mutex_lock(&copy_mutex);
     {
-        // free the old linked list copy
-        for (head = global_instances_copy; head;) {
-            container = head;
-            instance = head->instance;
-            head = head->next;
-            EUCA_FREE(instance);
-            EUCA_FREE(container);
+        // build the new snapshot, sharing the copies of unchanged instances with the current one
+        for (i = 0; i < total_instances(&global_instances); i++) {
+            src_instance = global_instances->instances[i];
+            dst_instance = find_instance(&global_instances_copy, src_instance->instanceId);
+            if ((dst_instance == NULL) || memcmp(dst_instance, src_instance, sizeof(ncInstance))) {
+                if ((dst_instance = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance))) == NULL) {
+                    LOGERROR("out of memory, keeping previous copy of instances\n");
+                    break;
+                }
+                memcpy(dst_instance, src_instance, sizeof(ncInstance));
+            }
+            if (add_instance(&fresh, dst_instance) != EUCA_OK) {
+                if (dst_instance != find_instance(&global_instances_copy, dst_instance->instanceId))
+                    EUCA_FREE(dst_instance);
+                break;
+            }
         }
 
-        global_instances_copy = NULL;
+        if (i < total_instances(&global_instances)) {
+            // could not copy everything: drop what was copied and keep the current snapshot
+            stale = fresh;
+            fresh = global_instances_copy;
+        } else {
+            pthread_rwlock_wrlock(&inst_copy_lock);
+            stale = global_instances_copy;
+            global_instances_copy = fresh;
+            pthread_rwlock_unlock(&inst_copy_lock);
+        }
 
-        // make a fresh copy
-        for (head = global_instances; head; head = head->next) {
-            src_instance = head->instance;
-            dst_instance = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
-            memcpy(dst_instance, src_instance, sizeof(ncInstance));
-            add_instance(&global_instances_copy, dst_instance);
+        // no reader can see the stale table anymore: free the copies that were not carried over
+        for (i = 0; i < total_instances(&stale); i++) {
+            dst_instance = stale->instances[i];
+            if (find_instance(&fresh, dst_instance->instanceId) != dst_instance)
+                EUCA_FREE(dst_instance);
         }
+        free_instances(&stale);
     }
-    sem_v(inst_copy_sem);
+    pthread_mutex_unlock(&copy_mutex);
 }
 
 //!
@@ -1364,9 +2155,9 @@ static void update_log_params(void)
 //!
 static void update_ebs_params(void)
 {
-    char *ceph_user = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_USER);
-    char *ceph_keys = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_KEYS);
-    char *ceph_conf = getConfString(nc_state.configFiles, 2, CONFIG_NC_CEPH_CONF);
+    char *ceph_user = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_CEPH_USER);
+    char *ceph_keys = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_CEPH_KEYS);
+    char *ceph_conf = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_CEPH_CONF);
     init_iscsi(nc_state.home,
                (ceph_user == NULL) ? (DEFAULT_CEPH_USER) : (ceph_user),
                (ceph_keys == NULL) ? (DEFAULT_CEPH_KEYRING) : (ceph_keys), (ceph_conf == NULL) ? (DEFAULT_CEPH_CONF) : (ceph_conf));
@@ -1388,6 +2179,7 @@ void *monitoring_thread(void *arg)
 #define EUCANETD_SERVICE_NAME     "eucanetd"
 
     int i = 0;
+    int j = 0;
     int tmpint = 0;
     int left = 0;
     int cleaned_up = 0;
@@ -1408,10 +2200,9 @@ void *monitoring_thread(void *arg)
     FILE *FP = NULL;
     time_t now = 0;
     struct nc_state_t *nc = NULL;
-    bunchOfInstances *head = NULL;
-    bunchOfInstances *vnhead = NULL;
     ncInstance *instance = NULL;
     ncInstance *vninstance = NULL;
+    hypervisor_domains *domains = NULL;
 
     LOGINFO("spawning monitoring thread\n");
     if (arg == NULL) {
@@ -1490,12 +2281,16 @@ void *monitoring_thread(void *arg)
             fflush(FP);
         }
 
+        // query for the current state of all domains at once (if that fails, each instance is looked up on its own)
+        if (global_instances)
+            domains = get_hypervisor_domains();
+
         cleaned_up = 0;
-        for (head = global_instances; head; head = head->next) {
-            instance = head->instance;
+        for (i = 0; i < total_instances(&global_instances); i++) {
+            instance = global_instances->instances[i];
 
             // query for current state, if any
-            refresh_instance_info(nc, instance);
+            refresh_instance_info(nc, instance, domains);
 
             // time out logic for migration-ready instances
             if (!strcmp(instance->stateName, "Extant") && ((instance->migration_state == MIGRATION_READY) || (instance->migration_state == MIGRATION_PREPARING))
@@ -1549,7 +2344,8 @@ void *monitoring_thread(void *arg)
                     remove_instance(&global_instances, instance);
                     LOGINFO("[%s] forgetting about instance\n", instance->instanceId);
                     free_instance(&instance);
-                    break;             // need to get out since the list changed
+                    i--;               // the last instance of the table moved into this position
+                    continue;
                 }
                 continue;
             }
@@ -1607,8 +2403,8 @@ void *monitoring_thread(void *arg)
                 }
                 // check to see if this is the last instance running on vlan, handle local networking information drop
                 left = 0;
-                for (vnhead = global_instances; vnhead; vnhead = vnhead->next) {
-                    vninstance = vnhead->instance;
+                for (j = 0; j < total_instances(&global_instances); j++) {
+                    vninstance = global_instances->instances[j];
                     if (vninstance->ncnet.vlan == (instance->ncnet).vlan && strcmp(instance->instanceId, vninstance->instanceId)) {
                         left++;
                     }
@@ -1626,13 +2422,10 @@ void *monitoring_thread(void *arg)
 
         copy_instances();              // copy global_instances to global_instances_copy
         sem_v(inst_sem);
+        free_hypervisor_domains(&domains);
 
-        if (head) {
-            // we got out because of modified list, no need to sleep now
-            continue;
-        }
-
-        sleep(MONITORING_PERIOD);
+        // sleep until the next pass, unless the hypervisor reports a domain lifecycle event sooner
+        monitor_wait(MONITORING_PERIOD);
 
         // do this on every iteration (every MONITORING_PERIOD seconds)
         if ((iteration % 1) == 0) {
@@ -1732,15 +2525,11 @@ void *startup_thread(void *arg)
 {
     int i = 0;
     int error = EUCA_OK;
-    int status = 0;
     int rc = 0;
     char *xml = NULL;
     char brname[IF_NAME_LEN] = "";
-    pid_t cpid = 0;
-    boolean try_killing = FALSE;
     boolean created = FALSE;
     ncInstance *instance = ((ncInstance *) arg);
-    virDomainPtr dom = NULL;
 
     LOGDEBUG("[%s] spawning startup thread\n", instance->instanceId);
     virConnectPtr conn = lock_hypervisor_conn();
@@ -1763,8 +2552,7 @@ void *startup_thread(void *arg)
     set_instance_params(instance);
 
     if ((error = create_instance_backing(instance, FALSE))  // do the heavy lifting on the disk
-        || (error = gen_instance_xml(instance)) // create euca-specific instance XML file
-        || (error = gen_libvirt_instance_xml(instance))) {  // transform euca-specific XML into libvirt XML
+        || (error = gen_instance_and_libvirt_xml(instance))) {  // create euca-specific instance XML and transform it into libvirt XML
         LOGERROR("[%s] failed to prepare images for instance (error=%d)\n", instance->instanceId, error);
         goto shutoff;
     }
@@ -1785,7 +2573,7 @@ void *startup_thread(void *arg)
 
     xml = file2str(instance->libvirtFilePath);
 
-    save_instance_struct(instance);    // to enable NC recovery
+    flush_instance_struct(instance);    // to enable NC recovery
     sensor_add_resource(instance->instanceId, "instance", instance->uuid);
     sensor_set_resource_alias(instance->instanceId, instance->ncnet.privateIp);
     update_disk_aliases(instance);
@@ -1804,20 +2592,25 @@ void *startup_thread(void *arg)
             LOGINFO("[%s] attempt %d of %d to create the instance\n", instance->instanceId, i + 1, MAX_CREATE_TRYS);
         }
 
-        {                              // all this is done while holding the hypervisor lock, with a valid connection
-            virConnectPtr conn = lock_hypervisor_conn();
+        {                              // all this is done while holding the domain lock, with a valid connection
+            virConnectPtr conn = lock_domain_conn(instance->instanceId);
             if (conn == NULL) {        // get a new connection for each loop iteration
                 LOGERROR("[%s] could not contact the hypervisor, abandoning the instance\n", instance->instanceId);
                 goto shutoff;
             }
 
+            sem_p(hyp_sem);            // one domain creation at a time
             sem_p(loop_sem);
 
             // We have seen virDomainCreateLinux() on occasion block indefinitely,
             // which freezes all activity on the NC since hyp_sem and loop_sem are
             // being held by the thread. (This is on Lucid with AppArmor enabled.)
-            // To protect against that, we invoke the function in a process and
-            // terminate it after CREATE_TIMEOUT_SEC seconds.
+            // To protect against that, we invoke the function in a watchdog thread
+            // and abandon it after CREATE_TIMEOUT_SEC seconds. (This used to be a
+            // forked process, but the connection is now shared with other threads,
+            // so a child process must not use it.) An abandoned thread destroys the
+            // domain if the create still succeeds, so a retry or shutoff never
+            // leaves an orphaned domain behind.
             //
             // #0  0x00007f359f0b1f93 in poll () from /lib/libc.so.6
             // #1  0x00007f359a9a44e2 in ?? () from /usr/lib/libvirt.so.0
@@ -1829,51 +2622,29 @@ void *startup_thread(void *arg)
             // #7  0x00007f359f0be70d in clone () from /lib/libc.so.6
             // #8  0x0000000000000000 in ?? ()
 
-            if ((cpid = fork()) < 0) { // fork error
-                LOGERROR("[%s] failed to fork to start instance\n", instance->instanceId);
-            } else if (cpid == 0) {    // child process - creates the domain
-                if ((dom = virDomainCreateLinux(conn, xml, 0)) != NULL) {
-                    virDomainFree(dom); // To be safe. Docs are not clear on whether the handle exists outside the process.
-
-                    // DAN TEMPORARY FOR VPC TESTING
-                    //                if (!strcmp(nc_state.vnetconfig->mode, NETMODE_SYSTEM)) {
-                    if (!strcmp(nc_state.pEucaNet->sMode, NETMODE_VPCMIDO)) {
-                        char iface[16], cmd[EUCA_MAX_PATH], obuf[256], ebuf[256];
-                        snprintf(iface, 16, "vn_%s", instance->instanceId);
-                        snprintf(cmd, EUCA_MAX_PATH, "%s brctl delif %s %s", nc_state.rootwrap_cmd_path, instance->params.guestNicDeviceName, iface);
-                        rc = timeshell(cmd, obuf, ebuf, 256, 10);
-                        if (rc) {
-                            LOGERROR
-                                ("unable to remove instance interface from bridge after launch: instance will not be able to connect to midonet (will not connect to network): check bridge/libvirt/kvm health\n");
-                        }
-                    }
-
-                    exit(0);
-                } else {
-                    exit(1);
-                }
+            virConnectRef(conn);       // for the watchdog thread, which may outlive this call
+            if ((rc = libvirt_watchdog_run(LIBVIRT_OP_CREATE, conn, xml, CREATE_TIMEOUT_SEC, NULL)) == EUCA_OK) {
+                created = TRUE;
+            } else if (rc == EUCA_TIMEOUT_ERROR) {
+                LOGERROR("[%s] timed out waiting for the hypervisor to create the instance\n", instance->instanceId);
             } else {
-                // parent process - waits for the child, kills it if necessary
-                try_killing = FALSE;
-                if ((rc = timewait(cpid, &status, CREATE_TIMEOUT_SEC)) < 0) {
-                    LOGERROR("[%s] failed to wait for forked process: %s\n", instance->instanceId, strerror(errno));
-                    try_killing = TRUE;
-                } else if (rc == 0) {
-                    LOGERROR("[%s] timed out waiting for forked process pid=%d\n", instance->instanceId, cpid);
-                    try_killing = TRUE;
-                } else if (WEXITSTATUS(status) != 0) {
-                    LOGERROR("[%s] hypervisor failed to create the instance\n", instance->instanceId);
-                } else {
-                    created = TRUE;
-                }
-
-                if (try_killing) {
-                    killwait(cpid);
-                }
+                LOGERROR("[%s] hypervisor failed to create the instance\n", instance->instanceId);
             }
 
             sem_v(loop_sem);
-            unlock_hypervisor_conn();  // guard against libvirtd connection badness
+            sem_v(hyp_sem);
+            unlock_domain_conn(instance->instanceId);   // guard against libvirtd connection badness
+        }
+
+        if (created && !strcmp(nc_state.pEucaNet->sMode, NETMODE_VPCMIDO)) {
+            char iface[16], cmd[EUCA_MAX_PATH], obuf[256], ebuf[256];
+            snprintf(iface, 16, "vn_%s", instance->instanceId);
+            snprintf(cmd, EUCA_MAX_PATH, "%s brctl delif %s %s", nc_state.rootwrap_cmd_path, instance->params.guestNicDeviceName, iface);
+            rc = timeshell(cmd, obuf, ebuf, 256, 10);
+            if (rc) {
+                LOGERROR
+                    ("unable to remove instance interface from bridge after launch: instance will not be able to connect to midonet (will not connect to network): check bridge/libvirt/kvm health\n");
+            }
         }
 
         if (created)
@@ -2084,7 +2855,7 @@ static int init(void)
 {
 #define GET_VAR_INT(_var, _name, _def)                   \
 {                                                        \
-	s = getConfString(nc_state.configFiles, 2, (_name)); \
+	s = configStoreValue(nc_state.configFiles, 2, (_name)); \
 	if (s) {					                         \
 		(_var) = atoi(s);                                \
 		EUCA_FREE(s);                                    \
@@ -2182,7 +2953,7 @@ static int init(void)
     snprintf(nc_state.rootwrap_cmd_path, EUCA_MAX_PATH, EUCALYPTUS_ROOTWRAP, nc_state.home);
 
     {                                  // determine the hypervisor to use
-        char *hypervisor = getConfString(nc_state.configFiles, 2, CONFIG_HYPERVISOR);
+        char *hypervisor = configStoreValue(nc_state.configFiles, 2, CONFIG_HYPERVISOR);
         if (!hypervisor) {
             LOGFATAL("value %s is not set in the config file\n", CONFIG_HYPERVISOR);
             return (EUCA_FATAL_ERROR);
@@ -2319,6 +3090,7 @@ static int init(void)
     GET_VAR_INT(nc_state.sc_request_timeout_sec, CONFIG_SC_REQUEST_TIMEOUT, 45);
     GET_VAR_INT(nc_state.concurrent_cleanup_ops, CONFIG_CONCURRENT_CLEANUP_OPS, 30);
     GET_VAR_INT(nc_state.disable_snapshots, CONFIG_DISABLE_SNAPSHOTS, 0);
+    GET_VAR_INT(nc_state.loop_direct_io, CONFIG_LOOP_DIRECT_IO, 0);
     GET_VAR_INT(nc_state.shutdown_grace_period_sec, CONFIG_SHUTDOWN_GRACE_PERIOD_SEC, 60);
 
     strcpy(nc_state.admin_user_id, EUCALYPTUS_ADMIN);
@@ -2365,28 +3137,38 @@ static int init(void)
 
     hyp_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     inst_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
-    inst_copy_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     addkey_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     log_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     service_state_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
     stats_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
 
-    if (!hyp_sem || !inst_sem || !inst_copy_sem || !addkey_sem || !log_sem || !service_state_sem) {
+    if (!hyp_sem || !inst_sem || !addkey_sem || !log_sem || !service_state_sem) {
         LOGFATAL("failed to create and initialize semaphores\n");
         return (EUCA_FATAL_ERROR);
     }
+    sem_set_stats_name(hyp_sem, "hyp_sem");
+    sem_set_stats_name(inst_sem, "inst_sem");
+    sem_set_stats_name(addkey_sem, "addkey_sem");
+    sem_set_stats_name(log_sem, "log_sem");
+    sem_set_stats_name(service_state_sem, "service_state_sem");
+    sem_set_stats_name(stats_sem, "stats_sem");
     if (log_sem_set(log_sem) != 0) {
         LOGFATAL("failed to set logging semaphore\n");
         return (EUCA_FATAL_ERROR);
     }
+    if (log_async_start() != EUCA_OK) {
+        LOGWARN("failed to start the log writer thread, logging synchronously\n");
+    }
     if (sensor_set_hyp_sem(hyp_sem) != 0) {
         LOGFATAL("failed to set hypervisor semaphore for the sensor subsystem\n");
         return (EUCA_FATAL_ERROR);
     }
+    sensor_set_collector(collect_instance_stats);
     if ((loop_sem = diskutil_get_loop_sem()) == NULL) { // NC does not need GRUB for now
         LOGFATAL("failed to find all dependencies\n");
         return (EUCA_FATAL_ERROR);
     }
+    diskutil_set_loop_direct_io(nc_state.loop_direct_io ? TRUE : FALSE);
 
     if (init_eucafaults(euca_this_component_name) == 0) {
         LOGFATAL("failed to initialize fault-logging subsystem\n");
@@ -2400,6 +3182,9 @@ static int init(void)
     // initialize the EBS subsystem
     update_ebs_params();
 
+    // the event loop must be in place before the first hypervisor connection is opened
+    start_libvirt_event_loop();
+
     // NOTE: this is the only call which needs to be called on both
     // the default and the specific handler! All the others will be
     // either or
@@ -2462,7 +3247,7 @@ static int init(void)
 
     {
         // backing store configuration
-        char *instances_path = getConfString(nc_state.configFiles, 2, INSTANCE_PATH);
+        char *instances_path = configStoreValue(nc_state.configFiles, 2, INSTANCE_PATH);
 
         if (instances_path == NULL) {
             LOGERROR("%s is not set\n", INSTANCE_PATH);
@@ -2646,7 +3431,7 @@ static int init(void)
     // setup the network
     snprintf(nc_state.config_network_path, EUCA_MAX_PATH, NC_NET_PATH_DEFAULT, nc_state.home);
 
-    tmp = getConfString(nc_state.configFiles, 2, "VNET_MODE");
+    tmp = configStoreValue(nc_state.configFiles, 2, "VNET_MODE");
     if (!tmp) {
         LOGWARN("VNET_MODE is not defined, defaulting to '%s'\n", NETMODE_MANAGED_NOVLAN);
         tmp = strdup(NETMODE_MANAGED_NOVLAN);
@@ -2668,7 +3453,7 @@ static int init(void)
     }
 
     if (tmp && (!strcmp(tmp, NETMODE_MANAGED_NOVLAN) || !strcmp(tmp, NETMODE_EDGE) || !strcmp(tmp, NETMODE_VPCMIDO))) {
-        bridge = getConfString(nc_state.configFiles, 2, "VNET_BRIDGE");
+        bridge = configStoreValue(nc_state.configFiles, 2, "VNET_BRIDGE");
         if (!bridge) {
             LOGFATAL("in 'EDGE', 'VPC' , or 'MANAGED-NOVLAN' network mode, you must specify a value for VNET_BRIDGE\n");
             initFail = 1;
@@ -2676,9 +3461,9 @@ static int init(void)
     }
 
     if (tmp && (!strcmp(tmp, NETMODE_MANAGED) || !strcmp(tmp, NETMODE_EDGE))) {
-        pubinterface = getConfString(nc_state.configFiles, 2, "VNET_PUBINTERFACE");
+        pubinterface = configStoreValue(nc_state.configFiles, 2, "VNET_PUBINTERFACE");
         if (!pubinterface)
-            pubinterface = getConfString(nc_state.configFiles, 2, "VNET_INTERFACE");
+            pubinterface = configStoreValue(nc_state.configFiles, 2, "VNET_INTERFACE");
 
         if (!pubinterface) {
             LOGWARN("VNET_PUBINTERFACE is not defined, defaulting to 'eth0'\n");
@@ -2705,7 +3490,7 @@ static int init(void)
         return (EUCA_FATAL_ERROR);
 
     // set NC helper path
-    tmp = getConfString(nc_state.configFiles, 2, CONFIG_NC_BUNDLE_UPLOAD);
+    tmp = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_BUNDLE_UPLOAD);
     if (tmp) {
         snprintf(nc_state.ncBundleUploadCmd, EUCA_MAX_PATH, "%s", tmp);
         EUCA_FREE(tmp);
@@ -2714,7 +3499,7 @@ static int init(void)
     }
 
     // set NC helper path
-    tmp = getConfString(nc_state.configFiles, 2, CONFIG_NC_CHECK_BUCKET);
+    tmp = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_CHECK_BUCKET);
     if (tmp) {
         snprintf(nc_state.ncCheckBucketCmd, EUCA_MAX_PATH, "%s", tmp);
         EUCA_FREE(tmp);
@@ -2723,7 +3508,7 @@ static int init(void)
     }
 
     // set NC helper path
-    tmp = getConfString(nc_state.configFiles, 2, CONFIG_NC_DELETE_BUNDLE);
+    tmp = configStoreValue(nc_state.configFiles, 2, CONFIG_NC_DELETE_BUNDLE);
     if (tmp) {
         snprintf(nc_state.ncDeleteBundleCmd, EUCA_MAX_PATH, "%s", tmp);
         EUCA_FREE(tmp);
@@ -2733,7 +3518,7 @@ static int init(void)
 
     {
         // set enable ws-security
-        tmp = getConfString(nc_state.configFiles, 2, CONFIG_ENABLE_WS_SECURITY);
+        tmp = configStoreValue(nc_state.configFiles, 2, CONFIG_ENABLE_WS_SECURITY);
         if (tmp && !strcmp(tmp, "N")) {
             LOGDEBUG("Configuring no use of WS-SEC as specified in config file by explicit 'no' value\n");
             nc_state.config_use_ws_sec = 0;
@@ -3552,25 +4337,28 @@ int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *re
 //! @param[in]  instIdsLen the number of instance identifiers in the instIds list
 //! @param[in]  sensorIds a list of sensor identifiers string
 //! @param[in]  sensorIdsLen the number of sensor identifiers string in the sensorIds list
+//! @param[in]  sinceSequenceNum only report values with this sequence number or newer (negative for all)
 //! @param[out] outResources a list of sensor resources created by this request
 //! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
 //!
 //! @return EUCA_ERROR on failure or the result of the proper doDescribeSensors() handler call.
 //!
 int doDescribeSensors(ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen, char **sensorIds,
-                      int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen)
+                      int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen)
 {
     int ret = EUCA_OK;
 
     if (init())
         return (EUCA_ERROR);
 
-    LOGDEBUG("invoked (instIdsLen=%d sensorIdsLen=%d)\n", instIdsLen, sensorIdsLen);
+    LOGDEBUG("invoked (instIdsLen=%d sensorIdsLen=%d sinceSequenceNum=%lld)\n", instIdsLen, sensorIdsLen, sinceSequenceNum);
 
     if (nc_state.H->doDescribeSensors) {
-        ret = nc_state.H->doDescribeSensors(&nc_state, pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, outResources, outResourcesLen);
+        ret = nc_state.H->doDescribeSensors(&nc_state, pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, sinceSequenceNum, outResources,
+                                            outResourcesLen);
     } else {
-        ret = nc_state.D->doDescribeSensors(&nc_state, pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, outResources, outResourcesLen);
+        ret = nc_state.D->doDescribeSensors(&nc_state, pMeta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, sinceSequenceNum, outResources,
+                                            outResourcesLen);
     }
 
     return ret;
@@ -3770,7 +4558,7 @@ int migration_rollback(ncInstance * instance)
         //bzero(instance->migration_dst, HOSTNAME_SIZE);
         bzero(instance->migration_credentials, CREDENTIAL_SIZE);
         instance->migrationTime = 0;
-        save_instance_struct(instance);
+        flush_instance_struct(instance);
         copy_instances();
         LOGINFO("[%s] migration source rolled back\n", instance->instanceId);
         return TRUE;
@@ -3783,7 +4571,7 @@ int migration_rollback(ncInstance * instance)
         bzero(instance->migration_dst, HOSTNAME_SIZE);
         bzero(instance->migration_credentials, CREDENTIAL_SIZE);
         instance->migrationTime = 0;
-        save_instance_struct(instance);
+        flush_instance_struct(instance);
         copy_instances();
         LOGINFO("[%s] migration state reset.\n", instance->instanceId);
         return TRUE;
@@ -3794,7 +4582,7 @@ int migration_rollback(ncInstance * instance)
     // So if this happens, we'll assume the rollback request was valid, and we'll reset its state and time so that it will get cleaned up--rather than stuck!
     instance->migration_state = NOT_MIGRATING;
     instance->migrationTime = 0;
-    save_instance_struct(instance);
+    flush_instance_struct(instance);
     copy_instances();
     return FALSE;
 }
@@ -142,6 +142,7 @@ struct nc_state_t {
     int concurrent_disk_ops, concurrent_cleanup_ops;
     int sc_request_timeout_sec;
     int disable_snapshots;
+    int loop_direct_io;
     int staging_cleanup_threshold;
     int booting_cleanup_threshold;
     int bundling_cleanup_threshold;
@@ -243,7 +244,7 @@ struct handlers {
     int (*doCancelBundleTask) (struct nc_state_t * nc, ncMetadata * pMeta, char *instanceId);
     int (*doDescribeBundleTasks) (struct nc_state_t * nc, ncMetadata * pMeta, char **instIds, int instIdsLen, bundleTask *** outBundleTasks, int *outBundleTasksLen);
     int (*doDescribeSensors) (struct nc_state_t * nc, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds,
-                              int instIdsLen, char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
+                              int instIdsLen, char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen);
     int (*doModifyNode) (struct nc_state_t * nc, ncMetadata * pMeta, char *stateName);
     int (*doMigrateInstances) (struct nc_state_t * nc, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
     int (*doStartInstance) (struct nc_state_t * nc, ncMetadata * pMeta, char *instanceId);
@@ -329,7 +330,7 @@ int doCancelBundleTask(ncMetadata * pMeta, char *instanceId);
 int doDescribeBundleTasks(ncMetadata * pMeta, char **instIds, int instIdsLen, bundleTask *** outBundleTasks, int *outBundleTasksLen);
 int doCreateImage(ncMetadata * pMeta, char *instanceId, char *volumeId, char *remoteDev);
 int doDescribeSensors(ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds, int instIdsLen, char **sensorIds,
-                      int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
+                      int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen);
 int doModifyNode(ncMetadata * pMeta, char *stateName);
 int doMigrateInstances(ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
 int doStartInstance(ncMetadata * pMeta, char *instanceId);
@@ -345,6 +346,8 @@ int canonicalize_dev(const char *dev, char *cdev, int cdev_len);
 void print_running_domains(void);
 virConnectPtr lock_hypervisor_conn(void);
 void unlock_hypervisor_conn(void);
+virConnectPtr lock_domain_conn(const char *instanceId);
+void unlock_domain_conn(const char *instanceId);
 void change_state(ncInstance * instance, instance_states state);
 int wait_state_transition(ncInstance * instance, instance_states from_state, instance_states to_state);
 void adopt_instances();
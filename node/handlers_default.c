@@ -160,7 +160,7 @@ typedef struct startstop_params_ {
 // coming from handlers.c
 extern sem *hyp_sem;
 extern sem *inst_sem;
-extern sem *inst_copy_sem;
+extern pthread_rwlock_t inst_copy_lock;
 extern bunchOfInstances *global_instances;
 extern bunchOfInstances *global_instances_copy;
 
@@ -224,7 +224,7 @@ static int doBundleRestartInstance(struct nc_state_t *nc, ncMetadata * pMeta, ch
 static int doCancelBundleTask(struct nc_state_t *nc, ncMetadata * pMeta, char *instanceId);
 static int doDescribeBundleTasks(struct nc_state_t *nc, ncMetadata * pMeta, char **instIds, int instIdsLen, bundleTask *** outBundleTasks, int *outBundleTasksLen);
 static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds,
-                             int instIdsLen, char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen);
+                             int instIdsLen, char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen);
 static int doModifyNode(struct nc_state_t *nc, ncMetadata * pMeta, char *stateName);
 static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInstance ** instances, int instancesLen, char *action, char *credentials);
 static void *startstop_thread(void *arg);
@@ -284,9 +284,9 @@ static void refresh_instance_resources(const char *instanceId)
 
     euca_strncpy(res_name[0], instanceId, MAX_SENSOR_NAME_LEN);
 
-    // we serialize all hypervisor calls and
-    // sensor_refresh_resources() may ultimately
-    // call the hypervisor
+    // sensor refreshes are serialized with the
+    // sensor polling thread, which also holds
+    // hyp_sem while it calls the hypervisor
     {
         sem_p(hyp_sem);
         sensor_refresh_resources(res_name, res_alias, 1);   // refresh stats
@@ -485,7 +485,7 @@ int shutdown_then_destroy_domain(const char *instanceId, boolean do_destroy)
     int error = 0;
 
     for (boolean done = FALSE; (!done);) {
-        virConnectPtr conn = lock_hypervisor_conn();
+        virConnectPtr conn = lock_domain_conn(instanceId);
         if (conn == NULL) {
             LOGERROR("[%s] cannot connect to hypervisor to shut down instance\n", instanceId);
             return -1;
@@ -494,7 +494,7 @@ int shutdown_then_destroy_domain(const char *instanceId, boolean do_destroy)
         virDomainPtr dom = virDomainLookupByName(conn, instanceId);
         if (dom == NULL) {             // domain is gone, so we are done
             LOGTRACE("[%s] domain not found\n", instanceId);
-            unlock_hypervisor_conn();
+            unlock_domain_conn(instanceId);
             break;
         }
 
@@ -527,10 +527,10 @@ int shutdown_then_destroy_domain(const char *instanceId, boolean do_destroy)
         }
 
         virDomainFree(dom);
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instanceId);
 
         if (!done)
-            sleep(2);                  // sleep outside the hypervisor lock
+            sleep(2);                  // sleep outside the domain lock
     }
 
     return error;
@@ -594,21 +594,21 @@ int find_and_stop_instance(char *psInstanceId)
     LOGDEBUG("[%s] stopping instance\n", psInstanceId);
 
     {
-        // we hold hyp_sem in this block
-        if ((conn = lock_hypervisor_conn()) == NULL) {
+        // we hold the domain lock in this block
+        if ((conn = lock_domain_conn(psInstanceId)) == NULL) {
             LOGERROR("[%s] cannot connect to hypervisor to stop instance, giving up\n", psInstanceId);
             return (EUCA_ERROR);
         }
 
         if ((dom = virDomainLookupByName(conn, psInstanceId)) == NULL) {
             LOGERROR("[%s] cannot locate instance to stop, giving up\n", psInstanceId);
-            unlock_hypervisor_conn();
+            unlock_domain_conn(psInstanceId);
             return (EUCA_NOT_FOUND_ERROR);
         }
         // obtain the most up-to-date XML for domain from libvirt
         psXML = virDomainGetXMLDesc(dom, 0);
         virDomainFree(dom);            // release libvirt resource
-        unlock_hypervisor_conn();
+        unlock_domain_conn(psInstanceId);
     }
 
     if (psXML == NULL) {
@@ -707,8 +707,8 @@ int find_and_start_instance(char *psInstanceId)
     sensor_shift_metric(psInstanceId, "NetworkOut");
 
     {
-        // we hold hyp_sem in this block
-        if ((conn = lock_hypervisor_conn()) == NULL) {
+        // we hold the domain lock in this block
+        if ((conn = lock_domain_conn(psInstanceId)) == NULL) {
             LOGERROR("[%s] cannot connect to hypervisor to restart instance, giving up\n", psInstanceId);
             EUCA_FREE(psXML);
             return (EUCA_ERROR);
@@ -716,18 +716,20 @@ int find_and_start_instance(char *psInstanceId)
         // ensure it is not running already
         if ((dom = virDomainLookupByName(conn, psInstanceId)) != NULL) {
             LOGERROR("[%s] instance to start is already running, giving up\n", psInstanceId);
-            unlock_hypervisor_conn();
+            unlock_domain_conn(psInstanceId);
             EUCA_FREE(psXML);
             virDomainFree(dom);
             return (EUCA_ERROR);
         }
-        // start it
+        // start it (one domain creation at a time)
+        sem_p(hyp_sem);
         if ((dom = virDomainCreateLinux(conn, psXML, 0)) == NULL) {
             LOGERROR("[%s] failed to start instance\n", psInstanceId);
         } else {
             virDomainFree(dom);
         }
-        unlock_hypervisor_conn();
+        sem_v(hyp_sem);
+        unlock_domain_conn(psInstanceId);
 
         //! @TODO: check if we sensor values survive stop/start
         refresh_instance_resources(psInstanceId);
@@ -807,7 +809,6 @@ static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char *
     ncInstance *instance = NULL;
     ncInstance *tmp = NULL;
     int total = 0;
-    int i = 0;
     int j = 0;
     int k = 0;
 
@@ -817,7 +818,8 @@ static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char *
     *outInstsLen = 0;
     *outInsts = NULL;
 
-    sem_p(inst_copy_sem);
+    // concurrent describe requests may all read the copy at once
+    pthread_rwlock_rdlock(&inst_copy_lock);
     if (instIdsLen == 0)               // describe all instances
         total = total_instances(&global_instances_copy);
     else
@@ -825,33 +827,33 @@ static int doDescribeInstances(struct nc_state_t *nc, ncMetadata * pMeta, char *
 
     *outInsts = EUCA_ZALLOC(total, sizeof(ncInstance *));
     if ((*outInsts) == NULL) {
-        sem_v(inst_copy_sem);
+        pthread_rwlock_unlock(&inst_copy_lock);
         return EUCA_MEMORY_ERROR;
     }
 
     k = 0;
-    for (i = 0; (instance = get_instance(&global_instances_copy)) != NULL; i++) {
+    // walk the table directly, as get_instance() keeps a shared cursor that is not safe for concurrent readers
+    for (j = 0; j < total; j++) {
+        if (instIdsLen > 0) {
+            // look up the requested instances rather than matching every instance against the request
+            if ((instance = find_instance(&global_instances_copy, instIds[j])) == NULL)
+                continue;
+        } else {
+            instance = global_instances_copy->instances[j];
+        }
+
         // only pick ones the user (or admin) is allowed to see
         if (strcmp(pMeta->userId, nc->admin_user_id)
             && strcmp(pMeta->userId, instance->userId))
             continue;
 
-        if (instIdsLen > 0) {
-            for (j = 0; j < instIdsLen; j++)
-                if (!strcmp(instance->instanceId, instIds[j]))
-                    break;
-
-            if (j >= instIdsLen)
-                // instance of no relevance right now
-                continue;
-        }
         // (* outInsts)[k++] = instance;
         tmp = (ncInstance *) EUCA_ALLOC(1, sizeof(ncInstance));
         memcpy(tmp, instance, sizeof(ncInstance));
         (*outInsts)[k++] = tmp;
     }
     *outInstsLen = k;
-    sem_v(inst_copy_sem);
+    pthread_rwlock_unlock(&inst_copy_lock);
 
     return EUCA_OK;
 }
@@ -918,15 +920,16 @@ static int doDescribeResource(struct nc_state_t *nc, ncMetadata * pMeta, char *r
         }
     }
 
-    sem_p(inst_copy_sem);
-    while ((inst = get_instance(&global_instances_copy)) != NULL) {
+    pthread_rwlock_rdlock(&inst_copy_lock);
+    for (int i = 0; i < total_instances(&global_instances_copy); i++) {
+        inst = global_instances_copy->instances[i];
         if (inst->state == TEARDOWN)
             continue;                  // they don't take up resources
         sum_mem += inst->params.mem;
         sum_disk += get_disk_use_gb(&(inst->params));
         sum_cores += inst->params.cores;
     }
-    sem_v(inst_copy_sem);
+    pthread_rwlock_unlock(&inst_copy_lock);
 
     disk_free = nc->disk_max - sum_disk;
     if (disk_free < 0)
@@ -1312,7 +1315,7 @@ int attach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
 {
     int ret = EUCA_OK;
 
-    virConnectPtr conn = lock_hypervisor_conn();
+    virConnectPtr conn = lock_domain_conn(instanceId);
     if (conn == NULL) {
         LOGERROR("[%s][%s] cannot get connection to hypervisor\n", instanceId, volumeId);
         return EUCA_HYPERVISOR_ERROR;
@@ -1320,7 +1323,7 @@ int attach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
     // find domain on hypervisor
     virDomainPtr dom = virDomainLookupByName(conn, instanceId);
     if (dom == NULL) {
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instanceId);
         return EUCA_HYPERVISOR_ERROR;
     }
 
@@ -1343,7 +1346,7 @@ int attach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
     }
 
     virDomainFree(dom);                // release libvirt resource
-    unlock_hypervisor_conn();
+    unlock_domain_conn(instanceId);
 
     return ret;
 }
@@ -1353,7 +1356,7 @@ int detach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
     int ret = EUCA_OK;
 
     // connect to hypervisor, find the domain, detach the volume
-    virConnectPtr conn = lock_hypervisor_conn();
+    virConnectPtr conn = lock_domain_conn(instanceId);
     if (conn == NULL) {
         LOGERROR("[%s][%s] cannot get connection to hypervisor\n", instanceId, volumeId);
         ret = EUCA_HYPERVISOR_ERROR;
@@ -1368,7 +1371,7 @@ int detach_vol_instance(struct nc_state_t *nc, const char *devName, const char *
             }
             virDomainFree(dom);        // release libvirt resource
         }
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instanceId);
 
         if (libvirt_err) {
             LOGERROR("[%s][%s] failed to detach EBS guest device\n", instanceId, volumeId);
@@ -2183,13 +2186,14 @@ static int doDescribeBundleTasks(struct nc_state_t *nc, ncMetadata * pMeta, char
 //! @param[in]  instIdsLen the number of instance identifiers in the instIds list
 //! @param[in]  sensorIds a list of sensor identifiers string
 //! @param[in]  sensorIdsLen the number of sensor identifiers string in the sensorIds list
+//! @param[in]  sinceSequenceNum only report values with this sequence number or newer (negative for all)
 //! @param[out] outResources a list of sensor resources created by this request
 //! @param[out] outResourcesLen the number of sensor resources contained in the outResources list
 //!
 //! @return EUCA_OK on success or EUCA_MEMORY_ERROR on failure.
 //!
 static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int historySize, long long collectionIntervalTimeMs, char **instIds,
-                             int instIdsLen, char **sensorIds, int sensorIdsLen, sensorResource *** outResources, int *outResourcesLen)
+                             int instIdsLen, char **sensorIds, int sensorIdsLen, long long sinceSequenceNum, sensorResource *** outResources, int *outResourcesLen)
 {
     int total;
 
@@ -2197,7 +2201,7 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     if (err != 0)
         LOGERROR("failed to update sensor configuration (err=%d)\n", err);
 
-    sem_p(inst_copy_sem);
+    pthread_rwlock_rdlock(&inst_copy_lock);
     if (instIdsLen == 0)               // describe all instances
         total = total_instances(&global_instances_copy);
     else
@@ -2207,7 +2211,7 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     if (total > 0) {
         rss = EUCA_ZALLOC(total, sizeof(sensorResource *));
         if (rss == NULL) {
-            sem_v(inst_copy_sem);
+            pthread_rwlock_unlock(&inst_copy_lock);
             return EUCA_MEMORY_ERROR;
         }
     }
@@ -2215,37 +2219,34 @@ static int doDescribeSensors(struct nc_state_t *nc, ncMetadata * pMeta, int hist
     int k = 0;
 
     ncInstance *instance;
-    for (int i = 0; (instance = get_instance(&global_instances_copy)) != NULL; i++) {
+    for (int j = 0; j < total; j++) {
+        if (instIdsLen > 0) {
+            if ((instance = find_instance(&global_instances_copy, instIds[j])) == NULL)
+                continue;
+        } else {
+            instance = global_instances_copy->instances[j];
+        }
+
         // only pick ones the user (or admin) is allowed to see
         if (strcmp(pMeta->userId, nc->admin_user_id)
             && strcmp(pMeta->userId, instance->userId))
             continue;
 
-        if (instIdsLen > 0) {
-            int j;
-
-            for (j = 0; j < instIdsLen; j++)
-                if (!strcmp(instance->instanceId, instIds[j]))
-                    break;
-
-            if (j >= instIdsLen)
-                // instance of no relevance right now
-                continue;
-        }
-
         assert(k < total);
         rss[k] = EUCA_ZALLOC(1, sizeof(sensorResource));
         if (sensor_get_instance_data(instance->instanceId, sensorIds, sensorIdsLen, rss + k, 1) != EUCA_OK) {
             LOGDEBUG("[%s] failed to retrieve sensor data\n", instance->instanceId);
             EUCA_FREE(rss[k]);
         } else {
+            // leave out what the caller has already seen
+            sensor_trim_resource(rss[k], sinceSequenceNum);
             k++;
         }
     }
 
     *outResourcesLen = k;
     *outResources = rss;
-    sem_v(inst_copy_sem);
+    pthread_rwlock_unlock(&inst_copy_lock);
 
     LOGDEBUG("found %d resource(s)\n", k);
     return EUCA_OK;
@@ -348,7 +348,7 @@ static void *rebooting_thread(void *arg)
 
     LOGDEBUG("[%s] spawning rebooting thread\n", instance->instanceId);
 
-    if ((conn = lock_hypervisor_conn()) == NULL) {
+    if ((conn = lock_domain_conn(instance->instanceId)) == NULL) {
         LOGERROR("[%s] cannot connect to hypervisor to restart instance, giving up\n", instance->instanceId);
         EUCA_FREE(params);
         return NULL;
@@ -356,7 +356,7 @@ static void *rebooting_thread(void *arg)
     dom = virDomainLookupByName(conn, instance->instanceId);
     if (dom == NULL) {
         LOGERROR("[%s] cannot locate instance to reboot, giving up\n", instance->instanceId);
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instance->instanceId);
         EUCA_FREE(params);
         return NULL;
     }
@@ -365,12 +365,12 @@ static void *rebooting_thread(void *arg)
     if (xml == NULL) {
         LOGERROR("[%s] cannot obtain metadata for instance to reboot, giving up\n", instance->instanceId);
         virDomainFree(dom);            // release libvirt resource
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instance->instanceId);
         EUCA_FREE(params);
         return NULL;
     }
     virDomainFree(dom);                // release libvirt resource
-    unlock_hypervisor_conn();
+    unlock_domain_conn(instance->instanceId);
 
     // try shutdown first, then kill it if uncooperative
     if (shutdown_then_destroy_domain(instance->instanceId, TRUE) != EUCA_OK) {
@@ -386,7 +386,7 @@ static void *rebooting_thread(void *arg)
     sensor_shift_metric(instance->instanceId, "NetworkIn");
     sensor_shift_metric(instance->instanceId, "NetworkOut");
 
-    if ((conn = lock_hypervisor_conn()) == NULL) {
+    if ((conn = lock_domain_conn(instance->instanceId)) == NULL) {
         LOGERROR("[%s] cannot connect to hypervisor to restart instance, giving up\n", instance->instanceId);
         EUCA_FREE(params);
         return NULL;
@@ -397,7 +397,9 @@ static void *rebooting_thread(void *arg)
         // need to sleep to allow midolman to update the VM interface
         sleep(10);
     }
+    sem_p(hyp_sem);                    // one domain creation at a time
     dom = virDomainCreateLinux(conn, xml, 0);
+    sem_v(hyp_sem);
     if (dom == NULL) {
         LOGERROR("[%s] failed to restart instance\n", instance->instanceId);
         change_state(instance, SHUTOFF);
@@ -421,7 +423,7 @@ static void *rebooting_thread(void *arg)
     }
     EUCA_FREE(xml);
 
-    unlock_hypervisor_conn();
+    unlock_domain_conn(instance->instanceId);
     unset_corrid(get_corrid());
     EUCA_FREE(params);
     return NULL;
@@ -600,7 +602,7 @@ static void *migrating_thread(void *arg)
 
     LOGTRACE("invoked for %s\n", instance->instanceId);
 
-    if ((conn = lock_hypervisor_conn()) == NULL) {
+    if ((conn = lock_domain_conn(instance->instanceId)) == NULL) {
         LOGERROR("[%s] cannot migrate instance %s (failed to connect to hypervisor), giving up and rolling back.\n", instance->instanceId, instance->instanceId);
         migration_error++;
         goto out;
@@ -656,7 +658,7 @@ out:
         virDomainFree(dom);
 
     if (conn != NULL)
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instance->instanceId);
 
     sem_p(inst_sem);
     LOGDEBUG("%d outgoing migrations still active\n", --outgoing_migrations_in_progress);
@@ -667,7 +669,7 @@ out:
         // both the source and destination nodes to report the same instance
         // as Extant/NOT_MIGRATING, which is confusing!
         instance->migration_state = MIGRATION_CLEANING;
-        save_instance_struct(instance);
+        flush_instance_struct(instance);
         copy_instances();
     }
     sem_v(inst_sem);
@@ -748,7 +750,7 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
                 euca_strncpy(instance->migration_dst, destNodeName, HOSTNAME_SIZE);
                 euca_strncpy(instance->migration_credentials, credentials, CREDENTIAL_SIZE);
                 instance->migrationTime = time(NULL);
-                save_instance_struct(instance);
+                flush_instance_struct(instance);
                 copy_instances();
                 sem_v(inst_sem);
 
@@ -765,7 +767,7 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
                 }
                 sem_p(inst_sem);
                 instance->migration_state = MIGRATION_READY;
-                save_instance_struct(instance);
+                flush_instance_struct(instance);
                 copy_instances();
                 sem_v(inst_sem);
 
@@ -787,7 +789,7 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
                 outgoing_migrations_in_progress++;
                 LOGINFO("[%s] migration source initiating %s > %s [creds=%s] (1 of %d active outgoing migrations)\n", instance->instanceId, instance->migration_src,
                         instance->migration_dst, (instance->migration_credentials == NULL) ? "UNSET" : "present", outgoing_migrations_in_progress);
-                save_instance_struct(instance);
+                flush_instance_struct(instance);
                 copy_instances();
                 sem_v(inst_sem);
 
@@ -831,7 +833,7 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
                         LOGDEBUG("[%s] marked for cleanup\n", instance->instanceId);
                         change_state(instance, SHUTOFF);
                         instance->migration_state = MIGRATION_CLEANING;
-                        save_instance_struct(instance);
+                        flush_instance_struct(instance);
                     }
                 }
                 sem_v(inst_sem);
@@ -888,8 +890,7 @@ static int doMigrateInstances(struct nc_state_t *nc, ncMetadata * pMeta, ncInsta
             set_instance_params(instance);
 
             if ((error = create_instance_backing(instance, TRUE))   // create files that back the disks
-                || (error = gen_instance_xml(instance)) // create euca-specific instance XML file
-                || (error = gen_libvirt_instance_xml(instance))) {  // transform euca-specific XML into libvirt XML
+                || (error = gen_instance_and_libvirt_xml(instance))) {  // create euca-specific instance XML and transform it into libvirt XML
                 LOGERROR("[%s] failed to prepare images for migrating instance (error=%d)\n", instance->instanceId, error);
                 goto failed_dest;
             }
@@ -929,7 +930,7 @@ unroll:
             instance->bootTime = time(NULL);    // otherwise nc_state.booting_cleanup_threshold will kick in
             change_state(instance, BOOTING);    // not STAGING, since in that mode we don't poll hypervisor for info
             LOGINFO("[%s] migration destination ready %s > %s\n", instance->instanceId, instance->migration_src, instance->migration_dst);
-            save_instance_struct(instance);
+            flush_instance_struct(instance);
 
             error = add_instance(&global_instances, instance);
             copy_instances();
@@ -973,11 +974,11 @@ failed_dest:
             if (!incoming_migrations_in_progress) {
                 int incoming_migrations_pending = 0;
                 LOGINFO("[%s] no remaining active incoming migrations -- checking to see if there are any pending migrations\n", instance->instanceId);
-                bunchOfInstances *head = NULL;
-                for (head = global_instances; head; head = head->next) {
-                    if ((head->instance->migration_state == MIGRATION_PREPARING) || (head->instance->migration_state == MIGRATION_READY)) {
-                        LOGINFO("[%s] is pending migration, state='%s', deferring deauthorization of migration keys\n", head->instance->instanceId,
-                                migration_state_names[head->instance->migration_state]);
+                for (int i = 0; i < total_instances(&global_instances); i++) {
+                    ncInstance *other = global_instances->instances[i];
+                    if ((other->migration_state == MIGRATION_PREPARING) || (other->migration_state == MIGRATION_READY)) {
+                        LOGINFO("[%s] is pending migration, state='%s', deferring deauthorization of migration keys\n", other->instanceId,
+                                migration_state_names[other->migration_state]);
                         incoming_migrations_pending++;
                     }
                 }
@@ -279,7 +279,7 @@ static int doRebootInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *ins
         return (EUCA_NOT_FOUND_ERROR);
 
     /* reboot the Xen domain */
-    if ((conn = lock_hypervisor_conn()) != NULL) {
+    if ((conn = lock_domain_conn(instanceId)) != NULL) {
         dom = virDomainLookupByName(conn, instanceId);
         if (dom) {
             // stop polling so values after reboot are not picked up until after we shift the metric
@@ -306,7 +306,7 @@ static int doRebootInstance(struct nc_state_t *nc, ncMetadata * pMeta, char *ins
                 LOGWARN("[%s] domain to be rebooted not running on hypervisor\n", instanceId);
             }
         }
-        unlock_hypervisor_conn();
+        unlock_domain_conn(instanceId);
     }
 
     return (EUCA_OK);
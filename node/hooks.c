@@ -81,8 +81,14 @@
 #include <string.h>
 #include <time.h>
 #include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
 #include <sys/wait.h>                  // WEXITSTATUS on Lucid
 
 #include <eucalyptus.h>
@@ -98,6 +104,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HOOK_DAEMON_SUFFIX                       ".daemon"  //!< hooks with this suffix are started once and fed events over a pipe
+#define HOOK_DAEMON_ARG                          "daemon"   //!< first argument a hook daemon is started with
+#define HOOK_DAEMON_START_TIMEOUT_MS             10000  //!< how long a hook daemon has to announce its events
+#define HOOK_DAEMON_CALL_TIMEOUT_MS              120000 //!< how long a hook daemon has to answer an event
+#define HOOK_DAEMON_LINE_SIZE                    1024   //!< longest line exchanged with a hook daemon
+
+//! Changes to the hooks directory that invalidate the cached hook set
+#define HOOKS_INOTIFY_MASK                       (IN_CREATE | IN_DELETE | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -116,6 +131,24 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A long-running hook daemon, shared by the hook set listing it and the threads sending it events
+typedef struct hook_daemon_t {
+    pthread_mutex_t mutex;             //!< one event at a time, guards pid and fd
+    char path[EUCA_MAX_PATH];          //!< full path of the executable
+    pid_t pid;                         //!< process of the running daemon or -1
+    int fd;                            //!< our end of the daemon's stdin/stdout or -1
+    char events[HOOK_DAEMON_LINE_SIZE];    //!< events the daemon asked for, as " event1 event2 " or " * " for all (under hooks_mutex)
+    int refs;                          //!< references from the hook set and from callers (under hooks_mutex)
+    struct hook_daemon_t *next;        //!< next unreferenced daemon waiting to be stopped (under hooks_mutex)
+} hook_daemon;
+
+//! An executable found in the hooks directory
+typedef struct hook_t {
+    char path[EUCA_MAX_PATH];          //!< full path of the executable
+    time_t mtime;                      //!< modification time when it was found, to restart changed daemons
+    hook_daemon *daemon;               //!< the daemon of a long-running hook, NULL for a hook exec'ed per event
+} hook;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -144,12 +177,32 @@ static boolean initialized = FALSE;    //!< To check wether or not the hooks wer
 static char euca_path[EUCA_MAX_PATH] = "";  //!< eucalyptus path
 static char hooks_path[EUCA_MAX_PATH] = ""; //!< hook path
 
+static pthread_mutex_t hooks_mutex = PTHREAD_MUTEX_INITIALIZER; //!< guards everything below, never held while talking to a daemon
+static hook *hooks = NULL;             //!< cached hook set, sorted by name
+static int hooks_len = 0;              //!< number of entries in hooks[]
+static boolean hooks_dir_ok = FALSE;   //!< whether the last scan of the hooks directory succeeded
+static boolean hooks_stale = TRUE;     //!< whether hooks[] must be rebuilt before use
+static int inotify_fd = -1;            //!< watches the hooks directory or -1 to rescan on every event
+static hook_daemon *dead_daemons = NULL;    //!< daemons no longer referenced, stopped by reap_hook_daemons()
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static long long now_ms(void);
+static int read_daemon_line(hook_daemon * h, char *buf, int buf_size, int timeout_ms);
+static int start_hook_daemon(hook_daemon * h);
+static void stop_hook_daemon(hook_daemon * h);
+static int call_hook_daemon(hook_daemon * h, const char *event_name, const char *param1);
+static boolean hook_wants(const hook_daemon * h, const char *event_name);
+static void put_hook_daemon(hook_daemon * h);
+static void reap_hook_daemons(void);
+static void free_hooks(void);
+static void scan_hooks(void);
+static void refresh_hooks(void);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -162,6 +215,421 @@ static char hooks_path[EUCA_MAX_PATH] = ""; //!< hook path
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//!
+//! Monotonic clock in milliseconds, for the hook daemon timeouts
+//!
+//! @return the current time in milliseconds
+//!
+static long long now_ms(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000L));
+}
+
+//!
+//! Reads one newline-terminated line from a hook daemon. Daemons only
+//! write in response to us, so anything past the newline is discarded.
+//!
+//! @param[in] h the hook daemon to read from
+//! @param[out] buf buffer for the line, without the newline
+//! @param[in] buf_size size of buf
+//! @param[in] timeout_ms how long to wait for the whole line
+//!
+//! @return EUCA_OK on success, EUCA_TIMEOUT_ERROR if the daemon did not answer in time
+//!         or EUCA_IO_ERROR if it went away
+//!
+static int read_daemon_line(hook_daemon * h, char *buf, int buf_size, int timeout_ms)
+{
+    int len = 0;
+    ssize_t got = 0;
+    char *nl = NULL;
+    long long deadline = now_ms() + timeout_ms;
+    struct pollfd pfd = { 0 };
+
+    while (len < (buf_size - 1)) {
+        long long left = deadline - now_ms();
+        if (left <= 0)
+            return (EUCA_TIMEOUT_ERROR);
+
+        pfd.fd = h->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (int)left) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        if (pfd.revents == 0)
+            continue;
+
+        if ((got = read(h->fd, buf + len, (buf_size - 1 - len))) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        if (got == 0)
+            return (EUCA_IO_ERROR);   // daemon exited or closed its stdout
+        len += got;
+        buf[len] = '\0';
+        if ((nl = strchr(buf, '\n')) != NULL) {
+            *nl = '\0';
+            return (EUCA_OK);
+        }
+    }
+    return (EUCA_IO_ERROR);           // line too long
+}
+
+//!
+//! Starts a hook daemon as '<path> daemon <eucalyptus home>' with both its
+//! stdin and stdout connected to us and waits for the first line it prints,
+//! which lists the events it wants ('*' for all of them, empty for none).
+//! Afterwards, every such event is written to it as '<event> <param1>\n',
+//! and it answers each with its exit status on a line of its own.
+//!
+//! @param[in] h the hook daemon to start
+//!
+//! @return EUCA_OK on success or the proper error code
+//!
+//! @pre The daemon's mutex must be held, and not the hooks_mutex
+//!
+static int start_hook_daemon(hook_daemon * h)
+{
+    int rc = EUCA_OK;
+    int sv[2] = { -1, -1 };
+    char line[HOOK_DAEMON_LINE_SIZE] = "";
+    char events[HOOK_DAEMON_LINE_SIZE] = "";
+    char *tok = NULL;
+    char *saveptr = NULL;
+
+    // a socket rather than a pair of pipes so that writes to a dead daemon
+    // can be made with MSG_NOSIGNAL instead of killing the NC with SIGPIPE
+    if (socketpair(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0, sv) != 0) {
+        LOGERROR("failed to create a socket for hook daemon %s: %s\n", h->path, strerror(errno));
+        return (EUCA_ERROR);
+    }
+
+    if ((h->pid = fork()) == -1) {
+        LOGERROR("failed to fork hook daemon %s: %s\n", h->path, strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return (EUCA_THREAD_ERROR);
+    }
+
+    if (h->pid == 0) {
+        // only async-signal-safe calls from here on, other threads may hold locks
+        if ((dup2(sv[1], STDIN_FILENO) == -1) || (dup2(sv[1], STDOUT_FILENO) == -1))
+            _exit(127);
+        execl(h->path, h->path, HOOK_DAEMON_ARG, euca_path, NULL);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    h->fd = sv[0];
+
+    if ((rc = read_daemon_line(h, line, sizeof(line), HOOK_DAEMON_START_TIMEOUT_MS)) != EUCA_OK) {
+        LOGERROR("hook daemon %s did not announce its events (rc=%d)\n", h->path, rc);
+        stop_hook_daemon(h);
+        return (rc);
+    }
+
+    euca_strncpy(events, " ", sizeof(events));
+    for (tok = strtok_r(line, " \t\r", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t\r", &saveptr)) {
+        euca_strncat(events, tok, sizeof(events));
+        euca_strncat(events, " ", sizeof(events));
+    }
+
+    pthread_mutex_lock(&hooks_mutex);
+    {
+        euca_strncpy(h->events, events, sizeof(h->events));
+    }
+    pthread_mutex_unlock(&hooks_mutex);
+
+    LOGINFO("started hook daemon %s (pid=%d) for events:%s\n", h->path, h->pid, events);
+    return (EUCA_OK);
+}
+
+//!
+//! Stops a hook daemon by closing its stdin, killing it if it does not exit on its own
+//!
+//! @param[in] h the hook daemon to stop
+//!
+//! @pre The daemon's mutex must be held, or the daemon no longer referenced
+//!
+static void stop_hook_daemon(hook_daemon * h)
+{
+    int status = 0;
+
+    if (h->fd >= 0) {
+        close(h->fd);
+        h->fd = -1;
+    }
+
+    if (h->pid > 0) {
+        if (timewait(h->pid, &status, 1) == 0)
+            killwait(h->pid);
+        LOGDEBUG("stopped hook daemon %s (pid=%d)\n", h->path, h->pid);
+    }
+    h->pid = -1;
+}
+
+//!
+//! Delivers an event to a hook daemon, (re)starting it if necessary. A daemon
+//! that just started only gets the event if it asked for it.
+//!
+//! @param[in] h the hook daemon
+//! @param[in] event_name the event to deliver
+//! @param[in] param1 the event parameter, if any
+//!
+//! @return EUCA_OK if the daemon answered with status 0 or EUCA_ERROR otherwise
+//!
+//! @pre The daemon's mutex must be held, and not the hooks_mutex
+//!
+static int call_hook_daemon(hook_daemon * h, const char *event_name, const char *param1)
+{
+    int rc = EUCA_OK;
+    int len = 0;
+    int sent = 0;
+    boolean wants = TRUE;
+    ssize_t wrote = 0;
+    char line[HOOK_DAEMON_LINE_SIZE] = "";
+
+    if (h->pid < 0) {
+        if (start_hook_daemon(h) != EUCA_OK)
+            return (EUCA_ERROR);
+
+        pthread_mutex_lock(&hooks_mutex);
+        {
+            wants = hook_wants(h, event_name);
+        }
+        pthread_mutex_unlock(&hooks_mutex);
+        if (!wants)
+            return (EUCA_OK);
+    }
+
+    len = snprintf(line, sizeof(line), "%s %s\n", event_name, ((param1 != NULL) ? param1 : ""));
+    if ((len < 0) || (len >= (int)sizeof(line))) {
+        LOGERROR("event '%s' is too long for hook daemon %s\n", event_name, h->path);
+        return (EUCA_ERROR);
+    }
+
+    LOGDEBUG("sending '%s %s' to hook daemon %s\n", event_name, ((param1 != NULL) ? param1 : ""), h->path);
+    while (sent < len) {
+        if ((wrote = send(h->fd, line + sent, (len - sent), MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to send '%s' to hook daemon %s: %s\n", event_name, h->path, strerror(errno));
+            stop_hook_daemon(h);
+            return (EUCA_ERROR);
+        }
+        sent += wrote;
+    }
+
+    if ((rc = read_daemon_line(h, line, sizeof(line), HOOK_DAEMON_CALL_TIMEOUT_MS)) != EUCA_OK) {
+        LOGERROR("hook daemon %s did not answer '%s' (rc=%d)\n", h->path, event_name, rc);
+        stop_hook_daemon(h);
+        return (EUCA_ERROR);
+    }
+
+    if ((rc = atoi(line)) != 0) {
+        LOGERROR("hook daemon %s failed '%s %s %s' with %d\n", h->path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), rc);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Whether a hook daemon is interested in an event: the ones it announced,
+//! or all of them until it starts. Plain hooks get every event.
+//!
+//! @param[in] h the hook daemon
+//! @param[in] event_name the event
+//!
+//! @return TRUE if the event should be delivered to the daemon
+//!
+//! @pre The hooks_mutex must be held
+//!
+static boolean hook_wants(const hook_daemon * h, const char *event_name)
+{
+    char key[HOOK_DAEMON_LINE_SIZE] = "";
+
+    if (strstr(h->events, " * "))
+        return (TRUE);
+
+    snprintf(key, sizeof(key), " %s ", event_name);
+    return ((strstr(h->events, key) != NULL) ? TRUE : FALSE);
+}
+
+//!
+//! Drops a reference to a hook daemon. The last one queues it to be stopped
+//! by reap_hook_daemons(), outside of the lock.
+//!
+//! @param[in] h the hook daemon
+//!
+//! @pre The hooks_mutex must be held
+//!
+static void put_hook_daemon(hook_daemon * h)
+{
+    if (--h->refs == 0) {
+        h->next = dead_daemons;
+        dead_daemons = h;
+    }
+}
+
+//!
+//! Stops and frees the hook daemons nobody references anymore
+//!
+//! @pre The hooks_mutex must not be held
+//!
+static void reap_hook_daemons(void)
+{
+    hook_daemon *h = NULL;
+    hook_daemon *dead = NULL;
+
+    pthread_mutex_lock(&hooks_mutex);
+    {
+        dead = dead_daemons;
+        dead_daemons = NULL;
+    }
+    pthread_mutex_unlock(&hooks_mutex);
+
+    while ((h = dead) != NULL) {
+        dead = h->next;
+        stop_hook_daemon(h);
+        pthread_mutex_destroy(&(h->mutex));
+        EUCA_FREE(h);
+    }
+}
+
+//!
+//! Empties the hook set, queuing the daemons no caller is using to be stopped
+//!
+//! @pre The hooks_mutex must be held
+//!
+static void free_hooks(void)
+{
+    for (int i = 0; i < hooks_len; i++) {
+        if (hooks[i].daemon != NULL)
+            put_hook_daemon(hooks[i].daemon);
+    }
+    EUCA_FREE(hooks);
+    hooks_len = 0;
+}
+
+//!
+//! Rebuilds the hook set from the hooks directory. Daemons that are still
+//! there, unchanged, keep running; the rest are stopped once no caller uses
+//! them, and new ones are started by their first event.
+//!
+//! @pre The hooks_mutex must be held
+//!
+static void scan_hooks(void)
+{
+    int n = 0;
+    int found = 0;
+    char *entry_name = NULL;
+    struct stat sb = { 0 };
+    struct dirent **entries = NULL;
+    hook *new_hooks = NULL;
+    hook *h = NULL;
+
+    if ((n = scandir(hooks_path, &entries, NULL, alphasort)) < 0) {
+        LOGDEBUG("failed to read hooks directory %s: %s\n", hooks_path, strerror(errno));
+        free_hooks();
+        hooks_dir_ok = FALSE;
+        return;
+    }
+
+    if ((n > 0) && ((new_hooks = EUCA_ZALLOC(n, sizeof(hook))) == NULL)) {
+        LOGERROR("out of memory for %d hooks\n", n);
+    }
+
+    for (int i = 0; (new_hooks != NULL) && (i < n); i++) {
+        entry_name = entries[i]->d_name;
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name))
+            continue;                  // ignore known unrelated files
+
+        h = new_hooks + found;
+        snprintf(h->path, sizeof(h->path), "%s/%s", hooks_path, entry_name);
+        if (stat(h->path, &sb) == -1)
+            continue;                  // ignore access errors
+
+        // cache the hook if...
+        if ((S_ISLNK(sb.st_mode) || S_ISREG(sb.st_mode))    // looks like a file or symlink
+            && (sb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {  // is executable
+            h->mtime = sb.st_mtime;
+            h->daemon = NULL;
+            if ((strlen(entry_name) > strlen(HOOK_DAEMON_SUFFIX))
+                && !strcmp(entry_name + strlen(entry_name) - strlen(HOOK_DAEMON_SUFFIX), HOOK_DAEMON_SUFFIX)) {
+                // keep the daemon of the previous set if its executable did not change
+                for (int j = 0; (h->daemon == NULL) && (j < hooks_len); j++) {
+                    if ((hooks[j].daemon != NULL) && !strcmp(hooks[j].path, h->path) && (hooks[j].mtime == h->mtime)) {
+                        h->daemon = hooks[j].daemon;
+                        h->daemon->refs++;
+                    }
+                }
+
+                if ((h->daemon == NULL) && ((h->daemon = EUCA_ZALLOC(1, sizeof(hook_daemon))) == NULL)) {
+                    LOGERROR("out of memory for hook daemon %s\n", h->path);
+                    continue;
+                }
+
+                if (h->daemon->refs == 0) {
+                    pthread_mutex_init(&(h->daemon->mutex), NULL);
+                    euca_strncpy(h->daemon->path, h->path, sizeof(h->daemon->path));
+                    h->daemon->pid = -1;
+                    h->daemon->fd = -1;
+                    euca_strncpy(h->daemon->events, " * ", sizeof(h->daemon->events));  // until the daemon says otherwise
+                    h->daemon->refs = 1;
+                }
+            }
+            found++;
+        }
+    }
+    for (int i = 0; i < n; i++)
+        free(entries[i]);
+    free(entries);
+
+    free_hooks();
+    hooks = new_hooks;
+    hooks_len = found;
+    hooks_dir_ok = TRUE;
+    LOGDEBUG("found %d hook(s) in %s\n", hooks_len, hooks_path);
+}
+
+//!
+//! Rebuilds the hook set if inotify reported a change to the hooks directory
+//! since the last call. Without inotify, the directory is scanned every time.
+//!
+//! @pre The hooks_mutex must be held
+//!
+static void refresh_hooks(void)
+{
+    ssize_t got = 0;
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev = NULL;
+
+    while ((inotify_fd >= 0) && ((got = read(inotify_fd, buf, sizeof(buf))) > 0)) {
+        hooks_stale = TRUE;
+        for (char *p = buf; p < (buf + got); p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // the directory itself is gone, so there is nothing left to watch
+                LOGWARN("hooks directory %s went away\n", hooks_path);
+                close(inotify_fd);
+                inotify_fd = -1;
+                break;
+            }
+        }
+    }
+
+    if (hooks_stale || (inotify_fd < 0)) {
+        scan_hooks();
+        hooks_stale = FALSE;
+    }
+}
+
 //!
 //! Validate and initialize the Eucalyptus and hook directories to use.
 //!
@@ -176,35 +644,62 @@ int init_hooks(const char *euca_dir, const char *hooks_dir)
     assert(euca_dir);
     assert(hooks_dir);
 
-    euca_strncpy(euca_path, euca_dir, sizeof(euca_path));
-    if (check_directory(euca_path))
-        return (EUCA_ERROR);
+    pthread_mutex_lock(&hooks_mutex);
+    {
+        euca_strncpy(euca_path, euca_dir, sizeof(euca_path));
+        if (check_directory(euca_path)) {
+            pthread_mutex_unlock(&hooks_mutex);
+            return (EUCA_ERROR);
+        }
 
-    euca_strncpy(hooks_path, hooks_dir, sizeof(hooks_path));
-    if (check_directory(hooks_path))
-        return (EUCA_ERROR);
+        euca_strncpy(hooks_path, hooks_dir, sizeof(hooks_path));
+        if (check_directory(hooks_path)) {
+            pthread_mutex_unlock(&hooks_mutex);
+            return (EUCA_ERROR);
+        }
 
-    LOGINFO("using hooks directory %s\n", hooks_path);
-    initialized = TRUE;
+        free_hooks();
+        if (inotify_fd >= 0)
+            close(inotify_fd);
+        if (((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+            || (inotify_add_watch(inotify_fd, hooks_path, HOOKS_INOTIFY_MASK) < 0)) {
+            LOGWARN("cannot watch hooks directory %s (%s), will scan it on every event\n", hooks_path, strerror(errno));
+            if (inotify_fd >= 0)
+                close(inotify_fd);
+            inotify_fd = -1;
+        }
+        hooks_stale = TRUE;
+
+        LOGINFO("using hooks directory %s\n", hooks_path);
+        initialized = TRUE;
+    }
+    pthread_mutex_unlock(&hooks_mutex);
+
+    reap_hook_daemons();
     return (EUCA_OK);
 }
 
 //!
-//! Execute a system command
+//! Runs the hooks for an event: the daemons that asked for it get it over
+//! their pipe, then every other hook is executed in name order. The set
+//! of hooks is cached and only rebuilt when the hooks directory changes,
+//! so an event nobody listens to costs no more than a lock. Hooks run
+//! without the hooks_mutex held, and each daemon only holds up the callers
+//! sending it events, so a slow daemon cannot stall unrelated events.
 //!
 //! @param[in] event_name the event to work on
 //! @param[in] param1 the parameters to pass to the command.
 //!
-//! @return 0 on failure or the proper hook status code [1-99]
+//! @return EUCA_OK if all hooks succeeded or EUCA_ERROR if one failed
 //!
 int call_hooks(const char *event_name, const char *param1)
 {
     int rc = EUCA_OK;
-    DIR *dir = NULL;
-    char *entry_name = NULL;
-    char entry_path[EUCA_MAX_PATH] = "";
-    struct stat sb = { 0 };
-    struct dirent *dir_entry = NULL;
+    int execs = 0;
+    int paths_len = 0;
+    int daemons_len = 0;
+    char **paths = NULL;
+    hook_daemon **daemons = NULL;
 
     assert(event_name);
     if (!initialized) {
@@ -212,36 +707,84 @@ int call_hooks(const char *event_name, const char *param1)
         return (EUCA_OK);
     }
 
-    if ((dir = opendir(hooks_path)) == NULL) {
-        return (EUCA_ERROR);
-    }
+    pthread_mutex_lock(&hooks_mutex);
+    {
+        refresh_hooks();
+        if (!hooks_dir_ok) {
+            pthread_mutex_unlock(&hooks_mutex);
+            reap_hook_daemons();
+            return (EUCA_ERROR);
+        }
 
-    while ((dir_entry = readdir(dir)) != NULL) {
-        entry_name = dir_entry->d_name;
+        for (int i = 0; i < hooks_len; i++) {
+            if (hooks[i].daemon == NULL)
+                execs++;
+        }
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name))
-            continue;                  // ignore known unrelated files
+        // take a reference on the daemons and copy out the paths, so the hooks run without holding the lock
+        if (((daemons = EUCA_ZALLOC((hooks_len + 1), sizeof(hook_daemon *))) == NULL) || ((paths = EUCA_ZALLOC((execs + 1), sizeof(char *))) == NULL)) {
+            rc = EUCA_MEMORY_ERROR;
+        } else {
+            for (int i = 0; i < hooks_len; i++) {
+                if (hooks[i].daemon != NULL) {
+                    if (hook_wants(hooks[i].daemon, event_name)) {
+                        hooks[i].daemon->refs++;
+                        daemons[daemons_len++] = hooks[i].daemon;
+                    }
+                } else if ((paths[paths_len] = strdup(hooks[i].path)) != NULL) {
+                    paths_len++;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&hooks_mutex);
 
-        // get the path of the directory item
-        snprintf(entry_path, sizeof(entry_path), "%s/%s", hooks_path, entry_name);
-        if (stat(entry_path, &sb) == -1)
-            continue;                  // ignore access errors
+    for (int i = 0; (rc == EUCA_OK) && (i < daemons_len); i++) {
+        pthread_mutex_lock(&(daemons[i]->mutex));
+        {
+            rc = call_hook_daemon(daemons[i], event_name, param1);
+        }
+        pthread_mutex_unlock(&(daemons[i]->mutex));
+    }
 
-        // run the hook if...
-        if ((S_ISLNK(sb.st_mode) || S_ISREG(sb.st_mode))    // looks like a file or symlink
-            && (sb.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH))) {  // is executable
-            LOGDEBUG("executing '%s %s %s %s'\n", entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""));
-            if ((rc = euca_execlp(NULL, entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), NULL)) != EUCA_OK) {
-                LOGERROR("cmd '%s %s %s %s' failed %d\n", entry_path, event_name, euca_path, ((param1 != NULL) ? param1 : ""), rc);
-                break;
-            }
+    if (daemons_len > 0) {
+        pthread_mutex_lock(&hooks_mutex);
+        {
+            for (int i = 0; i < daemons_len; i++)
+                put_hook_daemon(daemons[i]);
+        }
+        pthread_mutex_unlock(&hooks_mutex);
+    }
+    reap_hook_daemons();
+
+    for (int i = 0; (rc == EUCA_OK) && (i < paths_len); i++) {
+        LOGDEBUG("executing '%s %s %s %s'\n", paths[i], event_name, euca_path, ((param1 != NULL) ? param1 : ""));
+        if ((rc = euca_execlp(NULL, paths[i], event_name, euca_path, ((param1 != NULL) ? param1 : ""), NULL)) != EUCA_OK) {
+            LOGERROR("cmd '%s %s %s %s' failed %d\n", paths[i], event_name, euca_path, ((param1 != NULL) ? param1 : ""), rc);
         }
     }
-    closedir(dir);
+
+    for (int i = 0; i < paths_len; i++)
+        EUCA_FREE(paths[i]);
+    EUCA_FREE(paths);
+    EUCA_FREE(daemons);
     return ((rc == EUCA_OK) ? EUCA_OK : EUCA_ERROR);
 }
 
 #ifdef __STANDALONE
+//!
+//! Sends the slow event of the unit test from a thread of its own
+//!
+//! @param[in] arg unused
+//!
+//! @return NULL
+//!
+static void *slow_event_thread(void *arg)
+{
+    call_hooks("e3", "p1");
+    return (NULL);
+}
+
 //!
 //! Main entry point of the application
 //!
@@ -252,20 +795,26 @@ int call_hooks(const char *event_name, const char *param1)
 //!
 int main(int argc, char **argv)
 {
+    int rc = 0;
     int status = 0;
     char d[EUCA_MAX_PATH] = "/tmp/euca-XXXXXX";
     char h0[EUCA_MAX_PATH] = "";
     char h1[EUCA_MAX_PATH] = "";
     char h3[EUCA_MAX_PATH] = "";
     char h4[EUCA_MAX_PATH] = "";
+    char h5[EUCA_MAX_PATH] = "";
+    char h6[EUCA_MAX_PATH] = "";
+    long long start = 0;
+    pthread_t slow_thread = { 0 };
 
-    assert(call_hooks("e1", NULL) != 0);
-    assert(call_hooks("e1", "p1") != 0);
+    assert(call_hooks("e1", NULL) == 0);    // not initialized, so nothing to do
+    assert(call_hooks("e1", "p1") == 0);
     assert(init_hooks("/tmp", "/foobar") != 0);
     assert(init_hooks("/foobar", "/tmp") != 0);
 
     assert(mkdtemp(d) != NULL);
     assert(init_hooks("/tmp", d) == 0);
+    assert(call_hooks("e1", NULL) == 0);    // no hooks yet
 
     snprintf(h1, sizeof(h1), "%s/h1", d);
     write2file(h1, "#!/bin/bash\necho h1 -$1- -$2- -$3-\n");
@@ -281,11 +830,43 @@ int main(int argc, char **argv)
     snprintf(h0, sizeof(h0), "%s/h0", d);
     write2file(h0, "#!/bin/bash\nexit 99;\n");
     chmod(h0, S_IXUSR | S_IRUSR);
-    assert(call_hooks("e1", "p1") == 99);
+    assert(call_hooks("e1", "p1") != 0);    // the new failing hook is noticed
+    assert(unlink(h0) == 0);
+    assert(call_hooks("e1", "p1") == 0);    // and so is its removal
+
+    // a daemon that only wants 'e2' and fails it when the parameter is 'fail'
+    snprintf(h5, sizeof(h5), "%s/h5" HOOK_DAEMON_SUFFIX, d);
+    write2file(h5, "#!/bin/bash\n[ \"$1\" = \"daemon\" ] || exit 1\necho e2\n"
+               "while read ev p; do if [ \"$p\" = \"fail\" ]; then echo 1; else echo 0; fi; done\n");
+    chmod(h5, S_IXUSR | S_IRUSR);
+    assert(call_hooks("e2", "p1") == 0);
+    assert(call_hooks("e2", "fail") != 0);
+    assert(call_hooks("e1", "fail") == 0);  // not an event the daemon asked for
+
+    // a daemon busy with 'e3' holds up neither its peers nor events it did not ask for
+    snprintf(h6, sizeof(h6), "%s/h6" HOOK_DAEMON_SUFFIX, d);
+    write2file(h6, "#!/bin/bash\n[ \"$1\" = \"daemon\" ] || exit 1\necho e3\n" "while read ev p; do sleep 3; echo 0; done\n");
+    chmod(h6, S_IXUSR | S_IRUSR);
+    rc = call_hooks("e1", "p1");       // starts h6
+    assert(rc == 0);
+    rc = pthread_create(&slow_thread, NULL, slow_event_thread, NULL);
+    assert(rc == 0);
+    usleep(500000);
+    start = now_ms();
+    rc = call_hooks("e2", "p1");
+    assert(rc == 0);
+    rc = call_hooks("e1", "p1");
+    assert(rc == 0);
+    assert((now_ms() - start) < 2000);
+    pthread_join(slow_thread, NULL);
+    rc = unlink(h6);
+    assert(rc == 0);
+
+    assert(unlink(h5) == 0);
+    assert(call_hooks("e2", "fail") == 0);  // daemon is stopped along with its file
 
     assert(rmdir(h4) == 0);
     assert(unlink(h3) == 0);
-    assert(unlink(h0) == 0);
     assert(unlink(h1) == 0);
     assert(rmdir(d) == 0);
     printf("removed directory %s\n", d);
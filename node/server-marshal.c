@@ -1357,6 +1357,7 @@ adb_ncDescribeSensorsResponse_t *ncDescribeSensorsMarshal(adb_ncDescribeSensors_
     int sensorIdsLen = 0;
     int outResourcesLen = 0;
     long long collectionIntervalTimeMs = 0;
+    long long sinceSequenceNum = -1;
     char **sensorIds = NULL;
     char **instIds = NULL;
     ncMetadata meta = { 0 };
@@ -1404,11 +1405,14 @@ adb_ncDescribeSensorsResponse_t *ncDescribeSensorsMarshal(adb_ncDescribeSensors_
             sensorIds[i] = adb_ncDescribeSensorsType_get_sensorIds_at(input, env, i);
         }
 
+        if (!adb_ncDescribeSensorsType_is_sinceSequenceNum_nil(input, env))
+            sinceSequenceNum = adb_ncDescribeSensorsType_get_sinceSequenceNum(input, env);
+
         // do it
         EUCA_MESSAGE_UNMARSHAL(ncDescribeSensorsType, input, (&meta));
 
         threadCorrelationId *corr_id = set_corrid(meta.correlationId);
-        error = doDescribeSensors(&meta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, &outResources, &outResourcesLen);
+        error = doDescribeSensors(&meta, historySize, collectionIntervalTimeMs, instIds, instIdsLen, sensorIds, sensorIdsLen, sinceSequenceNum, &outResources, &outResourcesLen);
         unset_corrid(corr_id);
 
         if (error != EUCA_OK) {
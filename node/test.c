@@ -261,12 +261,29 @@ int main(int argc, char **argv)
         }
         n = total_instances(&bag);
         assert(n == INSTS);
+        n = add_instance(&bag, Insts[INSTS / 2]);
+        assert(n == EUCA_DUPLICATE_ERROR);
         n = remove_instance(&bag, Insts[0]);
         assert(n == EUCA_OK);
         n = remove_instance(&bag, Insts[INSTS - 1]);
         assert(n == EUCA_OK);
+        n = remove_instance(&bag, Insts[0]);
+        assert(n == EUCA_NOT_FOUND_ERROR);
         n = total_instances(&bag);
         assert(n == INSTS - 2);
+        for (i = 1; i < INSTS - 1; i++) {
+            char id[10];
+            sprintf(id, "i-%d", i);
+            assert(find_instance(&bag, id) == Insts[i]);
+        }
+        assert(find_instance(&bag, "i-0") == NULL);
+        for (i = 1; i < INSTS - 1; i++) {
+            n = remove_instance(&bag, Insts[i]);
+            assert(n == EUCA_OK);
+        }
+        assert(bag == NULL);
+        for (i = 0; i < INSTS; i++)
+            free_instance(&Insts[i]);
 
         printf("========> testing volume struct management\n");
         ncVolume *v;
@@ -118,6 +118,15 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Compiled XSL-T stylesheet shared by concurrent transforms
+typedef struct cached_stylesheet_t {
+    xsltStylesheetPtr stylesheet;      //!< The compiled stylesheet
+    char path[EUCA_MAX_PATH];          //!< Path of the file the stylesheet was compiled from
+    time_t mtime;                      //!< Modification time of the file when it was compiled
+    off_t size;                        //!< Size of the file when it was compiled
+    int refs;                          //!< Number of transforms using it, plus one while it is in the cache
+} cached_stylesheet;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -158,6 +167,7 @@ static boolean config_use_virtio_net = 0;   //!< Set to TRUE if we are using VIR
 static boolean config_cpu_passthrough = 0;  //!< Set to TRUE if host CPU should be passed through to the instance
 static char xslt_path[EUCA_MAX_PATH] = "";  //!< Destination path for the XSLT files
 static pthread_mutex_t xml_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< process-global mutex
+static cached_stylesheet *stylesheet_cache = NULL;  //!< most recently compiled XSL-T stylesheet, guarded by xml_mutex
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -175,8 +185,14 @@ static void cleanup(void);
 static int path_check(const char *path, const char *name);
 static int write_xml_file(const xmlDocPtr doc, const char *instanceId, const char *path, const char *type);
 static void write_vbr_xml(xmlNodePtr vbrs, const virtualBootRecord * vbr);
+static xmlDocPtr build_instance_doc(const ncInstance * instance);
+static xmlDocPtr build_volume_doc(const char *volumeId, const ncInstance * instance, const char *devName, const char *remoteDev);
 
 static void error_handler(void *ctx, const char *fmt, ...) _attribute_format_(2, 3);
+static cached_stylesheet *get_stylesheet(const char *xsltStylesheetPath);
+static void put_stylesheet(cached_stylesheet * cs);
+static int transform_xml_doc(const char *xsltStylesheetPath, xmlDocPtr doc, const char *inputName, const char *outputXmlPath, char *outputXmlBuffer,
+                             int outputXmlBufferSize);
 static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inputXmlPath, const char *outputXmlPath, char *outputXmlBuffer, int outputXmlBufferSize);
 
 #ifdef __STANDALONE
@@ -468,20 +484,14 @@ static void write_vbr_xml(xmlNodePtr vbrs, const virtualBootRecord * vbr)
 }
 
 //!
-//! Encodes instance metadata (contained in ncInstance struct) in XML
-//! and writes it to file instance->xmlFilePath (/path/to/instance/instance.xml)
-//! That file gets processed through tools/libvirt.xsl (/etc/eucalyptus/libvirt.xsl)
-//! to produce /path/to/instance/instance-libvirt.xml file that is passed to libvirt.
+//! Encodes instance metadata (contained in ncInstance struct) in an XML document
 //!
 //! @param[in] instance a pointer to the instance to generate XML from
 //!
-//! @return EUCA_OK if the operation is successful. Known error code returned include EUCA_ERROR.
-//!
-//! @see write_xml_file()
+//! @return a pointer to the new document, to be freed with xmlFreeDoc(), or NULL on failure
 //!
-int gen_instance_xml(const ncInstance * instance)
+static xmlDocPtr build_instance_doc(const ncInstance * instance)
 {
-    int ret = EUCA_ERROR;
     int i = 0;
     int j = 0;
     char *path = NULL;
@@ -508,262 +518,286 @@ int gen_instance_xml(const ncInstance * instance)
     xmlNodePtr vols = NULL;
     const virtualBootRecord *vbr = NULL;
 
-    INIT();
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    instanceNode = xmlNewNode(NULL, BAD_CAST "instance");
+    xmlDocSetRootElement(doc, instanceNode);
+
+    // hypervisor-related specs
+    hypervisor = xmlNewChild(instanceNode, NULL, BAD_CAST "hypervisor", NULL);
+    _ATTRIBUTE(hypervisor, "type", instance->hypervisorType);
+    _ATTRIBUTE(hypervisor, "capability", hypervisorCapabilityTypeNames[instance->hypervisorCapability]);
+    snprintf(bitness, 4, "%d", instance->hypervisorBitness);
+    _ATTRIBUTE(hypervisor, "bitness", bitness);
+    _ATTRIBUTE(hypervisor, "requiresDisk", (instance->combinePartitions ? "true" : "false"));
+
+    //! backing specification (@todo maybe expand this with device maps or whatnot?)
+    backing = xmlNewChild(instanceNode, NULL, BAD_CAST "backing", NULL);
+    root = xmlNewChild(backing, NULL, BAD_CAST "root", NULL);
+    if (instance->params.root != NULL) {
+        _ATTRIBUTE(root, "type", ncResourceTypeNames[instance->params.root->type]);
+    } else {
+        _ATTRIBUTE(root, "type", "unknown");    // for when gen_instance_xml is called with instance struct that hasn't been initialized
+    }
 
-    pthread_mutex_lock(&xml_mutex);
-    {
-        doc = xmlNewDoc(BAD_CAST "1.0");
-        instanceNode = xmlNewNode(NULL, BAD_CAST "instance");
-        xmlDocSetRootElement(doc, instanceNode);
-
-        // hypervisor-related specs
-        hypervisor = xmlNewChild(instanceNode, NULL, BAD_CAST "hypervisor", NULL);
-        _ATTRIBUTE(hypervisor, "type", instance->hypervisorType);
-        _ATTRIBUTE(hypervisor, "capability", hypervisorCapabilityTypeNames[instance->hypervisorCapability]);
-        snprintf(bitness, 4, "%d", instance->hypervisorBitness);
-        _ATTRIBUTE(hypervisor, "bitness", bitness);
-        _ATTRIBUTE(hypervisor, "requiresDisk", (instance->combinePartitions ? "true" : "false"));
-
-        //! backing specification (@todo maybe expand this with device maps or whatnot?)
-        backing = xmlNewChild(instanceNode, NULL, BAD_CAST "backing", NULL);
-        root = xmlNewChild(backing, NULL, BAD_CAST "root", NULL);
-        if (instance->params.root != NULL) {
-            _ATTRIBUTE(root, "type", ncResourceTypeNames[instance->params.root->type]);
-        } else {
-            _ATTRIBUTE(root, "type", "unknown");    // for when gen_instance_xml is called with instance struct that hasn't been initialized
-        }
+    _ELEMENT(instanceNode, "name", instance->instanceId);
+    _ELEMENT(instanceNode, "uuid", instance->uuid);
+    _ELEMENT(instanceNode, "reservation", instance->reservationId);
+    _ELEMENT(instanceNode, "user", instance->userId);
+    _ELEMENT(instanceNode, "owner", instance->ownerId);
+    _ELEMENT(instanceNode, "account", instance->accountId);
+    _ELEMENT(instanceNode, "imageId", instance->imageId);   // may be unused
+    _ELEMENT(instanceNode, "kernelId", instance->kernelId); // may be unused
+    _ELEMENT(instanceNode, "ramdiskId", instance->ramdiskId);   // may be unused
+    _ELEMENT(instanceNode, "dnsName", instance->dnsName);
+    _ELEMENT(instanceNode, "privateDnsName", instance->privateDnsName);
+    _ELEMENT(instanceNode, "instancePath", instance->instancePath);
+
+    if (instance->params.kernel) {
+        path = instance->params.kernel->backingPath;
+        if (path_check(path, "kernel"))
+            goto error;             // sanity check
+        _ELEMENT(instanceNode, "kernel", path);
+    }
 
-        _ELEMENT(instanceNode, "name", instance->instanceId);
-        _ELEMENT(instanceNode, "uuid", instance->uuid);
-        _ELEMENT(instanceNode, "reservation", instance->reservationId);
-        _ELEMENT(instanceNode, "user", instance->userId);
-        _ELEMENT(instanceNode, "owner", instance->ownerId);
-        _ELEMENT(instanceNode, "account", instance->accountId);
-        _ELEMENT(instanceNode, "imageId", instance->imageId);   // may be unused
-        _ELEMENT(instanceNode, "kernelId", instance->kernelId); // may be unused
-        _ELEMENT(instanceNode, "ramdiskId", instance->ramdiskId);   // may be unused
-        _ELEMENT(instanceNode, "dnsName", instance->dnsName);
-        _ELEMENT(instanceNode, "privateDnsName", instance->privateDnsName);
-        _ELEMENT(instanceNode, "instancePath", instance->instancePath);
-
-        if (instance->params.kernel) {
-            path = instance->params.kernel->backingPath;
-            if (path_check(path, "kernel"))
-                goto free;             // sanity check
-            _ELEMENT(instanceNode, "kernel", path);
-        }
+    if (instance->params.ramdisk) {
+        path = instance->params.ramdisk->backingPath;
+        if (path_check(path, "ramdisk"))
+            goto error;             // sanity check
+        _ELEMENT(instanceNode, "ramdisk", path);
+    }
 
-        if (instance->params.ramdisk) {
-            path = instance->params.ramdisk->backingPath;
-            if (path_check(path, "ramdisk"))
-                goto free;             // sanity check
-            _ELEMENT(instanceNode, "ramdisk", path);
-        }
+    _ELEMENT(instanceNode, "xmlFilePath", instance->xmlFilePath);
+    _ELEMENT(instanceNode, "libvirtFilePath", instance->libvirtFilePath);
+    _ELEMENT(instanceNode, "consoleLogPath", instance->consoleFilePath);
+    _ELEMENT(instanceNode, "userData", instance->userData);
+    _ELEMENT(instanceNode, "launchIndex", instance->launchIndex);
+
+    _ELEMENT(instanceNode, "cpuPassthrough", _BOOL(config_cpu_passthrough));
+    snprintf(cores_s, sizeof(cores_s), "%d", instance->params.cores);
+    _ELEMENT(instanceNode, "cores", cores_s);
+    snprintf(memory_s, sizeof(memory_s), "%d", instance->params.mem * 1024);
+    _ELEMENT(instanceNode, "memoryKB", memory_s);
+    snprintf(disk_s, sizeof(disk_s), "%d", instance->params.disk);
+    _ELEMENT(instanceNode, "diskGB", disk_s);
+    _ELEMENT(instanceNode, "VmType", instance->params.name);
+    _ELEMENT(instanceNode, "NicType", libvirtNicTypeNames[instance->params.nicType]);
+    _ELEMENT(instanceNode, "NicDevice", instance->params.guestNicDeviceName);
+    _ELEMENT(instanceNode, "rootDirective", instance->rootDirective);
+
+    // SSH-key related
+    key = _NODE(instanceNode, "key");
+    _ATTRIBUTE(key, "doInjectKey", _BOOL(instance->do_inject_key));
+    _ATTRIBUTE(key, "sshKey", instance->keyName);
+
+    // OS-related specs
+    os = _NODE(instanceNode, "os");
+    _ATTRIBUTE(os, "platform", instance->platform);
+    _ATTRIBUTE(os, "virtioRoot", _BOOL(config_use_virtio_root));
+    _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
+    _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
+
+    // Network groups assigned to the instance
+    groupNames = _NODE(instanceNode, "groupNames");
+    for (i = 0; i < instance->groupNamesSize; i++) {
+        _ELEMENT(groupNames, "name", instance->groupNames[i]);
+    }
 
-        _ELEMENT(instanceNode, "xmlFilePath", instance->xmlFilePath);
-        _ELEMENT(instanceNode, "libvirtFilePath", instance->libvirtFilePath);
-        _ELEMENT(instanceNode, "consoleLogPath", instance->consoleFilePath);
-        _ELEMENT(instanceNode, "userData", instance->userData);
-        _ELEMENT(instanceNode, "launchIndex", instance->launchIndex);
-
-        _ELEMENT(instanceNode, "cpuPassthrough", _BOOL(config_cpu_passthrough));
-        snprintf(cores_s, sizeof(cores_s), "%d", instance->params.cores);
-        _ELEMENT(instanceNode, "cores", cores_s);
-        snprintf(memory_s, sizeof(memory_s), "%d", instance->params.mem * 1024);
-        _ELEMENT(instanceNode, "memoryKB", memory_s);
-        snprintf(disk_s, sizeof(disk_s), "%d", instance->params.disk);
-        _ELEMENT(instanceNode, "diskGB", disk_s);
-        _ELEMENT(instanceNode, "VmType", instance->params.name);
-        _ELEMENT(instanceNode, "NicType", libvirtNicTypeNames[instance->params.nicType]);
-        _ELEMENT(instanceNode, "NicDevice", instance->params.guestNicDeviceName);
-        _ELEMENT(instanceNode, "rootDirective", instance->rootDirective);
-
-        // SSH-key related
-        key = _NODE(instanceNode, "key");
-        _ATTRIBUTE(key, "doInjectKey", _BOOL(instance->do_inject_key));
-        _ATTRIBUTE(key, "sshKey", instance->keyName);
-
-        // OS-related specs
-        os = _NODE(instanceNode, "os");
-        _ATTRIBUTE(os, "platform", instance->platform);
-        _ATTRIBUTE(os, "virtioRoot", _BOOL(config_use_virtio_root));
-        _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
-        _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
-
-        // Network groups assigned to the instance
-        groupNames = _NODE(instanceNode, "groupNames");
-        for (i = 0; i < instance->groupNamesSize; i++) {
-            _ELEMENT(groupNames, "name", instance->groupNames[i]);
-        }
+    // disks specification
+    disks = _NODE(instanceNode, "disks");
+    _ELEMENT(disks, "floppyPath", instance->floppyFilePath);
 
-        // disks specification
-        disks = _NODE(instanceNode, "disks");
-        _ELEMENT(disks, "floppyPath", instance->floppyFilePath);
+    vbrs = _NODE(instanceNode, "vbrs");
 
-        vbrs = _NODE(instanceNode, "vbrs");
+    // the first disk should be the root disk (at least for Windows)
+    for (j = 1; j >= 0; j--) {
+        for (i = 0; ((i < EUCA_MAX_VBRS) && (i < instance->params.virtualBootRecordLen)); i++) {
+            vbr = &(instance->params.virtualBootRecord[i]);
 
-        // the first disk should be the root disk (at least for Windows)
-        for (j = 1; j >= 0; j--) {
-            for (i = 0; ((i < EUCA_MAX_VBRS) && (i < instance->params.virtualBootRecordLen)); i++) {
-                vbr = &(instance->params.virtualBootRecord[i]);
+            // skip empty entries, if any
+            if (vbr == NULL)
+                continue;
 
-                // skip empty entries, if any
-                if (vbr == NULL)
-                    continue;
+            // on the first iteration, write all VBRs into their own section
+            if (j)
+                write_vbr_xml(vbrs, vbr);
 
-                // on the first iteration, write all VBRs into their own section
-                if (j)
-                    write_vbr_xml(vbrs, vbr);
+            // do EMI on the first iteration of the outer loop
+            if (j && vbr->type != NC_RESOURCE_IMAGE)
+                continue;
 
-                // do EMI on the first iteration of the outer loop
-                if (j && vbr->type != NC_RESOURCE_IMAGE)
-                    continue;
+            // ignore EMI on the second iteration of the outer loop
+            if (!j && vbr->type == NC_RESOURCE_IMAGE)
+                continue;
 
-                // ignore EMI on the second iteration of the outer loop
-                if (!j && vbr->type == NC_RESOURCE_IMAGE)
-                    continue;
+            // skip anything without a device on the guest, e.g., kernel and ramdisk
+            if (!strcmp("none", vbr->guestDeviceName))
+                continue;
 
-                // skip anything without a device on the guest, e.g., kernel and ramdisk
-                if (!strcmp("none", vbr->guestDeviceName))
+            // for Linux instances on Xen, partitions can be used directly, so disks can be skipped unless booting from EBS
+            if (strstr(instance->platform, "linux") && strstr(instance->hypervisorType, "xen")) {
+                if ((vbr->partitionNumber == 0) && (vbr->type == NC_RESOURCE_IMAGE)) {
                     continue;
-
-                // for Linux instances on Xen, partitions can be used directly, so disks can be skipped unless booting from EBS
-                if (strstr(instance->platform, "linux") && strstr(instance->hypervisorType, "xen")) {
-                    if ((vbr->partitionNumber == 0) && (vbr->type == NC_RESOURCE_IMAGE)) {
-                        continue;
-                    }
-                } else {               // on all other os + hypervisor combinations, disks are used, so partitions must be skipped
-                    if (vbr->partitionNumber > 0) {
-                        continue;
-                    }
                 }
-
-                if (vbr->locationType == NC_LOCATION_SC) {  // for EBS volumes, libvirt XML will be available under /instance/volumes
+            } else {               // on all other os + hypervisor combinations, disks are used, so partitions must be skipped
+                if (vbr->partitionNumber > 0) {
                     continue;
                 }
+            }
 
-                disk = _ELEMENT(disks, "diskPath", vbr->backingPath);
-                _ATTRIBUTE(disk, "targetDeviceType", libvirtDevTypeNames[vbr->guestDeviceType]);
-                _ATTRIBUTE(disk, "targetDeviceName", vbr->guestDeviceName);
-                snprintf(devstr, SMALL_CHAR_BUFFER_SIZE, "%s", vbr->guestDeviceName);
-                if (config_use_virtio_root) {
-                    devstr[0] = 'v';
-                    _ATTRIBUTE(disk, "targetDeviceNameVirtio", devstr);
-                    _ATTRIBUTE(disk, "targetDeviceBusVirtio", "virtio");
-                }
-                _ATTRIBUTE(disk, "targetDeviceBus", libvirtBusTypeNames[vbr->guestDeviceBus]);
-                _ATTRIBUTE(disk, "sourceType", libvirtSourceTypeNames[vbr->backingType]);
-                _ATTRIBUTE(disk, "serial", vbr->guestDeviceSerialId);
-
-                if (j) {
-                    rootNode = _ELEMENT(disks, "root", NULL);
-                    _ATTRIBUTE(rootNode, "device", devstr);
-                    if (get_blkid(vbr->backingPath, root_uuid, sizeof(root_uuid)) == 0) {
-                        assert(strlen(root_uuid));
-                        _ATTRIBUTE(rootNode, "uuid", root_uuid);
-                    }
+            if (vbr->locationType == NC_LOCATION_SC) {  // for EBS volumes, libvirt XML will be available under /instance/volumes
+                continue;
+            }
+
+            disk = _ELEMENT(disks, "diskPath", vbr->backingPath);
+            _ATTRIBUTE(disk, "targetDeviceType", libvirtDevTypeNames[vbr->guestDeviceType]);
+            _ATTRIBUTE(disk, "targetDeviceName", vbr->guestDeviceName);
+            snprintf(devstr, SMALL_CHAR_BUFFER_SIZE, "%s", vbr->guestDeviceName);
+            if (config_use_virtio_root) {
+                devstr[0] = 'v';
+                _ATTRIBUTE(disk, "targetDeviceNameVirtio", devstr);
+                _ATTRIBUTE(disk, "targetDeviceBusVirtio", "virtio");
+            }
+            _ATTRIBUTE(disk, "targetDeviceBus", libvirtBusTypeNames[vbr->guestDeviceBus]);
+            _ATTRIBUTE(disk, "sourceType", libvirtSourceTypeNames[vbr->backingType]);
+            _ATTRIBUTE(disk, "serial", vbr->guestDeviceSerialId);
+
+            if (j) {
+                rootNode = _ELEMENT(disks, "root", NULL);
+                _ATTRIBUTE(rootNode, "device", devstr);
+                if (get_blkid(vbr->backingPath, root_uuid, sizeof(root_uuid)) == 0) {
+                    assert(strlen(root_uuid));
+                    _ATTRIBUTE(rootNode, "uuid", root_uuid);
                 }
             }
         }
+    }
 
-        {                              // record volumes
-            vols = _NODE(instanceNode, "volumes");
-
-            for (int i = 0; i < EUCA_MAX_VOLUMES; i++) {
-                const ncVolume *v = instance->volumes + i;
-                if (strlen(v->volumeId) == 0)   // empty slot
-                    continue;
-                xmlNodePtr vol = _NODE(vols, "volume");
-                _ELEMENT(vol, "id", v->volumeId);
-                _ELEMENT(vol, "attachmentToken", v->attachmentToken);
-                _ELEMENT(vol, "devName", v->devName);
-                _ELEMENT(vol, "stateName", v->stateName);
-                _ELEMENT(vol, "connectionString", v->connectionString);
-                xmlNodePtr libvirt = _NODE(vol, "libvirt");
-                if (strlen(v->volLibvirtXml)) {
-                    xmlNodePtr vol_xml = NULL;
-                    xmlParseInNodeContext(libvirt, v->volLibvirtXml, strlen(v->volLibvirtXml), 0, &vol_xml);
-                    if (vol_xml) {
-                        xmlAddChild(libvirt, vol_xml);
-                    }
+    {                              // record volumes
+        vols = _NODE(instanceNode, "volumes");
+
+        for (int i = 0; i < EUCA_MAX_VOLUMES; i++) {
+            const ncVolume *v = instance->volumes + i;
+            if (strlen(v->volumeId) == 0)   // empty slot
+                continue;
+            xmlNodePtr vol = _NODE(vols, "volume");
+            _ELEMENT(vol, "id", v->volumeId);
+            _ELEMENT(vol, "attachmentToken", v->attachmentToken);
+            _ELEMENT(vol, "devName", v->devName);
+            _ELEMENT(vol, "stateName", v->stateName);
+            _ELEMENT(vol, "connectionString", v->connectionString);
+            xmlNodePtr libvirt = _NODE(vol, "libvirt");
+            if (strlen(v->volLibvirtXml)) {
+                xmlNodePtr vol_xml = NULL;
+                xmlParseInNodeContext(libvirt, v->volLibvirtXml, strlen(v->volLibvirtXml), 0, &vol_xml);
+                if (vol_xml) {
+                    xmlAddChild(libvirt, vol_xml);
                 }
             }
         }
+    }
 
-        if (instance->params.nicType != NIC_TYPE_NONE) {    // NIC specification
-            char str[16];
-
-            nics = _NODE(instanceNode, "nics");
-            nic = _NODE(nics, "nic");
-            snprintf(str, sizeof(str), "%d", instance->ncnet.vlan);
-            _ATTRIBUTE(nic, "vlan", str);
-            snprintf(str, sizeof(str), "%d", instance->ncnet.networkIndex);
-            _ATTRIBUTE(nic, "networkIndex", str);
-            _ATTRIBUTE(nic, "mac", instance->ncnet.privateMac);
-            _ATTRIBUTE(nic, "publicIp", instance->ncnet.publicIp);
-            _ATTRIBUTE(nic, "privateIp", instance->ncnet.privateIp);
-            _ATTRIBUTE(nic, "bridgeDeviceName", instance->params.guestNicDeviceName);
-            snprintf(str, sizeof(str), "vn_%s", instance->instanceId);
-            _ATTRIBUTE(nic, "guestDeviceName", str);
-        }
+    if (instance->params.nicType != NIC_TYPE_NONE) {    // NIC specification
+        char str[16];
+
+        nics = _NODE(instanceNode, "nics");
+        nic = _NODE(nics, "nic");
+        snprintf(str, sizeof(str), "%d", instance->ncnet.vlan);
+        _ATTRIBUTE(nic, "vlan", str);
+        snprintf(str, sizeof(str), "%d", instance->ncnet.networkIndex);
+        _ATTRIBUTE(nic, "networkIndex", str);
+        _ATTRIBUTE(nic, "mac", instance->ncnet.privateMac);
+        _ATTRIBUTE(nic, "publicIp", instance->ncnet.publicIp);
+        _ATTRIBUTE(nic, "privateIp", instance->ncnet.privateIp);
+        _ATTRIBUTE(nic, "bridgeDeviceName", instance->params.guestNicDeviceName);
+        snprintf(str, sizeof(str), "vn_%s", instance->instanceId);
+        _ATTRIBUTE(nic, "guestDeviceName", str);
+    }
 
-        {                              // set /instance/states
-            char str[10];
-
-            xmlNodePtr states = _NODE(instanceNode, "states");
-            snprintf(str, sizeof(str), "%d", instance->retries);
-            _ELEMENT(states, "retries", str);
-            _ELEMENT(states, "stateName", instance->stateName);
-            _ELEMENT(states, "bundleTaskStateName", instance->bundleTaskStateName);
-            snprintf(str, sizeof(str), "%0.4f", instance->bundleTaskProgress);
-            _ELEMENT(states, "bundleTaskProgress", str);
-            _ELEMENT(states, "createImageTaskStateName", instance->createImageTaskStateName);
-            snprintf(str, sizeof(str), "%d", instance->stateCode);
-            _ELEMENT(states, "stateCode", str);
-            _ELEMENT(states, "state", instance_state_names[instance->state]);
-            _ELEMENT(states, "bundleTaskState", bundling_progress_names[instance->bundleTaskState]);
-            _ELEMENT(states, "bundleBucketExists", (instance->bundleBucketExists) ? ("true") : ("false"));
-            _ELEMENT(states, "bundleCanceled", (instance->bundleCanceled) ? ("true") : ("false"));
-            _ELEMENT(states, "guestStateName", instance->guestStateName);
-            _ELEMENT(states, "isStopRequested", (instance->stop_requested) ? ("true") : ("false"));
-            _ELEMENT(states, "createImageTaskState", createImage_progress_names[instance->createImageTaskState]);
-            snprintf(str, sizeof(str), "%d", instance->createImagePid);
-            _ELEMENT(states, "createImagePid", str);
-            _ELEMENT(states, "createImageCanceled", (instance->createImageCanceled) ? ("true") : ("false"));
-            _ELEMENT(states, "migrationState", migration_state_names[instance->migration_state]);
-            _ELEMENT(states, "migrationSource", instance->migration_src);
-            _ELEMENT(states, "migrationDestination", instance->migration_dst);
-            _ELEMENT(states, "migrationCredentials", instance->migration_credentials);
-        }
+    {                              // set /instance/states
+        char str[10];
+
+        xmlNodePtr states = _NODE(instanceNode, "states");
+        snprintf(str, sizeof(str), "%d", instance->retries);
+        _ELEMENT(states, "retries", str);
+        _ELEMENT(states, "stateName", instance->stateName);
+        _ELEMENT(states, "bundleTaskStateName", instance->bundleTaskStateName);
+        snprintf(str, sizeof(str), "%0.4f", instance->bundleTaskProgress);
+        _ELEMENT(states, "bundleTaskProgress", str);
+        _ELEMENT(states, "createImageTaskStateName", instance->createImageTaskStateName);
+        snprintf(str, sizeof(str), "%d", instance->stateCode);
+        _ELEMENT(states, "stateCode", str);
+        _ELEMENT(states, "state", instance_state_names[instance->state]);
+        _ELEMENT(states, "bundleTaskState", bundling_progress_names[instance->bundleTaskState]);
+        _ELEMENT(states, "bundleBucketExists", (instance->bundleBucketExists) ? ("true") : ("false"));
+        _ELEMENT(states, "bundleCanceled", (instance->bundleCanceled) ? ("true") : ("false"));
+        _ELEMENT(states, "guestStateName", instance->guestStateName);
+        _ELEMENT(states, "isStopRequested", (instance->stop_requested) ? ("true") : ("false"));
+        _ELEMENT(states, "createImageTaskState", createImage_progress_names[instance->createImageTaskState]);
+        snprintf(str, sizeof(str), "%d", instance->createImagePid);
+        _ELEMENT(states, "createImagePid", str);
+        _ELEMENT(states, "createImageCanceled", (instance->createImageCanceled) ? ("true") : ("false"));
+        _ELEMENT(states, "migrationState", migration_state_names[instance->migration_state]);
+        _ELEMENT(states, "migrationSource", instance->migration_src);
+        _ELEMENT(states, "migrationDestination", instance->migration_dst);
+        _ELEMENT(states, "migrationCredentials", instance->migration_credentials);
+    }
 
-        {                              // set /instance/timestamps
-            char str[10];
-
-            xmlNodePtr ts = _NODE(instanceNode, "timestamps");
-            snprintf(str, sizeof(str), "%d", instance->launchTime);
-            _ELEMENT(ts, "launchTime", str);
-            snprintf(str, sizeof(str), "%d", instance->expiryTime);
-            _ELEMENT(ts, "expiryTime", str);
-            snprintf(str, sizeof(str), "%d", instance->bootTime);
-            _ELEMENT(ts, "bootTime", str);
-            snprintf(str, sizeof(str), "%d", instance->bundlingTime);
-            _ELEMENT(ts, "bundlingTime", str);
-            snprintf(str, sizeof(str), "%d", instance->createImageTime);
-            _ELEMENT(ts, "createImageTime", str);
-            snprintf(str, sizeof(str), "%d", instance->terminationRequestedTime);
-            _ELEMENT(ts, "terminationRequestedTime", str);
-            snprintf(str, sizeof(str), "%d", instance->terminationTime);
-            _ELEMENT(ts, "terminationTime", str);
-            snprintf(str, sizeof(str), "%d", instance->migrationTime);
-            _ELEMENT(ts, "migrationTime", str);
-        }
+    {                              // set /instance/timestamps
+        char str[10];
+
+        xmlNodePtr ts = _NODE(instanceNode, "timestamps");
+        snprintf(str, sizeof(str), "%d", instance->launchTime);
+        _ELEMENT(ts, "launchTime", str);
+        snprintf(str, sizeof(str), "%d", instance->expiryTime);
+        _ELEMENT(ts, "expiryTime", str);
+        snprintf(str, sizeof(str), "%d", instance->bootTime);
+        _ELEMENT(ts, "bootTime", str);
+        snprintf(str, sizeof(str), "%d", instance->bundlingTime);
+        _ELEMENT(ts, "bundlingTime", str);
+        snprintf(str, sizeof(str), "%d", instance->createImageTime);
+        _ELEMENT(ts, "createImageTime", str);
+        snprintf(str, sizeof(str), "%d", instance->terminationRequestedTime);
+        _ELEMENT(ts, "terminationRequestedTime", str);
+        snprintf(str, sizeof(str), "%d", instance->terminationTime);
+        _ELEMENT(ts, "terminationTime", str);
+        snprintf(str, sizeof(str), "%d", instance->migrationTime);
+        _ELEMENT(ts, "migrationTime", str);
+    }
+
+    return (doc);
 
-        ret = write_xml_file(doc, instance->instanceId, instance->xmlFilePath, "instance");
+error:
+    xmlFreeDoc(doc);
+    return (NULL);
+}
 
-free:
+//!
+//! Encodes instance metadata (contained in ncInstance struct) in XML
+//! and writes it to file instance->xmlFilePath (/path/to/instance/instance.xml)
+//! That file gets processed through tools/libvirt.xsl (/etc/eucalyptus/libvirt.xsl)
+//! to produce /path/to/instance/instance-libvirt.xml file that is passed to libvirt.
+//!
+//! @param[in] instance a pointer to the instance to generate XML from
+//!
+//! @return EUCA_OK if the operation is successful. Known error code returned include EUCA_ERROR.
+//!
+//! @see write_xml_file()
+//!
+int gen_instance_xml(const ncInstance * instance)
+{
+    int ret = EUCA_ERROR;
+    xmlDocPtr doc = NULL;
+
+    INIT();
+
+    if ((doc = build_instance_doc(instance)) != NULL) {
+        pthread_mutex_lock(&xml_mutex);    // write_xml_file() changes the process umask
+        {
+            ret = write_xml_file(doc, instance->instanceId, instance->xmlFilePath, "instance");
+        }
+        pthread_mutex_unlock(&xml_mutex);
         xmlFreeDoc(doc);
     }
-    pthread_mutex_unlock(&xml_mutex);
     return (ret);
 }
 
@@ -1062,25 +1096,36 @@ int read_instance_xml(const char *xml_path, ncInstance * instance)
 }
 
 //!
-//! Given a file with instance metadata in XML (instance->xmlFilePath)
-//! and an XSL-T stylesheet, produces XML document suitable for libvirt
+//! Encodes instance metadata in XML once, writes it to instance->xmlFilePath like
+//! gen_instance_xml() does and transforms that same in-memory document through the
+//! XSL-T stylesheet into instance->libvirtFilePath, the XML document given to libvirt.
 //!
 //! @param[in] instance a pointer to the instance structure
 //!
-//! @return The error code from the call of apply_xslt_stylesheet()
+//! @return EUCA_OK if the operation is successful or the error code from write_xml_file()
+//!         or transform_xml_doc()
 //!
-//! @see apply_xslt_stylesheet()
+//! @see gen_instance_xml()
+//! @see transform_xml_doc()
 //!
-int gen_libvirt_instance_xml(const ncInstance * instance)
+int gen_instance_and_libvirt_xml(const ncInstance * instance)
 {
-    int ret = 0;
+    int ret = EUCA_ERROR;
+    xmlDocPtr doc = NULL;
+
     INIT();
 
-    pthread_mutex_lock(&xml_mutex);
-    {
-        ret = apply_xslt_stylesheet(xslt_path, instance->xmlFilePath, instance->libvirtFilePath, NULL, 0);
+    if ((doc = build_instance_doc(instance)) != NULL) {
+        pthread_mutex_lock(&xml_mutex);    // write_xml_file() changes the process umask
+        {
+            ret = write_xml_file(doc, instance->instanceId, instance->xmlFilePath, "instance");
+        }
+        pthread_mutex_unlock(&xml_mutex);
+
+        if (ret == EUCA_OK)
+            ret = transform_xml_doc(xslt_path, doc, instance->xmlFilePath, instance->libvirtFilePath, NULL, 0);
+        xmlFreeDoc(doc);
     }
-    pthread_mutex_unlock(&xml_mutex);
     return (ret);
 }
 
@@ -1088,7 +1133,7 @@ int gen_libvirt_instance_xml(const ncInstance * instance)
 //! Gets called from XSLT/XML2 library, possibly several times per error.
 //! This handler concatenates the error pieces together and outputs a line,
 //! either when a newlines is seen or when the internal buffer is overrun.
-//! Needless to say, this function is not thread safe.
+//! The partial line is kept per thread, as transforms may run concurrently.
 //!
 //! @param[in] ctx a transparent pointer (UNUSED)
 //! @param[in] fmt a format string
@@ -1099,8 +1144,8 @@ static void error_handler(void *ctx, const char *fmt, ...)
     int i = 0;
     int old_size = 0;
     va_list ap = { {0} };
-    static int size = 0;
-    static char buf[512] = "";
+    static __thread int size = 0;
+    static __thread char buf[512] = "";
 
     old_size = size;
 
@@ -1122,18 +1167,109 @@ static void error_handler(void *ctx, const char *fmt, ...)
 }
 
 //!
-//! Processes input XML file (e.g., instance metadata) into output XML file or string (e.g., for libvirt)
-//! using XSL-T specification file (e.g., libvirt.xsl)
+//! Returns the compiled form of an XSL-T stylesheet. The last compiled stylesheet is
+//! cached and reused for as long as the file's modification time and size do not change.
+//! The stylesheet may be used by several transforms at once and must be released with
+//! put_stylesheet().
+//!
+//! @param[in] xsltStylesheetPath a string containing the path to the XSLT Stylesheet
+//!
+//! @return a pointer to the cached stylesheet or NULL if the file could not be compiled
+//!
+static cached_stylesheet *get_stylesheet(const char *xsltStylesheetPath)
+{
+    struct stat st = { 0 };
+    cached_stylesheet *cs = NULL;
+    cached_stylesheet *stale = NULL;
+
+    if (stat(xsltStylesheetPath, &st) != 0) {
+        LOGERROR("failed to open and parse XSL-T stylesheet file %s\n", xsltStylesheetPath);
+        return (NULL);
+    }
+
+    pthread_mutex_lock(&xml_mutex);
+    {
+        if (((cs = stylesheet_cache) != NULL) && !strcmp(cs->path, xsltStylesheetPath) && (cs->mtime == st.st_mtime) && (cs->size == st.st_size)) {
+            cs->refs++;
+        } else {
+            cs = NULL;
+        }
+    }
+    pthread_mutex_unlock(&xml_mutex);
+
+    if (cs != NULL)
+        return (cs);
+
+    // compile outside of the lock, so transforms using the cached stylesheet do not wait
+    if ((cs = EUCA_ZALLOC(1, sizeof(cached_stylesheet))) == NULL) {
+        LOGERROR("out of memory\n");
+        return (NULL);
+    }
+
+    if ((cs->stylesheet = xsltParseStylesheetFile((const xmlChar *)xsltStylesheetPath)) == NULL) {
+        LOGERROR("failed to open and parse XSL-T stylesheet file %s\n", xsltStylesheetPath);
+        EUCA_FREE(cs);
+        return (NULL);
+    }
+
+    euca_strncpy(cs->path, xsltStylesheetPath, sizeof(cs->path));
+    cs->mtime = st.st_mtime;
+    cs->size = st.st_size;
+    cs->refs = 2;                      // one for the cache and one for the caller
+    LOGDEBUG("compiled XSL-T stylesheet %s\n", xsltStylesheetPath);
+
+    pthread_mutex_lock(&xml_mutex);
+    {
+        if (((stale = stylesheet_cache) != NULL) && (--stale->refs > 0))
+            stale = NULL;              // still in use, the last transform will free it
+        stylesheet_cache = cs;
+    }
+    pthread_mutex_unlock(&xml_mutex);
+
+    if (stale != NULL) {
+        xsltFreeStylesheet(stale->stylesheet);
+        EUCA_FREE(stale);
+    }
+    return (cs);
+}
+
+//!
+//! Releases a stylesheet obtained with get_stylesheet(), freeing it if it was replaced
+//! in the cache and this was its last user.
+//!
+//! @param[in] cs a pointer to the stylesheet to release
+//!
+static void put_stylesheet(cached_stylesheet * cs)
+{
+    boolean last = FALSE;
+
+    pthread_mutex_lock(&xml_mutex);
+    {
+        last = ((--cs->refs == 0) ? TRUE : FALSE);
+    }
+    pthread_mutex_unlock(&xml_mutex);
+
+    if (last) {
+        xsltFreeStylesheet(cs->stylesheet);
+        EUCA_FREE(cs);
+    }
+}
+
+//!
+//! Processes an XML document (e.g., instance metadata) into output XML file or string (e.g., for libvirt)
+//! using XSL-T specification file (e.g., libvirt.xsl). Several transforms may run concurrently.
 //!
 //! @param[in]  xsltStylesheetPath a string containing the path to the XSLT Stylesheet
-//! @param[in]  inputXmlPath a string containing the path of the input XML document
+//! @param[in]  doc a pointer to the input XML document
+//! @param[in]  inputName a string naming the input document in log messages
 //! @param[in]  outputXmlPath a string containing the path of the output XML document
 //! @param[out] outputXmlBuffer a string that will contain the output XML data if non NULL and non-0 length.
 //! @param[in]  outputXmlBufferSize the length of outputXmlBuffer
 //!
 //! @return EUCA_OK on success or proper error code. Known error code returned include EUCA_ERROR and EUCA_IO_ERROR.
 //!
-static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inputXmlPath, const char *outputXmlPath, char *outputXmlBuffer, int outputXmlBufferSize)
+static int transform_xml_doc(const char *xsltStylesheetPath, xmlDocPtr doc, const char *inputName, const char *outputXmlPath, char *outputXmlBuffer,
+                             int outputXmlBufferSize)
 {
     int err = EUCA_OK;
     int i = 0;
@@ -1144,92 +1280,110 @@ static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inp
     FILE *fp = NULL;
     xmlChar *buf = NULL;
     boolean applied_ok = FALSE;
-    xmlDocPtr doc = NULL;
-    xsltStylesheetPtr cur = NULL;
+    cached_stylesheet *cs = NULL;
     xsltTransformContextPtr ctxt = NULL;
     xmlDocPtr res = NULL;
 
     INIT();
-    if ((cur = xsltParseStylesheetFile((const xmlChar *)xsltStylesheetPath)) != NULL) {
-        if ((doc = xmlParseFile(inputXmlPath)) != NULL) {
-            ctxt = xsltNewTransformContext(cur, doc);   // need context to get result
-            xsltSetCtxtParseOptions(ctxt, 0);   //! @todo do we want any XSL-T parsing options?
-
-            res = xsltApplyStylesheetUser(cur, doc, NULL, NULL, NULL, ctxt);    // applies XSLT to XML
-            applied_ok = ((ctxt->state == XSLT_STATE_OK) ? TRUE : FALSE);   // errors are communicated via ctxt->state
-            xsltFreeTransformContext(ctxt);
-
-            if (res && applied_ok) {
-                // save to a file, if path was provied
-                if (outputXmlPath != NULL) {
-                    if ((fp = fopen(outputXmlPath, "w")) != NULL) {
-                        if ((bytes = xsltSaveResultToFile(fp, res, cur)) == -1) {
-                            LOGERROR("failed to save XML document to %s\n", outputXmlPath);
-                            err = EUCA_IO_ERROR;
-                        }
-                        fclose(fp);
-                    } else {
-                        LOGERROR("failed to create file %s\n", outputXmlPath);
-                        err = EUCA_IO_ERROR;
-                    }
+    if ((cs = get_stylesheet(xsltStylesheetPath)) == NULL)
+        return (EUCA_IO_ERROR);
+
+    ctxt = xsltNewTransformContext(cs->stylesheet, doc);    // need context to get result
+    xsltSetCtxtParseOptions(ctxt, 0);  //! @todo do we want any XSL-T parsing options?
+
+    res = xsltApplyStylesheetUser(cs->stylesheet, doc, NULL, NULL, NULL, ctxt); // applies XSLT to XML
+    applied_ok = ((ctxt->state == XSLT_STATE_OK) ? TRUE : FALSE);   // errors are communicated via ctxt->state
+    xsltFreeTransformContext(ctxt);
+
+    if (res && applied_ok) {
+        // save to a file, if path was provied
+        if (outputXmlPath != NULL) {
+            if ((fp = fopen(outputXmlPath, "w")) != NULL) {
+                if ((bytes = xsltSaveResultToFile(fp, res, cs->stylesheet)) == -1) {
+                    LOGERROR("failed to save XML document to %s\n", outputXmlPath);
+                    err = EUCA_IO_ERROR;
                 }
-                // convert to an ASCII buffer, if such was provided
-                if (err == EUCA_OK && outputXmlBuffer != NULL && outputXmlBufferSize > 0) {
-                    if (xsltSaveResultToString(&buf, &buf_size, res, cur) == 0) {
-                        // success
-                        if (buf_size < outputXmlBufferSize) {
-                            bzero(outputXmlBuffer, outputXmlBufferSize);
-                            for (i = 0, j = 0; i < buf_size; i++) {
-                                c = ((char)buf[i]);
-                                if (c != '\n')  // remove newlines
-                                    outputXmlBuffer[j++] = c;
-                            }
-                        } else {
-                            LOGERROR("XML string buffer is too small (%d > %d)\n", buf_size, outputXmlBufferSize);
-                            err = EUCA_ERROR;
-                        }
-                        xmlFree(buf);
-                    } else {
-                        LOGERROR("failed to save XML document to a string\n");
-                        err = EUCA_ERROR;
+                fclose(fp);
+            } else {
+                LOGERROR("failed to create file %s\n", outputXmlPath);
+                err = EUCA_IO_ERROR;
+            }
+        }
+        // convert to an ASCII buffer, if such was provided
+        if (err == EUCA_OK && outputXmlBuffer != NULL && outputXmlBufferSize > 0) {
+            if (xsltSaveResultToString(&buf, &buf_size, res, cs->stylesheet) == 0) {
+                // success
+                if (buf_size < outputXmlBufferSize) {
+                    bzero(outputXmlBuffer, outputXmlBufferSize);
+                    for (i = 0, j = 0; i < buf_size; i++) {
+                        c = ((char)buf[i]);
+                        if (c != '\n')  // remove newlines
+                            outputXmlBuffer[j++] = c;
                     }
+                } else {
+                    LOGERROR("XML string buffer is too small (%d > %d)\n", buf_size, outputXmlBufferSize);
+                    err = EUCA_ERROR;
                 }
+                xmlFree(buf);
             } else {
-                LOGERROR("failed to apply stylesheet %s to %s\n", xsltStylesheetPath, inputXmlPath);
+                LOGERROR("failed to save XML document to a string\n");
                 err = EUCA_ERROR;
             }
-            if (res != NULL)
-                xmlFreeDoc(res);
-            xmlFreeDoc(doc);
-        } else {
-            LOGERROR("failed to parse XML document %s\n", inputXmlPath);
-            err = EUCA_ERROR;
         }
-        xsltFreeStylesheet(cur);
     } else {
-        LOGERROR("failed to open and parse XSL-T stylesheet file %s\n", xsltStylesheetPath);
-        err = EUCA_IO_ERROR;
+        LOGERROR("failed to apply stylesheet %s to %s\n", xsltStylesheetPath, inputName);
+        err = EUCA_ERROR;
     }
 
+    if (res != NULL)
+        xmlFreeDoc(res);
+    put_stylesheet(cs);
     return (err);
 }
 
 //!
-//! Generates the XML content for a given volume
+//! Processes input XML file (e.g., instance metadata) into output XML file or string (e.g., for libvirt)
+//! using XSL-T specification file (e.g., libvirt.xsl)
+//!
+//! @param[in]  xsltStylesheetPath a string containing the path to the XSLT Stylesheet
+//! @param[in]  inputXmlPath a string containing the path of the input XML document
+//! @param[in]  outputXmlPath a string containing the path of the output XML document
+//! @param[out] outputXmlBuffer a string that will contain the output XML data if non NULL and non-0 length.
+//! @param[in]  outputXmlBufferSize the length of outputXmlBuffer
+//!
+//! @return EUCA_OK on success or proper error code. Known error code returned include EUCA_ERROR and EUCA_IO_ERROR.
+//!
+//! @see transform_xml_doc()
+//!
+static int apply_xslt_stylesheet(const char *xsltStylesheetPath, const char *inputXmlPath, const char *outputXmlPath, char *outputXmlBuffer, int outputXmlBufferSize)
+{
+    int err = EUCA_ERROR;
+    xmlDocPtr doc = NULL;
+
+    INIT();
+    if ((doc = xmlParseFile(inputXmlPath)) != NULL) {
+        err = transform_xml_doc(xsltStylesheetPath, doc, inputXmlPath, outputXmlPath, outputXmlBuffer, outputXmlBufferSize);
+        xmlFreeDoc(doc);
+    } else {
+        LOGERROR("failed to parse XML document %s\n", inputXmlPath);
+    }
+    return (err);
+}
+
+//!
+//! Encodes volume metadata in an XML document
 //!
 //! @param[in] volumeId the volume identifier string (vol-XXXXXXXX)
 //! @param[in] instance a pointer to our instance structure
 //! @param[in] devName a string containing the target device name
+//! @param[in] remoteDev a string containing the path of the attached remote device
 //!
-//! @return The results of calling write_xml_file()
-//!
-//! @see write_xml_file()
+//! @return a pointer to the new document, to be freed with xmlFreeDoc()
 //!
-int gen_volume_xml(const char *volumeId, const ncInstance * instance, const char *devName, const char *remoteDev)
+static xmlDocPtr build_volume_doc(const char *volumeId, const ncInstance * instance, const char *devName, const char *remoteDev)
 {
-    int ret = EUCA_ERROR;
     char bitness[4] = "";
-    char path[EUCA_MAX_PATH] = "";
+    char serial[64] = "";
     xmlDocPtr doc = NULL;
     xmlNodePtr volumeNode = NULL;
     xmlNodePtr hypervisor = NULL;
@@ -1238,83 +1392,114 @@ int gen_volume_xml(const char *volumeId, const ncInstance * instance, const char
     xmlNodePtr root = NULL;
     xmlNodePtr disk = NULL;
 
+    doc = xmlNewDoc(BAD_CAST "1.0");
+    volumeNode = xmlNewNode(NULL, BAD_CAST "volume");
+    xmlDocSetRootElement(doc, volumeNode);
+
+    // hypervisor-related specs
+    hypervisor = xmlNewChild(volumeNode, NULL, BAD_CAST "hypervisor", NULL);
+    _ATTRIBUTE(hypervisor, "type", instance->hypervisorType);
+    _ATTRIBUTE(hypervisor, "capability", hypervisorCapabilityTypeNames[instance->hypervisorCapability]);
+    snprintf(bitness, 4, "%d", instance->hypervisorBitness);
+    _ATTRIBUTE(hypervisor, "bitness", bitness);
+
+    _ELEMENT(volumeNode, "id", volumeId);
+    _ELEMENT(volumeNode, "user", instance->userId);
+    _ELEMENT(volumeNode, "instancePath", instance->instancePath);
+
+    // OS-related specs
+    os = _NODE(volumeNode, "os");
+    _ATTRIBUTE(os, "platform", instance->platform);
+    _ATTRIBUTE(os, "virtioRoot", _BOOL(config_use_virtio_root));
+    _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
+    _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
+
+    //! backing specification (@todo maybe expand this with device maps or whatnot?)
+    backing = xmlNewChild(volumeNode, NULL, BAD_CAST "backing", NULL);
+    root = xmlNewChild(backing, NULL, BAD_CAST "root", NULL);
+    assert(instance->params.root);
+    _ATTRIBUTE(root, "type", ncResourceTypeNames[instance->params.root->type]);
+
+    // volume information
+    disk = _ELEMENT(volumeNode, "diskPath", remoteDev);
+    _ATTRIBUTE(disk, "targetDeviceType", "disk");
+    _ATTRIBUTE(disk, "targetDeviceName", devName);
+    _ATTRIBUTE(disk, "targetDeviceBus", "scsi");
+    _ATTRIBUTE(disk, "sourceType", "block");
+    snprintf(serial, sizeof(serial), "%s-dev-%s", volumeId, devName);
+    _ATTRIBUTE(disk, "serial", serial);
+
+    return (doc);
+}
+
+//!
+//! Generates the XML content for a given volume
+//!
+//! @param[in] volumeId the volume identifier string (vol-XXXXXXXX)
+//! @param[in] instance a pointer to our instance structure
+//! @param[in] devName a string containing the target device name
+//! @param[in] remoteDev a string containing the path of the attached remote device
+//!
+//! @return The results of calling write_xml_file()
+//!
+//! @see write_xml_file()
+//!
+int gen_volume_xml(const char *volumeId, const ncInstance * instance, const char *devName, const char *remoteDev)
+{
+    int ret = EUCA_ERROR;
+    char path[EUCA_MAX_PATH] = "";
+    xmlDocPtr doc = NULL;
+
     INIT();
 
-    pthread_mutex_lock(&xml_mutex);
+    snprintf(path, sizeof(path), EUCALYPTUS_VOLUME_XML_PATH_FORMAT, instance->instancePath, volumeId);
+    doc = build_volume_doc(volumeId, instance, devName, remoteDev);
+    pthread_mutex_lock(&xml_mutex);    // write_xml_file() changes the process umask
     {
-        doc = xmlNewDoc(BAD_CAST "1.0");
-        volumeNode = xmlNewNode(NULL, BAD_CAST "volume");
-        xmlDocSetRootElement(doc, volumeNode);
-
-        // hypervisor-related specs
-        hypervisor = xmlNewChild(volumeNode, NULL, BAD_CAST "hypervisor", NULL);
-        _ATTRIBUTE(hypervisor, "type", instance->hypervisorType);
-        _ATTRIBUTE(hypervisor, "capability", hypervisorCapabilityTypeNames[instance->hypervisorCapability]);
-        snprintf(bitness, 4, "%d", instance->hypervisorBitness);
-        _ATTRIBUTE(hypervisor, "bitness", bitness);
-
-        _ELEMENT(volumeNode, "id", volumeId);
-        _ELEMENT(volumeNode, "user", instance->userId);
-        _ELEMENT(volumeNode, "instancePath", instance->instancePath);
-
-        // OS-related specs
-        os = _NODE(volumeNode, "os");
-        _ATTRIBUTE(os, "platform", instance->platform);
-        _ATTRIBUTE(os, "virtioRoot", _BOOL(config_use_virtio_root));
-        _ATTRIBUTE(os, "virtioDisk", _BOOL(config_use_virtio_disk));
-        _ATTRIBUTE(os, "virtioNetwork", _BOOL(config_use_virtio_net));
-
-        //! backing specification (@todo maybe expand this with device maps or whatnot?)
-        backing = xmlNewChild(volumeNode, NULL, BAD_CAST "backing", NULL);
-        root = xmlNewChild(backing, NULL, BAD_CAST "root", NULL);
-        assert(instance->params.root);
-        _ATTRIBUTE(root, "type", ncResourceTypeNames[instance->params.root->type]);
-
-        // volume information
-        disk = _ELEMENT(volumeNode, "diskPath", remoteDev);
-        _ATTRIBUTE(disk, "targetDeviceType", "disk");
-        _ATTRIBUTE(disk, "targetDeviceName", devName);
-        _ATTRIBUTE(disk, "targetDeviceBus", "scsi");
-        _ATTRIBUTE(disk, "sourceType", "block");
-        char serial[64];
-        snprintf(serial, sizeof(serial), "%s-dev-%s", volumeId, devName);
-        _ATTRIBUTE(disk, "serial", serial);
-
-        snprintf(path, sizeof(path), EUCALYPTUS_VOLUME_XML_PATH_FORMAT, instance->instancePath, volumeId);
         ret = write_xml_file(doc, instance->instanceId, path, "volume");
-        xmlFreeDoc(doc);
     }
     pthread_mutex_unlock(&xml_mutex);
+    xmlFreeDoc(doc);
     return (ret);
 }
 
 //!
-//! Generate volume XML content for LIBVIRT
+//! Generates the XML content for a given volume once, writes it like gen_volume_xml()
+//! does and transforms that same in-memory document into the volume XML for libvirt
 //!
 //! @param[in] volumeId the volume identifier string (vol-XXXXXXXX)
-//! @param[in] instance a pointer to our instance structure.
+//! @param[in] instance a pointer to our instance structure
+//! @param[in] devName a string containing the target device name
+//! @param[in] remoteDev a string containing the path of the attached remote device
 //!
-//! @return The results of calling apply_xslt_stylesheet()
+//! @return EUCA_OK if the operation is successful or the error code from write_xml_file()
+//!         or transform_xml_doc()
 //!
-//! @see apply_xslt_stylesheet()
+//! @see gen_volume_xml()
+//! @see transform_xml_doc()
 //!
-int gen_libvirt_volume_xml(const char *volumeId, const ncInstance * instance)
+int gen_volume_and_libvirt_xml(const char *volumeId, const ncInstance * instance, const char *devName, const char *remoteDev)
 {
-    int ret = EUCA_OK;
+    int ret = EUCA_ERROR;
     char path[EUCA_MAX_PATH] = "";
     char lpath[EUCA_MAX_PATH] = "";
+    xmlDocPtr doc = NULL;
 
     INIT();
 
     snprintf(path, sizeof(path), EUCALYPTUS_VOLUME_XML_PATH_FORMAT, instance->instancePath, volumeId);  // vol-XXX.xml
     snprintf(lpath, sizeof(lpath), EUCALYPTUS_VOLUME_LIBVIRT_XML_PATH_FORMAT, instance->instancePath, volumeId);    // vol-XXX-libvirt.xml
 
-    pthread_mutex_lock(&xml_mutex);
+    doc = build_volume_doc(volumeId, instance, devName, remoteDev);
+    pthread_mutex_lock(&xml_mutex);    // write_xml_file() changes the process umask
     {
-        ret = apply_xslt_stylesheet(xslt_path, path, lpath, NULL, 0);
+        ret = write_xml_file(doc, instance->instanceId, path, "volume");
     }
     pthread_mutex_unlock(&xml_mutex);
 
+    if (ret == EUCA_OK)
+        ret = transform_xml_doc(xslt_path, doc, path, lpath, NULL, 0);
+    xmlFreeDoc(doc);
     return (ret);
 }
 
@@ -1737,6 +1922,38 @@ int main(int argc, char **argv)
     }
     LOGINFO("re-read re-generated XML from %s\n", out_path2);
 
+    LOGINFO("transforming in-memory instance XML with stylesheet %s\n", xslt_path);
+    char libvirt_path[sizeof(instance2.libvirtFilePath)];
+    memcpy(libvirt_path, instance2.libvirtFilePath, sizeof(libvirt_path));
+    strncpy(instance2.libvirtFilePath, out_path, sizeof(instance2.libvirtFilePath));
+    if (gen_instance_and_libvirt_xml(&instance2) != EUCA_OK) {
+        LOGERROR("failed to transform instance XML into %s\n", out_path);
+        goto out;
+    }
+    cached_stylesheet *cs = stylesheet_cache;
+    if ((gen_instance_and_libvirt_xml(&instance2) != EUCA_OK) || (stylesheet_cache != cs)) {
+        LOGERROR("failed to transform instance XML again with the cached stylesheet\n");
+        goto out;
+    }
+    memcpy(instance2.libvirtFilePath, libvirt_path, sizeof(libvirt_path));
+
+    LOGINFO("transforming in-memory volume XML with stylesheet %s\n", xslt_path);
+    char instance_path[sizeof(instance2.instancePath)];
+    char vol_path[EUCA_MAX_PATH];
+    char vol_buf[64];
+    memcpy(instance_path, instance2.instancePath, sizeof(instance_path));
+    euca_strncpy(instance2.instancePath, "/tmp", sizeof(instance2.instancePath));
+    snprintf(vol_path, sizeof(vol_path), EUCALYPTUS_VOLUME_LIBVIRT_XML_PATH_FORMAT, instance2.instancePath, "vol-xmltest");
+    if ((gen_volume_and_libvirt_xml("vol-xmltest", &instance2, "sdb", "/dev/xmltest") != EUCA_OK)
+        || (get_xpath_content_at(vol_path, "/disk/source/@dev", 0, vol_buf, sizeof(vol_buf)) == NULL) || strcmp(vol_buf, "/dev/xmltest")) {
+        LOGERROR("failed to transform volume XML into %s\n", vol_path);
+        goto out;
+    }
+    remove(vol_path);
+    snprintf(vol_path, sizeof(vol_path), EUCALYPTUS_VOLUME_XML_PATH_FORMAT, instance2.instancePath, "vol-xmltest");
+    remove(vol_path);
+    memcpy(instance2.instancePath, instance_path, sizeof(instance_path));
+
     instance.params.root = NULL;
     instance.params.kernel = NULL;
     instance.params.ramdisk = NULL;
@@ -86,6 +86,7 @@
 #include <limits.h>
 #include <assert.h>
 #include <dirent.h>
+#include <pthread.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl, ensure_...
@@ -114,6 +115,9 @@
 #define STORE_TIMEOUT_USEC                       (1000000LL * 60 * 2)
 #define DELETE_TIMEOUT_USEC                      (1000000LL * 10)
 #define FIND_TIMEOUT_USEC                        (50000LL)  //! @TODO use 1000LL or less to induce rare timeouts
+#define CACHE_LOW_WATERMARK_PERCENT              10 //!< the cache evictor keeps this much of the cache free, so new images rarely wait for purging
+#define CACHE_EVICTOR_INTERVAL_SEC               30
+#define INSTANCE_SAVE_DELAY_MS                   1000   //!< saves of an instance within this window are coalesced into one write
 
 #define INSTANCE_FILE_NAME                       "instance.xml"
 #define INSTANCE_LIBVIRT_FILE_NAME               "instance-libvirt.xml"
@@ -162,10 +166,17 @@ extern struct nc_state_t nc_state;
 static char instances_path[EUCA_MAX_PATH] = "";
 static blobstore *cache_bs = NULL;
 static blobstore *work_bs = NULL;
+static blobstore_evictor *cache_evictor = NULL;
 static sem *disk_sem = NULL;
 
 static bunchOfInstances **instances = NULL;
 
+static pthread_mutex_t save_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards pending_saves
+static pthread_cond_t save_cond = PTHREAD_COND_INITIALIZER; //!< signaled when pending_saves stops being empty
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER; //!< serializes instance.xml writes, so an older copy never lands after a newer one
+static bunchOfInstances *pending_saves = NULL;  //!< private copies of instances waiting to be written to disk
+static boolean saver_started = FALSE;   //!< set once the write-behind thread runs; until then saves are synchronous
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -178,6 +189,11 @@ static void set_id(const ncInstance * instance, virtualBootRecord * vbr, char *i
 static void set_id2(const ncInstance * instance, const char *suffix, char *id, unsigned int id_size);
 static void set_path(char *path, unsigned int path_size, const ncInstance * instance, const char *filename);
 static int stale_blob_examiner(const blockblob * bb);
+static void copy_instance_struct(ncInstance * dst, const ncInstance * src);
+static void drop_pending_save(const char *instanceId);
+static int write_instance_struct(const ncInstance * instance, boolean do_sync);
+static void flush_pending_saves(void);
+static void *saver_thread(void *arg);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -385,12 +401,21 @@ int init_backing_store(const char *conf_instances_path, unsigned int conf_work_s
             LOGERROR("failed to open/create cache blobstore: %s\n", blobstore_get_error_str(blobstore_get_error()));
             return (EUCA_PERMISSION_ERROR);
         }
+        // purge in the background before the cache fills up (failing that, blockblob_open purges on demand)
+        if (cache_evictor == NULL && cache_bs->revocation_policy == BLOBSTORE_REVOCATION_LRU) {
+            cache_evictor = blobstore_start_evictor(cache_bs, (cache_limit_blocks / 100) * CACHE_LOW_WATERMARK_PERCENT, CACHE_EVICTOR_INTERVAL_SEC);
+            if (cache_evictor == NULL) {
+                LOGWARN("failed to start cache evictor: %s\n", blobstore_get_error_str(blobstore_get_error()));
+            }
+        }
     }
     // Lets open the work blobstore
     work_bs = blobstore_open(work_path, work_limit_blocks, BLOBSTORE_FLAG_CREAT, BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_NONE, snapshot_policy);
     if (work_bs == NULL) {
         LOGERROR("failed to open/create work blobstore: %s\n", blobstore_get_error_str(blobstore_get_error()));
         LOGERROR("%s\n", blobstore_get_last_trace());
+        blobstore_stop_evictor(cache_evictor);
+        cache_evictor = NULL;
         BLOBSTORE_CLOSE(cache_bs);
         return (EUCA_PERMISSION_ERROR);
     }
@@ -400,6 +425,20 @@ int init_backing_store(const char *conf_instances_path, unsigned int conf_work_s
         LOGERROR("failed to create and initialize disk semaphore\n");
         return (EUCA_PERMISSION_ERROR);
     }
+    sem_set_stats_name(disk_sem, "disk_sem");
+    // start the thread that writes instance metadata behind the callers of save_instance_struct()
+    if (!saver_started) {
+        pthread_t tid;
+        pthread_attr_t tattr;
+        pthread_attr_init(&tattr);
+        pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&tid, &tattr, saver_thread, NULL) == 0) {
+            saver_started = TRUE;
+        } else {
+            LOGWARN("failed to start instance metadata writer, saving synchronously\n");
+        }
+        pthread_attr_destroy(&tattr);
+    }
 
     return (EUCA_OK);
 }
@@ -579,27 +618,203 @@ static int stale_blob_examiner(const blockblob * bb)
 }
 
 //!
-//! Save the instance structure data in the instance.checkpoint file under the instance's
-//! work blobstore path.
+//! Copies an instance structure, pointing the boot record shortcuts (root, kernel, etc.)
+//! of the copy into its own boot record array.
+//!
+//! @param[out] dst pointer to the instance structure to copy into
+//! @param[in]  src pointer to the instance structure to copy
+//!
+static void copy_instance_struct(ncInstance * dst, const ncInstance * src)
+{
+    int i = 0;
+    long off = 0;
+    virtualBootRecord **vbrs[] = { &dst->params.root, &dst->params.kernel, &dst->params.ramdisk, &dst->params.swap, &dst->params.ephemeral0, &dst->params.boot };
+
+    memcpy(dst, src, sizeof(ncInstance));
+    for (i = 0; i < (sizeof(vbrs) / sizeof(vbrs[0])); i++) {
+        if (*vbrs[i] == NULL)
+            continue;
+        off = *vbrs[i] - src->params.virtualBootRecord;
+        if ((off >= 0) && (off < EUCA_MAX_VBRS))
+            *vbrs[i] = dst->params.virtualBootRecord + off;
+    }
+}
+
+//!
+//! Discards the pending write-behind save of an instance, if any.
+//!
+//! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
+//!
+static void drop_pending_save(const char *instanceId)
+{
+    ncInstance *copy = NULL;
+
+    pthread_mutex_lock(&save_mutex);
+    {
+        if ((copy = find_instance(&pending_saves, instanceId)) != NULL) {
+            remove_instance(&pending_saves, copy);
+            free_instance(&copy);
+        }
+    }
+    pthread_mutex_unlock(&save_mutex);
+}
+
+//!
+//! Writes the instance.xml file of an instance, optionally syncing it to disk.
 //!
 //! @param[in] instance pointer to the instance to save
+//! @param[in] do_sync set to TRUE to fsync the file once written
 //!
-//! @return EUCA_OK on success of the following error codes:
-//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
-//!         \li EUCA_PERMISSION_ERROR: if we fail to open/create the checkpoint file
-//!         \li EUCA_IO_ERROR: if we fail to save the instance in the checkpoint file
+//! @return EUCA_OK on success or the error code of gen_instance_xml()
+//!
+static int write_instance_struct(const ncInstance * instance, boolean do_sync)
+{
+    int fd = -1;
+    int ret = EUCA_OK;
+
+    if (((ret = gen_instance_xml(instance)) == EUCA_OK) && do_sync) {
+        if ((fd = open(instance->xmlFilePath, O_RDONLY)) >= 0) {
+            fsync(fd);
+            close(fd);
+        }
+    }
+    return (ret);
+}
+
+//!
+//! Writes all pending instance saves. All files of the batch are written before any of
+//! them is synced, so the disk sees one burst rather than a write and flush per instance.
+//!
+static void flush_pending_saves(void)
+{
+    int i = 0;
+    int fd = -1;
+    ncInstance *copy = NULL;
+    bunchOfInstances *batch = NULL;
+
+    pthread_mutex_lock(&flush_mutex);
+    {
+        pthread_mutex_lock(&save_mutex);
+        {
+            batch = pending_saves;
+            pending_saves = NULL;
+        }
+        pthread_mutex_unlock(&save_mutex);
+
+        for (i = 0; i < total_instances(&batch); i++) {
+            gen_instance_xml(batch->instances[i]);
+        }
+
+        for (i = 0; i < total_instances(&batch); i++) {
+            if ((fd = open(batch->instances[i]->xmlFilePath, O_RDONLY)) >= 0) {
+                fsync(fd);
+                close(fd);
+            }
+        }
+    }
+    pthread_mutex_unlock(&flush_mutex);
+
+    for (i = 0; i < total_instances(&batch); i++) {
+        copy = batch->instances[i];
+        free_instance(&copy);
+    }
+    free_instances(&batch);
+}
+
+//!
+//! Thread writing pending instance saves. Once a save is queued, it waits for
+//! INSTANCE_SAVE_DELAY_MS so that further saves of the same instances coalesce,
+//! then writes the whole batch.
+//!
+//! @param[in] arg unused
+//!
+//! @return Never returns
+//!
+static void *saver_thread(void *arg)
+{
+    for (;;) {
+        pthread_mutex_lock(&save_mutex);
+        {
+            while (pending_saves == NULL)
+                pthread_cond_wait(&save_cond, &save_mutex);
+        }
+        pthread_mutex_unlock(&save_mutex);
+
+        usleep(INSTANCE_SAVE_DELAY_MS * 1000);
+        flush_pending_saves();
+    }
+    return (NULL);
+}
+
+//!
+//! Saves the instance structure data in the instance.xml file under the instance's
+//! work blobstore path. The write happens in the background, within INSTANCE_SAVE_DELAY_MS,
+//! and repeated saves of the same instance in that window are coalesced into one write.
+//! Use flush_instance_struct() where the state must be on disk before going on.
+//!
+//! @param[in] instance pointer to the instance to save
+//!
+//! @return EUCA_OK on success or the error code of gen_instance_xml() if the save
+//!         could not be queued and was attempted synchronously.
 //!
 //! @pre The instance variable must not be NULL.
 //!
-//! @post On success, the checkpoint file is created and contains the instance information
+//! @post The instance is copied, so the caller may modify or free it right away
 //!
 int save_instance_struct(const ncInstance * instance)
 {
+    ncInstance *copy = NULL;
+
     if (instance->state == TEARDOWN) {
+        drop_pending_save(instance->instanceId);
         return EUCA_OK;                // instance is without disk state => nowhere to write metadata
-    } else {
-        return gen_instance_xml(instance);
     }
+
+    if (saver_started) {
+        pthread_mutex_lock(&save_mutex);
+        {
+            if ((copy = find_instance(&pending_saves, instance->instanceId)) != NULL) {
+                copy_instance_struct(copy, instance);   // coalesce with the save already pending
+            } else if ((copy = EUCA_ALLOC(1, sizeof(ncInstance))) != NULL) {
+                copy_instance_struct(copy, instance);
+                if (add_instance(&pending_saves, copy) != EUCA_OK) {
+                    free_instance(&copy);
+                } else {
+                    pthread_cond_signal(&save_cond);
+                }
+            }
+        }
+        pthread_mutex_unlock(&save_mutex);
+    }
+
+    if (copy == NULL)
+        return write_instance_struct(instance, FALSE);
+    return EUCA_OK;
+}
+
+//!
+//! Saves the instance structure data in the instance.xml file right away and syncs it
+//! to disk, superseding any pending background save of the instance. Used at transitions
+//! that NC recovery depends on.
+//!
+//! @param[in] instance pointer to the instance to save
+//!
+//! @return EUCA_OK on success or the error code of gen_instance_xml()
+//!
+//! @pre The instance variable must not be NULL.
+//!
+int flush_instance_struct(const ncInstance * instance)
+{
+    int ret = EUCA_OK;
+
+    pthread_mutex_lock(&flush_mutex);
+    {
+        drop_pending_save(instance->instanceId);
+        if (instance->state != TEARDOWN)
+            ret = write_instance_struct(instance, TRUE);
+    }
+    pthread_mutex_unlock(&flush_mutex);
+    return (ret);
 }
 
 //!
@@ -852,7 +1067,7 @@ int create_instance_backing(ncInstance * instance, boolean is_migration_dest)
         }
     }
 
-    if (save_instance_struct(instance)) // update instance checkpoint now that the struct got updated
+    if (flush_instance_struct(instance))    // update instance checkpoint now that the struct got updated
         goto out;
 
     ret = EUCA_OK;
@@ -991,6 +1206,15 @@ int destroy_instance_backing(ncInstance * instance, boolean do_destroy_files)
         }
     }
 
+    // settle any pending save now, so that it cannot write instance.xml back into a deleted directory
+    if (do_destroy_files) {
+        pthread_mutex_lock(&flush_mutex);
+        drop_pending_save(instance->instanceId);
+        pthread_mutex_unlock(&flush_mutex);
+    } else {
+        flush_instance_struct(instance);
+    }
+
     // see if instance directory is there (sometimes startup fails before it is created)
     set_path(path, sizeof(path), instance, NULL);
     if (check_path(path))
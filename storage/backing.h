@@ -123,6 +123,7 @@ int check_backing_store(bunchOfInstances ** global_instances);
 int stat_backing_store(const char *conf_instances_path, blobstore_meta * work_meta, blobstore_meta * cache_meta);
 int init_backing_store(const char *conf_instances_path, unsigned int conf_work_size_mb, unsigned int conf_cache_size_mb);
 int save_instance_struct(const ncInstance * instance);
+int flush_instance_struct(const ncInstance * instance);
 ncInstance *load_instance_struct(const char *instanceId);
 
 int create_instance_backing(ncInstance * instance, boolean is_migration_dest);
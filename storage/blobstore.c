@@ -78,6 +78,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>                     // isspace
 #include <assert.h>
 #include <unistd.h>                    // close
 #include <time.h>                      // time
@@ -86,6 +87,8 @@
 #include <errno.h>                     // errno
 #include <sys/types.h>                 // *dir, etc, wait
 #include <sys/file.h>                  // flock
+#include <fcntl.h>                     // open
+#include <signal.h>                    // kill
 #include <dirent.h>
 #include <sys/wait.h>                  // wait
 #include <pthread.h>
@@ -112,6 +115,13 @@
 \*----------------------------------------------------------------------------*/
 
 #define BLOBSTORE_METADATA_FILE                  ".blobstore"
+#define BLOBSTORE_INDEX_FILE                     ".blobstore.index"    //!< compacted snapshot of the blob index
+#define BLOBSTORE_JOURNAL_FILE                   ".blobstore.journal"  //!< append-only log of blob index changes since the snapshot
+#define BLOBSTORE_INDEX_VERSION                        1
+#define BLOBSTORE_INDEX_BUCKETS                     4096
+#define BLOBSTORE_INDEX_COMPACT_RECORDS             2048    //!< journal records after which the index is compacted into a new snapshot
+#define BLOBSTORE_INDEX_KEEP_OPENER              ((pid_t)-1)
+#define BLOBSTORE_START_TIME_UNKNOWN             ((unsigned long long)-1)   //!< process_start_time() could not tell
 #define BLOBSTORE_METADATA_TIMEOUT_USEC          (1000000LL * 60 * 2)   //!< it may take dozens of seconds to open blobstore when others are LRU-purging it
 #define BLOBSTORE_LOCK_TIMEOUT_USEC               500000LL
 #define BLOBSTORE_FIND_TIMEOUT_USEC                50000LL
@@ -123,6 +133,8 @@
 #define BLOBSTORE_SIG_MAX                         262144
 #define DM_PATH                                  "/dev/mapper/"
 #define DM_FORMAT                                DM_PATH "%s"   //!< @TODO do not hardcode?
+#define DM_MAX_PARTITIONS                              9    //!< how many partition devices (created by parted on top of ours) to look for when removing
+#define DM_UDEV_COOKIE_SIZE                           32   //!< enough for the hexadecimal cookie printed by `dmsetup udevcreatecookie`
 #define MIN_BLOCKS_SNAPSHOT                      32 //!< otherwise dmsetup fails with device-mapper: reload ioctl failed: Cannot allocate memory OR device-mapper: reload ioctl failed: Input/output error
 #define EUCA_ZERO                                "euca-zero"
 #define EUCA_ZERO_SIZE                           "2199023255552"    //!< is one petabyte enough?
@@ -152,6 +164,8 @@
 #define STRESS_BS_SIZE                           100000
 #define STRESS_MIN_BB                                64
 #define STRESS_BLOBS                                 10
+#define CLONE_BENCH_DISKS                            50
+#define CLONE_BENCH_TIMEOUT_USEC                5000000
 
 #define LOCK_CYCLES                                    3
 #define COMPETITIVE_PARTICIPANTS                       3
@@ -222,6 +236,58 @@ typedef struct _blobstore_filelock {
     struct _blobstore_filelock *next;  //!< pointer for constructing a LL
 } blobstore_filelock;
 
+//! An entry of the blob index, which mirrors what a directory walk would find out about a blob
+typedef struct _blobstore_index_entry {
+    char *id;                          //!< ID of the blob
+    unsigned long long size_bytes;     //!< size of the blob in bytes, minus the blocks mapped from other blobs
+    unsigned long long blocks_allocated;    //!< actual number of blocks on disk taken by the blob
+    time_t last_accessed;              //!< timestamp of last access
+    time_t last_modified;              //!< timestamp of last modification
+    unsigned int in_use;               //!< MAPPED, BACKED and ABANDONED flags (OPENED is derived from opened_by)
+    unsigned char is_hollow;           //!< blockblob is 'hollow' - its size doesn't count toward the limit
+    pid_t opened_by;                   //!< process that has the blob open, or 0
+    unsigned long long opener_start;   //!< start time of opened_by, to tell it from a later process with the same PID, or 0 if unknown
+    unsigned int lru_pos;              //!< position of the entry in the LRU heap
+    struct _blobstore_index_entry *next;    //!< next entry in the same hash bucket
+} blobstore_index_entry;
+
+//! In-memory copy of the on-disk blob index (a snapshot file plus an append-only journal)
+typedef struct _blobstore_index {
+    pthread_mutex_t mutex;             //!< serializes threads using the same blobstore handle
+    ino_t journal_ino;                 //!< inode of the journal that was replayed (changes on compaction)
+    off_t journal_offset;              //!< how far into the journal we have replayed
+    unsigned int journal_records;      //!< records in the journal, to decide when to compact
+    unsigned int num_entries;          //!< number of blobs in the index
+    unsigned long long blocks_total;   //!< sum of sizes of all blobs, in blocks
+    unsigned long long blocks_opened;  //!< sum of sizes of blobs that are (or were last seen) open, in blocks
+    unsigned long long hollow_blocks_total; //!< the part of blocks_total taken by hollow blobs
+    unsigned long long hollow_blocks_opened;    //!< the part of blocks_opened taken by hollow blobs
+    unsigned long long blocks_allocated;    //!< sum of blocks allocated on disk to all blobs
+    blobstore_index_entry **lru;       //!< min-heap of all entries ordered by last_modified
+    unsigned int lru_size;             //!< allocated slots in the LRU heap (num_entries of them are used)
+    blobstore_index_entry *buckets[BLOBSTORE_INDEX_BUCKETS];
+} blobstore_index;
+
+#ifdef _UNIT_TEST
+//! Work of one thread of the clone benchmark
+typedef struct _clone_bench_job {
+    char path[BLOBSTORE_MAX_PATH];     //!< blobstore in which to provision the disk
+    int disk;                          //!< number of the disk, used for naming its blobs
+    int errors;                        //!< errors encountered by the thread
+} clone_bench_job;
+#endif /* _UNIT_TEST */
+
+//! State of a background thread that keeps free space in an LRU blobstore above a low watermark
+struct _blobstore_evictor {
+    blobstore *bs;                     //!< private handle of the blobstore, since the lock state lives in the handle
+    unsigned long long low_watermark_blocks;    //!< purge when fewer than this many blocks are free
+    unsigned int interval_sec;         //!< how often to check
+    boolean stop;                      //!< set to ask the thread to exit
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -365,17 +431,51 @@ static int typeof_blockblob_metadata_path(const blobstore * bs, const char *path
 static int delete_blockblob_files(const blobstore * bs, const char *bb_id);
 static int ensure_blockblob_metadata_path(const blobstore * bs, const char *bb_id);
 static void free_bbs(blockblob * bbs);
+static unsigned int check_relations(const blobstore * bs, const char *bb_id);
 static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long timeout_usec);
+static pid_t read_lock_owner(const blobstore * bs, const char *bb_id);
+static unsigned long long process_start_time(pid_t pid);
+static unsigned long long self_start_time(void);
+static unsigned long long blob_mapped_bytes(const blobstore * bs, const char *bb_id);
 static void set_device_path(blockblob * bb);
 static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** tail_bb, const blockblob * bb_to_avoid);
+static blockblob *walk_blobstore(blobstore * bs, const blockblob * bb_to_avoid);
+static unsigned int index_hash(const char *id);
+static blobstore_index_entry *index_find(blobstore_index * idx, const char *id);
+static void index_account(blobstore_index * idx, const blobstore_index_entry * e, int sign);
+static __INLINE__ void lru_swap(blobstore_index * idx, unsigned int i, unsigned int j);
+static void lru_fix(blobstore_index * idx, unsigned int pos);
+static int index_put(blobstore_index * idx, const blobstore_index_entry * val);
+static void index_remove(blobstore_index * idx, const char *id);
+static void index_clear(blobstore_index * idx);
+static void index_free(blobstore * bs);
+static int index_format_record(char *buf, int buf_size, const blobstore_index_entry * e, const char *id);
+static int index_apply_record(blobstore_index * idx, const char *line);
+static int index_replay(blobstore_index * idx, int fd, off_t * offset);
+static int index_open_journal(const blobstore * bs, int lock_type);
+static int index_catch_up(const blobstore * bs, int journal_fd);
+static int index_compact(const blobstore * bs);
+static int index_rebuild(const blobstore * bs, const blockblob * bbs);
+static int index_sync(const blobstore * bs);
+static void index_record(const blobstore * bs, const char *bb_id, pid_t opened_by);
+static blockblob *index_scan(blobstore * bs, const blockblob * bb_to_avoid);
 static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid);
 static int compare_bbs(const void *bb1, const void *bb2);
-static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks);
+static boolean opener_alive(const blobstore_index_entry * e);
+static int index_reap_openers(blobstore_index * idx);
+static int space_blobstore(blobstore * bs, const blockblob * bb_to_avoid, long long *blocks_locked, long long *blocks_unlocked, boolean precise);
+static int index_lru_candidates(blobstore * bs, const blockblob * bb_to_avoid, const blockblob * bbs_to_skip, long long need_blocks, blockblob ** candidates);
+static long long purge_blockblobs_list(blobstore * bs, blockblob * bb_list, long long need_blocks);
+static long long purge_blockblobs_lru(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks);
+static void *evictor_thread(void *arg);
 static int get_stale_refs(const blockblob * bb, char ***refs);
 static int loop_remove(blobstore * bs, const char *bb_id);
+static int dm_run(char *args[], int nargs, char **psStdout);
+static int dm_udev_cookie_create(char *cookie, int cookie_size);
+static void dm_udev_cookie_release(char *cookie);
+static boolean dm_table_uses(const char *dm_table, char *dev_names[], int size);
 static int dm_suspend_resume(const char *dev_name);
 static int dm_check_device(const char *dev_name);
-static int dm_delete_device(const char *dev_name);
 static int dm_delete_devices(char *dev_names[], int size);
 static int dm_create_devices(char *dev_names[], char *dm_tables[], int size);
 static char *dm_get_zero(void);
@@ -393,6 +493,10 @@ static int do_clone_stresstest(const char *base, const char *name, blobstore_for
 static int check_destination(blockblob * bb4, char *op);
 static int do_copy_test(const char *base, const char *name);
 static int do_clone_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation, blobstore_snapshot_t snapshot, int copy_or_snapshot);
+static void *clone_bench_function(void *ptr);
+static int do_clone_benchmark(const char *base, const char *name);
+static int do_index_test(const char *base, const char *name);
+static int do_lru_test(const char *base, const char *name);
 static int do_metadata_test(const char *base, const char *name);
 static int do_blobstore_test(const char *base, const char *name, blobstore_format_t format, blobstore_revocation_t revocation);
 static void *competitor_function(void *ptr);
@@ -1510,6 +1614,12 @@ blobstore *blobstore_open(const char *path, unsigned long long limit_blocks, uns
         goto out;
     }
     euca_strncpy(bs->path, path, sizeof(bs->path)); //! @TODO canonicalize path
+    if ((bs->index = EUCA_ZALLOC(1, sizeof(blobstore_index))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        EUCA_FREE(bs);
+        goto out;
+    }
+    pthread_mutex_init(&(bs->index->mutex), NULL);
     char meta_path[PATH_MAX];
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
 
@@ -1603,6 +1713,7 @@ write_metadata:
 free:
     saved_errno = _blobstore_errno;
     close_and_unlock(bs->fd);
+    index_free(bs);
     EUCA_FREE(bs);
     _blobstore_errno = saved_errno;
 
@@ -1623,6 +1734,8 @@ out:
 //!
 int blobstore_close(blobstore * bs)
 {
+    if (bs)
+        index_free(bs);
     EUCA_FREE(bs);
     return 0;
 }
@@ -1702,6 +1815,11 @@ int blobstore_delete(blobstore * bs)
     snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_METADATA_FILE);
     LOGINFO("removing blobstore metadata '%s'\n", meta_path);
     unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    unlink(meta_path);
+    snprintf(meta_path, sizeof(meta_path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    unlink(meta_path);
+    index_free(bs);
     EUCA_FREE(bs);
 
     return EUCA_OK;
@@ -1830,6 +1948,10 @@ static int write_blockblob_metadata_path(blockblob_path_t path_t, const blobstor
         ret = -1;                      // close_and_unlock should have set the error code
     }
 
+    if (path_t == BLOCKBLOB_PATH_HOLLOW || path_t == BLOCKBLOB_PATH_DM || path_t == BLOCKBLOB_PATH_DEPS || path_t == BLOCKBLOB_PATH_REFS) {
+        index_record(bs, bb_id, BLOBSTORE_INDEX_KEEP_OPENER);
+    }
+
     return ret;
 }
 
@@ -1923,6 +2045,10 @@ static int write_array_blockblob_metadata_path(blockblob_path_t path_t, const bl
         ret = -1;
     }
 
+    if (path_t == BLOCKBLOB_PATH_DM || path_t == BLOCKBLOB_PATH_DEPS || path_t == BLOCKBLOB_PATH_REFS) {
+        index_record(bs, bb_id, BLOBSTORE_INDEX_KEEP_OPENER);
+    }
+
     return (ret);
 }
 
@@ -2250,6 +2376,7 @@ static int delete_blockblob_files(const blobstore * bs, const char *bb_id)
         }
     }
 
+    index_record(bs, bb_id, BLOBSTORE_INDEX_KEEP_OPENER);  // drops the blob from the index unless its content survived
     return count;
 }
 
@@ -2325,6 +2452,117 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
         in_use |= BLOCKBLOB_STATUS_OPENED;  //! @TODO check if open failed for other reason?
     }
 
+    in_use |= check_relations(bs, bb_id);
+    _err_on();
+
+    return in_use;
+}
+
+//!
+//! Determines the process that opened a blob from the content of its lock file
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the process ID or 0 if it could not be determined
+//!
+static pid_t read_lock_owner(const blobstore * bs, const char *bb_id)
+{
+    int fd = -1;
+    int size = 0;
+    char path[PATH_MAX];
+    char buf[512] = "";
+
+    // blockblob_open() writes "pid/thread" into the lock file, which we can read without locking it
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, bb_id, path, sizeof(path));
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return 0;
+    size = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (size < 1)
+        return 0;
+    buf[size] = '\0';
+    return ((pid_t) atoi(buf));
+}
+
+//!
+//! Determines when a process started, which, unlike its PID, is not reused by a
+//! later process
+//!
+//! @param[in] pid the process ID
+//!
+//! @return the start time in clock ticks since boot, 0 if there is no such process,
+//!         or BLOBSTORE_START_TIME_UNKNOWN if /proc could not tell
+//!
+static unsigned long long process_start_time(pid_t pid)
+{
+    int fd = -1;
+    int size = 0;
+    char path[64];
+    char buf[1024] = "";
+    char *p = NULL;
+    unsigned long long start = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return ((errno == ENOENT || errno == ESRCH) ? 0 : BLOBSTORE_START_TIME_UNKNOWN);
+    size = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (size < 1)
+        return (BLOBSTORE_START_TIME_UNKNOWN);
+    buf[size] = '\0';
+
+    // the command name (field 2) is in parentheses and may contain anything, so count
+    // fields from its end: the start time is field 22, the 20th one after the name
+    if ((p = strrchr(buf, ')')) == NULL)
+        return (BLOBSTORE_START_TIME_UNKNOWN);
+    for (int field = 2; field < 22 && p != NULL; field++) {
+        p = strchr(p + 1, ' ');
+    }
+    if (p == NULL || sscanf(p, " %llu", &start) != 1 || start == 0)
+        return (BLOBSTORE_START_TIME_UNKNOWN);
+    return (start);
+}
+
+//!
+//! Returns the start time of this process, read once per process
+//!
+//! @return the start time or 0 if it could not be determined
+//!
+static unsigned long long self_start_time(void)
+{
+    static pthread_mutex_t self_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static pid_t self_pid = 0;
+    static unsigned long long self_start = 0;
+    unsigned long long start = 0;
+
+    pthread_mutex_lock(&self_mutex);
+    if (self_pid != getpid()) {        // first call, or we are a forked child
+        self_pid = getpid();
+        if ((self_start = process_start_time(self_pid)) == BLOBSTORE_START_TIME_UNKNOWN)
+            self_start = 0;
+    }
+    start = self_start;
+    pthread_mutex_unlock(&self_mutex);
+    return (start);
+}
+
+//!
+//! Determines how a blob is related to others, based on its metadata files
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return BLOCKBLOB_STATUS_MAPPED if other blobs depend on it, BLOCKBLOB_STATUS_BACKED
+//!         if it depends on others, both or none
+//!
+//! @note The caller is expected to have turned error reporting off
+//!
+static unsigned int check_relations(const blobstore * bs, const char *bb_id)
+{
+    unsigned int in_use = 0;
+    char path[PATH_MAX];
+
     if (read_blockblob_metadata_path(BLOCKBLOB_PATH_REFS, bs, bb_id, path, sizeof(path)) > 0) {
         in_use |= BLOCKBLOB_STATUS_MAPPED;
     }
@@ -2336,11 +2574,49 @@ static unsigned int check_in_use(blobstore * bs, const char *bb_id, long long ti
     if (read_blockblob_metadata_path(BLOCKBLOB_PATH_DM, bs, bb_id, path, sizeof(path)) > 0) {
         in_use |= BLOCKBLOB_STATUS_BACKED;
     }
-    _err_on();
 
     return in_use;
 }
 
+//!
+//! Sums up the blocks that a blob maps from other blobs, according to its .deps file,
+//! since those do not take up space in this blob
+//!
+//! @param[in] bs
+//! @param[in] bb_id
+//!
+//! @return the number of mapped bytes
+//!
+static unsigned long long blob_mapped_bytes(const blobstore * bs, const char *bb_id)
+{
+    char **array = NULL;
+    int array_size = 0;
+    unsigned long long mapped = 0;
+
+    if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bs, bb_id, &array, &array_size) != -1) {
+        for (int i = 0; i < array_size; i++) {
+            char *rel_type = NULL;
+            char *len_blocks = NULL;
+
+            strtok(array[i], " ");     // store path
+            strtok(NULL, " ");         // blob ID
+            rel_type = strtok(NULL, " ");
+            strtok(NULL, " ");         // start block
+            len_blocks = strtok(NULL, " ");
+            if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
+                mapped += strtoull(len_blocks, NULL, 0) * 512LL;
+            }
+        }
+    }
+
+    if (array) {
+        for (int i = 0; i < array_size; i++)
+            EUCA_FREE(array[i]);
+        EUCA_FREE(array);
+    }
+    return mapped;
+}
+
 //!
 //!
 //!
@@ -2399,7 +2675,8 @@ int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path)
     while ((dir_entry = readdir(dir)) != NULL) {
         char *entry_name = dir_entry->d_name;
 
-        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name))
+        if (!strcmp(".", entry_name) || !strcmp("..", entry_name) || !strcmp(BLOBSTORE_METADATA_FILE, entry_name)
+            || !strcmp(BLOBSTORE_INDEX_FILE, entry_name) || !strcmp(BLOBSTORE_JOURNAL_FILE, entry_name))
             continue;                  // ignore known unrelated files
 
         // get the path of the directory item
@@ -2499,33 +2776,8 @@ static blockblob **walk_bs(blobstore * bs, const char *dir_path, blockblob ** ta
         if (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bb->store, bb->id, buf, sizeof(buf)) != -1) {
             bb->is_hollow = TRUE;
         }
-        // if there is a .refs file, subtract the mapped blocks, if any, from the size
-        char **array = NULL;
-        int array_size = 0;
-        if (read_array_blockblob_metadata_path(BLOCKBLOB_PATH_DEPS, bb->store, bb->id, &array, &array_size) != -1) {
-            for (int i = 0; i < array_size; i++) {
-                char *store_path = NULL;
-                char *blob_id = NULL;
-                char *rel_type = NULL;
-                char *start_block = NULL;
-                char *len_blocks = NULL;
-
-                store_path = strtok(array[i], " ");
-                blob_id = strtok(NULL, " ");
-                rel_type = strtok(NULL, " ");
-                start_block = strtok(NULL, " ");
-                len_blocks = strtok(NULL, " ");
-                if (rel_type && len_blocks && strcmp(rel_type, blobstore_relation_type_name[BLOBSTORE_MAP]) == 0) {
-                    bb->size_bytes -= strtoull(len_blocks, NULL, 0) * 512LL;
-                }
-            }
-        }
-
-        if (array) {
-            for (int i = 0; i < array_size; i++)
-                EUCA_FREE(array[i]);
-            EUCA_FREE(array);
-        }
+        // if there is a .deps file, subtract the mapped blocks, if any, from the size
+        bb->size_bytes -= blob_mapped_bytes(bs, bb->id);
     }
 
 free:
@@ -2534,7 +2786,9 @@ free:
 }
 
 //!
-//! Runs through the blobstore and puts all found blockblobs into a linked list, returning its head
+//! Runs through the blobstore directory and puts all found blockblobs into a linked list,
+//! returning its head. This touches every file in the blobstore, so it is only used for
+//! recovery (fsck and rebuilding of the blob index).
 //!
 //! @param[in] bs
 //! @param[in] bb_to_avoid
@@ -2545,7 +2799,7 @@ free:
 //!
 //! @note
 //!
-static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
+static blockblob *walk_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
 {
     blockblob *bbs = NULL;
     if (walk_bs(bs, bs->path, &bbs, bb_to_avoid) == NULL) {
@@ -2558,141 +2812,1250 @@ static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
 }
 
 //!
+//! Computes the hash bucket of a blob ID in the in-memory blob index
 //!
+//! @param[in] id the blob ID
 //!
-//! @param[in] bb1
-//! @param[in] bb2
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return the bucket number
 //!
-static int compare_bbs(const void *bb1, const void *bb2)
+static unsigned int index_hash(const char *id)
 {
-    return (int)((*(blockblob **) bb1)->last_modified - (*(blockblob **) bb2)->last_modified);
+    unsigned int code = 5381;
+
+    for (const unsigned char *p = (const unsigned char *)id; *p; p++) {
+        code = ((code << 5) + code) + *p;
+    }
+    return (code % BLOBSTORE_INDEX_BUCKETS);
 }
 
 //!
+//! Finds the entry of a blob in the in-memory blob index
 //!
+//! @param[in] idx the index
+//! @param[in] id the blob ID
 //!
-//! @param[in] bs
-//! @param[in] bb_list
-//! @param[in] need_blocks
+//! @return the entry or NULL if the blob is not in the index
 //!
-//! @return
+static blobstore_index_entry *index_find(blobstore_index * idx, const char *id)
+{
+    for (blobstore_index_entry * e = idx->buckets[index_hash(id)]; e; e = e->next) {
+        if (!strcmp(e->id, id))
+            return e;
+    }
+    return NULL;
+}
+
 //!
-//! @pre
+//! Adds or subtracts the size of an index entry to or from the running totals of the index
 //!
-//! @note
+//! @param[in] idx the index
+//! @param[in] e the entry
+//! @param[in] sign 1 to add the entry or -1 to subtract it
 //!
-static long long purge_blockblobs_lru(blobstore * bs, blockblob * bb_list, long long need_blocks)
+static void index_account(blobstore_index * idx, const blobstore_index_entry * e, int sign)
 {
-    int list_length = 0;
-    long long purged = 0;
+    unsigned long long blocks = round_up_sec(e->size_bytes) / 512;
 
-    for (blockblob * bb = bb_list; bb; bb = bb->next) {
-        list_length++;
+    idx->blocks_total += sign * blocks;
+    idx->blocks_allocated += sign * e->blocks_allocated;
+    if (e->opened_by != 0)
+        idx->blocks_opened += sign * blocks;
+    if (e->is_hollow) {
+        idx->hollow_blocks_total += sign * blocks;
+        if (e->opened_by != 0)
+            idx->hollow_blocks_opened += sign * blocks;
     }
+}
 
-    if (list_length) {
-        blockblob *bb;
-        int i;
-
-        blockblob **bb_array = (blockblob **) EUCA_ZALLOC(list_length, sizeof(blockblob *));
-        if (!bb_array)
-            return purged;
-
-        for (i = 0, bb = bb_list; bb; bb = bb->next, i++) {
-            bb_array[i] = bb;
-        }
-
-        qsort(bb_array, list_length, sizeof(blockblob *), compare_bbs);
+//!
+//! Swaps two slots of the LRU heap, keeping the positions recorded in the entries current
+//!
+//! @param[in] idx the index
+//! @param[in] i the first slot
+//! @param[in] j the second slot
+//!
+static __INLINE__ void lru_swap(blobstore_index * idx, unsigned int i, unsigned int j)
+{
+    blobstore_index_entry *e = idx->lru[i];
 
-        int iteration = 0;
-        int deleted;
-        do {
-            // iterate multiple times in case there are dependencies
-            //! @TODO unify with _fsck's iteration code?
-            deleted = 0;               // deleted in this round
-            for (i = 0; i < list_length; i++) {
-                bb = bb_array[i];
-                if (bb == NULL)        // was either deleted or deemed undeletable on previous iteration
-                    continue;
-                bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+    idx->lru[i] = idx->lru[j];
+    idx->lru[j] = e;
+    idx->lru[i]->lru_pos = i;
+    idx->lru[j]->lru_pos = j;
+}
 
-                char code = '?';
-                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
-                    // mapped blobs have children, thus cannot be deleted at this iteration
-                    code = 'C';
+//!
+//! Restores the heap property of the LRU heap around one slot whose entry was added
+//! or whose last_modified changed
+//!
+//! @param[in] idx the index
+//! @param[in] pos the slot
+//!
+static void lru_fix(blobstore_index * idx, unsigned int pos)
+{
+    while (pos > 0 && idx->lru[pos]->last_modified < idx->lru[(pos - 1) / 2]->last_modified) {
+        lru_swap(idx, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
 
-                } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = 'O';
+    for (;;) {
+        unsigned int min = pos;
+        unsigned int left = 2 * pos + 1;
+        unsigned int right = 2 * pos + 2;
+        if (left < idx->num_entries && idx->lru[left]->last_modified < idx->lru[min]->last_modified)
+            min = left;
+        if (right < idx->num_entries && idx->lru[right]->last_modified < idx->lru[min]->last_modified)
+            min = right;
+        if (min == pos)
+            break;
+        lru_swap(idx, pos, min);
+        pos = min;
+    }
+}
 
-                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = '!';
+//!
+//! Inserts or updates the entry of a blob in the in-memory blob index
+//!
+//! @param[in] idx the index
+//! @param[in] val the values to store (the next pointer is ignored)
+//!
+//! @return 0 on success or -1 if out of memory
+//!
+static int index_put(blobstore_index * idx, const blobstore_index_entry * val)
+{
+    blobstore_index_entry *e = index_find(idx, val->id);
+
+    if (e == NULL) {
+        unsigned int bucket = index_hash(val->id);
+        if (idx->num_entries == idx->lru_size) {
+            unsigned int new_size = (idx->lru_size) ? (idx->lru_size * 2) : 64;
+            blobstore_index_entry **lru = EUCA_REALLOC(idx->lru, new_size, sizeof(blobstore_index_entry *));
+            if (lru == NULL)
+                return -1;
+            idx->lru = lru;
+            idx->lru_size = new_size;
+        }
+        if ((e = EUCA_ZALLOC(1, sizeof(blobstore_index_entry))) == NULL)
+            return -1;
+        if ((e->id = strdup(val->id)) == NULL) {
+            EUCA_FREE(e);
+            return -1;
+        }
+        e->next = idx->buckets[bucket];
+        idx->buckets[bucket] = e;
+        e->lru_pos = idx->num_entries;
+        idx->lru[e->lru_pos] = e;
+        idx->num_entries++;
+    } else {
+        index_account(idx, e, -1);
+    }
+
+    e->size_bytes = val->size_bytes;
+    e->blocks_allocated = val->blocks_allocated;
+    e->last_modified = val->last_modified;
+    e->last_accessed = val->last_accessed;
+    e->in_use = val->in_use;
+    e->is_hollow = val->is_hollow;
+    e->opened_by = val->opened_by;
+    e->opener_start = val->opener_start;
+    index_account(idx, e, 1);
+    lru_fix(idx, e->lru_pos);
+    return 0;
+}
 
-                } else {
-                    purged += round_up_sec(bb->size_bytes) / 512;
-                    bb_array[i] = NULL; // mark it to skip in the future
-                    code = 'D';
-                    deleted++;
-                }
-                LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'), // o = open
-                         (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
-                         (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
-                         (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
-                         code,         // outcome codes: D=deleted, else C=children, !=undeletable, O=open
-                         bb->size_bytes / 512L, // size is in sectors
-                         ctime(&(bb->last_modified)));  // ctime adds a newline
-                if (purged >= need_blocks)
-                    break;
+//!
+//! Removes the entry of a blob from the in-memory blob index, if it is there
+//!
+//! @param[in] idx the index
+//! @param[in] id the blob ID
+//!
+static void index_remove(blobstore_index * idx, const char *id)
+{
+    for (blobstore_index_entry ** pe = &(idx->buckets[index_hash(id)]); *pe; pe = &((*pe)->next)) {
+        if (!strcmp((*pe)->id, id)) {
+            blobstore_index_entry *e = *pe;
+            *pe = e->next;
+            index_account(idx, e, -1);
+            idx->num_entries--;
+            unsigned int pos = e->lru_pos;
+            if (pos < idx->num_entries) {  // move the last entry into the vacated slot
+                lru_swap(idx, pos, idx->num_entries);
+                lru_fix(idx, pos);
             }
-            iteration++;
-        } while (deleted && (purged < need_blocks));
-        EUCA_FREE(bb_array);
+            EUCA_FREE(e->id);
+            EUCA_FREE(e);
+            return;
+        }
     }
+}
 
-    return purged;
+//!
+//! Drops all entries from the in-memory blob index and forgets how much of the journal was read
+//!
+//! @param[in] idx the index
+//!
+static void index_clear(blobstore_index * idx)
+{
+    for (int i = 0; i < BLOBSTORE_INDEX_BUCKETS; i++) {
+        while (idx->buckets[i]) {
+            blobstore_index_entry *e = idx->buckets[i];
+            idx->buckets[i] = e->next;
+            EUCA_FREE(e->id);
+            EUCA_FREE(e);
+        }
+    }
+    idx->num_entries = 0;
+    idx->blocks_total = 0;
+    idx->blocks_opened = 0;
+    idx->hollow_blocks_total = 0;
+    idx->hollow_blocks_opened = 0;
+    idx->blocks_allocated = 0;
+    idx->journal_ino = 0;
+    idx->journal_offset = 0;
+    idx->journal_records = 0;
 }
 
 //!
+//! Frees the in-memory blob index of a blobstore handle
 //!
+//! @param[in] bs the blobstore handle
 //!
-//! @param[in] bs
-//! @param[in] meta
+static void index_free(blobstore * bs)
+{
+    if (bs->index) {
+        index_clear(bs->index);
+        pthread_mutex_destroy(&(bs->index->mutex));
+        EUCA_FREE(bs->index->lru);
+        EUCA_FREE(bs->index);
+    }
+}
+
 //!
-//! @return
+//! Formats an index record, as stored in the snapshot and in the journal. The ID goes
+//! last so that it may contain any character other than a newline. The opener is
+//! recorded as "pid/start", where older records only have the PID.
 //!
-//! @pre
+//! @param[out] buf the buffer to format into
+//! @param[in]  buf_size the size of the buffer
+//! @param[in]  e the entry to format or NULL for a removal record
+//! @param[in]  id the blob ID
 //!
-//! @note
+//! @return the length of the record
 //!
-int blobstore_stat(blobstore * bs, blobstore_meta * meta)
+static int index_format_record(char *buf, int buf_size, const blobstore_index_entry * e, const char *id)
 {
-    int ret = 0;
+    if (e == NULL)
+        return snprintf(buf, buf_size, "- %s\n", id);
 
-    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
-        return EUCA_ERROR;
-    }
-    // put existing items in the blobstore into a LL
-    _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
-    if (bbs == NULL) {
-        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-            goto unlock;
+    return snprintf(buf, buf_size, "+ %llu %llu %ld %ld %u %u %d/%llu %s\n", e->size_bytes, e->blocks_allocated, (long)e->last_modified, (long)e->last_accessed,
+                    e->in_use, (unsigned int)e->is_hollow, (int)e->opened_by, e->opener_start, id);
+}
+
+//!
+//! Applies one record of the snapshot or journal to the in-memory blob index
+//!
+//! @param[in] idx the index
+//! @param[in] line the NULL-terminated record, without the newline
+//!
+//! @return 0 on success or -1 if the record is malformed
+//!
+static int index_apply_record(blobstore_index * idx, const char *line)
+{
+    int id_offset = 0;
+    int start_offset = 0;
+    int opened_by = 0;
+    long mtime = 0;
+    long atime = 0;
+    unsigned int hollow = 0;
+    blobstore_index_entry e = { 0 };
+
+    switch (line[0]) {
+    case '#':
+    case '\0':
+        return 0;
+    case '-':
+        if (line[1] != ' ' || line[2] == '\0')
+            return -1;
+        index_remove(idx, line + 2);
+        return 0;
+    case '+':
+        if (sscanf(line, "+ %llu %llu %ld %ld %u %u %d%n", &e.size_bytes, &e.blocks_allocated, &mtime, &atime, &e.in_use, &hollow, &opened_by, &id_offset) != 7
+            || id_offset < 1)
+            return -1;
+        if (line[id_offset] == '/') {  // start time of the opener, which older records lack
+            if (sscanf(line + id_offset, "/%llu%n", &e.opener_start, &start_offset) != 1)
+                return -1;
+            id_offset += start_offset;
         }
+        if (line[id_offset] != ' ')
+            return -1;
+        while (line[id_offset] == ' ')
+            id_offset++;
+        if (line[id_offset] == '\0')
+            return -1;
+        e.id = (char *)(line + id_offset);
+        e.last_modified = mtime;
+        e.last_accessed = atime;
+        e.is_hollow = hollow;
+        e.opened_by = opened_by;
+        return index_put(idx, &e);
+    default:
+        return -1;
     }
-    // analyze the LL, calculating sizes
-    meta->blocks_allocated = 0;
-    meta->blocks_unlocked = 0;
-    meta->blocks_locked = 0;
-    meta->num_blobs = 0;
-    for (blockblob * abb = bbs; abb;) {
-        //! @TODO unify this with locked/unlocked calculation in open()
+}
+
+//!
+//! Reads complete records from a snapshot or journal file, starting at a given
+//! offset, and applies them to the in-memory index. A trailing partial record,
+//! if any, is left for the next call.
+//!
+//! @param[in]     idx the index
+//! @param[in]     fd the file to read from
+//! @param[in,out] offset where to start reading; on return, the offset after the last complete record
+//!
+//! @return the number of records applied or -1 on error
+//!
+static int index_replay(blobstore_index * idx, int fd, off_t * offset)
+{
+    int records = 0;
+    char buf[BLOBSTORE_MAX_PATH * 4];
+    ssize_t len = 0;
+    ssize_t used = 0;
+
+    for (;;) {
+        if ((len = pread(fd, buf + used, sizeof(buf) - used - 1, *offset + used)) < 0)
+            return -1;
+        if (len == 0)
+            break;
+        used += len;
+        buf[used] = '\0';
+
+        char *start = buf;
+        char *end = NULL;
+        while ((end = strchr(start, '\n')) != NULL) {
+            *end = '\0';
+            if (index_apply_record(idx, start) != 0) {
+                LOGWARN("ignoring malformed blobstore index record '%s'\n", start);
+            }
+            records++;
+            start = end + 1;
+        }
+
+        // move the partial record, if any, to the front of the buffer
+        *offset += (start - buf);
+        used -= (start - buf);
+        if (used >= (ssize_t) (sizeof(buf) - 1)) {
+            LOGERROR("blobstore index record is too long\n");
+            return -1;
+        }
+        memmove(buf, start, used);
+    }
+
+    return records;
+}
+
+//!
+//! Opens the journal of a blobstore, creating it if necessary, and locks it. If the
+//! file is replaced (compacted) while we wait for the lock, the new one is opened.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] lock_type LOCK_SH for readers or LOCK_EX for writers
+//!
+//! @return the file descriptor or -1 on error
+//!
+static int index_open_journal(const blobstore * bs, int lock_type)
+{
+    int fd = -1;
+    char path[PATH_MAX];
+    struct stat sb;
+
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    for (;;) {
+        if ((fd = open(path, O_RDWR | O_CREAT | O_APPEND, BLOBSTORE_FILE_PERM)) == -1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            return -1;
+        }
+        if (flock(fd, lock_type) == -1 || fstat(fd, &sb) == -1) {
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            close(fd);
+            return -1;
+        }
+        if (sb.st_nlink > 0)
+            return fd;
+        close(fd);                     // compacted while we waited for the lock, so try again
+    }
+}
+
+//!
+//! Brings the in-memory index up to date with the journal. If the journal was
+//! replaced since the last call, the snapshot is reloaded first.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] journal_fd the locked journal
+//!
+//! @return 0 on success, 1 if there is no snapshot (index must be rebuilt), or -1 on error
+//!
+//! @pre The caller holds the index mutex and a lock on the journal
+//!
+static int index_catch_up(const blobstore * bs, int journal_fd)
+{
+    int records = 0;
+    blobstore_index *idx = bs->index;
+    struct stat sb;
+
+    if (fstat(journal_fd, &sb) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        return -1;
+    }
+
+    if (sb.st_ino != idx->journal_ino) {
+        char path[PATH_MAX];
+        off_t offset = 0;
+        int fd = -1;
+
+        index_clear(idx);
+        snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+        if ((fd = open(path, O_RDONLY)) == -1) {
+            return 1;
+        }
+        records = index_replay(idx, fd, &offset);
+        close(fd);
+        if (records == -1) {
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to read blobstore index");
+            index_clear(idx);
+            return -1;
+        }
+        idx->journal_ino = sb.st_ino;
+    }
+
+    if ((records = index_replay(idx, journal_fd, &(idx->journal_offset))) == -1) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to read blobstore journal");
+        index_clear(idx);
+        return -1;
+    }
+    idx->journal_records += records;
+    return 0;
+}
+
+//!
+//! Writes the in-memory index out as a new snapshot and starts an empty journal
+//!
+//! @param[in] bs the blobstore
+//!
+//! @return 0 on success or -1 on error
+//!
+//! @pre The caller holds the index mutex and an exclusive lock on the current journal (if any)
+//!
+static int index_compact(const blobstore * bs)
+{
+    int ret = -1;
+    FILE *fp = NULL;
+    blobstore_index *idx = bs->index;
+    char index_path[PATH_MAX];
+    char journal_path[PATH_MAX];
+    char tmp_index_path[PATH_MAX];
+    char tmp_journal_path[PATH_MAX];
+    char record[BLOBSTORE_MAX_PATH + 256];
+    struct stat sb;
+
+    snprintf(index_path, sizeof(index_path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    snprintf(tmp_index_path, sizeof(tmp_index_path), "%s.%d", index_path, getpid());
+    snprintf(tmp_journal_path, sizeof(tmp_journal_path), "%s.%d", journal_path, getpid());
+
+    if ((fp = fopen(tmp_index_path, "w")) == NULL) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        return -1;
+    }
+    if (fchmod(fileno(fp), BLOBSTORE_FILE_PERM) == -1) {
+        LOGWARN("failed to set permissions on %s\n", tmp_index_path);
+    }
+    fprintf(fp, "# blobstore index v%d\n", BLOBSTORE_INDEX_VERSION);
+    for (int i = 0; i < BLOBSTORE_INDEX_BUCKETS; i++) {
+        for (blobstore_index_entry * e = idx->buckets[i]; e; e = e->next) {
+            index_format_record(record, sizeof(record), e, e->id);
+            fputs(record, fp);
+        }
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        fclose(fp);
+        goto cleanup;
+    }
+    fclose(fp);
+
+    // the snapshot must be in place before the new journal appears, as readers
+    // that see a new journal inode reload the snapshot
+    int fd = open(tmp_journal_path, O_WRONLY | O_CREAT | O_TRUNC, BLOBSTORE_FILE_PERM);
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        if (fd != -1)
+            close(fd);
+        goto cleanup;
+    }
+    close(fd);
+
+    if (rename(tmp_index_path, index_path) == -1 || rename(tmp_journal_path, journal_path) == -1) {
+        PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+        goto cleanup;
+    }
+
+    idx->journal_ino = sb.st_ino;
+    idx->journal_offset = 0;
+    idx->journal_records = 0;
+    ret = 0;
+
+cleanup:
+    unlink(tmp_index_path);
+    unlink(tmp_journal_path);
+    return ret;
+}
+
+//!
+//! Recovers the blob index from the content of the blobstore directory, replacing
+//! whatever the snapshot and the journal contained. This is the only place, besides
+//! fsck, where the blobstore directory is walked.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bbs blobs found by walk_blobstore()
+//!
+//! @return 0 on success or -1 on error
+//!
+//! @pre The caller holds the blobstore lock and the index mutex
+//!
+static int index_rebuild(const blobstore * bs, const blockblob * bbs)
+{
+    int ret = 0;
+    int fd = -1;
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry e = { 0 };
+
+    if ((fd = index_open_journal(bs, LOCK_EX)) == -1)
+        return -1;
+
+    index_clear(idx);
+    for (const blockblob * bb = bbs; bb; bb = bb->next) {
+        e.id = (char *)bb->id;
+        e.size_bytes = bb->size_bytes;
+        e.blocks_allocated = bb->blocks_allocated;
+        e.last_modified = bb->last_modified;
+        e.last_accessed = bb->last_accessed;
+        e.in_use = bb->in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED | BLOCKBLOB_STATUS_ABANDONED);
+        e.is_hollow = bb->is_hollow;
+        e.opened_by = 0;
+        e.opener_start = 0;
+        if ((bb->in_use & BLOCKBLOB_STATUS_OPENED) && (e.opened_by = read_lock_owner(bs, bb->id)) > 0) {
+            if ((e.opener_start = process_start_time(e.opened_by)) == BLOBSTORE_START_TIME_UNKNOWN)
+                e.opener_start = 0;
+        }
+        if (index_put(idx, &e) == -1) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret == 0 && (ret = index_compact(bs)) == 0) {
+        LOGDEBUG("rebuilt blob index of %s with %u blob(s)\n", bs->path, idx->num_entries);
+    } else {
+        index_clear(idx);
+    }
+    close(fd);
+    return ret;
+}
+
+//!
+//! Makes sure the in-memory blob index reflects the on-disk index, rebuilding the
+//! latter from the blobstore directory if it does not exist yet (e.g., a blobstore
+//! created by an older version).
+//!
+//! @param[in] bs the blobstore
+//!
+//! @return 0 on success or -1 on error
+//!
+//! @pre The caller holds the blobstore lock and the index mutex
+//!
+static int index_sync(const blobstore * bs)
+{
+    int rc = 0;
+    int fd = -1;
+
+    if ((fd = index_open_journal(bs, LOCK_SH)) == -1)
+        return -1;
+    rc = index_catch_up(bs, fd);
+    close(fd);
+
+    if (rc == 1) {
+        blockblob *bbs = NULL;
+        _blobstore_errno = BLOBSTORE_ERROR_OK;
+        if ((bbs = walk_blobstore((blobstore *) bs, NULL)) == NULL && _blobstore_errno != BLOBSTORE_ERROR_OK)
+            return -1;
+        rc = index_rebuild(bs, bbs);
+        free_bbs(bbs);
+    }
+    return rc;
+}
+
+//!
+//! Records the current state of a blob in the blob index, or its removal if its
+//! content file no longer exists. This is invoked whenever a blob is created,
+//! opened, closed or deleted and whenever its relations to other blobs change,
+//! so that queries need not look at the blob files.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bb_id the blob ID
+//! @param[in] opened_by the process that has the blob open, 0 if it is closed, or
+//!                      BLOBSTORE_INDEX_KEEP_OPENER to keep what the index says
+//!
+static void index_record(const blobstore * bs, const char *bb_id, pid_t opened_by)
+{
+    int fd = -1;
+    int len = 0;
+    char path[PATH_MAX];
+    char buf[64];
+    char record[BLOBSTORE_MAX_PATH + 256];
+    struct stat sb;
+    blobstore_index *idx = bs->index;
+    blobstore_index_entry e = { 0 };
+    blobstore_index_entry *old = NULL;
+    blobstore_error_t saved_errno = _blobstore_errno;
+    unsigned char saved_print = _do_print_errors;
+
+    if (idx == NULL)
+        return;
+
+    _err_off();                        // metadata files may legitimately be missing
+    pthread_mutex_lock(&(idx->mutex));
+    if ((fd = index_open_journal(bs, LOCK_EX)) == -1) {
+        goto unlock;
+    }
+    if (index_catch_up(bs, fd) != 0) {
+        goto unlock;                   // no snapshot yet, the next query will rebuild the index from scratch
+    }
+
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb_id, path, sizeof(path));
+    if (stat(path, &sb) == -1) {
+        if (index_find(idx, bb_id) == NULL)
+            goto unlock;
+        len = index_format_record(record, sizeof(record), NULL, bb_id);
+    } else {
+        old = index_find(idx, bb_id);
+        e.id = (char *)bb_id;
+        e.blocks_allocated = sb.st_blocks;
+        e.last_modified = sb.st_mtime;
+        e.last_accessed = sb.st_atime;
+        if (opened_by != BLOBSTORE_INDEX_KEEP_OPENER && old != NULL) {
+            // Only the opener changed. Relations and hollowness are recorded whenever their
+            // metadata files are written, so the index already has them, and only blobs
+            // that depend on others may have blocks mapped from them.
+            e.in_use = (old->in_use & (BLOCKBLOB_STATUS_MAPPED | BLOCKBLOB_STATUS_BACKED));
+            e.is_hollow = old->is_hollow;
+            e.size_bytes = sb.st_size - ((e.in_use & BLOCKBLOB_STATUS_BACKED) ? blob_mapped_bytes(bs, bb_id) : 0);
+        } else {
+            e.in_use = check_relations(bs, bb_id);
+            e.is_hollow = (read_blockblob_metadata_path(BLOCKBLOB_PATH_HOLLOW, bs, bb_id, buf, sizeof(buf)) != -1);
+            e.size_bytes = sb.st_size - blob_mapped_bytes(bs, bb_id);
+        }
+        e.opened_by = opened_by;
+        e.opener_start = ((opened_by == getpid()) ? self_start_time() : 0);
+        if (opened_by == BLOBSTORE_INDEX_KEEP_OPENER) {
+            e.opened_by = 0;
+            if (old != NULL) {
+                e.opened_by = old->opened_by;
+                e.opener_start = old->opener_start;
+                e.in_use |= (old->in_use & BLOCKBLOB_STATUS_ABANDONED);
+            }
+        }
+        len = index_format_record(record, sizeof(record), &e, bb_id);
+    }
+
+    if (write(fd, record, len) != len) {
+        LOGWARN("failed to append to the blob index of %s, it will be rebuilt\n", bs->path);
+        snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+        unlink(path);
+        index_clear(idx);
+        goto unlock;
+    }
+    // we hold the journal exclusively, so our record is the one right after what we read
+    record[len - 1] = '\0';
+    index_apply_record(idx, record);
+    idx->journal_offset += len;
+    idx->journal_records++;
+
+    if (idx->journal_records > BLOBSTORE_INDEX_COMPACT_RECORDS) {
+        index_compact(bs);
+    }
+
+unlock:
+    if (fd != -1)
+        close(fd);
+    pthread_mutex_unlock(&(idx->mutex));
+    _do_print_errors = saved_print;
+    _blobstore_errno = saved_errno;
+}
+
+//!
+//! Puts all blobs in the blob index into a linked list, like walk_blobstore() would,
+//! but without looking at the files of the blobs
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bb_to_avoid a blob to leave out of the list or NULL
+//!
+//! @return A pointer to the head of the linked list or NULL if the blobstore is empty
+//!         or on error (in which case _blobstore_errno is set)
+//!
+//! @pre The caller holds the blobstore lock
+//!
+static blockblob *index_scan(blobstore * bs, const blockblob * bb_to_avoid)
+{
+    blockblob *bbs = NULL;
+    blockblob **tail_bb = &bbs;
+    blobstore_index *idx = bs->index;
+
+    pthread_mutex_lock(&(idx->mutex));
+    if (index_sync(bs) == -1) {
+        goto unlock;
+    }
+
+    for (int i = 0; i < BLOBSTORE_INDEX_BUCKETS; i++) {
+        for (blobstore_index_entry * e = idx->buckets[i]; e; e = e->next) {
+            if (bb_to_avoid != NULL && strcmp(e->id, bb_to_avoid->id) == 0)
+                continue;
+
+            blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+            if (bb == NULL) {
+                ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+                free_bbs(bbs);
+                bbs = NULL;
+                goto unlock;
+            }
+            *tail_bb = bb;
+            tail_bb = &(bb->next);
+
+            bb->store = bs;
+            euca_strncpy(bb->id, e->id, sizeof(bb->id));
+            set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+            bb->size_bytes = e->size_bytes;
+            bb->blocks_allocated = e->blocks_allocated;
+            bb->last_accessed = e->last_accessed;
+            bb->last_modified = e->last_modified;
+            bb->snapshot_type = BLOBSTORE_FORMAT_ANY;
+            bb->is_hollow = e->is_hollow;
+            bb->in_use = e->in_use;
+            if (e->opened_by > 0) {
+                if (opener_alive(e)) {
+                    bb->in_use |= BLOCKBLOB_STATUS_OPENED;
+                } else {
+                    bb->in_use |= BLOCKBLOB_STATUS_ABANDONED;   // opener died without closing it
+                }
+            }
+        }
+    }
+
+unlock:
+    pthread_mutex_unlock(&(idx->mutex));
+    return bbs;
+}
+
+//!
+//! Puts all blockblobs of the blobstore into a linked list, returning its head. The list
+//! comes from the blob index when possible and from a directory walk otherwise.
+//!
+//! @param[in] bs
+//! @param[in] bb_to_avoid
+//!
+//! @return A pointer to the head of a linked list containing all found blockblobs
+//!
+//! @pre The caller holds the blobstore lock
+//!
+//! @note
+//!
+static blockblob *scan_blobstore(blobstore * bs, const blockblob * bb_to_avoid)
+{
+    blockblob *bbs = NULL;
+
+    if (bs->index != NULL) {
+        _blobstore_errno = BLOBSTORE_ERROR_OK;
+        bbs = index_scan(bs, bb_to_avoid);
+        if (bbs != NULL || _blobstore_errno == BLOBSTORE_ERROR_OK)
+            return bbs;
+        LOGWARN("blob index of %s is unusable, scanning the directory instead\n", bs->path);
+    }
+
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    return walk_blobstore(bs, bb_to_avoid);
+}
+
+//!
+//! Checks whether the process recorded as the opener of a blob is still running. A PID
+//! alone is not enough, since it may since have been reused by an unrelated process,
+//! which would keep the blob locked forever, so the start time of the process must
+//! match as well.
+//!
+//! @param[in] e the index entry
+//!
+//! @return TRUE if the opener is alive or FALSE if the blob is not open or its opener is gone
+//!
+static boolean opener_alive(const blobstore_index_entry * e)
+{
+    unsigned long long start = 0;
+
+    if (e->opened_by <= 0)
+        return (FALSE);
+
+    if ((start = process_start_time(e->opened_by)) == BLOBSTORE_START_TIME_UNKNOWN) {
+        // without /proc, the PID is all we can go by
+        return ((kill(e->opened_by, 0) == 0 || errno == EPERM) ? TRUE : FALSE);
+    }
+    // records written before start times were kept have none
+    return ((start != 0 && (e->opener_start == 0 || e->opener_start == start)) ? TRUE : FALSE);
+}
+
+//!
+//! Clears the opener of index entries whose opening process is gone, so that the
+//! running totals stop counting their blobs as locked. Such blobs are marked as
+//! abandoned, which is what index_scan() would report for them.
+//!
+//! @param[in] idx the index
+//!
+//! @return the number of entries that were updated
+//!
+//! @pre The caller holds the index mutex
+//!
+static int index_reap_openers(blobstore_index * idx)
+{
+    int reaped = 0;
+
+    for (unsigned int i = 0; i < idx->num_entries; i++) {
+        blobstore_index_entry *e = idx->lru[i];
+        if (e->opened_by > 0 && !opener_alive(e)) {
+            index_account(idx, e, -1);
+            e->opened_by = 0;
+            e->in_use |= BLOCKBLOB_STATUS_ABANDONED;
+            index_account(idx, e, 1);
+            reaped++;
+        }
+    }
+    return reaped;
+}
+
+//!
+//! Computes how many blocks are taken by blobs that are open (locked) and by blobs
+//! that are not (unlocked, thus potentially purgeable), not counting hollow blobs.
+//! With the blob index this takes constant time, unless a precise answer is asked
+//! for, in which case the openers of all blobs are checked for being alive.
+//!
+//! @param[in]  bs the blobstore
+//! @param[in]  bb_to_avoid a blob to leave out of the totals or NULL
+//! @param[out] blocks_locked blocks taken by open blobs
+//! @param[out] blocks_unlocked blocks taken by the rest of the blobs
+//! @param[in]  precise set to TRUE to not count blobs whose opener died as locked
+//!
+//! @return 0 on success or -1 on error (in which case _blobstore_errno is set)
+//!
+//! @pre The caller holds the blobstore lock
+//!
+static int space_blobstore(blobstore * bs, const blockblob * bb_to_avoid, long long *blocks_locked, long long *blocks_unlocked, boolean precise)
+{
+    blockblob *bbs = NULL;
+    blobstore_index *idx = bs->index;
+
+    *blocks_locked = 0;
+    *blocks_unlocked = 0;
+
+    if (idx != NULL) {
+        pthread_mutex_lock(&(idx->mutex));
+        if (index_sync(bs) == 0) {
+            if (precise)
+                index_reap_openers(idx);
+            *blocks_locked = idx->blocks_opened - idx->hollow_blocks_opened;
+            *blocks_unlocked = (idx->blocks_total - idx->hollow_blocks_total) - *blocks_locked;
+
+            blobstore_index_entry *e = NULL;
+            if (bb_to_avoid != NULL && (e = index_find(idx, bb_to_avoid->id)) != NULL && !e->is_hollow) {
+                if (e->opened_by != 0) {
+                    *blocks_locked -= round_up_sec(e->size_bytes) / 512;
+                } else {
+                    *blocks_unlocked -= round_up_sec(e->size_bytes) / 512;
+                }
+            }
+            pthread_mutex_unlock(&(idx->mutex));
+            return 0;
+        }
+        pthread_mutex_unlock(&(idx->mutex));
+        LOGWARN("blob index of %s is unusable, scanning the directory instead\n", bs->path);
+    }
+
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    if ((bbs = walk_blobstore(bs, bb_to_avoid)) == NULL && _blobstore_errno != BLOBSTORE_ERROR_OK)
+        return -1;
+
+    for (blockblob * abb = bbs; abb; abb = abb->next) {
+        long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
+        if (abb->is_hollow)
+            abb_size_blocks = 0;
+        if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
+            // these can't be purged if we need space
+            //! @TODO look into recursive purging of unused references?
+            *blocks_locked += abb_size_blocks;
+        } else {
+            *blocks_unlocked += abb_size_blocks;    // these potentially can be purged, unless they are depended on by locked ones
+        }
+    }
+    free_bbs(bbs);
+    return 0;
+}
+
+//!
+//! Picks the least recently modified blobs that look purgeable according to the blob
+//! index, until their sizes add up to the requested amount. The index keeps its entries
+//! in a min-heap, which is traversed in order without modifying it, so this takes
+//! O(k log k) time for k examined entries, independently of the size of the blobstore.
+//!
+//! @param[in]  bs the blobstore
+//! @param[in]  bb_to_avoid a blob to leave out or NULL
+//! @param[in]  bbs_to_skip a LL of blobs to leave out (e.g., ones that could not be deleted) or NULL
+//! @param[in]  need_blocks how many blocks worth of blobs to pick
+//! @param[out] candidates the LL of picked blobs, in LRU order, which the caller must free
+//!
+//! @return 0 on success or -1 if the index is unusable
+//!
+//! @pre The caller holds the blobstore lock
+//!
+static int index_lru_candidates(blobstore * bs, const blockblob * bb_to_avoid, const blockblob * bbs_to_skip, long long need_blocks, blockblob ** candidates)
+{
+    int ret = -1;
+    long long picked = 0;
+    unsigned int frontier_len = 0;
+    unsigned int *frontier = NULL;
+    blockblob **tail_bb = candidates;
+    blobstore_index *idx = bs->index;
+
+    *candidates = NULL;
+    if (idx == NULL)
+        return -1;
+
+    pthread_mutex_lock(&(idx->mutex));
+    if (index_sync(bs) == -1)
+        goto unlock;
+    ret = 0;
+    if (idx->num_entries == 0)
+        goto unlock;
+    if ((frontier = EUCA_ALLOC(idx->num_entries, sizeof(unsigned int))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        ret = -1;
+        goto unlock;
+    }
+    // the frontier is itself a min-heap of LRU heap slots: popping a slot and
+    // pushing its children yields the entries in the order of last_modified
+    frontier[frontier_len++] = 0;
+    while (frontier_len > 0 && picked < need_blocks) {
+        unsigned int pos = frontier[0];
+        frontier[0] = frontier[--frontier_len];
+        for (unsigned int i = 0;;) {
+            unsigned int min = i;
+            unsigned int left = 2 * i + 1;
+            unsigned int right = 2 * i + 2;
+            if (left < frontier_len && idx->lru[frontier[left]]->last_modified < idx->lru[frontier[min]]->last_modified)
+                min = left;
+            if (right < frontier_len && idx->lru[frontier[right]]->last_modified < idx->lru[frontier[min]]->last_modified)
+                min = right;
+            if (min == i)
+                break;
+            unsigned int tmp = frontier[i];
+            frontier[i] = frontier[min];
+            frontier[min] = tmp;
+            i = min;
+        }
+        for (unsigned int child = 2 * pos + 1; child <= 2 * pos + 2 && child < idx->num_entries; child++) {
+            unsigned int i = frontier_len++;
+            frontier[i] = child;
+            while (i > 0 && idx->lru[frontier[i]]->last_modified < idx->lru[frontier[(i - 1) / 2]]->last_modified) {
+                unsigned int tmp = frontier[i];
+                frontier[i] = frontier[(i - 1) / 2];
+                frontier[(i - 1) / 2] = tmp;
+                i = (i - 1) / 2;
+            }
+        }
+
+        blobstore_index_entry *e = idx->lru[pos];
+        if (e->in_use & BLOCKBLOB_STATUS_MAPPED)
+            continue;                  // has children, may become purgeable once they are gone
+        if (opener_alive(e))
+            continue;
+        if (bb_to_avoid != NULL && strcmp(e->id, bb_to_avoid->id) == 0)
+            continue;
+        const blockblob *skip = bbs_to_skip;
+        while (skip != NULL && strcmp(skip->id, e->id) != 0)
+            skip = skip->next;
+        if (skip != NULL)
+            continue;
+
+        blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
+        if (bb == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            free_bbs(*candidates);
+            *candidates = NULL;
+            ret = -1;
+            goto unlock;
+        }
+        *tail_bb = bb;
+        tail_bb = &(bb->next);
+
+        bb->store = bs;
+        euca_strncpy(bb->id, e->id, sizeof(bb->id));
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, bb->id, bb->blocks_path, sizeof(bb->blocks_path));
+        bb->size_bytes = e->size_bytes;
+        bb->blocks_allocated = e->blocks_allocated;
+        bb->last_accessed = e->last_accessed;
+        bb->last_modified = e->last_modified;
+        bb->snapshot_type = BLOBSTORE_FORMAT_ANY;
+        bb->is_hollow = e->is_hollow;
+        picked += round_up_sec(e->size_bytes) / 512;
+    }
+
+unlock:
+    pthread_mutex_unlock(&(idx->mutex));
+    EUCA_FREE(frontier);
+    return ret;
+}
+
+//!
+//!
+//!
+//! @param[in] bb1
+//! @param[in] bb2
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+static int compare_bbs(const void *bb1, const void *bb2)
+{
+    return (int)((*(blockblob **) bb1)->last_modified - (*(blockblob **) bb2)->last_modified);
+}
+
+//!
+//! Purges blobs from a list obtained with a directory walk, in LRU order, until the
+//! requested amount of space is freed. Used only when the blob index is unusable.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bb_list the LL of all blobs in the blobstore
+//! @param[in] need_blocks how many blocks to free
+//!
+//! @return the number of blocks freed
+//!
+//! @pre The caller holds the blobstore lock
+//!
+static long long purge_blockblobs_list(blobstore * bs, blockblob * bb_list, long long need_blocks)
+{
+    int list_length = 0;
+    long long purged = 0;
+
+    for (blockblob * bb = bb_list; bb; bb = bb->next) {
+        list_length++;
+    }
+
+    if (list_length) {
+        blockblob *bb;
+        int i;
+
+        blockblob **bb_array = (blockblob **) EUCA_ZALLOC(list_length, sizeof(blockblob *));
+        if (!bb_array)
+            return purged;
+
+        for (i = 0, bb = bb_list; bb; bb = bb->next, i++) {
+            bb_array[i] = bb;
+        }
+
+        qsort(bb_array, list_length, sizeof(blockblob *), compare_bbs);
+
+        int iteration = 0;
+        int deleted;
+        do {
+            // iterate multiple times in case there are dependencies
+            //! @TODO unify with _fsck's iteration code?
+            deleted = 0;               // deleted in this round
+            for (i = 0; i < list_length; i++) {
+                bb = bb_array[i];
+                if (bb == NULL)        // was either deleted or deemed undeletable on previous iteration
+                    continue;
+                bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+
+                char code = '?';
+                if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+                    // mapped blobs have children, thus cannot be deleted at this iteration
+                    code = 'C';
+
+                } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = 'O';
+
+                } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = '!';
+
+                } else {
+                    purged += round_up_sec(bb->size_bytes) / 512;
+                    bb_array[i] = NULL; // mark it to skip in the future
+                    code = 'D';
+                    deleted++;
+                }
+                LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'), // o = open
+                         (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
+                         (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
+                         (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
+                         code,         // outcome codes: D=deleted, else C=children, !=undeletable, O=open
+                         bb->size_bytes / 512L, // size is in sectors
+                         ctime(&(bb->last_modified)));  // ctime adds a newline
+                if (purged >= need_blocks)
+                    break;
+            }
+            iteration++;
+        } while (deleted && (purged < need_blocks));
+        EUCA_FREE(bb_array);
+    }
+
+    return purged;
+}
+
+//!
+//! Purges the least recently modified blobs that are not in use until the requested
+//! amount of space is freed. Candidates come from the LRU order maintained by the blob
+//! index, so only as many blobs as it takes are looked at. Each candidate is checked
+//! with check_in_use() before deletion, so a stale index cannot cause an open blob
+//! to be purged.
+//!
+//! @param[in] bs the blobstore
+//! @param[in] bb_to_avoid a blob that must not be purged (e.g., the one being created) or NULL
+//! @param[in] need_blocks how many blocks to free
+//!
+//! @return the number of blocks freed
+//!
+//! @pre The caller holds the blobstore lock
+//!
+static long long purge_blockblobs_lru(blobstore * bs, const blockblob * bb_to_avoid, long long need_blocks)
+{
+    int iteration = 0;
+    int deleted = 0;
+    long long purged = 0;
+    blockblob *undeletable = NULL;     // blobs that will not be looked at again
+
+    do {
+        // iterate multiple times in case there are dependencies
+        blockblob *bbs = NULL;
+        if (index_lru_candidates(bs, bb_to_avoid, undeletable, need_blocks - purged, &bbs) == -1) {
+            if (iteration == 0) {
+                LOGWARN("blob index of %s is unusable, scanning the directory instead\n", bs->path);
+                _blobstore_errno = BLOBSTORE_ERROR_OK;
+                if ((bbs = walk_blobstore(bs, bb_to_avoid)) != NULL) {
+                    purged = purge_blockblobs_list(bs, bbs, need_blocks);
+                    free_bbs(bbs);
+                }
+            }
+            break;
+        }
+
+        deleted = 0;                   // deleted in this round
+        while (bbs != NULL) {
+            blockblob *bb = bbs;
+            bbs = bb->next;
+            bb->next = NULL;
+            bb->in_use = check_in_use(bs, bb->id, 0);   // record in-use status
+
+            char code = '?';
+            if (bb->in_use & BLOCKBLOB_STATUS_MAPPED) {
+                // mapped blobs have children, thus cannot be deleted at this iteration
+                code = 'C';
+
+            } else if (bb->in_use & BLOCKBLOB_STATUS_OPENED) {
+                code = 'O';
+
+            } else if (delete_blob_state(bb, BLOBSTORE_DELETE_TIMEOUT_USEC, 1) == -1) {
+                code = '!';
+
+            } else {
+                purged += round_up_sec(bb->size_bytes) / 512;
+                code = 'D';
+                deleted++;
+            }
+            LOGDEBUG("LRU %d %08lld: %29s %c%c%c%c %c %9llu %s", iteration, purged, bb->id, (bb->in_use & BLOCKBLOB_STATUS_OPENED) ? ('o') : ('-'),    // o = open
+                     (bb->in_use & BLOCKBLOB_STATUS_BACKED) ? ('p') : ('-'),    // p = has parents
+                     (bb->in_use & BLOCKBLOB_STATUS_MAPPED) ? ('c') : ('-'),    // c = has children
+                     (bb->in_use & BLOCKBLOB_STATUS_ABANDONED) ? ('a') : ('-'), // a = was abandoned
+                     code,             // outcome codes: D=deleted, else C=children, !=undeletable, O=open
+                     bb->size_bytes / 512L, // size is in sectors
+                     ctime(&(bb->last_modified)));  // ctime adds a newline
+
+            if (code == 'O' || code == '!') {
+                bb->next = undeletable; // skip it in the future
+                undeletable = bb;
+            } else {
+                EUCA_FREE(bb);
+            }
+            if (purged >= need_blocks)
+                break;
+        }
+        free_bbs(bbs);
+        iteration++;
+    } while (deleted && (purged < need_blocks));
+    free_bbs(undeletable);
+
+    return purged;
+}
+
+//!
+//!
+//!
+//! @param[in] bs
+//! @param[in] meta
+//!
+//! @return
+//!
+//! @pre
+//!
+//! @note
+//!
+int blobstore_stat(blobstore * bs, blobstore_meta * meta)
+{
+    int ret = 0;
+
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {    // lock it so we can traverse blobstore safely
+        return EUCA_ERROR;
+    }
+    meta->blocks_allocated = 0;
+    meta->blocks_unlocked = 0;
+    meta->blocks_locked = 0;
+    meta->num_blobs = 0;
+
+    // the blob index keeps running totals, so there is no need to look at individual blobs
+    blobstore_index *idx = bs->index;
+    if (idx != NULL) {
+        pthread_mutex_lock(&(idx->mutex));
+        if (index_sync(bs) == 0) {
+            index_reap_openers(idx);
+            meta->blocks_locked = idx->blocks_opened;
+            meta->blocks_unlocked = idx->blocks_total - idx->blocks_opened;
+            meta->blocks_allocated = idx->blocks_allocated;
+            meta->num_blobs = idx->num_entries;
+            pthread_mutex_unlock(&(idx->mutex));
+            goto unlock;
+        }
+        pthread_mutex_unlock(&(idx->mutex));
+    }
+    // put existing items in the blobstore into a LL
+    _blobstore_errno = BLOBSTORE_ERROR_OK;
+    blockblob *bbs = walk_blobstore(bs, NULL);
+    if (bbs == NULL) {
+        if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
+            goto unlock;
+        }
+    }
+    // analyze the LL, calculating sizes
+    for (blockblob * abb = bbs; abb;) {
+        //! @TODO unify this with locked/unlocked calculation in open()
         long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
         if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
             // these can't be purged if we need space
@@ -2730,6 +4093,121 @@ unlock:
     return ret;
 }
 
+//!
+//! Body of the background evictor thread: every interval_sec seconds, purges the least
+//! recently modified blobs if the free space in the blobstore is below the low watermark
+//!
+//! @param[in] arg the evictor
+//!
+//! @return always NULL
+//!
+static void *evictor_thread(void *arg)
+{
+    blobstore_evictor *ev = (blobstore_evictor *) arg;
+    blobstore *bs = ev->bs;
+    struct timespec ts = { 0 };
+
+    pthread_mutex_lock(&(ev->mutex));
+    while (!ev->stop) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ev->interval_sec;
+        pthread_cond_timedwait(&(ev->cond), &(ev->mutex), &ts);
+        if (ev->stop)
+            break;
+        pthread_mutex_unlock(&(ev->mutex));
+
+        if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) != -1) {
+            long long blocks_locked = 0;
+            long long blocks_unlocked = 0;
+            if (space_blobstore(bs, NULL, &blocks_locked, &blocks_unlocked, FALSE) == 0) {
+                long long blocks_free = bs->limit_blocks - (blocks_locked + blocks_unlocked);
+                if (blocks_free < (long long)ev->low_watermark_blocks && blocks_unlocked > 0) {
+                    long long blocks_needed = ev->low_watermark_blocks - blocks_free;
+                    _err_off();        // do not care about errors duing purging
+                    long long blocks_freed = purge_blockblobs_lru(bs, NULL, blocks_needed);
+                    _err_on();
+                    LOGDEBUG("evictor freed %lld of %lld blocks needed to reach the low watermark of %s\n", blocks_freed, blocks_needed, bs->path);
+                }
+            }
+            blobstore_unlock(bs);
+        }
+
+        pthread_mutex_lock(&(ev->mutex));
+    }
+    pthread_mutex_unlock(&(ev->mutex));
+
+    return NULL;
+}
+
+//!
+//! Starts a background thread that purges blobs from an LRU blobstore, least recently
+//! modified first, whenever its free space drops below a low watermark, so that
+//! blockblob_open() rarely has to purge on the critical path
+//!
+//! @param[in] bs the blobstore, which must have the LRU revocation policy
+//! @param[in] low_watermark_blocks the amount of free space to maintain, in blocks
+//! @param[in] interval_sec how often to check the free space, in seconds
+//!
+//! @return the evictor, to be stopped with blobstore_stop_evictor(), or NULL on error
+//!
+blobstore_evictor *blobstore_start_evictor(blobstore * bs, unsigned long long low_watermark_blocks, unsigned int interval_sec)
+{
+    blobstore_evictor *ev = NULL;
+
+    if (bs == NULL || bs->revocation_policy != BLOBSTORE_REVOCATION_LRU || interval_sec == 0) {
+        ERR(BLOBSTORE_ERROR_INVAL, "evictor requires an LRU blobstore and a non-zero interval");
+        return NULL;
+    }
+
+    if ((ev = EUCA_ZALLOC(1, sizeof(blobstore_evictor))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return NULL;
+    }
+    // the thread gets a handle of its own, since the blobstore lock is held through the handle
+    if ((ev->bs = blobstore_open(bs->path, 0, 0, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY)) == NULL) {
+        EUCA_FREE(ev);
+        return NULL;
+    }
+    ev->low_watermark_blocks = low_watermark_blocks;
+    ev->interval_sec = interval_sec;
+    pthread_mutex_init(&(ev->mutex), NULL);
+    pthread_cond_init(&(ev->cond), NULL);
+
+    if (pthread_create(&(ev->thread), NULL, evictor_thread, ev) != 0) {
+        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to start the evictor thread");
+        pthread_cond_destroy(&(ev->cond));
+        pthread_mutex_destroy(&(ev->mutex));
+        blobstore_close(ev->bs);
+        EUCA_FREE(ev);
+        return NULL;
+    }
+
+    LOGINFO("started evictor for %s with low watermark of %llu blocks\n", bs->path, low_watermark_blocks);
+    return ev;
+}
+
+//!
+//! Stops a background evictor, waiting for a purge in progress to finish, and frees it
+//!
+//! @param[in] ev the evictor returned by blobstore_start_evictor() or NULL
+//!
+void blobstore_stop_evictor(blobstore_evictor * ev)
+{
+    if (ev == NULL)
+        return;
+
+    pthread_mutex_lock(&(ev->mutex));
+    ev->stop = TRUE;
+    pthread_cond_signal(&(ev->cond));
+    pthread_mutex_unlock(&(ev->mutex));
+    pthread_join(ev->thread, NULL);
+
+    pthread_cond_destroy(&(ev->cond));
+    pthread_mutex_destroy(&(ev->mutex));
+    blobstore_close(ev->bs);
+    EUCA_FREE(ev);
+}
+
 //!
 //! Read .refs file content and return any entries that point to blobs that no longer exist
 //!
@@ -2838,9 +4316,17 @@ int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb))
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to lock the blobstore");
         return -1;
     }
-    // put existing items in the blobstore into a LL
+    // put existing items in the blobstore into a LL, walking the directory
+    // since fsck is where the blob index gets recovered from
     _blobstore_errno = BLOBSTORE_ERROR_OK;
-    blockblob *bbs = scan_blobstore(bs, NULL);
+    blockblob *bbs = walk_blobstore(bs, NULL);
+    if ((bbs != NULL || _blobstore_errno == BLOBSTORE_ERROR_OK) && bs->index != NULL) {
+        pthread_mutex_lock(&(bs->index->mutex));
+        if (index_rebuild(bs, bbs) == -1) {
+            LOGWARN("failed to rebuild the blob index of %s\n", bs->path);
+        }
+        pthread_mutex_unlock(&(bs->index->mutex));
+    }
 
     if (blobstore_unlock(bs) == -1) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to unlock the blobstore");
@@ -3122,7 +4608,6 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
 
     LOGTRACE("{%u} blockblob_open: opening blob id=%s flags=%d timeout=%lld\n", (unsigned int)pthread_self(), id, flags, timeout_usec);
 
-    blockblob *bbs = NULL;             // a temp LL of blockblobs, used for computing free space and for purging
     blockblob *bb = EUCA_ZALLOC(1, sizeof(blockblob));
     if (bb == NULL) {
         ERR(BLOBSTORE_ERROR_NOMEM, NULL);
@@ -3209,14 +4694,6 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
             blobstore_locked = 1;
         }
 
-        // put existing items in the blobstore into a LL
-        _blobstore_errno = BLOBSTORE_ERROR_OK;
-        bbs = scan_blobstore(bs, bb);
-        if (bbs == NULL) {
-            if (_blobstore_errno != BLOBSTORE_ERROR_OK) {
-                goto clean;
-            }
-        }
         // a bit of a hack: HOLLOW blobs skip the blobstore limit check upon creation
         if (flags & BLOBSTORE_FLAG_HOLLOW) {
             bb->is_hollow = TRUE;
@@ -3225,26 +4702,19 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
 
         } else {                       // enforce blobstore limits
 
-            // analyze the LL, calculating sizes
+            // the running totals of the blob index make this check cheap
             long long blocks_unlocked = 0;
             long long blocks_locked = 0;
-            unsigned int num_blobs = 0;
-            for (blockblob * abb = bbs; abb; abb = abb->next) {
-                long long abb_size_blocks = round_up_sec(abb->size_bytes) / 512;
-                if (abb->is_hollow)
-                    abb_size_blocks = 0;
-                if (abb->in_use & BLOCKBLOB_STATUS_OPENED) {
-                    // these can't be purged if we need space
-                    //! @TODO look into recursive purging of unused references?
-                    blocks_locked += abb_size_blocks;
-                } else {
-                    blocks_unlocked += abb_size_blocks; // these potentially can be purged, unless they are depended on by locked ones
-                }
-                num_blobs++;
-            }
+            if (space_blobstore(bs, bb, &blocks_locked, &blocks_unlocked, FALSE) == -1)
+                goto clean;
 
             long long blocks_free = bs->limit_blocks - (blocks_unlocked + blocks_locked);
             if (blocks_free < size_blocks) {
+                if ((bs->revocation_policy == BLOBSTORE_REVOCATION_LRU) && (blocks_free + blocks_unlocked) < size_blocks) {
+                    // openers that died still count as locked, so take a closer look before giving up
+                    if (space_blobstore(bs, bb, &blocks_locked, &blocks_unlocked, TRUE) == -1)
+                        goto clean;
+                }
                 if (!(bs->revocation_policy == BLOBSTORE_REVOCATION_LRU)    // not allowed to purge
                     || (blocks_free + blocks_unlocked) < size_blocks) { // not enough purgeable material
                     ERR(BLOBSTORE_ERROR_NOSPC, NULL);
@@ -3252,7 +4722,7 @@ blockblob *blockblob_open(blobstore * bs, const char *id, unsigned long long siz
                 }
                 long long blocks_needed = size_blocks - blocks_free;
                 _err_off();            // do not care about errors duing purging
-                long long blocks_freed = purge_blockblobs_lru(bs, bbs, blocks_needed);
+                long long blocks_freed = purge_blockblobs_lru(bs, bb, blocks_needed);
                 _err_on();
                 if (blocks_freed < blocks_needed) {
                     ERR(BLOBSTORE_ERROR_NOSPC, "could not purge enough from cache");
@@ -3376,12 +4846,14 @@ free:
     EUCA_FREE(bb);
 
 out:
+    if (bb != NULL) {
+        index_record(bs, bb->id, getpid());
+    }
     LOGTRACE("{%u} blockblob_open: done with blob id=%s ret=%p\n", (unsigned int)pthread_self(), id, bb);
     if (bb == NULL) {
         LOGTRACE("{%u} blockblob_open: errno=%d msg=%s\n", (unsigned int)pthread_self(), _blobstore_errno, blobstore_get_last_msg());
     }
 
-    free_bbs(bbs);
     return bb;
 }
 
@@ -3451,31 +4923,134 @@ int blockblob_close(blockblob * bb)
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to truncate the blobstore lock file.");
     }
     ret |= close_and_unlock(bb->fd_lock);
+    index_record(bb->store, bb->id, 0);
     EUCA_FREE(bb);                     // we free the blob regardless of whether closing succeeds or not
     return ret;
 }
 
 //!
+//! Runs dmsetup through rootwrap with the given arguments. No shell is involved, so
+//! device names and table files are never parsed as anything but arguments.
+//!
+//! @param[in]  args the arguments to pass to dmsetup
+//! @param[in]  nargs the number of arguments
+//! @param[out] psStdout set to what dmsetup printed, if not NULL (to be freed by the caller)
+//!
+//! @return 0 on success or -1 if dmsetup could not be run, failed or timed out
+//!
+static int dm_run(char *args[], int nargs, char **psStdout)
+{
+    int i = 0;
+    int rc = 0;
+    int status = 0;
+    char *errors = NULL;
+    char **argv = NULL;
+
+    if ((argv = EUCA_ZALLOC(nargs + 3, sizeof(char *))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return (-1);
+    }
+    argv[i++] = helpers_path[ROOTWRAP];
+    argv[i++] = helpers_path[DMSETUP];
+    for (int j = 0; j < nargs; j++) {
+        argv[i++] = args[j];
+    }
+    argv[i] = NULL;
+
+    rc = euca_spawn_capture(argv, EUCA_SPAWN_SETPGROUP, BLOBSTORE_DMSETUP_TIMEOUT_SEC, 0, psStdout, &errors, &status);
+    if (rc != EUCA_OK) {
+        LOGDEBUG("{%u} dmsetup %s failed (rc=%d status=%d): %s\n", (unsigned int)pthread_self(), ((nargs > 0) ? args[0] : ""), rc, status, SP(errors));
+    }
+    EUCA_FREE(errors);
+    EUCA_FREE(argv);
+    return ((rc == EUCA_OK) ? 0 : -1);
+}
+
+//!
+//! Creates a udev cookie, so that the udev events of a set of dmsetup invocations can be
+//! waited for all at once with dm_udev_cookie_release(), rather than one by one
+//!
+//! @param[out] cookie set to the cookie or to an empty string on failure
+//! @param[in]  cookie_size the size of the cookie buffer
+//!
+//! @return 0 on success or -1 if dmsetup does not support udev synchronization
+//!
+static int dm_udev_cookie_create(char *cookie, int cookie_size)
+{
+    char *out = NULL;
+    char *args[1] = { "udevcreatecookie" };
+
+    cookie[0] = '\0';
+    if ((dm_run(args, 1, &out) == 0) && (out != NULL)) {
+        euca_strncpy(cookie, out, cookie_size);
+        cookie[strcspn(cookie, " \t\n")] = '\0';
+    }
+    EUCA_FREE(out);
+    return ((cookie[0] != '\0') ? 0 : -1);
+}
+
+//!
+//! Waits for the udev events bound to a cookie, so that the /dev/mapper entries of the
+//! devices created with it exist, and releases the cookie. Does nothing without a cookie.
+//!
+//! @param[in,out] cookie the cookie, emptied on return
+//!
+static void dm_udev_cookie_release(char *cookie)
+{
+    char *args[2] = { "udevreleasecookie", cookie };
+
+    if (cookie[0] == '\0')
+        return;
+
+    if (dm_run(args, 2, NULL) != 0) {
+        LOGWARN("{%u} failed to wait for udev cookie %s\n", (unsigned int)pthread_self(), cookie);
+    }
+    cookie[0] = '\0';
+}
+
+//!
+//! Tells whether a device mapper table refers to any of the given devices by path
+//!
+//! @param[in] dm_table the device mapper table
+//! @param[in] dev_names the device mapper names to look for
+//! @param[in] size the number of names
+//!
+//! @return TRUE if the table refers to one of the devices
+//!
+static boolean dm_table_uses(const char *dm_table, char *dev_names[], int size)
+{
+    int len = 0;
+    const char *p = NULL;
+    char dm_path[MAX_DM_PATH] = "";
+
+    for (int i = 0; i < size; i++) {
+        len = snprintf(dm_path, sizeof(dm_path), DM_FORMAT, dev_names[i]);
+        for (p = strstr(dm_table, dm_path); p != NULL; p = strstr(p + 1, dm_path)) {
+            if ((p[len] == '\0') || isspace(p[len]))
+                return (TRUE);
+        }
+    }
+    return (FALSE);
+}
+
+//!
+//! Suspends and resumes a device mapper device
 //!
+//! @param[in] dev_name the device mapper name of the device
 //!
-//! @param[in] dev_name
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or -1 on error
 //!
 static int dm_suspend_resume(const char *dev_name)
 {
-    int ret = EUCA_OK;
+    char *suspend_args[2] = { "suspend", (char *)dev_name };
+    char *resume_args[2] = { "resume", (char *)dev_name };
 
-    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "suspend", dev_name, NULL)) != EUCA_OK) {
+    if (dm_run(suspend_args, 2, NULL) != 0) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to suspend device with 'dmsetup'");
         return (-1);
     }
 
-    if ((ret = euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "resume", dev_name, NULL)) != EUCA_OK) {
+    if (dm_run(resume_args, 2, NULL) != 0) {
         ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to resume device with 'dmsetup'");
         return (-1);
     }
@@ -3503,58 +5078,23 @@ static int dm_check_device(const char *dev_name)
 }
 
 //!
+//! Removes a set of device mapper devices, in reverse order of creation and along
+//! with any partition devices created on top of them. The udev events of the whole
+//! set are waited for once, at the end.
 //!
+//! @param[in] dev_names the device mapper names, in the order they were created (may repeat)
+//! @param[in] size the number of names
 //!
-//! @param[in] dev_name
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
-//!
-static int dm_delete_device(const char *dev_name)
-{
-    int ret = 0;
-    int retries = 1;
-    char dm_path[MAX_DM_PATH] = "";
-
-    // see if the device to delete exists
-    snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_name);
-    errno = 0;
-    if (check_path(dm_path) && (errno == ENOENT))   // we do not use check_block() because /dev/mapper/... entries can be sym links
-        return (0);
-
-try_again:
-    myprintf(EUCA_LOG_INFO, "removing device %s (retries=%d)\n", dev_name, retries);
-    if ((euca_execlp(NULL, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "remove", dev_name, NULL)) != EUCA_OK) {
-        if (retries--) {
-            usleep(100);
-            goto try_again;
-        }
-        ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with 'dmsetup'");
-        ret = -1;
-    }
-    return (ret);
-}
-
-//!
-//!
-//!
-//! @param[in] dev_names
-//! @param[in] size
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or -1 if any of the existing devices could not be removed
 //!
 static int dm_delete_devices(char *dev_names[], int size)
 {
     if (size < 1)
         return 0;
     int ret = 0;
+    int nargs = 0;
+    int nnames = 0;
+    char cookie[DM_UDEV_COOKIE_SIZE] = "";
 
     // construct list of device names in the order that they should be removed
     int devices = 0;
@@ -3563,6 +5103,12 @@ static int dm_delete_devices(char *dev_names[], int size)
         ERR(BLOBSTORE_ERROR_NOMEM, NULL);
         return -1;
     }
+    char **names = EUCA_ZALLOC(size * (1 + 2 * DM_MAX_PARTITIONS), sizeof(char *));
+    if (names == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        EUCA_FREE(dev_names_removable);
+        return -1;
+    }
     for (int i = size - 1; i >= 0; i--) {
         char *name = dev_names[i];
         int seen = 0;
@@ -3577,122 +5123,190 @@ static int dm_delete_devices(char *dev_names[], int size)
         }
     }
 
-    // run through devices and remove them
+    // run through devices and list the ones that exist, before any of them is removed
     for (int i = 0; i < devices; i++) {
 
         // some of these devices may have children devices that were created
         // by GNU parted for each of the partitions inside; here we look for
         // those devices and remove them so the main device is not 'busy'.
-        for (int j = 1; j < 10; j++) {
+        for (int j = 1; j <= DM_MAX_PARTITIONS; j++) {
             char name_p[1024];         // device mapper name of a potential partition entry
             char path_p[1024];         // path to the device mapper file
             // just append 'pN' to the name, e.g., sda -> sdap1
             snprintf(name_p, sizeof(name_p), "%sp%d", dev_names_removable[i], j);
             snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
             if (check_path(path_p) == 0) {
-                dm_delete_device(name_p);
+                names[nnames++] = strdup(name_p);
             }
             // also try appending just 'N', since that may be the name format, too
             snprintf(name_p, sizeof(name_p), "%s%d", dev_names_removable[i], j);
             snprintf(path_p, sizeof(path_p), DM_FORMAT, name_p);
             if (check_path(path_p) == 0) {
-                dm_delete_device(name_p);
+                names[nnames++] = strdup(name_p);
+            }
+        }
+        if (dm_check_device(dev_names_removable[i]) == 0) {
+            myprintf(EUCA_LOG_INFO, "removing device %s\n", dev_names_removable[i]);
+            names[nnames++] = strdup(dev_names_removable[i]);
+        }
+    }
+
+    for (int i = 0; i < nnames; i++) {
+        if (names[i] == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            ret = -1;
+            goto free;
+        }
+    }
+
+    // without udev synchronization support, each dmsetup waits for its own events
+    dm_udev_cookie_create(cookie, sizeof(cookie));
+    for (int i = 0; i < nnames; i++) {
+        char *args[4] = { NULL };
+        nargs = 0;
+        if (cookie[0] != '\0') {
+            args[nargs++] = "--udevcookie";
+            args[nargs++] = cookie;
+        }
+        args[nargs++] = "remove";
+        args[nargs++] = names[i];
+
+        if (dm_run(args, nargs, NULL) != 0) {
+            sleep(1);                  // the device may still be busy, try once more
+            if (dm_run(args, nargs, NULL) != 0) {
+                ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to remove device mapper device with 'dmsetup'");
+                ret = -1;
             }
         }
-        ret = dm_delete_device(dev_names_removable[i]);
     }
+    dm_udev_cookie_release(cookie);
+
+free:
+    for (int i = 0; i < nnames; i++) {
+        EUCA_FREE(names[i]);
+    }
+    EUCA_FREE(names);
     EUCA_FREE(dev_names_removable);
 
     return ret;
 }
 
 //!
+//! Creates a set of device mapper devices, in order. The devices share a udev cookie,
+//! so their udev events are waited for together rather than after each dmsetup. When a
+//! device's table refers to a device created earlier in the set, the pending events are
+//! waited for first, so that the earlier device's /dev/mapper entry exists. Each device
+//! is then made accessible to the eucalyptus user. If any of the devices cannot be
+//! created, the ones that were are removed.
 //!
+//! @param[in] dev_names the device mapper names of the devices
+//! @param[in] dm_tables the device mapper tables of the devices
+//! @param[in] size the number of devices
 //!
-//! @param[in] dev_names
-//! @param[in] dm_tables
-//! @param[in] size
-//!
-//! @return
-//!
-//! @pre
-//!
-//! @note
+//! @return 0 on success or -1 on error
 //!
 static int dm_create_devices(char *dev_names[], char *dm_tables[], int size)
 {
     int i = 0;
-    int fd = 0;
-    int status = 0;
-    int rc = EUCA_OK;
-    int rbytes = 0;
-    pid_t cpid = 0;
+    int fd = -1;
+    int rc = 0;
+    int ret = -1;
+    int nargs = 0;
+    int pending = 0;
+    boolean use_cookie = TRUE;
+    char **tmpfiles = NULL;
     char tmpfile[EUCA_MAX_PATH] = "";
     char dm_path[MAX_DM_PATH] = "";
+    char cookie[DM_UDEV_COOKIE_SIZE] = "";
 
-    for (i = 0; i < size; i++) {
-        // create devices one by one
-        myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
-
-        if ((cpid = fork()) < 0) {
-            // fork error
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto cleanup;
-        } else if (cpid == 0) {
-            // child process - runs `dmsetup` using system()
-            bzero(tmpfile, sizeof(tmpfile));
-            snprintf(tmpfile, sizeof(tmpfile) - 1, "/tmp/dmsetup.XXXXXX");
-            if ((fd = safe_mkstemp(tmpfile)) >= 0) {
-                if ((rbytes = write(fd, dm_tables[i], strlen(dm_tables[i]))) != strlen(dm_tables[i])) {
-                    // if write error
-                    LOGERROR("{%u} error: dm_create_devices: write returned number of bytes != write buffer: %d/%ld\n", (unsigned int)pthread_self(), rbytes, strlen(dm_tables[i]));
-                    unlink(tmpfile);
-                    exit(1);
-                }
-                close(fd);
-            } else {
-                // couldn't get fd
-                LOGERROR("{%u} error: dm_create_devices: couldn't open temporary file %s: %s\n", (unsigned int)pthread_self(), tmpfile, strerror(errno));
-                unlink(tmpfile);
-                exit(1);
-            }
+    if (size < 1)
+        return (0);
 
-            // invoke `dmsetup create ...`
-            rc = euca_execlp(&status, helpers_path[ROOTWRAP], helpers_path[DMSETUP], "create", dev_names[i], tmpfile, NULL);
+    if ((tmpfiles = EUCA_ZALLOC(size, sizeof(char *))) == NULL) {
+        ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+        return (-1);
+    }
 
-            // free out temp file
+    // write the tables into files that dmsetup will read
+    for (i = 0; i < size; i++) {
+        snprintf(tmpfile, sizeof(tmpfile), "/tmp/dmsetup.XXXXXX");
+        if ((fd = safe_mkstemp(tmpfile)) < 0) {
+            LOGERROR("{%u} error: dm_create_devices: couldn't open temporary file %s: %s\n", (unsigned int)pthread_self(), tmpfile, strerror(errno));
+            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
+            goto free;
+        }
+        if ((tmpfiles[i] = strdup(tmpfile)) == NULL) {
+            ERR(BLOBSTORE_ERROR_NOMEM, NULL);
+            close(fd);
             unlink(tmpfile);
+            goto free;
+        }
+        if ((rc = write(fd, dm_tables[i], strlen(dm_tables[i]))) != strlen(dm_tables[i])) {
+            LOGERROR("{%u} error: dm_create_devices: write returned number of bytes != write buffer: %d/%ld\n", (unsigned int)pthread_self(), rc, strlen(dm_tables[i]));
+            ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to write device mapper table");
+            close(fd);
+            goto free;
+        }
+        close(fd);
+    }
+
+    // invoke `dmsetup create ...` for each of them
+    for (i = 0; i < size; i++) {
+        char *args[5] = { NULL };
 
-            // pass back dmsetup's return code
-            exit(WEXITSTATUS(status));
+        myprintf(EUCA_LOG_INFO, "creating device %s\n", dev_names[i]);
+        if (dm_table_uses(dm_tables[i], dev_names + pending, i - pending)) {
+            dm_udev_cookie_release(cookie);     // the devices this one is built on must be in /dev/mapper
+            pending = i;
         }
-        // parent - waits for child, reacts to status
-        if ((rc = timewait(cpid, &status, BLOBSTORE_DMSETUP_TIMEOUT_SEC)) <= 0) {
-            LOGERROR("{%u} error: dm_create_devices: bad exit from dmsetup child: %d\n", (unsigned int)pthread_self(), rc);
-            PROPAGATE_ERR(BLOBSTORE_ERROR_UNKNOWN);
-            goto cleanup;
+        if (use_cookie && (cookie[0] == '\0') && (dm_udev_cookie_create(cookie, sizeof(cookie)) != 0)) {
+            use_cookie = FALSE;        // each dmsetup will wait for its own udev events
         }
 
-        if (WEXITSTATUS(status) != 0) {
+        nargs = 0;
+        if (cookie[0] != '\0') {
+            args[nargs++] = "--udevcookie";
+            args[nargs++] = cookie;
+        }
+        args[nargs++] = "create";
+        args[nargs++] = dev_names[i];
+        args[nargs++] = tmpfiles[i];
+
+        if (dm_run(args, nargs, NULL) != 0) {
             ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to set up device mapper table with 'dmsetup'");
             myprintf(EUCA_LOG_INFO, "{%u} command: %s %s create %s\n", (unsigned int)pthread_self(), helpers_path[ROOTWRAP], helpers_path[DMSETUP], dev_names[i]);
             myprintf(EUCA_LOG_INFO, "{%u} input: %s", (unsigned int)pthread_self(), dm_tables[i]);
             goto cleanup;
         }
+    }
+    dm_udev_cookie_release(cookie);
 
-        snprintf(dm_path, sizeof(dm_path), DM_PATH "%s", dev_names[i]);
+    for (i = 0; i < size; i++) {
+        snprintf(dm_path, sizeof(dm_path), DM_FORMAT, dev_names[i]);
         if (diskutil_ch(dm_path, get_username(), NULL, BLOBSTORE_FILE_PERM) != EUCA_OK) {
             ERR(BLOBSTORE_ERROR_UNKNOWN, "failed to change permissions on the device mapper file\n");
+            i = size - 1;
             goto cleanup;
         }
     }
+    ret = 0;
+    goto free;
 
-    return (0);
 cleanup:
+    dm_udev_cookie_release(cookie);
     _err_off();
     dm_delete_devices(dev_names, i + 1);
     _err_on();
-    return (-1);
+
+free:
+    for (i = 0; i < size; i++) {
+        if (tmpfiles[i] != NULL) {
+            unlink(tmpfiles[i]);
+            EUCA_FREE(tmpfiles[i]);
+        }
+    }
+    EUCA_FREE(tmpfiles);
+    return (ret);
 }
 
 //!
@@ -5202,6 +6816,332 @@ done:
     return errors;
 }
 
+//!
+//! Provisions one disk of the clone benchmark: a snapshot of its own image blob
+//! followed by a zero-filled section, as an instance disk with ephemeral space would be
+//!
+//! @param[in] ptr the clone_bench_job of this thread
+//!
+//! @return always NULL
+//!
+static void *clone_bench_function(void *ptr)
+{
+    int ret = 0;
+    int errors = 0;
+    char img_id[64];
+    char disk_id[64];
+    clone_bench_job *job = (clone_bench_job *) ptr;
+    blockblob *img = NULL;
+    blockblob *disk = NULL;
+
+    // blobstore handles hold the blobstore lock, so each thread needs its own
+    blobstore *bs = blobstore_open(job->path, 0, 0, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL) {
+        job->errors++;
+        return NULL;
+    }
+    snprintf(img_id, sizeof(img_id), "bench-%02d-image", job->disk);
+    snprintf(disk_id, sizeof(disk_id), "bench-%02d-disk", job->disk);
+
+    _OPENBB(img, img_id, CBB_SIZE, NULL, _CBB, CLONE_BENCH_TIMEOUT_USEC, 0);
+    _OPENBB(disk, disk_id, CBB_SIZE * 2, NULL, _CBB, CLONE_BENCH_TIMEOUT_USEC, 0);
+    if (img != NULL && disk != NULL) {
+        blockmap map[] = {
+            {BLOBSTORE_SNAPSHOT, BLOBSTORE_BLOCKBLOB, {blob:img}
+             , 0, 0, CBB_SIZE}
+            ,
+            {BLOBSTORE_MAP, BLOBSTORE_ZERO, {blob:NULL}
+             , 0, CBB_SIZE, CBB_SIZE}
+            ,
+        };
+        _CLONBB(disk, disk_id, map, 0);
+    }
+    if (disk != NULL)
+        _CLOSBB(disk, disk_id);
+    if (img != NULL)
+        _CLOSBB(img, img_id);
+
+    blobstore_close(bs);
+    job->errors += errors;
+    return NULL;
+}
+
+//!
+//! Measures how long it takes to provision CLONE_BENCH_DISKS cloned disks, each with
+//! a snapshot and a zero-filled section, concurrently from as many threads, then
+//! deletes them
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_clone_benchmark(const char *base, const char *name)
+{
+    int ret = 0;
+    int errors = 0;
+    char id[64];
+    struct timeval start = { 0 };
+    struct timeval end = { 0 };
+    pthread_t threads[CLONE_BENCH_DISKS];
+    clone_bench_job jobs[CLONE_BENCH_DISKS];
+    blockblob *bb = NULL;
+
+    printf("\nTEST: running do_clone_benchmark(%s) with %d disks\n", name, CLONE_BENCH_DISKS);
+
+    blobstore *bs = create_teststore(CBB_SIZE * 3 * CLONE_BENCH_DISKS, base, name, BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_NONE, BLOBSTORE_SNAPSHOT_DM);
+    if (bs == NULL)
+        return 1;
+
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < CLONE_BENCH_DISKS; i++) {
+        bzero(&jobs[i], sizeof(clone_bench_job));
+        euca_strncpy(jobs[i].path, bs->path, sizeof(jobs[i].path));
+        jobs[i].disk = i;
+        pthread_create(&threads[i], NULL, clone_bench_function, &jobs[i]);
+    }
+    for (int i = 0; i < CLONE_BENCH_DISKS; i++) {
+        pthread_join(threads[i], NULL);
+        errors += jobs[i].errors;
+    }
+    gettimeofday(&end, NULL);
+
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+    printf("provisioned %d cloned disks in %.3f seconds (%.1f ms per disk, errors=%d)\n", CLONE_BENCH_DISKS, elapsed, elapsed * 1000.0 / CLONE_BENCH_DISKS, errors);
+
+    // disks first, since they depend on the images
+    for (int i = 0; i < CLONE_BENCH_DISKS; i++) {
+        snprintf(id, sizeof(id), "bench-%02d-disk", i);
+        _OPENBB(bb, id, 0, NULL, 0, 0, 0);
+        if (bb != NULL)
+            _DELEBB(bb, id, 0);
+    }
+    for (int i = 0; i < CLONE_BENCH_DISKS; i++) {
+        snprintf(id, sizeof(id), "bench-%02d-image", i);
+        _OPENBB(bb, id, 0, NULL, 0, 0, 0);
+        if (bb != NULL)
+            _DELEBB(bb, id, 0);
+    }
+
+    blobstore_close(bs);
+    return errors;
+}
+
+//!
+//! Exercises the blob index without device-mapper or loopback devices by
+//! creating blob content files directly and recording them in the index
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_index_test(const char *base, const char *name)
+{
+    int errors = 0;
+    int count = 0;
+    char path[PATH_MAX];
+    blockblob *bbs = NULL;
+    blobstore *bs2 = NULL;
+    const char *ids[] = { B1, B2, B3 };
+
+    printf("\nTEST: running do_index_test(%s)\n", name);
+
+    blobstore *bs = create_teststore(BS_SIZE, base, name, BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL)
+        return 1;
+
+    // an empty store gets an empty index, built from a walk
+    if (index_scan(bs, NULL) != NULL || _blobstore_errno != BLOBSTORE_ERROR_OK) {
+        _UNEXPECTED();
+    }
+
+    for (int i = 0; i < 3; i++) {
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, ids[i], path, sizeof(path));
+        int fd = open(path, O_RDWR | O_CREAT, BLOBSTORE_FILE_PERM);
+        if (fd == -1 || ftruncate(fd, (i + 1) * 512) == -1) {
+            _UNEXPECTED();
+        }
+        if (fd != -1)
+            close(fd);
+        index_record(bs, ids[i], (i == 0) ? getpid() : 0);
+    }
+
+    // a second handle must see the records through the journal
+    bs2 = blobstore_open(bs->path, 0, 0, BLOBSTORE_FORMAT_ANY, BLOBSTORE_REVOCATION_ANY, BLOBSTORE_SNAPSHOT_ANY);
+    assert(bs2);
+    bbs = index_scan(bs2, NULL);
+    count = 0;
+    for (blockblob * bb = bbs; bb; bb = bb->next) {
+        count++;
+        if (!strcmp(bb->id, B1) && !(bb->in_use & BLOCKBLOB_STATUS_OPENED)) {
+            _UNEXPECTED();
+        }
+        if (!strcmp(bb->id, B3) && bb->size_bytes != 3 * 512) {
+            _UNEXPECTED();
+        }
+    }
+    free_bbs(bbs);
+    if (count != 3) {
+        _UNEXPECTED();
+    }
+    // removing the content file and recording it drops the entry
+    set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, B2, path, sizeof(path));
+    unlink(path);
+    index_record(bs, B2, BLOBSTORE_INDEX_KEEP_OPENER);
+
+    // enough records to force a compaction, which the second handle must notice
+    for (int i = 0; i <= BLOBSTORE_INDEX_COMPACT_RECORDS; i++) {
+        index_record(bs, B3, 0);
+    }
+    bbs = index_scan(bs2, NULL);
+    count = 0;
+    for (blockblob * bb = bbs; bb; bb = bb->next) {
+        count++;
+        if (!strcmp(bb->id, B2)) {
+            _UNEXPECTED();
+        }
+    }
+    free_bbs(bbs);
+    if (count != 2 || bs2->index->journal_records > BLOBSTORE_INDEX_COMPACT_RECORDS) {
+        _UNEXPECTED();
+    }
+    // losing the snapshot makes the next scan recover the index from the directory
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_INDEX_FILE);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", bs->path, BLOBSTORE_JOURNAL_FILE);
+    unlink(path);
+    bbs = index_scan(bs2, NULL);
+    count = 0;
+    for (blockblob * bb = bbs; bb; bb = bb->next)
+        count++;
+    free_bbs(bbs);
+    if (count != 2) {
+        _UNEXPECTED();
+    }
+    // an opener is only alive if its start time matches too, and records without one go by the PID
+    {
+        char line[256];
+        const char *fake_id = "opener-test";
+        blobstore_index_entry *e = NULL;
+        struct {
+            pid_t pid;
+            unsigned long long start;
+            boolean old_format;
+            boolean alive;
+        } openers[] = {
+            {getpid(), self_start_time(), FALSE, TRUE},
+            {getpid(), self_start_time() + 1, FALSE, FALSE},    // our PID, reused from a dead process
+            {getpid(), 0, TRUE, TRUE},
+            {0, 0, FALSE, FALSE},
+        };
+
+        for (int i = 0; i < sizeof(openers) / sizeof(openers[0]); i++) {
+            if (openers[i].old_format) {
+                snprintf(line, sizeof(line), "+ 512 1 0 0 0 0 %d %s", (int)openers[i].pid, fake_id);
+            } else {
+                snprintf(line, sizeof(line), "+ 512 1 0 0 0 0 %d/%llu %s", (int)openers[i].pid, openers[i].start, fake_id);
+            }
+            if (index_apply_record(bs->index, line) != 0 || (e = index_find(bs->index, fake_id)) == NULL) {
+                _UNEXPECTED();
+                continue;
+            }
+            if (e->opener_start != openers[i].start || opener_alive(e) != openers[i].alive) {
+                _UNEXPECTED();
+            }
+        }
+        index_remove(bs->index, fake_id);
+    }
+
+    blobstore_close(bs2);
+    blobstore_close(bs);
+    return errors;
+}
+
+//!
+//! Checks the running totals of the blob index and that LRU purging picks the least
+//! recently modified blobs, skipping the open ones, without looking at other blobs
+//!
+//! @param[in] base
+//! @param[in] name
+//!
+//! @return the number of errors
+//!
+static int do_lru_test(const char *base, const char *name)
+{
+    int errors = 0;
+    char path[PATH_MAX];
+    long long blocks_locked = 0;
+    long long blocks_unlocked = 0;
+    const char *ids[] = { "lru-0", "lru-1", "lru-2", "lru-3", "lru-4" };
+    const int age[] = { 200, 400, 100, 500, 300 };  // so LRU order is 3, 1, 4, 0, 2
+    struct timeval tv[2] = { {0} };
+
+    printf("\nTEST: running do_lru_test(%s)\n", name);
+
+    blobstore *bs = create_teststore(BS_SIZE, base, name, BLOBSTORE_FORMAT_FILES, BLOBSTORE_REVOCATION_LRU, BLOBSTORE_SNAPSHOT_ANY);
+    if (bs == NULL)
+        return 1;
+
+    // start with an empty index, so that the records below are journaled
+    if (space_blobstore(bs, NULL, &blocks_locked, &blocks_unlocked, FALSE) == -1 || blocks_locked != 0 || blocks_unlocked != 0) {
+        _UNEXPECTED();
+    }
+
+    for (int i = 0; i < 5; i++) {
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_LOCK, bs, ids[i], path, sizeof(path));
+        int fd = open(path, O_RDWR | O_CREAT, BLOBSTORE_FILE_PERM);
+        if (fd != -1)
+            close(fd);
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, ids[i], path, sizeof(path));
+        fd = open(path, O_RDWR | O_CREAT, BLOBSTORE_FILE_PERM);
+        if (fd == -1 || ftruncate(fd, 512) == -1) {
+            _UNEXPECTED();
+        }
+        if (fd != -1)
+            close(fd);
+        gettimeofday(&tv[0], NULL);
+        tv[0].tv_sec -= age[i];
+        tv[1] = tv[0];
+        if (utimes(path, tv) == -1) {
+            _UNEXPECTED();
+        }
+        index_record(bs, ids[i], (i == 1) ? getpid() : 0);
+    }
+
+    if (space_blobstore(bs, NULL, &blocks_locked, &blocks_unlocked, FALSE) == -1 || blocks_locked != 1 || blocks_unlocked != 4) {
+        _UNEXPECTED();
+    }
+    if (bs->index->num_entries != 5 || bs->index->lru[0]->last_modified > bs->index->lru[1]->last_modified) {
+        _UNEXPECTED();
+    }
+    // the oldest blob is open, so the next two oldest ones must go
+    if (blobstore_lock(bs, BLOBSTORE_LOCK_TIMEOUT_USEC) == -1) {
+        _UNEXPECTED();
+    }
+    if (purge_blockblobs_lru(bs, NULL, 2) != 2) {
+        _UNEXPECTED();
+    }
+    blobstore_unlock(bs);
+    for (int i = 0; i < 5; i++) {
+        set_blockblob_metadata_path(BLOCKBLOB_PATH_BLOCKS, bs, ids[i], path, sizeof(path));
+        if ((access(path, F_OK) == 0) != (i != 3 && i != 4)) {
+            _UNEXPECTED();
+        }
+    }
+    if (space_blobstore(bs, NULL, &blocks_locked, &blocks_unlocked, FALSE) == -1 || blocks_locked != 1 || blocks_unlocked != 2) {
+        _UNEXPECTED();
+    }
+    for (unsigned int i = 0; i < bs->index->num_entries; i++) {
+        if (bs->index->lru[i]->lru_pos != i || (i > 0 && bs->index->lru[(i - 1) / 2]->last_modified > bs->index->lru[i]->last_modified)) {
+            _UNEXPECTED();
+        }
+    }
+
+    blobstore_close(bs);
+    return errors;
+}
+
 //!
 //!
 //!
@@ -5797,6 +7737,14 @@ int main(int argc, char **argv)
     if (errors)
         goto done;                     // no point in doing blobstore test if above isn't working
 
+    errors += do_index_test(cwd, "index");
+    if (errors)
+        goto done;                     // no point in doing blobstore test if above isn't working
+
+    errors += do_lru_test(cwd, "lru");
+    if (errors)
+        goto done;                     // no point in doing blobstore test if above isn't working
+
     errors += do_blobstore_test(cwd, "directory-norevoc", BLOBSTORE_FORMAT_DIRECTORY, BLOBSTORE_REVOCATION_NONE);
     if (errors)
         goto done;                     // no point in continuing blobstore test if above isn't working
@@ -5825,6 +7773,10 @@ int main(int argc, char **argv)
     if (errors)
         goto done;                     // no point in continuing
 
+    errors += do_clone_benchmark(cwd, "clonebench");
+    if (errors)
+        goto done;
+
 done:
     printf("done testing blobstore.c (errors=%d)\n", errors);
     blobstore_cleanup();
@@ -202,8 +202,11 @@ typedef struct _blobstore {
     blobstore_snapshot_t snapshot_policy;
     blobstore_format_t format;
     int fd;                            //!< file descriptor of the blobstore metadata file
+    struct _blobstore_index *index;    //!< in-memory copy of the blob index (private to blobstore.c)
 } blobstore;
 
+typedef struct _blobstore_evictor blobstore_evictor; //!< background LRU evictor (private to blobstore.c)
+
 typedef struct _blockblob {
     blobstore *store;                  //!< pointer to the store for this blob
     char id[BLOBSTORE_MAX_PATH];       //!< ID of the blob (used as part of file/directory name)
@@ -308,6 +311,8 @@ int blobstore_get_error(void);
 ssize_t get_line_desc(char **ppLine, size_t * n, int fd);
 int blobstore_delete_nonblobs(blobstore * bs, const char *dir_path);
 int blobstore_stat(blobstore * bs, blobstore_meta * meta);
+blobstore_evictor *blobstore_start_evictor(blobstore * bs, unsigned long long low_watermark_blocks, unsigned int interval_sec);
+void blobstore_stop_evictor(blobstore_evictor * ev);
 int blobstore_fsck(blobstore * bs, int (*examiner) (const blockblob * bb));
 int blobstore_search(blobstore * bs, const char *regex, blockblob_meta ** results);
 int blobstore_delete_regex(blobstore * bs, const char *regex);
@@ -86,11 +86,16 @@
 #include <sys/stat.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <eucalyptus.h>
 #include <misc.h>                      // logprintfl
 #include <ipc.h>                       // sem
 #include <euca_string.h>
+#include <euca_rootwrap.h>
 
 #include "diskutil.h"
 
@@ -101,8 +106,11 @@
 \*----------------------------------------------------------------------------*/
 
 #define LOOP_RETRIES                             9
-#define OUTPUT_ALLOC_CHUNK 1024
+#define LOOP_RETRY_USEC                          100000 //!< initial back-off between attempts to attach a loop device
+#define LOOP_LOCKS                               64 //!< number of per-device locks, loop devices are hashed onto them by minor number
 #define MAX_OUTPUT_BYTES 1024*1024
+#define ROOTWRAP_TIMEOUT_MS                      60000  //!< how long the privileged helper may go without answering any outstanding request
+#define ROOTWRAP_MAX_BATCH                       4  //!< maximum number of requests pipelined to the privileged helper at once
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -144,6 +152,19 @@ enum {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A request to the privileged helper and its outcome
+typedef struct rootwrap_call_t {
+    euca_rootwrap_op op;               //!< the operation
+    const char *args[EUCA_ROOTWRAP_MAX_ARGS];   //!< its arguments
+    int nargs;                         //!< the number of arguments
+    int status;                        //!< set to 0 or the errno value of the failure
+    char out[EUCA_ROOTWRAP_MAX_REPLY]; //!< set to the output of the operation
+    uint32_t id;                       //!< request id, set by rootwrap_run()
+    boolean done;                      //!< the call got its reply or was failed (under rootwrap_mutex)
+    boolean lost;                      //!< the helper went away before replying, the outcome is unknown
+    struct rootwrap_call_t *next;      //!< next call waiting for a reply
+} rootwrap_call;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -189,12 +210,32 @@ static char *helpers_path[LASTHELPER] = { NULL };
 
 static char stage_files_dir[EUCA_MAX_PATH] = "";
 static int initialized = 0;
-static sem *loop_sem = NULL;           //!< semaphore held while attaching/detaching loopback devices
+static sem *loop_sem = NULL;           //!< semaphore held while attaching/detaching loopback devices with an old 'losetup'
+static boolean loop_find_show = FALSE; //!< 'losetup' can find a free device and attach to it in one step
+static boolean loop_can_direct_io = FALSE;  //!< 'losetup' supports --direct-io
+static boolean loop_direct_io = FALSE; //!< attach loop devices with direct I/O, bypassing the page cache for the backing file
+static pthread_mutex_t loop_locks[LOOP_LOCKS] = {[0 ... LOOP_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER };  //!< serialize operations on the same loop device
 static unsigned char grub_version = 0;
 static char euca_home_path[EUCA_MAX_PATH] = "";
 static char cloud_cert_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/cloud-cert.pem";
 static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.pem";
 
+//! @{
+//! @name Long-lived privileged helper ('euca_rootwrap --server') doing chown/chmod/loop/file work without a fork+exec per operation
+static pthread_mutex_t rootwrap_mutex = PTHREAD_MUTEX_INITIALIZER;  //!< guards the helper state below, never held while waiting on the helper
+static pthread_cond_t rootwrap_cond = PTHREAD_COND_INITIALIZER;     //!< signaled when calls complete, the reader role frees up or the helper is reaped
+static pthread_mutex_t rootwrap_send_mutex = PTHREAD_MUTEX_INITIALIZER; //!< keeps the requests of concurrent batches from interleaving on the socket
+static int rootwrap_fd = -1;           //!< our end of the helper socket
+static pid_t rootwrap_pid = -1;        //!< the helper process
+static pid_t rootwrap_owner = -1;      //!< the process that started the helper (forked children start their own)
+static boolean rootwrap_unavailable = FALSE;    //!< the helper could not be started, keep using the exec path
+static boolean rootwrap_broken = FALSE; //!< the helper failed, its socket is shut down until the last user lets go of it
+static boolean rootwrap_reading = FALSE;    //!< a thread is reading replies on behalf of every waiting one
+static int rootwrap_users = 0;         //!< threads using rootwrap_fd without holding rootwrap_mutex
+static uint32_t rootwrap_next_id = 0;  //!< id of the last request sent
+static rootwrap_call *rootwrap_pending = NULL;  //!< calls sent and waiting for their reply
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -202,9 +243,19 @@ static char service_key_path[EUCA_MAX_PATH] = "/var/lib/eucalyptus/keys/node-pk.
 \*----------------------------------------------------------------------------*/
 
 static int try_stage_dir(const char *dir);
+static void loop_detect_features(void);
+static pthread_mutex_t *loop_lock(const char *lodev);
 static char *pruntf(boolean log_error, char *format, ...)
 _attribute_wur_ _attribute_format_(2, 3);
 static char *execlp_output(boolean log_error, ...);
+static int rootwrap_start(void);
+static void rootwrap_stop(void);
+static void rootwrap_break(void);
+static void rootwrap_put(void);
+static int rootwrap_read(void *buf, size_t len);
+static int rootwrap_send(struct iovec *iov, int niov, size_t total);
+static int rootwrap_read_reply(euca_rootwrap_reply * reply, char *out);
+static int rootwrap_run(rootwrap_call * calls, int ncalls);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -341,8 +392,11 @@ int diskutil_init(boolean require_grub)
             }
         }
 
-        if ((initialized < 1) && (loop_sem == NULL))
+        if ((initialized < 1) && (loop_sem == NULL)) {
             loop_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+            sem_set_stats_name(loop_sem, "loop_sem");
+            loop_detect_features();
+        }
         initialized = 1 + require_grub;
     }
 
@@ -357,6 +411,11 @@ int diskutil_init(boolean require_grub)
 int diskutil_cleanup(void)
 {
     int i = 0;
+
+    pthread_mutex_lock(&rootwrap_mutex);
+    rootwrap_stop();
+    pthread_mutex_unlock(&rootwrap_mutex);
+
     for (i = 0; i < LASTHELPER; i++) {
         EUCA_FREE(helpers_path[i]);
     }
@@ -660,6 +719,63 @@ int diskutil_get_parts(const char *path, struct partition_table_entry entries[],
     return count;
 }
 
+//!
+//! Finds out what the installed 'losetup' can do. Versions that support '--show'
+//! together with '--find' pick a free device (with LOOP_CTL_GET_FREE, where
+//! available) and attach to it atomically, which lets us skip the global loop
+//! semaphore and the find-then-attach retries when attaching.
+//!
+static void loop_detect_features(void)
+{
+    char *output = NULL;
+
+    if (helpers_path[LOSETUP] == NULL)
+        return;
+
+    // the usage message does not require privileges, so rootwrap is not needed
+    if ((output = execlp_output(FALSE, helpers_path[LOSETUP], "--help", NULL)) == NULL)
+        return;
+    loop_find_show = (strstr(output, "--show") != NULL);
+    loop_can_direct_io = (strstr(output, "--direct-io") != NULL);
+    EUCA_FREE(output);
+
+    LOGDEBUG("losetup %s atomic attach and %s direct I/O\n", (loop_find_show ? "supports" : "does not support"), (loop_can_direct_io ? "supports" : "does not support"));
+}
+
+//!
+//! Returns the lock that serializes operations on a particular loop device
+//!
+//! @param[in] lodev the loop device path, e.g., /dev/loop7
+//!
+//! @return a pointer to the lock
+//!
+static pthread_mutex_t *loop_lock(const char *lodev)
+{
+    unsigned int minor = 0;
+    const char *p = lodev + strlen(lodev);
+
+    // use the trailing digits, if any, so that neighboring devices get different locks
+    while (p > lodev && *(p - 1) >= '0' && *(p - 1) <= '9')
+        p--;
+    minor = (unsigned int)strtoul(p, NULL, 10);
+    return (&loop_locks[minor % LOOP_LOCKS]);
+}
+
+//!
+//! Turns direct I/O on loop devices attached from now on on or off. With direct I/O
+//! the backing files of blobs are not cached twice (once through the loop device
+//! and once through the file). Has no effect if 'losetup' does not support it.
+//!
+//! @param[in] enable TRUE to use direct I/O
+//!
+void diskutil_set_loop_direct_io(boolean enable)
+{
+    loop_direct_io = enable;
+    if (enable && !loop_can_direct_io) {
+        LOGWARN("losetup does not support direct I/O, loop devices will use the page cache\n");
+    }
+}
+
 //!
 //! Expose the loop semaphore so others (e.g., instance startup code)
 //! can avoid races with 'losetup' that we've seen on Xen
@@ -754,11 +870,82 @@ int diskutil_loop(const char *path, const long long offset, char *lodev, int lod
     int ret = EUCA_OK;
     char *ptr = NULL;
     char *output = NULL;
+    char str_offset[64] = "";
     boolean done = FALSE;
     boolean found = FALSE;
+    int rc = EUCA_OK;
     boolean do_log = FALSE;
+    rootwrap_call call = { 0 };
 
     if (path && lodev) {
+        snprintf(str_offset, sizeof(str_offset), "%lld", offset);
+
+        // the helper finds a free device and attaches to it in one step, like 'losetup --find --show'
+        call.op = EUCA_ROOTWRAP_LOOP_ATTACH;
+        call.args[0] = path;
+        call.args[1] = str_offset;
+        call.args[2] = ((loop_direct_io && loop_can_direct_io) ? "1" : "0");
+        call.nargs = 3;
+        for (i = 0; ((path[0] == '/') && (i < LOOP_RETRIES)); i++) {
+            if ((rc = rootwrap_run(&call, 1)) == EUCA_UNSUPPORTED_ERROR)
+                break;
+
+            if (rc != EUCA_OK) {
+                // the helper may have attached a device before going away, do not attach another one
+                LOGERROR("cannot attach file %s to a loop device: %s\n", path, call.out);
+                return (EUCA_ERROR);
+            }
+
+            if (call.status == 0) {
+                euca_strncpy(lodev, call.out, lodev_size);
+                LOGDEBUG("attached file %s\n", path);
+                LOGDEBUG("         to %s at offset %lld\n", lodev, offset);
+                return (EUCA_OK);
+            }
+
+            if ((i + 1) == LOOP_RETRIES) {
+                LOGERROR("cannot find free loop device or attach to one: %s\n", call.out);
+                return (EUCA_ERROR);
+            }
+            LOGDEBUG("cannot attach file %s to a loop device (will retry): %s\n", path, call.out);
+            usleep(LOOP_RETRY_USEC * (i + 1));
+        }
+
+        if (loop_find_show) {
+            // 'losetup' finds a free device and attaches to it in one step, so concurrent
+            // attaches cannot pick the same device and need not be serialized
+            for (i = 0; i < LOOP_RETRIES; i++) {
+                do_log = ((i + 1) == LOOP_RETRIES); // log error on last try only
+                if (loop_direct_io && loop_can_direct_io) {
+                    output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "--find", "--show", "--direct-io=on", "-o", str_offset, path, NULL);
+                } else {
+                    output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "--find", "--show", "-o", str_offset, path, NULL);
+                }
+
+                if (output != NULL) {
+                    if (strncmp(output, "/dev/loop", 9) == 0) {
+                        euca_strncpy(lodev, output, lodev_size);
+                        if ((ptr = strchr(lodev, '\n')) != NULL)
+                            *ptr = '\0';
+                        done = TRUE;
+                    }
+                    EUCA_FREE(output);
+                    if (done)
+                        break;
+                }
+
+                LOGDEBUG("cannot attach file %s to a loop device (will retry)\n", path);
+                usleep(LOOP_RETRY_USEC * (i + 1));
+            }
+
+            if (!done) {
+                LOGERROR("cannot find free loop device or attach to one\n");
+                return (EUCA_ERROR);
+            }
+            LOGDEBUG("attached file %s\n", path);
+            LOGDEBUG("         to %s at offset %lld\n", lodev, offset);
+            return (EUCA_OK);
+        }
         // we retry because we cannot atomically obtain a free loopback device on all distros (some
         // versions of 'losetup' allow a file argument with '-f' options, but some do not)
         for (i = 0, done = FALSE, found = FALSE; i < LOOP_RETRIES; i++) {
@@ -789,8 +976,6 @@ int diskutil_loop(const char *path, const long long offset, char *lodev, int lod
                 LOGDEBUG("            to %s at offset %lld\n", lodev, offset);
                 sem_p(loop_sem);
                 {
-                    char str_offset[64];
-                    snprintf(str_offset, sizeof(str_offset), "%lld", offset);
                     output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "-o", str_offset, lodev, path, NULL);
                 }
                 sem_v(loop_sem);
@@ -839,20 +1024,47 @@ int diskutil_unloop(const char *lodev)
     int ret = EUCA_OK;
     int retried = 0;
     char *output = NULL;
+    int rc = EUCA_OK;
     boolean do_log = FALSE;
+    boolean use_helper = TRUE;
+    rootwrap_call call = { 0 };
 
     if (lodev) {
         LOGDEBUG("detaching from loop device %s\n", lodev);
 
+        call.op = EUCA_ROOTWRAP_LOOP_DETACH;
+        call.args[0] = lodev;
+        call.nargs = 1;
+
         // we retry because we have seen spurious errors from 'losetup -d' on Xen:
         //     ioctl: LOOP_CLR_FD: Device or resource bus
         for (i = 0; i < LOOP_RETRIES; i++) {
             do_log = ((i + 1) == LOOP_RETRIES); // log error on last try only
-            sem_p(loop_sem);
-            {
-                output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "-d", lodev, NULL);
+            if (loop_find_show) {
+                // attaches are atomic, so only operations on this device need to be kept apart
+                pthread_mutex_t *lock = loop_lock(lodev);
+                pthread_mutex_lock(lock);
+                {
+                    if (use_helper && ((rc = rootwrap_run(&call, 1)) != EUCA_UNSUPPORTED_ERROR)) {
+                        // a lost request is retried through the restarted helper like a failed one
+                        if ((rc == EUCA_OK) && (call.status == 0)) {
+                            output = strdup("");
+                        } else if (do_log) {
+                            LOGERROR("%s\n", call.out);
+                        }
+                    } else {
+                        use_helper = FALSE;
+                        output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "-d", lodev, NULL);
+                    }
+                }
+                pthread_mutex_unlock(lock);
+            } else {
+                sem_p(loop_sem);
+                {
+                    output = execlp_output(do_log, helpers_path[ROOTWRAP], helpers_path[LOSETUP], "-d", lodev, NULL);
+                }
+                sem_v(loop_sem);
             }
-            sem_v(loop_sem);
 
             if (!output) {
                 ret = EUCA_ERROR;
@@ -1158,8 +1370,23 @@ int diskutil_write2file(const char *file, const char *str)
     int ret = EUCA_OK;
     int size = 0;
     char tmpfile[] = "/tmp/euca-temp-XXXXXX";
+    rootwrap_call call = { 0 };
 
     if (file && str) {
+        if (file[0] == '/') {
+            call.op = EUCA_ROOTWRAP_WRITE_FILE;
+            call.args[0] = file;
+            call.args[1] = str;
+            call.nargs = 2;
+            if (rootwrap_run(&call, 1) != EUCA_UNSUPPORTED_ERROR) {
+                if (call.status != 0) {
+                    LOGERROR("failed to write file: %s\n", call.out);
+                    return ((call.status == ENOSPC || call.status == EIO) ? EUCA_ACCESS_ERROR : EUCA_PERMISSION_ERROR);
+                }
+                return (EUCA_OK);
+            }
+        }
+
         if ((fd = safe_mkstemp(tmpfile)) < 0) {
             LOGERROR("failed to create temporary directory\n");
             unlink(tmpfile);
@@ -1502,11 +1729,44 @@ int diskutil_grub2_mbr(const char *path, const int part, const char *mnt_pt)
 //!
 int diskutil_ch(const char *path, const char *user, const char *group, const int perms)
 {
+    int i = 0;
+    int ncalls = 0;
     char *output = NULL;
+    char perms_str[32] = "";
+    rootwrap_call calls[2] = { {0} };
 
     LOGDEBUG("ch(own|mod) '%s' %s.%s %o\n", SP(path), ((user != NULL) ? user : "*"), ((group != NULL) ? group : "*"), perms);
 
     if (path) {
+        // with the helper running, ownership and mode change in one round trip ('user:group' specs are left to chown)
+        if ((path[0] == '/') && ((user == NULL) || (strchr(user, ':') == NULL))) {
+            if (user || group) {
+                calls[ncalls].op = EUCA_ROOTWRAP_CHOWN;
+                calls[ncalls].args[0] = path;
+                calls[ncalls].args[1] = ((user != NULL) ? user : "");
+                calls[ncalls].args[2] = ((group != NULL) ? group : "");
+                calls[ncalls++].nargs = 3;
+            }
+
+            if (perms > 0) {
+                snprintf(perms_str, sizeof(perms_str), "0%o", perms);
+                calls[ncalls].op = EUCA_ROOTWRAP_CHMOD;
+                calls[ncalls].args[0] = path;
+                calls[ncalls].args[1] = perms_str;
+                calls[ncalls++].nargs = 2;
+            }
+
+            if ((ncalls == 0) || (rootwrap_run(calls, ncalls) != EUCA_UNSUPPORTED_ERROR)) {
+                for (i = 0; i < ncalls; i++) {
+                    if (calls[i].status != 0) {
+                        LOGERROR("%s\n", calls[i].out);
+                        return (EUCA_ERROR);
+                    }
+                }
+                return (EUCA_OK);
+            }
+        }
+
         if (user) {
             output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[CHOWN], user, path, NULL);
             if (!output) {
@@ -1526,7 +1786,6 @@ int diskutil_ch(const char *path, const char *user, const char *group, const int
         }
 
         if (perms > 0) {
-            char perms_str[32];
             snprintf(perms_str, sizeof(perms_str), "0%o", perms);
             output = execlp_output(TRUE, helpers_path[ROOTWRAP], helpers_path[CHMOD], perms_str, path, NULL);
             if (!output) {
@@ -1722,68 +1981,22 @@ static char *execlp_output(boolean log_error, ...)
     va_end(ap);
 
     char *output = NULL;
-
-    // set up a pipe for getting stdout and stderror from child process
-    int filedes[2];
-    if (pipe(filedes)) {
-        LOGERROR("failed to create a pipe\n");
-        goto free;
-    }
-    LOGTRACE("executing: %s\n", cmd);
-
-    pid_t cpid = fork();
+    int status = -1;
     int rc = -1;
-    if (cpid == -1) {
-        LOGERROR("failed to fork\n");
-        close(filedes[0]);
-        close(filedes[1]);
-        goto free;
-    } else if (cpid == 0) {            // child
-        close(filedes[0]);
-        if (dup2(filedes[1], STDOUT_FILENO) == -1) {
-            LOGERROR("failed to dup2\n");
-            exit(-1);
-        }
-        if (dup2(filedes[1], STDERR_FILENO) == -1) {
-            LOGERROR("failed to dup2\n");
-            exit(-1);
-        }
-        exit(execvp(argv[0], argv));
-    }
-    // parent reads stdout and stdin from child into a string
-    close(filedes[1]);
 
-    int outsize = OUTPUT_ALLOC_CHUNK;  // allocate in chunks of this size
-    int nextchar = 0;                  // offset of the next usable char
-    int bytesread;
-    output = EUCA_ALLOC(outsize, sizeof(char));
-    if (output) {
-        output[0] = '\0';              // return an empty string if there is no output
-    }
+    LOGTRACE("executing: %s\n", cmd);
 
-    while ((output != NULL) && (bytesread = read(filedes[0], output + nextchar, outsize - nextchar - 1)) > 0) {
-        nextchar += bytesread;
-        output[nextchar] = '\0';
-        if (nextchar + 1 == outsize) {
-            outsize += OUTPUT_ALLOC_CHUNK;
-            if (outsize > MAX_OUTPUT_BYTES) {
-                LOGERROR("internal error: output from command is too long\n");
-                EUCA_FREE(output);
-                break;
-            }
-            output = EUCA_REALLOC(output, outsize, sizeof(char));
+    // stdout and stderr from the child process both end up in the output string
+    switch (euca_spawn_capture(argv, EUCA_SPAWN_MERGE_STDERR, 0, MAX_OUTPUT_BYTES, &output, NULL, &status)) {
+    case EUCA_OK:
+    case EUCA_ERROR:
+        if ((output != NULL) && (strlen(output) >= (MAX_OUTPUT_BYTES - 1))) {
+            LOGERROR("internal error: output from command is too long\n");
+            EUCA_FREE(output);
         }
-    }
-    if (output == NULL) {
-        LOGERROR("failed to allocate mem for output\n");
-    }
-    close(filedes[0]);
 
-    {                                  // wait for the child to reap status
-        int status;
-        rc = waitpid(cpid, &status, 0);
-        if (rc == -1) {
-            LOGERROR("failed to wait for child process\n");
+        if (status == -1) {
+            LOGERROR("failed to execute or wait for child process\n");
         } else if (WIFEXITED(status)) {
             rc = WEXITSTATUS(status);
             if (rc) {
@@ -1793,6 +2006,13 @@ static char *execlp_output(boolean log_error, ...)
             LOGERROR("child process did not terminate normally\n");
             rc = -1;
         }
+        break;
+    case EUCA_MEMORY_ERROR:
+        LOGERROR("failed to allocate mem for output\n");
+        goto free;
+    default:
+        LOGERROR("failed to fork\n");
+        goto free;
     }
 
     if (rc) {
@@ -1853,6 +2073,346 @@ long long round_down_sec(long long bytes)
     return ((bytes % SECTOR_SIZE) ? (((bytes / SECTOR_SIZE)) * SECTOR_SIZE) : bytes);
 }
 
+//!
+//! Starts the privileged helper. Must be called with the rootwrap_mutex held.
+//!
+//! @return EUCA_OK on success or EUCA_UNSUPPORTED_ERROR if the helper cannot be used
+//!
+static int rootwrap_start(void)
+{
+    char *argv[] = { helpers_path[ROOTWRAP], EUCA_ROOTWRAP_SERVER_ARG, NULL };
+    euca_rootwrap_reply hello = { 0 };
+    char out[EUCA_ROOTWRAP_MAX_REPLY] = "";
+
+    if (rootwrap_unavailable || (helpers_path[ROOTWRAP] == NULL))
+        return (EUCA_UNSUPPORTED_ERROR);
+
+    if (euca_spawn(&rootwrap_pid, &rootwrap_fd, NULL, NULL, EUCA_SPAWN_STDIO_SOCKET, argv) != EUCA_OK) {
+        rootwrap_unavailable = TRUE;
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+    rootwrap_owner = getpid();
+
+    // an older euca_rootwrap would try to execute '--server' and exit without greeting us
+    if ((rootwrap_read(&hello, sizeof(hello)) != EUCA_OK) || (hello.len == 0) || (hello.len > sizeof(out)) ||
+        (rootwrap_read(out, hello.len) != EUCA_OK) || (hello.status != 0)) {
+        LOGWARN("privileged helper %s is not available, falling back to one process per operation\n", helpers_path[ROOTWRAP]);
+        rootwrap_stop();
+        rootwrap_unavailable = TRUE;
+        return (EUCA_UNSUPPORTED_ERROR);
+    }
+
+    LOGINFO("started privileged helper %s (pid=%d)\n", helpers_path[ROOTWRAP], rootwrap_pid);
+    return (EUCA_OK);
+}
+
+//!
+//! Stops the privileged helper by closing its socket. Must be called with the rootwrap_mutex held
+//! and no thread using the socket.
+//!
+static void rootwrap_stop(void)
+{
+    int status = 0;
+
+    if (rootwrap_fd >= 0) {
+        close(rootwrap_fd);
+        rootwrap_fd = -1;
+    }
+
+    // a forked child does not own its parent's helper
+    if ((rootwrap_pid > 0) && (rootwrap_owner == getpid())) {
+        if (timewait(rootwrap_pid, &status, 1) == 0)
+            killwait(rootwrap_pid);
+    }
+    rootwrap_pid = -1;
+}
+
+//!
+//! Gives up on a helper that timed out or broke the protocol. Every call waiting for a reply is
+//! failed as lost, since the helper may or may not have performed it, and the socket is shut down
+//! so threads still sending or reading on it return. The last of them stops the helper, see
+//! rootwrap_put(). Must be called with the rootwrap_mutex held.
+//!
+static void rootwrap_break(void)
+{
+    rootwrap_call *call = NULL;
+
+    if (!rootwrap_broken && (rootwrap_fd >= 0)) {
+        LOGWARN("restarting privileged helper (pid=%d)\n", rootwrap_pid);
+        rootwrap_broken = TRUE;
+        shutdown(rootwrap_fd, SHUT_RDWR);
+    }
+
+    for (call = rootwrap_pending; call != NULL; call = call->next) {
+        call->done = TRUE;
+        call->lost = TRUE;
+    }
+    rootwrap_pending = NULL;
+
+    if (rootwrap_broken && (rootwrap_users == 0)) {
+        rootwrap_stop();
+        rootwrap_broken = FALSE;
+    }
+    pthread_cond_broadcast(&rootwrap_cond);
+}
+
+//!
+//! Lets go of the helper socket after using it without the rootwrap_mutex, stopping a broken
+//! helper once nobody uses its socket anymore. Must be called with the rootwrap_mutex held.
+//!
+static void rootwrap_put(void)
+{
+    if ((--rootwrap_users == 0) && rootwrap_broken) {
+        rootwrap_stop();
+        rootwrap_broken = FALSE;
+        pthread_cond_broadcast(&rootwrap_cond);
+    }
+}
+
+//!
+//! Reads exactly len bytes from the privileged helper
+//!
+//! @param[out] buf where to store the bytes
+//! @param[in]  len the number of bytes to read
+//!
+//! @return EUCA_OK on success, EUCA_TIMEOUT_ERROR or EUCA_IO_ERROR
+//!
+static int rootwrap_read(void *buf, size_t len)
+{
+    int rc = 0;
+    ssize_t n = 0;
+    size_t got = 0;
+    struct pollfd pfd = { 0 };
+
+    pfd.fd = rootwrap_fd;
+    pfd.events = POLLIN;
+    while (got < len) {
+        if ((rc = poll(&pfd, 1, ROOTWRAP_TIMEOUT_MS)) == 0)
+            return (EUCA_TIMEOUT_ERROR);
+        if ((rc < 0) && (errno != EINTR))
+            return (EUCA_IO_ERROR);
+        if (rc < 0)
+            continue;
+
+        if ((n = read(rootwrap_fd, ((char *)buf) + got, (len - got))) <= 0) {
+            if ((n < 0) && (errno == EINTR))
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        got += n;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writes a batch of requests to the privileged helper. Must be called with the rootwrap_send_mutex held.
+//!
+//! @param[in] iov the headers and arguments of the requests, advanced past what was sent
+//! @param[in] niov the number of entries in iov
+//! @param[in] total the number of bytes to send
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR
+//!
+static int rootwrap_send(struct iovec *iov, int niov, size_t total)
+{
+    ssize_t n = 0;
+    size_t sent = 0;
+    struct msghdr msg = { 0 };
+
+    msg.msg_iov = iov;
+    msg.msg_iovlen = niov;
+    while (sent < total) {
+        if ((n = sendmsg(rootwrap_fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to send to the privileged helper: %s\n", strerror(errno));
+            return (EUCA_IO_ERROR);
+        }
+
+        // skip what went out and send the rest
+        for (sent += n; ((msg.msg_iovlen > 0) && (((size_t) n) >= msg.msg_iov->iov_len)); msg.msg_iov++, msg.msg_iovlen--)
+            n -= msg.msg_iov->iov_len;
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = ((char *)msg.msg_iov->iov_base) + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Reads the next reply of the privileged helper, whichever request it answers
+//!
+//! @param[out] reply the reply header
+//! @param[out] out the output of the operation, EUCA_ROOTWRAP_MAX_REPLY bytes
+//!
+//! @return EUCA_OK on success, EUCA_TIMEOUT_ERROR or EUCA_IO_ERROR
+//!
+static int rootwrap_read_reply(euca_rootwrap_reply * reply, char *out)
+{
+    int rc = EUCA_OK;
+
+    if ((rc = rootwrap_read(reply, sizeof(euca_rootwrap_reply))) != EUCA_OK)
+        return (rc);
+    if ((reply->len == 0) || (reply->len > EUCA_ROOTWRAP_MAX_REPLY))
+        return (EUCA_IO_ERROR);
+    if ((rc = rootwrap_read(out, reply->len)) != EUCA_OK)
+        return (rc);
+    out[reply->len - 1] = '\0';
+    return (EUCA_OK);
+}
+
+//!
+//! Sends a batch of requests to the privileged helper in one write and waits for their replies,
+//! starting the helper first if needed. Other threads may have requests outstanding at the same
+//! time: whichever thread is waiting first reads the replies and hands each one to the call with
+//! the same id, so a slow request only delays the threads waiting on it.
+//!
+//! @param[in,out] calls the requests; their status and output fields are set on return
+//! @param[in]     ncalls the number of requests
+//!
+//! @return EUCA_OK if every request got a reply (check each status), EUCA_UNSUPPORTED_ERROR if
+//!         the helper cannot be used and nothing was sent, in which case the caller may fall
+//!         back to running the commands, or EUCA_IO_ERROR if the helper went away or stopped
+//!         answering after the requests were sent. The helper may have performed them then,
+//!         so the caller must not run them again another way.
+//!
+static int rootwrap_run(rootwrap_call * calls, int ncalls)
+{
+    int i = 0;
+    int j = 0;
+    int rc = EUCA_OK;
+    int niov = 0;
+    int ret = EUCA_OK;
+    size_t len = 0;
+    size_t total = 0;
+    boolean done = FALSE;
+    rootwrap_call *call = NULL;
+    rootwrap_call **prev = NULL;
+    struct iovec iov[ROOTWRAP_MAX_BATCH * (EUCA_ROOTWRAP_MAX_ARGS + 1)] = { {0} };
+    euca_rootwrap_request requests[ROOTWRAP_MAX_BATCH] = { {0} };
+    euca_rootwrap_reply reply = { 0 };
+    char out[EUCA_ROOTWRAP_MAX_REPLY] = "";
+
+    assert(ncalls <= ROOTWRAP_MAX_BATCH);
+
+    // lay out every request as a header followed by its '\0' terminated arguments
+    for (i = 0; i < ncalls; i++) {
+        requests[i].op = calls[i].op;
+        iov[niov].iov_base = &requests[i];
+        iov[niov++].iov_len = sizeof(euca_rootwrap_request);
+        for (j = 0; j < calls[i].nargs; j++) {
+            len = strlen(calls[i].args[j]) + 1;
+            requests[i].len += len;
+            iov[niov].iov_base = ((void *)calls[i].args[j]);
+            iov[niov++].iov_len = len;
+        }
+        if (requests[i].len > EUCA_ROOTWRAP_MAX_REQUEST)
+            return (EUCA_UNSUPPORTED_ERROR);
+        total += sizeof(euca_rootwrap_request) + requests[i].len;
+    }
+
+    pthread_mutex_lock(&rootwrap_mutex);
+    {
+        if ((rootwrap_fd >= 0) && (rootwrap_owner != getpid())) {
+            // inherited across a fork(), leave the parent's helper and its waiters alone
+            close(rootwrap_fd);
+            rootwrap_fd = -1;
+            rootwrap_pid = -1;
+            rootwrap_broken = FALSE;
+            rootwrap_reading = FALSE;
+            rootwrap_users = 0;
+            rootwrap_pending = NULL;
+        }
+        // a failed helper is restarted once the threads still on its socket let go of it
+        while (rootwrap_broken)
+            pthread_cond_wait(&rootwrap_cond, &rootwrap_mutex);
+
+        if ((rootwrap_fd < 0) && (rootwrap_start() != EUCA_OK)) {
+            pthread_mutex_unlock(&rootwrap_mutex);
+            return (EUCA_UNSUPPORTED_ERROR);
+        }
+
+        // from here on, the calls are only completed by their reply or by rootwrap_break()
+        for (i = 0; i < ncalls; i++) {
+            if (++rootwrap_next_id == 0)
+                rootwrap_next_id = 1;  // 0 is the greeting
+            calls[i].id = requests[i].id = rootwrap_next_id;
+            calls[i].done = FALSE;
+            calls[i].lost = FALSE;
+            calls[i].next = rootwrap_pending;
+            rootwrap_pending = &calls[i];
+        }
+        rootwrap_users++;
+    }
+    pthread_mutex_unlock(&rootwrap_mutex);
+
+    pthread_mutex_lock(&rootwrap_send_mutex);
+    {
+        rc = rootwrap_send(iov, niov, total);
+    }
+    pthread_mutex_unlock(&rootwrap_send_mutex);
+
+    pthread_mutex_lock(&rootwrap_mutex);
+    {
+        if (rc != EUCA_OK)
+            rootwrap_break();
+        rootwrap_put();
+
+        for (;;) {
+            for (i = 0, done = TRUE; ((i < ncalls) && done); i++)
+                done = calls[i].done;
+            if (done)
+                break;
+
+            if (rootwrap_reading) {
+                pthread_cond_wait(&rootwrap_cond, &rootwrap_mutex);
+                continue;
+            }
+
+            // read one reply for whoever it belongs to, without holding the lock
+            rootwrap_reading = TRUE;
+            rootwrap_users++;
+            pthread_mutex_unlock(&rootwrap_mutex);
+            {
+                rc = rootwrap_read_reply(&reply, out);
+            }
+            pthread_mutex_lock(&rootwrap_mutex);
+            rootwrap_reading = FALSE;
+
+            if (rc == EUCA_OK) {
+                for (prev = &rootwrap_pending; ((*prev != NULL) && ((*prev)->id != reply.id)); prev = &((*prev)->next)) ;
+                if ((call = *prev) != NULL) {
+                    *prev = call->next;
+                    call->status = reply.status;
+                    euca_strncpy(call->out, out, sizeof(call->out));
+                    call->done = TRUE;
+                } else {
+                    LOGERROR("privileged helper answered unknown request %u\n", reply.id);
+                    rc = EUCA_IO_ERROR;
+                }
+            } else {
+                LOGERROR("failed to read from the privileged helper (rc=%d)\n", rc);
+            }
+
+            if (rc != EUCA_OK)
+                rootwrap_break();
+            rootwrap_put();
+            pthread_cond_broadcast(&rootwrap_cond);
+        }
+
+        for (i = 0; i < ncalls; i++) {
+            if (calls[i].lost) {
+                snprintf(calls[i].out, sizeof(calls[i].out), "no reply from the privileged helper");
+                calls[i].status = EIO;
+                ret = EUCA_IO_ERROR;
+            }
+        }
+    }
+    pthread_mutex_unlock(&rootwrap_mutex);
+    return (ret);
+}
+
 #ifdef _UNIT_TEST
 int main(int argc, char *argv[])
 {
@@ -1884,6 +2444,11 @@ int main(int argc, char *argv[])
     output = execlp_output(TRUE, "ls", "a-ridiculously-long-name-that-does-not-exist", NULL);
     assert(output == NULL);
 
+    // loop devices get per-device locks by minor number
+    assert(loop_lock("/dev/loop3") == loop_lock("/dev/loop67"));
+    assert(loop_lock("/dev/loop3") != loop_lock("/dev/loop4"));
+    assert(loop_lock("/dev/loop") == loop_lock("/dev/loop0"));
+
     {                                  // test diskutil_get_parts()
         struct partition_table_entry parts[5];
         int n = diskutil_get_parts("/dev/sda", parts, 5);
@@ -1904,3 +2469,4 @@ int main(int argc, char *argv[])
 }
 
 #endif // _UNIT_TEST
+
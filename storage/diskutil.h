@@ -143,6 +143,7 @@ int diskutil_part(const char *path, char *part_type, const char *fs_type, const
 int diskutil_get_parts(const char *path, struct partition_table_entry entries[], int num_entries);
 sem *diskutil_get_loop_sem(void);
 int diskutil_loop_check(const char *path, const char *lodev);
+void diskutil_set_loop_direct_io(boolean enable);
 int diskutil_loop(const char *path, const long long offset, char *lodev, int lodev_size);
 int diskutil_unloop(const char *lodev);
 int diskutil_mkswap(const char *lodev, const long long size_bytes);
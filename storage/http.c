@@ -74,6 +74,7 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define _GNU_SOURCE                    // strcasestr
 #include <stdlib.h>
 #include <time.h>
 #include <unistd.h>                    // close, stat
@@ -82,6 +83,7 @@
 #include <strings.h>
 #include <fcntl.h>                     // open
 #include <ctype.h>                     // tolower, isdigit
+#include <errno.h>
 #include <sys/types.h>                 // stat
 #include <sys/stat.h>                  // stat
 #include <curl/curl.h>
@@ -91,11 +93,17 @@
 #include <log.h>
 #include "misc.h"
 
-#ifndef _UNIT_TEST
-// http_ functions aren't part of the unit test
 #include <config.h>
 #include "http.h"
-#endif /* ! _UNIT_TEST */
+
+#ifdef _UNIT_TEST
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif /* _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -103,12 +111,17 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 #define TOTAL_RETRIES                             40    //!< download is retried in case of connection problems (2.5hrs+)
 #define FIRST_TIMEOUT                              4    //!< in seconds, goes in powers of two afterwards
 #define MAX_TIMEOUT                              300    //!< in seconds, the cap for growing timeout values
 #define STRSIZE                                  245    //!< for short strings: files, hosts, URLs
-#endif /* ! _UNIT_TEST */
+#define RANGE_RETRIES                             10    //!< per-segment retries of a ranged download before giving up
+#ifdef _UNIT_TEST
+#define RANGE_MIN_SEGMENT_BYTES         (64LL * 1024)   //!< small enough for the unit test to serve a ranged object quickly
+#else /* _UNIT_TEST */
+#define RANGE_MIN_SEGMENT_BYTES   (64LL * 1024 * 1024)  //!< objects smaller than two of these are downloaded with a single stream
+#endif /* _UNIT_TEST */
+#define RANGE_MAX_CONNECTIONS                     16    //!< upper bound on parallel connections of a ranged download
 #define RANDOM_DELAY_PERCENT                    0.01    //!< 1% of current timeout determines max delay duration
 
 /*----------------------------------------------------------------------------*\
@@ -129,7 +142,6 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 struct read_request {
     FILE *fp;                          //!< input file pointer to be used by curl READERs
     long long total_read;              //!< bytes written during the operation
@@ -147,7 +159,24 @@ struct write_request {
     int ret;                           //!< return value of last inflate() call
 #endif                                 /* CAN_GZIP */
 };
-#endif /* ! _UNIT_TEST */
+
+//! Describes one byte range of a segmented (ranged) download
+struct range_segment {
+    int fd;                            //!< output file descriptor shared by all segments
+    long long start;                   //!< offset of the first byte of this segment
+    long long end;                     //!< offset of the last byte of this segment (inclusive)
+    long long done;                    //!< bytes of this segment already written to the output file
+    boolean complete;                  //!< set once the whole segment has been received
+    boolean write_error;               //!< set if the write handler failed to store data
+    CURL *curl;                        //!< easy handle used for this segment
+    char range[64];                    //!< value for the Range header ("start-end")
+    char error_msg[CURL_ERROR_SIZE];   //!< libcurl error buffer for this segment
+};
+
+//! Collects the response headers of interest during a range probe
+struct range_probe {
+    boolean accepts_ranges;            //!< set if the server advertises "Accept-Ranges: bytes"
+};
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -169,9 +198,7 @@ struct write_request {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-#ifndef _UNIT_TEST
 static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have already initialize libcurl
-#endif /* ! _UNIT_TEST */
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -181,9 +208,20 @@ static boolean curl_initialized = FALSE;    //!< boolean to indicate if we have
 
 static size_t read_data(char *buffer, size_t size, size_t nitems, void *params);
 static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t write_range_data(void *buffer, size_t size, size_t nmemb, void *params);
+static size_t probe_header(char *buffer, size_t size, size_t nitems, void *params);
+static int http_probe_ranges(const char *url, int connect_timeout, long long *size_bytes);
+static int range_segment_prepare(struct range_segment *seg, const char *url, int connect_timeout);
 static char hch_to_int(char ch);
 static char int_to_hch(char i);
 
+#ifdef _UNIT_TEST
+static char test_byte(long long offset);
+static void test_serve(int sock, boolean honor_ranges);
+static pid_t test_server_start(boolean honor_ranges, char *url, int url_size);
+static int test_ranged(boolean honor_ranges);
+#endif /* _UNIT_TEST */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -422,6 +460,73 @@ static size_t write_data(void *buffer, size_t size, size_t nmemb, void *params)
     return (wrote);
 }
 
+//!
+//! libcurl write handler for one segment of a ranged download. Data is stored
+//! with pwrite() at the segment's current offset so that any number of segments
+//! can share the same output file descriptor.
+//!
+//! @param[in] buffer the data received from libcurl
+//! @param[in] size the size of each member
+//! @param[in] nmemb the number of members
+//! @param[in] params a transparent pointer to the range_segment structure.
+//!
+//! @return The number of bytes written, anything else signals an error to libcurl.
+//!
+//! @pre Both params and buffer parameters must not be NULL.
+//!
+static size_t write_range_data(void *buffer, size_t size, size_t nmemb, void *params)
+{
+    ssize_t wrote = 0;
+    size_t total = (size * nmemb);
+    size_t offset = 0;
+    struct range_segment *seg = ((struct range_segment *)params);
+
+    assert(buffer != NULL);
+    assert(params != NULL);
+
+    // a server that ignores the Range header would overrun the segment
+    if ((seg->start + seg->done + ((long long)total)) > (seg->end + 1)) {
+        seg->write_error = TRUE;
+        return (0);
+    }
+
+    while (offset < total) {
+        if ((wrote = pwrite(seg->fd, ((char *)buffer) + offset, (total - offset), (seg->start + seg->done))) < 1) {
+            seg->write_error = TRUE;
+            return (0);
+        }
+        offset += wrote;
+        seg->done += wrote;
+    }
+
+    return (total);
+}
+
+//!
+//! libcurl header handler used while probing a server for range support
+//!
+//! @param[in] buffer the header line (not NULL-terminated)
+//! @param[in] size the size of each member
+//! @param[in] nitems the number of members
+//! @param[in] params a transparent pointer to the range_probe structure.
+//!
+//! @return The number of bytes consumed
+//!
+static size_t probe_header(char *buffer, size_t size, size_t nitems, void *params)
+{
+    static const char header[] = "Accept-Ranges:";
+    size_t len = (size * nitems);
+    size_t i = 0;
+    struct range_probe *probe = ((struct range_probe *)params);
+
+    if ((len > (sizeof(header) - 1)) && !strncasecmp(buffer, header, (sizeof(header) - 1))) {
+        for (i = (sizeof(header) - 1); (i < len) && isspace(buffer[i]); i++) ;
+        if (((len - i) >= 5) && !strncasecmp(buffer + i, "bytes", 5))
+            probe->accepts_ranges = TRUE;
+    }
+    return (len);
+}
+
 //!
 //! Converts hex character to integer
 //!
@@ -743,17 +848,510 @@ int http_get_timeout(const char *url, const char *outfile, int total_retries, in
     return (code);
 }
 
+//!
+//! Issues a HEAD request to find out whether the server serving the URL supports
+//! byte ranges and how large the object is.
+//!
+//! @param[in]  url the request URL
+//! @param[in]  connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//! @param[out] size_bytes the size of the object, if known
+//!
+//! @return EUCA_OK if the server supports ranges and reported the size, EUCA_UNSUPPORTED_ERROR
+//!         if it does not and EUCA_ERROR if the probe failed.
+//!
+static int http_probe_ranges(const char *url, int connect_timeout, long long *size_bytes)
+{
+    int ret = EUCA_ERROR;
+    long httpcode = 0L;
+    curl_off_t length = -1;
+    char error_msg[CURL_ERROR_SIZE] = { 0 };
+    CURL *curl = NULL;
+    CURLcode result = CURLE_OK;
+    struct range_probe probe = { 0 };
+
+    if ((curl = curl_easy_init()) == NULL) {
+        LOGERROR("could not initialize libcurl\n");
+        return (EUCA_ERROR);
+    }
+
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_msg);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, probe_header);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe);
+    if (connect_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+    }
+
+    if ((result = curl_easy_perform(curl)) != CURLE_OK) {
+        LOGWARN("range probe failed for %s: %s (%d)\n", url, error_msg, result);
+    } else {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpcode);
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+        if ((httpcode == 200L) && probe.accepts_ranges && (length > 0)) {
+            *size_bytes = ((long long)length);
+            ret = EUCA_OK;
+        } else {
+            LOGDEBUG("server does not support ranged downloads of %s (code=%ld ranges=%d length=%lld)\n", url, httpcode, probe.accepts_ranges, (long long)length);
+            ret = EUCA_UNSUPPORTED_ERROR;
+        }
+    }
+
+    curl_easy_cleanup(curl);
+    return (ret);
+}
+
+//!
+//! (Re)initializes the libcurl easy handle of a segment so that it requests the
+//! part of the segment that has not been received yet.
+//!
+//! @param[in] seg the segment to prepare
+//! @param[in] url the request URL
+//! @param[in] connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//!
+//! @return EUCA_OK on success or EUCA_ERROR if the handle could not be created
+//!
+static int range_segment_prepare(struct range_segment *seg, const char *url, int connect_timeout)
+{
+    if (seg->curl == NULL) {
+        if ((seg->curl = curl_easy_init()) == NULL) {
+            LOGERROR("could not initialize libcurl\n");
+            return (EUCA_ERROR);
+        }
+
+        curl_easy_setopt(seg->curl, CURLOPT_ERRORBUFFER, seg->error_msg);
+        curl_easy_setopt(seg->curl, CURLOPT_URL, url);
+        curl_easy_setopt(seg->curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+        curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, write_range_data);
+        curl_easy_setopt(seg->curl, CURLOPT_PRIVATE, seg);
+        curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_LIMIT, 360L); // must have at least a 360 baud modem
+        curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_TIME, 60L);   // abort if below speed limit for this many seconds
+        if (connect_timeout > 0) {
+            curl_easy_setopt(seg->curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
+        }
+    }
+
+    // only ask for what is still missing so a retry resumes the segment
+    snprintf(seg->range, sizeof(seg->range), "%lld-%lld", (seg->start + seg->done), seg->end);
+    curl_easy_setopt(seg->curl, CURLOPT_RANGE, seg->range);
+    seg->error_msg[0] = '\0';
+    seg->write_error = FALSE;
+    return (EUCA_OK);
+}
+
+//!
+//! Process an HTTP get request to the given URL using several parallel connections,
+//! each fetching a byte range of the object into a preallocated output file. When a
+//! segment fails, only the missing part of that segment is re-requested. If the
+//! server does not support ranges, or the object is too small to benefit, this falls
+//! back to the single-stream http_get_timeout().
+//!
+//! @param[in] url the request URL
+//! @param[in] outfile path to the output file
+//! @param[in] connections the maximum number of parallel connections to use
+//! @param[in] connect_timeout the libcurl connect timeout (libcurl option CURLOPT_CONNECTTIMEOUT)
+//! @param[in] bail_flag if not NULL and set to TRUE, retries are abandoned
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_ERROR: on failure
+//!         \li EUCA_INVALID_ERROR: if any parameter does not meet the preconditions
+//!         \li EUCA_MEMORY_ERROR: if we fail to allocate the segments
+//!         \li EUCA_ACCESS_ERROR: if we fail to access the outfile.
+//!
+//! @pre \li Both url and outfile parameters must not be NULL.
+//!      \li The url parameter must start with "http://"
+//!
+//! @post On success, the object is stored in outfile. On failure, outfile is removed.
+//!
+//! @see http_get_timeout()
+//!
+int http_get_ranged(const char *url, const char *outfile, int connections, int connect_timeout, boolean * bail_flag)
+{
+    int i = 0;
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    int nsegs = 0;
+    int running = 0;
+    int pending = 0;
+    int failed = 0;
+    int retries = RANGE_RETRIES;
+    int timeout = FIRST_TIMEOUT;
+    long httpcode = 0L;
+    long long size = 0;
+    long long seg_size = 0;
+    boolean fallback = FALSE;
+    CURLM *multi = NULL;
+    CURLMsg *msg = NULL;
+    CURLMcode mresult = CURLM_OK;
+    struct range_segment *seg = NULL;
+    struct range_segment *segs = NULL;
+
+    if (!url || !outfile) {
+        LOGERROR("invalid params: outfile=%s, url=%s\n", SP(outfile), SP(url));
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (strncasecmp(url, "http://", 7) != 0) {
+        LOGERROR("URL must start with http://...\n");
+        return (EUCA_INVALID_ERROR);
+    }
+
+    if (!curl_initialized) {
+        curl_global_init(CURL_GLOBAL_SSL);
+        curl_initialized = TRUE;
+    }
+
+    if (connections > RANGE_MAX_CONNECTIONS)
+        connections = RANGE_MAX_CONNECTIONS;
+
+    if ((connections < 2) || (http_probe_ranges(url, connect_timeout, &size) != EUCA_OK) || (size < (2 * RANGE_MIN_SEGMENT_BYTES))) {
+        return (http_get_timeout(url, outfile, TOTAL_RETRIES, FIRST_TIMEOUT, connect_timeout, 0, bail_flag));
+    }
+
+    if ((nsegs = (int)(size / RANGE_MIN_SEGMENT_BYTES)) > connections)
+        nsegs = connections;
+    seg_size = (size + nsegs - 1) / nsegs;
+
+    LOGDEBUG("downloading %s\n", outfile);
+    LOGDEBUG("from %s (%lld bytes in %d ranges)\n", url, size, nsegs);
+
+    if ((fd = open(outfile, (O_WRONLY | O_CREAT | O_TRUNC), 0600)) < 0) {
+        LOGERROR("failed to open %s for writing\n", outfile);
+        return (EUCA_ACCESS_ERROR);
+    }
+
+    // preallocate the output so segments can be written in any order
+    if ((errno = posix_fallocate(fd, 0, size)) != 0) {
+        LOGWARN("failed to preallocate %lld bytes for %s: %s\n", size, outfile, strerror(errno));
+        if (ftruncate(fd, size) != 0) {
+            LOGERROR("failed to size %s to %lld bytes\n", outfile, size);
+            close(fd);
+            remove(outfile);
+            return (EUCA_ACCESS_ERROR);
+        }
+    }
+
+    if (((segs = EUCA_ZALLOC(nsegs, sizeof(struct range_segment))) == NULL) || ((multi = curl_multi_init()) == NULL)) {
+        LOGERROR("out of memory (failed to allocate %d download ranges)\n", nsegs);
+        EUCA_FREE(segs);
+        close(fd);
+        remove(outfile);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    for (i = 0; i < nsegs; i++) {
+        segs[i].fd = fd;
+        segs[i].start = (i * seg_size);
+        segs[i].end = (((i + 1) * seg_size) < size) ? (((i + 1) * seg_size) - 1) : (size - 1);
+    }
+
+    do {
+        // (re)start every segment that has not completed yet
+        for (i = 0, pending = 0; i < nsegs; i++) {
+            if (segs[i].complete)
+                continue;
+            if (range_segment_prepare(&segs[i], url, connect_timeout) != EUCA_OK)
+                break;
+            curl_multi_add_handle(multi, segs[i].curl);
+            pending++;
+        }
+
+        if (i < nsegs) {
+            failed = nsegs;
+            break;
+        }
+
+        running = pending;
+        while (running > 0) {
+            if ((mresult = curl_multi_perform(multi, &running)) != CURLM_OK) {
+                LOGERROR("ranged download of %s failed: %s (%d)\n", url, curl_multi_strerror(mresult), mresult);
+                break;
+            }
+
+            if ((running > 0) && ((mresult = curl_multi_wait(multi, NULL, 0, 1000, NULL)) != CURLM_OK)) {
+                LOGERROR("ranged download of %s failed: %s (%d)\n", url, curl_multi_strerror(mresult), mresult);
+                break;
+            }
+        }
+
+        while ((msg = curl_multi_info_read(multi, &pending)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+
+            seg = NULL;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&seg);
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &httpcode);
+            curl_multi_remove_handle(multi, msg->easy_handle);
+
+            if (seg == NULL)
+                continue;
+
+            if ((msg->data.result == CURLE_OK) && (httpcode == 206L) && ((seg->start + seg->done) == (seg->end + 1))) {
+                seg->complete = TRUE;
+            } else if (httpcode == 200L) {
+                // server ignored the range after all
+                LOGWARN("server ignored range %s of %s, falling back to a single stream\n", seg->range, url);
+                fallback = TRUE;
+            } else {
+                LOGWARN("range %s of %s failed after %lld bytes: %s (%d, HTTP code %ld)\n", seg->range, url, seg->done, seg->error_msg, msg->data.result, httpcode);
+            }
+        }
+
+        // anything still attached to the multi handle did not finish either
+        for (i = 0, failed = 0; i < nsegs; i++) {
+            if (!segs[i].complete) {
+                if (segs[i].curl != NULL)
+                    curl_multi_remove_handle(multi, segs[i].curl);
+                failed++;
+            }
+        }
+
+        if (fallback)
+            break;
+
+        if ((failed > 0) && (--retries > 0)) {
+            LOGERROR("retrying %d of %d ranges of %s in %d sec (%d retries left)\n", failed, nsegs, url, timeout, retries);
+            for (i = 0; i < timeout; i++) {
+                sleep(1);
+                if (bail_flag != NULL && *bail_flag == TRUE) {
+                    LOGWARN("bailing on the download for %s\n", url);
+                    retries = 0;
+                    break;
+                }
+            }
+            timeout <<= 1;
+            if (timeout > MAX_TIMEOUT)
+                timeout = MAX_TIMEOUT;
+        }
+    } while ((failed > 0) && (retries > 0));
+
+    for (i = 0; i < nsegs; i++) {
+        if (segs[i].curl != NULL) {
+            curl_multi_remove_handle(multi, segs[i].curl);
+            curl_easy_cleanup(segs[i].curl);
+        }
+    }
+    curl_multi_cleanup(multi);
+    EUCA_FREE(segs);
+
+    if (!fallback && (failed == 0)) {
+        if (fsync(fd) != 0) {
+            LOGWARN("failed to sync %s\n", outfile);
+        }
+        LOGDEBUG("saved image in %s\n", outfile);
+        ret = EUCA_OK;
+    }
+    close(fd);
+
+    if (fallback) {
+        return (http_get_timeout(url, outfile, TOTAL_RETRIES, FIRST_TIMEOUT, connect_timeout, 0, bail_flag));
+    }
+
+    if (ret != EUCA_OK) {
+        LOGWARN("removing %s\n", outfile);
+        remove(outfile);
+    }
+    return (ret);
+}
+
 #ifdef _UNIT_TEST
+#define TEST_OBJECT_BYTES     (1024LL * 1024 + 12345)    //!< not a multiple of the number of ranges
+#define TEST_CONNECTIONS                           4    //!< parallel connections asked of http_get_ranged()
+
+//! Requests seen by the test server, in memory shared with the test
+struct test_requests {
+    int heads;                         //!< HEAD requests
+    int ranged_gets;                   //!< GET requests with a Range header
+    int full_gets;                     //!< GET requests without one
+};
+
+static struct test_requests *test_requests = NULL;
+
+//!
+//! Computes the content of the test object at a given offset
+//!
+//! @param[in] offset the offset into the object
+//!
+//! @return the byte at that offset
+//!
+static char test_byte(long long offset)
+{
+    return ((char)((offset * 7) + (offset / 4093)));
+}
+
+//!
+//! Answers the HTTP requests of the test, one connection at a time, until killed. HEAD
+//! always advertises byte ranges; GET honors the Range header only if asked to.
+//!
+//! @param[in] sock the listening socket
+//! @param[in] honor_ranges set to FALSE to answer every GET with the whole object
+//!
+static void test_serve(int sock, boolean honor_ranges)
+{
+    int fd = -1;
+    int len = 0;
+    int rc = 0;
+    char *range = NULL;
+    char req[4096] = "";
+    char buf[65536] = "";
+    long long start = 0;
+    long long end = 0;
+    long long offset = 0;
+
+    while ((fd = accept(sock, NULL, NULL)) >= 0) {
+        for (len = 0; (len < (sizeof(req) - 1)) && ((rc = read(fd, req + len, (sizeof(req) - 1 - len))) > 0);) {
+            len += rc;
+            req[len] = '\0';
+            if (strstr(req, "\r\n\r\n"))
+                break;
+        }
+
+        start = 0;
+        end = (TEST_OBJECT_BYTES - 1);
+        range = strcasestr(req, "\r\nRange: bytes=");
+        if (!strncmp(req, "HEAD ", 5)) {
+            test_requests->heads++;
+            len = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nAccept-Ranges: bytes\r\nConnection: close\r\n\r\n", TEST_OBJECT_BYTES);
+            end = -1;                  // no body
+        } else if (honor_ranges && (range != NULL) && (sscanf(range, "\r\n%*[^=]=%lld-%lld", &start, &end) == 2)) {
+            test_requests->ranged_gets++;
+            len = snprintf(buf, sizeof(buf), "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+                           start, end, TEST_OBJECT_BYTES, (end - start + 1));
+        } else {
+            if (range != NULL) {
+                test_requests->ranged_gets++;
+            } else {
+                test_requests->full_gets++;
+            }
+            len = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n", TEST_OBJECT_BYTES);
+        }
+
+        // the client may hang up early, e.g., on a range it did not get, which must not kill us
+        rc = send(fd, buf, len, MSG_NOSIGNAL);
+        for (offset = start; (rc > 0) && (offset <= end); offset += len) {
+            for (len = 0; (len < sizeof(buf)) && ((offset + len) <= end); len++)
+                buf[len] = test_byte(offset + len);
+            rc = send(fd, buf, len, MSG_NOSIGNAL);
+        }
+        close(fd);
+    }
+    _exit(0);
+}
+
+//!
+//! Starts the test HTTP server on an ephemeral port of the loopback interface
+//!
+//! @param[in]  honor_ranges set to FALSE for a server that ignores the Range header
+//! @param[out] url the URL of the test object
+//! @param[in]  url_size the size of the url buffer
+//!
+//! @return the process ID of the server or -1 on failure
+//!
+static pid_t test_server_start(boolean honor_ranges, char *url, int url_size)
+{
+    int sock = -1;
+    pid_t pid = -1;
+    socklen_t addr_len = sizeof(struct sockaddr_in);
+    struct sockaddr_in addr = { 0 };
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) || (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(sock, 16) != 0)
+        || (getsockname(sock, (struct sockaddr *)&addr, &addr_len) != 0)) {
+        printf("cannot set up the test server: %s\n", strerror(errno));
+        if (sock >= 0)
+            close(sock);
+        return (-1);
+    }
+
+    snprintf(url, url_size, "http://127.0.0.1:%d/object", ntohs(addr.sin_port));
+    if ((pid = fork()) == 0) {
+        test_serve(sock, honor_ranges);
+    }
+    close(sock);
+    return (pid);
+}
+
+//!
+//! Downloads the test object with http_get_ranged() and checks its content and how
+//! it was fetched: in ranges if the server honors them, or with a single full GET
+//! after the ranges came back whole if it does not
+//!
+//! @param[in] honor_ranges set to FALSE for a server that ignores the Range header
+//!
+//! @return the number of errors
+//!
+static int test_ranged(boolean honor_ranges)
+{
+    int fd = -1;
+    int rc = 0;
+    int errors = 0;
+    pid_t pid = -1;
+    char url[128] = "";
+    char outfile[EUCA_MAX_PATH] = "/tmp/euca-http-test-XXXXXX";
+    char buf[65536] = "";
+    long long offset = 0;
+    ssize_t len = 0;
+    struct stat st = { 0 };
+
+    printf("testing a ranged download from a server that %s ranges\n", (honor_ranges ? "honors" : "ignores"));
+    bzero(test_requests, sizeof(struct test_requests));
+    if ((pid = test_server_start(honor_ranges, url, sizeof(url))) < 0)
+        return (1);
+
+    fd = mkstemp(outfile);
+    if (fd < 0) {
+        printf("\tcannot create %s\n", outfile);
+        errors++;
+    } else {
+        close(fd);
+        rc = http_get_ranged(url, outfile, TEST_CONNECTIONS, 5, NULL);
+        if (rc != EUCA_OK) {
+            printf("\thttp_get_ranged() returned %d\n", rc);
+            errors++;
+        } else if ((stat(outfile, &st) != 0) || (st.st_size != TEST_OBJECT_BYTES) || ((fd = open(outfile, O_RDONLY)) < 0)) {
+            printf("\t%s is missing or has the wrong size\n", outfile);
+            errors++;
+        } else {
+            for (offset = 0; (len = read(fd, buf, sizeof(buf))) > 0; offset += len) {
+                for (int i = 0; i < len; i++) {
+                    if (buf[i] != test_byte(offset + i)) {
+                        printf("\twrong content at offset %lld\n", (offset + i));
+                        errors++;
+                        len = 0;
+                        break;
+                    }
+                }
+            }
+            close(fd);
+        }
+        unlink(outfile);
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+
+    printf("\tHEAD requests=%d ranged GETs=%d full GETs=%d\n", test_requests->heads, test_requests->ranged_gets, test_requests->full_gets);
+    if ((test_requests->heads != 1) || (test_requests->ranged_gets != TEST_CONNECTIONS) || (test_requests->full_gets != (honor_ranges ? 0 : 1))) {
+        printf("\tunexpected requests\n");
+        errors++;
+    }
+    return (errors);
+}
+
 //!
 //! Main entry point of the application
 //!
 //! @param[in] argc the number of parameter passed on the command line
 //! @param[in] argv the list of arguments
 //!
-//! @return EUCA_OK
+//! @return EUCA_OK on success or EUCA_ERROR on failure
 //!
 int main(int argc, char **argv)
 {
+    int errors = 0;
+
 #define _T(_S)                                                \
 {                                                             \
 	char *__e = url_encode (_S);                              \
@@ -766,8 +1364,19 @@ int main(int argc, char **argv)
     _T("hello world");
     _T("~`!1@2#3$4%5^6&7*8(9)0_-+={[}]|\\:;\"'<,>.?/");
     _T("[datastore1 (1)] windows 2003 enterprise/windows 2003 enterprise.vmx");
-    return (EUCA_OK);
 
 #undef _T
+
+    logfile(NULL, EUCA_LOG_WARN, 4);
+    if ((test_requests = mmap(NULL, sizeof(struct test_requests), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        printf("cannot map the request counters\n");
+        return (EUCA_ERROR);
+    }
+    errors += test_ranged(TRUE);
+    errors += test_ranged(FALSE);
+    munmap(test_requests, sizeof(struct test_requests));
+
+    printf("%s\n", ((errors == 0) ? "all tests passed" : "some tests failed"));
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
 }
 #endif /* _UNIT_TEST */
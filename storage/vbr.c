@@ -120,6 +120,7 @@
 #define CREATE                                   1
 
 #define ARTIFACT_RETRY_SLEEP_USEC                500000LL
+#define URL_DOWNLOAD_CONNECTIONS                 4  //!< parallel ranged connections used by url_creator()
 
 #ifdef _UNIT_TEST
 #define BS_SIZE                                  20000000000 / 512
@@ -1027,7 +1028,7 @@ static int url_creator(artifact * a)
         return (EUCA_OK);
     }
     LOGINFO("[%s] downloading %s\n", a->instanceId, vbr->preparedResourceLocation);
-    if (http_get(vbr->preparedResourceLocation, dest_path, NULL) != EUCA_OK) {
+    if (http_get_ranged(vbr->preparedResourceLocation, dest_path, URL_DOWNLOAD_CONNECTIONS, 0, NULL) != EUCA_OK) {
         LOGERROR("[%s] failed to download component %s\n", a->instanceId, vbr->preparedResourceLocation);
         return (EUCA_ERROR);
     }
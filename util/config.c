@@ -78,14 +78,18 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <sys/errno.h>
 #include <assert.h>
 #include <string.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include "eucalyptus.h"
 #include "misc.h"
 #include "config.h"
+#include "euca_string.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -93,6 +97,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define CONFIG_STORE_BUCKETS                     128    //!< Number of hash buckets per parsed configuration file
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -111,6 +117,33 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! One KEY=VALUE line of a parsed configuration file
+typedef struct configStoreEntry_t {
+    char *sKey;                        //!< The configuration key name
+    char *sValue;                      //!< The raw value (NULL if the line has an unterminated quote)
+    struct configStoreEntry_t *pNext;  //!< Next entry in the same hash bucket
+} configStoreEntry;
+
+//! A configuration file parsed once and kept in memory until its identity changes on disk
+typedef struct configStoreFile_t {
+    char sPath[EUCA_MAX_PATH];         //!< The configuration file path
+    boolean exists;                    //!< Set to TRUE if the file could be read when last parsed
+    dev_t dev;                         //!< Device of the file when last parsed
+    ino_t ino;                         //!< Inode of the file when last parsed
+    off_t size;                        //!< Size of the file when last parsed
+    struct timespec mtime;             //!< Modification time of the file when last parsed
+    struct timespec ctime;             //!< Status change time of the file when last parsed
+    configStoreEntry *apBuckets[CONFIG_STORE_BUCKETS];  //!< Key/value hash table
+    struct configStoreFile_t *pNext;   //!< Next file in the store
+} configStoreFile;
+
+//! A subsystem registered to be told about configuration changes
+typedef struct configListener_t {
+    char *sKey;                        //!< The key of interest (NULL for all keys)
+    configChangeCallback fnCallback;   //!< The function to invoke on change
+    void *pData;                       //!< Opaque data handed back to the callback
+} configListener;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -152,12 +185,43 @@ static char *asConfigValuesNoRestart[256] = { NULL };   //!< The list of modifie
 //! Hold the timestamp of when we last processed the config files
 static time_t lastConfigMtime[4] = { 0, 0, 0, 0 };
 
+//! @{
+//! @name In-memory store of the parsed configuration files
+
+static configStoreFile *pConfigStore = NULL;    //!< The list of parsed configuration files
+static pthread_mutex_t configStoreMutex = PTHREAD_MUTEX_INITIALIZER;    //!< Protects the store
+
+//! @}
+
+//! @{
+//! @name Subsystems to notify when a no-restart value changes
+
+static configListener *aConfigListeners = NULL; //!< The registered listeners
+static int configListenersLen = 0;     //!< Number of registered listeners
+static pthread_mutex_t configListenersMutex = PTHREAD_MUTEX_INITIALIZER;    //!< Protects the listeners
+
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static u32 config_store_hash(const char *sKey);
+static void config_store_clear(configStoreFile * pFile);
+static int config_store_parse(configStoreFile * pFile);
+static configStoreFile *config_store_file(const char *sPath);
+static void config_store_refresh(char asConfigFiles[][EUCA_MAX_PATH], int numFiles);
+static char *config_store_lookup(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey);
+static void config_notify(const char *sKey, const char *sOldValue, const char *sNewValue);
+
+#ifdef _UNIT_TEST
+static void config_test_write(const char *sPath, const char *sContent);
+static void config_test_listener(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData);
+static void config_test_poll_listener(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData);
+#endif /* _UNIT_TEST */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -362,10 +426,18 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
     int ret = 0;
     char *old = NULL;
     char *new = NULL;
+    u32 changedLen = 0;
+    char *asChangedOld[256] = { NULL };
+    char *asChangedNew[256] = { NULL };
+    boolean aChanged[256] = { FALSE };
+
+    // stat the files once and re-parse only those that changed; all keys are then served from memory
+    pthread_mutex_lock(&configStoreMutex);
+    config_store_refresh(asConfigFiles, numFiles);
 
     for (i = 0; aConfigKeysRestart[i].key; i++) {
         old = asConfigValuesRestart[i];
-        new = getConfString(asConfigFiles, numFiles, aConfigKeysRestart[i].key);
+        new = config_store_lookup(asConfigFiles, numFiles, aConfigKeysRestart[i].key);
         if (configRestartLen) {
             if ((!old && new) || (old && !new) || ((old && new) && strcmp(old, new))) {
                 LOGWARN("configuration file changed (KEY=%s, ORIGVALUE=%s, NEWVALUE=%s): clean restart is required before this change "
@@ -384,13 +456,20 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
 
     for (i = 0; aConfigKeysNoRestart[i].key; i++) {
         old = asConfigValuesNoRestart[i];
-        new = getConfString(asConfigFiles, numFiles, aConfigKeysNoRestart[i].key);
+        new = config_store_lookup(asConfigFiles, numFiles, aConfigKeysNoRestart[i].key);
 
         if (configNoRestartLen) {
             if ((!old && new) || (old && !new) || ((old && new) && strcmp(old, new))) {
                 LOGINFO("configuration file changed (KEY=%s, ORIGVALUE=%s, NEWVALUE=%s): change will take effect immediately.\n", aConfigKeysNoRestart[i].key, SP(old), SP(new));
                 ret++;
-                EUCA_FREE(asConfigValuesNoRestart[i]);
+                // the listeners get their own copies so that a concurrent re-read cannot free them
+                if (i < (sizeof(aChanged) / sizeof(aChanged[0]))) {
+                    asChangedOld[i] = old;
+                    asChangedNew[i] = ((new != NULL) ? strdup(new) : NULL);
+                    aChanged[i] = TRUE;
+                } else {
+                    EUCA_FREE(old);
+                }
                 asConfigValuesNoRestart[i] = new;
             } else {
                 EUCA_FREE(new);
@@ -400,13 +479,161 @@ int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
             EUCA_FREE(asConfigValuesNoRestart[i]);
             asConfigValuesNoRestart[i] = new;
             ret++;
+            // the first read in this process is a change too, so the listeners start from the file's value
+            if (i < (sizeof(aChanged) / sizeof(aChanged[0]))) {
+                asChangedNew[i] = ((new != NULL) ? strdup(new) : NULL);
+                aChanged[i] = TRUE;
+            }
+        }
+    }
+    configNoRestartLen = changedLen = i;
+    pthread_mutex_unlock(&configStoreMutex);
+
+    // listeners may query the store themselves, so they are invoked without holding its lock
+    for (i = 0; (i < changedLen) && (i < (sizeof(aChanged) / sizeof(aChanged[0]))); i++) {
+        if (aChanged[i]) {
+            config_notify(aConfigKeysNoRestart[i].key, asChangedOld[i], asChangedNew[i]);
+            EUCA_FREE(asChangedOld[i]);
+            EUCA_FREE(asChangedNew[i]);
         }
     }
-    configNoRestartLen = i;
 
     return (ret);
 }
 
+//!
+//! Retrieves a value straight from a list of configuration files. This is a drop-in
+//! replacement for getConfString(): the first file defining the key wins and trailing
+//! spaces are trimmed. Each file is parsed once and kept in memory; a lookup only costs
+//! a stat() per file, and a file is re-parsed when its inode, size, mtime or ctime change.
+//!
+//! @param[in] asConfigFiles a list of configuration file path
+//! @param[in] numFiles the number of configuration files in the list
+//! @param[in] sKey the name of the key for which we're looking for its paired value
+//!
+//! @return a string copy of the value matching the provided keyname or NULL if the
+//!         key is not found in any of the files.
+//!
+//! @pre The \p asConfigFiles list must not be NULL and \p sKey must not be NULL or empty
+//!
+//! @note the caller is responsible for freeing the allocated memory
+//!
+char *configStoreValue(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey)
+{
+    char *sValue = NULL;
+
+    if ((asConfigFiles == NULL) || (sKey == NULL) || (sKey[0] == '\0'))
+        return (NULL);
+
+    pthread_mutex_lock(&configStoreMutex);
+    {
+        config_store_refresh(asConfigFiles, numFiles);
+        sValue = config_store_lookup(asConfigFiles, numFiles, sKey);
+    }
+    pthread_mutex_unlock(&configStoreMutex);
+    return (sValue);
+}
+
+//!
+//! Retrieves a "long" integer value straight from a list of configuration files.
+//!
+//! @param[in]  asConfigFiles a list of configuration file path
+//! @param[in]  numFiles the number of configuration files in the list
+//! @param[in]  sKey the name of the key for which we're looking for its paired value
+//! @param[out] pVal the matching long value to be set if \p sKey is found
+//!
+//! @return TRUE if the key was found and its value is a valid long integer, otherwise FALSE.
+//!
+//! @see configStoreValue()
+//!
+boolean configStoreValueLong(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey, long *pVal)
+{
+    long v = 0;
+    char *endptr = NULL;
+    char *tmpstr = configStoreValue(asConfigFiles, numFiles, sKey);
+    boolean found = FALSE;
+
+    if ((tmpstr != NULL) && (tmpstr[0] != '\0') && (pVal != NULL)) {
+        errno = 0;
+        v = (long)strtoll(tmpstr, &endptr, 10);
+        if ((errno == 0) && ((*endptr) == '\0')) {
+            (*pVal) = v;
+            found = TRUE;
+        }
+    }
+    EUCA_FREE(tmpstr);
+    return (found);
+}
+
+//!
+//! Retrieves a boolean value straight from a list of configuration files. The values
+//! "Y", "YES", "TRUE" and "1" are true and "N", "NO", "FALSE" and "0" are false
+//! (case insensitive).
+//!
+//! @param[in]  asConfigFiles a list of configuration file path
+//! @param[in]  numFiles the number of configuration files in the list
+//! @param[in]  sKey the name of the key for which we're looking for its paired value
+//! @param[out] pVal the matching boolean value to be set if \p sKey is found
+//!
+//! @return TRUE if the key was found and its value is a recognized boolean, otherwise FALSE.
+//!
+//! @see configStoreValue()
+//!
+boolean configStoreValueBoolean(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey, boolean * pVal)
+{
+    char *tmpstr = configStoreValue(asConfigFiles, numFiles, sKey);
+    boolean found = FALSE;
+
+    if ((tmpstr != NULL) && (pVal != NULL)) {
+        if (!strcasecmp(tmpstr, "Y") || !strcasecmp(tmpstr, "YES") || !strcasecmp(tmpstr, "TRUE") || !strcmp(tmpstr, "1")) {
+            (*pVal) = TRUE;
+            found = TRUE;
+        } else if (!strcasecmp(tmpstr, "N") || !strcasecmp(tmpstr, "NO") || !strcasecmp(tmpstr, "FALSE") || !strcmp(tmpstr, "0")) {
+            (*pVal) = FALSE;
+            found = TRUE;
+        }
+    }
+    EUCA_FREE(tmpstr);
+    return (found);
+}
+
+//!
+//! Registers a subsystem to be told when a no-restart configuration value changes. The
+//! callback is invoked by readConfigFile(), outside of any configuration lock, with the
+//! old and the new value of the key (either may be NULL when the key was added or removed).
+//! The first read in a process reports every no-restart key with a NULL old value.
+//!
+//! @param[in] sKey the key of interest or NULL to be told about every no-restart key
+//! @param[in] fnCallback the function to invoke on change
+//! @param[in] pData opaque data handed back to the callback
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR on bad parameters or EUCA_MEMORY_ERROR
+//!
+//! @note Listeners are per process: a daemon must register them in the process that calls
+//!       readConfigFile().
+//!
+int configRegisterChangeCallback(const char *sKey, configChangeCallback fnCallback, void *pData)
+{
+    configListener *pListeners = NULL;
+
+    if (fnCallback == NULL)
+        return (EUCA_INVALID_ERROR);
+
+    pthread_mutex_lock(&configListenersMutex);
+    if ((pListeners = EUCA_REALLOC(aConfigListeners, (configListenersLen + 1), sizeof(configListener))) == NULL) {
+        pthread_mutex_unlock(&configListenersMutex);
+        return (EUCA_MEMORY_ERROR);
+    }
+
+    aConfigListeners = pListeners;
+    aConfigListeners[configListenersLen].sKey = ((sKey != NULL) ? strdup(sKey) : NULL);
+    aConfigListeners[configListenersLen].fnCallback = fnCallback;
+    aConfigListeners[configListenersLen].pData = pData;
+    configListenersLen++;
+    pthread_mutex_unlock(&configListenersMutex);
+    return (EUCA_OK);
+}
+
 //!
 //! Helper for reading log-related params from eucalyptus.conf
 //!
@@ -445,3 +672,427 @@ void configReadLogParams(int *pLogLevel, int *pLogRollNumber, long *pLogMaxSizeB
     if (psLogPrefix)
         (*psLogPrefix) = configFileValue("LOGPREFIX");
 }
+
+//!
+//! Hashes a configuration key name into one of the store buckets (djb2)
+//!
+//! @param[in] sKey the key name
+//!
+//! @return the bucket index
+//!
+static u32 config_store_hash(const char *sKey)
+{
+    u32 hash = 5381;
+
+    while (*sKey != '\0')
+        hash = ((hash << 5) + hash) + ((unsigned char)*sKey++);
+    return (hash % CONFIG_STORE_BUCKETS);
+}
+
+//!
+//! Releases all the key/value entries of a parsed configuration file
+//!
+//! @param[in] pFile the parsed file
+//!
+static void config_store_clear(configStoreFile * pFile)
+{
+    u32 i = 0;
+    configStoreEntry *pEntry = NULL;
+    configStoreEntry *pNext = NULL;
+
+    for (i = 0; i < CONFIG_STORE_BUCKETS; i++) {
+        for (pEntry = pFile->apBuckets[i]; pEntry != NULL; pEntry = pNext) {
+            pNext = pEntry->pNext;
+            EUCA_FREE(pEntry->sKey);
+            EUCA_FREE(pEntry->sValue);
+            EUCA_FREE(pEntry);
+        }
+        pFile->apBuckets[i] = NULL;
+    }
+}
+
+//!
+//! Parses a configuration file into its hash table. The parsing rules are those of
+//! get_conf_var(): leading spaces are skipped, the key is followed by optional spaces
+//! and '=', a quoted value ends on the closing quote and an unquoted one on the first
+//! space or '#'. Only the first definition of a key in a file is kept and a key whose
+//! quote is never closed is kept with a NULL value so lookups fall through to the next file.
+//!
+//! @param[in] pFile the file to parse
+//!
+//! @return EUCA_OK on success, EUCA_ACCESS_ERROR if the file cannot be opened or EUCA_MEMORY_ERROR
+//!
+static int config_store_parse(configStoreFile * pFile)
+{
+    int rc = EUCA_OK;
+    u32 bucket = 0;
+    FILE *f = NULL;
+    char *buf = NULL;
+    char *ptr = NULL;
+    char *key = NULL;
+    char *value = NULL;
+    size_t bufLen = 0;
+    size_t keyLen = 0;
+    configStoreEntry *pEntry = NULL;
+
+    config_store_clear(pFile);
+
+    if ((f = fopen(pFile->sPath, "r")) == NULL)
+        return (EUCA_ACCESS_ERROR);
+
+    while (getline(&buf, &bufLen, f) != -1) {
+        for (ptr = buf; ((*ptr != '\0') && isspace((int)*ptr)); ptr++) ;
+        for (key = ptr; ((*ptr != '\0') && !isspace((int)*ptr) && (*ptr != '=')); ptr++) ;
+        if ((keyLen = (ptr - key)) == 0)
+            continue;
+
+        for (; (*ptr != '\0') && isspace((int)*ptr); ptr++) ;
+        if (*ptr != '=')
+            continue;
+
+        for (ptr++; (*ptr != '\0') && isspace((int)*ptr); ptr++) ;
+        if (*ptr == '"') {
+            for (value = ++ptr; ((*ptr != '"') && (*ptr != '\0')); ptr++) ;
+            if (*ptr == '\0')
+                value = NULL;
+        } else {
+            for (value = ptr; (!isspace((int)*ptr) && (*ptr != '#') && (*ptr != '\0')); ptr++) ;
+        }
+
+        if (value != NULL)
+            *ptr = '\0';
+        key[keyLen] = '\0';
+
+        // the first definition within a file wins
+        bucket = config_store_hash(key);
+        for (pEntry = pFile->apBuckets[bucket]; ((pEntry != NULL) && strcmp(pEntry->sKey, key)); pEntry = pEntry->pNext) ;
+        if (pEntry != NULL)
+            continue;
+
+        if ((pEntry = EUCA_ZALLOC(1, sizeof(configStoreEntry))) == NULL) {
+            rc = EUCA_MEMORY_ERROR;
+            break;
+        }
+
+        pEntry->sKey = strdup(key);
+        pEntry->sValue = ((value != NULL) ? strdup(value) : NULL);
+        if ((pEntry->sKey == NULL) || ((value != NULL) && (pEntry->sValue == NULL))) {
+            EUCA_FREE(pEntry->sKey);
+            EUCA_FREE(pEntry->sValue);
+            EUCA_FREE(pEntry);
+            rc = EUCA_MEMORY_ERROR;
+            break;
+        }
+
+        pEntry->pNext = pFile->apBuckets[bucket];
+        pFile->apBuckets[bucket] = pEntry;
+    }
+
+    fclose(f);
+    EUCA_FREE(buf);
+
+    // a partially parsed file would hide values, treat it as unreadable
+    if (rc != EUCA_OK)
+        config_store_clear(pFile);
+    return (rc);
+}
+
+//!
+//! Finds the store slot for a configuration file, creating an empty one if needed.
+//! Must be called with the configStoreMutex held.
+//!
+//! @param[in] sPath the configuration file path
+//!
+//! @return the store slot or NULL on memory error
+//!
+static configStoreFile *config_store_file(const char *sPath)
+{
+    configStoreFile *pFile = NULL;
+
+    for (pFile = pConfigStore; pFile != NULL; pFile = pFile->pNext) {
+        if (!strcmp(pFile->sPath, sPath))
+            return (pFile);
+    }
+
+    if ((pFile = EUCA_ZALLOC(1, sizeof(configStoreFile))) == NULL)
+        return (NULL);
+
+    euca_strncpy(pFile->sPath, sPath, EUCA_MAX_PATH);
+    pFile->pNext = pConfigStore;
+    pConfigStore = pFile;
+    return (pFile);
+}
+
+//!
+//! Makes sure the store reflects what is on disk for the given files. Each file is
+//! stat'ed and re-parsed only when its identity (device, inode, size, mtime or ctime)
+//! differs from when it was last parsed. Must be called with the configStoreMutex held.
+//!
+//! @param[in] asConfigFiles a list of configuration file path
+//! @param[in] numFiles the number of configuration files in the list
+//!
+static void config_store_refresh(char asConfigFiles[][EUCA_MAX_PATH], int numFiles)
+{
+    int i = 0;
+    struct stat statbuf = { 0 };
+    configStoreFile *pFile = NULL;
+
+    for (i = 0; i < numFiles; i++) {
+        if ((pFile = config_store_file(asConfigFiles[i])) == NULL)
+            continue;
+
+        if (stat(pFile->sPath, &statbuf) != 0) {
+            if (pFile->exists) {
+                config_store_clear(pFile);
+                pFile->exists = FALSE;
+            }
+            pFile->ino = 0;
+            continue;
+        }
+
+        if ((pFile->ino != 0) && (pFile->dev == statbuf.st_dev) && (pFile->ino == statbuf.st_ino) && (pFile->size == statbuf.st_size) &&
+            (pFile->mtime.tv_sec == statbuf.st_mtim.tv_sec) && (pFile->mtime.tv_nsec == statbuf.st_mtim.tv_nsec) &&
+            (pFile->ctime.tv_sec == statbuf.st_ctim.tv_sec) && (pFile->ctime.tv_nsec == statbuf.st_ctim.tv_nsec)) {
+            continue;
+        }
+
+        pFile->dev = statbuf.st_dev;
+        pFile->ino = statbuf.st_ino;
+        pFile->size = statbuf.st_size;
+        pFile->mtime = statbuf.st_mtim;
+        pFile->ctime = statbuf.st_ctim;
+        pFile->exists = ((config_store_parse(pFile) == EUCA_OK) ? TRUE : FALSE);
+        if (!pFile->exists) {
+            // force a new attempt on the next lookup
+            pFile->ino = 0;
+        }
+        LOGTRACE("parsed configuration file %s (%s)\n", pFile->sPath, (pFile->exists ? "ok" : "failed"));
+    }
+}
+
+//!
+//! Looks a key up in the store, with the getConfString() semantics: the first file holding
+//! a valid definition of the key wins and trailing spaces are trimmed. Must be called with
+//! the configStoreMutex held, after config_store_refresh().
+//!
+//! @param[in] asConfigFiles a list of configuration file path
+//! @param[in] numFiles the number of configuration files in the list
+//! @param[in] sKey the name of the key for which we're looking for its paired value
+//!
+//! @return a string copy of the value or NULL if not found
+//!
+static char *config_store_lookup(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey)
+{
+    int i = 0;
+    u32 bucket = 0;
+    char *sValue = NULL;
+    size_t len = 0;
+    configStoreFile *pFile = NULL;
+    configStoreEntry *pEntry = NULL;
+
+    bucket = config_store_hash(sKey);
+    for (i = 0; i < numFiles; i++) {
+        for (pFile = pConfigStore; ((pFile != NULL) && strcmp(pFile->sPath, asConfigFiles[i])); pFile = pFile->pNext) ;
+        if ((pFile == NULL) || !pFile->exists)
+            continue;
+
+        for (pEntry = pFile->apBuckets[bucket]; ((pEntry != NULL) && strcmp(pEntry->sKey, sKey)); pEntry = pEntry->pNext) ;
+        if ((pEntry == NULL) || (pEntry->sValue == NULL))
+            continue;
+
+        if ((sValue = strdup(pEntry->sValue)) != NULL) {
+            for (len = strlen(sValue); ((len > 0) && (sValue[len - 1] == ' ')); len--)
+                sValue[len - 1] = '\0';
+        }
+        return (sValue);
+    }
+    return (NULL);
+}
+
+//!
+//! Tells the registered listeners that a no-restart configuration value changed
+//!
+//! @param[in] sKey the key that changed
+//! @param[in] sOldValue the previous value (may be NULL)
+//! @param[in] sNewValue the new value (may be NULL)
+//!
+static void config_notify(const char *sKey, const char *sOldValue, const char *sNewValue)
+{
+    int i = 0;
+    int len = 0;
+    configListener *pListeners = NULL;
+
+    // work on a snapshot so that a callback may register another listener
+    pthread_mutex_lock(&configListenersMutex);
+    if ((configListenersLen > 0) && ((pListeners = EUCA_ALLOC(configListenersLen, sizeof(configListener))) != NULL)) {
+        memcpy(pListeners, aConfigListeners, (configListenersLen * sizeof(configListener)));
+        len = configListenersLen;
+    }
+    pthread_mutex_unlock(&configListenersMutex);
+
+    for (i = 0; i < len; i++) {
+        if ((pListeners[i].sKey == NULL) || !strcmp(pListeners[i].sKey, sKey)) {
+            pListeners[i].fnCallback(sKey, sOldValue, sNewValue, pListeners[i].pData);
+        }
+    }
+    EUCA_FREE(pListeners);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Writes a test configuration file
+//!
+//! @param[in] sPath the file path
+//! @param[in] sContent the file content
+//!
+static void config_test_write(const char *sPath, const char *sContent)
+{
+    FILE *f = fopen(sPath, "w");
+
+    assert(f != NULL);
+    assert(fputs(sContent, f) >= 0);
+    fclose(f);
+}
+
+//!
+//! Counts the change notifications received by the unit test
+//!
+//! @param[in] sKey the key that changed
+//! @param[in] sOldValue the previous value
+//! @param[in] sNewValue the new value
+//! @param[in] pData pointer to the notification counter
+//!
+static void config_test_listener(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData)
+{
+    char *sValue = NULL;
+
+    printf("changed %s: %s -> %s\n", sKey, SP(sOldValue), SP(sNewValue));
+    (*((int *)pData))++;
+
+    // listeners must be able to query the store
+    sValue = configFileValue(sKey);
+    assert((sValue != NULL) && (sNewValue != NULL) && !strcmp(sValue, sNewValue));
+    EUCA_FREE(sValue);
+}
+
+//!
+//! Refreshes a polling period through the typed getter, the way a daemon would
+//!
+//! @param[in] sKey the key that changed
+//! @param[in] sOldValue the previous value
+//! @param[in] sNewValue the new value
+//! @param[in] pData pointer to the polling period to refresh
+//!
+static void config_test_poll_listener(const char *sKey, const char *sOldValue, const char *sNewValue, void *pData)
+{
+    char asFiles[2][EUCA_MAX_PATH] = { "/tmp/euca-config-test-1.conf", "/tmp/euca-config-test-2.conf" };
+
+    if (!configStoreValueLong(asFiles, 2, sKey, ((long *)pData)))
+        (*((long *)pData)) = -1;
+}
+
+//!
+//! Main entry point of the application. Checks that the store gives the same answers as
+//! getConfString(), picks up file changes, notifies listeners and serves typed values, then times both lookups.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return Always return 0 or fail an assertion
+//!
+int main(int argc, char **argv)
+{
+    int i = 0;
+    int j = 0;
+    int rc = 0;
+    int notified = 0;
+    long l = 0;
+    long poll = 0;
+    boolean b = FALSE;
+    boolean found = FALSE;
+    char *s1 = NULL;
+    char *s2 = NULL;
+    char asFiles[2][EUCA_MAX_PATH] = { "/tmp/euca-config-test-1.conf", "/tmp/euca-config-test-2.conf" };
+    const char *asKeys[] = {
+        "PLAIN", "QUOTED", "SPACED", "COMMENTED", "EMPTY", "TRAILING", "BROKEN", "ONLY2", "DUP", "MISSING", "#HIDDEN", "PREFIX", "PREF", "LOGLEVEL", NULL
+    };
+    configEntry aRestart[] = { {"PLAIN", "x"}, {NULL, NULL} };
+    configEntry aNoRestart[] = { {"LOGLEVEL", "INFO"}, {"ONLY2", NULL}, {"POLL", "6"}, {NULL, NULL} };
+    struct timeval tv1 = { 0 };
+    struct timeval tv2 = { 0 };
+
+    logfile(NULL, EUCA_LOG_INFO, 4);
+
+    config_test_write(asFiles[0],
+                      "# comment\n"
+                      "PLAIN=value\n"
+                      "  QUOTED = \"two words \"  # trailing\n"
+                      "SPACED   =   spaced   \n"
+                      "COMMENTED=val#ue\n"
+                      "EMPTY=\n"
+                      "TRAILING=\"x   \"\n"
+                      "BROKEN=\"never closed\n"
+                      "#HIDDEN=1\n"
+                      "PREFIXED=1\n"
+                      "PREF IX=2\n"
+                      "DUP=first\n" "DUP=second\n" "LOGLEVEL=DEBUG\n" "POLL=6\n");
+    config_test_write(asFiles[1], "BROKEN=fixed\n" "ONLY2=\"2\"\n" "DUP=other\n" "PLAIN=hidden\n");
+
+    for (i = 0; asKeys[i] != NULL; i++) {
+        s1 = getConfString(asFiles, 2, (char *)asKeys[i]);
+        s2 = configStoreValue(asFiles, 2, asKeys[i]);
+        printf("%-10s getConfString=[%s] configStoreValue=[%s]\n", asKeys[i], SP(s1), SP(s2));
+        assert(((s1 == NULL) && (s2 == NULL)) || ((s1 != NULL) && (s2 != NULL) && !strcmp(s1, s2)));
+        EUCA_FREE(s1);
+        EUCA_FREE(s2);
+    }
+
+    found = configStoreValueLong(asFiles, 2, "ONLY2", &l);
+    assert(found && (l == 2));
+    found = configStoreValueLong(asFiles, 2, "PLAIN", &l);
+    assert(!found);
+    found = configStoreValueBoolean(asFiles, 2, "PLAIN", &b);
+    assert(!found);
+
+    configInitValues(aRestart, aNoRestart);
+    rc = configRegisterChangeCallback("LOGLEVEL", config_test_listener, &notified);
+    assert(rc == EUCA_OK);
+    rc = configRegisterChangeCallback("POLL", config_test_poll_listener, &poll);
+    assert(rc == EUCA_OK);
+    rc = readConfigFile(asFiles, 2);
+    assert(rc == 4);
+    assert((notified == 1) && (poll == 6));
+
+    // rewrite within the same second: inode/ctime/nsec still tell it changed
+    config_test_write(asFiles[0], "PLAIN=value\nLOGLEVEL=TRACE\nCOMMENTED=yes\nPOLL=10\n");
+    rc = readConfigFile(asFiles, 2);
+    assert(rc == 2);
+    assert(notified == 2);
+    assert(poll == 10);
+    found = configStoreValueBoolean(asFiles, 2, "COMMENTED", &b);
+    assert(found && b);
+    rc = readConfigFile(asFiles, 2);
+    assert(rc == 0);
+    assert((notified == 2) && (poll == 10));
+
+    unlink(asFiles[0]);
+    s1 = configStoreValue(asFiles, 2, "PLAIN");
+    assert((s1 != NULL) && !strcmp(s1, "hidden"));
+    EUCA_FREE(s1);
+
+    for (j = 0; j < 2; j++) {
+        gettimeofday(&tv1, NULL);
+        for (i = 0; i < 10000; i++) {
+            s1 = ((j == 0) ? getConfString(asFiles, 2, "DUP") : configStoreValue(asFiles, 2, "DUP"));
+            EUCA_FREE(s1);
+        }
+        gettimeofday(&tv2, NULL);
+        printf("%s: %.2f usec per lookup\n", ((j == 0) ? "getConfString" : "configStoreValue"),
+               ((tv2.tv_sec - tv1.tv_sec) * 1000000.0 + (tv2.tv_usec - tv1.tv_usec)) / 10000.0);
+    }
+
+    unlink(asFiles[1]);
+    printf("all tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
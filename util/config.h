@@ -91,6 +91,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Invoked by readConfigFile() when a no-restart value changes (either value may be NULL)
+typedef void (*configChangeCallback) (const char *sKey, const char *sOldValue, const char *sNewValue, void *pData);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -126,6 +129,10 @@ int isConfigModified(char asConfigFiles[][EUCA_MAX_PATH], u32 numFiles);
 char *configFileValue(const char *sKey);
 boolean configFileValueLong(const char *sKey, long *pVal);
 int readConfigFile(char asConfigFiles[][EUCA_MAX_PATH], int numFiles);
+char *configStoreValue(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey);
+boolean configStoreValueLong(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey, long *pVal);
+boolean configStoreValueBoolean(char asConfigFiles[][EUCA_MAX_PATH], int numFiles, const char *sKey, boolean * pVal);
+int configRegisterChangeCallback(const char *sKey, configChangeCallback fnCallback, void *pData);
 void configReadLogParams(int *pLogLevel, int *pLogRollNumber, long *pLogMaxSizeBytes, char **psLogPrefix);
 
 /*----------------------------------------------------------------------------*\
@@ -89,6 +89,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define INSTANCE_TABLE_MIN_SIZE                  16 //!< Initial number of entries in an instance table (doubles as needed)
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -284,6 +286,10 @@ const char *euca_error_names[] = {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static unsigned int instance_hash(const char *sInstanceId);
+static int instance_slot(const bunchOfInstances * pTable, const char *sInstanceId);
+static int resize_instances(bunchOfInstances * pTable, int size);
+static void unindex_instance(bunchOfInstances * pTable, int slot);
 static ncVolume *find_volume(ncInstance * pInstance, const char *sVolumeId);
 
 /*----------------------------------------------------------------------------*\
@@ -588,136 +594,235 @@ void free_instance(ncInstance ** ppInstance)
 }
 
 //!
-//! Adds an instance to an instance linked list
+//! Computes the hash of an instance identifier for the instance table index
+//!
+//! @param[in] sInstanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return the hash value
+//!
+static unsigned int instance_hash(const char *sInstanceId)
+{
+    unsigned int code = 5381;
+
+    for (const unsigned char *p = (const unsigned char *)sInstanceId; *p; p++) {
+        code = ((code << 5) + code) + *p;
+    }
+    return (code);
+}
+
+//!
+//! Finds the index slot of an instance identifier in an instance table. This is either
+//! the slot referring to the instance or, if the instance is not in the table, the
+//! empty slot where it would be placed.
+//!
+//! @param[in] pTable a pointer to the instance table
+//! @param[in] sInstanceId the instance identifier string (i-XXXXXXXX)
+//!
+//! @return the slot number in the hash index
+//!
+//! @pre The index must have at least one free slot, which holds as it is twice the size of the array.
+//!
+static int instance_slot(const bunchOfInstances * pTable, const char *sInstanceId)
+{
+    int pos = 0;
+    int mask = pTable->indexSize - 1;
+    int slot = instance_hash(sInstanceId) & mask;
+
+    while ((pos = pTable->index[slot]) != -1) {
+        if (!strcmp(pTable->instances[pos]->instanceId, sInstanceId))
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return (slot);
+}
+
+//!
+//! Grows the instance array of a table to the given number of entries and rebuilds
+//! the hash index to match.
+//!
+//! @param[in,out] pTable a pointer to the instance table
+//! @param[in]     size the new number of entries in the array
+//!
+//! @return EUCA_OK on success or EUCA_MEMORY_ERROR if we fail to allocate memory. On
+//!         failure, the table is left as it was.
+//!
+static int resize_instances(bunchOfInstances * pTable, int size)
+{
+    int i = 0;
+    int *paIndex = NULL;
+    ncInstance **paInstances = NULL;
+
+    if ((paInstances = EUCA_REALLOC(pTable->instances, size, sizeof(ncInstance *))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    pTable->instances = paInstances;
+
+    if ((paIndex = EUCA_ALLOC((2 * size), sizeof(int))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+    memset(paIndex, -1, (2 * size * sizeof(int)));
+
+    EUCA_FREE(pTable->index);
+    pTable->index = paIndex;
+    pTable->indexSize = 2 * size;
+    pTable->size = size;
+
+    for (i = 0; i < pTable->count; i++) {
+        pTable->index[instance_slot(pTable, pTable->instances[i]->instanceId)] = i;
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Clears a slot of the hash index, moving back any following entries of the same
+//! probe sequence so that lookups keep finding them.
+//!
+//! @param[in,out] pTable a pointer to the instance table
+//! @param[in]     slot the slot to clear
+//!
+static void unindex_instance(bunchOfInstances * pTable, int slot)
+{
+    int pos = 0;
+    int home = 0;
+    int next = slot;
+    int mask = pTable->indexSize - 1;
+
+    pTable->index[slot] = -1;
+    for (next = (slot + 1) & mask; (pos = pTable->index[next]) != -1; next = (next + 1) & mask) {
+        home = instance_hash(pTable->instances[pos]->instanceId) & mask;
+
+        // the entry can fill the hole unless its home slot lies cyclically within (slot, next]
+        if ((slot < next) ? ((home <= slot) || (home > next)) : ((home <= slot) && (home > next))) {
+            pTable->index[slot] = pos;
+            pTable->index[next] = -1;
+            slot = next;
+        }
+    }
+}
+
+//!
+//! Adds an instance to an instance table
 //!
-//! @param[in,out] ppHead a pointer to the pointer to the head of the list
-//! @param[in]     pInstance a pointer to the instance to add to the list
+//! @param[in,out] ppHead a pointer to the pointer to the table
+//! @param[in]     pInstance a pointer to the instance to add to the table
 //!
 //! @return EUCA_OK on success or the following error code:
 //!         \li EUCA_MEMORY_ERROR: if we fail to allocate memory
 //!         \li EUCA_INVALID_ERROR: if any of our parameter does not meet the pre-condition
-//!         \li EUCA_DUPLICATE_ERROR: if the instance is already part of this list
+//!         \li EUCA_DUPLICATE_ERROR: if the instance is already part of this table
 //!
 //! @pre \li Both \p ppHead and \p pInstance field must not be NULL.
-//!      \li The instance must not be part of the list
+//!      \li The instance must not be part of the table
 //!
-//! @post The instance is added to the list. If this is the first instance in the list,
-//!       the \p ppHead value is updated to point to this instance.
+//! @post The instance is added to the table. If this is the first instance in the table,
+//!       the table is allocated and \p ppHead is updated to point to it.
 //!
 int add_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 {
-    bunchOfInstances *pNew = NULL;
-    bunchOfInstances *pLast = NULL;
-    bunchOfInstances *pNext = NULL;
+    int slot = 0;
+    bunchOfInstances *pTable = NULL;
 
     // Make sure our paramters are valid
     if ((ppHead == NULL) || (pInstance == NULL))
         return (EUCA_INVALID_ERROR);
 
-    // Try to allocate memory for our instance list node
-    if ((pNew = EUCA_ZALLOC(1, sizeof(bunchOfInstances))) == NULL)
-        return (EUCA_MEMORY_ERROR);
+    // Are we the first item in this table?
+    if ((pTable = *ppHead) == NULL) {
+        if ((pTable = EUCA_ZALLOC(1, sizeof(bunchOfInstances))) == NULL)
+            return (EUCA_MEMORY_ERROR);
 
-    // Initialize our node
-    pNew->instance = pInstance;
-    pNew->next = NULL;
-
-    // Are we the first item in this list?
-    if (*ppHead == NULL) {
-        *ppHead = pNew;
-        (*ppHead)->count = 1;
-    } else {
-        pNext = *ppHead;
+        if (resize_instances(pTable, INSTANCE_TABLE_MIN_SIZE) != EUCA_OK) {
+            free_instances(&pTable);
+            return (EUCA_MEMORY_ERROR);
+        }
+        *ppHead = pTable;
+    }
 
-        //
-        // Process the list to make sure we're not trying to add a duplicate
-        //
-        do {
-            pLast = pNext;
-            if (!strcmp(pLast->instance->instanceId, pInstance->instanceId)) {
-                EUCA_FREE(pNew);
-                return (EUCA_DUPLICATE_ERROR);
-            }
-            pNext = pLast->next;
-        } while (pLast->next);
+    slot = instance_slot(pTable, pInstance->instanceId);
+    if (pTable->index[slot] != -1)
+        return (EUCA_DUPLICATE_ERROR);
 
-        // We're at the end so add it there.
-        pLast->next = pNew;
-        (*ppHead)->count++;
+    if (pTable->count == pTable->size) {
+        if (resize_instances(pTable, (2 * pTable->size)) != EUCA_OK)
+            return (EUCA_MEMORY_ERROR);
+        slot = instance_slot(pTable, pInstance->instanceId);
     }
 
+    pTable->instances[pTable->count] = pInstance;
+    pTable->index[slot] = pTable->count;
+    pTable->count++;
     return (EUCA_OK);
 }
 
 //!
-//! Removes an instance from an instance linked list
+//! Removes an instance from an instance table. The last instance of the array takes
+//! the place of the removed one, so the order of the remaining instances may change.
 //!
-//! @param[in,out] ppHead a pointer to the pointer to the head of the list
-//! @param[in]     pInstance a pointer to the instance to remove from the list
+//! @param[in,out] ppHead a pointer to the pointer to the table
+//! @param[in]     pInstance a pointer to the instance to remove from the table
 //!
 //! @return EUCA_OK on success or the following error code:
 //!         \li EUCA_INVALID_ERROR: if any of our parameters do not meet the pre-conditions
-//!         \li EUCA_NOT_FOUND_ERROR: if the instance is not part of this list
+//!         \li EUCA_NOT_FOUND_ERROR: if the instance is not part of this table
 //!
 //! @pre \li Both \p ppHead and \p pInstance field must not be NULL
-//!      \li The instance must exist in this list
+//!      \li The instance must exist in this table
 //!
-//! @post The instance is removed from the list. If this instance was the head of the list,
-//!       the \p ppHead field will be updated to point to the new head (next instance in list
-//!       from previous head).
+//! @post The instance is removed from the table. If this was the last instance in the
+//!       table, the table is freed and \p ppHead is set to NULL.
 //!
 int remove_instance(bunchOfInstances ** ppHead, ncInstance * pInstance)
 {
-    u32 count = 0;
-    bunchOfInstances *pHead = NULL;
-    bunchOfInstances *pPrevious = NULL;
+    int pos = 0;
+    int last = 0;
+    int slot = 0;
+    bunchOfInstances *pTable = NULL;
 
     // Make sure our parameters are valid
-    if (ppHead && pInstance) {
-        for (pHead = *ppHead; pHead; pPrevious = pHead, pHead = pHead->next) {
-            count = (*ppHead)->count;
-
-            if (!strcmp(pHead->instance->instanceId, pInstance->instanceId)) {
-                if (pPrevious) {
-                    pPrevious->next = pHead->next;
-                } else {
-                    *ppHead = pHead->next;
-                }
-
-                if (*ppHead) {
-                    (*ppHead)->count = count - 1;
-                }
-                EUCA_FREE(pHead);
-                return (EUCA_OK);
-            }
-        }
+    if ((ppHead == NULL) || (pInstance == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if ((pTable = *ppHead) == NULL)
         return (EUCA_NOT_FOUND_ERROR);
+
+    slot = instance_slot(pTable, pInstance->instanceId);
+    if ((pos = pTable->index[slot]) == -1)
+        return (EUCA_NOT_FOUND_ERROR);
+
+    unindex_instance(pTable, slot);
+    last = --pTable->count;
+    if (pos != last) {
+        pTable->instances[pos] = pTable->instances[last];
+        pTable->index[instance_slot(pTable, pTable->instances[pos]->instanceId)] = pos;
     }
-    return (EUCA_INVALID_ERROR);
+    pTable->instances[last] = NULL;
+
+    if (pTable->count == 0)
+        free_instances(ppHead);
+    return (EUCA_OK);
 }
 
 //!
-//! Helper to do something on each instance of a given list
+//! Helper to do something on each instance of a given table
 //!
-//! @param[in] ppHead a pointer to the pointer to the head of the list
-//! @param[in] pFunction a pointer to the function to execute on each node
+//! @param[in] ppHead a pointer to the pointer to the table
+//! @param[in] pFunction a pointer to the function to execute on each instance
 //! @param[in] pParam a transparent pointer to provide to pFunction
 //!
 //! @return EUCA_OK on success or the following error code:
 //!         \li EUCA_INVALID_ERROR: if any of our parameters do not meet the pre-conditions
 //!
-//! @pre Both \p ppHead and \p pFunction fields must not be NULL
+//! @pre Both \p ppHead and \p pFunction fields must not be NULL. \p pFunction must not
+//!      add or remove instances.
 //!
-//! @post The function \p pFunction is applied to each member of the instance list.
+//! @post The function \p pFunction is applied to each member of the instance table.
 //!
 int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInstances **, ncInstance *, void *), void *pParam)
 {
-    bunchOfInstances *pHead = NULL;
+    int i = 0;
 
     // Make sure our parameters aren't NULL
     if (ppHead && pFunction) {
-        for (pHead = *ppHead; pHead; pHead = pHead->next) {
-            pFunction(ppHead, pHead->instance, pParam);
+        for (i = 0; i < total_instances(ppHead); i++) {
+            pFunction(ppHead, (*ppHead)->instances[i], pParam);
         }
 
         return (EUCA_OK);
@@ -726,9 +831,9 @@ int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInst
 }
 
 //!
-//! Finds an instance in a given list based on the given instance identifier
+//! Finds an instance in a given table based on the given instance identifier
 //!
-//! @param[in] ppHead a pointer to the pointer to the head of the list
+//! @param[in] ppHead a pointer to the pointer to the table
 //! @param[in] sInstanceId the instance identifier string (i-XXXXXXXX)
 //!
 //! @return a pointer to the instance if found. Otherwise, NULL is returned.
@@ -737,52 +842,44 @@ int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInst
 //!
 ncInstance *find_instance(bunchOfInstances ** ppHead, const char *sInstanceId)
 {
-    bunchOfInstances *pHead = NULL;
+    int pos = 0;
 
     // Make sure our parameters aren't NULL
-    if (ppHead && sInstanceId) {
-        for (pHead = *ppHead; pHead; pHead = pHead->next) {
-            if (!strcmp(pHead->instance->instanceId, sInstanceId)) {
-                return (pHead->instance);
-            }
+    if (ppHead && (*ppHead) && sInstanceId) {
+        if ((pos = (*ppHead)->index[instance_slot((*ppHead), sInstanceId)]) != -1) {
+            return ((*ppHead)->instances[pos]);
         }
     }
     return (NULL);
 }
 
 //!
-//! Retrieves the next instance in the list
+//! Retrieves the next instance in the table
 //!
-//! @param[in] ppHead a pointer to the pointer to the head of the list
+//! @param[in] ppHead a pointer to the pointer to the table
 //!
-//! @return a pointer ot the next instance in the list or NULL if no list is set
+//! @return a pointer ot the next instance in the table or NULL once all instances were returned
 //!
-//! @pre The \p ppHead field must not be NULL if the static list pointer is NULL.
+//! @note The position is kept in a static cursor, so this is not safe for concurrent use.
 //!
 ncInstance *get_instance(bunchOfInstances ** ppHead)
 {
-    static bunchOfInstances *pCurrent = NULL;
+    static int current = -1;
 
-    // advance static variable, wrapping to head if at the end
-    if (pCurrent == NULL)
-        pCurrent = ((ppHead == NULL) ? NULL : (*ppHead));
-    else
-        pCurrent = pCurrent->next;
-
-    // return the new value, if any
-    if (pCurrent == NULL)
+    // advance static cursor, wrapping to the start if at the end
+    if (++current >= total_instances(ppHead)) {
+        current = -1;
         return (NULL);
-    return (pCurrent->instance);
+    }
+    return ((*ppHead)->instances[current]);
 }
 
 //!
-//! Returns the number of instances assigned to a given instance list
+//! Returns the number of instances assigned to a given instance table
 //!
-//! @param[in] ppHead a pointer to the pointer to the head of the list
+//! @param[in] ppHead a pointer to the pointer to the table
 //!
-//! @return number of instances in the list. If \p ppHead is NULL or \p (*ppHead) is NULL, 0 will be returned.
-//!
-//! @pre The \p ppHead field must not be NULL
+//! @return number of instances in the table. If \p ppHead is NULL or \p (*ppHead) is NULL, 0 will be returned.
 //!
 int total_instances(bunchOfInstances ** ppHead)
 {
@@ -793,6 +890,22 @@ int total_instances(bunchOfInstances ** ppHead)
     return (0);
 }
 
+//!
+//! Frees an instance table. The instances it refers to are left alone.
+//!
+//! @param[in,out] ppHead a pointer to the pointer to the table
+//!
+//! @post The table is freed and \p (*ppHead) is set to NULL.
+//!
+void free_instances(bunchOfInstances ** ppHead)
+{
+    if (ppHead && (*ppHead)) {
+        EUCA_FREE((*ppHead)->instances);
+        EUCA_FREE((*ppHead)->index);
+        EUCA_FREE((*ppHead));
+    }
+}
+
 //!
 //! Allocate and initialize a resource structure with given information. Resource is
 //! used to return information about resources
@@ -468,12 +468,14 @@ typedef struct ncResource_t {
     char hypervisor[CHAR_BUFFER_SIZE]; //!< Node hypervisor
 } ncResource;
 
-//! Instance list node structure
-//! @todo make this into something smarter than a linked list
+//! Instance table structure. Instances are kept in a dense array for iteration
+//! and indexed by instance identifier in an open-addressed hash table.
 typedef struct bunchOfInstances_t {
-    ncInstance *instance;              //!< Pointer to this node's assigned instance
-    int count;                         //!< Number of instances in the list. Only valid on first node.
-    struct bunchOfInstances_t *next;   //!< Pointer to our next node.
+    ncInstance **instances;            //!< Dense array of the instances in the table, in no particular order
+    int count;                         //!< Number of instances in the table
+    int size;                          //!< Number of allocated entries in the instances array
+    int *index;                        //!< Hash index on instanceId holding positions in the instances array (-1 if unused)
+    int indexSize;                     //!< Number of slots in the hash index (power of two, twice the array size)
 } bunchOfInstances;
 
 /*----------------------------------------------------------------------------*\
@@ -535,6 +537,7 @@ int for_each_instance(bunchOfInstances ** ppHead, void (*pFunction) (bunchOfInst
 ncInstance *find_instance(bunchOfInstances ** ppHead, const char *instanceId);
 ncInstance *get_instance(bunchOfInstances ** ppHead);
 int total_instances(bunchOfInstances ** ppHead);
+void free_instances(bunchOfInstances ** ppHead);
 //! @}
 
 //! @{
@@ -67,6 +67,10 @@
 //! @file util/euca_auth.c
 //! Need to provide description
 //!
+//! Key and certificate files are parsed once into an EVP_PKEY and kept in a small
+//! cache along with reusable OpenSSL contexts. A cached key is reloaded when its
+//! file changes on disk, so key rotation does not require a restart.
+//!
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -84,6 +88,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <string.h>
+#include <time.h>
 #include <openssl/sha.h>
 #include <openssl/rsa.h>
 #include <openssl/pem.h>
@@ -97,6 +102,12 @@
 #include <regex.h>
 #include <arpa/inet.h>
 
+// the vectorized base64 and hex codecs are built per function for SSSE3 and AVX2 and picked at run time
+#if defined(__GNUC__) && ((__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))) && (defined(__x86_64__) || defined(__i386__))
+#define CODEC_SIMD_X86
+#include <immintrin.h>
+#endif /* __GNUC__ >= 4.9 && x86 */
+
 #include "eucalyptus.h"
 #include "misc.h"
 #include "euca_auth.h"
@@ -129,6 +140,29 @@
 #define MAX_DECRYPTED_STRING_LEN                8192
 #endif /* ! MAX_DECRYPTED_STRING_LEN */
 
+//! @{
+//! @name Vector units used by the base64 and hex codecs
+#define CODEC_SIMD_NONE                          0  //!< portable scalar code only
+#define CODEC_SIMD_SSSE3                         1  //!< 16 bytes at a time
+#define CODEC_SIMD_AVX2                          2  //!< 32 bytes at a time
+//! @}
+
+#define BASE64_ENC_LEN(_size)                    ((((_size) + 2) / 3) * 4)  //!< encoded length of _size bytes, with padding
+#define BASE64_DEC_SLACK                         8  //!< bytes the vector decoders may store past the decoded data
+#define BASE64_SPACE                            -2  //!< base64_values entry for whitespace, which decoding skips
+
+#define KEY_CACHE_SIZE                             8    //!< Maximum number of key and certificate files kept parsed
+
+//! @{
+//! @name OpenSSL 1.1 context API names, mapped for the 1.0 series
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new()                         EVP_MD_CTX_create()
+#define EVP_MD_CTX_free(_ctx)                    EVP_MD_CTX_destroy((_ctx))
+#define EVP_MD_CTX_reset(_ctx)                   EVP_MD_CTX_cleanup((_ctx))
+#define EVP_CIPHER_CTX_reset(_ctx)               EVP_CIPHER_CTX_cleanup((_ctx))
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -147,6 +181,31 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! A parsed key or certificate, shared by the key cache and every caller using it
+typedef struct cached_key_t {
+    EVP_PKEY *key;                     //!< the private key, or the public key of the certificate
+    char *fingerprint;                 //!< fingerprint of the certificate, certificates only
+    int refs;                          //!< references held by the cache and by callers (under key_cache_mutex)
+} cached_key;
+
+//! A key or certificate file kept parsed, reloaded when the file changes on disk
+typedef struct key_cache_entry_t {
+    char path[FILENAME];               //!< the key or certificate file
+    boolean is_cert;                   //!< TRUE for an X509 certificate, FALSE for a private key
+    dev_t dev;                         //!< device of the file when it was loaded
+    ino_t ino;                         //!< inode of the file when it was loaded
+    off_t size;                        //!< size of the file when it was loaded
+    struct timespec mtime;             //!< modification time of the file when it was loaded
+    u64 last_used;                     //!< key_cache_clock value of the last lookup, for LRU eviction
+    cached_key *ck;                    //!< the parsed key, the cache holds one reference on it
+} key_cache_entry;
+
+//! Reusable OpenSSL contexts of one thread, see get_thread_ctx()
+typedef struct auth_thread_ctx_t {
+    EVP_CIPHER_CTX *cipher_ctx;        //!< symmetric cipher context
+    EVP_MD_CTX *md_ctx;                //!< signing context
+} auth_thread_ctx;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -174,6 +233,28 @@ static char sCloudCertFileName[FILENAME] = "";  //!< Cloud public cert file name
 
 static char hex_digits[16] = { '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
 
+static const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+//! 6-bit value of each base64 character, BASE64_SPACE for whitespace and -1 for anything that ends the data
+static const s8 base64_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -2, -2, -1, -1, -2, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -2, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
 static regex_t *uri_regex = NULL;
 
 //! Mutex to guard initialization and compile of the uri_regex
@@ -185,6 +266,21 @@ static const char *url_pattern = "([^:?&]+://)([^:/?&]+)(:([0-9]+)?)?(/[^?&=]*)?
 //! Mutex to guard certificate and ssl init to enforce the function as a singleton.
 static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+//! Parsed keys and certificates, see key_cache_acquire()
+static key_cache_entry key_cache[KEY_CACHE_SIZE];
+static int key_cache_used = 0;         //!< number of key_cache slots in use
+static u64 key_cache_clock = 0;        //!< lookup counter stamped on entries for LRU eviction
+static pthread_mutex_t key_cache_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< guards key_cache and the cached_key reference counts
+
+//! Per-thread reusable OpenSSL contexts, see get_thread_ctx()
+static pthread_key_t thread_ctx_key;
+static pthread_once_t thread_ctx_once = PTHREAD_ONCE_INIT;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+//! Locks OpenSSL 1.0 needs to be used from several threads, see openssl_locking()
+static pthread_mutex_t *openssl_locks = NULL;
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -194,6 +290,21 @@ static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int compare_keys(const void *arg0, const void *arg1);
 static int count_query_params(const char *query_str);
 static void init_url_regex(void);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static void openssl_locking(int mode, int n, const char *file, int line);
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+static cached_key *key_load(const char *path, boolean is_cert);
+static cached_key *key_cache_acquire(const char *path, boolean is_cert);
+static void key_cache_release(cached_key * ck);
+static EVP_PKEY_CTX *key_pkey_ctx(cached_key * ck, boolean encrypt);
+static u8 *key_sign(cached_key * ck, const EVP_MD * md, const char *data, size_t data_len, size_t * sig_len);
+static void thread_ctx_free(void *ptr);
+static void thread_ctx_key_init(void);
+static auth_thread_ctx *get_thread_ctx(void);
+static EVP_CIPHER_CTX *get_cipher_ctx(void);
+static int codec_simd_level(void);
+static size_t base64_encode(char *dst, const u8 * src, size_t size);
+static int base64_decode(u8 * dst, const u8 * src, size_t size);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -273,6 +384,15 @@ int euca_init_cert(void)
         pthread_mutex_unlock(&init_mutex);
         return (EUCA_ERROR);
     }
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+    // cached keys are used by several threads at once, which OpenSSL 1.0 only supports with locking
+    // callbacks in place. Keep those of the application if it installed any.
+    if ((CRYPTO_get_locking_callback() == NULL) && ((openssl_locks = EUCA_ZALLOC(CRYPTO_num_locks(), sizeof(pthread_mutex_t))) != NULL)) {
+        for (fd = 0; fd < CRYPTO_num_locks(); fd++)
+            pthread_mutex_init(&(openssl_locks[fd]), NULL);
+        CRYPTO_set_locking_callback(openssl_locking);
+    }
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
     initialized = TRUE;
     pthread_mutex_unlock(&init_mutex);
@@ -283,6 +403,345 @@ int euca_init_cert(void)
 #undef CHK_FILE
 }
 
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+//!
+//! Locking callback installed for OpenSSL 1.0 by euca_init_cert()
+//!
+//! @param[in] mode CRYPTO_LOCK to take the lock, anything else to release it
+//! @param[in] n    the index of the lock
+//! @param[in] file unused
+//! @param[in] line unused
+//!
+static void openssl_locking(int mode, int n, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK)
+        pthread_mutex_lock(&(openssl_locks[n]));
+    else
+        pthread_mutex_unlock(&(openssl_locks[n]));
+}
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
+//!
+//! Parses a key or certificate file. Certificates must carry a 1024, 2048 or 4096 bit RSA
+//! key and private keys must be RSA.
+//!
+//! @param[in] path    the private key or certificate file, PEM encoded
+//! @param[in] is_cert TRUE if path is an X509 certificate, FALSE for a private key
+//!
+//! @return the parsed key holding one reference for the caller, or NULL on failure
+//!
+static cached_key *key_load(const char *path, boolean is_cert)
+{
+    int key_bits = -1;
+    FILE *fp = NULL;
+    X509 *cert = NULL;
+    EVP_PKEY *key = NULL;
+    cached_key *ck = NULL;
+
+    if ((fp = fopen(path, "r")) == NULL) {
+        LOGERROR("cannot open key file: open failed on %s\n", path);
+        return (NULL);
+    }
+
+    if (is_cert) {
+        if ((cert = PEM_read_X509(fp, NULL, NULL, NULL)) == NULL) {
+            LOGERROR("error loading cert %s into memory\n", path);
+        } else if ((key = X509_get_pubkey(cert)) == NULL) {
+            LOGERROR("error getting pub key from %s\n", path);
+        }
+        if (cert != NULL)
+            X509_free(cert);
+    } else if ((key = PEM_read_PrivateKey(fp, NULL, NULL, NULL)) == NULL) {
+        LOGERROR("private key file %s read failed\n", path);
+    }
+    fclose(fp);
+
+    if (key == NULL)
+        return (NULL);
+
+    if (EVP_PKEY_id(key) != EVP_PKEY_RSA) {
+        LOGERROR("invalid non-RSA key found in %s. Only RSA supported.\n", path);
+        goto error;
+    }
+
+    key_bits = EVP_PKEY_bits(key);
+    if (is_cert && (key_bits != 1024) && (key_bits != 2048) && (key_bits != 4096)) {
+        LOGERROR("invalid RSA key length found in %s. Requires 1024, 2048, or 4096. Found %d\n", path, key_bits);
+        goto error;
+    }
+
+    if ((ck = EUCA_ZALLOC(1, sizeof(cached_key))) == NULL) {
+        LOGERROR("out of memory\n");
+        goto error;
+    }
+
+    if (is_cert && ((ck->fingerprint = calc_fingerprint(path)) == NULL)) {
+        LOGERROR("failed to calculate certificate fingerprint for %s\n", path);
+        EUCA_FREE(ck);
+        goto error;
+    }
+
+    ck->key = key;
+    ck->refs = 1;
+    LOGDEBUG("loaded %d bit RSA %s from %s\n", key_bits, (is_cert ? "certificate" : "private key"), path);
+    return (ck);
+
+error:
+    EVP_PKEY_free(key);
+    return (NULL);
+}
+
+//!
+//! Looks up a key or certificate in the key cache, parsing it on first use and again
+//! whenever the file on disk has changed since it was loaded. When the cache is full,
+//! the least recently used entry makes room; callers still using its key keep it alive
+//! through their reference.
+//!
+//! @param[in] path    the private key or certificate file, PEM encoded
+//! @param[in] is_cert TRUE if path is an X509 certificate, FALSE for a private key
+//!
+//! @return a reference on the parsed key, to be given back with key_cache_release(), or NULL on failure
+//!
+//! @note The parsed key is only read once loaded, so callers use it concurrently without
+//!       holding any lock, each with its own per-thread contexts.
+//!
+static cached_key *key_cache_acquire(const char *path, boolean is_cert)
+{
+    int i = 0;
+    struct stat st = { 0 };
+    cached_key *ck = NULL;
+    cached_key *old = NULL;
+    key_cache_entry *entry = NULL;
+
+    if ((path == NULL) || (*path == '\0'))
+        return (NULL);
+
+    if (stat(path, &st) != 0) {
+        LOGERROR("cannot stat key file %s\n", path);
+        return (NULL);
+    }
+
+    pthread_mutex_lock(&key_cache_mutex);
+    {
+        for (i = 0; i < key_cache_used; i++) {
+            entry = &(key_cache[i]);
+            if ((entry->is_cert == is_cert) && !strcmp(entry->path, path) && (entry->dev == st.st_dev) && (entry->ino == st.st_ino) &&
+                (entry->size == st.st_size) && (entry->mtime.tv_sec == st.st_mtim.tv_sec) && (entry->mtime.tv_nsec == st.st_mtim.tv_nsec)) {
+                ck = entry->ck;
+                ck->refs++;
+                entry->last_used = ++key_cache_clock;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&key_cache_mutex);
+
+    if (ck != NULL)
+        return (ck);
+
+    // parse outside of the lock, a slow load must not hold up users of other keys
+    if ((ck = key_load(path, is_cert)) == NULL)
+        return (NULL);
+
+    pthread_mutex_lock(&key_cache_mutex);
+    {
+        // reuse the entry of this file, else a free slot, else the least recently used entry
+        for (i = 0, entry = NULL; i < key_cache_used; i++) {
+            if ((key_cache[i].is_cert == is_cert) && !strcmp(key_cache[i].path, path)) {
+                entry = &(key_cache[i]);
+                break;
+            }
+        }
+
+        if ((entry == NULL) && (key_cache_used < KEY_CACHE_SIZE)) {
+            entry = &(key_cache[key_cache_used++]);
+        } else if (entry == NULL) {
+            for (i = 0, entry = &(key_cache[0]); i < key_cache_used; i++) {
+                if (key_cache[i].last_used < entry->last_used)
+                    entry = &(key_cache[i]);
+            }
+            LOGDEBUG("evicting %s from the key cache for %s\n", entry->path, path);
+        }
+
+        if ((old = entry->ck) != NULL) {
+            if (--old->refs > 0)
+                old = NULL;            // still in use, its last user frees it
+        }
+
+        snprintf(entry->path, FILENAME, "%s", path);
+        entry->is_cert = is_cert;
+        entry->dev = st.st_dev;
+        entry->ino = st.st_ino;
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtim;
+        entry->last_used = ++key_cache_clock;
+        entry->ck = ck;
+        ck->refs++;                    // the cache's own reference
+    }
+    pthread_mutex_unlock(&key_cache_mutex);
+
+    if (old != NULL) {
+        EVP_PKEY_free(old->key);
+        EUCA_FREE(old->fingerprint);
+        EUCA_FREE(old);
+    }
+    return (ck);
+}
+
+//!
+//! Gives back a reference obtained from key_cache_acquire()
+//!
+//! @param[in] ck the key to release, may be NULL
+//!
+static void key_cache_release(cached_key * ck)
+{
+    boolean last = FALSE;
+
+    if (ck == NULL)
+        return;
+
+    pthread_mutex_lock(&key_cache_mutex);
+    {
+        last = (--ck->refs == 0);
+    }
+    pthread_mutex_unlock(&key_cache_mutex);
+
+    if (last) {
+        EVP_PKEY_free(ck->key);
+        EUCA_FREE(ck->fingerprint);
+        EUCA_FREE(ck);
+    }
+}
+
+//!
+//! Prepares an RSA PKCS#1 v1.5 encryption or decryption context for a cached key
+//!
+//! @param[in] ck      the key
+//! @param[in] encrypt TRUE for encryption with a public key, FALSE for decryption with a private key
+//!
+//! @return the context, which the caller must free with EVP_PKEY_CTX_free(), or NULL on failure
+//!
+static EVP_PKEY_CTX *key_pkey_ctx(cached_key * ck, boolean encrypt)
+{
+    EVP_PKEY_CTX *pkey_ctx = NULL;
+
+    if ((pkey_ctx = EVP_PKEY_CTX_new(ck->key, NULL)) == NULL) {
+        LOGERROR("cannot allocate key context\n");
+        return (NULL);
+    }
+
+    if (((encrypt ? EVP_PKEY_encrypt_init(pkey_ctx) : EVP_PKEY_decrypt_init(pkey_ctx)) <= 0) || (EVP_PKEY_CTX_set_rsa_padding(pkey_ctx, RSA_PKCS1_PADDING) <= 0)) {
+        LOGERROR("cannot initialize key context\n");
+        EVP_PKEY_CTX_free(pkey_ctx);
+        return (NULL);
+    }
+    return (pkey_ctx);
+}
+
+//!
+//! Digests and signs data with a cached private key (RSA PKCS#1 v1.5), reusing the
+//! signing context of the calling thread.
+//!
+//! @param[in]  ck       the private key
+//! @param[in]  md       the digest to use
+//! @param[in]  data     the data to sign
+//! @param[in]  data_len the length of data
+//! @param[out] sig_len  the length of the returned signature
+//!
+//! @return the signature, which the caller must free, or NULL on failure
+//!
+static u8 *key_sign(cached_key * ck, const EVP_MD * md, const char *data, size_t data_len, size_t * sig_len)
+{
+    u8 *sig = NULL;
+    auth_thread_ctx *tctx = NULL;
+
+    if ((tctx = get_thread_ctx()) == NULL) {
+        LOGERROR("cannot allocate signing context\n");
+        return (NULL);
+    }
+
+    EVP_MD_CTX_reset(tctx->md_ctx);
+    if ((EVP_DigestSignInit(tctx->md_ctx, NULL, md, NULL, ck->key) <= 0) || (EVP_DigestSignUpdate(tctx->md_ctx, data, data_len) <= 0)) {
+        LOGERROR("cannot initialize signature\n");
+        goto done;
+    }
+
+    *sig_len = EVP_PKEY_size(ck->key);
+    if ((sig = EUCA_ZALLOC(*sig_len, sizeof(u8))) == NULL) {
+        LOGERROR("out of memory (for RSA key)\n");
+        goto done;
+    }
+
+    if (EVP_DigestSignFinal(tctx->md_ctx, sig, sig_len) <= 0) {
+        LOGERROR("signing failed\n");
+        EUCA_FREE(sig);
+    }
+
+done:
+    EVP_MD_CTX_reset(tctx->md_ctx);    // drops the key reference held by the context
+    return (sig);
+}
+
+//!
+//! Frees the OpenSSL contexts of a thread when it exits
+//!
+//! @param[in] ptr the thread's auth_thread_ctx
+//!
+static void thread_ctx_free(void *ptr)
+{
+    auth_thread_ctx *tctx = ((auth_thread_ctx *) ptr);
+
+    if (tctx->cipher_ctx != NULL)
+        EVP_CIPHER_CTX_free(tctx->cipher_ctx);
+    if (tctx->md_ctx != NULL)
+        EVP_MD_CTX_free(tctx->md_ctx);
+    EUCA_FREE(tctx);
+}
+
+//!
+//! Creates the thread-specific key holding the per-thread OpenSSL contexts
+//!
+static void thread_ctx_key_init(void)
+{
+    pthread_key_create(&thread_ctx_key, thread_ctx_free);
+}
+
+//!
+//! Retrieves the reusable OpenSSL contexts of the calling thread, allocated on first use.
+//! Callers reset a context when done with it, which also wipes keys it may hold.
+//!
+//! @return the contexts of the calling thread or NULL if they cannot be allocated
+//!
+static auth_thread_ctx *get_thread_ctx(void)
+{
+    auth_thread_ctx *tctx = NULL;
+
+    pthread_once(&thread_ctx_once, thread_ctx_key_init);
+    if ((tctx = pthread_getspecific(thread_ctx_key)) != NULL)
+        return (tctx);
+
+    if ((tctx = EUCA_ZALLOC(1, sizeof(auth_thread_ctx))) == NULL)
+        return (NULL);
+
+    if (((tctx->cipher_ctx = EVP_CIPHER_CTX_new()) == NULL) || ((tctx->md_ctx = EVP_MD_CTX_new()) == NULL) || (pthread_setspecific(thread_ctx_key, tctx) != 0)) {
+        thread_ctx_free(tctx);
+        return (NULL);
+    }
+    return (tctx);
+}
+
+//!
+//! Retrieves the symmetric cipher context of the calling thread
+//!
+//! @return the cipher context of the calling thread or NULL if it cannot be allocated
+//!
+static EVP_CIPHER_CTX *get_cipher_ctx(void)
+{
+    auth_thread_ctx *tctx = get_thread_ctx();
+
+    return ((tctx == NULL) ? NULL : tctx->cipher_ctx);
+}
+
 //! At first, decrypt the symmetric key in key_buffer using NC private key and use the symmetric key to decrypt the input string
 //! Note the first 32 bytes of input string contains iv string (the remaining string is actual cipher text)
 //!
@@ -417,7 +876,7 @@ int encrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer,
     char *dec64_key = NULL;
     char *dec64_in = NULL;
     char encrypted[MAX_ENCRYPTED_STRING_LEN] = "";
-    EVP_CIPHER_CTX ctx = { 0 };
+    EVP_CIPHER_CTX *ctx = NULL;
 
     if (!initialized) {
         if (euca_init_cert() != EUCA_OK) {
@@ -442,19 +901,23 @@ int encrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer,
     }
     in_len = len;
 
-    EVP_CIPHER_CTX_init(&ctx);
-    EVP_EncryptInit_ex(&ctx, EVP_aes_256_gcm(), NULL, (unsigned char *)dec64_key, (unsigned char *)iv_buffer);
-    EVP_CIPHER_CTX_set_key_length(&ctx, key_len);
-    EVP_CIPHER_CTX_ctrl(&ctx, EVP_CTRL_GCM_SET_IVLEN, IV_LENGTH, NULL);
-    EVP_CIPHER_CTX_set_padding(&ctx, 0);
+    if ((ctx = get_cipher_ctx()) == NULL) {
+        LOGERROR("Cannot allocate cipher context\n");
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+    EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, (unsigned char *)dec64_key, (unsigned char *)iv_buffer);
+    EVP_CIPHER_CTX_set_key_length(ctx, key_len);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, IV_LENGTH, NULL);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
 
-    if (!EVP_EncryptUpdate(&ctx, (unsigned char *)encrypted + IV_LENGTH, out_len, (unsigned char *)dec64_in, in_len)) {
+    if (!EVP_EncryptUpdate(ctx, (unsigned char *)encrypted + IV_LENGTH, out_len, (unsigned char *)dec64_in, in_len)) {
         LOGERROR("Cipher update failed\n");
         ret = EUCA_ERROR;
         goto cleanup;
     }
 
-    if (!EVP_EncryptFinal_ex(&ctx, (unsigned char *)encrypted + IV_LENGTH, &len)) {
+    if (!EVP_EncryptFinal_ex(ctx, (unsigned char *)encrypted + IV_LENGTH, &len)) {
         ERR_print_errors_fp(stderr);
         ret = EUCA_ERROR;
         LOGERROR("Cipher final failed\n");
@@ -474,7 +937,8 @@ cleanup:
     if (ret != EUCA_OK) {
         EUCA_FREE(*out_buffer);
     }
-    EVP_CIPHER_CTX_cleanup(&ctx);
+    if (ctx != NULL)
+        EVP_CIPHER_CTX_reset(ctx);
     return ret;
 }
 
@@ -505,7 +969,7 @@ int decrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer,
     char decrypted_str[MAX_DECRYPTED_STRING_LEN] = "";  // MAX encrypted data length
     char *cipher_text = NULL;
     char *tag = NULL;
-    EVP_CIPHER_CTX ctx = { 0 };
+    EVP_CIPHER_CTX *ctx = NULL;
 
     if (in_buffer == NULL || strlen(in_buffer) <= 0) {
         LOGERROR("No input string to decrypt\n");
@@ -548,27 +1012,31 @@ int decrypt_string_symmetric(char *in_buffer, char *key_buffer, char *iv_buffer,
         goto cleanup;
     }
 
-    EVP_CIPHER_CTX_init(&ctx);
+    if ((ctx = get_cipher_ctx()) == NULL) {
+        LOGERROR("Cannot allocate cipher context\n");
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
     cipher_init = TRUE;
-    EVP_DecryptInit_ex(&ctx, EVP_aes_256_gcm(), NULL, (unsigned char *)dec64_key, (unsigned char *)iv_buffer);
-    EVP_CIPHER_CTX_set_key_length(&ctx, key_len);
-    EVP_CIPHER_CTX_ctrl(&ctx, EVP_CTRL_GCM_SET_IVLEN, IV_LENGTH, NULL);
-    EVP_CIPHER_CTX_set_padding(&ctx, 0);
+    EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, (unsigned char *)dec64_key, (unsigned char *)iv_buffer);
+    EVP_CIPHER_CTX_set_key_length(ctx, key_len);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, IV_LENGTH, NULL);
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
 
-    if (!EVP_DecryptUpdate(&ctx, (unsigned char *)decrypted_str, &len, (unsigned char *)cipher_text, cipher_len)) {
+    if (!EVP_DecryptUpdate(ctx, (unsigned char *)decrypted_str, &len, (unsigned char *)cipher_text, cipher_len)) {
         ret = EUCA_ERROR;
         LOGERROR("Cipher update failed\n");
         goto cleanup;
     }
 
-    if (!EVP_CIPHER_CTX_ctrl(&ctx, EVP_CTRL_GCM_SET_TAG, TAG_LENGTH, tag)) {
+    if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_LENGTH, tag)) {
         ret = EUCA_ERROR;
         LOGERROR("Failed to set tag\n");
         goto cleanup;
     }
 
     *out_len = len;
-    if (!EVP_DecryptFinal_ex(&ctx, (unsigned char *)decrypted_str + len, &len)) {
+    if (!EVP_DecryptFinal_ex(ctx, (unsigned char *)decrypted_str + len, &len)) {
         ret = EUCA_ERROR;
         LOGERROR("Cipher final failed\n");
         goto cleanup;
@@ -599,7 +1067,7 @@ cleanup:
     }
 
     if (cipher_init)
-        EVP_CIPHER_CTX_cleanup(&ctx);
+        EVP_CIPHER_CTX_reset(ctx);
     return ret;
 }
 
@@ -622,9 +1090,9 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
     int ret = -1;
     int in_buffer_str_size = -1;
     char *dec64 = NULL;
-    int out_size = 0;
-    FILE *PKFP = NULL;
-    RSA *pr = NULL;
+    size_t out_size = 0;
+    cached_key *pk = NULL;
+    EVP_PKEY_CTX *pkey_ctx = NULL;
 
     // Make sure we have valid parameters
     if ((in_buffer == NULL) || (pk_file == NULL) || (*pk_file == '\0') || (out_buffer == NULL)) {
@@ -641,23 +1109,12 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
 
     in_buffer_str_size = (int)strlen(in_buffer);    //! the length of the string, not including the null-terminator
 
-    // Open the private key file in read mode
-    if ((PKFP = fopen(pk_file, "r")) == NULL) {
-        LOGERROR("Cannot open key file: open failed on %s\n", pk_file);
-        ret = EUCA_ERROR;
-        goto cleanup;
-    }
-    // Get the key
-    if (PEM_read_RSAPrivateKey(PKFP, &pr, NULL, NULL) == NULL) {
+    // Get the key, parsed only when the file is first seen or has changed
+    if ((pk = key_cache_acquire(pk_file, FALSE)) == NULL) {
         LOGERROR("Private key file read failed\n");
-        fclose(PKFP);
-        PKFP = NULL;
         ret = EUCA_ERROR;
         goto cleanup;
     }
-    // No longer need the file handler
-    fclose(PKFP);
-    PKFP = NULL;
 
     //Base64 decode the string, null terminator deducted from buffer size
     if ((dec64 = base64_dec((unsigned char *)in_buffer, in_buffer_str_size)) == NULL) {
@@ -670,11 +1127,11 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
         printf("Calloc failed\n");
         ret = EUCA_ERROR;
         goto cleanup;
-    } else {
-        bzero(*out_buffer, in_buffer_str_size + 1);
     }
 
-    if ((out_size = RSA_private_decrypt(RSA_size(pr), ((unsigned char *)dec64), ((unsigned char *)*out_buffer), pr, RSA_PKCS1_PADDING)) == -1) {
+    out_size = in_buffer_str_size;
+    if (((pkey_ctx = key_pkey_ctx(pk, FALSE)) == NULL) ||
+        (EVP_PKEY_decrypt(pkey_ctx, ((unsigned char *)*out_buffer), &out_size, ((unsigned char *)dec64), EVP_PKEY_size(pk->key)) <= 0)) {
         LOGERROR("private decrypt failed\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -683,15 +1140,14 @@ int decrypt_string(char *in_buffer, char *pk_file, char **out_buffer)
     ret = EUCA_OK;
 
 cleanup:
+    if (pkey_ctx != NULL)
+        EVP_PKEY_CTX_free(pkey_ctx);
+    key_cache_release(pk);
     EUCA_FREE(dec64);
     if (ret == EUCA_ERROR) {
         EUCA_FREE(*out_buffer);
     }
 
-    if (pr != NULL) {
-        RSA_free(pr);
-    }
-
     return ret;
 }
 
@@ -707,17 +1163,13 @@ cleanup:
 //!
 int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
 {
-    int rc = -1;
-    int key_bits = -1;
     int ret = -1;
     int in_buffer_str_size = -1;
     int encrypt_size = -1;
+    size_t enc_len = 0;
     char *enc64 = NULL;
-    RSA *pr = NULL;
-    BIO *cert_bio = NULL;
-    BIO *out_bio = NULL;
-    X509 *cert = NULL;
-    EVP_PKEY *pubkey = NULL;
+    cached_key *cert = NULL;
+    EVP_PKEY_CTX *pkey_ctx = NULL;
 
     // Make sure we have valid parameters
     if ((in_buffer == NULL) || (cert_file == NULL) || (*cert_file == '\0') || (out_buffer == NULL)) {
@@ -735,57 +1187,14 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
 
     in_buffer_str_size = (int)strlen(in_buffer);
 
-    // create a BIO buffer for the cert contents
-    cert_bio = BIO_new(BIO_s_file());
-    out_bio = BIO_new(BIO_s_file());
-    out_bio = BIO_new_fp(stdout, BIO_NOCLOSE);
-
-    //Read cert
-    rc = BIO_read_filename(cert_bio, cert_file);
-    if (!rc) {
-        LOGERROR("read file return error\n");
-        ret = EUCA_ERROR;
-        goto cleanup;
-    }
-
-    if (!(cert = PEM_read_bio_X509(cert_bio, NULL, 0, NULL))) {
+    // Get the public key of the cert, checked to be a 1024, 2048 or 4096 bit RSA key when loaded
+    if ((cert = key_cache_acquire(cert_file, TRUE)) == NULL) {
         LOGERROR("Error loading cert into memory..\n");
         ret = EUCA_ERROR;
         goto cleanup;
     }
-    //Get the public key and populate the RSA struct
-    if ((pubkey = X509_get_pubkey(cert)) == NULL) {
-        LOGERROR("ERROR getting pub key\n");
-        ret = EUCA_ERROR;
-        goto cleanup;
-    } else {
-        switch (pubkey->type) {
-        case EVP_PKEY_RSA:
-            key_bits = EVP_PKEY_bits(pubkey);
-            if (key_bits != 1024 && key_bits != 2048 && key_bits != 4096) {
-                LOGERROR("Invalid RSA key length found in %s. Requires 1024, 2048, or 4096. Found %d\n", cert_file, key_bits);
-                ret = EUCA_ERROR;
-                goto cleanup;
-            }
-            break;
-        case EVP_PKEY_DSA:
-            LOGERROR("Invalid DSA key found. Only RSA supported.\n");
-            ret = EUCA_ERROR;
-            goto cleanup;
-        default:
-            LOGERROR("Unsupported %d bit non-RSA/DSA Key found", EVP_PKEY_bits(pubkey));
-            ret = EUCA_ERROR;
-            goto cleanup;
-        }
-    }
-
-    if ((pr = EVP_PKEY_get1_RSA(pubkey)) == NULL) {
-        LOGERROR("Could not get public RSA key for encrypting\n");
-        ret = EUCA_ERROR;
-        goto cleanup;
-    }
 
-    if ((encrypt_size = RSA_size(pr)) <= 0) {
+    if ((encrypt_size = EVP_PKEY_size(cert->key)) <= 0) {
         LOGERROR("Failed to read expected encryption size from RSA based on key\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -797,8 +1206,9 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
         goto cleanup;
     }
 
-    rc = RSA_public_encrypt(in_buffer_str_size, ((unsigned char *)in_buffer), ((unsigned char *)enc64), pr, RSA_PKCS1_PADDING);
-    if (rc == -1) {
+    enc_len = encrypt_size;
+    if (((pkey_ctx = key_pkey_ctx(cert, TRUE)) == NULL) ||
+        (EVP_PKEY_encrypt(pkey_ctx, ((unsigned char *)enc64), &enc_len, ((unsigned char *)in_buffer), in_buffer_str_size) <= 0)) {
         LOGERROR("Failed encrypt op\n");
         ret = EUCA_ERROR;
         goto cleanup;
@@ -813,24 +1223,10 @@ int encrypt_string(char *in_buffer, char *cert_file, char **out_buffer)
     ret = EUCA_OK;
 
 cleanup:
-    if (pr != NULL) {
-        RSA_free(pr);
-    }
-
-    if (cert_bio != NULL) {
-        BIO_free(cert_bio);
-    }
-
+    if (pkey_ctx != NULL)
+        EVP_PKEY_CTX_free(pkey_ctx);
+    key_cache_release(cert);
     EUCA_FREE(enc64);
-
-    if (cert != NULL) {
-        X509_free(cert);
-    }
-
-    if (pr != NULL) {
-        RSA_free(pr);
-    }
-
     return ret;
 }
 
@@ -950,6 +1346,440 @@ char *euca_get_cert(u8 options)
     return (sCert);
 }
 
+//!
+//! Finds the widest vector unit the codecs may use on this CPU
+//!
+//! @return one of the CODEC_SIMD_* levels
+//!
+static int codec_simd_level(void)
+{
+#ifdef CODEC_SIMD_X86
+    static int level = -1;
+
+    if (level < 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            level = CODEC_SIMD_AVX2;
+        else if (__builtin_cpu_supports("ssse3"))
+            level = CODEC_SIMD_SSSE3;
+        else
+            level = CODEC_SIMD_NONE;
+    }
+    return (level);
+#else /* CODEC_SIMD_X86 */
+    return (CODEC_SIMD_NONE);
+#endif /* CODEC_SIMD_X86 */
+}
+
+#ifdef CODEC_SIMD_X86
+//!
+//! Maps sixteen 6-bit values to their base64 characters
+//!
+//! @param[in] indices the 6-bit values, one per byte
+//!
+//! @return the base64 characters
+//!
+__attribute__ ((target("ssse3")))
+static inline __m128i base64_enc_lookup_ssse3(__m128i indices)
+{
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    return (_mm_add_epi8(_mm_shuffle_epi8(shift, result), indices));
+}
+
+//!
+//! Base64 encodes 12 bytes at a time into 16 characters
+//!
+//! @param[out] dst  the output, receives 4 characters for every 3 bytes consumed
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input bytes consumed, a multiple of 12
+//!
+__attribute__ ((target("ssse3")))
+static size_t base64_enc_ssse3(char *dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m128i in = { 0 };
+    __m128i t0 = { 0 };
+    __m128i t1 = { 0 };
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+
+    // each iteration loads 16 bytes and uses 12 of them
+    for (done = 0; (size - done) >= 16; done += 12, dst += 16) {
+        in = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + done)), spread);
+        t0 = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+        t1 = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+        _mm_storeu_si128((__m128i *) dst, base64_enc_lookup_ssse3(_mm_or_si128(t0, t1)));
+    }
+    return (done);
+}
+
+//!
+//! Maps thirty-two 6-bit values to their base64 characters
+//!
+//! @param[in] indices the 6-bit values, one per byte
+//!
+//! @return the base64 characters
+//!
+__attribute__ ((target("avx2")))
+static inline __m256i base64_enc_lookup_avx2(__m256i indices)
+{
+    __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+    __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+    const __m256i shift = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+                                           'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                           '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+    return (_mm256_add_epi8(_mm256_shuffle_epi8(shift, result), indices));
+}
+
+//!
+//! Base64 encodes 24 bytes at a time into 32 characters
+//!
+//! @param[out] dst  the output, receives 4 characters for every 3 bytes consumed
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input bytes consumed, a multiple of 24
+//!
+__attribute__ ((target("avx2")))
+static size_t base64_enc_avx2(char *dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m256i in = { 0 };
+    __m256i t0 = { 0 };
+    __m256i t1 = { 0 };
+    const __m256i spread = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+
+    // each lane loads 16 bytes and uses 12 of them, the second lane starts 12 bytes in
+    for (done = 0; (size - done) >= 28; done += 24, dst += 32) {
+        in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + done))), _mm_loadu_si128((const __m128i *)(src + done + 12)), 1);
+        in = _mm256_shuffle_epi8(in, spread);
+        t0 = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        t1 = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        _mm256_storeu_si256((__m256i *) dst, base64_enc_lookup_avx2(_mm256_or_si256(t0, t1)));
+    }
+    return (done);
+}
+
+//!
+//! Base64 decodes 16 characters at a time into 12 bytes, stopping ahead of any block that
+//! holds a character outside the base64 alphabet (padding, whitespace or garbage).
+//!
+//! @param[out] dst  the output, must have room for 4 bytes past the decoded data
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input characters consumed, a multiple of 16
+//!
+__attribute__ ((target("ssse3")))
+static size_t base64_dec_ssse3(u8 * dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m128i str = { 0 };
+    __m128i hi_nibbles = { 0 };
+    __m128i lo = { 0 };
+    __m128i hi = { 0 };
+    __m128i roll = { 0 };
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    for (done = 0; (size - done) >= 16; done += 16, dst += 12) {
+        str = _mm_loadu_si128((const __m128i *)(src + done));
+
+        // classify each character by its nibbles, any overlap of the two lookups is an invalid character
+        hi_nibbles = _mm_and_si128(_mm_srli_epi32(str, 4), mask_2f);
+        lo = _mm_shuffle_epi8(lut_lo, _mm_and_si128(str, mask_2f));
+        hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff)
+            break;
+
+        // translate to 6-bit values and pack four of them into three bytes
+        roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm_add_epi8(str, roll);
+        str = _mm_madd_epi16(_mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(str, pack));
+    }
+    return (done);
+}
+
+//!
+//! Base64 decodes 32 characters at a time into 24 bytes, stopping ahead of any block that
+//! holds a character outside the base64 alphabet (padding, whitespace or garbage).
+//!
+//! @param[out] dst  the output, must have room for 8 bytes past the decoded data
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input characters consumed, a multiple of 32
+//!
+__attribute__ ((target("avx2")))
+static size_t base64_dec_avx2(u8 * dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m256i str = { 0 };
+    __m256i hi_nibbles = { 0 };
+    __m256i lo = { 0 };
+    __m256i hi = { 0 };
+    __m256i roll = { 0 };
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    for (done = 0; (size - done) >= 32; done += 32, dst += 24) {
+        str = _mm256_loadu_si256((const __m256i *)(src + done));
+
+        hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        lo = _mm256_shuffle_epi8(lut_lo, _mm256_and_si256(str, mask_2f));
+        hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(str, mask_2f), hi_nibbles));
+        str = _mm256_add_epi8(str, roll);
+        str = _mm256_madd_epi16(_mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        str = _mm256_shuffle_epi8(str, pack);
+        _mm256_storeu_si256((__m256i *) dst, _mm256_permutevar8x32_epi32(str, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7)));
+    }
+    return (done);
+}
+
+//!
+//! Converts 16 bytes at a time into 32 lowercase hex digits
+//!
+//! @param[out] dst  the output, receives 2 digits per byte consumed
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input bytes consumed, a multiple of 16
+//!
+__attribute__ ((target("ssse3")))
+static size_t hex_encode_ssse3(char *dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m128i in = { 0 };
+    __m128i hi = { 0 };
+    __m128i lo = { 0 };
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+
+    for (done = 0; (size - done) >= 16; done += 16, dst += 32) {
+        in = _mm_loadu_si128((const __m128i *)(src + done));
+        hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        lo = _mm_shuffle_epi8(digits, _mm_and_si128(in, mask));
+        _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return (done);
+}
+
+//!
+//! Converts 32 bytes at a time into 64 lowercase hex digits
+//!
+//! @param[out] dst  the output, receives 2 digits per byte consumed
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of input bytes consumed, a multiple of 32
+//!
+__attribute__ ((target("avx2")))
+static size_t hex_encode_avx2(char *dst, const u8 * src, size_t size)
+{
+    size_t done = 0;
+    __m256i in = { 0 };
+    __m256i hi = { 0 };
+    __m256i lo = { 0 };
+    __m256i first = { 0 };
+    __m256i second = { 0 };
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    const __m256i digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+                                            '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+
+    for (done = 0; (size - done) >= 32; done += 32, dst += 64) {
+        in = _mm256_loadu_si256((const __m256i *)(src + done));
+        hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+        lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(in, mask));
+
+        // the unpacks work within each 128-bit lane, put the four quarters back in order
+        first = _mm256_unpacklo_epi8(hi, lo);
+        second = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(first, second, 0x20));
+        _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_permute2x128_si256(first, second, 0x31));
+    }
+    return (done);
+}
+#endif /* CODEC_SIMD_X86 */
+
+//!
+//! Base64 encodes a buffer, with padding and without line breaks
+//!
+//! @param[out] dst  the output, must hold BASE64_ENC_LEN(size) + 1 characters
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of characters written, not counting the terminating NULL
+//!
+static size_t base64_encode(char *dst, const u8 * src, size_t size)
+{
+    size_t i = 0;
+    u32 triple = 0;
+    char *p = dst;
+
+#ifdef CODEC_SIMD_X86
+    switch (codec_simd_level()) {
+    case CODEC_SIMD_AVX2:
+        i = base64_enc_avx2(p, src, size);
+        // fall through - the SSSE3 loop takes what is left
+    case CODEC_SIMD_SSSE3:
+        i += base64_enc_ssse3(dst + ((i / 3) * 4), src + i, size - i);
+        p = dst + ((i / 3) * 4);
+        break;
+    default:
+        break;
+    }
+#endif /* CODEC_SIMD_X86 */
+
+    for (; (size - i) >= 3; i += 3) {
+        triple = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+        *p++ = base64_digits[(triple >> 18) & 0x3f];
+        *p++ = base64_digits[(triple >> 12) & 0x3f];
+        *p++ = base64_digits[(triple >> 6) & 0x3f];
+        *p++ = base64_digits[triple & 0x3f];
+    }
+
+    if ((size - i) > 0) {
+        triple = (src[i] << 16) | (((size - i) > 1) ? (src[i + 1] << 8) : 0);
+        *p++ = base64_digits[(triple >> 18) & 0x3f];
+        *p++ = base64_digits[(triple >> 12) & 0x3f];
+        *p++ = (((size - i) > 1) ? base64_digits[(triple >> 6) & 0x3f] : '=');
+        *p++ = '=';
+    }
+
+    *p = '\0';
+    return (p - dst);
+}
+
+//!
+//! Base64 decodes a buffer. Whitespace is skipped and decoding ends at the padding or at
+//! the first character outside the base64 alphabet.
+//!
+//! @param[out] dst  the output, must hold at least size + 8 bytes
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of bytes decoded, or -1 if the input does not start with base64 data
+//!
+static int base64_decode(u8 * dst, const u8 * src, size_t size)
+{
+    int value = 0;
+    size_t i = 0;
+    size_t quantum = 0;
+    u32 bits = 0;
+    u8 *p = dst;
+#ifdef CODEC_SIMD_X86
+    int level = codec_simd_level();
+#endif /* CODEC_SIMD_X86 */
+
+    while (i < size) {
+#ifdef CODEC_SIMD_X86
+        // the vector loops only run between whole 4-character groups
+        if ((quantum == 0) && (level != CODEC_SIMD_NONE)) {
+            size_t done = 0;
+
+            if (level == CODEC_SIMD_AVX2) {
+                done = base64_dec_avx2(p, src + i, size - i);
+                p += ((done / 4) * 3);
+                i += done;
+            }
+            done = base64_dec_ssse3(p, src + i, size - i);
+            p += ((done / 4) * 3);
+            i += done;
+            if (i >= size)
+                break;
+        }
+#endif /* CODEC_SIMD_X86 */
+
+        // one character at a time until the end of a group, past whitespace or up to the end of the data
+        if ((value = base64_values[src[i++]]) == BASE64_SPACE)
+            continue;
+        if (value < 0)
+            break;
+
+        bits = (bits << 6) | value;
+        if (++quantum == 4) {
+            *p++ = (bits >> 16) & 0xff;
+            *p++ = (bits >> 8) & 0xff;
+            *p++ = bits & 0xff;
+            bits = 0;
+            quantum = 0;
+        }
+    }
+
+    // a trailing partial group of 2 or 3 characters carries 1 or 2 bytes
+    if (quantum == 2) {
+        *p++ = (bits >> 4) & 0xff;
+    } else if (quantum == 3) {
+        *p++ = (bits >> 10) & 0xff;
+        *p++ = (bits >> 2) & 0xff;
+    }
+
+    if (p == dst)
+        return (-1);
+    return (p - dst);
+}
+
+//!
+//! Converts a buffer into lowercase hex digits
+//!
+//! @param[out] dst  the output, must hold (size * 2) + 1 characters
+//! @param[in]  src  the input
+//! @param[in]  size the length of src
+//!
+//! @return the number of characters written, not counting the terminating NULL
+//!
+size_t hex_encode(char *dst, const u8 * src, size_t size)
+{
+    size_t i = 0;
+
+#ifdef CODEC_SIMD_X86
+    switch (codec_simd_level()) {
+    case CODEC_SIMD_AVX2:
+        i = hex_encode_avx2(dst, src, size);
+        // fall through - the SSSE3 loop takes what is left
+    case CODEC_SIMD_SSSE3:
+        i += hex_encode_ssse3(dst + (i * 2), src + i, size - i);
+        break;
+    default:
+        break;
+    }
+#endif /* CODEC_SIMD_X86 */
+
+    for (; i < size; i++) {
+        dst[i * 2] = hex_digits[(src[i] >> 4)];
+        dst[i * 2 + 1] = hex_digits[(src[i] & 0x0f)];
+    }
+
+    dst[size * 2] = '\0';
+    return (size * 2);
+}
+
 //!
 //! Encode a given buffer
 //!
@@ -966,35 +1796,13 @@ char *euca_get_cert(u8 options)
 //!
 char *base64_enc(u8 * sIn, int size)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
     char *sEncVal = NULL;
-    BUF_MEM *pBuffer = NULL;
 
     if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
+        if ((sEncVal = EUCA_ALLOC((BASE64_ENC_LEN(size) + 1), sizeof(char))) == NULL) {
+            LOGERROR("out of memory for Base64 buf\n");
         } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  // no long-line wrapping
-            if ((pBioMem = BIO_new(BIO_s_mem())) == NULL) {
-                LOGERROR("BIO_new(BIO_s_mem()) failed\n");
-            } else {
-                pBio64 = BIO_push(pBio64, pBioMem);
-                if (BIO_write(pBio64, sIn, size) != size) {
-                    LOGERROR("BIO_write() failed\n");
-                } else {
-                    (void)BIO_flush(pBio64);
-                    BIO_get_mem_ptr(pBio64, &pBuffer);
-                    if ((sEncVal = EUCA_ALLOC((pBuffer->length + 1), sizeof(char))) == NULL) {
-                        LOGERROR("out of memory for Base64 buf\n");
-                    } else {
-                        memcpy(sEncVal, pBuffer->data, pBuffer->length);
-                        sEncVal[pBuffer->length] = '\0';
-                    }
-                }
-            }
-
-            BIO_free_all(pBio64);      // frees both bio64 and biomem
+            base64_encode(sEncVal, sIn, size);
         }
     }
     return (sEncVal);
@@ -1011,30 +1819,19 @@ char *base64_enc(u8 * sIn, int size)
 //!
 char *base64_dec2(u8 * sIn, int size, int *decoded_length)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
+    int len = 0;
     char *sBuffer = NULL;
 
     if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
+        if ((sBuffer = EUCA_ZALLOC((size + BASE64_DEC_SLACK), sizeof(char))) == NULL) {
+            LOGERROR("Memory allocation failure.\n");
+        } else if ((len = base64_decode(((u8 *) sBuffer), sIn, size)) <= 0) {
+            LOGERROR("Base64 decode failed\n");
+            EUCA_FREE(sBuffer);
         } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  /* no long-line wrapping */
-
-            if ((pBioMem = BIO_new_mem_buf(sIn, size)) == NULL) {
-                LOGERROR("BIO_new_mem_buf() failed\n");
-            } else if ((sBuffer = EUCA_ZALLOC(size, sizeof(char))) == NULL) {
-                LOGERROR("Memory allocation failure.\n");
-            } else {
-                pBioMem = BIO_push(pBio64, pBioMem);
-
-                if ((*decoded_length = BIO_read(pBioMem, sBuffer, size)) <= 0) {
-                    LOGERROR("BIO_read() read failed\n");
-                    EUCA_FREE(sBuffer);
-                }
-            }
-
-            BIO_free_all(pBio64);
+            sBuffer[len] = '\0';
+            if (decoded_length != NULL)
+                *decoded_length = len;
         }
     }
 
@@ -1057,34 +1854,7 @@ char *base64_dec2(u8 * sIn, int size, int *decoded_length)
 //!
 char *base64_dec(u8 * sIn, int size)
 {
-    BIO *pBio64 = NULL;
-    BIO *pBioMem = NULL;
-    char *sBuffer = NULL;
-
-    if ((sIn != NULL) && (size > 0)) {
-        if ((pBio64 = BIO_new(BIO_f_base64())) == NULL) {
-            LOGERROR("BIO_new(BIO_f_base64()) failed\n");
-        } else {
-            BIO_set_flags(pBio64, BIO_FLAGS_BASE64_NO_NL);  /* no long-line wrapping */
-
-            if ((pBioMem = BIO_new_mem_buf(sIn, size)) == NULL) {
-                LOGERROR("BIO_new_mem_buf() failed\n");
-            } else if ((sBuffer = EUCA_ZALLOC(size, sizeof(char))) == NULL) {
-                LOGERROR("Memory allocation failure.\n");
-            } else {
-                pBioMem = BIO_push(pBio64, pBioMem);
-
-                if ((BIO_read(pBioMem, sBuffer, size)) <= 0) {
-                    LOGERROR("BIO_read() read failed\n");
-                    EUCA_FREE(sBuffer);
-                }
-            }
-
-            BIO_free_all(pBio64);
-        }
-    }
-
-    return (sBuffer);
+    return (base64_dec2(sIn, size, NULL));
 }
 
 //!
@@ -1105,7 +1875,6 @@ char *base64_dec(u8 * sIn, int size)
 //!
 char *hexify(unsigned char *data, int data_len)
 {
-    int i = 0;
     char *hex_str = NULL;
 
     if (data == NULL)
@@ -1117,12 +1886,7 @@ char *hexify(unsigned char *data, int data_len)
         return (NULL);
     }
 
-    for (i = 0; i < data_len; i++) {
-        hex_str[i * 2] = hex_digits[(data[i] / 16)];
-        hex_str[i * 2 + 1] = hex_digits[(data[i] % 16)];
-    }
-
-    hex_str[data_len * 2] = '\0';      //make sure it's null terminated
+    hex_encode(hex_str, data, data_len);
     return (hex_str);
 }
 
@@ -1804,10 +2568,7 @@ char *eucav2_sign_request(const char *verb, const char *url, const struct curl_s
 #define BUFSIZE           2024
 
     u8 *sig = NULL;
-    RSA *rsa = NULL;
-    FILE *fp = NULL;
-    u32 siglen = 0;
-    int ret = 0;
+    size_t siglen = 0;
     char *auth_header = NULL;
     char *canonical_uri = NULL;
     char *canonical_query = NULL;
@@ -1816,8 +2577,9 @@ char *eucav2_sign_request(const char *verb, const char *url, const struct curl_s
     char *cert_fingerprint = NULL;
     char *sig_str = NULL;
     char canonical_request[BUFSIZE] = "";
-    u8 sha256[SHA256_DIGEST_LENGTH] = { 0 };
     struct key_value_pair_array *hdr_array = NULL;
+    cached_key *cert = NULL;
+    cached_key *pk = NULL;
 
     if (!initialized) {
         if (euca_init_cert() != EUCA_OK) {
@@ -1870,56 +2632,41 @@ char *eucav2_sign_request(const char *verb, const char *url, const struct curl_s
     EUCA_FREE(canonical_headers);
     // Don't free signed_headers... needed later for the auth header construction
 
-    if ((rsa = RSA_new()) == NULL) {
-        LOGERROR("error, RSA_new() failed\n");
-    } else if ((fp = fopen(sPrivKeyFileName, "r")) == NULL) {
-        LOGERROR("error, failed to open private key file %s\n", sPrivKeyFileName);
-        RSA_free(rsa);
+    // The certificate fingerprint is computed once per certificate file by the key cache
+    if ((cert = key_cache_acquire(sCertFileName, TRUE)) != NULL) {
+        cert_fingerprint = strdup(cert->fingerprint);
+        key_cache_release(cert);
+    }
+
+    if (cert_fingerprint == NULL) {
+        LOGERROR("error, failed to calculate certificate fingerprint for %s\n", sCertFileName);
+    } else if ((pk = key_cache_acquire(sPrivKeyFileName, FALSE)) == NULL) {
+        LOGERROR("error, failed to read private key file %s\n", sPrivKeyFileName);
     } else {
-        LOGTRACE("reading private key file %s\n", sPrivKeyFileName);
-        PEM_read_RSAPrivateKey(fp, &rsa, NULL, NULL);   /* read the PEM-encoded file into rsa struct */
-        if (rsa == NULL) {
-            LOGERROR("error, failed to read private key file %s\n", sPrivKeyFileName);
+        // finally, SHA256 and sign with PK
+        LOGTRACE("signing input %s\n", get_string_stats(canonical_request));
+        if ((sig = key_sign(pk, EVP_sha256(), canonical_request, strlen(canonical_request), &siglen)) == NULL) {
+            LOGDEBUG("RSA signature failed\n");
         } else {
-            if ((cert_fingerprint = calc_fingerprint(sCertFileName)) == NULL) {
-                LOGERROR("error, failed to calculate certificate fingerprint for %s\n", sCertFileName);
-            } else {
-                // RSA_print_fp (stdout, rsa, 0); // (for debugging)
-                if ((sig = EUCA_ZALLOC(RSA_size(rsa), sizeof(u8))) == NULL) {
-                    LOGERROR("out of memory (for RSA key)\n");
-                } else {
-                    // finally, SHA256 and sign with PK
-                    LOGTRACE("signing input %s\n", get_string_stats(canonical_request));
-                    SHA256(((u8 *) canonical_request), strlen(canonical_request), sha256);
-
-                    if ((ret = RSA_sign(NID_sha256, sha256, SHA256_DIGEST_LENGTH, sig, &siglen, rsa)) != 1) {
-                        LOGDEBUG("RSA_sign() failed\n");
-                    } else {
-                        LOGTRACE("signing output %d\n", sig[siglen - 1]);
-                        sig_str = base64_enc(sig, siglen);
-                        LOGTRACE("base64 signature %s\n", get_string_stats((char *)sig_str));
-                    }
-                    EUCA_FREE(sig);
-
-                    // create full auth header string
-                    if ((auth_header = (char *)EUCA_ZALLOC((BUFSIZE + 1), sizeof(char))) == NULL) {
-                        LOGERROR("Cannot sign object storage request, no memory for auth header string\n");
-                    } else {
-                        snprintf(auth_header, BUFSIZE, "Authorization: EUCA2-RSA-SHA256 %s %s %s", cert_fingerprint, signed_headers, sig_str);
-                    }
-
-                    EUCA_FREE(sig_str);
-                }
-
-                EUCA_FREE(cert_fingerprint);
-            }
-
-            RSA_free(rsa);
+            LOGTRACE("signing output %d\n", sig[siglen - 1]);
+            sig_str = base64_enc(sig, siglen);
+            LOGTRACE("base64 signature %s\n", get_string_stats((char *)sig_str));
         }
-
-        fclose(fp);
+        key_cache_release(pk);
+        EUCA_FREE(sig);
+
+        // create full auth header string
+        if (sig_str == NULL) {
+            LOGERROR("Cannot sign object storage request, no signature\n");
+        } else if ((auth_header = (char *)EUCA_ZALLOC((BUFSIZE + 1), sizeof(char))) == NULL) {
+            LOGERROR("Cannot sign object storage request, no memory for auth header string\n");
+        } else {
+            snprintf(auth_header, BUFSIZE, "Authorization: EUCA2-RSA-SHA256 %s %s %s", cert_fingerprint, signed_headers, sig_str);
+        }
+        EUCA_FREE(sig_str);
     }
 
+    EUCA_FREE(cert_fingerprint);
     EUCA_FREE(signed_headers);
     return (auth_header);
 
@@ -1945,14 +2692,11 @@ char *euca_sign_url(const char *sVerb, const char *sDate, const char *sURL)
 {
 #define BUFSIZE                        2024
 
-    int ret = 0;
     char sInput[BUFSIZE] = "";
     char *sSignature = NULL;
-    RSA *pRSA = NULL;
-    FILE *pFile = NULL;
-    u32 siglen = 0;
+    size_t siglen = 0;
     u8 *sSigBuffer = NULL;
-    u8 sSHA1[SHA_DIGEST_LENGTH] = "";
+    cached_key *pk = NULL;
 
     if (!initialized) {
         if (euca_init_cert() != EUCA_OK) {
@@ -1963,42 +2707,25 @@ char *euca_sign_url(const char *sVerb, const char *sDate, const char *sURL)
     if ((sVerb == NULL) || (sDate == NULL) || (sURL == NULL))
         return (NULL);
 
-    if ((pRSA = RSA_new()) == NULL) {
-        LOGERROR("RSA_new() failed\n");
-    } else if ((pFile = fopen(sPrivKeyFileName, "r")) == NULL) {
-        LOGERROR("failed to open private key file %s\n", sPrivKeyFileName);
-        RSA_free(pRSA);
+    if ((pk = key_cache_acquire(sPrivKeyFileName, FALSE)) == NULL) {
+        LOGERROR("failed to read private key file %s\n", sPrivKeyFileName);
     } else {
-        LOGTRACE("reading private key file %s\n", sPrivKeyFileName);
-        PEM_read_RSAPrivateKey(pFile, &pRSA, NULL, NULL);   // read the PEM-encoded file into rsa struct
-        if (pRSA == NULL) {
-            LOGERROR("failed to read private key file %s\n", sPrivKeyFileName);
-        } else {
-            if ((sSigBuffer = EUCA_ALLOC(RSA_size(pRSA), sizeof(u8))) == NULL) {
-                LOGERROR("out of memory (for RSA key)\n");
-            } else {
-                // finally, SHA1 and sign with PK
-                assert((strlen(sVerb) + strlen(sDate) + strlen(sURL) + 4) <= BUFSIZE);
-
-                snprintf(sInput, BUFSIZE, "%s\n%s\n%s\n", sVerb, sDate, sURL);
-                LOGEXTREME("signing input %s\n", get_string_stats(sInput));
-
-                SHA1(((u8 *) sInput), strlen(sInput), sSHA1);
-                if ((ret = RSA_sign(NID_sha1, sSHA1, SHA_DIGEST_LENGTH, sSigBuffer, &siglen, pRSA)) != 1) {
-                    LOGERROR("RSA_sign() failed\n");
-                } else {
-                    LOGEXTREME("signing output %d\n", sSigBuffer[siglen - 1]);
-                    sSignature = base64_enc(sSigBuffer, siglen);
-                    LOGEXTREME("base64 signature %s\n", get_string_stats((char *)sSignature));
-                }
+        // finally, SHA1 and sign with PK
+        assert((strlen(sVerb) + strlen(sDate) + strlen(sURL) + 4) <= BUFSIZE);
 
-                EUCA_FREE(sSigBuffer);
-            }
+        snprintf(sInput, BUFSIZE, "%s\n%s\n%s\n", sVerb, sDate, sURL);
+        LOGEXTREME("signing input %s\n", get_string_stats(sInput));
 
-            RSA_free(pRSA);
+        if ((sSigBuffer = key_sign(pk, EVP_sha1(), sInput, strlen(sInput), &siglen)) == NULL) {
+            LOGERROR("RSA signature failed\n");
+        } else {
+            LOGEXTREME("signing output %d\n", sSigBuffer[siglen - 1]);
+            sSignature = base64_enc(sSigBuffer, siglen);
+            LOGEXTREME("base64 signature %s\n", get_string_stats((char *)sSignature));
         }
 
-        fclose(pFile);
+        key_cache_release(pk);
+        EUCA_FREE(sSigBuffer);
     }
 
     return (sSignature);
@@ -2207,6 +2934,288 @@ void print_key_value_pair_array(const struct key_value_pair_array *kv_array)
     printf("Key-Value Pair array complete\n");
 }
 
+//!
+//! Writes a freshly generated RSA private key to a file for the key cache tests
+//!
+//! @param[in] path the file to write, replaced through a rename so it gets a new inode
+//! @param[in] bits the size of the key
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int write_test_key(const char *path, int bits)
+{
+    int ret = EUCA_ERROR;
+    FILE *fp = NULL;
+    EVP_PKEY *key = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
+    char tmp_path[FILENAME] = "";
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (((ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL)) == NULL) || (EVP_PKEY_keygen_init(ctx) <= 0) ||
+        (EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, bits) <= 0) || (EVP_PKEY_keygen(ctx, &key) <= 0)) {
+        goto cleanup;
+    }
+
+    if ((fp = fopen(tmp_path, "w")) == NULL)
+        goto cleanup;
+    if (PEM_write_PrivateKey(fp, key, NULL, NULL, 0, NULL, NULL) == 1)
+        ret = EUCA_OK;
+    fclose(fp);
+
+    if ((ret == EUCA_OK) && (rename(tmp_path, path) != 0))
+        ret = EUCA_ERROR;
+
+cleanup:
+    if (ctx != NULL)
+        EVP_PKEY_CTX_free(ctx);
+    if (key != NULL)
+        EVP_PKEY_free(key);
+    return (ret);
+}
+
+//!
+//! Checks that a cached private key is reused while its file is unchanged and reloaded
+//! once the file is replaced
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int test_key_cache(void)
+{
+    int ret = EUCA_ERROR;
+    char saved_key[FILENAME] = "";
+    char key_path[FILENAME] = "/tmp/euca-auth-test-key-XXXXXX";
+    char *sig1 = NULL;
+    char *sig2 = NULL;
+    char *sig3 = NULL;
+    int fd = -1;
+
+    if ((fd = mkstemp(key_path)) < 0)
+        return (EUCA_ERROR);
+    close(fd);
+
+    snprintf(saved_key, sizeof(saved_key), "%s", sPrivKeyFileName);
+    snprintf(sPrivKeyFileName, sizeof(sPrivKeyFileName), "%s", key_path);
+
+    if (write_test_key(key_path, 2048) != EUCA_OK) {
+        printf("	Failed to generate test key\n");
+        goto cleanup;
+    }
+
+    sig1 = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object");
+    sig2 = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object");
+    if ((sig1 == NULL) || (sig2 == NULL) || strcmp(sig1, sig2)) {
+        printf("	Signatures with the cached key differ\n");
+        goto cleanup;
+    }
+
+    if (write_test_key(key_path, 2048) != EUCA_OK) {
+        printf("	Failed to replace test key\n");
+        goto cleanup;
+    }
+
+    sig3 = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object");
+    if ((sig3 == NULL) || !strcmp(sig1, sig3)) {
+        printf("	Replaced key was not reloaded\n");
+        goto cleanup;
+    }
+    ret = EUCA_OK;
+
+cleanup:
+    snprintf(sPrivKeyFileName, sizeof(sPrivKeyFileName), "%s", saved_key);
+    unlink(key_path);
+    EUCA_FREE(sig1);
+    EUCA_FREE(sig2);
+    EUCA_FREE(sig3);
+    return (ret);
+}
+
+//!
+//! Signs with more distinct keys than the key cache holds, while a reference on the first
+//! key is held, and checks that every signature succeeds and matches an uncached one.
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure
+//!
+static int test_key_cache_eviction(void)
+{
+#define NUM_EVICTION_KEYS        (KEY_CACHE_SIZE + 3)
+    int i = 0;
+    int fd = -1;
+    int ret = EUCA_ERROR;
+    char saved_key[FILENAME] = "";
+    char key_paths[NUM_EVICTION_KEYS][FILENAME] = { {0} };
+    char *sigs[NUM_EVICTION_KEYS] = { NULL };
+    char *sig = NULL;
+    cached_key *held = NULL;
+
+    snprintf(saved_key, sizeof(saved_key), "%s", sPrivKeyFileName);
+    for (i = 0; i < NUM_EVICTION_KEYS; i++) {
+        snprintf(key_paths[i], FILENAME, "/tmp/euca-auth-evict-key-XXXXXX");
+        if ((fd = mkstemp(key_paths[i])) < 0) {
+            key_paths[i][0] = '\0';
+            goto cleanup;
+        }
+        close(fd);
+        if (write_test_key(key_paths[i], 1024) != EUCA_OK) {
+            printf("	Failed to generate test key %d\n", i);
+            goto cleanup;
+        }
+    }
+
+    if ((held = key_cache_acquire(key_paths[0], FALSE)) == NULL) {
+        printf("	Failed to load %s\n", key_paths[0]);
+        goto cleanup;
+    }
+
+    for (i = 0; i < NUM_EVICTION_KEYS; i++) {
+        snprintf(sPrivKeyFileName, sizeof(sPrivKeyFileName), "%s", key_paths[i]);
+        if ((sigs[i] = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object")) == NULL) {
+            printf("	Signing with key %d of %d failed\n", (i + 1), NUM_EVICTION_KEYS);
+            goto cleanup;
+        }
+    }
+
+    // the evicted keys sign again, and the first one is still intact
+    for (i = 0; i < NUM_EVICTION_KEYS; i++) {
+        snprintf(sPrivKeyFileName, sizeof(sPrivKeyFileName), "%s", key_paths[i]);
+        sig = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object");
+        if ((sig == NULL) || strcmp(sig, sigs[i])) {
+            printf("	Key %d signed differently after eviction\n", (i + 1));
+            goto cleanup;
+        }
+        EUCA_FREE(sig);
+    }
+    ret = EUCA_OK;
+
+cleanup:
+    key_cache_release(held);
+    snprintf(sPrivKeyFileName, sizeof(sPrivKeyFileName), "%s", saved_key);
+    for (i = 0; i < NUM_EVICTION_KEYS; i++) {
+        if (key_paths[i][0] != '\0')
+            unlink(key_paths[i]);
+        EUCA_FREE(sigs[i]);
+    }
+    EUCA_FREE(sig);
+    return (ret);
+#undef NUM_EVICTION_KEYS
+}
+
+//!
+//! Returns a monotonic timestamp for the benchmark
+//!
+//! @return the time in nanoseconds
+//!
+static long long bench_now_ns(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec);
+}
+
+//!
+//! Prints the throughput of one benchmark case
+//!
+//! @param[in] name       the benchmark case
+//! @param[in] iterations the number of operations performed
+//! @param[in] start_ns   the time the case started, from bench_now_ns()
+//!
+static void bench_report(const char *name, int iterations, long long start_ns)
+{
+    long long elapsed_ns = bench_now_ns() - start_ns;
+
+    if (elapsed_ns <= 0)
+        elapsed_ns = 1;
+    printf("%-32s %8d ops %10.1f us/op %10.1f ops/s\n", name, iterations, ((double)elapsed_ns / iterations) / 1000.0, (iterations * 1e9) / elapsed_ns);
+}
+
+//!
+//! Measures the throughput of signed requests and of the asymmetric string encryption
+//! with the node keys. The uncached case parses the key and certificate on every
+//! request the way signing worked before the key cache.
+//!
+//! @param[in] iterations the number of operations per benchmark case
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int run_benchmark(int iterations)
+{
+    int i = 0;
+    long long start_ns = 0;
+    size_t siglen = 0;
+    char *out = NULL;
+    char *enc = NULL;
+    char *fingerprint = NULL;
+    u8 *sig = NULL;
+    FILE *fp = NULL;
+    EVP_PKEY *key = NULL;
+    EVP_MD_CTX *md_ctx = NULL;
+    struct curl_slist *list = NULL;
+    const char *url = "http://myserver.com:8773/services/objectstorage/bucket/cento2123_testkvm.img.manifest.xml?versionId=123&acl";
+
+    if (euca_init_cert() != EUCA_OK)
+        return (EUCA_ERROR);
+
+    list = curl_slist_append(list, "host: myserver0.com");
+    list = curl_slist_append(list, "date: 20120910T101055Z");
+    list = curl_slist_append(list, "x-amz-date: May 12, 2012 8:00pm EST");
+
+    // warm up the cache so the first load is not part of the measurement
+    if ((out = eucav2_sign_request("GET", url, list)) == NULL) {
+        printf("Signing failed, are the node keys in place?\n");
+        curl_slist_free_all(list);
+        return (EUCA_ERROR);
+    }
+    EUCA_FREE(out);
+
+    start_ns = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        out = eucav2_sign_request("GET", url, list);
+        EUCA_FREE(out);
+    }
+    bench_report("eucav2_sign_request", iterations, start_ns);
+
+    start_ns = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        out = euca_sign_url("GET", "20120910T101055Z", "/services/objectstorage/bucket/object");
+        EUCA_FREE(out);
+    }
+    bench_report("euca_sign_url", iterations, start_ns);
+
+    start_ns = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        if ((fp = fopen(sPrivKeyFileName, "r")) == NULL)
+            break;
+        key = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+        fclose(fp);
+        fingerprint = calc_fingerprint(sCertFileName);
+        md_ctx = EVP_MD_CTX_new();
+        if ((key != NULL) && (md_ctx != NULL) && (EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, key) > 0)) {
+            siglen = EVP_PKEY_size(key);
+            sig = EUCA_ALLOC(siglen, sizeof(u8));
+            EVP_DigestSignUpdate(md_ctx, url, strlen(url));
+            EVP_DigestSignFinal(md_ctx, sig, &siglen);
+            EUCA_FREE(sig);
+        }
+        EVP_MD_CTX_free(md_ctx);
+        EVP_PKEY_free(key);
+        EUCA_FREE(fingerprint);
+    }
+    bench_report("sign, uncached key (baseline)", iterations, start_ns);
+
+    start_ns = bench_now_ns();
+    for (i = 0; i < iterations; i++) {
+        if (encrypt_string_with_node("testing123", &enc) != EUCA_OK)
+            break;
+        if (decrypt_string_with_node(enc, &out) == EUCA_OK)
+            EUCA_FREE(out);
+        EUCA_FREE(enc);
+    }
+    bench_report("encrypt+decrypt with node keys", iterations, start_ns);
+
+    curl_slist_free_all(list);
+    return (EUCA_OK);
+}
+
 //!
 //! Main entry point of the application
 //!
@@ -2272,6 +3281,10 @@ int main(int argc, char **argv)
         "/services/objectstorage/bucket/object?versionId=123&acl"
     };
 
+    if ((argc > 1) && !strcmp(argv[1], "bench")) {
+        return ((run_benchmark((argc > 2) ? strtol(argv[2], NULL, 0) : 1000) == EUCA_OK) ? 0 : 1);
+    }
+
     if (argc > 1) {
         test_count = strtol(argv[1], NULL, 0);
     } else {
@@ -2382,6 +3395,19 @@ int main(int argc, char **argv)
     EUCA_FREE(out_buffer);
     EUCA_FREE(out_buffer2);
 
+    printf("Testing key cache invalidation on key file change\n");
+    if (test_key_cache() != EUCA_OK) {
+        printf("\tKey cache test failed!\n");
+        return 1;
+    }
+    printf("\tKey cache test passed\n");
+
+    if (test_key_cache_eviction() != EUCA_OK) {
+        printf("\tKey cache eviction test failed!\n");
+        return 1;
+    }
+    printf("\tKey cache eviction test passed\n");
+
     printf("Testing token decryption with node PK using test token: %s\n", test_token);
     rc = decrypt_string_with_node(test_token, &out_buffer);
     if (rc != EUCA_OK) {
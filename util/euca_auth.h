@@ -155,6 +155,7 @@ char *base64_enc(u8 * sIn, int size);
 char *base64_dec(u8 * sIn, int size);
 char *base64_dec2(u8 * sIn, int size, int *decoded_length);
 char *hexify(unsigned char *data, int data_len);
+size_t hex_encode(char *dst, const u8 * src, size_t size);
 char *calc_fingerprint(const char *cert_filename);
 void free_key_value_pair_array(struct key_value_pair_array *kv_array);
 struct key_value_pair *deconstruct_header(const char *header_str, char delimiter);
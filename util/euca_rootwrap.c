@@ -65,7 +65,10 @@
 
 //!
 //! @file util/euca_rootwrap.c
-//! Need to provide description
+//! Runs a command as root. When started with EUCA_ROOTWRAP_SERVER_ARG, stays up as a
+//! privileged helper daemon instead and performs the operations of euca_rootwrap.h
+//! natively for the process that started it, over the socket it was given as stdin
+//! and stdout.
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -79,10 +82,24 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/loop.h>
+
+#ifdef _UNIT_TEST
+#include <assert.h>
+#include <sys/wait.h>
+#endif /* _UNIT_TEST */
 
 #include "eucalyptus.h"
 #include "misc.h"
 #include "euca_string.h"
+#include "euca_rootwrap.h"
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -90,6 +107,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define LOOP_ATTACH_TRIES                       16  //!< Attempts at grabbing a free loop device that others may grab too
+#define LOOP_STATUS_TRIES                       10  //!< Attempts at setting the loop status while the kernel answers EAGAIN
+#define LOOP_STATUS_RETRY_USEC               50000  //!< Delay between attempts at setting the loop status
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -134,6 +155,35 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int read_full(int fd, void *buf, size_t len);
+static int send_reply(int fd, uint32_t id, int status, const char *out);
+static int parse_id(const char *name, boolean user, unsigned int *pId);
+static int do_chown(char **args, char *out, size_t out_size);
+static int do_chmod(char **args, char *out, size_t out_size);
+static int do_loop_attach(char **args, char *out, size_t out_size);
+static int do_loop_detach(char **args, char *out, size_t out_size);
+static int do_write_file(char **args, char *out, size_t out_size);
+static int serve(int fd);
+
+#ifdef _UNIT_TEST
+static int test_send(int fd, uint32_t id, uint32_t op, const char **args, int nargs);
+static int test_recv(int fd, euca_rootwrap_reply * reply, char *out);
+static int test_call(int fd, uint32_t id, uint32_t op, const char **args, int nargs, char *out);
+static pid_t test_server(int *pFd);
+#endif /* _UNIT_TEST */
+
+//! Operation handlers, indexed by euca_rootwrap_op
+static const struct {
+    int nargs;                         //!< Number of arguments the operation takes
+    int (*handler) (char **args, char *out, size_t out_size);   //!< The function performing it
+} ops[EUCA_ROOTWRAP_LAST_OP] = {
+    [EUCA_ROOTWRAP_CHOWN] = {3, do_chown},
+    [EUCA_ROOTWRAP_CHMOD] = {2, do_chmod},
+    [EUCA_ROOTWRAP_LOOP_ATTACH] = {3, do_loop_attach},
+    [EUCA_ROOTWRAP_LOOP_DETACH] = {1, do_loop_detach},
+    [EUCA_ROOTWRAP_WRITE_FILE] = {2, do_write_file},
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -146,6 +196,630 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//!
+//! Reads exactly len bytes from a descriptor
+//!
+//! @param[in]  fd the descriptor to read from
+//! @param[out] buf where to store the bytes
+//! @param[in]  len the number of bytes to read
+//!
+//! @return 1 on success, 0 on end of file before anything was read or -1 on error
+//!
+static int read_full(int fd, void *buf, size_t len)
+{
+    ssize_t n = 0;
+    size_t got = 0;
+
+    while (got < len) {
+        if ((n = read(fd, ((char *)buf) + got, (len - got))) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        if (n == 0)
+            return ((got == 0) ? 0 : -1);
+        got += n;
+    }
+    return (1);
+}
+
+//!
+//! Sends a reply to the client
+//!
+//! @param[in] fd the client socket
+//! @param[in] id the id of the request answered
+//! @param[in] status 0 on success or an errno value
+//! @param[in] out the output of the operation
+//!
+//! @return 0 on success or -1 if the client is gone
+//!
+static int send_reply(int fd, uint32_t id, int status, const char *out)
+{
+    ssize_t n = 0;
+    size_t sent = 0;
+    size_t len = 0;
+    char buf[sizeof(euca_rootwrap_reply) + EUCA_ROOTWRAP_MAX_REPLY] = "";
+    euca_rootwrap_reply *reply = ((euca_rootwrap_reply *) buf);
+
+    len = strnlen(out, (EUCA_ROOTWRAP_MAX_REPLY - 1));
+    reply->id = id;
+    reply->status = status;
+    reply->len = len + 1;
+    memcpy(buf + sizeof(euca_rootwrap_reply), out, len);
+    buf[sizeof(euca_rootwrap_reply) + len] = '\0';
+
+    len = sizeof(euca_rootwrap_reply) + reply->len;
+    while (sent < len) {
+        if ((n = send(fd, buf + sent, (len - sent), MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (-1);
+        }
+        sent += n;
+    }
+    return (0);
+}
+
+//!
+//! Resolves a user or group name, or a numeric ID, into an ID
+//!
+//! @param[in]  name the name or number
+//! @param[in]  user TRUE for a user, FALSE for a group
+//! @param[out] pId the resolved ID
+//!
+//! @return 0 on success or an errno value
+//!
+static int parse_id(const char *name, boolean user, unsigned int *pId)
+{
+    char *end = NULL;
+    unsigned long id = 0;
+    struct passwd *pw = NULL;
+    struct group *gr = NULL;
+
+    errno = 0;
+    id = strtoul(name, &end, 10);
+    if ((errno == 0) && (end != name) && (*end == '\0')) {
+        *pId = ((unsigned int)id);
+        return (0);
+    }
+
+    if (user && ((pw = getpwnam(name)) != NULL)) {
+        *pId = pw->pw_uid;
+        return (0);
+    }
+    if (!user && ((gr = getgrnam(name)) != NULL)) {
+        *pId = gr->gr_gid;
+        return (0);
+    }
+    return (EINVAL);
+}
+
+//!
+//! Changes the owner and/or group of a file
+//!
+//! @param[in]  args path, user name ("" to keep) and group name ("" to keep)
+//! @param[out] out an error message on failure
+//! @param[in]  out_size the size of the output buffer
+//!
+//! @return 0 on success or an errno value
+//!
+static int do_chown(char **args, char *out, size_t out_size)
+{
+    int rc = 0;
+    unsigned int uid = ((unsigned int)-1);
+    unsigned int gid = ((unsigned int)-1);
+
+    if ((args[1][0] != '\0') && ((rc = parse_id(args[1], TRUE, &uid)) != 0)) {
+        snprintf(out, out_size, "unknown user '%s'", args[1]);
+        return (rc);
+    }
+    if ((args[2][0] != '\0') && ((rc = parse_id(args[2], FALSE, &gid)) != 0)) {
+        snprintf(out, out_size, "unknown group '%s'", args[2]);
+        return (rc);
+    }
+
+    if (chown(args[0], ((uid_t) uid), ((gid_t) gid)) != 0) {
+        rc = errno;
+        snprintf(out, out_size, "chown %s: %s", args[0], strerror(rc));
+        return (rc);
+    }
+    return (0);
+}
+
+//!
+//! Changes the permissions of a file
+//!
+//! @param[in]  args path and octal mode
+//! @param[out] out an error message on failure
+//! @param[in]  out_size the size of the output buffer
+//!
+//! @return 0 on success or an errno value
+//!
+static int do_chmod(char **args, char *out, size_t out_size)
+{
+    int rc = 0;
+    char *end = NULL;
+    unsigned long mode = 0;
+
+    errno = 0;
+    mode = strtoul(args[1], &end, 8);
+    if ((errno != 0) || (end == args[1]) || (*end != '\0') || (mode > 07777)) {
+        snprintf(out, out_size, "invalid mode '%s'", args[1]);
+        return (EINVAL);
+    }
+
+    if (chmod(args[0], ((mode_t) mode)) != 0) {
+        rc = errno;
+        snprintf(out, out_size, "chmod %s: %s", args[0], strerror(rc));
+        return (rc);
+    }
+    return (0);
+}
+
+//!
+//! Attaches a file to the first free loop device, as 'losetup --find --show -o offset path'
+//! would. Another process may grab the device we were told is free, in which case we ask
+//! for another one.
+//!
+//! @param[in]  args path, offset and "1" to enable direct I/O
+//! @param[out] out the loop device on success or an error message on failure
+//! @param[in]  out_size the size of the output buffer
+//!
+//! @return 0 on success or an errno value
+//!
+static int do_loop_attach(char **args, char *out, size_t out_size)
+{
+    int i = 0;
+    int rc = 0;
+    int num = 0;
+    int ctlfd = -1;
+    int filefd = -1;
+    int loopfd = -1;
+    char *end = NULL;
+    char dev[64] = "";
+    long long offset = 0;
+    struct loop_info64 info = { 0 };
+
+    errno = 0;
+    offset = strtoll(args[1], &end, 10);
+    if ((errno != 0) || (end == args[1]) || (*end != '\0') || (offset < 0)) {
+        snprintf(out, out_size, "invalid offset '%s'", args[1]);
+        return (EINVAL);
+    }
+
+    if ((filefd = open(args[0], (O_RDWR | O_CLOEXEC))) < 0) {
+        if ((errno == EROFS) || (errno == EACCES))
+            filefd = open(args[0], (O_RDONLY | O_CLOEXEC));
+        if (filefd < 0) {
+            rc = errno;
+            snprintf(out, out_size, "open %s: %s", args[0], strerror(rc));
+            return (rc);
+        }
+    }
+
+    if ((ctlfd = open("/dev/loop-control", (O_RDWR | O_CLOEXEC))) < 0) {
+        rc = errno;
+        snprintf(out, out_size, "open /dev/loop-control: %s", strerror(rc));
+        close(filefd);
+        return (rc);
+    }
+
+    for (i = 0, rc = EBUSY; ((i < LOOP_ATTACH_TRIES) && (rc == EBUSY)); i++) {
+        if ((num = ioctl(ctlfd, LOOP_CTL_GET_FREE)) < 0) {
+            rc = errno;
+            snprintf(out, out_size, "no free loop device: %s", strerror(rc));
+            break;
+        }
+
+        snprintf(dev, sizeof(dev), "/dev/loop%d", num);
+        if ((loopfd = open(dev, (O_RDWR | O_CLOEXEC))) < 0) {
+            rc = errno;
+            snprintf(out, out_size, "open %s: %s", dev, strerror(rc));
+            break;
+        }
+
+        if (ioctl(loopfd, LOOP_SET_FD, filefd) == 0) {
+            rc = 0;
+        } else {
+            rc = errno;
+            snprintf(out, out_size, "attach %s to %s: %s", args[0], dev, strerror(rc));
+            close(loopfd);
+            loopfd = -1;
+        }
+    }
+    close(ctlfd);
+    close(filefd);
+
+    if (rc != 0)
+        return (rc);
+
+    info.lo_offset = offset;
+    euca_strncpy(((char *)info.lo_file_name), args[0], LO_NAME_SIZE);
+    for (i = 0; i < LOOP_STATUS_TRIES; i++) {
+        if ((rc = ((ioctl(loopfd, LOOP_SET_STATUS64, &info) == 0) ? 0 : errno)) != EAGAIN)
+            break;
+        usleep(LOOP_STATUS_RETRY_USEC);
+    }
+
+    if (rc != 0) {
+        snprintf(out, out_size, "set offset of %s: %s", dev, strerror(rc));
+        ioctl(loopfd, LOOP_CLR_FD, 0);
+        close(loopfd);
+        return (rc);
+    }
+#ifdef LOOP_SET_DIRECT_IO
+    // like losetup, carry on without direct I/O if the backing file system cannot do it
+    if (!strcmp(args[2], "1"))
+        ioctl(loopfd, LOOP_SET_DIRECT_IO, 1);
+#endif /* LOOP_SET_DIRECT_IO */
+
+    close(loopfd);
+    snprintf(out, out_size, "%s", dev);
+    return (0);
+}
+
+//!
+//! Detaches a loop device, as 'losetup -d' would
+//!
+//! @param[in]  args the loop device
+//! @param[out] out an error message on failure
+//! @param[in]  out_size the size of the output buffer
+//!
+//! @return 0 on success or an errno value
+//!
+static int do_loop_detach(char **args, char *out, size_t out_size)
+{
+    int rc = 0;
+    int loopfd = -1;
+
+    if (strncmp(args[0], "/dev/loop", 9) != 0) {
+        snprintf(out, out_size, "not a loop device '%s'", args[0]);
+        return (EINVAL);
+    }
+
+    if ((loopfd = open(args[0], (O_RDONLY | O_CLOEXEC))) < 0) {
+        rc = errno;
+        snprintf(out, out_size, "open %s: %s", args[0], strerror(rc));
+        return (rc);
+    }
+
+    if (ioctl(loopfd, LOOP_CLR_FD, 0) != 0) {
+        rc = errno;
+        snprintf(out, out_size, "detach %s: %s", args[0], strerror(rc));
+    }
+    close(loopfd);
+    return (rc);
+}
+
+//!
+//! Replaces the content of a file, creating it if needed
+//!
+//! @param[in]  args path and content
+//! @param[out] out an error message on failure
+//! @param[in]  out_size the size of the output buffer
+//!
+//! @return 0 on success or an errno value
+//!
+static int do_write_file(char **args, char *out, size_t out_size)
+{
+    int fd = -1;
+    int rc = 0;
+    ssize_t n = 0;
+    size_t len = strlen(args[1]);
+    size_t done = 0;
+
+    if ((fd = open(args[0], (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC), 0600)) < 0) {
+        rc = errno;
+        snprintf(out, out_size, "open %s: %s", args[0], strerror(rc));
+        return (rc);
+    }
+
+    while (done < len) {
+        if ((n = write(fd, args[1] + done, (len - done))) < 0) {
+            if (errno == EINTR)
+                continue;
+            rc = errno;
+            snprintf(out, out_size, "write %s: %s", args[0], strerror(rc));
+            break;
+        }
+        done += n;
+    }
+
+    if ((close(fd) != 0) && (rc == 0)) {
+        rc = errno;
+        snprintf(out, out_size, "close %s: %s", args[0], strerror(rc));
+    }
+    return (rc);
+}
+
+//!
+//! Serves requests from the process that started us until it closes the socket
+//!
+//! @param[in] fd the client socket
+//!
+//! @return 0 when the client went away or 1 on a protocol error
+//!
+static int serve(int fd)
+{
+    int rc = 0;
+    int status = 0;
+    int nargs = 0;
+    char *ptr = NULL;
+    char *buf = NULL;
+    char *args[EUCA_ROOTWRAP_MAX_ARGS] = { NULL };
+    char out[EUCA_ROOTWRAP_MAX_REPLY] = "";
+    euca_rootwrap_request request = { 0 };
+
+    while ((rc = read_full(fd, &request, sizeof(request))) == 1) {
+        if ((request.op >= EUCA_ROOTWRAP_LAST_OP) || (request.len == 0) || (request.len > EUCA_ROOTWRAP_MAX_REQUEST))
+            return (1);
+
+        if ((buf = malloc(request.len)) == NULL)
+            return (1);
+
+        if (read_full(fd, buf, request.len) != 1) {
+            free(buf);
+            return (1);
+        }
+
+        // split the arguments, which must all be '\0' terminated
+        if (buf[request.len - 1] != '\0') {
+            free(buf);
+            return (1);
+        }
+        for (ptr = buf, nargs = 0; ((ptr < (buf + request.len)) && (nargs < EUCA_ROOTWRAP_MAX_ARGS)); nargs++) {
+            args[nargs] = ptr;
+            ptr += strlen(ptr) + 1;
+        }
+
+        out[0] = '\0';
+        if ((nargs != ops[request.op].nargs) || (ptr != (buf + request.len))) {
+            snprintf(out, sizeof(out), "operation %u takes %d arguments", request.op, ops[request.op].nargs);
+            status = EINVAL;
+        } else if ((request.op != EUCA_ROOTWRAP_LOOP_DETACH) && (args[0][0] != '/')) {
+            snprintf(out, sizeof(out), "path '%s' is not absolute", args[0]);
+            status = EINVAL;
+        } else {
+            status = ops[request.op].handler(args, out, sizeof(out));
+        }
+
+        free(buf);
+        buf = NULL;
+
+        if (send_reply(fd, request.id, status, out) != 0)
+            return (0);
+    }
+
+    return ((rc == 0) ? 0 : 1);
+}
+
+#ifdef _UNIT_TEST
+//!
+//! Sends one request to a server
+//!
+//! @param[in] fd the client socket
+//! @param[in] id the request id
+//! @param[in] op the operation, possibly invalid
+//! @param[in] args the arguments of the operation
+//! @param[in] nargs the number of arguments
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int test_send(int fd, uint32_t id, uint32_t op, const char **args, int nargs)
+{
+    int i = 0;
+    size_t len = 0;
+    char buf[sizeof(euca_rootwrap_request) + 8192] = "";
+    euca_rootwrap_request *request = ((euca_rootwrap_request *) buf);
+
+    request->id = id;
+    request->op = op;
+    for (i = 0, len = sizeof(euca_rootwrap_request); i < nargs; i++) {
+        snprintf(buf + len, (sizeof(buf) - len), "%s", args[i]);
+        len += strlen(args[i]) + 1;
+    }
+    request->len = len - sizeof(euca_rootwrap_request);
+    return ((send(fd, buf, len, MSG_NOSIGNAL) == ((ssize_t) len)) ? 0 : -1);
+}
+
+//!
+//! Receives one reply from a server
+//!
+//! @param[in]  fd the client socket
+//! @param[out] reply the reply header
+//! @param[out] out the output of the operation, EUCA_ROOTWRAP_MAX_REPLY bytes
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int test_recv(int fd, euca_rootwrap_reply * reply, char *out)
+{
+    if ((read_full(fd, reply, sizeof(euca_rootwrap_reply)) != 1) || (reply->len == 0) || (reply->len > EUCA_ROOTWRAP_MAX_REPLY))
+        return (-1);
+    if ((read_full(fd, out, reply->len) != 1) || (out[reply->len - 1] != '\0'))
+        return (-1);
+    return (0);
+}
+
+//!
+//! Performs one operation through a server and checks the reply answers it
+//!
+//! @param[in]  fd the client socket
+//! @param[in]  id the request id
+//! @param[in]  op the operation
+//! @param[in]  args the arguments of the operation
+//! @param[in]  nargs the number of arguments
+//! @param[out] out the output of the operation, EUCA_ROOTWRAP_MAX_REPLY bytes
+//!
+//! @return the status of the operation
+//!
+static int test_call(int fd, uint32_t id, uint32_t op, const char **args, int nargs, char *out)
+{
+    int rc = 0;
+    euca_rootwrap_reply reply = { 0 };
+
+    rc = test_send(fd, id, op, args, nargs);
+    assert(rc == 0);
+    rc = test_recv(fd, &reply, out);
+    assert(rc == 0);
+    assert(reply.id == id);
+    printf("\top %u (id %u) -> %d '%s'\n", op, id, reply.status, out);
+    return (reply.status);
+}
+
+//!
+//! Runs serve() in a child process over a socket pair
+//!
+//! @param[out] pFd the client end of the socket pair
+//!
+//! @return the pid of the child
+//!
+static pid_t test_server(int *pFd)
+{
+    int rc = 0;
+    int sv[2] = { -1, -1 };
+    pid_t pid = -1;
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    assert(rc == 0);
+    pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        close(sv[0]);
+        _exit(serve(sv[1]));
+    }
+    close(sv[1]);
+    *pFd = sv[0];
+    return (pid);
+}
+
+//!
+//! Unit test: drives serve() and every operation handler over a socket pair, as the
+//! privileged helper would be driven by diskutil. Loop device operations are only
+//! checked for their outcome when run with the privileges they require.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return 0 on success; failures abort
+//!
+int main(int argc, char **argv)
+{
+    int fd = -1;
+    int rc = 0;
+    int status = 0;
+    int filefd = -1;
+    pid_t pid = -1;
+    char *ptr = NULL;
+    char uid[32] = "";
+    char gid[32] = "";
+    char dir[] = "/tmp/euca-rootwrap-test-XXXXXX";
+    char file[EUCA_MAX_PATH] = "";
+    char image[EUCA_MAX_PATH] = "";
+    char lodev[EUCA_ROOTWRAP_MAX_REPLY] = "";
+    char out[EUCA_ROOTWRAP_MAX_REPLY] = "";
+    char content[64] = "";
+    euca_rootwrap_reply reply = { 0 };
+    struct stat st = { 0 };
+
+    ptr = mkdtemp(dir);
+    assert(ptr != NULL);
+    snprintf(file, sizeof(file), "%s/file", dir);
+    snprintf(image, sizeof(image), "%s/image", dir);
+    snprintf(uid, sizeof(uid), "%u", getuid());
+    snprintf(gid, sizeof(gid), "%u", getgid());
+
+    pid = test_server(&fd);
+
+    printf("testing write_file\n");
+    status = test_call(fd, 1, EUCA_ROOTWRAP_WRITE_FILE, ((const char *[]) { file, "hello rootwrap" }), 2, out);
+    assert(status == 0);
+    filefd = open(file, O_RDONLY);
+    assert(filefd >= 0);
+    rc = read(filefd, content, sizeof(content) - 1);
+    close(filefd);
+    assert((rc == 14) && !strcmp(content, "hello rootwrap"));
+    status = test_call(fd, 2, EUCA_ROOTWRAP_WRITE_FILE, ((const char *[]) { "/nonexistent/dir/file", "x" }), 2, out);
+    assert(status == ENOENT);
+
+    printf("testing chmod\n");
+    status = test_call(fd, 3, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { file, "0640" }), 2, out);
+    assert(status == 0);
+    rc = stat(file, &st);
+    assert((rc == 0) && ((st.st_mode & 07777) == 0640));
+    status = test_call(fd, 4, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { file, "0999" }), 2, out);
+    assert(status == EINVAL);
+
+    printf("testing chown\n");
+    status = test_call(fd, 5, EUCA_ROOTWRAP_CHOWN, ((const char *[]) { file, uid, gid }), 3, out);
+    assert(status == 0);
+    status = test_call(fd, 6, EUCA_ROOTWRAP_CHOWN, ((const char *[]) { file, "", "" }), 3, out);
+    assert(status == 0);
+    status = test_call(fd, 7, EUCA_ROOTWRAP_CHOWN, ((const char *[]) { file, "no-such-user-euca", "" }), 3, out);
+    assert(status == EINVAL);
+
+    printf("testing argument checks\n");
+    status = test_call(fd, 8, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { "relative/file", "0600" }), 2, out);
+    assert(status == EINVAL);
+    status = test_call(fd, 9, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { file }), 1, out);
+    assert(status == EINVAL);
+
+    printf("testing pipelined requests\n");
+    rc = test_send(fd, 100, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { file, "0600" }), 2);
+    rc += test_send(fd, 101, EUCA_ROOTWRAP_CHMOD, ((const char *[]) { file, "bad" }), 2);
+    rc += test_send(fd, 102, EUCA_ROOTWRAP_WRITE_FILE, ((const char *[]) { file, "pipelined" }), 2);
+    assert(rc == 0);
+    rc = test_recv(fd, &reply, out);
+    assert((rc == 0) && (reply.id == 100) && (reply.status == 0));
+    rc = test_recv(fd, &reply, out);
+    assert((rc == 0) && (reply.id == 101) && (reply.status == EINVAL));
+    rc = test_recv(fd, &reply, out);
+    assert((rc == 0) && (reply.id == 102) && (reply.status == 0));
+    rc = stat(file, &st);
+    assert((rc == 0) && ((st.st_mode & 07777) == 0600) && (st.st_size == 9));
+
+    printf("testing loop_attach and loop_detach\n");
+    filefd = open(image, (O_WRONLY | O_CREAT), 0600);
+    assert(filefd >= 0);
+    rc = ftruncate(filefd, 1048576);
+    close(filefd);
+    assert(rc == 0);
+    status = test_call(fd, 10, EUCA_ROOTWRAP_LOOP_ATTACH, ((const char *[]) { image, "-1", "0" }), 3, out);
+    assert(status == EINVAL);
+    status = test_call(fd, 11, EUCA_ROOTWRAP_LOOP_DETACH, ((const char *[]) { image }), 1, out);
+    assert(status == EINVAL);
+    status = test_call(fd, 12, EUCA_ROOTWRAP_LOOP_ATTACH, ((const char *[]) { image, "512", "0" }), 3, lodev);
+    if (status == 0) {
+        assert(!strncmp(lodev, "/dev/loop", 9));
+        status = test_call(fd, 13, EUCA_ROOTWRAP_LOOP_DETACH, ((const char *[]) { lodev }), 1, out);
+        assert(status == 0);
+        status = test_call(fd, 14, EUCA_ROOTWRAP_LOOP_DETACH, ((const char *[]) { lodev }), 1, out);
+        assert(status == ENXIO);
+    } else {
+        // no loop devices or not enough privileges to use them here
+        assert((status == ENOENT) || (status == EACCES) || (status == EPERM) || (status == ENXIO));
+        printf("\tskipping loop device checks: %s\n", lodev);
+    }
+
+    printf("testing protocol errors\n");
+    rc = test_send(fd, 15, EUCA_ROOTWRAP_LAST_OP, ((const char *[]) { file }), 1);
+    assert(rc == 0);
+    rc = waitpid(pid, &status, 0);
+    assert((rc == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 1));
+    close(fd);
+
+    printf("testing client going away\n");
+    pid = test_server(&fd);
+    close(fd);
+    rc = waitpid(pid, &status, 0);
+    assert((rc == pid) && WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    unlink(file);
+    unlink(image);
+    rmdir(dir);
+    printf("all tests passed\n");
+    return (0);
+}
+#else /* _UNIT_TEST */
 //!
 //! Main entry point of the application
 //!
@@ -164,6 +838,17 @@ int main(int argc, char **argv)
     if (argc <= 1) {
         exit(1);
     }
+
+    if ((argc == 2) && !strcmp(argv[1], EUCA_ROOTWRAP_SERVER_ARG)) {
+        // helper daemon mode: tell the client whether we are root, then serve it
+        if ((setresuid(((uid_t) 0), ((uid_t) 0), ((uid_t) 0)) != 0) || (setresgid(((gid_t) 0), ((gid_t) 0), ((gid_t) 0)) != 0)) {
+            send_reply(STDIN_FILENO, 0, errno, "euca_rootwrap cannot become root");
+            exit(1);
+        }
+        if (send_reply(STDIN_FILENO, 0, 0, "euca_rootwrap") != 0)
+            exit(1);
+        exit(serve(STDIN_FILENO));
+    }
     // Allocate memory for our new argument list so we can sanitize every arguments...
     if ((newargv = calloc((argc - 1), sizeof(char *))) == NULL) {
         perror("alloc");
@@ -199,3 +884,4 @@ int main(int argc, char **argv)
     free(newargv[i]);
     exit(rc);
 }
+#endif /* _UNIT_TEST */
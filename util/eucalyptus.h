@@ -220,6 +220,7 @@
 #define CONFIG_SC_REQUEST_TIMEOUT               "SC_REQUEST_TIMEOUT"
 #define CONFIG_CONCURRENT_CLEANUP_OPS           "CONCURRENT_CLEANUP_OPS"
 #define CONFIG_DISABLE_SNAPSHOTS                "DISABLE_CACHE_SNAPSHOTS"
+#define CONFIG_LOOP_DIRECT_IO                   "USE_LOOP_DIRECT_IO"
 #define CONFIG_USE_VIRTIO_NET                   "USE_VIRTIO_NET"
 #define CONFIG_USE_VIRTIO_DISK                  "USE_VIRTIO_DISK"
 #define CONFIG_USE_VIRTIO_ROOT                  "USE_VIRTIO_ROOT"
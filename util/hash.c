@@ -67,6 +67,9 @@
 //! @file util/hash.c
 //! Implements various MD5 and Jenkins hash functionality
 //!
+//! Files are digested through hash_file(), which maps them a window at a time and feeds
+//! the digest incrementally, so image-sized files never need to be mapped or read whole.
+//!
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -96,13 +99,14 @@
 #include <sys/time.h>                  // gettimeofday
 #include <limits.h>
 #include <openssl/md5.h>
+#include <openssl/evp.h>
 #include <sys/mman.h>                  // mmap
 #include <pthread.h>
 
 #include "eucalyptus.h"
 #include "misc.h"
 #include "hash.h"
-#include "euca_auth.h"                 // base64_enc
+#include "euca_auth.h"                 // base64_enc, hex_encode
 #include "vnetwork.h"                  // OK / ERROR
 
 /*----------------------------------------------------------------------------*\
@@ -111,6 +115,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HASH_MMAP_WINDOW                         (64 * 1024 * 1024) //!< Bytes of a file mapped at a time by hash_file()
+#define HASH_READ_SIZE                           (1024 * 1024)  //!< Read size for files hash_file() cannot map
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -155,6 +162,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static const EVP_MD *hash_md(hash_type type);
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -229,8 +238,6 @@ int hash_b64enc_string(const char *in, char **out)
 //!
 int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
 {
-    u32 i = 0;
-    char *pBuf = NULL;
     u8 md5digest[MD5_DIGEST_LENGTH + 1] = { 0 };    // +1 for NULL termination.
 
     // Make sure our parameters are valid
@@ -252,10 +259,7 @@ int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
     bzero(sBuf, bufSize);
 
     // Convert the computed hash to readable hex values
-    for (i = 0, pBuf = sBuf; i < MD5_DIGEST_LENGTH; i++, pBuf += 2) {
-        sprintf(pBuf, "%02x", md5digest[i]);
-    }
-
+    hex_encode(sBuf, md5digest, MD5_DIGEST_LENGTH);
     return (EUCA_OK);
 }
 
@@ -275,45 +279,227 @@ int str2md5str(char *sBuf, u32 bufSize, const char *sValue)
 //!
 char *file2md5str(const char *path)
 {
-    u32 i = 0;
+    return (file2digeststr(path, HASH_MD5));
+}
+
+//!
+//! Maps a hash_type to its OpenSSL digest
+//!
+//! @param[in] type the digest algorithm
+//!
+//! @return the OpenSSL digest or NULL if type is unknown
+//!
+static const EVP_MD *hash_md(hash_type type)
+{
+    switch (type) {
+    case HASH_MD5:
+        return (EVP_md5());
+    case HASH_SHA256:
+        return (EVP_sha256());
+    default:
+        break;
+    }
+    return (NULL);
+}
+
+//!
+//! Starts an incremental digest
+//!
+//! @param[out] ctx  the digest state to initialize
+//! @param[in]  type the digest algorithm
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR if ctx is NULL or type is unknown
+//!         \li EUCA_MEMORY_ERROR if the digest context cannot be allocated
+//!         \li EUCA_ERROR if OpenSSL fails to set up the digest
+//!
+//! @post On success, ctx must be given to hash_final() or hash_abort() to release it
+//!
+int hash_init(hash_ctx * ctx, hash_type type)
+{
+    const EVP_MD *md = NULL;
+
+    if ((ctx == NULL) || ((md = hash_md(type)) == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    ctx->type = type;
+    if ((ctx->md_ctx = EVP_MD_CTX_create()) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    if (EVP_DigestInit_ex(ctx->md_ctx, md, NULL) != 1) {
+        hash_abort(ctx);
+        return (EUCA_ERROR);
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Adds data to an incremental digest
+//!
+//! @param[in] ctx  the digest state, from hash_init()
+//! @param[in] data the data to add
+//! @param[in] len  the length of data
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if ctx was not initialized or EUCA_ERROR if OpenSSL fails
+//!
+int hash_update(hash_ctx * ctx, const void *data, size_t len)
+{
+    if ((ctx == NULL) || (ctx->md_ctx == NULL) || ((data == NULL) && (len > 0)))
+        return (EUCA_INVALID_ERROR);
+
+    if ((len > 0) && (EVP_DigestUpdate(ctx->md_ctx, data, len) != 1))
+        return (EUCA_ERROR);
+    return (EUCA_OK);
+}
+
+//!
+//! Completes an incremental digest and releases its state
+//!
+//! @param[in]  ctx        the digest state, from hash_init()
+//! @param[out] digest     receives the digest, must hold HASH_MAX_DIGEST_LEN bytes
+//! @param[out] digest_len receives the length of the digest, may be NULL
+//!
+//! @return EUCA_OK on success, EUCA_INVALID_ERROR if a parameter is invalid or EUCA_ERROR if OpenSSL fails
+//!
+//! @post The ctx state is released whether or not the digest could be completed
+//!
+int hash_final(hash_ctx * ctx, u8 * digest, u32 * digest_len)
+{
+    int rc = EUCA_OK;
+    unsigned int len = 0;
+
+    if ((ctx == NULL) || (ctx->md_ctx == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if (digest == NULL) {
+        rc = EUCA_INVALID_ERROR;
+    } else if (EVP_DigestFinal_ex(ctx->md_ctx, digest, &len) != 1) {
+        rc = EUCA_ERROR;
+    } else if (digest_len != NULL) {
+        *digest_len = len;
+    }
+
+    hash_abort(ctx);
+    return (rc);
+}
+
+//!
+//! Releases the state of an incremental digest without completing it
+//!
+//! @param[in] ctx the digest state, from hash_init(). May be NULL or already released.
+//!
+void hash_abort(hash_ctx * ctx)
+{
+    if ((ctx != NULL) && (ctx->md_ctx != NULL)) {
+        EVP_MD_CTX_destroy(ctx->md_ctx);
+        ctx->md_ctx = NULL;
+    }
+}
+
+//!
+//! Computes the digest of a file. Regular files are mapped HASH_MMAP_WINDOW bytes at a
+//! time, anything that cannot be mapped (pipes, devices, procfs files) is read instead.
+//!
+//! @param[in]  path       the path to the file
+//! @param[in]  type       the digest algorithm
+//! @param[out] digest     receives the digest, must hold HASH_MAX_DIGEST_LEN bytes
+//! @param[out] digest_len receives the length of the digest, may be NULL
+//!
+//! @return EUCA_OK on success or the following error codes:
+//!         \li EUCA_INVALID_ERROR if a parameter is invalid
+//!         \li EUCA_ACCESS_ERROR if the file cannot be opened
+//!         \li EUCA_IO_ERROR if the file cannot be read
+//!         \li any error from hash_init()
+//!
+int hash_file(const char *path, hash_type type, u8 * digest, u32 * digest_len)
+{
+    int rc = EUCA_OK;
     int fd = -1;
-    char *p = NULL;
-    char *buf = NULL;
-    char *md5string = NULL;
-    u8 md5digest[MD5_DIGEST_LENGTH + 1] = { 0 };
+    char *map = NULL;
+    u8 *buf = NULL;
+    off_t offset = 0;
+    size_t window = 0;
+    ssize_t got = 0;
+    hash_ctx ctx = { 0 };
     struct stat mystat = { 0 };
 
-    // Make sure our given parameter is valid
-    if (path == NULL)
-        return (NULL);
+    if ((path == NULL) || (digest == NULL))
+        return (EUCA_INVALID_ERROR);
 
-    // Open the file for read only
     if ((fd = open(path, O_RDONLY)) < 0)
-        return (NULL);
+        return (EUCA_ACCESS_ERROR);
 
-    // can we stat this file?
-    if (fstat(fd, &mystat) >= 0) {
-        // Create a memory map for this file descriptor for the size of this file
-        if ((buf = mmap(0, mystat.st_size, PROT_READ, MAP_SHARED, fd, 0)) != MAP_FAILED) {
-            // Zero out our digest buffer...
-            bzero(md5digest, sizeof(md5digest));
-
-            // Compute the MD5 checksum of the content of this file
-            if (MD5(((const u8 *)buf), mystat.st_size, md5digest) != NULL) {
-                // Allocate memory for our output string
-                if ((md5string = EUCA_ZALLOC(((MD5_DIGEST_LENGTH * 2) + 1), sizeof(char))) != NULL) {
-                    for (i = 0, p = md5string; i < MD5_DIGEST_LENGTH; i++, p += 2) {
-                        sprintf(p, "%02x", md5digest[i]);
-                    }
-                }
+    if (fstat(fd, &mystat) < 0) {
+        close(fd);
+        return (EUCA_IO_ERROR);
+    }
+
+    if ((rc = hash_init(&ctx, type)) != EUCA_OK) {
+        close(fd);
+        return (rc);
+    }
+
+    if (S_ISREG(mystat.st_mode)) {
+        for (offset = 0; (rc == EUCA_OK) && (offset < mystat.st_size); offset += window) {
+            window = MIN(HASH_MMAP_WINDOW, (mystat.st_size - offset));
+            if ((map = mmap(NULL, window, PROT_READ, MAP_SHARED, fd, offset)) == MAP_FAILED)
+                break;
+
+            madvise(map, window, MADV_SEQUENTIAL);
+            rc = hash_update(&ctx, map, window);
+            munmap(map, window);
+        }
+    }
+    // Read whatever could not be mapped
+    if ((rc == EUCA_OK) && (!S_ISREG(mystat.st_mode) || (offset < mystat.st_size))) {
+        if ((buf = EUCA_ALLOC(HASH_READ_SIZE, sizeof(u8))) == NULL) {
+            rc = EUCA_MEMORY_ERROR;
+        } else if (S_ISREG(mystat.st_mode) && (lseek(fd, offset, SEEK_SET) < 0)) {
+            rc = EUCA_IO_ERROR;
+        } else {
+            while ((rc == EUCA_OK) && (((got = read(fd, buf, HASH_READ_SIZE)) > 0) || ((got < 0) && (errno == EINTR)))) {
+                if (got > 0)
+                    rc = hash_update(&ctx, buf, got);
             }
-            // Don't forget to free mapped memory
-            munmap(buf, mystat.st_size);
+
+            if ((rc == EUCA_OK) && (got < 0))
+                rc = EUCA_IO_ERROR;
         }
+        EUCA_FREE(buf);
     }
-    // Don't forget to close our file
     close(fd);
-    return (md5string);
+
+    if (rc != EUCA_OK) {
+        hash_abort(&ctx);
+        return (rc);
+    }
+    return (hash_final(&ctx, digest, digest_len));
+}
+
+//!
+//! Retrieves a new string with the hex value of the digest of a file (same as `md5sum`
+//! or `sha256sum`) or NULL if there was an error.
+//!
+//! @param[in] path the path to the file to digest
+//! @param[in] type the digest algorithm
+//!
+//! @return a new string with the hex value of the digest of the file or NULL if error
+//!
+//! @note The caller is responsible for freeing the allocated memory for the returned value
+//!
+char *file2digeststr(const char *path, hash_type type)
+{
+    u32 len = 0;
+    char *digeststr = NULL;
+    u8 digest[HASH_MAX_DIGEST_LEN] = { 0 };
+
+    if (hash_file(path, type, digest, &len) != EUCA_OK)
+        return (NULL);
+
+    if ((digeststr = EUCA_ALLOC(((len * 2) + 1), sizeof(char))) != NULL) {
+        hex_encode(digeststr, digest, len);
+    }
+    return (digeststr);
 }
 
 //!
@@ -371,3 +557,359 @@ int hexjenkins(char *sBuf, u32 bufSize, const char *sValue)
     }
     return (EUCA_INVALID_ERROR);
 }
+
+#ifdef _UNIT_TEST
+#include <openssl/buffer.h>
+
+//!
+//! Returns a monotonic timestamp for the benchmark
+//!
+//! @return the time in nanoseconds
+//!
+static long long bench_now_ns(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec);
+}
+
+//!
+//! Prints the throughput of one benchmark case
+//!
+//! @param[in] name     the benchmark case
+//! @param[in] bytes    the number of input bytes processed
+//! @param[in] start_ns the time the case started, from bench_now_ns()
+//!
+static void bench_report(const char *name, double bytes, long long start_ns)
+{
+    long long elapsed_ns = bench_now_ns() - start_ns;
+
+    if (elapsed_ns <= 0)
+        elapsed_ns = 1;
+    printf("%-32s %10.1f MB/s\n", name, (bytes / (1024.0 * 1024.0)) / (elapsed_ns / 1e9));
+}
+
+//!
+//! Checks the base64 and hex codecs against OpenSSL and plain printf on every length up
+//! to a few vector blocks, at every alignment, plus the whitespace and garbage handling
+//!
+//! @return the number of failed checks
+//!
+static int test_codecs(void)
+{
+    int errors = 0;
+    int len = 0;
+    int align = 0;
+    int i = 0;
+    int dec_len = 0;
+    u8 data[1024] = { 0 };
+    char ref[2048] = "";
+    char wrapped[2048] = "";
+    char *enc = NULL;
+    char *dec = NULL;
+    char *hex = NULL;
+    char *p = NULL;
+
+    for (i = 0; i < sizeof(data); i++)
+        data[i] = random() & 0xff;
+
+    for (len = 1; len <= 300; len++) {
+        for (align = 0; align < 4; align++) {
+            EVP_EncodeBlock(((u8 *) ref), data + align, len);
+            if (((enc = base64_enc(data + align, len)) == NULL) || strcmp(enc, ref)) {
+                printf("base64_enc mismatch for length %d at offset %d\n", len, align);
+                errors++;
+            } else if (((dec = base64_dec2(((u8 *) enc), strlen(enc), &dec_len)) == NULL) || (dec_len != len) || memcmp(dec, data + align, len)) {
+                printf("base64_dec2 mismatch for length %d at offset %d\n", len, align);
+                errors++;
+            }
+            EUCA_FREE(dec);
+
+            for (i = 0, p = ref; i < len; i++, p += 2)
+                sprintf(p, "%02x", data[align + i]);
+            if (((hex = hexify(data + align, len)) == NULL) || strcmp(hex, ref)) {
+                printf("hexify mismatch for length %d at offset %d\n", len, align);
+                errors++;
+            }
+            EUCA_FREE(hex);
+
+            // PEM style line breaks must not change what is decoded
+            if (enc != NULL) {
+                for (i = 0, p = wrapped; enc[i] != '\0'; i++) {
+                    *p++ = enc[i];
+                    if ((i % 64) == 63)
+                        *p++ = '\n';
+                }
+                *p = '\0';
+                if (((dec = base64_dec2(((u8 *) wrapped), strlen(wrapped), &dec_len)) == NULL) || (dec_len != len) || memcmp(dec, data + align, len)) {
+                    printf("base64_dec2 mismatch for wrapped length %d at offset %d\n", len, align);
+                    errors++;
+                }
+                EUCA_FREE(dec);
+            }
+            EUCA_FREE(enc);
+        }
+    }
+
+    // decoding stops at the first character outside the alphabet and fails if nothing came before it
+    if (((dec = base64_dec(((u8 *) "QUJD!QUJD"), 9)) == NULL) || strcmp(dec, "ABC")) {
+        printf("base64_dec did not stop at an invalid character\n");
+        errors++;
+    }
+    EUCA_FREE(dec);
+    if ((dec = base64_dec(((u8 *) "!QUJDQUJDQUJDQUJDQUJDQUJDQUJDQUJDQUJD"), 37)) != NULL) {
+        printf("base64_dec accepted invalid data\n");
+        errors++;
+    }
+    EUCA_FREE(dec);
+    return (errors);
+}
+
+//!
+//! Checks the incremental digests against the one-shot OpenSSL digests, in chunks of
+//! varying size and through files that can and cannot be mapped
+//!
+//! @return the number of failed checks
+//!
+static int test_digests(void)
+{
+    int errors = 0;
+    int fd = -1;
+    int t = 0;
+    size_t i = 0;
+    size_t chunk = 0;
+    size_t size = (3 * 1024 * 1024) + 12345;
+    u32 len = 0;
+    u32 ref_len = 0;
+    u8 *data = NULL;
+    u8 digest[HASH_MAX_DIGEST_LEN] = { 0 };
+    u8 ref[EVP_MAX_MD_SIZE] = { 0 };
+    char *str = NULL;
+    char path[] = "/tmp/euca-hash-test-XXXXXX";
+    hash_ctx ctx = { 0 };
+    const EVP_MD *mds[2] = { EVP_md5(), EVP_sha256() };
+    hash_type types[2] = { HASH_MD5, HASH_SHA256 };
+
+    if ((data = EUCA_ALLOC(size, sizeof(u8))) == NULL)
+        return (1);
+    for (i = 0; i < size; i++)
+        data[i] = random() & 0xff;
+
+    if (((fd = mkstemp(path)) < 0) || (write(fd, data, size) != size)) {
+        printf("cannot write %s\n", path);
+        EUCA_FREE(data);
+        return (1);
+    }
+    close(fd);
+
+    for (t = 0; t < 2; t++) {
+        EVP_Digest(data, size, ref, &ref_len, mds[t], NULL);
+
+        hash_init(&ctx, types[t]);
+        for (i = 0; i < size; i += chunk) {
+            chunk = MIN((random() % 100000), (size - i));
+            hash_update(&ctx, data + i, chunk);
+        }
+        if ((hash_final(&ctx, digest, &len) != EUCA_OK) || (len != ref_len) || memcmp(digest, ref, len)) {
+            printf("incremental digest %d mismatch\n", t);
+            errors++;
+        }
+
+        if ((hash_file(path, types[t], digest, &len) != EUCA_OK) || (len != ref_len) || memcmp(digest, ref, len)) {
+            printf("file digest %d mismatch\n", t);
+            errors++;
+        }
+    }
+
+    // character devices are read rather than mapped, and empty input still has a digest
+    if (((str = file2md5str("/dev/null")) == NULL) || strcmp(str, "d41d8cd98f00b204e9800998ecf8427e")) {
+        printf("digest of /dev/null is %s\n", str);
+        errors++;
+    }
+    EUCA_FREE(str);
+
+    if ((truncate(path, 0) != 0) || ((str = file2digeststr(path, HASH_SHA256)) == NULL) || strcmp(str, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855")) {
+        printf("digest of an empty file is %s\n", str);
+        errors++;
+    }
+    EUCA_FREE(str);
+
+    unlink(path);
+    EUCA_FREE(data);
+    return (errors);
+}
+
+//!
+//! Base64 encodes through an OpenSSL BIO chain, the way base64_enc() used to
+//!
+//! @param[in] in   the data to encode
+//! @param[in] size the length of in
+//!
+//! @return the encoded string, to be freed by the caller
+//!
+static char *bench_bio_enc(u8 * in, int size)
+{
+    char *out = NULL;
+    BIO *b64 = BIO_new(BIO_f_base64());
+    BUF_MEM *mem = NULL;
+
+    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+    b64 = BIO_push(b64, BIO_new(BIO_s_mem()));
+    BIO_write(b64, in, size);
+    (void)BIO_flush(b64);
+    BIO_get_mem_ptr(b64, &mem);
+    if ((out = EUCA_ALLOC((mem->length + 1), sizeof(char))) != NULL) {
+        memcpy(out, mem->data, mem->length);
+        out[mem->length] = '\0';
+    }
+    BIO_free_all(b64);
+    return (out);
+}
+
+//!
+//! Base64 decodes through an OpenSSL BIO chain, the way base64_dec() used to
+//!
+//! @param[in] in   the string to decode
+//! @param[in] size the length of in
+//!
+//! @return the decoded data, to be freed by the caller
+//!
+static char *bench_bio_dec(u8 * in, int size)
+{
+    char *out = NULL;
+    BIO *b64 = BIO_new(BIO_f_base64());
+
+    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+    b64 = BIO_push(b64, BIO_new_mem_buf(in, size));
+    if ((out = EUCA_ZALLOC(size, sizeof(char))) != NULL)
+        BIO_read(b64, out, size);
+    BIO_free_all(b64);
+    return (out);
+}
+
+//!
+//! Converts to hex one byte at a time, the way hexify() used to
+//!
+//! @param[in] in   the data to convert
+//! @param[in] size the length of in
+//!
+//! @return the hex string, to be freed by the caller
+//!
+static char *bench_scalar_hex(u8 * in, int size)
+{
+    int i = 0;
+    char *out = NULL;
+    static const char digits[] = "0123456789abcdef";
+
+    if ((out = EUCA_ALLOC(((size * 2) + 1), sizeof(char))) != NULL) {
+        for (i = 0; i < size; i++) {
+            out[i * 2] = digits[in[i] / 16];
+            out[i * 2 + 1] = digits[in[i] % 16];
+        }
+        out[size * 2] = '\0';
+    }
+    return (out);
+}
+
+//!
+//! Measures the throughput of the codecs against the code they replaced, and of the
+//! file digests
+//!
+//! @param[in] kb         the size of one input buffer in kilobytes
+//! @param[in] iterations the number of times each buffer is processed
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+static int run_benchmark(int kb, int iterations)
+{
+    int fd = -1;
+    int i = 0;
+    int len = 0;
+    int size = kb * 1024;
+    u8 *data = NULL;
+    char *enc = NULL;
+    char *out = NULL;
+    char *str = NULL;
+    char path[] = "/tmp/euca-hash-bench-XXXXXX";
+    long long start_ns = 0;
+
+    if ((size <= 0) || (iterations <= 0) || ((data = EUCA_ALLOC(size, sizeof(u8))) == NULL))
+        return (EUCA_ERROR);
+    for (i = 0; i < size; i++)
+        data[i] = random() & 0xff;
+
+    printf("%d iterations over %d KB\n", iterations, kb);
+    if ((enc = base64_enc(data, size)) == NULL) {
+        EUCA_FREE(data);
+        return (EUCA_ERROR);
+    }
+    len = strlen(enc);
+
+#define BENCH(_name, _bytes, _call)                    \
+{                                                      \
+    start_ns = bench_now_ns();                         \
+    for (i = 0; i < iterations; i++) {                 \
+        out = (_call);                                 \
+        EUCA_FREE(out);                                \
+    }                                                  \
+    bench_report((_name), ((double)(_bytes)) * iterations, start_ns); \
+}
+
+    BENCH("base64_enc", size, base64_enc(data, size));
+    BENCH("base64 encode, BIO (baseline)", size, bench_bio_enc(data, size));
+    BENCH("base64_dec", len, base64_dec(((u8 *) enc), len));
+    BENCH("base64 decode, BIO (baseline)", len, bench_bio_dec(((u8 *) enc), len));
+    BENCH("hexify", size, hexify(data, size));
+    BENCH("hex, scalar (baseline)", size, bench_scalar_hex(data, size));
+
+#undef BENCH
+
+    if (((fd = mkstemp(path)) >= 0) && (write(fd, data, size) == size)) {
+        start_ns = bench_now_ns();
+        for (i = 0; i < iterations; i++) {
+            str = file2digeststr(path, HASH_MD5);
+            EUCA_FREE(str);
+        }
+        bench_report("file2digeststr MD5", ((double)size) * iterations, start_ns);
+
+        start_ns = bench_now_ns();
+        for (i = 0; i < iterations; i++) {
+            str = file2digeststr(path, HASH_SHA256);
+            EUCA_FREE(str);
+        }
+        bench_report("file2digeststr SHA-256", ((double)size) * iterations, start_ns);
+    }
+    if (fd >= 0) {
+        close(fd);
+        unlink(path);
+    }
+
+    EUCA_FREE(enc);
+    EUCA_FREE(data);
+    return (EUCA_OK);
+}
+
+//!
+//! Main entry point of the application. Runs the codec and digest checks, or with
+//! "bench [KB] [iterations]" measures their throughput.
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int main(int argc, char **argv)
+{
+    int errors = 0;
+
+    if ((argc > 1) && !strcmp(argv[1], "bench")) {
+        return (run_benchmark(((argc > 2) ? atoi(argv[2]) : 1024), ((argc > 3) ? atoi(argv[3]) : 100)));
+    }
+
+    errors += test_codecs();
+    errors += test_digests();
+    printf("%s: %d error(s)\n", ((errors == 0) ? "PASSED" : "FAILED"), errors);
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
+}
+#endif /* _UNIT_TEST */
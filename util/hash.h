@@ -68,7 +68,8 @@
 
 //!
 //! @file util/hash.h
-//! Provides various MD5 and Jenkins hash functionality
+//! Provides various MD5 and Jenkins hash functionality, along with an incremental
+//! MD5/SHA-256 digest API for data that arrives in pieces or lives in large files
 //!
 
 /*----------------------------------------------------------------------------*\
@@ -83,6 +84,8 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define HASH_MAX_DIGEST_LEN                      32 //!< Largest digest produced by any hash_type (SHA-256)
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -95,12 +98,24 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Digest algorithms supported by the hash_init() family
+typedef enum hash_type_t {
+    HASH_MD5 = 0,
+    HASH_SHA256,
+} hash_type;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! State of a digest being computed incrementally, see hash_init()
+typedef struct hash_ctx_t {
+    hash_type type;                    //!< the digest algorithm
+    void *md_ctx;                      //!< the OpenSSL digest context, NULL once finalized
+} hash_ctx;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -119,6 +134,13 @@ int str2md5str(char *sBuf, u32 bufSize, const char *sValue);
 
 char *file2md5str(const char *path);
 
+int hash_init(hash_ctx * ctx, hash_type type);
+int hash_update(hash_ctx * ctx, const void *data, size_t len);
+int hash_final(hash_ctx * ctx, u8 * digest, u32 * digest_len);
+void hash_abort(hash_ctx * ctx);
+int hash_file(const char *path, hash_type type, u8 * digest, u32 * digest_len);
+char *file2digeststr(const char *path, hash_type type);
+
 u32 jenkins(const char *key, size_t len);
 int hexjenkins(char *sBuf, u32 bufSize, const char *sValue);
 
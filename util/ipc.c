@@ -68,6 +68,11 @@
 //! Provides wrappers that support BOTH SYS V semaphores and the POSIX named
 //! semaphores depending on whether name was passed to sem_alloc().
 //!
+//! The "mutex" type is a futex based counting semaphore. Taking an
+//! available semaphore is a single compare-and-swap in userspace; only callers
+//! that must block enter the kernel. Each futex semaphore keeps contention
+//! statistics that can be collected with sem_get_lock_stats().
+//!
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -87,6 +92,11 @@
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "eucalyptus.h"
 #include "misc.h"                      /* logprintfl */
@@ -136,12 +146,31 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Futex semaphores of this process whose statistics sem_get_lock_stats() reports
+static sem *tracked_sems[IPC_MAX_TRACKED_LOCKS] = { NULL };
+static pthread_mutex_t tracked_sems_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread s32 my_thread_id = 0;  //!< cached kernel thread ID of the calling thread
+static pthread_once_t thread_id_once = PTHREAD_ONCE_INIT;  //!< for thread_id_init_once()
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static void thread_id_atfork_child(void);
+static void thread_id_init_once(void);
+static s32 ipc_thread_id(void);
+static void sem_track(sem * pSem, boolean track);
+static int futex_call(s32 * pWord, int op, s32 val);
+static int futex_wait(ipc_futex * pFutex);
+static int futex_post(ipc_futex * pFutex);
+
+#ifdef _UNIT_TEST
+static int test_futex_semaphore(void);
+#endif /* _UNIT_TEST */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                   MACROS                                   |
@@ -160,8 +189,8 @@
 //! Allocate a new semaphore with the given name and mutex starting value.
 //!
 //! @param[in] val  the starting mutex count
-//! @param[in] typeName the type of semaphore ('mutex' = pthread mutex; 'semaphore' = semaphore) if any other
-//!                     name, then SYS V IPC semaphore is implied.
+//! @param[in] typeName the type of semaphore ('mutex' = futex semaphore) if any other name then posix
+//!                     named semaphore is used if an empty name then SYS V IPC semaphore is implied.
 //!
 //! @return a pointer to the newly allocated semaphore or NULL if a failure occured
 //!
@@ -185,7 +214,7 @@ sem *sem_alloc(const int val, const char *typeName)
 //! Allocate a new semaphore with the given name and mutex starting value.
 //!
 //! @param[in] val   the starting mutex count
-//! @param[in] typeName  the type of semaphore. If 'mutex' then pthread mutexis used if any other
+//! @param[in] typeName  the type of semaphore. If 'mutex' then a futex semaphore is used if any other
 //!                      name then posix named semaphore is used if an empty name then SYS V IPC
 //!                      semaphore is implied.
 //! @param[in] flags Kernel encoding of open mode
@@ -225,15 +254,20 @@ sem *sem_realloc(const int val, const char *typeName, u32 flags)
     // Initialize our semphore base on the requested type
     //
     if (!strcmp(typeName, IPC_MUTEX_SEMAPHORE)) {
-        // use pthread mutex
-        pSem->usemutex = 1;
-        pSem->mutcount = val;
-        pSem->mutwaiters = 0;
-        pthread_mutex_init(&(pSem->mutex), NULL);
-        pthread_cond_init(&(pSem->cond), NULL);
+        // use a futex
+        if ((pSem->futex = EUCA_ZALLOC(1, sizeof(ipc_futex))) == NULL) {
+            EUCA_FREE(pSem);
+            return (NULL);
+        }
+
+        pSem->futex->value = val;
+        pSem->futex->waiters = 0;
+        bzero(&(pSem->futex->stats), sizeof(ipc_lock_stats));
+        snprintf(pSem->futex->stats.name, IPC_LOCK_NAME_LEN, "%s", addr);
 
         // In this case we'll use the address of the semaphore rather than the name
         pSem->name = strdup(addr);
+        sem_track(pSem, TRUE);
     } else if (strlen(typeName) > 0) {
         // named semaphores
         if (pSem->flags & O_EXCL) {
@@ -335,9 +369,10 @@ void sem_free(sem * pSem)
         if (pSem->sysv > 0) {
             semctl(pSem->sysv, 0, IPC_RMID, arg);
         }
-        // If we use mutex, we need to destroy it.
-        if (pSem->usemutex) {
-            pthread_mutex_destroy(&(pSem->mutex));
+        // If we use a futex, stop tracking it and release its memory
+        if (pSem->futex) {
+            sem_track(pSem, FALSE);
+            EUCA_FREE(pSem->futex);
         }
         // Free the memory for the name before freeing the semaphore structure memory
         EUCA_FREE(pSem->name);
@@ -361,7 +396,6 @@ void sem_free(sem * pSem)
 //!
 int sem_prolaag(sem * pSem, boolean doLog)
 {
-    int rc = 0;
     struct sembuf sb = { 0, -1, 0 };
 
     // Make sure our given semaphore is valid
@@ -370,18 +404,9 @@ int sem_prolaag(sem * pSem, boolean doLog)
         if (doLog) {
             LOGEXTREME("%s locking\n", pSem->name);
         }
-        // For mutex semaphore
-        if (pSem->usemutex) {
-            rc = pthread_mutex_lock(&(pSem->mutex));
-            pSem->mutwaiters++;
-            while (pSem->mutcount == 0) {
-                pthread_cond_wait(&(pSem->cond), &(pSem->mutex));
-            }
-
-            pSem->mutwaiters--;
-            pSem->mutcount--;
-            rc = pthread_mutex_unlock(&(pSem->mutex));
-            return (rc);
+        // For futex semaphore
+        if (pSem->futex) {
+            return (futex_wait(pSem->futex));
         }
         // For Posix semaphore
         if (pSem->posix) {
@@ -426,7 +451,6 @@ int sem_p(sem * pSem)
 //!
 int sem_verhogen(sem * pSem, boolean doLog)
 {
-    int rc = 0;
     struct sembuf sb = { 0, 1, 0 };
 
     // Make sure our given semaphore is valid
@@ -435,16 +459,9 @@ int sem_verhogen(sem * pSem, boolean doLog)
         if (doLog) {
             LOGEXTREME("%s unlocking\n", pSem->name);
         }
-        // For mutex semaphore
-        if (pSem->usemutex) {
-            rc = pthread_mutex_lock(&(pSem->mutex));
-            if (pSem->mutwaiters > 0) {
-                rc = pthread_cond_signal(&(pSem->cond));
-            }
-
-            pSem->mutcount++;
-            rc = pthread_mutex_unlock(&(pSem->mutex));
-            return (rc);
+        // For futex semaphore
+        if (pSem->futex) {
+            return (futex_post(pSem->futex));
         }
         // For Posix semaphore
         if (pSem->posix) {
@@ -472,3 +489,392 @@ int sem_v(sem * pSem)
 {
     return (sem_verhogen(pSem, TRUE));
 }
+
+//!
+//! Sets the name reported in the lock statistics of a futex semaphore. Other semaphore
+//! types keep no statistics and are left untouched.
+//!
+//! @param[in] pSem a pointer to the semaphore to name
+//! @param[in] name the name to report for this semaphore
+//!
+void sem_set_stats_name(sem * pSem, const char *name)
+{
+    if (pSem && pSem->futex && name) {
+        snprintf(pSem->futex->stats.name, IPC_LOCK_NAME_LEN, "%s", name);
+    }
+}
+
+//!
+//! Collects the statistics of the futex semaphores allocated by this process.
+//!
+//! @param[out] pStats array receiving one entry per semaphore
+//! @param[in]  max    the number of entries pStats can hold
+//! @param[in]  reset  set to TRUE to zero the counters as they are read, so the next call
+//!                    only reports what happened in between
+//!
+//! @return the number of entries written to pStats
+//!
+int sem_get_lock_stats(ipc_lock_stats * pStats, int max, boolean reset)
+{
+    int i = 0;
+    int count = 0;
+
+    if ((pStats == NULL) || (max < 1))
+        return (0);
+
+    pthread_mutex_lock(&tracked_sems_mutex);
+    {
+        for (i = 0; (i < IPC_MAX_TRACKED_LOCKS) && (count < max); i++) {
+            if (tracked_sems[i] != NULL) {
+                ipc_lock_stats_take(&(tracked_sems[i]->futex->stats), &(pStats[count++]), reset);
+            }
+        }
+    }
+    pthread_mutex_unlock(&tracked_sems_mutex);
+    return (count);
+}
+
+//!
+//! Accounts for one acquisition of a lock. Only atomic operations are used so the
+//! statistics may live in memory shared by several processes.
+//!
+//! @param[in] pStats    the statistics of the lock that was acquired
+//! @param[in] holder    the thread or process ID of the new holder
+//! @param[in] contended set to TRUE if the caller had to block for the lock
+//! @param[in] waitNs    how long the caller blocked, in nanoseconds
+//!
+void ipc_lock_stats_acquired(ipc_lock_stats * pStats, s32 holder, boolean contended, u64 waitNs)
+{
+    u64 max = 0;
+
+    if (pStats == NULL)
+        return;
+
+    __atomic_store_n(&(pStats->holder), holder, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(pStats->acquisitions), 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_add_fetch(&(pStats->contended), 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(pStats->wait_ns_total), waitNs, __ATOMIC_RELAXED);
+        max = __atomic_load_n(&(pStats->wait_ns_max), __ATOMIC_RELAXED);
+        while ((waitNs > max) && !__atomic_compare_exchange_n(&(pStats->wait_ns_max), &max, waitNs, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+    }
+}
+
+//!
+//! Accounts for the release of a lock
+//!
+//! @param[in] pStats the statistics of the lock being released
+//!
+void ipc_lock_stats_released(ipc_lock_stats * pStats)
+{
+    if (pStats) {
+        __atomic_store_n(&(pStats->holder), 0, __ATOMIC_RELAXED);
+    }
+}
+
+//!
+//! Copies the statistics of a lock, optionally zeroing the counters in the same pass.
+//! Acquisitions made while copying are accounted to the next read.
+//!
+//! @param[in]  pStats the statistics to read
+//! @param[out] pCopy  receives the copy
+//! @param[in]  reset  set to TRUE to zero the counters
+//!
+void ipc_lock_stats_take(ipc_lock_stats * pStats, ipc_lock_stats * pCopy, boolean reset)
+{
+    if ((pStats == NULL) || (pCopy == NULL))
+        return;
+
+    memcpy(pCopy->name, pStats->name, IPC_LOCK_NAME_LEN);
+    pCopy->name[IPC_LOCK_NAME_LEN - 1] = '\0';
+    pCopy->holder = __atomic_load_n(&(pStats->holder), __ATOMIC_RELAXED);
+    if (reset) {
+        pCopy->acquisitions = __atomic_exchange_n(&(pStats->acquisitions), 0, __ATOMIC_RELAXED);
+        pCopy->contended = __atomic_exchange_n(&(pStats->contended), 0, __ATOMIC_RELAXED);
+        pCopy->wait_ns_total = __atomic_exchange_n(&(pStats->wait_ns_total), 0, __ATOMIC_RELAXED);
+        pCopy->wait_ns_max = __atomic_exchange_n(&(pStats->wait_ns_max), 0, __ATOMIC_RELAXED);
+    } else {
+        pCopy->acquisitions = __atomic_load_n(&(pStats->acquisitions), __ATOMIC_RELAXED);
+        pCopy->contended = __atomic_load_n(&(pStats->contended), __ATOMIC_RELAXED);
+        pCopy->wait_ns_total = __atomic_load_n(&(pStats->wait_ns_total), __ATOMIC_RELAXED);
+        pCopy->wait_ns_max = __atomic_load_n(&(pStats->wait_ns_max), __ATOMIC_RELAXED);
+    }
+}
+
+//!
+//! Monotonic clock used to time lock waits
+//!
+//! @return the current monotonic time in nanoseconds
+//!
+u64 ipc_clock_ns(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((u64) ts.tv_sec * 1000000000ULL) + (u64) ts.tv_nsec);
+}
+
+//!
+//! Clears the cached thread ID in the child after a fork()
+//!
+static void thread_id_atfork_child(void)
+{
+    my_thread_id = 0;
+}
+
+//!
+//! Registers the fork handler keeping the cached thread ID valid
+//!
+static void thread_id_init_once(void)
+{
+    pthread_atfork(NULL, NULL, thread_id_atfork_child);
+}
+
+//!
+//! Retrieves the kernel thread ID of the caller, which is the process ID for a
+//! single threaded process. The value is cached per thread.
+//!
+//! @return the thread ID of the caller
+//!
+static s32 ipc_thread_id(void)
+{
+    if (my_thread_id == 0) {
+        pthread_once(&thread_id_once, thread_id_init_once);
+        my_thread_id = (s32) syscall(SYS_gettid);
+    }
+    return (my_thread_id);
+}
+
+//!
+//! Adds or removes a futex semaphore from the set reported by sem_get_lock_stats().
+//! When the set is full the semaphore still works but its statistics are not reported.
+//!
+//! @param[in] pSem  the semaphore to add or remove
+//! @param[in] track set to TRUE to add the semaphore, FALSE to remove it
+//!
+static void sem_track(sem * pSem, boolean track)
+{
+    int i = 0;
+
+    pthread_mutex_lock(&tracked_sems_mutex);
+    {
+        for (i = 0; i < IPC_MAX_TRACKED_LOCKS; i++) {
+            if (track && (tracked_sems[i] == NULL)) {
+                tracked_sems[i] = pSem;
+                break;
+            } else if (!track && (tracked_sems[i] == pSem)) {
+                tracked_sems[i] = NULL;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&tracked_sems_mutex);
+}
+
+//!
+//! Invokes the futex system call on a futex word
+//!
+//! @param[in] pWord  the futex word
+//! @param[in] op     FUTEX_WAIT or FUTEX_WAKE
+//! @param[in] val    the expected value for FUTEX_WAIT or the number of waiters to wake for FUTEX_WAKE
+//!
+//! @return the system call result
+//!
+static int futex_call(s32 * pWord, int op, s32 val)
+{
+    // the word is never mapped by another process, so the kernel may skip the shared futex hashing
+    return ((int)syscall(SYS_futex, pWord, (op | FUTEX_PRIVATE_FLAG), val, NULL, NULL, 0));
+}
+
+//!
+//! Acquires a futex semaphore. An available semaphore is taken with a compare-and-swap
+//! without entering the kernel. Otherwise the caller registers as a waiter and sleeps
+//! on the futex word until the count becomes positive, and the time spent is accounted
+//! as contention.
+//!
+//! @param[in] pFutex the futex semaphore to acquire
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int futex_wait(ipc_futex * pFutex)
+{
+    s32 value = 0;
+    u64 start = 0;
+
+    // Uncontended fast path
+    value = __atomic_load_n(&(pFutex->value), __ATOMIC_RELAXED);
+    while (value > 0) {
+        if (__atomic_compare_exchange_n(&(pFutex->value), &value, (value - 1), TRUE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            ipc_lock_stats_acquired(&(pFutex->stats), ipc_thread_id(), FALSE, 0);
+            return (0);
+        }
+    }
+
+    // Contended: the waiter count must be visible before we re-check the value, so futex_post() cannot miss us
+    start = ipc_clock_ns();
+    __atomic_add_fetch(&(pFutex->waiters), 1, __ATOMIC_SEQ_CST);
+    for (;;) {
+        value = __atomic_load_n(&(pFutex->value), __ATOMIC_SEQ_CST);
+        if (value > 0) {
+            if (__atomic_compare_exchange_n(&(pFutex->value), &value, (value - 1), FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                break;
+        } else if ((futex_call(&(pFutex->value), FUTEX_WAIT, 0) != 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            __atomic_sub_fetch(&(pFutex->waiters), 1, __ATOMIC_SEQ_CST);
+            return (-1);
+        }
+    }
+    __atomic_sub_fetch(&(pFutex->waiters), 1, __ATOMIC_SEQ_CST);
+
+    ipc_lock_stats_acquired(&(pFutex->stats), ipc_thread_id(), TRUE, (ipc_clock_ns() - start));
+    return (0);
+}
+
+//!
+//! Releases a futex semaphore, waking one waiter if any is registered
+//!
+//! @param[in] pFutex the futex semaphore to release
+//!
+//! @return 0 on success or -1 on failure
+//!
+static int futex_post(ipc_futex * pFutex)
+{
+    ipc_lock_stats_released(&(pFutex->stats));
+    __atomic_add_fetch(&(pFutex->value), 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(pFutex->waiters), __ATOMIC_SEQ_CST) > 0) {
+        if (futex_call(&(pFutex->value), FUTEX_WAKE, 1) < 0)
+            return (-1);
+    }
+    return (0);
+}
+
+#ifdef _UNIT_TEST
+
+#define TEST_THREADS             4     //!< number of threads hammering a semaphore
+#define TEST_ITERATIONS     200000     //!< number of increments each thread makes
+
+//! Counter protected by the semaphore under test
+static long test_counter = 0;
+static sem *test_sem = NULL;
+
+//!
+//! Increments the shared counter under the semaphore under test
+//!
+//! @param[in] arg unused
+//!
+//! @return NULL
+//!
+static void *test_worker(void *arg)
+{
+    int i = 0;
+    long value = 0;
+
+    for (i = 0; i < TEST_ITERATIONS; i++) {
+        sem_p(test_sem);
+        // a non-atomic read-modify-write loses updates if the semaphore does not exclude
+        value = test_counter;
+        test_counter = value + 1;
+        sem_v(test_sem);
+    }
+    return (NULL);
+}
+
+//!
+//! Checks that a futex semaphore provides mutual exclusion and accounts for every
+//! acquisition, using threads as contenders
+//!
+//! @return 0 on success or 1 on failure
+//!
+static int test_futex_semaphore(void)
+{
+    int i = 0;
+    int n = 0;
+    int ret = 0;
+    long expected = (long)TEST_THREADS * TEST_ITERATIONS;
+    u64 start = 0;
+    u64 elapsed = 0;
+    pthread_t threads[TEST_THREADS];
+    ipc_lock_stats stats[IPC_MAX_TRACKED_LOCKS];
+
+    printf("testing '%s' semaphore with %d threads\n", IPC_MUTEX_SEMAPHORE, TEST_THREADS);
+    if ((test_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE)) == NULL) {
+        printf("\tcannot allocate semaphore\n");
+        return (1);
+    }
+    sem_set_stats_name(test_sem, "test_sem");
+    test_counter = 0;
+
+    // uncontended cost first
+    start = ipc_clock_ns();
+    for (i = 0; i < TEST_ITERATIONS; i++) {
+        sem_p(test_sem);
+        sem_v(test_sem);
+    }
+    elapsed = ipc_clock_ns() - start;
+    printf("\tuncontended sem_p()+sem_v(): %.1f ns\n", (double)elapsed / TEST_ITERATIONS);
+    sem_get_lock_stats(stats, IPC_MAX_TRACKED_LOCKS, TRUE);
+
+    start = ipc_clock_ns();
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_create(&(threads[i]), NULL, test_worker, NULL);
+    }
+    for (i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = ipc_clock_ns() - start;
+
+    if (test_counter != expected) {
+        printf("\tcounter is %ld, expected %ld\n", test_counter, expected);
+        ret = 1;
+    }
+
+    n = sem_get_lock_stats(stats, IPC_MAX_TRACKED_LOCKS, TRUE);
+    for (i = 0; i < n; i++) {
+        if (!strcmp(stats[i].name, "test_sem"))
+            break;
+    }
+    if (i == n) {
+        printf("\tstatistics for test_sem not found\n");
+        ret = 1;
+    } else {
+        printf("\tcontended run: %.1f ns per acquisition, acquisitions=%llu contended=%llu wait total=%llu us max=%llu us holder=%d\n",
+               (double)elapsed / expected, (unsigned long long)stats[i].acquisitions, (unsigned long long)stats[i].contended,
+               (unsigned long long)(stats[i].wait_ns_total / 1000), (unsigned long long)(stats[i].wait_ns_max / 1000), stats[i].holder);
+        if ((stats[i].acquisitions != (u64) expected) || (stats[i].contended > stats[i].acquisitions) || (stats[i].holder != 0)) {
+            printf("\tunexpected statistics\n");
+            ret = 1;
+        }
+        // the counters were reset by the read above
+        sem_get_lock_stats(stats, IPC_MAX_TRACKED_LOCKS, FALSE);
+        if (stats[i].acquisitions != 0) {
+            printf("\tstatistics were not reset\n");
+            ret = 1;
+        }
+    }
+
+    SEM_FREE(test_sem);
+    if (sem_get_lock_stats(stats, IPC_MAX_TRACKED_LOCKS, FALSE) != 0) {
+        printf("\tfreed semaphore is still tracked\n");
+        ret = 1;
+    }
+    return (ret);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure.
+//!
+int main(int argc, char **argv)
+{
+    int errors = 0;
+
+    errors += test_futex_semaphore();
+
+    printf("%s\n", ((errors == 0) ? "all tests passed" : "some tests failed"));
+    return ((errors == 0) ? EUCA_OK : EUCA_ERROR);
+}
+
+#endif /* _UNIT_TEST */
@@ -94,6 +94,12 @@
 //! A mutex type semaphore uses the "mutex" type name
 #define IPC_MUTEX_SEMAPHORE                      "mutex"
 
+//! Maximum length of a lock name kept in the lock statistics
+#define IPC_LOCK_NAME_LEN                          32
+
+//! Maximum number of futex semaphores a process tracks for statistics
+#define IPC_MAX_TRACKED_LOCKS                      64
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -112,15 +118,28 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Per-lock contention statistics. Holds no pointers so it can live in memory shared between processes.
+typedef struct ipc_lock_stats_t {
+    char name[IPC_LOCK_NAME_LEN];      // the name reported for this lock
+    u64 acquisitions;                  // number of times the lock was acquired
+    u64 contended;                     // number of acquisitions that had to block
+    u64 wait_ns_total;                 // total time spent blocked, in nanoseconds
+    u64 wait_ns_max;                   // longest single blocked wait, in nanoseconds
+    s32 holder;                        // thread or process ID of the last acquirer, 0 when released
+} ipc_lock_stats;
+
+//! Futex based counting semaphore. Holds no pointers so it can live in memory shared between processes.
+typedef struct ipc_futex_t {
+    s32 value;                         // the current semaphore count, the futex word
+    s32 waiters;                       // number of callers blocked (or about to block) in the kernel
+    ipc_lock_stats stats;              // contention statistics for this semaphore
+} ipc_futex;
+
 //! Semaphore structure
 typedef struct sem_struct {
     int sysv;                          // reference to the SYS V semaphore
     sem_t *posix;                      // reference to the posix semaphore information
-    pthread_mutex_t mutex;             // reference to the mutex semaphore
-    pthread_cond_t cond;               // the mutex semaphore consitional information
-    int usemutex;                      // boolean indicating if this is a mutex semaphore
-    int mutwaiters;                    // number of currently mutex waiters
-    int mutcount;                      // the current mutex count
+    ipc_futex *futex;                  // reference to the futex semaphore
     char *name;                        // the name of the semaphore
     u32 flags;                         // the kernel flags for SYS V semaphores
 } sem;
@@ -159,6 +178,16 @@ int sem_verhogen(sem * pSem, boolean doLog);
 int sem_v(sem * pSem);
 //! @}
 
+//! @{
+//! @name Lock statistics APIs
+void sem_set_stats_name(sem * pSem, const char *name);
+int sem_get_lock_stats(ipc_lock_stats * pStats, int max, boolean reset);
+void ipc_lock_stats_acquired(ipc_lock_stats * pStats, s32 holder, boolean contended, u64 waitNs);
+void ipc_lock_stats_released(ipc_lock_stats * pStats);
+void ipc_lock_stats_take(ipc_lock_stats * pStats, ipc_lock_stats * pCopy, boolean reset);
+u64 ipc_clock_ns(void);
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                           STATIC INLINE PROTOTYPES                         |
@@ -76,6 +76,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 #define __USE_GNU
 #include <string.h>
 #include <stdarg.h>
@@ -83,7 +84,10 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>                   // writev
 #include <sys/syscall.h>               // to get thread id
 #include <sys/resource.h>              // rusage
 #include <execinfo.h>                  // backtrace
@@ -108,6 +112,17 @@
 #define DEFAULT_LOG_LEVEL                             4 //!< log level if none is specified (4==INFO)
 #define LOGFH_DEFAULT                            stdout //!< without a file, this is where log output goes
 #define USE_STANDARD_PREFIX                      "(standard)"   //!< a special string that means no custom prefix
+#define LOG_CHECK_INTERVAL_SEC                        1 //!< how often an open log file is checked for rotation, removal or truncation
+
+//! @{
+//! @name asynchronous logging parameters
+#define LOG_ASYNC_RING_SIZE                 (64 * 1024) //!< bytes of pending lines each logging thread can buffer
+#define LOG_ASYNC_MAX_LINE     (LOG_ASYNC_RING_SIZE / 4)    //!< longer lines bypass the buffers and are written directly
+#define LOG_ASYNC_MAX_IOV                           256 //!< most lines written by one writev()
+#define LOG_ASYNC_FLUSH_MS                          100 //!< longest a line waits in a buffer before the writer picks it up
+#define LOG_ASYNC_FLUSH_WAIT_MS                    5000 //!< longest log_async_flush() waits for the writer
+#define LOG_ASYNC_ALIGN(_n)           (((_n) + 15) & ~15UL) //!< entries in the buffers start on 16-byte boundaries
+//! @}
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -121,12 +136,42 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Which log file a buffered line goes to
+typedef enum log_target_e {
+    LOG_TARGET_MAIN = 0,               //!< log_file_path
+    LOG_TARGET_REQ_TRACK,              //!< log_file_path_req_track
+    LOG_TARGET_SKIP,                   //!< not a line but padding up to the end of the buffer
+} log_target_e;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Header of a line in a thread's buffer, followed by the text of the line
+typedef struct log_entry_t {
+    unsigned long long seq;            //!< global order of the line, to interleave the buffers of all threads
+    int target;                        //!< one of log_target_e
+    int len;                           //!< length of the text that follows
+} log_entry;
+
+//! Lines logged by one thread and not yet written: a ring with one producer (the thread) and one consumer (the writer)
+typedef struct log_ring_t {
+    char buf[LOG_ASYNC_RING_SIZE];     //!< the entries
+    unsigned long head;                //!< total bytes ever added, only advanced by the owning thread
+    unsigned long tail;                //!< total bytes ever written out, only advanced by the writer
+    int orphaned;                      //!< set when the owning thread exits, so the writer frees the ring once it is empty
+    struct log_ring_t *next;           //!< next ring in the list of all rings
+} log_ring;
+
+//! The writer's position in one ring while interleaving the rings
+typedef struct log_cursor_t {
+    log_ring *ring;                    //!< the ring
+    unsigned long pos;                 //!< next byte to look at
+    unsigned long end;                 //!< head of the ring when the pass started
+} log_cursor;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXTERNAL VARIABLES                             |
@@ -141,6 +186,10 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Messages below this level are not logged. Exported so that the logging macros can
+//! check it inline, before evaluating their arguments; set it with log_params_set().
+int log_level_threshold = DEFAULT_LOG_LEVEL;
+
 //! To convert the various log level IDs to a readable format
 const char *log_level_names[] = {
     "ALL",
@@ -209,7 +258,6 @@ static const int syslog_options = 0;   //!< flags to be passed to openlog(), suc
 //! @{
 //! @name these can be modified through setters
 static FILE *log_fp = NULL;
-static int log_level = DEFAULT_LOG_LEVEL;
 static int log_roll_number = 10;
 static long log_max_size_bytes = MAXLOGFILESIZE;
 static char log_file_path[EUCA_MAX_PATH] = "";
@@ -219,14 +267,49 @@ static sem *log_sem = NULL;            //!< if set, the semaphore will be used w
 static int syslog_facility = -1;       //!< if not -1 then we are logging to a syslog facility
 //! @}
 
+//! when the open log files were last checked for rotation (see LOG_CHECK_INTERVAL_SEC)
+static time_t log_checked = 0;
+static time_t log_checked_req = 0;
+
+//! @{
+//! @name asynchronous logging state, see log_async_start()
+static int async_running = FALSE;      //!< whether lines are handed to the writer thread
+static int async_in_flight = 0;        //!< threads that may be adding a line to their ring right now
+static unsigned long long async_seq = 0;    //!< sequence number of the next buffered line
+static log_ring *async_rings = NULL;   //!< rings of all threads that have logged
+static pthread_mutex_t async_rings_mutex = PTHREAD_MUTEX_INITIALIZER;   //!< guards the list of rings (not their contents)
+static pthread_t async_writer;         //!< the writer thread
+static int async_writer_stop = FALSE;  //!< tells the writer to drain the rings one last time and exit
+static int async_writer_sleeping = FALSE;   //!< whether the writer is waiting on async_wake_cond
+static pthread_mutex_t async_wake_mutex = PTHREAD_MUTEX_INITIALIZER;    //!< goes with async_wake_cond
+static pthread_cond_t async_wake_cond = PTHREAD_COND_INITIALIZER;   //!< wakes up the writer early
+static pthread_once_t async_once = PTHREAD_ONCE_INIT;   //!< for async_init_once()
+static pthread_key_t async_ring_key;   //!< to hear about threads exiting
+static __thread log_ring *my_ring = NULL;   //!< the ring of the calling thread
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 static FILE *get_file(const char *log_file, boolean do_reopen);
-static FILE *get_file_impl(const char *log_file, FILE * fp, ino_t * log_inop, boolean do_reopen);
+static FILE *get_file_impl(const char *log_file, FILE * fp, ino_t * log_inop, time_t * checkedp, boolean do_reopen);
 static void release_file(const char *log_file);
+static void log_lock(void);
+static void log_unlock(void);
+
+static void async_init_once(void);
+static void async_ring_release(void *arg);
+static void async_atfork_child(void);
+static void async_wake_writer(boolean always);
+static log_ring *async_ring_get(void);
+static boolean async_pending(void);
+static int log_line_async(log_target_e target, const char *line);
+static int writev_all(int fd, struct iovec *iov, int iovcnt);
+static void async_write(struct iovec iov[][LOG_ASYNC_MAX_IOV], int *iovcnt);
+static int async_drain(void);
+static void *async_writer_thread(void *arg);
 
 static int fill_timestamp(char *buf, int buf_size);
 static int log_line(const char *log_file, const char *line);
@@ -278,10 +361,10 @@ static FILE *get_file(const char *log_file, boolean do_reopen)
         }
     }
     if (log_file_path != NULL && strcmp(log_file, log_file_path) == 0) {
-        gLogFh = get_file_impl(log_file, gLogFh, &log_ino, do_reopen);
+        gLogFh = get_file_impl(log_file, gLogFh, &log_ino, &log_checked, do_reopen);
         return gLogFh;
     } else if (log_file_path_req_track != NULL && strcmp(log_file, log_file_path_req_track) == 0) {
-        gLogFhReq = get_file_impl(log_file, gLogFhReq, &log_ino_req, do_reopen);
+        gLogFhReq = get_file_impl(log_file, gLogFhReq, &log_ino_req, &log_checked_req, do_reopen);
         return gLogFhReq;
     } else {
         return NULL;
@@ -295,25 +378,36 @@ static FILE *get_file(const char *log_file, boolean do_reopen)
 //! The log file gets re-opened if it is currently closed or if reopening is explicitly requested
 //! (do_reopen==TRUE). In case of failure, returns NULL.
 //!
+//! An open file is checked at most every LOG_CHECK_INTERVAL_SEC seconds rather than on every
+//! line, so a rotation or a move by another process may take that long to be noticed.
+//!
 //! To avoid unpredictable behavior due to concurrency,  this function should be called while
 //! holding a lock.
 //!
 //! @param[in] log_file a string containing the log file name
 //! @param[in] fp the log file structure pointer
 //! @param[in] log_inop pointer to the inode number
+//! @param[in,out] checkedp pointer to the time of the last check
 //! @param[in] do_reopen set to TRUE to for re-open the log file
 //!
 //! @return a pointer to the lof file or NULL if any error occured
 //!
-static FILE *get_file_impl(const char *log_file, FILE * fp, ino_t * log_inop, boolean do_reopen)
+static FILE *get_file_impl(const char *log_file, FILE * fp, ino_t * log_inop, time_t * checkedp, boolean do_reopen)
 {
     int fd = -1;
     int err = -1;
+    time_t now = time(NULL);
     char oldFile[EUCA_MAX_PATH] = "";
     char newFile[EUCA_MAX_PATH] = "";
     struct stat statbuf = { 0 };
     boolean file_changed = FALSE;
 
+    if ((fp != NULL) && !do_reopen && (now >= *checkedp) && ((now - *checkedp) < LOG_CHECK_INTERVAL_SEC)) {
+        // checked recently enough
+        return fp;
+    }
+    *checkedp = now;
+
     if (fp != NULL) {
         // apparently the stream is still open
         if (!do_reopen && do_stat_log) {
@@ -400,6 +494,25 @@ static void release_file(const char *log_file)
     }
 }
 
+//!
+//! Takes the logging semaphore, if one was set, to serialize access to the log
+//! files between threads and processes
+//!
+static void log_lock(void)
+{
+    if (log_sem)
+        sem_prolaag(log_sem, FALSE);
+}
+
+//!
+//! Releases the logging semaphore taken by log_lock()
+//!
+static void log_unlock(void)
+{
+    if (log_sem)
+        sem_verhogen(log_sem, FALSE);
+}
+
 //!
 //! setter for logging parameters except file path
 //!
@@ -411,7 +524,7 @@ static void release_file(const char *log_file)
 //!      \li The log_roll_number_in field must be withing the [0..999] range
 //!      \li The log_max_size_bytes_in field must be greater than 0.
 //!
-//! @post \li if log_level_in field is valid, our global log_level field is updated with this value
+//! @post \li if log_level_in field is valid, our global log_level_threshold field is updated with this value
 //!           where if its outside the valid range, it will be set to DEFAULT_LOG_LEVEL explicitedly.
 //!       \li If the log_roll_number_in field is valid, the log_roll_number global field will be updated
 //!           with the given value.
@@ -423,9 +536,9 @@ void log_params_set(int log_level_in, int log_roll_number_in, long log_max_size_
 {
     // update the log level
     if ((log_level_in >= EUCA_LOG_ALL) && (log_level_in <= EUCA_LOG_OFF)) {
-        log_level = log_level_in;
+        log_level_threshold = log_level_in;
     } else {
-        log_level = DEFAULT_LOG_LEVEL;
+        log_level_threshold = DEFAULT_LOG_LEVEL;
     }
 
     // update the roll number limit
@@ -435,10 +548,13 @@ void log_params_set(int log_level_in, int log_roll_number_in, long log_max_size_
     // update the max size for any file
     if (log_max_size_bytes_in >= 0 && log_max_size_bytes != log_max_size_bytes_in) {
         log_max_size_bytes = log_max_size_bytes_in;
+        log_lock();
+        log_checked = log_checked_req = 0;  // check right away
         if (get_file(log_file_path, FALSE)) // that will rotate log files if needed
             release_file(log_file_path);
         if (get_file(log_file_path_req_track, FALSE))   // that will rotate log files if needed
             release_file(log_file_path_req_track);
+        log_unlock();
     }
 }
 
@@ -449,7 +565,7 @@ void log_params_set(int log_level_in, int log_roll_number_in, long log_max_size_
 //!
 int log_level_get(void)
 {
-    return (log_level);
+    return (log_level_threshold);
 }
 
 //!
@@ -463,7 +579,7 @@ int log_level_get(void)
 //!
 void log_params_get(int *log_level_out, int *log_roll_number_out, long *log_max_size_bytes_out)
 {
-    *log_level_out = log_level;
+    *log_level_out = log_level_threshold;
     *log_roll_number_out = log_roll_number;
     *log_max_size_bytes_out = log_max_size_bytes;
 }
@@ -497,6 +613,8 @@ int log_fp_set(FILE * fp)
 //!
 int log_file_set(const char *file, const char *req_track_file)
 {
+    FILE *fp = NULL;
+
     if (file == NULL) {
         // NULL means standard output
         log_file_path[0] = '\0';
@@ -507,11 +625,14 @@ int log_file_set(const char *file, const char *req_track_file)
     if (strcmp(log_file_path, file) == 0) {
         ;
     } else {
+        log_lock();
         euca_strncpy(log_file_path, file, EUCA_MAX_PATH);
-        if (get_file(log_file_path, TRUE) == NULL) {
+        if ((fp = get_file(log_file_path, TRUE)) != NULL)
+            release_file(log_file_path);
+        log_unlock();
+        if (fp == NULL) {
             return (EUCA_ERROR);
         }
-        release_file(log_file_path);
     }
 
     if (req_track_file == NULL || strlen(req_track_file) == 0) {
@@ -522,11 +643,14 @@ int log_file_set(const char *file, const char *req_track_file)
     if (strcmp(log_file_path_req_track, req_track_file) == 0) {
         return (EUCA_OK);
     } else {
+        log_lock();
         euca_strncpy(log_file_path_req_track, req_track_file, EUCA_MAX_PATH);
-        if (get_file(log_file_path_req_track, TRUE) == NULL) {
+        if ((fp = get_file(log_file_path_req_track, TRUE)) != NULL)
+            release_file(log_file_path_req_track);
+        log_unlock();
+        if (fp == NULL) {
             return (EUCA_ERROR);
         }
-        release_file(log_file_path_req_track);
     }
     return (EUCA_OK);
 }
@@ -701,29 +825,439 @@ static int log_line(const char *log_file, const char *line)
     int rc = EUCA_ERROR;
     FILE *pFh = NULL;
 
-    if (log_sem) {
-        sem_prolaag(log_sem, FALSE);
+    if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)
+        && (log_line_async(((log_file == log_file_path_req_track) ? LOG_TARGET_REQ_TRACK : LOG_TARGET_MAIN), line) == EUCA_OK))
+        return (EUCA_OK);
 
+    log_lock();
+    {
         if ((pFh = get_file(log_file, FALSE)) != NULL) {
             fprintf(pFh, "%s", line);
             fflush(pFh);
             release_file(log_file);
             rc = EUCA_OK;
         }
+    }
+    log_unlock();
 
-        sem_verhogen(log_sem, FALSE);
-    } else {
-        if ((pFh = get_file(log_file, FALSE)) != NULL) {
-            fprintf(pFh, "%s", line);
-            fflush(pFh);
-            release_file(log_file);
-            rc = EUCA_OK;
+    return (rc);
+}
+
+//!
+//! One-time setup for asynchronous logging: the key that tells us about exiting
+//! threads, the fork handler and the exit handler that flushes the buffers
+//!
+static void async_init_once(void)
+{
+    pthread_key_create(&async_ring_key, async_ring_release);
+    pthread_atfork(NULL, NULL, async_atfork_child);
+    atexit(log_async_stop);
+}
+
+//!
+//! Called when a thread that has logged exits. Its ring is left for the writer,
+//! which frees it once the lines in it are written.
+//!
+//! @param[in] arg the ring of the exiting thread
+//!
+static void async_ring_release(void *arg)
+{
+    log_ring *ring = arg;
+
+    __atomic_store_n(&ring->orphaned, TRUE, __ATOMIC_RELEASE);
+}
+
+//!
+//! Called in the child after a fork(). The writer thread does not survive the fork,
+//! so the child logs synchronously. Lines buffered before the fork are written by
+//! the parent.
+//!
+static void async_atfork_child(void)
+{
+    async_running = FALSE;
+    async_in_flight = 0;
+    async_rings = NULL;
+    my_ring = NULL;
+    pthread_setspecific(async_ring_key, NULL);
+    pthread_mutex_init(&async_rings_mutex, NULL);
+    pthread_mutex_init(&async_wake_mutex, NULL);
+    pthread_cond_init(&async_wake_cond, NULL);
+}
+
+//!
+//! Wakes up the writer thread before its next scheduled pass
+//!
+//! @param[in] always if FALSE, only bother when the writer is actually sleeping
+//!
+static void async_wake_writer(boolean always)
+{
+    if (always || __atomic_load_n(&async_writer_sleeping, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&async_wake_mutex);
+        pthread_cond_signal(&async_wake_cond);
+        pthread_mutex_unlock(&async_wake_mutex);
+    }
+}
+
+//!
+//! Returns the ring of the calling thread, creating it on its first line
+//!
+//! @return the ring or NULL if out of memory
+//!
+static log_ring *async_ring_get(void)
+{
+    log_ring *ring = NULL;
+
+    if (my_ring != NULL)
+        return (my_ring);
+
+    if ((ring = EUCA_ZALLOC(1, sizeof(log_ring))) == NULL)
+        return (NULL);
+
+    pthread_mutex_lock(&async_rings_mutex);
+    {
+        ring->next = async_rings;
+        async_rings = ring;
+    }
+    pthread_mutex_unlock(&async_rings_mutex);
+
+    pthread_setspecific(async_ring_key, ring);
+    my_ring = ring;
+    return (ring);
+}
+
+//!
+//! Whether any thread has lines that have not been written yet
+//!
+//! @return TRUE if there is something for the writer to do
+//!
+static boolean async_pending(void)
+{
+    boolean pending = FALSE;
+
+    pthread_mutex_lock(&async_rings_mutex);
+    {
+        for (log_ring * ring = async_rings; (ring != NULL) && !pending; ring = ring->next) {
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+                pending = TRUE;
+        }
+    }
+    pthread_mutex_unlock(&async_rings_mutex);
+    return (pending);
+}
+
+//!
+//! Adds a line to the calling thread's ring for the writer thread to pick up.
+//! This takes no locks unless the ring is full, in which case the thread waits
+//! for the writer to make room.
+//!
+//! @param[in] target the log file the line goes to
+//! @param[in] line the line
+//!
+//! @return EUCA_OK if the line was buffered or EUCA_ERROR if it must be written directly
+//!
+static int log_line_async(log_target_e target, const char *line)
+{
+    int rc = EUCA_ERROR;
+    size_t len = strlen(line);
+    unsigned long head = 0;
+    unsigned long off = 0;
+    unsigned long pad = 0;
+    unsigned long need = LOG_ASYNC_ALIGN(sizeof(log_entry) + len);
+    log_ring *ring = NULL;
+    log_entry *e = NULL;
+
+    __atomic_add_fetch(&async_in_flight, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&async_running, __ATOMIC_SEQ_CST) || ((ring = async_ring_get()) == NULL))
+        goto out;
+
+    head = ring->head;
+    if (len > LOG_ASYNC_MAX_LINE) {
+        // too big for the ring, so let the writer catch up with this thread and have the caller write it
+        while ((__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != head) && __atomic_load_n(&async_running, __ATOMIC_ACQUIRE)) {
+            async_wake_writer(TRUE);
+            usleep(1000);
         }
+        goto out;
+    }
+
+    off = head % LOG_ASYNC_RING_SIZE;
+    if ((off + need) > LOG_ASYNC_RING_SIZE)
+        pad = LOG_ASYNC_RING_SIZE - off;   // entries do not wrap around, so skip to the start
+
+    while ((LOG_ASYNC_RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) < (pad + need)) {
+        if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+            goto out;
+        async_wake_writer(TRUE);
+        usleep(1000);
+    }
+
+    if (pad > 0) {
+        e = (log_entry *) (ring->buf + off);
+        e->seq = 0;
+        e->target = LOG_TARGET_SKIP;
+        e->len = pad - sizeof(log_entry);
+        head += pad;
+        off = 0;
     }
 
+    e = (log_entry *) (ring->buf + off);
+    e->target = target;
+    e->len = len;
+    memcpy(e + 1, line, len);
+    e->seq = __atomic_fetch_add(&async_seq, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, (head + need), __ATOMIC_RELEASE);
+
+    // the writer comes around every LOG_ASYNC_FLUSH_MS, only hurry it along if the ring is filling up
+    if ((head + need - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) > (LOG_ASYNC_RING_SIZE / 2))
+        async_wake_writer(FALSE);
+    rc = EUCA_OK;
+
+out:
+    __atomic_sub_fetch(&async_in_flight, 1, __ATOMIC_SEQ_CST);
     return (rc);
 }
 
+//!
+//! writev() that retries on interruptions and short writes
+//!
+//! @param[in] fd the file descriptor to write to
+//! @param[in] iov the buffers to write, which may get modified
+//! @param[in] iovcnt number of entries in iov[]
+//!
+//! @return EUCA_OK on success or EUCA_IO_ERROR on failure
+//!
+static int writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t wrote = 0;
+
+    while (iovcnt > 0) {
+        if ((wrote = writev(fd, iov, iovcnt)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return (EUCA_IO_ERROR);
+        }
+        // skip over what made it out
+        while ((iovcnt > 0) && (wrote >= (ssize_t) iov->iov_len)) {
+            wrote -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = ((char *)iov->iov_base) + wrote;
+            iov->iov_len -= wrote;
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Writes a batch of lines to the log files, one writev() per file, under the logging
+//! semaphore. Rotation and the other checks of get_file() apply as for a single line.
+//!
+//! @param[in] iov lines for each log_target_e
+//! @param[in,out] iovcnt number of lines for each log_target_e, reset to 0
+//!
+static void async_write(struct iovec iov[][LOG_ASYNC_MAX_IOV], int *iovcnt)
+{
+    FILE *fp = NULL;
+    const char *paths[] = { log_file_path, log_file_path_req_track };
+
+    log_lock();
+    {
+        // the tracking log first, in the same order as logprintfl()
+        for (int t = LOG_TARGET_REQ_TRACK; t >= LOG_TARGET_MAIN; t--) {
+            if ((iovcnt[t] > 0) && ((fp = get_file(paths[t], FALSE)) != NULL)) {
+                fflush(fp);
+                writev_all(fileno(fp), iov[t], iovcnt[t]);
+                release_file(paths[t]);
+            }
+            iovcnt[t] = 0;
+        }
+    }
+    log_unlock();
+}
+
+//!
+//! Writes out everything the threads have buffered so far, in the order in which
+//! it was logged, and frees the rings of threads that have exited
+//!
+//! @return the number of lines written
+//!
+static int async_drain(void)
+{
+    static log_cursor *cursors = NULL;
+    static int cursors_size = 0;
+    static struct iovec iov[LOG_TARGET_SKIP][LOG_ASYNC_MAX_IOV];
+    int n = 0;
+    int best = -1;
+    int lines = 0;
+    int iovcnt[LOG_TARGET_SKIP] = { 0 };
+    log_cursor *cur = NULL;
+    log_entry *e = NULL;
+    log_ring **prev = NULL;
+    log_ring *ring = NULL;
+
+    pthread_mutex_lock(&async_rings_mutex);
+    {
+        for (prev = &async_rings; (ring = *prev) != NULL;) {
+            unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            if (ring->tail != head) {
+                if (n == cursors_size) {
+                    log_cursor *bigger = EUCA_REALLOC(cursors, (cursors_size + 16), sizeof(log_cursor));
+                    if (bigger == NULL)
+                        break;         // the rest waits for the next pass
+                    cursors = bigger;
+                    cursors_size += 16;
+                }
+                cursors[n].ring = ring;
+                cursors[n].pos = ring->tail;
+                cursors[n].end = head;
+                n++;
+            } else if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) && (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)) {
+                *prev = ring->next;
+                EUCA_FREE(ring);
+                continue;
+            }
+            prev = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&async_rings_mutex);
+
+    // rings are only freed by this thread, so they stay valid without the lock
+    while (n > 0) {
+        best = -1;
+        for (int i = 0; i < n; i++) {
+            cur = cursors + i;
+            while ((cur->pos != cur->end) && ((e = (log_entry *) (cur->ring->buf + (cur->pos % LOG_ASYNC_RING_SIZE)))->target == LOG_TARGET_SKIP))
+                cur->pos += LOG_ASYNC_ALIGN(sizeof(log_entry) + e->len);
+            if ((cur->pos != cur->end) && ((best < 0) || (e->seq < ((log_entry *) (cursors[best].ring->buf + (cursors[best].pos % LOG_ASYNC_RING_SIZE)))->seq)))
+                best = i;
+        }
+        if (best < 0)
+            break;
+
+        cur = cursors + best;
+        e = (log_entry *) (cur->ring->buf + (cur->pos % LOG_ASYNC_RING_SIZE));
+        iov[e->target][iovcnt[e->target]].iov_base = e + 1;
+        iov[e->target][iovcnt[e->target]].iov_len = e->len;
+        cur->pos += LOG_ASYNC_ALIGN(sizeof(log_entry) + e->len);
+        lines++;
+
+        if (++iovcnt[e->target] == LOG_ASYNC_MAX_IOV) {
+            async_write(iov, iovcnt);
+            for (int i = 0; i < n; i++)
+                __atomic_store_n(&cursors[i].ring->tail, cursors[i].pos, __ATOMIC_RELEASE);
+        }
+    }
+
+    if ((iovcnt[LOG_TARGET_MAIN] > 0) || (iovcnt[LOG_TARGET_REQ_TRACK] > 0))
+        async_write(iov, iovcnt);
+    for (int i = 0; i < n; i++)
+        __atomic_store_n(&cursors[i].ring->tail, cursors[i].pos, __ATOMIC_RELEASE);
+
+    return (lines);
+}
+
+//!
+//! The writer thread: drains the rings every LOG_ASYNC_FLUSH_MS, or sooner when woken
+//! up, until log_async_stop() is called
+//!
+//! @param[in] arg unused
+//!
+//! @return Always NULL
+//!
+static void *async_writer_thread(void *arg)
+{
+    struct timespec ts = { 0 };
+
+    while (!__atomic_load_n(&async_writer_stop, __ATOMIC_ACQUIRE)) {
+        async_drain();
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += (LOG_ASYNC_FLUSH_MS * 1000000L);
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+
+        pthread_mutex_lock(&async_wake_mutex);
+        {
+            __atomic_store_n(&async_writer_sleeping, TRUE, __ATOMIC_RELEASE);
+            if (!__atomic_load_n(&async_writer_stop, __ATOMIC_ACQUIRE))
+                pthread_cond_timedwait(&async_wake_cond, &async_wake_mutex, &ts);
+            __atomic_store_n(&async_writer_sleeping, FALSE, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&async_wake_mutex);
+    }
+
+    async_drain();                     // whatever is left
+    return (NULL);
+}
+
+//!
+//! Switches this process to asynchronous logging: threads put their lines into
+//! per-thread buffers without taking any locks, and a writer thread writes them
+//! out in batches. Formatting, rotation and the log_sem semantics stay the same.
+//! Children forked afterwards go back to logging synchronously.
+//!
+//! @return EUCA_OK on success or EUCA_THREAD_ERROR if the writer could not be started
+//!
+int log_async_start(void)
+{
+    int rc = EUCA_OK;
+
+    pthread_once(&async_once, async_init_once);
+
+    pthread_mutex_lock(&async_wake_mutex);
+    {
+        if (!async_running) {
+            async_writer_stop = FALSE;
+            if (pthread_create(&async_writer, NULL, async_writer_thread, NULL) != 0) {
+                rc = EUCA_THREAD_ERROR;
+            } else {
+                __atomic_store_n(&async_running, TRUE, __ATOMIC_SEQ_CST);
+            }
+        }
+    }
+    pthread_mutex_unlock(&async_wake_mutex);
+    return (rc);
+}
+
+//!
+//! Waits, for up to LOG_ASYNC_FLUSH_WAIT_MS, until everything logged so far is written
+//!
+void log_async_flush(void)
+{
+    if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        return;
+
+    for (int i = 0; (i < LOG_ASYNC_FLUSH_WAIT_MS) && async_pending(); i++) {
+        async_wake_writer(TRUE);
+        usleep(1000);
+    }
+}
+
+//!
+//! Writes out what is buffered, stops the writer thread and returns to synchronous
+//! logging. Also called at exit.
+//!
+void log_async_stop(void)
+{
+    if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+        return;
+
+    // new lines go the synchronous way, wait for the ones on their way into a ring
+    __atomic_store_n(&async_running, FALSE, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&async_in_flight, __ATOMIC_SEQ_CST) > 0)
+        usleep(100);
+
+    pthread_mutex_lock(&async_wake_mutex);
+    {
+        __atomic_store_n(&async_writer_stop, TRUE, __ATOMIC_RELEASE);
+        pthread_cond_signal(&async_wake_cond);
+    }
+    pthread_mutex_unlock(&async_wake_mutex);
+    pthread_join(async_writer, NULL);
+}
+
 //!
 //! Log-printing function without a specific log level. It is essentially printf() that will go verbatim,
 //! with just timestamp as prefix and at any log level, into the current log or stdout, if no log was open.
@@ -741,7 +1275,7 @@ int logprintf(const char *format, ...)
 {
     int rc = -1;
     int offset = -1;
-    char buf[LOGLINEBUF] = "";
+    char buf[LOGLINEBUF];              // not initialized, zeroing 100K on every call is not free
     va_list ap = { {0} };
 
     // start with current timestamp
@@ -858,14 +1392,14 @@ int logprintfl(const char *func, const char *file, int line, log_level_e level,
     char c = '\0';
     char cn = '\0';
     boolean custom_spec = FALSE;
-    char buf[LOGLINEBUF] = "";
+    char buf[LOGLINEBUF];              // not initialized, zeroing 100K on every call is not free
     va_list ap = { {0} };
     const char *prefix_spec = NULL;
     boolean is_corrid = FALSE;
     char buf_corrid[128] = "";
 
     // return if level is invalid or below the threshold
-    if (level < log_level) {
+    if (level < log_level_threshold) {
         return (0);
     }
 
@@ -873,6 +1407,7 @@ int logprintfl(const char *func, const char *file, int line, log_level_e level,
         // unexpected log level
         return (-1);
     }
+    buf[0] = '\0';
 
     threadCorrelationId *corr_id = get_corrid();
     if (corr_id != NULL && corr_id->correlation_id != NULL && strlen(corr_id->correlation_id) >= 74) {
@@ -880,7 +1415,7 @@ int logprintfl(const char *func, const char *file, int line, log_level_e level,
     }
 
     if (strcmp(log_custom_prefix, USE_STANDARD_PREFIX) == 0) {
-        prefix_spec = log_level_prefix[log_level];
+        prefix_spec = log_level_prefix[log_level_threshold];
         custom_spec = FALSE;
     } else {
         prefix_spec = log_custom_prefix;
@@ -1050,6 +1585,10 @@ int logprintfl(const char *func, const char *file, int line, log_level_e level,
     if ((rc = log_line(log_file_path, buf)) != EUCA_OK)
         return (rc);
 
+    if (level >= EUCA_LOG_FATAL) {
+        // the process may be about to die, so do not leave this in a buffer
+        log_async_flush();
+    }
     return EUCA_OK;
 }
 
@@ -1161,3 +1700,191 @@ void log_dump_trace(char *buf, int buf_size)
 
     EUCA_FREE(strings);
 }
+
+#ifdef _UNIT_TEST
+#define TEST_THREADS                                  8 //!< number of threads logging at once
+#define TEST_LINES                                 5000 //!< lines logged by each thread
+#define TEST_BENCH_ITERATIONS                  10000000 //!< iterations of the hot loop in the benchmark
+
+static int test_evaluations = 0;       //!< how many times test_argument() was called
+
+//!
+//! Stands in for an expensive argument of a log statement, such as a hex2dot() call
+//!
+//! @return a string to log
+//!
+static const char *test_argument(void)
+{
+    test_evaluations++;
+    return ("argument");
+}
+
+//!
+//! Time since some point in the past, for the benchmark
+//!
+//! @return nanoseconds
+//!
+static long long test_now_ns(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((long long)ts.tv_sec * 1000000000LL) + ts.tv_nsec);
+}
+
+//!
+//! Logs TEST_LINES numbered lines
+//!
+//! @param[in] arg pointer to the number of the thread
+//!
+//! @return Always NULL
+//!
+static void *test_logger(void *arg)
+{
+    int t = *(int *)arg;
+
+    for (int i = 0; i < TEST_LINES; i++)
+        LOGINFO("thread %d line %d\n", t, i);
+    return (NULL);
+}
+
+//!
+//! Counts the lines of the test threads in a log file and checks that each thread's
+//! lines are in order
+//!
+//! @param[in] path the log file
+//!
+//! @return the number of test lines found
+//!
+static int test_count(const char *path)
+{
+    int t = 0;
+    int i = 0;
+    int count = 0;
+    int next[TEST_THREADS] = { 0 };
+    char *s = NULL;
+    char buf[LOGLINEBUF] = "";
+    FILE *fp = NULL;
+
+    fp = fopen(path, "r");
+    assert(fp != NULL);
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (((s = strstr(buf, "| thread ")) != NULL) && (sscanf(s, "| thread %d line %d", &t, &i) == 2)) {
+            assert((t >= 0) && (t < TEST_THREADS));
+            assert(i == next[t]);
+            next[t]++;
+            count++;
+        }
+    }
+    fclose(fp);
+    return (count);
+}
+
+//!
+//! Main entry point of the application
+//!
+//! @param[in] argc the number of parameter passed on the command line
+//! @param[in] argv the list of arguments
+//!
+//! @return Always return 0 or exits with an assertion failure
+//!
+int main(int argc, char **argv)
+{
+    int rc = 0;
+    int fd = -1;
+    int status = 0;
+    int ids[TEST_THREADS] = { 0 };
+    pid_t pid = 0;
+    pthread_t threads[TEST_THREADS];
+    char path[EUCA_MAX_PATH] = "/tmp/euca-log-test-XXXXXX";
+    char old_path[EUCA_MAX_PATH] = "";
+    sem *s = NULL;
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    s = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    assert(s != NULL);
+    rc = log_sem_set(s);
+    assert(rc == EUCA_OK);
+    rc = log_file_set(path, NULL);
+    assert(rc == EUCA_OK);
+    log_params_set(EUCA_LOG_INFO, 0, MAXLOGFILESIZE);
+
+    printf("testing with %d threads logging %d lines each into %s\n", TEST_THREADS, TEST_LINES, path);
+    rc = log_async_start();
+    assert(rc == EUCA_OK);
+    for (int t = 0; t < TEST_THREADS; t++) {
+        ids[t] = t;
+        rc = pthread_create(threads + t, NULL, test_logger, ids + t);
+        assert(rc == 0);
+    }
+    for (int t = 0; t < TEST_THREADS; t++)
+        pthread_join(threads[t], NULL);
+    log_async_flush();
+    rc = test_count(path);
+    assert(rc == (TEST_THREADS * TEST_LINES));
+
+    // a forked child logs synchronously
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+        LOGINFO("from the child\n");
+        exit(0);
+    }
+    rc = waitpid(pid, &status, 0);
+    assert(rc == pid);
+    log_async_stop();
+
+    // a smaller size limit rotates the log right away
+    log_params_set(EUCA_LOG_INFO, 2, 1000);
+    rc = log_async_start();
+    assert(rc == EUCA_OK);
+    LOGINFO("after rotation\n");
+    log_async_stop();
+    snprintf(old_path, sizeof(old_path), "%s.0", path);
+    rc = access(old_path, F_OK);
+    assert(rc == 0);
+    rc = test_count(old_path);
+    assert(rc == (TEST_THREADS * TEST_LINES));
+
+    {                                  // a hot loop with TRACE disabled pays for a compare and nothing else
+        volatile long long sum = 0;
+        long long t0 = 0;
+        long long bare_ns = 0;
+        long long gated_ns = 0;
+        long long unguarded_ns = 0;
+
+        log_params_set(EUCA_LOG_INFO, 0, MAXLOGFILESIZE);
+
+        t0 = test_now_ns();
+        for (int i = 0; i < TEST_BENCH_ITERATIONS; i++)
+            sum += i;
+        bare_ns = test_now_ns() - t0;
+
+        t0 = test_now_ns();
+        for (int i = 0; i < TEST_BENCH_ITERATIONS; i++) {
+            sum += i;
+            LOGTRACE("i=%d %s\n", i, test_argument());
+        }
+        gated_ns = test_now_ns() - t0;
+        assert(test_evaluations == 0);
+
+        t0 = test_now_ns();
+        for (int i = 0; i < TEST_BENCH_ITERATIONS; i++) {
+            sum += i;
+            logprintfl(__FUNCTION__, __FILE__, __LINE__, EUCA_LOG_TRACE, "i=%d %s\n", i, test_argument());
+        }
+        unguarded_ns = test_now_ns() - t0;
+        assert(test_evaluations == TEST_BENCH_ITERATIONS);
+
+        printf("hot loop of %d iterations with TRACE disabled (ns/iteration): bare %.2f, LOGTRACE %.2f, unguarded logprintfl %.2f\n",
+               TEST_BENCH_ITERATIONS, ((double)bare_ns / TEST_BENCH_ITERATIONS), ((double)gated_ns / TEST_BENCH_ITERATIONS),
+               ((double)unguarded_ns / TEST_BENCH_ITERATIONS));
+    }
+
+    unlink(path);
+    unlink(old_path);
+    printf("all tests passed\n");
+    return (0);
+}
+#endif /* _UNIT_TEST */
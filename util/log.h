@@ -87,6 +87,13 @@
 
 #define LOG_FILE_PERM                        0660   //!< Backing file default permission
 
+//! Log statements below this level are compiled out entirely, e.g., build with
+//! -DEUCA_LOG_MIN_LEVEL=EUCA_LOG_DEBUG (configure --disable-trace-logging) to drop
+//! TRACE and EXTREME statements, arguments and all
+#ifndef EUCA_LOG_MIN_LEVEL
+#define EUCA_LOG_MIN_LEVEL                   EUCA_LOG_ALL
+#endif /* ! EUCA_LOG_MIN_LEVEL */
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -124,6 +131,9 @@ typedef enum log_level_e {
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Messages below this level are not logged (use log_params_set() to change it)
+extern int log_level_threshold;
+
 //! To convert the various log level IDs to a readable format
 extern const char *log_level_names[];
 
@@ -162,6 +172,9 @@ int logfile(const char *file, int log_level_in, int log_roll_number_in);
 int logprintf(const char *format, ...) _attribute_format_(1, 2);
 int logprintfl(const char *func, const char *file, int line, log_level_e level, const char *format, ...) _attribute_format_(5, 6);
 int logcat(int debug_level, const char *file_path);
+int log_async_start(void);
+void log_async_flush(void);
+void log_async_stop(void);
 
 void eventlog(char *hostTag, char *userTag, char *cid, char *eventTag, char *other);
 void log_dump_trace(char *buf, int buf_size);
@@ -202,12 +215,20 @@ void log_dump_trace(char *buf, int buf_size);
 #define PRINTF_XML(a, args...)
 #endif /* DEBUGXML */
 
+//! Whether a message at the given level would be logged. The compile-time part folds
+//! away statements below EUCA_LOG_MIN_LEVEL, the rest is a load and a compare. Use it
+//! to guard work done only for the sake of a log message.
+#define LOG_ENABLED(_level)                      (((_level) >= EUCA_LOG_MIN_LEVEL) && __builtin_expect(((_level) >= log_level_threshold), 0))
+
 //! @{
 //! @name Various log level logging macros
+//!
+//! The arguments are only evaluated if the level is enabled, and the format is
+//! still checked against them when the statement is compiled out.
 
 #define EUCALOG(_level, _format, args...)                                          \
 {                                                                                  \
-    if ((_level) >= log_level_get()) {                                             \
+    if (LOG_ENABLED(_level)) {                                                     \
         logprintfl(__FUNCTION__, __FILE__, __LINE__, (_level), _format, ## args);  \
     }                                                                              \
 }
@@ -99,6 +99,10 @@
 #include <sys/mman.h>                  // mmap
 #include <pthread.h>
 #include <sys/select.h>                // pselect
+#include <poll.h>
+#include <spawn.h>                     // posix_spawnp
+#include <sys/syscall.h>               // SYS_pidfd_open
+#include <sys/socket.h>                // socketpair
 
 #include "eucalyptus.h"
 
@@ -152,6 +156,8 @@
 
 /* Should preferably be handled in header file */
 
+extern char **environ;                 //!< handed to the spawned children
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              GLOBAL VARIABLES                              |
@@ -170,6 +176,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+static int euca_pidfd_open(pid_t pid);
+static void log_argv(pid_t pid, char **argv);
+static int spawn_read(int fd, char **psBuf, size_t * pLen, size_t * pAlloc, size_t max_size);
 static char *next_tag(const char *xml, int *start, int *end, int *single, int *closing);
 static char *find_cont(const char *xml, char *xpath);
 
@@ -397,7 +406,11 @@ int add_euca_to_path(const char *euca_home_supplied)
 pid_t timewait(pid_t pid, int *status, int timeout_sec)
 {
     int rc = 0;
+    int pidfd = -1;
     time_t elapsed_usec = 0;
+    long long deadline_ms = 0;
+    long long remaining_ms = 0;
+    struct pollfd pfd = { 0 };
 
     // do not allow negative timeouts
     if (timeout_sec < 0)
@@ -407,10 +420,25 @@ pid_t timewait(pid_t pid, int *status, int timeout_sec)
     *status = 1;
 
     rc = waitpid(pid, status, WNOHANG);
-    while ((rc == 0) && (elapsed_usec < (timeout_sec * 1000000))) {
-        usleep(10000);
-        elapsed_usec += 10000;
+    if ((rc == 0) && (timeout_sec > 0) && ((pidfd = euca_pidfd_open(pid)) >= 0)) {
+        // the pidfd turns readable as soon as the child exits, so sleep in poll() rather than spin on waitpid()
+        pfd.fd = pidfd;
+        pfd.events = POLLIN;
+        deadline_ms = time_ms() + (timeout_sec * 1000LL);
+        while ((remaining_ms = (deadline_ms - time_ms())) > 0) {
+            rc = poll(&pfd, 1, (int)remaining_ms);
+            if ((rc > 0) || ((rc < 0) && (errno != EINTR)))
+                break;
+        }
+        close(pidfd);
         rc = waitpid(pid, status, WNOHANG);
+    } else {
+        // kernels without pidfd_open()
+        while ((rc == 0) && (elapsed_usec < (timeout_sec * 1000000))) {
+            usleep(10000);
+            elapsed_usec += 10000;
+            rc = waitpid(pid, status, WNOHANG);
+        }
     }
 
     if (rc == 0) {
@@ -505,21 +533,21 @@ int check_process(pid_t pid, char *search)
 char *system_output(char *shell_command)
 {
     char *buf = NULL;
-    FILE *fp = NULL;
+    char *argv[] = { "/bin/sh", "-c", shell_command, NULL };
 
     if (!shell_command)
         return (NULL);
 
-    // forks off command (this doesn't fail if command doesn't exist
+    // runs the command through the shell (this doesn't fail if command doesn't exist)
     LOGTRACE("[%s]\n", shell_command);
-    if ((fp = popen(shell_command, "r")) == NULL) {
-        // caller can check errno
+    switch (euca_spawn_capture(argv, 0, 0, 0, &buf, NULL, NULL)) {
+    case EUCA_OK:
+    case EUCA_ERROR:
+        return (buf);
+    default:
+        EUCA_FREE(buf);
         return (NULL);
     }
-
-    buf = fp2str(fp);
-    pclose(fp);
-    return (buf);
 }
 
 //!
@@ -1610,132 +1638,40 @@ int drop_privs(void)
 //!
 int timeshell(char *command, char *stdout_str, char *stderr_str, int max_size, int timeout)
 {
-    int retval;
-    int readn;
-    int stdoutfds[2] = { 0, 0 };
-    int stderrfds[2] = { 0, 0 };
-    int child_pid = 0;
-    int maxfd = 0;
     int rc = 0;
     int status = 0;
-    int stdout_toread = 0;
-    int stderr_toread = 0;
-    char errorBuf[256] = { 0 };
-    time_t start_time = 0;
-    time_t remaining_time = 0;
-    fd_set rfds = { {0} };
-    struct timeval tv = { 0 };
+    char *out = NULL;
+    char *err = NULL;
+    char *argv[] = { "/bin/sh", "-c", command, NULL };
 
     // force nonempty on all arguments to simplify the logic
     assert(command);
     assert(stdout_str);
     assert(stderr_str);
 
-    if (pipe(stdoutfds) < 0) {
-        strerror_r(errno, errorBuf, 256);
-        LOGERROR("error: failed to create pipe for stdout: %s\n", errorBuf);
-        return (-1);
-    }
-    if (pipe(stderrfds) < 0) {
-        strerror_r(errno, errorBuf, 256);
-        LOGERROR("error: failed to create pipe for stderr: %s\n", errorBuf);
-        return (-1);
-    }
-
-    if ((child_pid = fork()) == 0) {
-        close(stdoutfds[0]);
-        if (dup2(stdoutfds[1], STDOUT_FILENO) < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGERROR("error: failed to dup2 stdout: %s\n", errorBuf);
-            exit(1);
-        }
-
-        close(stdoutfds[1]);
-        close(stderrfds[0]);
-
-        if (dup2(stderrfds[1], STDERR_FILENO) < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGERROR("error: failed to dup2 stderr: %s\n", errorBuf);
-            exit(1);
-        };
-
-        close(stderrfds[1]);
-
-        execl("/bin/sh", "sh", "-c", command, (char *)0);
-
-        exit(127);
-    }
-
-    close(stdoutfds[1]);
-    close(stderrfds[1]);
-
-    if (child_pid < 0) {
-        close(stdoutfds[0]);
-        close(stderrfds[0]);
-        return (-1);
-    }
-
     memset(stdout_str, 0, max_size);
     memset(stderr_str, 0, max_size);
-    stdout_toread = stderr_toread = max_size - 1;
-
-    maxfd = ((stdoutfds[0] > stderrfds[0]) ? stdoutfds[0] : stderrfds[0]);
-
-    start_time = time(NULL);
-    for (;;) {
-        FD_ZERO(&rfds);
-        FD_SET(stdoutfds[0], &rfds);
-        FD_SET(stderrfds[0], &rfds);
-
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
 
-        if ((retval = select(maxfd + 1, &rfds, (fd_set *) 0, (fd_set *) 0, &tv)) > 0) {
-            if (FD_ISSET(stdoutfds[0], &rfds) && stdout_toread > 0) {
-                if ((readn = read(stdoutfds[0], stdout_str, stdout_toread)) > 0) {
-                    stdout_toread -= readn;
-                    stdout_str += readn;
-                } else {
-                    break;
-                }
-            }
-
-            if (FD_ISSET(stderrfds[0], &rfds) && stderr_toread > 0) {
-                if ((readn = read(stderrfds[0], stderr_str, stderr_toread)) > 0) {
-                    stderr_toread -= readn;
-                    stderr_str += readn;
-                } else {
-                    break;
-                }
-            }
-        } else if (retval < 0) {
-            strerror_r(errno, errorBuf, 256);
-            LOGWARN("warning: select error on pipe read: %s\n", errorBuf);
-            break;
-        }
-
-        if ((time(NULL) - start_time) > timeout) {
-            LOGWARN("warning: read timeout\n");
-            break;
-        }
-    }
-
-    close(stdoutfds[0]);
-    close(stderrfds[0]);
-
-    remaining_time = timeout - (time(NULL) - start_time);
-    if ((rc = timewait(child_pid, &status, remaining_time)) != 0) {
-        if (WIFEXITED(status))
-            rc = WEXITSTATUS(status);
-        else
-            rc = -1;
-    } else {
-        killwait(child_pid);
+    rc = euca_spawn_capture(argv, 0, ((timeout > 0) ? timeout : 1), max_size, &out, &err, &status);
+    if (out)
+        memcpy(stdout_str, out, strlen(out));
+    if (err)
+        memcpy(stderr_str, err, strlen(err));
+    EUCA_FREE(out);
+    EUCA_FREE(err);
+
+    switch (rc) {
+    case EUCA_OK:
+    case EUCA_ERROR:
+        if ((status != -1) && WIFEXITED(status))
+            return (WEXITSTATUS(status));
+        return (-1);
+    case EUCA_TIMEOUT_ERROR:
         LOGERROR("warning: shell execution timeout\n");
         return (-1);
+    default:
+        return (-1);
     }
-
-    return (rc);
 }
 
 //!
@@ -1856,11 +1792,20 @@ char **build_argv(const char *first, va_list va)
     return (argv);
 }
 
-void log_argv(char **argv)
+//!
+//! Logs the command line a child process was started with
+//!
+//! @param[in] pid the PID of the child process
+//! @param[in] argv the NULL terminated list of arguments
+//!
+static void log_argv(pid_t pid, char **argv)
 {
     int args = 0;
     char cmd[10240] = "";
 
+    if (!LOG_ENABLED(EUCA_LOG_DEBUG))
+        return;
+
     for (char **s = argv; *s != NULL; s++, args++) {
         char *arg = *s;
         char formatted[1024] = "";
@@ -1876,125 +1821,392 @@ void log_argv(char **argv)
         }
         euca_strncat(cmd, formatted, sizeof(cmd));
     }
-    fprintf(stderr, "child process %d executing: %s\n", getpid(), cmd);
+    LOGDEBUG("child process %d executing: %s\n", pid, cmd);
 }
 
 //!
-//! Eucalyptus wrapper function around exec with file-descriptor support and argv[]
+//! Opens a file descriptor referring to a child process that becomes readable when
+//! the child terminates (pidfd_open(2), Linux 5.3 and up).
 //!
-//! This is the low-level function that actually sets up file descriptors, forks,
-//! and calls execvp(). The function does not wait for the child process to finish:
-//! that can and probably should be done with the complementary low-level function:
-//! euca_waitpid().  Consider higher-level alternatives, too:
+//! @param[in] pid the PID of the child process
 //!
-//! - Those who want to use variable arguments (in lieu of argv[]), can use
-//!   euca_execlp_fd(), which constructs the argv[] and calls this function.
+//! @return the pidfd or -1 with errno set (ENOSYS on older kernels and headers)
 //!
-//! - Those who want to use variable arguments (in liue of argv[]) and also
-//!   have the function wait for the child to complete, can use euca_execlp()
-//!   (and thus give up on the ability to feed stdin and read stdout and stderr).
+static int euca_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return ((int)syscall(SYS_pidfd_open, pid, 0));
+#else /* SYS_pidfd_open */
+    errno = ENOSYS;
+    return (-1);
+#endif /* SYS_pidfd_open */
+}
+
 //!
-//! @param[in] ppid pointer to populate with child process's PID (must not be NULL)
-//! @param[in] stdin_fd a pointer to populate with child process's stdin descriptr, if not NULL
-//! @param[in] stdout_fd a pointer to populate with child process's stdout descriptr, if not NULL
-//! @param[in] stderr_fd a pointer to populate with child process's stderr descriptr, if not NULL
-//! @param[in] argv
+//! Starts a program without fork()ing the caller. The child is created with posix_spawnp(),
+//! which glibc implements with clone(CLONE_VM|CLONE_VFORK): the child borrows the parent's
+//! address space until it calls exec, so the cost does not grow with the size of the parent's
+//! heap and shared memory the way copying the page tables in fork() does. No code runs in the
+//! child between the clone and the exec, which also makes this safe to call from threaded
+//! processes.
 //!
-//! @return EUCA_OK on success or the following error codes on failure:
-//!         \li EUCA_ERROR if the execution terminated but failed
-//!         \li EUCA_INVALID_ERROR if the provided argument does not meet the pre-requirements
-//!         \li EUCA_THREAD_ERROR if we fail to execute the program within its own thread
+//! The pipes are created close-on-exec, so the child only inherits the ends that are
+//! dup2()'ed onto its standard descriptors. The function does not wait for the child; use
+//! euca_waitpid(), timewait() or euca_spawn_capture() for that.
 //!
-//! @pre The file and ppid parameters must not be NULL
+//! @param[out] ppid pointer to populate with child process's PID (must not be NULL)
+//! @param[out] stdin_fd a pointer to populate with child process's stdin descriptor, if not NULL
+//! @param[out] stdout_fd a pointer to populate with child process's stdout descriptor, if not NULL
+//! @param[out] stderr_fd a pointer to populate with child process's stderr descriptor, if not NULL
+//! @param[in]  flags a combination of EUCA_SPAWN_SETPGROUP, EUCA_SPAWN_MERGE_STDERR and
+//!             EUCA_SPAWN_STDIO_SOCKET
+//! @param[in]  argv the NULL terminated list of arguments, argv[0] being looked up in the PATH
 //!
-//! @post
+//! @return EUCA_OK on success or the following error codes on failure:
+//!         \li EUCA_ERROR if the program could not be executed
+//!         \li EUCA_INVALID_ERROR if the provided argument does not meet the pre-requirements
+//!         \li EUCA_THREAD_ERROR if we fail to create the child process
 //!
-//! @note
+//! @pre The ppid and argv parameters must not be NULL. With EUCA_SPAWN_MERGE_STDERR, the
+//!      child's stderr goes to the \p stdout_fd pipe and \p stderr_fd must be NULL. With
+//!      EUCA_SPAWN_STDIO_SOCKET, \p stdin_fd receives our end of a socket pair that is the
+//!      child's stdin and stdout, and \p stdout_fd must be NULL. Unlike a pipe, the socket
+//!      can be written with send(MSG_NOSIGNAL) so a dead child does not raise SIGPIPE.
 //!
-int euca_execvp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, char **argv)
+int euca_spawn(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, int flags, char *const argv[])
 {
-    int result = 0;
-    int stdin_p[2];
-    int stdout_p[2];
-    int stderr_p[2];
+    int rc = 0;
+    int ret = EUCA_OK;
+    int stdin_p[2] = { -1, -1 };
+    int stdout_p[2] = { -1, -1 };
+    int stderr_p[2] = { -1, -1 };
+    short attr_flags = 0;
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
 
     assert(ppid);
     *ppid = -1;
 
-    // set up the pipes, if requested
-    if (stdin_fd) {
+    if ((argv == NULL) || (argv[0] == NULL) || ((flags & EUCA_SPAWN_MERGE_STDERR) && (stderr_fd != NULL)))
+        return (EUCA_INVALID_ERROR);
+    if ((flags & EUCA_SPAWN_STDIO_SOCKET) && ((stdin_fd == NULL) || (stdout_fd != NULL)))
+        return (EUCA_INVALID_ERROR);
+
+    if (stdin_fd)
         *stdin_fd = -1;
-        if (pipe(stdin_p) != 0) {
-            LOGERROR("pipe() failed\n");
-            return (EUCA_ERROR);
+    if (stdout_fd)
+        *stdout_fd = -1;
+    if (stderr_fd)
+        *stderr_fd = -1;
+
+    // set up the pipes, if requested
+    if (flags & EUCA_SPAWN_STDIO_SOCKET) {
+        // [0] is the child's end and [1] ours, like the stdin pipe
+        if (socketpair(AF_UNIX, (SOCK_STREAM | SOCK_CLOEXEC), 0, stdin_p) != 0) {
+            LOGERROR("socketpair() failed: %s\n", strerror(errno));
+            ret = EUCA_ERROR;
+            goto cleanup;
         }
+    } else if (stdin_fd && (pipe2(stdin_p, O_CLOEXEC) != 0)) {
+        LOGERROR("pipe() failed: %s\n", strerror(errno));
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+    if ((stdout_fd && (pipe2(stdout_p, O_CLOEXEC) != 0)) || (stderr_fd && (pipe2(stderr_p, O_CLOEXEC) != 0))) {
+        LOGERROR("pipe() failed: %s\n", strerror(errno));
+        ret = EUCA_ERROR;
+        goto cleanup;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_init(&attr);
+
+    if (stdin_fd)
+        posix_spawn_file_actions_adddup2(&actions, stdin_p[0], STDIN_FILENO);
+    if (flags & EUCA_SPAWN_STDIO_SOCKET)
+        posix_spawn_file_actions_adddup2(&actions, stdin_p[0], STDOUT_FILENO);
+    if (stdout_fd)
+        posix_spawn_file_actions_adddup2(&actions, stdout_p[1], STDOUT_FILENO);
+    if (stdout_fd && (flags & EUCA_SPAWN_MERGE_STDERR))
+        posix_spawn_file_actions_adddup2(&actions, stdout_p[1], STDERR_FILENO);
+    if (stderr_fd)
+        posix_spawn_file_actions_adddup2(&actions, stderr_p[1], STDERR_FILENO);
+
+    if (flags & EUCA_SPAWN_SETPGROUP) {
+        attr_flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, 0);
+    }
+#ifdef POSIX_SPAWN_USEVFORK
+    // older glibc only vfork()s when asked to
+    attr_flags |= POSIX_SPAWN_USEVFORK;
+#endif /* POSIX_SPAWN_USEVFORK */
+    posix_spawnattr_setflags(&attr, attr_flags);
+
+    rc = posix_spawnp(ppid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (rc != 0) {
+        LOGERROR("failed to execute '%s': %s\n", argv[0], strerror(rc));
+        *ppid = -1;
+        ret = (((rc == EAGAIN) || (rc == ENOMEM)) ? EUCA_THREAD_ERROR : EUCA_ERROR);
+        goto cleanup;
+    }
+    // print the command we just started
+    log_argv(*ppid, (char **)argv);
+
+    // hand the parent's ends of the pipes to the caller
+    if (stdin_fd) {
+        *stdin_fd = stdin_p[1];
+        stdin_p[1] = -1;
     }
     if (stdout_fd) {
-        *stdout_fd = -1;
-        if (pipe(stdout_p) != 0) {
-            LOGERROR("pipe() failed: %s\n", strerror(errno));
-            return (EUCA_ERROR);
-        }
+        *stdout_fd = stdout_p[0];
+        stdout_p[0] = -1;
     }
     if (stderr_fd) {
-        *stderr_fd = -1;
-        if (pipe(stderr_p) != 0) {
-            LOGERROR("pipe() failed: %s\n", strerror(errno));
-            return (EUCA_ERROR);
+        *stderr_fd = stderr_p[0];
+        stderr_p[0] = -1;
+    }
+
+cleanup:
+    for (int i = 0; i < 2; i++) {
+        if (stdin_p[i] >= 0)
+            close(stdin_p[i]);
+        if (stdout_p[i] >= 0)
+            close(stdout_p[i]);
+        if (stderr_p[i] >= 0)
+            close(stderr_p[i]);
+    }
+    return (ret);
+}
+
+//!
+//! Reads whatever is available on a child's output pipe into a growing buffer
+//!
+//! @param[in]     fd the pipe to read from
+//! @param[in,out] psBuf the buffer (NULL if the output is not kept)
+//! @param[in,out] pLen the number of bytes in the buffer
+//! @param[in,out] pAlloc the allocated size of the buffer
+//! @param[in]     max_size the maximum size of the buffer including the '\0' (0 for no limit)
+//!
+//! @return the number of bytes read, 0 on EOF or -1 on error
+//!
+static int spawn_read(int fd, char **psBuf, size_t * pLen, size_t * pAlloc, size_t max_size)
+{
+    ssize_t n = 0;
+    size_t room = 0;
+    char *newBuf = NULL;
+    char discard[4096] = "";
+
+    // make room for at least one more chunk unless we reached the limit
+    if (((*pAlloc) - (*pLen)) < 1024) {
+        room = (*pAlloc) * 2;
+        if ((max_size > 0) && (room > max_size))
+            room = max_size;
+        if ((room > (*pAlloc)) && ((newBuf = EUCA_REALLOC(*psBuf, room, sizeof(char))) != NULL)) {
+            (*psBuf) = newBuf;
+            (*pAlloc) = room;
         }
     }
-    // Fork the work
-    if ((*ppid = fork()) == -1) {
-        LOGDEBUG("failed to create a child process\n");
-        return (EUCA_THREAD_ERROR);
+
+    if ((room = ((*pAlloc) - (*pLen) - 1)) > 0) {
+        if ((n = read(fd, ((*psBuf) + (*pLen)), room)) > 0) {
+            (*pLen) += n;
+            (*psBuf)[(*pLen)] = '\0';
+        }
+    } else {
+        // past the limit: keep draining so the child does not block on a full pipe
+        n = read(fd, discard, sizeof(discard));
     }
-    // child?
-    if (*ppid == 0) {
-        setpgid(0, 0);
-        // arrange the file descriptors
-        if (stdin_fd) {
-            close(stdin_p[1]);
-            if (dup2(stdin_p[0], STDIN_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
+
+    if ((n < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+        return (1);
+    return ((int)n);
+}
+
+//!
+//! Runs a program to completion, capturing its output. The child is started with
+//! euca_spawn(), its stdout and stderr are read with poll() and it is waited for with a
+//! pidfd (see timewait()). If the timeout expires, the child is killed.
+//!
+//! @param[in]  argv the NULL terminated list of arguments, argv[0] being looked up in the PATH
+//! @param[in]  flags a combination of EUCA_SPAWN_SETPGROUP and EUCA_SPAWN_MERGE_STDERR
+//! @param[in]  timeout_sec the time allowed to the child in seconds (0 to wait forever)
+//! @param[in]  max_size the maximum size of each captured string including its '\0' (0 for no
+//!             limit). Output beyond that is read and discarded.
+//! @param[out] psStdout set to the captured stdout if not NULL, otherwise stdout is inherited.
+//!             With EUCA_SPAWN_MERGE_STDERR, stderr is captured here as well.
+//! @param[out] psStderr set to the captured stderr if not NULL, otherwise stderr is inherited
+//! @param[out] pStatus set to the status from waitpid() if not NULL (-1 if it is not known)
+//!
+//! @return EUCA_OK if the child exited with 0 or the following error codes on failure:
+//!         \li EUCA_ERROR if the child could not be executed, exited with non-zero or was killed
+//!         \li EUCA_TIMEOUT_ERROR if the child had to be killed because it ran too long
+//!         \li EUCA_INVALID_ERROR if the provided argument does not meet the pre-requirements
+//!         \li EUCA_MEMORY_ERROR if the output buffers cannot be allocated
+//!         \li EUCA_THREAD_ERROR if we fail to create the child process
+//!
+//! @note the caller is responsible for freeing \p psStdout and \p psStderr, which are set
+//!       whenever the child ran, even if it failed
+//!
+int euca_spawn_capture(char *const argv[], int flags, int timeout_sec, size_t max_size, char **psStdout, char **psStderr, int *pStatus)
+{
+    int i = 0;
+    int rc = 0;
+    int nopen = 0;
+    int status = -1;
+    int wait_ms = -1;
+    int ret = EUCA_OK;
+    int fds[2] = { -1, -1 };
+    char **apsBuf[2] = { psStdout, psStderr };
+    pid_t pid = -1;
+    size_t len[2] = { 0, 0 };
+    size_t alloc[2] = { 0, 0 };
+    boolean timedout = FALSE;
+    long long deadline_ms = 0;
+    struct pollfd pfds[2] = { {0} };
+
+    if (pStatus)
+        (*pStatus) = -1;
+    if (psStdout)
+        (*psStdout) = NULL;
+    if (psStderr)
+        (*psStderr) = NULL;
+
+    if ((psStderr != NULL) && (flags & EUCA_SPAWN_MERGE_STDERR))
+        return (EUCA_INVALID_ERROR);
+
+    for (i = 0; i < 2; i++) {
+        if (apsBuf[i] != NULL) {
+            alloc[i] = (((max_size > 0) && (max_size < 4096)) ? max_size : 4096);
+            if ((*apsBuf[i] = EUCA_ZALLOC(alloc[i], sizeof(char))) == NULL) {
+                if (psStdout)
+                    EUCA_FREE(*psStdout);
+                return (EUCA_MEMORY_ERROR);
             }
         }
-        if (stdout_fd) {
-            close(stdout_p[0]);
-            if (dup2(stdout_p[1], STDOUT_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
-            }
+    }
+
+    if ((ret = euca_spawn(&pid, NULL, (psStdout ? &fds[0] : NULL), (psStderr ? &fds[1] : NULL), flags, argv)) != EUCA_OK) {
+        if (psStdout)
+            EUCA_FREE(*psStdout);
+        if (psStderr)
+            EUCA_FREE(*psStderr);
+        return (ret);
+    }
+
+    if (timeout_sec > 0)
+        deadline_ms = time_ms() + (timeout_sec * 1000LL);
+
+    for (;;) {
+        for (i = 0, nopen = 0; i < 2; i++) {
+            pfds[i].fd = fds[i];       // poll() skips negative descriptors
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            if (fds[i] >= 0)
+                nopen++;
         }
-        if (stderr_fd) {
-            close(stderr_p[0]);
-            if (dup2(stderr_p[1], STDERR_FILENO) == -1) {
-                LOGERROR("dup2() failed: %s\n", strerror(errno));
-                exit(1);
+
+        if (nopen == 0)
+            break;
+
+        if (deadline_ms > 0) {
+            if ((wait_ms = (int)(deadline_ms - time_ms())) <= 0) {
+                timedout = TRUE;
+                break;
             }
         }
-        // print the command we are about to execute
-        log_argv(argv);
 
-        // Run the command. This should never return unless a failure occured
-        result = execvp(argv[0], argv);
-        exit(result);
+        if ((rc = poll(pfds, 2, wait_ms)) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOGERROR("failed to poll the child output: %s\n", strerror(errno));
+            break;
+        }
+
+        for (i = 0; (rc > 0) && (i < 2); i++) {
+            if ((fds[i] >= 0) && (pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                if (spawn_read(fds[i], apsBuf[i], &len[i], &alloc[i], max_size) <= 0) {
+                    close(fds[i]);
+                    fds[i] = -1;
+                }
+            }
+        }
     }
-    // close the file descriptors on the parent appropriately
-    if (stdin_fd) {
-        close(stdin_p[0]);
-        *stdin_fd = stdin_p[1];
+
+    for (i = 0; i < 2; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
     }
-    if (stdout_fd) {
-        close(stdout_p[1]);
-        *stdout_fd = stdout_p[0];
+
+    if (!timedout) {
+        if (deadline_ms > 0) {
+            // whole seconds are good enough here, round up what is left
+            if (timewait(pid, &status, (int)((deadline_ms - time_ms() + 999) / 1000)) == 0)
+                timedout = TRUE;
+        } else {
+            while (((rc = waitpid(pid, &status, 0)) < 0) && (errno == EINTR)) ;
+            if (rc < 0)
+                status = -1;
+        }
     }
-    if (stderr_fd) {
-        close(stderr_p[1]);
-        *stderr_fd = stderr_p[0];
+
+    if (timedout) {
+        LOGERROR("child process %d (%s) timed out after %d seconds\n", pid, argv[0], timeout_sec);
+        killwait(pid);
+        status = -1;
+        ret = EUCA_TIMEOUT_ERROR;
+    } else if ((status != -1) && WIFEXITED(status) && (WEXITSTATUS(status) == 0)) {
+        ret = EUCA_OK;
+    } else {
+        ret = EUCA_ERROR;
     }
 
-    return EUCA_OK;
+    if (pStatus)
+        (*pStatus) = status;
+    return (ret);
+}
+
+//!
+//! Eucalyptus wrapper function around exec with file-descriptor support and argv[]
+//!
+//! This is the low-level function that actually sets up file descriptors and
+//! starts the program with euca_spawn(). The function does not wait for the child process to finish:
+//! that can and probably should be done with the complementary low-level function:
+//! euca_waitpid().  Consider higher-level alternatives, too:
+//!
+//! - Those who want to use variable arguments (in lieu of argv[]), can use
+//!   euca_execlp_fd(), which constructs the argv[] and calls this function.
+//!
+//! - Those who want to use variable arguments (in liue of argv[]) and also
+//!   have the function wait for the child to complete, can use euca_execlp()
+//!   (and thus give up on the ability to feed stdin and read stdout and stderr).
+//!
+//! @param[in] ppid pointer to populate with child process's PID (must not be NULL)
+//! @param[in] stdin_fd a pointer to populate with child process's stdin descriptr, if not NULL
+//! @param[in] stdout_fd a pointer to populate with child process's stdout descriptr, if not NULL
+//! @param[in] stderr_fd a pointer to populate with child process's stderr descriptr, if not NULL
+//! @param[in] argv
+//!
+//! @return EUCA_OK on success or the following error codes on failure:
+//!         \li EUCA_ERROR if the execution terminated but failed
+//!         \li EUCA_INVALID_ERROR if the provided argument does not meet the pre-requirements
+//!         \li EUCA_THREAD_ERROR if we fail to execute the program within its own thread
+//!
+//! @pre The file and ppid parameters must not be NULL
+//!
+//! @post
+//!
+//! @note
+//!
+int euca_execvp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, char **argv)
+{
+    assert(ppid);
+    *ppid = -1;
+
+    // the child gets its own process group, as it always did
+    return (euca_spawn(ppid, stdin_fd, stdout_fd, stderr_fd, EUCA_SPAWN_SETPGROUP, argv));
 }
 
 //!
@@ -2544,6 +2756,52 @@ static void *competitor_function(void *arg)
     return NULL;
 }
 
+//!
+//! Times starting /bin/true with fork()+execl() against euca_spawn() from a process whose
+//! heap has been grown and touched, the situation of a CC or NC with large caches.
+//!
+//! @param[in] iterations the number of children to start with each method
+//! @param[in] heap_mb the size of the heap to allocate, in megabytes
+//!
+static void spawn_benchmark(int iterations, size_t heap_mb)
+{
+    int i = 0;
+    int status = 0;
+    pid_t pid = 0;
+    char *heap = NULL;
+    char *argv[] = { "/bin/true", NULL };
+    long long start = 0;
+    long long forked_usec = 0;
+    long long spawned_usec = 0;
+
+    assert((heap = EUCA_ALLOC(heap_mb, MEGABYTE)) != NULL);
+    memset(heap, 1, heap_mb * MEGABYTE);   // make the pages real so fork() has page tables to copy
+
+    start = time_usec();
+    for (i = 0; i < iterations; i++) {
+        if ((pid = fork()) == 0) {
+            execl("/bin/true", "true", (char *)NULL);
+            _exit(127);
+        }
+        assert(pid > 0);
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+    forked_usec = time_usec() - start;
+
+    start = time_usec();
+    for (i = 0; i < iterations; i++) {
+        assert(euca_spawn(&pid, NULL, NULL, NULL, 0, argv) == EUCA_OK);
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+    spawned_usec = time_usec() - start;
+
+    printf("%d x /bin/true with a %lu MB heap: fork+exec %.1f usec/child, euca_spawn %.1f usec/child (%.1fx)\n", iterations, (unsigned long)heap_mb,
+           ((double)forked_usec / iterations), ((double)spawned_usec / iterations), ((double)forked_usec / (double)spawned_usec));
+    EUCA_FREE(heap);
+}
+
 //!
 //! Main entry point of the application
 //!
@@ -2566,6 +2824,13 @@ int main(int argc, char **argv)
     char *devs[] = { "hda", "hdb", "hdc", "hdd", "sda", "sdb", "sdc", "sdd", NULL };
     struct stat estat = { 0 };
 
+    // 'test_misc spawn-bench [iterations [heap_mb]]' only runs the process creation benchmark
+    if ((argc > 1) && !strcmp(argv[1], "spawn-bench")) {
+        logfile(NULL, EUCA_LOG_ERROR, 4);
+        spawn_benchmark(((argc > 2) ? atoi(argv[2]) : 10000), ((argc > 3) ? atoi(argv[3]) : 1024));
+        return (0);
+    }
+
     logfile(TEST_LOG, EUCA_LOG_DEBUG, 4);   // bump up the log level
     sem *log_sem = NULL;
     log_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
@@ -2768,6 +3033,54 @@ int main(int argc, char **argv)
         waitpid(pid, NULL, 0);
     }
 
+    {
+        printf("testing euca_spawn_capture and timeshell\n");
+        int status = 0;
+        pid_t pid = 0;
+        char *out = NULL;
+        char *err = NULL;
+        char obuf[16] = "";
+        char ebuf[16] = "";
+        char *sh_argv[] = { "/bin/sh", "-c", "echo out; echo err 1>&2; exit 3", NULL };
+        char *big_argv[] = { "/bin/sh", "-c", "head -c 100000 /dev/zero | tr '\\0' x", NULL };
+        char *sleep_argv[] = { "sleep", "10", NULL };
+        char *short_argv[] = { "sleep", "1", NULL };
+        char *bad_argv[] = { "/bin/no-such-program", NULL };
+
+        assert(euca_spawn_capture(sh_argv, 0, 5, 0, &out, &err, &status) == EUCA_ERROR);
+        assert(WIFEXITED(status) && (WEXITSTATUS(status) == 3));
+        assert(!strcmp(out, "out\n") && !strcmp(err, "err\n"));
+        EUCA_FREE(out);
+        EUCA_FREE(err);
+
+        assert(euca_spawn_capture(sh_argv, EUCA_SPAWN_MERGE_STDERR, 0, 0, &out, NULL, &status) == EUCA_ERROR);
+        assert(strstr(out, "out\n") && strstr(out, "err\n"));
+        EUCA_FREE(out);
+
+        assert(euca_spawn_capture(big_argv, 0, 5, 0, &out, NULL, &status) == EUCA_OK);
+        assert(strlen(out) == 100000);
+        EUCA_FREE(out);
+        assert(euca_spawn_capture(big_argv, 0, 5, 16, &out, NULL, &status) == EUCA_OK);
+        assert(strlen(out) == 15);
+        EUCA_FREE(out);
+
+        gettimeofday(&tv1, NULL);
+        assert(euca_spawn_capture(sleep_argv, 0, 1, 0, NULL, NULL, &status) == EUCA_TIMEOUT_ERROR);
+        gettimeofday(&tv2, NULL);
+        assert((tv2.tv_sec - tv1.tv_sec) < 5);
+
+        assert(euca_spawn_capture(bad_argv, 0, 0, 0, &out, NULL, &status) == EUCA_ERROR);
+        assert(out == NULL);
+
+        assert(timeshell("echo hello; echo oops 1>&2; exit 2", obuf, ebuf, sizeof(obuf), 5) == 2);
+        assert(!strcmp(obuf, "hello\n") && !strcmp(ebuf, "oops\n"));
+        assert(timeshell("sleep 10", obuf, ebuf, sizeof(obuf), 1) == -1);
+
+        assert(euca_spawn(&pid, NULL, NULL, NULL, 0, short_argv) == EUCA_OK);
+        assert(timewait(pid, &status, 5) == pid);
+        assert(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    }
+
     {
         printf("testing euca_execlp_log\n");
         printf("spawning %d competing threads that will write to %s\n", COMPETITIVE_PARTICIPANTS, TEST_LOG);
@@ -104,6 +104,13 @@
 
 #define NANOSECONDS_IN_SECOND           1000000000  //!< constant for conversion
 
+//! @{
+//! @name Flags for euca_spawn() and euca_spawn_capture()
+#define EUCA_SPAWN_SETPGROUP                  0x01  //!< Start the child in its own process group
+#define EUCA_SPAWN_MERGE_STDERR               0x02  //!< Send the child's stderr to its stdout pipe
+#define EUCA_SPAWN_STDIO_SOCKET               0x04  //!< Give the child one AF_UNIX socket as both stdin and stdout
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -179,6 +186,8 @@ int timeshell(char *command, char *stdout_str, char *stderr_str, int max_size, i
 int get_remoteDevForNC(const char *the_iqn, const char *remoteDev, char *remoteDevForNC, int remoteDevForNCLen);
 int check_for_string_in_list(char *string, char **list, int count);
 char **build_argv(const char *first, va_list va);
+int euca_spawn(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, int flags, char *const argv[]);
+int euca_spawn_capture(char *const argv[], int flags, int timeout_sec, size_t max_size, char **psStdout, char **psStderr, int *pStatus);
 int euca_execvp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, char **argv);
 int euca_waitpid(pid_t pid, int *pStatus);
 int euca_execlp_fd(pid_t * ppid, int *stdin_fd, int *stdout_fd, int *stderr_fd, const char *file, ...);
@@ -76,6 +76,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>                    // offsetof
 #define _GNU_SOURCE
 #include <string.h>                    // strlen, strcpy
 #include <ctype.h>                     // isspace
@@ -121,7 +122,7 @@
 \*----------------------------------------------------------------------------*/
 
 //! an internal struct for temporary storage of stats
-typedef struct getstat_t {
+struct getstat_t {
     char instanceId[100];
     long long timestamp;
     char metricName[100];
@@ -129,7 +130,7 @@ typedef struct getstat_t {
     char dimensionName[100];
     double value;
     struct getstat_t *next;
-} getstat;
+};
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -169,6 +170,7 @@ static sensorResourceCache *sensor_state = NULL;
 static sem *state_sem = NULL;
 static sem *hyp_sem = NULL;
 static int (*sensor_update_euca_config) (void) = NULL;
+static int (*sensor_collector) (getstat *** pstats) = NULL;    //!< in-process replacement for the getstats scripts
 static long long seq_num = 0L;
 
 #ifdef _UNIT_TEST
@@ -192,15 +194,26 @@ static int getstat_generate(getstat *** pstats);
 static void sensor_bottom_half(void);
 static void *sensor_thread(void *arg);
 static void init_state(int resources_size);
+static boolean state_layout_matches(int resources_size);
 static __inline__ boolean is_empty_sr(const sensorResource * sr);
 static int sensor_expire_cache_entries(void);
 #ifdef _UNIT_TEST
 static void log_sensor_resources(const char *name, sensorResource ** srs, int srsLen);
 #endif /* _UNIT_TEST */
+static __inline__ int *sensor_index(void);
+static int index_home(const char *key);
+static const char *index_key(int entry);
+static sensorResource *index_lookup(const char *key);
+static void index_insert(int entry);
+static void index_remove(int entry);
+static void index_rebuild(void);
+static void release_sr(sensorResource * sr);
 static sensorResource *find_or_alloc_sr(const boolean do_alloc, const char *resourceName, const char *resourceType, const char *resourceUuid);
 static sensorMetric *find_or_alloc_sm(const boolean do_alloc, sensorResource * sr, const char *metricName);
 static sensorCounter *find_or_alloc_sc(const boolean do_alloc, sensorMetric * sm, const sensorCounterType counterType);
 static sensorDimension *find_or_alloc_sd(const boolean do_alloc, sensorCounter * sc, const char *dimensionName);
+static int merge_dimension(const char *resourceName, const char *metricName, const sensorCounterType type, sensorCounter * cache_sc, sensorDimension * cache_sd,
+                           const sensorDimension * sd);
 
 #ifdef _UNIT_TEST
 static void dump_sensor_cache(void);
@@ -308,7 +321,177 @@ static int getstat_add_values(const char *name, getstat * head)
 }
 
 //!
-//! obtain stats from the getstats script
+//! Appends one measurement to a set of stats, the way getstats.pl output
+//! would be recorded: the array holds one NULL-terminated entry per
+//! resource and each entry heads a linked list of that resource's values.
+//! Collectors tend to emit all values of one resource in a row, so the
+//! last entry of the array is checked before searching the whole set.
+//!
+//! @param[in,out] pstats pointer to the NULL-terminated array of stats, may point to NULL
+//! @param[in] resource name of the resource (e.g., instance ID)
+//! @param[in] timestampMs time of the measurement in milliseconds
+//! @param[in] metricName name of the metric (e.g., CPUUtilization)
+//! @param[in] counterType type of the counter (see sensorCounterType)
+//! @param[in] dimensionName name of the dimension (e.g., default, vda)
+//! @param[in] value measured value
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR or EUCA_MEMORY_ERROR on failure
+//!
+int sensor_add_stat(getstat *** pstats, const char *resource, long long timestampMs, const char *metricName, int counterType, const char *dimensionName, double value)
+{
+    int ninst = 0;
+    getstat *gs = NULL;
+    getstat *gsp = NULL;
+    getstat **gss = NULL;
+
+    if ((pstats == NULL) || (resource == NULL) || (metricName == NULL) || (dimensionName == NULL))
+        return (EUCA_INVALID_ERROR);
+
+    if ((gs = EUCA_ZALLOC(1, sizeof(getstat))) == NULL)
+        return (EUCA_MEMORY_ERROR);
+
+    euca_strncpy(gs->instanceId, resource, sizeof(gs->instanceId));
+    gs->timestamp = timestampMs;
+    euca_strncpy(gs->metricName, metricName, sizeof(gs->metricName));
+    gs->counterType = counterType;
+    euca_strncpy(gs->dimensionName, dimensionName, sizeof(gs->dimensionName));
+    gs->value = value;
+
+    ninst = getstat_ninstances(*pstats);
+    if ((ninst > 0) && !strcmp((*pstats)[ninst - 1]->instanceId, gs->instanceId))
+        gsp = (*pstats)[ninst - 1];
+    else
+        gsp = getstat_find(*pstats, gs->instanceId);
+
+    if (gsp == NULL) {                 // first record for this resource => expand pointer array
+        if ((gss = EUCA_REALLOC(*pstats, (ninst + 2), sizeof(getstat *))) == NULL) {
+            EUCA_FREE(gs);
+            return (EUCA_MEMORY_ERROR);
+        }
+        gss[ninst] = gs;
+        gss[ninst + 1] = NULL;         // NULL-terminate the array
+        *pstats = gss;
+    } else {                           // not first record
+        for (; gsp->next != NULL; gsp = gsp->next) ;    // walk the linked list to the end
+        gsp->next = gs;                // add the new record
+    }
+
+    return (EUCA_OK);
+}
+
+//!
+//! Parses the output of the getstats scripts, which is a string with one
+//! line per measurement and tab-delimited fields, and appends the values
+//! to a set of stats. The string is modified in the process.
+//!
+//! @param[in] output output of a getstats script
+//! @param[in,out] pstats pointer to the NULL-terminated array of stats, may point to NULL
+//!
+//! @return EUCA_OK on success or EUCA_ERROR on failure. On failure all stats are freed.
+//!
+int sensor_parse_stats(char *output, getstat *** pstats)
+{
+    char *token = NULL;
+    char *subtoken = NULL;
+    char *saveptr1 = NULL;
+    char *saveptr2 = NULL;
+    char *str1 = output;
+    char *str2 = NULL;
+    char *endptr = NULL;
+    char *instanceId = NULL;
+    char *metricName = NULL;
+    char *dimensionName = NULL;
+    int counterType = 0;
+    long long timestamp = 0;
+    double value = 0;
+
+    if ((output == NULL) || (pstats == NULL))
+        return (EUCA_ERROR);
+
+    for (int i = 1;; i++, str1 = NULL) {    // iterate over lines in output
+        token = strtok_r(str1, "\n", &saveptr1);    // token points to a whole line
+        if (token == NULL)
+            break;
+
+        // e.g. line: i-760B43A1      1347407243789   NetworkIn       summation       total   2112765752
+        instanceId = metricName = dimensionName = NULL;
+        counterType = 0;
+        timestamp = 0;
+        value = 0;
+
+        str2 = token;
+        for (int j = 1;; j++, str2 = NULL) {    // iterate over tab-separated entries in the line
+            subtoken = strtok_r(str2, "\t", &saveptr2);
+            if (subtoken == NULL)
+                break;
+
+            switch (j) {
+            case 1:                   // first entry is instance ID
+                instanceId = subtoken;
+                break;
+            case 2:
+                errno = 0;
+                timestamp = strtoll(subtoken, &endptr, 10);
+                if (errno != 0 && *endptr != '\0') {
+                    LOGERROR("unexpected input from getstats.pl (could not convert timestamp with strtoll())\n");
+                    goto bail;
+                }
+                break;
+            case 3:
+                metricName = subtoken;
+                break;
+            case 4:
+                counterType = sensor_str2type(subtoken);
+                break;
+            case 5:
+                dimensionName = subtoken;
+                break;
+            case 6:
+                errno = 0;
+                value = strtod(subtoken, &endptr);
+                if (errno != 0 && *endptr != '\0') {
+                    LOGERROR("unexpected input from getstats.pl (could not convert value with strtod())\n");
+                    goto bail;
+                }
+                break;
+            default:
+                LOGERROR("unexpected input from getstats.pl (too many fields)\n");
+                goto bail;
+            }
+        }
+
+        if (instanceId == NULL)        // empty line
+            continue;
+
+        if (sensor_add_stat(pstats, instanceId, timestamp, (metricName ? metricName : ""), counterType, (dimensionName ? dimensionName : ""), value) != EUCA_OK)
+            goto bail;
+    }
+    return (EUCA_OK);
+
+bail:
+    getstat_free(*pstats);
+    *pstats = NULL;
+    return (EUCA_ERROR);
+}
+
+//!
+//! Registers a function that collects stats in-process, in place of the
+//! getstats scripts. The function appends its measurements to the set it
+//! is given with sensor_add_stat() and returns EUCA_OK on success.
+//!
+//! @param[in] collector_function the collector or NULL to go back to the scripts
+//!
+//! @return Always returns EUCA_OK
+//!
+int sensor_set_collector(int (*collector_function) (getstat *** pstats))
+{
+    sensor_collector = collector_function;
+    return (EUCA_OK);
+}
+
+//!
+//! obtain stats from the registered collector or, if there is none, from
+//! the getstats script
 //!
 //! @param[in,out] pstats
 //!
@@ -318,6 +501,15 @@ static int getstat_generate(getstat *** pstats)
 {
     assert(sensor_state != NULL && state_sem != NULL);
 
+    if (sensor_collector != NULL) {
+        if (sensor_collector(pstats) != EUCA_OK) {
+            getstat_free(*pstats);
+            *pstats = NULL;
+            return (EUCA_ERROR);
+        }
+        return (EUCA_OK);
+    }
+
     errno = 0;
     char *output = NULL;
     if (!strcmp(euca_this_component_name, "cc")) {
@@ -344,88 +536,8 @@ static int getstat_generate(getstat *** pstats)
     }
 
     int ret = EUCA_ERROR;
-    if (output) {                      // output is a string with one line per measurement, with tab-delimited fields
-        char *token, *subtoken;
-        char *saveptr1, *saveptr2;
-        char *str1 = output;
-        getstat **gss = NULL;
-        int ninst = 0;
-
-        for (int i = 1;; i++, str1 = NULL) {    // iterate over lines in output
-            token = strtok_r(str1, "\n", &saveptr1);    // token points to a whole line
-            if (token == NULL)
-                break;
-            getstat *gs = EUCA_ZALLOC(1, sizeof(getstat));  // new lines means new data record
-            if (gs == NULL)
-                goto bail;
-
-            char *str2 = token;
-            for (int j = 1;; j++, str2 = NULL) {    // iterate over tab-separated entries in the line
-                subtoken = strtok_r(str2, "\t", &saveptr2);
-                if (subtoken == NULL) {
-                    if (j == 1)
-                        EUCA_FREE(gs);
-                    break;
-                }
-                // e.g. line: i-760B43A1      1347407243789   NetworkIn       summation       total   2112765752
-                switch (j) {
-                case 1:{              // first entry is instance ID
-                        getstat *gsp = getstat_find(*pstats, subtoken);
-                        if (gsp == NULL) {  // first record for this instance => expand pointer array
-                            ninst++;
-                            gss = EUCA_REALLOC(gss, (ninst + 1), sizeof(getstat *));
-                            gss[ninst - 1] = gs;
-                            gss[ninst] = NULL;  // NULL-terminate the array
-                            *pstats = gss;
-                        } else {       // not first record
-                            for (; gsp->next != NULL; gsp = gsp->next) ;    // walk the linked list to the end
-                            gsp->next = gs; // add the new record
-                        }
-                        euca_strncpy(gs->instanceId, subtoken, sizeof(gs->instanceId));
-                        break;
-                    }
-                case 2:{
-                        char *endptr;
-                        errno = 0;
-                        gs->timestamp = strtoll(subtoken, &endptr, 10);
-                        if (errno != 0 && *endptr != '\0') {
-                            LOGERROR("unexpected input from getstats.pl (could not convert timestamp with strtoll())\n");
-                            goto bail;
-                        }
-                        break;
-                    }
-                case 3:
-                    euca_strncpy(gs->metricName, subtoken, sizeof(gs->metricName));
-                    break;
-                case 4:
-                    gs->counterType = sensor_str2type(subtoken);
-                    break;
-                case 5:
-                    euca_strncpy(gs->dimensionName, subtoken, sizeof(gs->dimensionName));
-                    break;
-                case 6:{
-                        char *endptr;
-                        errno = 0;
-                        gs->value = strtod(subtoken, &endptr);
-                        if (errno != 0 && *endptr != '\0') {
-                            LOGERROR("unexpected input from getstats.pl (could not convert value with strtod())\n");
-                            goto bail;
-                        }
-                        break;
-                    }
-                default:
-                    LOGERROR("unexpected input from getstats.pl (too many fields)\n");
-                    goto bail;
-                }
-            }
-        }
-        ret = EUCA_OK;
-        goto done;
-
-bail:
-        getstat_free(*pstats);
-
-done:
+    if (output) {
+        ret = sensor_parse_stats(output, pstats);
         EUCA_FREE(output);
     } else {
         LOGWARN("failed to invoke getstats for sensor data (%s)\n", strerror(errno));
@@ -537,7 +649,10 @@ static void *sensor_thread(void *arg)
 //!
 static void init_state(int resources_size)
 {
-    LOGDEBUG("initializing sensor shared memory (%lu KB)...\n", (sizeof(sensorResourceCache) + sizeof(sensorResource) * (resources_size - 1)) / 1024);
+    LOGDEBUG("initializing sensor shared memory (%lu KB)...\n", SENSOR_CACHE_SIZE(resources_size) / 1024);
+    bzero(sensor_state, offsetof(sensorResourceCache, resources));
+    sensor_state->magic = SENSOR_CACHE_MAGIC;
+    sensor_state->resource_size = sizeof(sensorResource);
     sensor_state->max_resources = resources_size;
     sensor_state->collection_interval_time_ms = 0;
     sensor_state->history_size = 0;
@@ -547,10 +662,27 @@ static void init_state(int resources_size)
         sensorResource *sr = sensor_state->resources + i;
         bzero(sr, sizeof(sensorResource));
     }
+    sensor_state->used_resources = 0;
+    sensor_state->index_size = SENSOR_INDEX_SIZE(resources_size);
+    bzero(sensor_index(), (sizeof(int) * sensor_state->index_size));
     sensor_state->initialized = TRUE;  // inter-process init done
     LOGINFO("initialized sensor shared memory\n");
 }
 
+//!
+//! Checks whether the sensor state was initialized by a process using the same layout and
+//! size, e.g., not by a CC of an earlier release that left its cache file behind
+//!
+//! @param[in] resources_size the number of resources the state was mapped with
+//!
+//! @return TRUE if the state can be used as it is or FALSE if it must be initialized
+//!
+static boolean state_layout_matches(int resources_size)
+{
+    return ((sensor_state->magic == SENSOR_CACHE_MAGIC) && (sensor_state->resource_size == sizeof(sensorResource)) && sensor_state->initialized
+            && (sensor_state->max_resources == resources_size) && (sensor_state->index_size == SENSOR_INDEX_SIZE(resources_size)));
+}
+
 //!
 //! Checks wether or not a sensor resource is in use
 //!
@@ -596,7 +728,7 @@ static int sensor_expire_cache_entries(void)
 
         if (cache_timeout && (timestamp_age > cache_timeout)) {
             LOGINFO("expiring resource %s from sensor cache, no update in %ld seconds, timeout is %ld seconds\n", sr->resourceName, timestamp_age, cache_timeout);
-            sr->resourceName[0] = '\0'; // marks the slot as empty
+            release_sr(sr);
             ret++;
         }
     }
@@ -642,7 +774,9 @@ int sensor_init(sem * sem, sensorResourceCache * resources, int resources_size,
 
         // if this process is the first to get to global state, initialize it
         sem_p(state_sem);
-        if (!sensor_state->initialized) {
+        if (!state_layout_matches(resources_size)) {
+            if (sensor_state->magic != 0)
+                LOGWARN("sensor shared memory was laid out differently (magic=%#x), discarding its content\n", sensor_state->magic);
             init_state(resources_size);
         }
         LOGDEBUG("setting sensor_update_euca_config: %s\n", update_euca_config_function ? "TRUE" : "NULL");
@@ -668,7 +802,7 @@ int sensor_init(sem * sem, sensorResourceCache * resources, int resources_size,
             return (EUCA_MEMORY_ERROR);
         }
 
-        sensor_state = EUCA_ZALLOC(sizeof(sensorResourceCache) + sizeof(sensorResource), (use_resources_size - 1));
+        sensor_state = EUCA_ZALLOC(1, SENSOR_CACHE_SIZE(use_resources_size));
         if (sensor_state == NULL) {
             LOGFATAL("failed to allocate memory for sensor data\n");
             SEM_FREE(state_sem);
@@ -1018,6 +1152,159 @@ int sensor_get_dummy_instance_data(long long sn, const char *instanceId, const c
     return (EUCA_OK);
 }
 
+//!
+//! Returns the hash index of the sensor cache, which lives right after
+//! the last resource slot so that it is shared along with the cache.
+//! Each non-empty slot holds r+1 for the name of resources[r] or -(r+1)
+//! for its alias; zero marks an empty slot.
+//!
+//! @return a pointer to the first slot of the index
+//!
+static __inline__ int *sensor_index(void)
+{
+    return ((int *)(sensor_state->resources + sensor_state->max_resources));
+}
+
+//!
+//! Hashes a resource name or alias for the index (djb2)
+//!
+//! @param[in] key the name or alias
+//!
+//! @return the home slot of the key in the index
+//!
+static int index_home(const char *key)
+{
+    u_int32_t hash = 5381;
+
+    for (; *key != '\0'; key++)
+        hash = ((hash << 5) + hash) + ((unsigned char)*key);
+    return ((int)(hash % ((u_int32_t) sensor_state->index_size)));
+}
+
+//!
+//! Returns the string an index entry stands for
+//!
+//! @param[in] entry the index entry (see sensor_index())
+//!
+//! @return the name or the alias of the resource
+//!
+static const char *index_key(int entry)
+{
+    const sensorResource *sr = sensor_state->resources + (((entry > 0) ? entry : -entry) - 1);
+    return ((entry > 0) ? sr->resourceName : sr->resourceAlias);
+}
+
+//!
+//! Finds a resource by name or by alias through the index
+//!
+//! @param[in] key the name or alias
+//!
+//! @return a pointer to the resource or NULL if there is none
+//!
+static sensorResource *index_lookup(const char *key)
+{
+    int *index = sensor_index();
+    int entry = 0;
+
+    for (int i = index_home(key), n = 0; (index[i] != 0) && (n < sensor_state->index_size); i = ((i + 1) % sensor_state->index_size), n++) {
+        if (!strcmp(index_key(index[i]), key)) {
+            entry = index[i];
+            return (sensor_state->resources + (((entry > 0) ? entry : -entry) - 1));
+        }
+    }
+    return (NULL);
+}
+
+//!
+//! Adds an entry to the index, unless the string it stands for is empty
+//!
+//! @param[in] entry the index entry (see sensor_index())
+//!
+static void index_insert(int entry)
+{
+    int *index = sensor_index();
+    const char *key = index_key(entry);
+
+    if (key[0] == '\0')
+        return;
+
+    // there are at most two entries per resource, so there is always a free slot
+    for (int i = index_home(key);; i = ((i + 1) % sensor_state->index_size)) {
+        if (index[i] == 0) {
+            index[i] = entry;
+            return;
+        }
+    }
+}
+
+//!
+//! Removes an entry from the index, moving later entries of the same probe
+//! sequence back so that lookups never need tombstones. Must be called
+//! while the string the entry stands for is still in place.
+//!
+//! @param[in] entry the index entry (see sensor_index())
+//!
+static void index_remove(int entry)
+{
+    int i = 0;
+    int j = 0;
+    int home = 0;
+    int *index = sensor_index();
+    const char *key = index_key(entry);
+
+    if (key[0] == '\0')
+        return;
+
+    for (i = index_home(key); index[i] != entry; i = ((i + 1) % sensor_state->index_size)) {
+        if (index[i] == 0)
+            return;                    // not indexed
+    }
+
+    for (j = ((i + 1) % sensor_state->index_size); index[j] != 0; j = ((j + 1) % sensor_state->index_size)) {
+        home = index_home(index_key(index[j]));
+        // leave the entry alone if its home lies cyclically in (i, j]
+        if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j)))
+            continue;
+        index[i] = index[j];
+        i = j;
+    }
+    index[i] = 0;
+}
+
+//!
+//! Rebuilds the index from the resources in the cache
+//!
+static void index_rebuild(void)
+{
+    sensor_state->index_size = SENSOR_INDEX_SIZE(sensor_state->max_resources);
+    bzero(sensor_index(), (sizeof(int) * sensor_state->index_size));
+    sensor_state->used_resources = 0;
+    for (int r = 0; r < sensor_state->max_resources; r++) {
+        if (is_empty_sr(sensor_state->resources + r))
+            continue;
+        index_insert(r + 1);
+        index_insert(-(r + 1));
+        sensor_state->used_resources++;
+    }
+}
+
+//!
+//! Empties a resource slot in the cache. This must be called from within
+//! a state_sem lock.
+//!
+//! @param[in] sr pointer to the resource to release
+//!
+static void release_sr(sensorResource * sr)
+{
+    int entry = (sr - sensor_state->resources) + 1;
+
+    index_remove(-entry);
+    index_remove(entry);
+    sr->resourceName[0] = '\0';        // marks the slot as empty
+    sr->resourceAlias[0] = '\0';
+    sensor_state->used_resources--;
+}
+
 //!
 //!
 //!
@@ -1036,32 +1323,25 @@ static sensorResource *find_or_alloc_sr(const boolean do_alloc, const char *reso
         return NULL;
     }
 
-    sensorResource *unused_sr = NULL;
-    for (int r = 0; r < sensor_state->max_resources; r++) {
-        sensorResource *sr = sensor_state->resources + r;
-
-        if (is_empty_sr(sr)) {         // unused slot
-            // remember the first unused slot in case we do not find this resource
-            if (unused_sr == NULL) {
-                unused_sr = sr;
-            }
-            continue;
-        }
-        // we have a match
-        if ((strcmp(sr->resourceName, resourceName) == 0) || (strcmp(sr->resourceAlias, resourceName) == 0)) {
-            if (resourceType) {
-                if (strcmp(sr->resourceType, resourceType) == 0) {
-                    return sr;
-                }
-            }
-            return sr;
-        }
-    }
+    sensorResource *sr = index_lookup(resourceName);
+    if (sr != NULL)                    // we have a match, by name or by alias
+        return sr;
 
     if (!do_alloc)
         return NULL;
     if (resourceType == NULL)          // must be set for allocation
         return NULL;
+    if (resourceName[0] == '\0')       // would look like an unused slot
+        return NULL;
+
+    // take the first unused slot
+    sensorResource *unused_sr = NULL;
+    for (int r = 0; r < sensor_state->max_resources; r++) {
+        if (is_empty_sr(sensor_state->resources + r)) {
+            unused_sr = sensor_state->resources + r;
+            break;
+        }
+    }
 
     // fill out the new slot
     if (unused_sr != NULL) {
@@ -1072,6 +1352,7 @@ static sensorResource *find_or_alloc_sr(const boolean do_alloc, const char *reso
         if (resourceUuid)
             euca_strncpy(unused_sr->resourceUuid, resourceUuid, sizeof(unused_sr->resourceUuid));
         unused_sr->timestamp = time(NULL);
+        index_insert((unused_sr - sensor_state->resources) + 1);
         sensor_state->used_resources++;
         LOGINFO("allocated new sensor resource %s\n", resourceName);
     }
@@ -1194,6 +1475,127 @@ static sensorDimension *find_or_alloc_sd(const boolean do_alloc, sensorCounter *
     return sd;
 }
 
+//!
+//! Merges the values of one dimension into the matching dimension in the
+//! cache, skipping over values that are already there. Values live in a
+//! ring indexed from firstValueIndex, so appending is O(1) per value and
+//! the oldest value is dropped by moving the start of the ring.
+//!
+//! @param[in] resourceName name of the resource, for logging
+//! @param[in] metricName name of the metric, for logging
+//! @param[in] type type of the counter
+//! @param[in] cache_sc the counter in the cache that cache_sd belongs to
+//! @param[in] cache_sd the dimension in the cache to merge into
+//! @param[in] sd the dimension with the new values
+//!
+//! @return the number of values merged or -1 if the cache is inconsistent
+//!
+static int merge_dimension(const char *resourceName, const char *metricName, const sensorCounterType type, sensorCounter * cache_sc, sensorDimension * cache_sd,
+                           const sensorDimension * sd)
+{
+    int copied = 0;
+
+    if (cache_sd->valuesLen < 0 || cache_sd->valuesLen > MAX_SENSOR_VALUES) {   // sanity check
+        LOGWARN("inconsistency in sensor database (valuesLen=%d for %s:%s:%s:%s)\n",
+                cache_sd->valuesLen, resourceName, metricName, sensor_type2str(type), cache_sd->dimensionName);
+        return (-1);
+    }
+
+    if (sd->valuesLen < 1)             // no values in this dimension at all
+        return (0);
+
+    // correlate new values with values already in the cache:
+    // phase 1: go backwards through sequence numbers of new and old
+
+    int inv_start = -1;                // input start logical index for copying of new values
+    int iov = cache_sd->valuesLen - 1; // logical index for old values, starting with the latest
+    int iov_start = iov + 1;           // cache start logical index for receiving new values
+    for (int inv = sd->valuesLen - 1; inv >= 0; inv--) {    // logical index for new values, starting with the latest
+        long long sov = cache_sd->sequenceNum + iov;    // seq for old values
+        long long snv = sd->sequenceNum + inv;  // seq for new values
+
+        if (snv < sov) {               // the last new seq number is behind the last old seq number
+            // this can happen when sensor resets; if, additionally,
+            // network outage prevented delivery for a while, there
+            // may also be a gap in numbers, rather than a reset to 0
+            LOGINFO("reset in sensor values detected, clearing history for %s:%s:%s:%s\n", resourceName, metricName, sensor_type2str(type), sd->dimensionName);
+            LOGDEBUG("cached valuesLen=%d seq=%lld+%d vs new valuesLen=%d seq=%lld+%d\n", cache_sd->valuesLen, cache_sd->sequenceNum, iov, sd->valuesLen, sd->sequenceNum, inv);
+            inv_start = 0;             // copy all new values
+            iov_start = 0;             // overwrite what is in cache
+            break;
+        }
+
+        if (snv > sov) {               // new data, so include it in the list to copy
+            inv_start = inv;
+            continue;
+        }
+
+        if (iov < 0)                   // no more old, cached data to compare against
+            continue;
+
+        // the rest of this is for internal checking - the old and new values must match
+        int vn_adj = (inv + sd->firstValueIndex) % MAX_SENSOR_VALUES;   // values adjusted for firstValueIndex
+        int vo_adj = (iov + cache_sd->firstValueIndex) % MAX_SENSOR_VALUES;
+        if ((sd->values[vn_adj].timestampMs != cache_sd->values[vo_adj].timestampMs)
+            || (sd->values[vn_adj].available != cache_sd->values[vo_adj].available)
+            || (sd->values[vn_adj].value != cache_sd->values[vo_adj].value)) {
+            LOGWARN("mismatch in sensor data being merged into in-memory cache, clearing history for %s:%s:%s:%s\n",
+                    resourceName, metricName, sensor_type2str(type), sd->dimensionName);
+            inv_start = 0;
+            iov_start = 0;
+            break;
+        }
+
+        iov--;
+    }
+
+    // step 2: if there is new data, copy it into the right place
+
+    if (inv_start < 0)                 // nothing new
+        return (0);
+
+    iov = iov_start;
+    for (int inv = inv_start; inv < sd->valuesLen; inv++, iov++) {
+        int vn_adj = (inv + sd->firstValueIndex) % MAX_SENSOR_VALUES;   // values adjusted for firstValueIndex
+        int vo_adj = (iov + cache_sd->firstValueIndex) % MAX_SENSOR_VALUES;
+        cache_sd->values[vo_adj].timestampMs = sd->values[vn_adj].timestampMs;
+        cache_sd->values[vo_adj].available = sd->values[vn_adj].available;
+        cache_sd->values[vo_adj].value = sd->values[vn_adj].value;
+
+        // if this is the first value for a SUMMATION-type counter (seq num is zero),
+        // set the shift to the negative of the value so that values go back to zero, too
+        // (this is easier than maintaining shift_value, which is also used to compensate
+        // for value resets due to instance rebooting, across component restarts)
+        if ((sd->sequenceNum + iov) == 0 && copied == 0 && type == SENSOR_SUMMATION) {
+            if (sd->values[vn_adj].value != 0) {
+                cache_sd->shift_value = -sd->values[vn_adj].value;  // TODO: deal with the case when available is FALSE?
+                LOGTRACE("at seq 0, setting shift for %s:%s:%s:%s to %f\n", resourceName, metricName, sensor_type2str(type), sd->dimensionName, cache_sd->shift_value);
+            }
+        } else {
+            sensorValue *sv = cache_sd->values + vo_adj;
+            LOGTRACE("merging sensor value %s:%s:%s:%s %05lld %014lld %s %f\n",
+                     resourceName, metricName, sensor_type2str(type), sd->dimensionName, sd->sequenceNum + inv,
+                     sv->timestampMs, sv->available ? "YES" : " NO", sv->available ? sv->value : -1);
+        }
+        copied++;
+    }
+    // adjust the length capping it at array size
+    cache_sd->valuesLen = iov_start + copied;
+    if (cache_sd->valuesLen > MAX_SENSOR_VALUES) {
+        cache_sd->valuesLen = MAX_SENSOR_VALUES;
+    }
+    // shift the first entry's index up if the values wrapped
+    cache_sd->firstValueIndex = (cache_sd->firstValueIndex + (iov_start + copied) - cache_sd->valuesLen) % MAX_SENSOR_VALUES;
+
+    // set the sequence number by counting back from the seq num of the last value copied in
+    cache_sd->sequenceNum = (sd->sequenceNum + sd->valuesLen) - cache_sd->valuesLen;
+
+    //! update the interval now (@TODO should we base it on the delta between the last two values?)
+    cache_sc->collectionIntervalMs = sensor_state->collection_interval_time_ms;
+
+    return (copied);
+}
+
 //!
 //! Merges records in srs[] array of pointers (of length srsLen)
 //! into records in the in-memory sensor values cache.  The merge
@@ -1266,107 +1668,10 @@ int sensor_merge_records(sensorResource * srs[], int srsLen, boolean fail_on_oom
                         continue;
                     }
 
-                    if (cache_sd->valuesLen < 0 || cache_sd->valuesLen > MAX_SENSOR_VALUES) {   // sanity check
-                        LOGWARN("inconsistency in sensor database (valuesLen=%d for %s:%s:%s:%s)\n",
-                                cache_sd->valuesLen, cache_sr->resourceName, cache_sm->metricName, sensor_type2str(cache_sc->type), cache_sd->dimensionName);
+                    int merged = merge_dimension(sr->resourceName, sm->metricName, sc->type, cache_sc, cache_sd, sd);
+                    if (merged < 0)
                         goto bail;
-                    }
-
-                    if (sd->valuesLen < 1)  // no values in this dimension at all
-                        continue;
-
-                    // correlate new values with values already in the cache:
-                    // phase 1: go backwards through sequence numbers of new and old
-
-                    int inv_start = -1; // input start logical index for copying of new values
-                    int iov = cache_sd->valuesLen - 1;  // logical index for old values, starting with the latest
-                    int iov_start = iov + 1;    // cache start logical index for receiving new values
-                    for (int inv = sd->valuesLen - 1; inv >= 0; inv--) {    // logical index for new values, starting with the latest
-                        long long sov = cache_sd->sequenceNum + iov;    // seq for old values
-                        long long snv = sd->sequenceNum + inv;  // seq for new values
-
-                        if (snv < sov) {    // the last new seq number is behind the last old seq number
-                            // this can happen when sensor resets; if, additionally,
-                            // network outage prevented delivery for a while, there
-                            // may also be a gap in numbers, rather than a reset to 0
-                            LOGINFO("reset in sensor values detected, clearing history for %s:%s:%s:%s\n", sr->resourceName,
-                                    sm->metricName, sensor_type2str(sc->type), sd->dimensionName);
-                            LOGDEBUG("cached valuesLen=%d seq=%lld+%d vs new valuesLen=%d seq=%lld+%d\n", cache_sd->valuesLen,
-                                     cache_sd->sequenceNum, iov, sd->valuesLen, sd->sequenceNum, inv);
-                            inv_start = 0;  // copy all new values
-                            iov_start = 0;  // overwrite what is in cache
-                            break;
-                        }
-
-                        if (snv > sov) {    // new data, so include it in the list to copy
-                            inv_start = inv;
-                            continue;
-                        }
-
-                        if (iov < 0)   // no more old, cached data to compare against
-                            continue;
-
-                        // the rest of this is for internal checking - the old and new values must match
-                        int vn_adj = (inv + sd->firstValueIndex) % MAX_SENSOR_VALUES;   // values adjusted for firstValueIndex
-                        int vo_adj = (iov + cache_sd->firstValueIndex) % MAX_SENSOR_VALUES;
-                        if ((sd->values[vn_adj].timestampMs != cache_sd->values[vo_adj].timestampMs)
-                            || (sd->values[vn_adj].available != cache_sd->values[vo_adj].available)
-                            || (sd->values[vn_adj].value != cache_sd->values[vo_adj].value)) {
-                            LOGWARN("mismatch in sensor data being merged into in-memory cache, clearing history for %s:%s:%s:%s\n",
-                                    sr->resourceName, sm->metricName, sensor_type2str(sc->type), sd->dimensionName);
-                            inv_start = 0;
-                            iov_start = 0;
-                            break;
-                        }
-
-                        iov--;
-                    }
-
-                    // step 2: if there is new data, copy it into the right place
-
-                    if (inv_start >= 0) {   // there is new data to copy
-                        int iov = iov_start;
-                        int copied = 0;
-                        for (int inv = inv_start; inv < sd->valuesLen; inv++, iov++) {
-                            int vn_adj = (inv + sd->firstValueIndex) % MAX_SENSOR_VALUES;   // values adjusted for firstValueIndex
-                            int vo_adj = (iov + cache_sd->firstValueIndex) % MAX_SENSOR_VALUES;
-                            cache_sd->values[vo_adj].timestampMs = sd->values[vn_adj].timestampMs;
-                            cache_sd->values[vo_adj].available = sd->values[vn_adj].available;
-                            cache_sd->values[vo_adj].value = sd->values[vn_adj].value;
-
-                            // if this is the first value for a SUMMATION-type counter (seq num is zero),
-                            // set the shift to the negative of the value so that values go back to zero, too
-                            // (this is easier than maintaining shift_value, which is also used to compensate
-                            // for value resets due to instance rebooting, across component restarts)
-                            if ((sd->sequenceNum + iov) == 0 && copied == 0 && sc->type == SENSOR_SUMMATION) {
-                                if (sd->values[vn_adj].value != 0) {
-                                    cache_sd->shift_value = -sd->values[vn_adj].value;  // TODO: deal with the case when available is FALSE?
-                                    LOGTRACE("at seq 0, setting shift for %s:%s:%s:%s to %f\n",
-                                             sr->resourceName, sm->metricName, sensor_type2str(sc->type), sd->dimensionName, cache_sd->shift_value);
-                                }
-                            } else {
-                                sensorValue *sv = cache_sd->values + vo_adj;
-                                LOGTRACE("merging sensor value %s:%s:%s:%s %05lld %014lld %s %f\n",
-                                         sr->resourceName, sm->metricName, sensor_type2str(sc->type), sd->dimensionName, sd->sequenceNum + inv,
-                                         sv->timestampMs, sv->available ? "YES" : " NO", sv->available ? sv->value : -1);
-                            }
-                            num_merged++;
-                            copied++;
-                        }
-                        // adjust the length capping it at array size
-                        cache_sd->valuesLen = iov_start + copied;
-                        if (cache_sd->valuesLen > MAX_SENSOR_VALUES) {
-                            cache_sd->valuesLen = MAX_SENSOR_VALUES;
-                        }
-                        // shift the first entry's index up if the values wrapped
-                        cache_sd->firstValueIndex = (cache_sd->firstValueIndex + (iov_start + copied) - cache_sd->valuesLen) % MAX_SENSOR_VALUES;
-
-                        // set the sequence number by counting back from the seq num of the last value copied in
-                        cache_sd->sequenceNum = (sd->sequenceNum + sd->valuesLen) - cache_sd->valuesLen;
-
-                        //! update the interval now (@TODO should we base it on the delta between the last two values?)
-                        cache_sc->collectionIntervalMs = sensor_state->collection_interval_time_ms;
-                    }
+                    num_merged += merged;
                 }
             }
         }
@@ -1384,10 +1689,11 @@ bail:
 }
 
 //!
-//! Adds a single value into the in-memory sensor cache. This is
-//! implemented by constructing a whole big sensorResource record
-//! just for one value and merging it. The advantage of this
-//! approach is that all additions are done by the merging code.
+//! Adds a single value into the in-memory sensor cache. The value goes
+//! through the same merging code as sensor_merge_records(), but only a
+//! single dimension is built to carry it, and the cache entries are found
+//! through the index, so an addition costs O(1) rather than a scan of the
+//! whole cache.
 //!
 //! @param[in] instanceId the instance identifier string (i-XXXXXXXX)
 //! @param[in] metricName
@@ -1398,52 +1704,66 @@ bail:
 //! @param[in] available
 //! @param[in] value
 //!
-//! @return the result of the sensor_merge_records() call
+//! @return EUCA_OK on success or EUCA_ERROR on failure
 //!
 //! @see sensor_merge_records()
 //!
 int sensor_add_value(const char *instanceId, const char *metricName, const int counterType, const char *dimensionName, const long long sequenceNum, const long long timestampMs,
                      const boolean available, const double value)
 {
+    if (sensor_state == NULL || sensor_state->initialized == FALSE)
+        return (EUCA_ERROR);
+
     // this data structure is a carrier for the value
-    sensorResource sr = {
-        .resourceType = "instance",
-        .metricsLen = 1,
-        .metrics = {
-                    {
-                     .countersLen = 1,
-                     .counters = {
-                                  {
-                                   .collectionIntervalMs = 0,
-                                   .dimensionsLen = 1,
-                                   .dimensions = {
-                                                  {
-                                                   .sequenceNum = sequenceNum,
-                                                   .valuesLen = 1}
-                                                  }
-                                   }
-                                  }
-                     }
-                    }
+    sensorDimension sd = {
+        .sequenceNum = sequenceNum,
+        .valuesLen = 1,
     };
-    euca_strncpy(sr.resourceName, instanceId, sizeof(sr.resourceName));
-    sensorMetric *sm = sr.metrics;     // use array entry [0]
-    euca_strncpy(sm->metricName, metricName, sizeof(sm->metricName));
-    sensorCounter *sc = sm->counters;  // use array entry [0]
-    sc->type = counterType;
-    sensorDimension *sd = sc->dimensions;   // use array entry [0]
-    euca_strncpy(sd->dimensionName, dimensionName, sizeof(sd->dimensionName));
-    sensorValue *sv = sd->values;      // use array entry [0]
+    euca_strncpy(sd.dimensionName, dimensionName, sizeof(sd.dimensionName));
+    sensorValue *sv = sd.values;       // use array entry [0]
     sv->timestampMs = timestampMs;
     sv->value = value;
     sv->available = available;
 
-    sensorResource *srs[1] = { &sr };
-
     LOGTRACE("adding sensor value %s:%s:%s:%s %05lld %014lld %s %f\n",
-             sr.resourceName, sm->metricName, sensor_type2str(sc->type), sd->dimensionName, sequenceNum, sv->timestampMs,
-             sv->available ? "YES" : " NO", sv->available ? sv->value : -1);
-    return sensor_merge_records(srs, 1, TRUE);
+             instanceId, metricName, sensor_type2str(counterType), sd.dimensionName, sequenceNum, sv->timestampMs, sv->available ? "YES" : " NO", sv->available ? sv->value : -1);
+
+    int ret = EUCA_ERROR;
+    sem_p(state_sem);
+    sensorResource *cache_sr = find_or_alloc_sr(TRUE, instanceId, "instance", NULL);
+    if (cache_sr == NULL) {
+        LOGWARN("failed to find space in sensor cache for resource %s\n", instanceId);
+        goto bail;
+    }
+
+    sensorMetric *cache_sm = find_or_alloc_sm(TRUE, cache_sr, metricName);
+    if (cache_sm == NULL) {
+        LOGWARN("failed to find space in sensor cache for metric %s:%s\n", instanceId, metricName);
+        goto bail;
+    }
+
+    sensorCounter *cache_sc = find_or_alloc_sc(TRUE, cache_sm, counterType);
+    if (cache_sc == NULL) {
+        LOGWARN("failed to find space in sensor cache for counter %s:%s:%s\n", instanceId, metricName, sensor_type2str(counterType));
+        goto bail;
+    }
+
+    sensorDimension *cache_sd = find_or_alloc_sd(TRUE, cache_sc, sd.dimensionName);
+    if (cache_sd == NULL) {
+        LOGWARN("failed to find space in sensor cache for dimension %s:%s:%s:%s\n", instanceId, metricName, sensor_type2str(counterType), sd.dimensionName);
+        goto bail;
+    }
+
+    if (merge_dimension(instanceId, metricName, counterType, cache_sc, cache_sd, &sd) < 0)
+        goto bail;
+
+    cache_sr->timestamp = time(NULL);
+    ret = EUCA_OK;
+
+bail:
+
+    sem_v(state_sem);
+    return (ret);
 }
 
 //!
@@ -1535,18 +1855,21 @@ int sensor_get_instance_data(const char *instanceId, char **sensorIds, int senso
     for (int r = 0; r < sensor_state->max_resources; r++) {
         sensorResource *sr = sensor_state->resources + r;
 
-        if (is_empty_sr(sr))           // unused slot in cache, skip it
-            continue;
-
-        if ((instanceId != NULL)       // we are looking for a specific instance (rather than all)
-            && (strcmp(sr->resourceName, instanceId) != 0)) // and this is not the one
+        if (instanceId != NULL) {      // we are looking for a specific instance (rather than all), so ask the index
+            sr = index_lookup(instanceId);
+            if ((sr == NULL) || (strcmp(sr->resourceName, instanceId) != 0))    // not in the cache (or only an alias matched)
+                break;
+        } else if (is_empty_sr(sr)) {  // unused slot in cache, skip it
             continue;
+        }
 
         if (sensorIdsLen > 0)          //! @todo implement support for sensorIds[]
             goto bail;
 
-        if (sri >= srLen)              // out of room in output
-            goto bail;                 //! @fixme Log something here?
+        if (sri >= srLen) {            // out of room in output, report what fits (the rest will be picked up next time)
+            LOGDEBUG("more sensor resources than the %d requested, reporting on the first %d\n", srLen, sri);
+            break;
+        }
 
         memcpy(sr_out[sri], sr, sizeof(sensorResource));    //! @todo run through the data, do not just copy
         sri++;
@@ -1646,11 +1969,14 @@ int sensor_set_resource_alias(const char *resourceName, const char *resourceAlia
     if (sr != NULL) {
         if (resourceAlias) {
             if (strcmp(sr->resourceAlias, resourceAlias) != 0) {
+                index_remove(-((sr - sensor_state->resources) + 1));
                 euca_strncpy(sr->resourceAlias, resourceAlias, sizeof(sr->resourceAlias));
+                index_insert(-((sr - sensor_state->resources) + 1));
                 LOGDEBUG("set alias for sensor resource %s to %s\n", resourceName, resourceAlias);
             }
         } else {
             LOGTRACE("clearing alias for resource '%s'\n", resourceName);
+            index_remove(-((sr - sensor_state->resources) + 1));
             sr->resourceAlias[0] = '\0';    // clears the alias
         }
         ret = EUCA_OK;
@@ -1676,7 +2002,7 @@ int sensor_remove_resource(const char *resourceName)
     sem_p(state_sem);
     sensorResource *sr = find_or_alloc_sr(FALSE, resourceName, NULL, NULL);
     if (sr != NULL) {
-        sr->resourceName[0] = '\0';    // marks the slot as empty
+        release_sr(sr);
         ret = EUCA_OK;
     }
     sem_v(state_sem);
@@ -1998,6 +2324,80 @@ next_resource:
     return errors;
 }
 
+//!
+//! Drops the values in a copy of a cached resource that precede a given
+//! sequence number, so that a caller who has seen everything up to that
+//! number receives only what is newer. Values at the sequence number are
+//! kept, since it may have been reported while a collection pass was
+//! still adding them. Must only be used on this process's own readings:
+//! if sinceSequenceNum is ahead of what this process has produced, the
+//! caller saw readings from before a restart and all values are kept.
+//!
+//! @param[in,out] sr a copy of a resource, as returned by sensor_get_instance_data()
+//! @param[in] sinceSequenceNum the sequence number to report from, or a negative number for all values
+//!
+//! @return EUCA_OK on success or EUCA_INVALID_ERROR if the resource is inconsistent
+//!
+int sensor_trim_resource(sensorResource * sr, long long sinceSequenceNum)
+{
+    long long drop = 0;
+
+    if (sensor_validate_resources(&sr, 1) != EUCA_OK)
+        return (EUCA_INVALID_ERROR);
+
+    if ((sinceSequenceNum < 0) || (sinceSequenceNum > seq_num))
+        return (EUCA_OK);
+
+    for (int m = 0; m < sr->metricsLen; m++) {
+        sensorMetric *sm = sr->metrics + m;
+        for (int c = 0; c < sm->countersLen; c++) {
+            sensorCounter *sc = sm->counters + c;
+            for (int d = 0; d < sc->dimensionsLen; d++) {
+                sensorDimension *sd = sc->dimensions + d;
+                if ((drop = sinceSequenceNum - sd->sequenceNum) <= 0)
+                    continue;
+                if (drop > sd->valuesLen)
+                    drop = sd->valuesLen;
+                sd->firstValueIndex = (sd->firstValueIndex + drop) % MAX_SENSOR_VALUES;
+                sd->sequenceNum += drop;
+                sd->valuesLen -= drop;
+            }
+        }
+    }
+    return (EUCA_OK);
+}
+
+//!
+//! Finds the highest sequence number among the values in a set of
+//! resources, e.g., to ask for only newer values next time around
+//!
+//! @param[in] srs array of pointers to resources
+//! @param[in] srsLen number of entries in srs[]
+//!
+//! @return the highest sequence number or -1 if there are no values
+//!
+long long sensor_last_sequence_num(sensorResource ** srs, int srsLen)
+{
+    long long last = -1;
+
+    for (int r = 0; r < srsLen; r++) {
+        if ((srs[r] == NULL) || (sensor_validate_resources(srs + r, 1) != EUCA_OK))
+            continue;
+        for (int m = 0; m < srs[r]->metricsLen; m++) {
+            const sensorMetric *sm = srs[r]->metrics + m;
+            for (int c = 0; c < sm->countersLen; c++) {
+                const sensorCounter *sc = sm->counters + c;
+                for (int d = 0; d < sc->dimensionsLen; d++) {
+                    const sensorDimension *sd = sc->dimensions + d;
+                    if ((sd->valuesLen > 0) && ((sd->sequenceNum + sd->valuesLen - 1) > last))
+                        last = sd->sequenceNum + sd->valuesLen - 1;
+                }
+            }
+        }
+    }
+    return (last);
+}
+
 #ifdef _UNIT_TEST
 //!
 //!
@@ -2085,6 +2485,40 @@ int main(int argc, char **argv)
     init_state(2);                     // clear out sensor state after previous experiments
     assert(0 == sensor_config(3, intervalMs));
 
+    // test the index: lookups by name and by alias, reuse of released slots
+    assert(sensor_add_resource("i-111", "instance", "uuid-111") == EUCA_OK);
+    assert(sensor_add_resource("i-222", "instance", "uuid-222") == EUCA_OK);
+    assert(sensor_add_resource("i-333", "instance", "uuid-333") != EUCA_OK);   // cache is full
+    assert(sensor_get_num_resources() == 2);
+    assert(sensor_set_resource_alias("i-111", "10.0.0.1") == EUCA_OK);
+    assert(find_or_alloc_sr(FALSE, "10.0.0.1", NULL, NULL) == find_or_alloc_sr(FALSE, "i-111", NULL, NULL));
+    assert(sensor_set_resource_alias("i-111", "10.0.0.2") == EUCA_OK);
+    assert(find_or_alloc_sr(FALSE, "10.0.0.1", NULL, NULL) == NULL);
+    assert(find_or_alloc_sr(FALSE, "10.0.0.2", NULL, NULL) != NULL);
+    assert(sensor_remove_resource("i-111") == EUCA_OK);
+    assert(sensor_get_num_resources() == 1);
+    assert(find_or_alloc_sr(FALSE, "i-111", NULL, NULL) == NULL);
+    assert(find_or_alloc_sr(FALSE, "10.0.0.2", NULL, NULL) == NULL);
+    assert(find_or_alloc_sr(FALSE, "i-222", NULL, NULL) != NULL);
+    assert(sensor_add_resource("i-333", "instance", "uuid-333") == EUCA_OK);
+    assert(find_or_alloc_sr(FALSE, "i-333", NULL, NULL) != NULL);
+    index_rebuild();
+    assert(sensor_get_num_resources() == 2);
+    assert(find_or_alloc_sr(FALSE, "i-222", NULL, NULL) != NULL);
+    assert(find_or_alloc_sr(FALSE, "i-333", NULL, NULL) != NULL);
+    init_state(2);
+
+    // test the layout check done when attaching to a shared cache left by another build
+    assert(state_layout_matches(2));
+    assert(!state_layout_matches(3));
+    sensor_state->magic = SENSOR_CACHE_MAGIC - 1;
+    assert(!state_layout_matches(2));
+    sensor_state->magic = SENSOR_CACHE_MAGIC;
+    sensor_state->resource_size = sizeof(sensorResource) + 8;
+    assert(!state_layout_matches(2));
+    init_state(2);
+    assert(state_layout_matches(2));
+
     // test sensor_add_value and sensor_get_value
     double val = 11.0;
     for (int j = 0; j < 50; j++) {
@@ -2185,6 +2619,27 @@ int main(int argc, char **argv)
     assert(0 == sensor_get_instance_data("i-555", NULL, 0, srs, srsLen));   // same
     log_sensor_resources("values read from cache", srs, srsLen);
 
+    {                                  // trim to the newest values only, as the NC does for a CC that has seen the rest
+        long long saved_seq_num = seq_num;
+        long long last = sensor_last_sequence_num(srs, 1);
+        assert(last >= 0);
+        seq_num = last;
+        assert(0 == sensor_trim_resource(srs[0], last + 1));    // a number from before a restart is ignored
+        assert(last == sensor_last_sequence_num(srs, 1));
+        assert(0 == sensor_trim_resource(srs[0], last));
+        assert(last == sensor_last_sequence_num(srs, 1));
+        for (int m = 0; m < srs[0]->metricsLen; m++) {
+            for (int c = 0; c < srs[0]->metrics[m].countersLen; c++) {
+                for (int d = 0; d < srs[0]->metrics[m].counters[c].dimensionsLen; d++) {
+                    sensorDimension *sd = srs[0]->metrics[m].counters[c].dimensions + d;
+                    assert((sd->valuesLen == 0) || (sd->sequenceNum >= last));
+                }
+            }
+        }
+        assert(0 == sensor_validate_resources(srs, 1));
+        seq_num = saved_seq_num;
+    }
+
     for (int i = 0; i < sensor_state->max_resources; i++) {
         EUCA_FREE(srs[i]);
     }
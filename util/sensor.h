@@ -87,7 +87,9 @@
 
 #ifndef _UNIT_TEST
 #define MAX_SENSOR_NAME_LEN                      64
-#define MAX_SENSOR_VALUES                        15 //!< by default 10 on CLC
+#ifndef MAX_SENSOR_VALUES
+#define MAX_SENSOR_VALUES                        15 //!< by default 10 on CLC, may be raised at build time (-DMAX_SENSOR_VALUES=n) for deeper history
+#endif /* ! MAX_SENSOR_VALUES */
 #define MAX_SENSOR_DIMENSIONS                    (5 + EUCA_MAX_VOLUMES) //!< root, ephemeral[0-1], vol-XYZ
 #define MAX_SENSOR_COUNTERS                      2  //!< we only have two types of counters in use (summation|latest) for now
 #define MAX_SENSOR_METRICS                       12 //!< currently 12 are implemented
@@ -104,6 +106,19 @@
 #define MAX_COLLECTION_INTERVAL_MS               86400000L  //!< above 24 hours is too infrequent
 #define MAX_SENSOR_RESOURCES_HARD                10000000L  //!< 10 mil resources max, for sanity checking
 
+//! Number of slots in the hash index of a sensor cache with room for _resources
+//! resources: each resource is indexed by name and by alias, so the index is
+//! never more than half full.
+#define SENSOR_INDEX_SIZE(_resources)            (4 * (_resources))
+
+//! Marks an initialized sensor cache laid out as sensorResourceCache is now: "SEN" and a
+//! version to be bumped whenever that layout changes, since the CC keeps the cache in a
+//! file that outlives upgrades
+#define SENSOR_CACHE_MAGIC                       0x53454e02
+
+//! Size of a sensor cache with room for _resources resources, including its index
+#define SENSOR_CACHE_SIZE(_resources)            (sizeof(sensorResourceCache) + sizeof(sensorResource) * ((_resources) - 1) + sizeof(int) * SENSOR_INDEX_SIZE(_resources))
+
 //! Sensor resources that have not been updated in this multiple of the
 //! upstream polling interval will be expired from the cache.
 #define CACHE_EXPIRY_MULTIPLE_OF_POLLING_INTERVAL 3
@@ -114,6 +129,9 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Opaque set of raw measurements, as produced by a stats collector
+typedef struct getstat_t getstat;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                ENUMERATIONS                                |
@@ -180,6 +198,8 @@ typedef struct {
 
 //! Sensor resource cache structure
 typedef struct {
+    unsigned int magic;                //!< SENSOR_CACHE_MAGIC once initialized, any other value means a different layout
+    unsigned int resource_size;        //!< sizeof(sensorResource) the cache was laid out with (see MAX_SENSOR_VALUES)
     long long collection_interval_time_ms;
     int history_size;
     boolean initialized;
@@ -188,7 +208,8 @@ typedef struct {
     int used_resources;
     time_t last_polled;
     time_t interval_polled;
-    sensorResource resources[1];       //!< if struct should be allocated with extra space after it for additional cache elements
+    int index_size;                    //!< number of slots in the hash index that follows resources[max_resources]
+    sensorResource resources[1];       //!< if struct should be allocated with extra space after it for additional cache elements (see SENSOR_CACHE_SIZE)
 } sensorResourceCache;
 
 /*----------------------------------------------------------------------------*\
@@ -231,6 +252,11 @@ int sensor_set_dimension_alias(const char *resourceName, const char *metricName,
 int sensor_set_volume(const char *instanceId, const char *volumeId, const char *guestDev);
 int sensor_refresh_resources(char resourceNames[][MAX_SENSOR_NAME_LEN], char resourceAliases[][MAX_SENSOR_NAME_LEN], int size);
 int sensor_validate_resources(sensorResource ** srs, int srsLen);
+int sensor_trim_resource(sensorResource * sr, long long sinceSequenceNum);
+long long sensor_last_sequence_num(sensorResource ** srs, int srsLen);
+int sensor_set_collector(int (*collector_function) (getstat *** pstats));
+int sensor_add_stat(getstat *** pstats, const char *resource, long long timestampMs, const char *metricName, int counterType, const char *dimensionName, double value);
+int sensor_parse_stats(char *output, getstat *** pstats);
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
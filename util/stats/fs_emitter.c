@@ -82,13 +82,22 @@
 #include <euca_string.h>
 #include <diskutil.h>
 #include <log.h>
+#include <config.h>
 #include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
 #include <json/json.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <string.h>
+#ifdef _UNIT_TEST
+#include <sys/time.h>
+#endif
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -139,6 +148,17 @@ static struct group *euca_stats_group;
 const static int file_flags = O_CREAT | O_WRONLY;
 static char euca_stats_path[EUCA_MAX_PATH];
 
+//! @{
+//! @name ndjson segment and datagram sink state. Only the stats pass touches them, under its lock.
+static enum emitter_mode emitter_mode = EMITTER_MODE_FILES;
+static int segment_fd = -1;
+static off_t segment_size = 0;
+static off_t segment_max_bytes = EMITTER_SEGMENT_MAX_BYTES;
+static size_t unsynced_bytes = 0;
+static int sink_fd = -1;
+static struct sockaddr_un sink_addr;
+//! @}
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                              STATIC PROTOTYPES                             |
@@ -148,6 +168,11 @@ static const char *get_sensor_name(json_object *event);
 static char *get_temp_output_name(const char *sensor_name);
 static char *get_output_name(const char *sensor_name);
 static int write_event_to_file(json_object *event);
+static int write_event_to_segment(json_object *event);
+static int open_segment();
+static int rotate_segment();
+static int open_sink(const char *sink_path);
+static void send_event_to_sink(json_object *event);
 static char *expand_data_path(const char *path);
 static int set_stats_output_path(const char *euca_home);
 static char *get_stats_output_path();
@@ -159,6 +184,8 @@ static int test_get_sensor_name();
 static int test_get_temp_output_name();
 static int test_get_output_name();
 static int test_write_event_to_file();
+static int test_write_event_to_segment();
+static int test_send_event_to_sink();
 static int test_get_set_stats_path();
 #endif
 
@@ -175,6 +202,9 @@ static int test_get_set_stats_path();
 \*----------------------------------------------------------------------------*/
 
 int init_emitter(const char *euca_home) {
+    char *mode = NULL;
+    char *sink_path = NULL;
+
     //check for proper group
     LOGDEBUG("Initializing fs emitter\n");
     LOGINFO("Verifying %s group is present\n", DATA_OUTPUT_GROUP);
@@ -204,12 +234,31 @@ int init_emitter(const char *euca_home) {
         }
     }
 
-    LOGINFO("FS emitter initialization complete\n");
+    mode = configFileValue(EMITTER_MODE_CONF_PARAM_NAME);
+    if(mode != NULL && strcmp(mode, EMITTER_MODE_NDJSON_NAME) == 0) {
+        emitter_mode = EMITTER_MODE_NDJSON;
+    } else {
+        if(mode != NULL && strcmp(mode, EMITTER_MODE_FILES_NAME) != 0) {
+            LOGWARN("Unknown %s value '%s', using '%s'\n", EMITTER_MODE_CONF_PARAM_NAME, mode, EMITTER_MODE_FILES_NAME);
+        }
+        emitter_mode = EMITTER_MODE_FILES;
+    }
+    EUCA_FREE(mode);
+
+    sink_path = configFileValue(EMITTER_SOCKET_CONF_PARAM_NAME);
+    if(sink_path != NULL && sink_path[0] != '\0' && open_sink(sink_path) != EUCA_OK) {
+        LOGWARN("Cannot send stats events to %s, continuing without the datagram sink\n", sink_path);
+    }
+    EUCA_FREE(sink_path);
+
+    LOGINFO("FS emitter initialization complete (%s output%s)\n", ((emitter_mode == EMITTER_MODE_NDJSON) ? EMITTER_MODE_NDJSON_NAME : EMITTER_MODE_FILES_NAME),
+            ((sink_fd >= 0) ? " and datagram sink" : ""));
     return EUCA_OK;
 }
 
 //!
-//! Synchronously offer an event to the emitter. Emits the event at this time, no batching/queues
+//! Synchronously offer an event to the emitter. Emits the event at this time, no queues. In
+//! ndjson mode the event is written but only made durable by emitter_flush()
 //! 
 //! @param json document to emit
 //! @returns 0 on success, error code != 0 on failure
@@ -217,9 +266,33 @@ int emitter_offer_event(json_object *event) {
     if(event == NULL) {
         return EUCA_ERROR;
     }
+
+    if(sink_fd >= 0) {
+        send_event_to_sink(event);
+    }
+
+    if(emitter_mode == EMITTER_MODE_NDJSON) {
+        return write_event_to_segment(event);
+    }
     return write_event_to_file(event);
 }
 
+//! Syncs whatever was appended to the ndjson segment since the last call. A no-op in files mode,
+//! where every event is its own complete file.
+//! @returns 0 on success, error code != 0 on failure
+int emitter_flush() {
+    if(segment_fd < 0 || unsynced_bytes == 0) {
+        return EUCA_OK;
+    }
+
+    if(fdatasync(segment_fd) != 0) {
+        LOGERROR("Error syncing stats segment: %s\n", strerror(errno));
+        return EUCA_IO_ERROR;
+    }
+    unsynced_bytes = 0;
+    return EUCA_OK;
+}
+
 //! Replace the 'replace' char with the 'find' char in the string. Simple
 static void euca_chrreplace(char *haystack, char target, char replacement) {
     if(haystack == NULL) {
@@ -399,6 +472,158 @@ static int write_event_to_file(json_object *event) {
     }
     return result;
 }
+
+//! Opens (or creates) the current ndjson segment for appending. Ownership and permissions are
+//! only set when the segment is new or not owned by the stats group yet, once per segment rather
+//! than once per event.
+static int open_segment() {
+    int result = EUCA_OK;
+    char *segment_name = NULL;
+    struct stat st;
+
+    if((segment_name = expand_data_path(EMITTER_SEGMENT_NAME)) == NULL) {
+        return EUCA_ERROR;
+    }
+
+    if((segment_fd = open(segment_name, (O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC), OUTPUT_DATA_PERM)) < 0 || fstat(segment_fd, &st) != 0) {
+        LOGERROR("Cannot open stats segment %s: %s\n", segment_name, strerror(errno));
+        result = EUCA_IO_ERROR;
+    } else if((st.st_size == 0 || euca_stats_group == NULL || st.st_gid != euca_stats_group->gr_gid) &&
+              (result = diskutil_ch(segment_name, DATA_OUTPUT_USER, DATA_OUTPUT_GROUP, OUTPUT_DATA_PERM)) != EUCA_OK) {
+        LOGERROR("Error setting ownership info on stats segment %s\n", segment_name);
+    } else {
+        segment_size = st.st_size;
+        unsynced_bytes = 0;
+    }
+
+    if(result != EUCA_OK && segment_fd >= 0) {
+        close(segment_fd);
+        segment_fd = -1;
+    }
+    EUCA_FREE(segment_name);
+    return result;
+}
+
+//! Closes the current segment and shifts it and the older ones down one suffix, dropping the
+//! oldest. Readers following the file by name see it replaced, readers holding it open keep
+//! reading the rotated data.
+static int rotate_segment() {
+    int i = 0;
+    int result = EUCA_OK;
+    char *segment_name = NULL;
+    char older[EUCA_MAX_PATH] = "";
+    char newer[EUCA_MAX_PATH] = "";
+
+    if(segment_fd >= 0) {
+        emitter_flush();
+        close(segment_fd);
+        segment_fd = -1;
+    }
+
+    if((segment_name = expand_data_path(EMITTER_SEGMENT_NAME)) == NULL) {
+        return EUCA_ERROR;
+    }
+
+    for(i = EMITTER_SEGMENTS_KEPT; i > 0; i--) {
+        snprintf(older, sizeof(older), "%s.%d", segment_name, i);
+        if(i > 1) {
+            snprintf(newer, sizeof(newer), "%s.%d", segment_name, (i - 1));
+        } else {
+            euca_strncpy(newer, segment_name, sizeof(newer));
+        }
+
+        if(rename(newer, older) != 0 && errno != ENOENT) {
+            LOGERROR("Could not rotate stats segment %s to %s: %s\n", newer, older, strerror(errno));
+            result = EUCA_IO_ERROR;
+        }
+    }
+
+    EUCA_FREE(segment_name);
+    return result;
+}
+
+//! Appends the event as one line of compact json to the current segment, rotating it first
+//! if the line would take it past its maximum size. A single write keeps the line whole.
+//! Returns 0 on success, error code != 0 otherwise
+static int write_event_to_segment(json_object *event) {
+    ssize_t written = 0;
+    size_t length = 0;
+    struct iovec iov[2];
+    const char *json_string = NULL;
+
+    if(event == NULL) {
+        LOGDEBUG("Cannot emit a null event\n");
+        return EUCA_INVALID_ERROR;
+    }
+
+    if((json_string = json_object_to_json_string_ext(event, JSON_C_TO_STRING_PLAIN)) == NULL) {
+        LOGERROR("Error getting json string for sensor event\n");
+        return EUCA_ERROR;
+    }
+    length = strlen(json_string) + 1;
+
+    if(segment_fd >= 0 && segment_size > 0 && (segment_size + length) > segment_max_bytes) {
+        rotate_segment();
+    }
+
+    if(segment_fd < 0 && open_segment() != EUCA_OK) {
+        return EUCA_IO_ERROR;
+    }
+
+    iov[0].iov_base = (void *)json_string;
+    iov[0].iov_len = length - 1;
+    iov[1].iov_base = "\n";
+    iov[1].iov_len = 1;
+    if((written = writev(segment_fd, iov, 2)) != (ssize_t)length) {
+        LOGERROR("Error appending event to stats segment: %s\n", ((written < 0) ? strerror(errno) : "short write"));
+        //Start over with a fresh file descriptor on the next event
+        close(segment_fd);
+        segment_fd = -1;
+        return EUCA_IO_ERROR;
+    }
+
+    segment_size += written;
+    if((unsynced_bytes += written) >= EMITTER_SYNC_BYTES) {
+        return emitter_flush();
+    }
+    return EUCA_OK;
+}
+
+//! Sets up the datagram socket used to send events to a local collector
+static int open_sink(const char *sink_path) {
+    if(strlen(sink_path) >= sizeof(sink_addr.sun_path)) {
+        LOGERROR("Stats socket path %s is too long\n", sink_path);
+        return EUCA_INVALID_ERROR;
+    }
+
+    if(sink_fd < 0 && (sink_fd = socket(AF_UNIX, (SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC), 0)) < 0) {
+        LOGERROR("Cannot create stats socket: %s\n", strerror(errno));
+        return EUCA_IO_ERROR;
+    }
+
+    bzero(&sink_addr, sizeof(sink_addr));
+    sink_addr.sun_family = AF_UNIX;
+    euca_strncpy(sink_addr.sun_path, sink_path, sizeof(sink_addr.sun_path));
+    return EUCA_OK;
+}
+
+//! Best-effort send of the event to the local collector: the emitter never waits for it, and
+//! events are dropped while no collector is listening or it falls behind
+static void send_event_to_sink(json_object *event) {
+    const char *json_string = json_object_to_json_string_ext(event, JSON_C_TO_STRING_PLAIN);
+
+    if(json_string == NULL) {
+        return;
+    }
+
+    if(sendto(sink_fd, json_string, strlen(json_string), MSG_NOSIGNAL, (struct sockaddr *)&sink_addr, sizeof(sink_addr)) < 0) {
+        if(errno == EMSGSIZE) {
+            LOGWARN("Stats event of %lu bytes is too large for socket %s\n", (unsigned long)strlen(json_string), sink_addr.sun_path);
+        } else {
+            LOGTRACE("Dropped stats event for socket %s: %s\n", sink_addr.sun_path, strerror(errno));
+        }
+    }
+}
     
 #ifdef _UNIT_TEST
 static int test_get_set_stats_path() {
@@ -534,8 +759,108 @@ static int test_write_event_to_file() {
     }
 }
 
-static int test_write_event_to_file_highload() {    
-    LOGINFO("\n-------------Testing write_event_to_file with high load----------------\n");
+static int test_write_event_to_segment() {
+    LOGINFO("\n-------------Testing write_event_to_segment----------------\n");
+    int i = 0;
+    int lines = 0;
+    int result = EUCA_OK;
+    int c = 0;
+    char *segment_name = expand_data_path(EMITTER_SEGMENT_NAME);
+    char rotated[EUCA_MAX_PATH] = "";
+    struct stat st;
+    FILE *fp = NULL;
+    json_object *test_event = json_tokener_parse("{\"sensor\":\"mysensor.name\",\"test\":\"value\", \"timestamp\": 123456 }");
+
+    if(test_event == NULL || segment_name == NULL) {
+        LOGERROR("Got null json or segment name\n");
+        return EUCA_ERROR;
+    }
+
+    //Start from scratch with segments small enough to rotate a few times
+    for(i = 0; i <= EMITTER_SEGMENTS_KEPT; i++) {
+        snprintf(rotated, sizeof(rotated), ((i == 0) ? "%s" : "%s.%d"), segment_name, i);
+        unlink(rotated);
+    }
+    segment_max_bytes = 1024;
+    for(i = 0; i < 200 && result == EUCA_OK; i++) {
+        result = write_event_to_segment(test_event);
+    }
+    if(result != EUCA_OK || emitter_flush() != EUCA_OK) {
+        LOGERROR("Failed appending to the segment: %d\n", result);
+        return EUCA_ERROR;
+    }
+
+    //Every event is one line and no segment outgrew its limit
+    for(i = 0; i <= EMITTER_SEGMENTS_KEPT; i++) {
+        snprintf(rotated, sizeof(rotated), ((i == 0) ? "%s" : "%s.%d"), segment_name, i);
+        if(stat(rotated, &st) != 0 || st.st_size > segment_max_bytes || (fp = fopen(rotated, "r")) == NULL) {
+            LOGERROR("Missing or oversized segment %s\n", rotated);
+            return EUCA_ERROR;
+        }
+        while((c = fgetc(fp)) != EOF) {
+            lines += (c == '\n');
+        }
+        fclose(fp);
+    }
+    LOGINFO("Found %d events in %d segments\n", lines, EMITTER_SEGMENTS_KEPT + 1);
+    segment_max_bytes = EMITTER_SEGMENT_MAX_BYTES;
+    json_object_put(test_event);
+    EUCA_FREE(segment_name);
+
+    //The oldest segments were dropped
+    if(lines == 0 || lines >= 200) {
+        LOGERROR("Unexpected number of events found: %d\n", lines);
+        return EUCA_ERROR;
+    }
+    return EUCA_OK;
+}
+
+static int test_send_event_to_sink() {
+    LOGINFO("\n-------------Testing send_event_to_sink----------------\n");
+    int collector = -1;
+    ssize_t received = 0;
+    char buf[MAX_JSON_LENGTH_TEST] = "";
+    char collector_path[EUCA_MAX_PATH] = "";
+    struct sockaddr_un addr;
+    json_object *test_event = json_tokener_parse("{\"sensor\":\"mysensor.name\",\"test\":\"value\", \"timestamp\": 123456 }");
+
+    snprintf(collector_path, sizeof(collector_path), "/tmp/euca-stats-test-%d.sock", getpid());
+    bzero(&addr, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    euca_strncpy(addr.sun_path, collector_path, sizeof(addr.sun_path));
+
+    //Nobody listening yet: the event is dropped without an error
+    if(test_event == NULL || open_sink(collector_path) != EUCA_OK) {
+        LOGERROR("Cannot set up the sink\n");
+        return EUCA_ERROR;
+    }
+    send_event_to_sink(test_event);
+
+    if((collector = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 || bind(collector, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        LOGERROR("Cannot set up the collector: %s\n", strerror(errno));
+        return EUCA_ERROR;
+    }
+    send_event_to_sink(test_event);
+    received = recv(collector, buf, (sizeof(buf) - 1), MSG_DONTWAIT);
+
+    close(collector);
+    unlink(collector_path);
+    close(sink_fd);
+    sink_fd = -1;
+
+    if(received <= 0 || strcmp(buf, json_object_to_json_string_ext(test_event, JSON_C_TO_STRING_PLAIN)) != 0) {
+        LOGERROR("Collector got '%s'\n", buf);
+        json_object_put(test_event);
+        return EUCA_ERROR;
+    }
+    LOGINFO("Collector got %s\n", buf);
+    json_object_put(test_event);
+    return EUCA_OK;
+}
+
+//! Emits the same few events over and over, as a full sensor pass would, and reports the rate
+static int test_write_event_to_file_highload(enum emitter_mode mode) {    
+    LOGINFO("\n-------------Testing write_event_to_file with high load (%s)----------------\n", ((mode == EMITTER_MODE_NDJSON) ? EMITTER_MODE_NDJSON_NAME : EMITTER_MODE_FILES_NAME));
     char test_json0[MAX_JSON_LENGTH_TEST];
     char test_json1[MAX_JSON_LENGTH_TEST];
     char test_json2[MAX_JSON_LENGTH_TEST];
@@ -560,18 +885,36 @@ static int test_write_event_to_file_highload() {
     int result = 0;
     int successes = 0;
     int failures = 0;
+    long usec = 0;
+    struct timeval start, end;
+    enum emitter_mode saved_mode = emitter_mode;
+
+    emitter_mode = mode;
+    gettimeofday(&start, NULL);
     for(i = 0; i < set_count ; i++) {
         for(j = 0 ; j < count_per_event ; j++) {
-            result = write_event_to_file(test_event0);
+            result = emitter_offer_event(test_event0);
             result == EUCA_OK ? successes++ : failures++;
 
-            result = write_event_to_file(test_event1);
+            result = emitter_offer_event(test_event1);
             result == EUCA_OK ? successes++ : failures++;
 
-            result = write_event_to_file(test_event2);
+            result = emitter_offer_event(test_event2);
             result == EUCA_OK ? successes++ : failures++;
         }
+        //One sensor pass
+        emitter_flush();
     }
+    gettimeofday(&end, NULL);
+    emitter_mode = saved_mode;
+
+    usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+    LOGINFO("%d events in %ld usec: %.1f usec per event, %.0f events per second (%d failures)\n", successes + failures, usec,
+            ((double)usec / (successes + failures)), ((successes + failures) * 1000000.0 / ((usec > 0) ? usec : 1)), failures);
+
+    json_object_put(test_event0);
+    json_object_put(test_event1);
+    json_object_put(test_event2);
     if(failures > 0 ) {
         return failures;
     } else {
@@ -611,10 +954,19 @@ int main(int argc, char** argv) {
     ++test_count && (test_write_event_to_file() == EUCA_OK) ? success_count++ : failure_count++;    
     LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
 
-    //Test performance and lots of data
-    //++test_count && (test_write_event_to_file_highload() == EUCA_OK) ? success_count++ : failure_count++;    
+    ++test_count && (test_write_event_to_segment() == EUCA_OK) ? success_count++ : failure_count++;
     LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
 
+    ++test_count && (test_send_event_to_sink() == EUCA_OK) ? success_count++ : failure_count++;
+    LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
+
+    //Test performance and lots of data: 'test_fs_emitter highload' compares the output modes
+    if(argc > 1 && strcmp(argv[1], "highload") == 0) {
+        ++test_count && (test_write_event_to_file_highload(EMITTER_MODE_FILES) == EUCA_OK) ? success_count++ : failure_count++;
+        ++test_count && (test_write_event_to_file_highload(EMITTER_MODE_NDJSON) == EUCA_OK) ? success_count++ : failure_count++;
+        LOGINFO("Unit tests completed: %d total, %d success, %d failures\n", test_count, success_count, failure_count);
+    }
+
     return 0;
 }
 
@@ -100,6 +100,24 @@
 #define DATA_DIR_PERM 0755
 #define OUTPUT_DATA_PERM 0640
 
+//! How events are written out, set in eucalyptus.conf: "files" for one file per sensor
+//! replaced on each event, "ndjson" for one line per event appended to a rotating segment
+#define EMITTER_MODE_CONF_PARAM_NAME "STATS_EMITTER_MODE"
+#define EMITTER_MODE_CONF_PARAM_DEFAULT "files"
+#define EMITTER_MODE_FILES_NAME "files"
+#define EMITTER_MODE_NDJSON_NAME "ndjson"
+
+//! Path of a unix datagram socket to also send each event to, for local collectors. Empty to disable.
+#define EMITTER_SOCKET_CONF_PARAM_NAME "STATS_EMITTER_SOCKET"
+#define EMITTER_SOCKET_CONF_PARAM_DEFAULT ""
+
+//! The current ndjson segment, relative to the stats directory. Older ones get a numeric suffix.
+//! Cannot conflict with sensor data files because '.' is not valid in a sensor name after conversion
+#define EMITTER_SEGMENT_NAME "events.ndjson"
+#define EMITTER_SEGMENT_MAX_BYTES (16 * 1024 * 1024) //!< rotate the segment once it reaches this size
+#define EMITTER_SEGMENTS_KEPT 4 //!< number of rotated segments kept besides the current one
+#define EMITTER_SYNC_BYTES (1024 * 1024) //!< sync the segment before this much unsynced data accumulates
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -112,6 +130,12 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Output formats of the emitter
+enum emitter_mode {
+    EMITTER_MODE_FILES = 0,            //!< one pretty-printed file per sensor, atomically replaced
+    EMITTER_MODE_NDJSON,               //!< compact events appended to a rotating segment
+};
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                 STRUCTURES                                 |
@@ -133,6 +157,9 @@
 int init_emitter();
 int emitter_offer_event(json_object *event);
 
+//! Make the events offered so far durable. Called at the end of each sensor pass.
+int emitter_flush();
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                           STATIC INLINE PROTOTYPES                         |
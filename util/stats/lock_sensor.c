@@ -0,0 +1,323 @@
+// -*- mode: C; c-basic-offset: 4; tab-width: 4; indent-tabs-mode: nil -*-
+// vim: set softtabstop=4 shiftwidth=4 tabstop=4 expandtab:
+
+/*************************************************************************
+ * Copyright 2009-2012 Eucalyptus Systems, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/.
+ *
+ * Please contact Eucalyptus Systems, Inc., 6755 Hollister Ave., Goleta
+ * CA 93117, USA or visit http://www.eucalyptus.com/licenses/ if you need
+ * additional information or have any questions.
+ *
+ * This file may incorporate work covered under the following copyright
+ * and permission notice:
+ *
+ *   Software License Agreement (BSD License)
+ *
+ *   Copyright (c) 2008, Regents of the University of California
+ *   All rights reserved.
+ *
+ *   Redistribution and use of this software in source and binary forms,
+ *   with or without modification, are permitted provided that the
+ *   following conditions are met:
+ *
+ *     Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *
+ *     Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer
+ *     in the documentation and/or other materials provided with the
+ *     distribution.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ *   FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ *   COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ *   INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ *   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *   LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ *   CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *   LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ *   ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *   POSSIBILITY OF SUCH DAMAGE. USERS OF THIS SOFTWARE ACKNOWLEDGE
+ *   THE POSSIBLE PRESENCE OF OTHER OPEN SOURCE LICENSED MATERIAL,
+ *   COPYRIGHTED MATERIAL OR PATENTED MATERIAL IN THIS SOFTWARE,
+ *   AND IF ANY SUCH MATERIAL IS DISCOVERED THE PARTY DISCOVERING
+ *   IT MAY INFORM DR. RICH WOLSKI AT THE UNIVERSITY OF CALIFORNIA,
+ *   SANTA BARBARA WHO WILL THEN ASCERTAIN THE MOST APPROPRIATE REMEDY,
+ *   WHICH IN THE REGENTS' DISCRETION MAY INCLUDE, WITHOUT LIMITATION,
+ *   REPLACEMENT OF THE CODE SO IDENTIFIED, LICENSING OF THE CODE SO
+ *   IDENTIFIED, OR WITHDRAWAL OF THE CODE CAPABILITY TO THE EXTENT
+ *   NEEDED TO COMPLY WITH ANY SUCH LICENSES OR RIGHTS.
+ ************************************************************************/
+
+//!
+//! @file util/stats/lock_sensor.c
+//! Implementation of the lock sensor. Reads the lock contention statistics of the
+//! component through its collector and creates the sensor output
+//!
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  INCLUDES                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+#include "lock_sensor.h"
+#include "sensor_common.h"
+#include "euca_string.h"
+#include <string.h>
+#include "log.h"
+#include "ipc.h"
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  DEFINES                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                  TYPEDEFS                                  |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                ENUMERATIONS                                |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                 STRUCTURES                                 |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                             EXTERNAL VARIABLES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+/* Should preferably be handled in header file */
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              GLOBAL VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC VARIABLES                              |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+static json_object *default_tags;
+static int sensor_data_ttl;
+static lock_stats_collector collect_lock_stats; //Reads the component's lock stats, which may be in shared memory updated by other processes
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                              STATIC PROTOTYPES                             |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+//! Collects the lock stats and prepares them for the emitter in json format
+static json_object *lock_stats_sensor_call();
+
+#ifdef _UNIT_TEST
+static int test_lock_stats_sensor_call();
+#endif
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                                   MACROS                                   |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+/*----------------------------------------------------------------------------*\
+ |                                                                            |
+ |                               IMPLEMENTATION                               |
+ |                                                                            |
+\*----------------------------------------------------------------------------*/
+
+//! Builds the json map of lock name to statistics. Locks that were not acquired
+//! during the interval are skipped unless somebody is holding them, since a lock
+//! held across the whole interval is exactly what a convoy looks like.
+json_object *get_lock_stats_json(ipc_lock_stats *stats, int count)
+{
+    json_object *locks_json = NULL;
+    json_object *lock_json = NULL;
+    int i = 0;
+
+    if(stats == NULL || count < 0) {
+        return NULL;
+    }
+
+    locks_json = json_object_new_object();
+    for(i = 0; i < count; i++) {
+        if(stats[i].acquisitions == 0 && stats[i].holder == 0) {
+            continue;
+        }
+
+        lock_json = json_object_new_object();
+        json_object_object_add(lock_json, LOCK_ACQUISITIONS_KEY, json_object_new_int64(stats[i].acquisitions));
+        json_object_object_add(lock_json, LOCK_CONTENDED_KEY, json_object_new_int64(stats[i].contended));
+        json_object_object_add(lock_json, LOCK_WAIT_TOTAL_KEY, json_object_new_int64(stats[i].wait_ns_total / 1000));
+        json_object_object_add(lock_json, LOCK_WAIT_MAX_KEY, json_object_new_int64(stats[i].wait_ns_max / 1000));
+        json_object_object_add(lock_json, LOCK_HOLDER_KEY, json_object_new_int(stats[i].holder));
+        json_object_object_add(locks_json, stats[i].name, lock_json);
+    }
+    return locks_json;
+}
+
+//! Entry point for the lock stats sensor. Reads and resets the lock stats
+//! and builds the sensor output from them.
+static json_object *lock_stats_sensor_call()
+{
+    ipc_lock_stats stats[LOCK_STATS_MAX_LOCKS];
+    json_object *lock_data;
+    json_object *event_json;
+    int count = 0;
+
+    if(collect_lock_stats == NULL) {
+        LOGERROR("Cannot complete lock stats sensor operation, no stats collector available\n");
+        return NULL;
+    }
+
+    //Reads and resets the counters in one pass, acquisitions made meanwhile go to the next interval
+    LOGTRACE("Collecting and resetting lock stats\n");
+    count = collect_lock_stats(stats, LOCK_STATS_MAX_LOCKS, TRUE);
+    lock_data = get_lock_stats_json(stats, count);
+    if(lock_data == NULL) {
+        LOGTRACE("Cannot output results because no result found\n");
+        return NULL;
+    }
+
+    event_json = build_sensor_output(lock_sensor.sensor_name, LOCK_STATS_SENSOR_DESCRIPTION, time(NULL), sensor_data_ttl, default_tags, lock_data);
+    json_object_put(lock_data);
+
+    if(event_json == NULL) {
+        LOGERROR("Failed in lock stats output generation.\n");
+        return NULL;
+    }
+
+    return event_json;
+}
+
+//! Idempotently initialize the lock sensor structures. Not threadsafe.
+//! The collector reads the lock stats of the component: for the CC they live in memory
+//! shared by all its processes, while for the NC they are the semaphores of the process
+int initialize_lock_sensor(const char *current_component_name, int interval, int ttl, lock_stats_collector collector)
+{
+    LOGINFO("Initializing internal lock sensor for component %s\n", current_component_name);
+    if(current_component_name == NULL ||
+       interval < 1 ||
+       ttl < 0 ||
+       collector == NULL) {
+        LOGERROR("Invalid lock sensor initialization values. Cannot initialize\n");
+        return EUCA_INVALID_ERROR;
+    }
+
+    collect_lock_stats = collector;
+    euca_strncpy(lock_sensor.config_name, LOCK_STATS_SENSOR_CONFIG_NAME, SENSOR_NAME_MAX);
+    snprintf(lock_sensor.sensor_name, SENSOR_NAME_MAX, LOCK_STATS_SENSOR_NAME_FORMAT, current_component_name);
+    lock_sensor.enabled = 0;
+    lock_sensor.sensor_function = lock_stats_sensor_call;
+    lock_sensor.state_toggle_callback = NULL;
+
+    char interval_tag[SENSOR_NAME_MAX];
+    snprintf(interval_tag, SENSOR_NAME_MAX, SENSOR_INTERVAL_PERIOD_TAG_FORMAT, interval);
+    default_tags = build_tag_set(1, interval_tag);
+    sensor_data_ttl = ttl;
+    return EUCA_OK;
+}
+
+int teardown_lock_sensor() {
+    ipc_lock_stats stats[LOCK_STATS_MAX_LOCKS];
+
+    if(collect_lock_stats != NULL) {
+        collect_lock_stats(stats, LOCK_STATS_MAX_LOCKS, TRUE);
+    } else {
+        LOGDEBUG("No lock stats collector defined, cannot reset stats during teardown\n");
+    }
+    return EUCA_OK;
+}
+
+#ifdef _UNIT_TEST
+static int test_lock_stats_sensor_call() {
+    LOGINFO("\nRunning test %s\n", __func__);
+    json_object *output_map = NULL;
+    sem *held_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    sem *idle_sem = sem_alloc(1, IPC_MUTEX_SEMAPHORE);
+    int i = 0;
+    int ret = 0;
+
+    sem_set_stats_name(held_sem, "held_sem");
+    sem_set_stats_name(idle_sem, "idle_sem");
+    initialize_lock_sensor("testservice", 60, 30, sem_get_lock_stats);
+
+    for(i = 0; i < 10; i++) {
+        sem_p(held_sem);
+        sem_v(held_sem);
+    }
+    sem_p(held_sem);
+
+    output_map = lock_stats_sensor_call();
+    if(output_map == NULL) {
+        return 1;
+    }
+    LOGINFO("Result map: %s\n", json_object_to_json_string_ext(output_map, JSON_C_TO_STRING_PRETTY));
+
+    const char *output = json_object_to_json_string(output_map);
+    if(strstr(output, "held_sem") == NULL || strstr(output, "idle_sem") != NULL) {
+        LOGERROR("Expected held_sem and not idle_sem in the output\n");
+        ret = 1;
+    }
+
+    //The collected counters were reset, only the holder is left
+    ipc_lock_stats stats[LOCK_STATS_MAX_LOCKS];
+    int count = sem_get_lock_stats(stats, LOCK_STATS_MAX_LOCKS, FALSE);
+    for(i = 0; i < count; i++) {
+        if(!strcmp(stats[i].name, "held_sem") && (stats[i].acquisitions != 0 || stats[i].holder == 0)) {
+            LOGERROR("Unexpected held_sem stats after collection\n");
+            ret = 1;
+        }
+    }
+
+    json_object_put(output_map);
+    sem_v(held_sem);
+    SEM_FREE(held_sem);
+    SEM_FREE(idle_sem);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    int count, success, failure;
+    count = 0;
+    success = 0;
+    failure = 0;
+
+    if(test_lock_stats_sensor_call() == 0) {
+        LOGINFO("Success!\n");
+        success++;
+    } else {
+        LOGINFO("Failed\n");
+        failure++;
+    }
+    count++;
+
+    LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
+    return 0;
+}
+#endif
@@ -127,11 +127,10 @@
 static json_object *default_tags;
 static int sensor_data_ttl;
 static char component_name[EUCA_MAX_PATH];
-static json_object **(*message_stats_get_fn)(); //Pointer to function to get the stats
-static void (*message_stats_set_fn)(); //Pointer to function to set the stats. Called after the sensor runs to update the stats to the reset values
+static message_stats_table *message_stats; //The stats table, may be shared memory updated by other processes
 
 #ifdef _UNIT_TEST
-static json_object *test_stats_state;
+static message_stats_table test_stats_state;
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -146,8 +145,6 @@ static void toggle_stats(int enabled);
 
 #ifdef _UNIT_TEST
 static int test_msg_stats_sensor_call();
-static json_object **get_stats_state();
-static void set_stats_state();
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -167,94 +164,75 @@ static void set_stats_state();
 //! the message maps and sends it to the emitter.
 //! The arg is a string for the service name to use in output.
 static json_object *msg_stats_sensor_call() {
-    json_object **msg_data;
+    json_object *msg_data;
     json_object *event_json;
-    if(message_stats_get_fn == NULL) {
+    if(message_stats == NULL) {
         LOGERROR("Cannot complete message stats sensor operation, no stats found available\n");
         return NULL;
     }
     
-    msg_data = message_stats_get_fn();    
-    if(msg_data == NULL || *msg_data == NULL) {
+    //Reads and resets the counters in one pass, updates made meanwhile go to the next interval
+    LOGTRACE("Collecting and resetting message stats\n");
+    msg_data = get_message_stats_json(message_stats, TRUE);
+    if(msg_data == NULL) {
         LOGTRACE("Cannot output results because no result found\n");
         //Make an empty one for clean output, but no values
         return NULL;
     }
 
-    event_json = build_sensor_output(message_sensor.sensor_name, MESSAGE_STATS_SENSOR_DESCRIPTION, time(NULL), sensor_data_ttl, default_tags, *msg_data);
+    event_json = build_sensor_output(message_sensor.sensor_name, MESSAGE_STATS_SENSOR_DESCRIPTION, time(NULL), sensor_data_ttl, default_tags, msg_data);
+    json_object_put(msg_data);
     
     if(event_json == NULL) {
         LOGERROR("Failed in message stats output generation.\n");
         return NULL;
     }
     
-    LOGTRACE("Resetting message stats\n");
-    reset_message_stats(msg_data);
-    
-    //Update the stats memory
-    message_stats_set_fn();
-    
     return event_json;
 }
 
 //! Enable/Disable stats collection in coordination with the sensor itself
 static void toggle_stats(int enabled)
 {
-    json_object **stats_data = message_stats_get_fn();
-    if(stats_data == NULL || *stats_data == NULL) {
+    if(message_stats == NULL) {
         LOGWARN("Cannot toggle message stats enabled/disabled status, null found\n");
         return;
     }
 
     if(enabled) {
         LOGTRACE("Setting message stats enabled\n");
-        enable_stats(*stats_data);
+        enable_stats(message_stats);
     } else {
         LOGTRACE("Setting message stats disabled\n");
-        disable_stats(*stats_data);
+        disable_stats(message_stats);
     }
-
-    LOGTRACE("Setting changes in the cache\n");
-    message_stats_set_fn();
     return;
 }
 
 //! Idempotently initialize the message sensor structures. Not threadsafe.
-//! The function pointer is a supplier for the json state of the message stats system at run-time
-//! This is for CC & NC memory models. For CC, this can be the cache copy and lock, while for NC it is just a ref return
-int initialize_message_sensor(const char *current_component_name, int interval, int ttl, json_object **(*stats_state_get_fn)(), void (*stats_state_set_fn)())
+//! The table holds the message stats at run-time. This is for CC & NC memory models: for the CC it
+//! lives in memory shared by all its processes, while for the NC it is just process memory
+int initialize_message_sensor(const char *current_component_name, int interval, int ttl, message_stats_table *stats_table)
 {   
-    json_object **stats_state = NULL;
     int ret = 0;
     LOGINFO("Initializing internal message sensor for component %s\n", current_component_name);
     if(current_component_name == NULL ||
        interval < 1 ||
        ttl < 0 ||
-       stats_state_get_fn == NULL ||
-       stats_state_set_fn == NULL) {
+       stats_table == NULL) {
         LOGERROR("Invalid message sensor initialization values. Cannot initialize\n");
         return EUCA_INVALID_ERROR;
     }
     
-    message_stats_get_fn = stats_state_get_fn;
-    message_stats_set_fn = stats_state_set_fn;    
+    message_stats = stats_table;
 
-    stats_state = message_stats_get_fn();
-    if(stats_state == NULL) {
-        LOGERROR("Cannot initialize internal message stats structures due to null pointer\n");
-        return EUCA_INVALID_ERROR;
-    }
-
-    ret = initialize_message_stats(stats_state);
+    ret = initialize_message_stats(message_stats);
     if(ret != EUCA_OK) {
         LOGERROR("Error intializing internal message stats structure: %d\n", ret);
         return ret;
     } else {
-        const char *tmp_json = json_object_to_json_string(*stats_state);
-        LOGDEBUG("Initialized message stats structure: %s\n", tmp_json);
+        LOGDEBUG("Initialized message stats structure (%lu bytes)\n", (unsigned long)sizeof(message_stats_table));
     }
-
-    message_stats_set_fn();
     
     euca_strncpy(component_name, current_component_name, EUCA_MAX_PATH);
     euca_strncpy(message_sensor.config_name, MESSAGE_STATS_SENSOR_CONFIG_NAME, SENSOR_NAME_MAX);
@@ -271,43 +249,24 @@ int initialize_message_sensor(const char *current_component_name, int interval,
 }
 
 int teardown_message_sensor() {
-    //Allow the map to be freed
-    if(message_stats_get_fn != NULL) {
-        json_object **stats_json = message_stats_get_fn();
-        reset_message_stats(stats_json);
+    if(message_stats != NULL) {
+        reset_message_stats(message_stats);
     } else {
-        LOGDEBUG("No stats get function defined, cannot reset stats during teardown\n");
-    }
-
-    if(message_stats_set_fn != NULL) {
-        message_stats_set_fn();
-    } else {
-        LOGDEBUG("No stats set function defined, cannot reset stats during teardown\n");
+        LOGDEBUG("No stats table defined, cannot reset stats during teardown\n");
     }
     return EUCA_OK;
 }
 
 #ifdef _UNIT_TEST
-static json_object **get_stats_state() 
-{
-    return &test_stats_state;
-}
-
-static void set_stats_state()
-{
-    //No op
-    return;
-}
-
 static int test_msg_stats_sensor_call() {
     LOGINFO("\nRunning test %s\n", __func__);
     int test_interval, test_ttl;
     test_interval = 60;
     test_ttl = 30;
-    initialize_message_sensor("testservice", test_interval, test_ttl, get_stats_state, set_stats_state);
-    update_message_stats(test_stats_state, "runInstance", 55, 0);
-    update_message_stats(test_stats_state, "terminateInstance", 15, 0);
-    update_message_stats(test_stats_state, "describeInstances", 15, 0);
+    initialize_message_sensor("testservice", test_interval, test_ttl, &test_stats_state);
+    update_message_stats(&test_stats_state, "runInstance", 55, 0);
+    update_message_stats(&test_stats_state, "terminateInstance", 15, 0);
+    update_message_stats(&test_stats_state, "describeInstances", 15, 0);
     
     json_object *output_map = msg_stats_sensor_call();
     if(output_map == NULL) {
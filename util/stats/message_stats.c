@@ -77,10 +77,15 @@
 #include "message_stats.h"
 #include <eucalyptus.h>
 #include <string.h>
+#include <sched.h>
 #include <log.h>
-#include <ipc.h>
+#include <euca_string.h>
 #include <json/json.h>
 #include <math.h>
+#ifdef _UNIT_TEST
+#include <pthread.h>
+#include <sys/time.h>
+#endif
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -88,6 +93,16 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+#define ENTRY_FREE                               0  //!< entry state: unused
+#define ENTRY_CLAIMED                            1  //!< entry state: its name is being written
+#define ENTRY_READY                              2  //!< entry state: in use
+#define ENTRY_CLAIM_SPINS                     1000  //!< give up on an entry whose name never shows up (its writer died)
+
+#ifdef _UNIT_TEST
+#define TEST_THREADS                             4
+#define TEST_UPDATES_PER_THREAD             250000
+#endif
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                                  TYPEDEFS                                  |
@@ -127,28 +142,23 @@
 \*----------------------------------------------------------------------------*/
 
 /*
-Stats map is json mapping. Each message is named and has an associated nested map containing the
-useful stats. The stats tracked are: count, success_count, failed_count, mean, min, max all in milliseconds of duration. 
-Example:
+The stats table is a fixed array of per-message entries located by hashing the message name. The
+stats tracked are: count, success_count, failure_count, mean, min, max and the p50/p99/p999
+latencies, all in milliseconds of duration. The json is only built when the sensor asks for it:
 {
-  "describeResources": { "min": 10, "max"; 20, "mean":12.3},
-  "describeSensors": { "min": 10, "max"; 40, "mean":24.3},
-  "runInstance": { "min": 15, "max"; 20, "mean":33.3},
-  "attachVolume": { "min": 35, "max"; 100, "mean":76.3}
+  "describeResources": { "count": 3, "success_count": 3, "failure_count": 0, "min": 10, "max": 20, "mean": 12.3, "p50": 11, "p99": 20, "p999": 20 },
+  "runInstance": { "count": 1, "success_count": 1, "failure_count": 0, "min": 15, "max": 15, "mean": 15.0, "p50": 15, "p99": 15, "p999": 15 }
 }
 */
 
 /*
-Uses a map as input to the update and fetch systems. This is entirely due to
-the memory model of the CC and how it must share memory between processes.
-
-The stats system assumes that the actual stats state is shared memory managed
-externally (or not, as in the case of the NC), and is provided directly to these
-methods as a json string.
+The table holds no pointers and is only updated with atomic operations. This is entirely due to
+the memory model of the CC: its processes map the same table from a shared file and update it
+concurrently without a lock. The NC keeps its table in memory and its threads do the same.
  */
 
 #ifdef _UNIT_TEST
-json_object *message_stats_map;
+static message_stats_table message_stats_map;
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -156,18 +166,21 @@ json_object *message_stats_map;
  |                              STATIC PROTOTYPES                             |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
-static double calculate_moving_mean(double current_mean, int current_count, long new_value);
+static unsigned int message_name_hash(const char *message_name);
 
-//! Constructs a new json object for the message statistics, but not for any specific message, no name used
-static json_object *initialize_new_message_map();
+//! Finds the entry of the given message, adding it if needed
+static message_stats_entry *find_message_entry(message_stats_table *stats_state, const char *message_name);
 
-//! Zero the stats for a single message entry.
-static void reset_message_stat(json_object *msg_entry);
+//! Maps a timing to its histogram bucket and a bucket to the highest timing it holds
+static int histogram_bucket(long timing_ms);
+static long histogram_value(int bucket);
+static long histogram_percentile(const uint64_t *buckets, uint64_t total, double fraction, long max_ms);
 
 #ifdef _UNIT_TEST
-static int test_moving_average();
-static int test_init_message_map();
+static int test_histogram();
 static int test_update_message_stats();
+static int test_get_message_stats_json();
+static int test_concurrent_updates();
 #endif
 
 /*----------------------------------------------------------------------------*\
@@ -176,360 +189,472 @@ static int test_update_message_stats();
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Reads a counter, zeroing it in the same atomic step when resetting
+#define TAKE_COUNTER(_ptr, _reset, _init) ((_reset) ? __atomic_exchange_n((_ptr), (_init), __ATOMIC_RELAXED) : __atomic_load_n((_ptr), __ATOMIC_RELAXED))
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                               IMPLEMENTATION                               |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
-//! Calculate a cumulative moving averaged using the standard method
-static double calculate_moving_mean(double current_mean, int current_count, long new_value) {
-    return current_mean + ( ((double)new_value - current_mean ) / (current_count + 1) );
+//! djb2 string hash of the message name
+static unsigned int message_name_hash(const char *message_name) {
+    unsigned int hash = 5381;
+    const unsigned char *p = (const unsigned char *)message_name;
+
+    while (*p != '\0') {
+        hash = ((hash << 5) + hash) + *p++;
+    }
+    return hash;
 }
 
-//! Returns a new message map for the named message type
-//! If cached_map != NULL, reads in that value and initializes the structure with that state.
-//! This is necessary for the CC's memory model.
-static json_object *initialize_new_message_map() {
-    json_object *default_fields = json_object_new_object();
-    json_object_object_add(default_fields, MSG_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_OK_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_FAIL_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(default_fields, MSG_MEAN_KEY, json_object_new_double(MSG_MEAN_INIT));
-    json_object_object_add(default_fields, MSG_MIN_KEY, json_object_new_int(MSG_MIN_INIT)); //Use -1 since it is invalid measure
-    json_object_object_add(default_fields, MSG_MAX_KEY, json_object_new_int(MSG_MAX_INIT));
-    return default_fields;
+//! Looks the message up by probing from its hash. A free entry found on the way is claimed
+//! with a compare-and-swap so two processes adding the same new message end up sharing one entry.
+//! @returns the entry or NULL if the table is full
+static message_stats_entry *find_message_entry(message_stats_table *stats_state, const char *message_name) {
+    int i = 0;
+    int spins = 0;
+    uint32_t state = ENTRY_FREE;
+    unsigned int hash = message_name_hash(message_name);
+    message_stats_entry *entry = NULL;
+
+    for (i = 0; i < MSG_STATS_MAX_TYPES; i++) {
+        entry = &stats_state->entries[(hash + i) % MSG_STATS_MAX_TYPES];
+        state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+
+        if (state == ENTRY_FREE) {
+            if (__atomic_compare_exchange_n(&entry->state, &state, ENTRY_CLAIMED, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                euca_strncpy(entry->name, message_name, MSG_STATS_NAME_LEN);
+                entry->min_ms = MSG_MIN_INIT;
+                entry->max_ms = MSG_MAX_INIT;
+                __atomic_store_n(&entry->state, ENTRY_READY, __ATOMIC_RELEASE);
+                return entry;
+            }
+            // somebody else claimed it first, 'state' now holds what they set
+        }
+
+        for (spins = 0; ((state == ENTRY_CLAIMED) && (spins < ENTRY_CLAIM_SPINS)); spins++) {
+            sched_yield();
+            state = __atomic_load_n(&entry->state, __ATOMIC_ACQUIRE);
+        }
+
+        if ((state == ENTRY_READY) && (strncmp(entry->name, message_name, (MSG_STATS_NAME_LEN - 1)) == 0)) {
+            return entry;
+        }
+    }
+    return NULL;
 }
 
-//! Resets the counters for the given message entry. Expects that the json object passed
-//! is the map of values for a single message entry. Modifies the entry in-place
-static void reset_message_stat(json_object *msg_entry) {
-    if(msg_entry == NULL || json_object_is_type(msg_entry, json_type_object)) {
-        return;
+//! Buckets are exact below 2^MSG_STATS_HIST_SUB_BITS. Above that a timing with its highest bit at
+//! position (MSG_STATS_HIST_SUB_BITS + e) keeps MSG_STATS_HIST_SUB_BITS + 1 significant bits, so it
+//! lands in bucket (e << MSG_STATS_HIST_SUB_BITS) + (timing >> e).
+static int histogram_bucket(long timing_ms) {
+    int shift = 0;
+
+    if (timing_ms < 0) {
+        timing_ms = 0;
+    } else if (timing_ms > MSG_STATS_HIST_MAX_MS) {
+        timing_ms = MSG_STATS_HIST_MAX_MS;
     }
 
-    json_object_object_del(msg_entry, MSG_MEAN_KEY);
-    json_object_object_del(msg_entry, MSG_MIN_KEY);
-    json_object_object_del(msg_entry, MSG_MAX_KEY);
-    json_object_object_del(msg_entry, MSG_COUNT_KEY);
-    json_object_object_del(msg_entry, MSG_OK_COUNT_KEY);
-    json_object_object_del(msg_entry, MSG_FAIL_COUNT_KEY);
+    if (timing_ms >= (1 << MSG_STATS_HIST_SUB_BITS)) {
+        shift = (31 - __builtin_clz((unsigned int)timing_ms)) - MSG_STATS_HIST_SUB_BITS;
+    }
+    return ((shift << MSG_STATS_HIST_SUB_BITS) + (int)(timing_ms >> shift));
+}
 
-    json_object_object_add(msg_entry, MSG_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_OK_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_FAIL_COUNT_KEY, json_object_new_int(MSG_COUNT_INIT));
-    json_object_object_add(msg_entry, MSG_MEAN_KEY, json_object_new_double(MSG_MEAN_INIT));
-    json_object_object_add(msg_entry, MSG_MIN_KEY, json_object_new_int(MSG_MIN_INIT)); //Use -1 since it is invalid measure
-    json_object_object_add(msg_entry, MSG_MAX_KEY, json_object_new_int(MSG_MAX_INIT));
+//! The highest timing counted in the given bucket
+static long histogram_value(int bucket) {
+    int shift = 0;
+
+    if (bucket < (2 << MSG_STATS_HIST_SUB_BITS)) {
+        return bucket;
+    }
 
+    shift = (bucket >> MSG_STATS_HIST_SUB_BITS) - 1;
+    return (((long)(bucket - (shift << MSG_STATS_HIST_SUB_BITS) + 1) << shift) - 1);
 }
 
-//! Idempotently enable stats
-void enable_stats(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool == NULL || 
-       ( !json_object_is_type(enabled_bool, json_type_boolean) || 
-         json_object_get_boolean(enabled_bool) != TRUE) ) {
-
-        if(enabled_bool != NULL) {
-            json_object_object_del(stats_state, STATS_ENABLED_KEY);
+//! Walks the histogram up to the bucket holding the given fraction of the total
+//! @returns the highest timing of that bucket capped to the longest timing actually seen,
+//!          or MSG_MAX_INIT if the histogram is empty
+static long histogram_percentile(const uint64_t *buckets, uint64_t total, double fraction, long max_ms) {
+    int i = 0;
+    uint64_t seen = 0;
+    uint64_t rank = (uint64_t)ceil(fraction * (double)total);
+
+    if (total == 0) {
+        return MSG_MAX_INIT;
+    }
+
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    for (i = 0; i < MSG_STATS_HIST_BUCKETS; i++) {
+        if ((seen += buckets[i]) >= rank) {
+            return ((histogram_value(i) < max_ms) ? histogram_value(i) : max_ms);
         }
+    }
+    return max_ms;
+}
 
-        json_object_object_add(stats_state, STATS_ENABLED_KEY, json_object_new_boolean(TRUE));
-    }    
+//! Idempotently enable stats
+void enable_stats(message_stats_table *stats_state) {
+    if(stats_state != NULL) {
+        __atomic_store_n(&stats_state->enabled, TRUE, __ATOMIC_RELAXED);
+    }
 }
 
-int is_enabled(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool != NULL && json_object_is_type(enabled_bool, json_type_boolean)) {
-        return json_object_get_boolean(enabled_bool);
+int is_enabled(message_stats_table *stats_state) {
+    if(stats_state != NULL && __atomic_load_n(&stats_state->magic, __ATOMIC_RELAXED) == MSG_STATS_MAGIC) {
+        return (__atomic_load_n(&stats_state->enabled, __ATOMIC_RELAXED) ? TRUE : FALSE);
     } else {
         return FALSE;
     }
 }
 
 //! Idempotently disable stats
-void disable_stats(json_object *stats_state) {
-    json_object *enabled_bool = NULL;
-    json_object_object_get_ex(stats_state, STATS_ENABLED_KEY, &enabled_bool);
-    if(enabled_bool == NULL || 
-       (!json_object_is_type(enabled_bool, json_type_boolean) || json_object_get_boolean(enabled_bool) == TRUE)) {
-
-        if(enabled_bool != NULL) {
-            json_object_object_del(stats_state, STATS_ENABLED_KEY);
-        }
-
-        json_object_object_add(stats_state, STATS_ENABLED_KEY, json_object_new_boolean(FALSE));
-    }        
+void disable_stats(message_stats_table *stats_state) {
+    if(stats_state != NULL) {
+        __atomic_store_n(&stats_state->enabled, FALSE, __ATOMIC_RELAXED);
+    }
 }
 
-//! Must ensure that this is called serially the first time. Once the mutex is initialized it is protected by locks
-//! @param stats_state - the current state, if any. Will be reset and set enabled. Does not empty memory, just resets counters
-int initialize_message_stats(json_object **stats_state) {
+//! Must ensure that this is called serially the first time. Afterwards updates need no locks.
+//! @param stats_state - the table. A table that is not initialized yet (zeroed memory or the json text
+//!                      kept by older versions of the CC) is cleared and enabled, an initialized
+//!                      one just gets its counters reset.
+int initialize_message_stats(message_stats_table *stats_state) {
     if(stats_state == NULL) {
         LOGFATAL("Cannot initialize a NULL address pointer for stats\n");
         return EUCA_INVALID_ERROR;
     }
 
+    if(stats_state->magic != MSG_STATS_MAGIC) {
+        LOGTRACE("Initializing a new message stats table\n");
+        bzero(stats_state, sizeof(message_stats_table));
+        stats_state->enabled = TRUE;
+        __atomic_store_n(&stats_state->magic, MSG_STATS_MAGIC, __ATOMIC_RELEASE);
+        return EUCA_OK;
+    }
+
     return reset_message_stats(stats_state);
 }
 
-//! Add a new data point to the message's stats
-int update_message_stats(json_object *stats_state, const char *message_name, int timing_ms, int failed) {
+//! Add a new data point to the message's stats. Lock free: a handful of atomic adds, plus
+//! compare-and-swap loops for the min and max when they change.
+int update_message_stats(message_stats_table *stats_state, const char *message_name, int timing_ms, int failed) {
+    int64_t current = 0;
+    message_stats_entry *entry = NULL;
+
     if(message_name == NULL) {
         return EUCA_ERROR;
     }
 
-    if(stats_state == NULL || !is_enabled(stats_state) ) {
+    if(!is_enabled(stats_state)) {
         //Stats are disabled, return ok
         return EUCA_OK;
     }
 
-    json_object *msg = NULL;
-    json_object_object_get_ex(stats_state, message_name, &msg);
-    json_object *min_obj, *max_obj, *mean_obj, *count_obj, *ok_obj, *fail_obj;
-    int min_val, max_val, count_val, ok_count, fail_count;
-    double mean_val;
-
-    if(msg == NULL) {
-        //Not found. Add it.
-        msg = initialize_new_message_map();
-        if(msg == NULL) {
-            LOGERROR("Failed to add message type %s to the message stats map", message_name);
-            return EUCA_ERROR;
-        }  else {
-            json_object_object_add(stats_state, message_name, msg);
-        }
-    }
-
-    //Update the data
-    json_object_object_get_ex(msg, MSG_MEAN_KEY, &mean_obj);
-    if(mean_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
+    if((entry = find_message_entry(stats_state, message_name)) == NULL) {
+        LOGERROR("Failed to add message type %s to the message stats table, it is full\n", message_name);
         return EUCA_ERROR;
     }
-    mean_val = json_object_get_int(mean_obj);
 
-    json_object_object_get_ex(msg, MSG_MIN_KEY, &min_obj);
-    if(mean_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+    if(timing_ms < 0) {
+        timing_ms = 0;
     }
-    min_val = json_object_get_int(min_obj);
 
-    json_object_object_get_ex(msg, MSG_MAX_KEY, &max_obj);
-    if(max_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
-    }
-    max_val = json_object_get_int(max_obj);
-
-    json_object_object_get_ex(msg, MSG_COUNT_KEY, &count_obj);
-    if(count_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
+    __atomic_fetch_add(&entry->count, 1, __ATOMIC_RELAXED);
+    if(failed != 0) {
+        __atomic_fetch_add(&entry->failures, 1, __ATOMIC_RELAXED);
     }
-    count_val = json_object_get_int(count_obj);
+    __atomic_fetch_add(&entry->sum_ms, timing_ms, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&entry->buckets[histogram_bucket(timing_ms)], 1, __ATOMIC_RELAXED);
 
-    json_object_object_get_ex(msg, MSG_OK_COUNT_KEY, &ok_obj);
-    if(ok_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
-    }
-    ok_count = json_object_get_int(ok_obj);
+    current = __atomic_load_n(&entry->min_ms, __ATOMIC_RELAXED);
+    while((current == MSG_MIN_INIT || timing_ms < current) &&
+          !__atomic_compare_exchange_n(&entry->min_ms, &current, timing_ms, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
-    json_object_object_get_ex(msg, MSG_COUNT_KEY, &fail_obj);
-    if(fail_obj == NULL) {
-        LOGERROR("Null in stats object found, cannot continue update.\n");
-        return EUCA_ERROR;
-    }
-    fail_count = json_object_get_int(fail_obj);
-
-    mean_val = (int)trunc(calculate_moving_mean((double)mean_val, count_val, timing_ms));
-    json_object_object_del(msg, MSG_MEAN_KEY);
-
-    json_object_object_add(msg, MSG_MEAN_KEY, json_object_new_int(mean_val));
-    
-    if(min_val == MSG_MIN_INIT || timing_ms < min_val) {
-        json_object_object_del(msg, MSG_MIN_KEY);
-        json_object_object_add(msg, MSG_MIN_KEY, json_object_new_int(timing_ms));
-    }
-    
-    if(max_val == MSG_MAX_INIT || timing_ms > max_val) {
-        json_object_object_del(msg, MSG_MAX_KEY);
-        json_object_object_add(msg, MSG_MAX_KEY, json_object_new_int(timing_ms));
-    }
-    
-    json_object_object_del(msg, MSG_COUNT_KEY);
-    json_object_object_add(msg, MSG_COUNT_KEY, json_object_new_int(++count_val));
-
-    if(failed == 0) {
-        json_object_object_del(msg, MSG_OK_COUNT_KEY);
-        json_object_object_add(msg, MSG_OK_COUNT_KEY, json_object_new_int(++ok_count));
-    } else {
-        json_object_object_del(msg, MSG_FAIL_COUNT_KEY);
-        json_object_object_add(msg, MSG_FAIL_COUNT_KEY, json_object_new_int(++fail_count));
-    }
+    current = __atomic_load_n(&entry->max_ms, __ATOMIC_RELAXED);
+    while((current == MSG_MAX_INIT || timing_ms > current) &&
+          !__atomic_compare_exchange_n(&entry->max_ms, &current, timing_ms, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
 
     return EUCA_OK;
 }
 
 //! Iterate through and reset all message metrics for next interval
-//! Removes all current data and stats from memory
-int reset_message_stats(json_object **stats_state) {
+//! Message names are kept, only the counters are zeroed
+int reset_message_stats(message_stats_table *stats_state) {
+    json_object *discard = NULL;
+
     if(stats_state == NULL) {
         LOGERROR("Cannot reset message stats on null pointer\n");
         return EUCA_INVALID_ERROR;
     }
 
-    if(*stats_state != NULL) {
-        //In future versions of json-c (0.12 for sure), this returns an int to determine if count decremented.
-        //The CentOS version is old (0.10), but when available use the return value to ensure all refs are released
-        json_object_object_foreach(*stats_state, key, value) {
-            if(strcmp(key, STATS_ENABLED_KEY) != 0 && json_object_is_type(value, json_type_object)) {
-                reset_message_stat(value);
-            }
-        }
-    } else {
-        LOGTRACE("Reseting message stats to a new json object\n");
-        *stats_state = json_object_new_object();
-        enable_stats(*stats_state);
+    if((discard = get_message_stats_json(stats_state, TRUE)) != NULL) {
+        json_object_put(discard);
     }
     return EUCA_OK;
 }
 
-//! Entry point for the message stats sensor. Gets the stats data from
-//! the message maps and sends it to the emitter.
-json_object *get_message_stats_json(const char *message_stats_string) {
-    //Stringify and re-parse to create completely separate copy
-    if(message_stats_string != NULL) {
-        return json_tokener_parse(message_stats_string);
-    } else {
+//! Entry point for the message stats sensor. Builds the json for every message seen so far.
+//! When resetting, each counter is read and zeroed in one atomic step so no concurrent update
+//! is lost: it is either part of this interval or of the next one.
+json_object *get_message_stats_json(message_stats_table *stats_state, int reset) {
+    int i = 0;
+    int b = 0;
+    uint64_t count = 0;
+    uint64_t failures = 0;
+    uint64_t sum_ms = 0;
+    uint64_t total = 0;
+    int64_t min_ms = 0;
+    int64_t max_ms = 0;
+    uint64_t buckets[MSG_STATS_HIST_BUCKETS] = { 0 };
+    message_stats_entry *entry = NULL;
+    json_object *stats_json = NULL;
+    json_object *msg_json = NULL;
+
+    if(stats_state == NULL || stats_state->magic != MSG_STATS_MAGIC) {
         return NULL;
     }
+
+    stats_json = json_object_new_object();
+    for(i = 0; i < MSG_STATS_MAX_TYPES; i++) {
+        entry = &stats_state->entries[i];
+        if(__atomic_load_n(&entry->state, __ATOMIC_ACQUIRE) != ENTRY_READY) {
+            continue;
+        }
+
+        count = TAKE_COUNTER(&entry->count, reset, 0);
+        failures = TAKE_COUNTER(&entry->failures, reset, 0);
+        sum_ms = TAKE_COUNTER(&entry->sum_ms, reset, 0);
+        min_ms = TAKE_COUNTER(&entry->min_ms, reset, MSG_MIN_INIT);
+        max_ms = TAKE_COUNTER(&entry->max_ms, reset, MSG_MAX_INIT);
+        for(b = 0, total = 0; b < MSG_STATS_HIST_BUCKETS; b++) {
+            total += (buckets[b] = TAKE_COUNTER(&entry->buckets[b], reset, 0));
+        }
+
+        msg_json = json_object_new_object();
+        json_object_object_add(msg_json, MSG_COUNT_KEY, json_object_new_int64(count));
+        json_object_object_add(msg_json, MSG_OK_COUNT_KEY, json_object_new_int64((failures < count) ? (count - failures) : 0));
+        json_object_object_add(msg_json, MSG_FAIL_COUNT_KEY, json_object_new_int64(failures));
+        json_object_object_add(msg_json, MSG_MEAN_KEY, json_object_new_double((count > 0) ? ((double)sum_ms / (double)count) : 0.0));
+        json_object_object_add(msg_json, MSG_MIN_KEY, json_object_new_int64(min_ms));
+        json_object_object_add(msg_json, MSG_MAX_KEY, json_object_new_int64(max_ms));
+
+        json_object_object_add(msg_json, MSG_P50_KEY, json_object_new_int64(histogram_percentile(buckets, total, 0.5, max_ms)));
+        json_object_object_add(msg_json, MSG_P99_KEY, json_object_new_int64(histogram_percentile(buckets, total, 0.99, max_ms)));
+        json_object_object_add(msg_json, MSG_P999_KEY, json_object_new_int64(histogram_percentile(buckets, total, 0.999, max_ms)));
+        json_object_object_add(stats_json, entry->name, msg_json);
+    }
+    return stats_json;
 }
 
 
 #ifdef _UNIT_TEST
-static int test_moving_average() {
-    LOGINFO("Testing moving average calculation\n");
-    double cma = 0.0;
-    int count = 0;
-    double result;
-    result = calculate_moving_mean(cma, count, 1); 
-    if(result != 1.0) {
-        LOGERROR("Wrong answer %f\n", result);
-        return 1;
+static int test_histogram() {
+    LOGINFO("Testing histogram bucket calculation\n");
+    long v = 0;
+    int bucket = 0;
+    int previous = -1;
+
+    for(v = 0; v <= MSG_STATS_HIST_MAX_MS; v += ((v < 4096) ? 1 : (v / 997))) {
+        bucket = histogram_bucket(v);
+        if(bucket < previous || bucket >= MSG_STATS_HIST_BUCKETS) {
+            LOGERROR("Bucket %d for %ld out of order or range\n", bucket, v);
+            return 1;
+        }
+        //The bucket holds v and its top is within the precision of the histogram
+        if(histogram_value(bucket) < v || (histogram_value(bucket) - v) > (v >> MSG_STATS_HIST_SUB_BITS)) {
+            LOGERROR("Bucket %d for %ld tops out at %ld\n", bucket, v, histogram_value(bucket));
+            return 1;
+        }
+        previous = bucket;
     }
-    
-    cma = 1.0;
-    count = 1;    
-    result = calculate_moving_mean(cma, count, 2);
-    if(result != 1.5) {
-        LOGERROR("Wrong answer %f\n", result);
+
+    if(histogram_bucket(MSG_STATS_HIST_MAX_MS) != (MSG_STATS_HIST_BUCKETS - 1) || histogram_bucket(-5) != 0) {
+        LOGERROR("Wrong bucket for out of range values\n");
         return 1;
     }
-
     return 0;
 }
 
-static int test_init_message_map() {
-    json_object *map = initialize_new_message_map();
-    if(map != NULL) {
-        LOGINFO("Built: %s\n", json_object_to_json_string_ext(map, JSON_C_TO_STRING_PRETTY));
-        return 0;
-    }
-    return 1;
-}
-
 static int test_update_message_stats() {
     LOGINFO("Testing update message stats\n");
+    int i = 0;
+    json_object *stats = NULL;
+    json_object *inst = NULL;
+    json_object *msg_count, *msg_fail, *msg_max, *msg_min, *msg_mean, *msg_p50, *msg_p99;
+
+    bzero(&message_stats_map, sizeof(message_stats_map));
     if(initialize_message_stats(&message_stats_map) != 0) {
         LOGERROR("Failed to initialize the structures\n");
         return 1;
     }
-    
-    if(update_message_stats(message_stats_map, "runInstance", 100, 0) != 0) {
-        LOGERROR("Error updating stats\n");
-        return 1;
-    }
 
-    if(update_message_stats(message_stats_map, "runInstance", 125, 0) != 0) {
+    if(update_message_stats(&message_stats_map, "runInstance", 100, 0) != 0 ||
+       update_message_stats(&message_stats_map, "runInstance", 125, 0) != 0 ||
+       update_message_stats(&message_stats_map, "runInstance", 75, 1) != 0 ||
+       update_message_stats(&message_stats_map, "runInstance", 50, 0) != 0 ||
+       update_message_stats(&message_stats_map, "describeInstances", 50, 0) != 0 ||
+       update_message_stats(&message_stats_map, "terminateInstance", 50, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    if(update_message_stats(message_stats_map, "runInstance", 75, 0) != 0) {
-        LOGERROR("Error updating stats\n");
+    //Verify
+    stats = get_message_stats_json(&message_stats_map, FALSE);
+    json_object_object_get_ex(stats, "runInstance", &inst);
+    LOGINFO("Message stats: \n%s\n", json_object_to_json_string_ext(stats, JSON_C_TO_STRING_PRETTY));
+    msg_count = msg_fail = msg_max = msg_min = msg_mean = msg_p50 = msg_p99 = NULL;
+    json_object_object_get_ex(inst, MSG_COUNT_KEY, &msg_count);
+    json_object_object_get_ex(inst, MSG_FAIL_COUNT_KEY, &msg_fail);
+    json_object_object_get_ex(inst, MSG_MAX_KEY, &msg_max);
+    json_object_object_get_ex(inst, MSG_MIN_KEY, &msg_min);
+    json_object_object_get_ex(inst, MSG_MEAN_KEY, &msg_mean);
+    json_object_object_get_ex(inst, MSG_P50_KEY, &msg_p50);
+    json_object_object_get_ex(inst, MSG_P99_KEY, &msg_p99);
+    if(inst == NULL ||
+       json_object_get_int(msg_count) != 4 ||
+       json_object_get_int(msg_fail) != 1 ||
+       json_object_get_int(msg_max) != 125 ||
+       json_object_get_double(msg_mean) != ((100.0+125.0+75.0+50.0)/4.0) ||
+       json_object_get_int(msg_min) != 50 ||
+       json_object_get_int(msg_p50) < 75 || json_object_get_int(msg_p50) > 77 ||
+       json_object_get_int(msg_p99) != 125) {
+        LOGERROR("failure on verification of results\n");
+        json_object_put(stats);
         return 1;
     }
+    json_object_put(stats);
 
-    if(update_message_stats(message_stats_map, "runInstance", 50, 0) != 0) {
-        LOGERROR("Error updating stats\n");
-        return 1;
+    //Percentiles of a known distribution
+    for(i = 1; i <= 1000; i++) {
+        update_message_stats(&message_stats_map, "describeSensors", i, 0);
     }
-
-    if(update_message_stats(message_stats_map, "describeInstances", 50, 0) != 0) {
-        LOGERROR("Error updating stats\n");
+    stats = get_message_stats_json(&message_stats_map, TRUE);
+    json_object_object_get_ex(stats, "describeSensors", &inst);
+    json_object_object_get_ex(inst, MSG_P50_KEY, &msg_p50);
+    json_object_object_get_ex(inst, MSG_P99_KEY, &msg_p99);
+    LOGINFO("p50=%d p99=%d\n", json_object_get_int(msg_p50), json_object_get_int(msg_p99));
+    if(fabs(json_object_get_int(msg_p50) - 500.0) > 500.0 / 32 || fabs(json_object_get_int(msg_p99) - 990.0) > 990.0 / 32) {
+        LOGERROR("percentiles outside of the histogram precision\n");
+        json_object_put(stats);
         return 1;
     }
+    json_object_put(stats);
 
-    if(update_message_stats(message_stats_map, "terminateInstance", 50, 0) != 0) {
-        LOGERROR("Error updating stats\n");
-        return 1;
-    }
-    
-    //Verify
-    json_object * inst = NULL;
-    json_object_object_get_ex(message_stats_map, "runInstance", &inst);
-    LOGINFO("Message stats: \n%s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
-    json_object *msg_count, *msg_max, *msg_min, *msg_mean;
-    msg_count = NULL;
-    msg_max = NULL;
-    msg_min = NULL;
-    msg_mean = NULL;
+    //The reset left the names but no counts
+    stats = get_message_stats_json(&message_stats_map, FALSE);
+    json_object_object_get_ex(stats, "runInstance", &inst);
     json_object_object_get_ex(inst, MSG_COUNT_KEY, &msg_count);
-    json_object_object_get_ex(inst, MSG_MAX_KEY, &msg_max);
     json_object_object_get_ex(inst, MSG_MIN_KEY, &msg_min);
-    json_object_object_get_ex(inst, MSG_MEAN_KEY, &msg_mean);
-    if(inst != NULL && 
-       json_object_get_int(msg_count) == 4 &&
-       json_object_get_int(msg_max) == 125 &&
-       json_object_get_double(msg_mean) == ((100.0+125.0+75.0+50.0)/4.0) && 
-       json_object_get_int(msg_min) == 50) {
-        LOGINFO("test passes\n");
-        return 0;
-    } else {
-        LOGERROR("failure on verification of results\n");
+    if(inst == NULL || json_object_get_int(msg_count) != 0 || json_object_get_int(msg_min) != MSG_MIN_INIT) {
+        LOGERROR("reset did not clear the counters\n");
+        json_object_put(stats);
         return 1;
     }
+    json_object_put(stats);
+
+    //Disabled stats are not collected
+    disable_stats(&message_stats_map);
+    update_message_stats(&message_stats_map, "runInstance", 10, 0);
+    enable_stats(&message_stats_map);
+    if(find_message_entry(&message_stats_map, "runInstance")->count != 0) {
+        LOGERROR("disabled stats were collected\n");
+        return 1;
+    }
+
+    LOGINFO("test passes\n");
+    return 0;
 }
 
 static int test_get_message_stats_json() {
-    LOGINFO("Testing update message stats\n");
-    if(initialize_message_stats(&message_stats_map) != 0) {
+    LOGINFO("Testing message stats json\n");
+    json_object *stats = NULL;
+
+    bzero(&message_stats_map, sizeof(message_stats_map));
+    //Leftover text from an older version is not mistaken for a table
+    euca_strncpy((char *)&message_stats_map, "{ \"enabled\": true }", sizeof(message_stats_map));
+    if(initialize_message_stats(&message_stats_map) != 0 || !is_enabled(&message_stats_map)) {
         LOGERROR("Failed to initialize the structures\n");
         return 1;
     }
-    
-    if(update_message_stats(message_stats_map, "runInstance", 100, 0) != 0) {
+
+    if(update_message_stats(&message_stats_map, "runInstance", 100, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
-    
-    LOGINFO("Got intermediate result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
 
-    if(update_message_stats(message_stats_map, "runInstance", 125, 0) != 0) {
+    stats = get_message_stats_json(&message_stats_map, FALSE);
+    LOGINFO("Got intermediate result: %s\n", json_object_to_json_string_ext(stats, JSON_C_TO_STRING_PRETTY));
+    json_object_put(stats);
+
+    if(update_message_stats(&message_stats_map, "runInstance", 125, 0) != 0) {
         LOGERROR("Error updating stats\n");
         return 1;
     }
 
-    LOGINFO("Post-update result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
+    stats = get_message_stats_json(&message_stats_map, TRUE);
+    LOGINFO("Post-update result: %s\n", json_object_to_json_string_ext(stats, JSON_C_TO_STRING_PRETTY));
+    json_object_put(stats);
 
-    LOGINFO("Internal state result: %s\n", json_object_to_json_string_ext(message_stats_map, JSON_C_TO_STRING_PRETTY));
-    
+    return 0;
+}
+
+//! Hammers one table from several threads with a new message name per thread plus a shared one
+static void *test_update_thread(void *arg) {
+    int i = 0;
+    char name[MSG_STATS_NAME_LEN] = "";
+
+    snprintf(name, sizeof(name), "threadMessage%ld", (long)arg);
+    for(i = 0; i < TEST_UPDATES_PER_THREAD; i++) {
+        update_message_stats(&message_stats_map, ((i % 2) ? name : "sharedMessage"), (i % 1000), (i % 10 == 0));
+    }
+    return NULL;
+}
+
+static int test_concurrent_updates() {
+    LOGINFO("Testing concurrent updates\n");
+    long i = 0;
+    long usec = 0;
+    pthread_t threads[TEST_THREADS];
+    struct timeval start, end;
+    message_stats_entry *shared = NULL;
+
+    bzero(&message_stats_map, sizeof(message_stats_map));
+    initialize_message_stats(&message_stats_map);
+
+    gettimeofday(&start, NULL);
+    for(i = 0; i < TEST_THREADS; i++) {
+        pthread_create(&threads[i], NULL, test_update_thread, (void *)i);
+    }
+    for(i = 0; i < TEST_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    gettimeofday(&end, NULL);
+    usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+    LOGINFO("%d threads did %d updates in %ld usec (%.1f nsec per update)\n", TEST_THREADS, TEST_THREADS * TEST_UPDATES_PER_THREAD, usec,
+            (1000.0 * usec) / (TEST_THREADS * TEST_UPDATES_PER_THREAD));
+
+    shared = find_message_entry(&message_stats_map, "sharedMessage");
+    if(shared == NULL || shared->count != (uint64_t)(TEST_THREADS * TEST_UPDATES_PER_THREAD / 2) || shared->min_ms != 0 || shared->max_ms != 998) {
+        LOGERROR("lost updates on the shared message\n");
+        return 1;
+    }
+
+    for(i = 0; i < TEST_THREADS; i++) {
+        char name[MSG_STATS_NAME_LEN] = "";
+        snprintf(name, sizeof(name), "threadMessage%ld", i);
+        if(find_message_entry(&message_stats_map, name)->count != (uint64_t)(TEST_UPDATES_PER_THREAD / 2)) {
+            LOGERROR("lost updates on %s\n", name);
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -539,7 +664,7 @@ int main(int argc, char** argv) {
     success = 0;
     failure = 0;
 
-    if(test_moving_average() == 0) {
+    if(test_histogram() == 0) {
         LOGINFO("Success!\n");
         success++;
     } else {
@@ -548,7 +673,7 @@ int main(int argc, char** argv) {
     }
     count++;
 
-    if(test_init_message_map() == 0) {
+    if(test_update_message_stats() == 0) {
         LOGINFO("Success!\n");
         success++;
     } else {
@@ -557,7 +682,7 @@ int main(int argc, char** argv) {
     }
     count++;
 
-    if(test_update_message_stats() == 0) {
+    if(test_get_message_stats_json() == 0) {
         LOGINFO("Success!\n");
         success++;
     } else {
@@ -566,7 +691,7 @@ int main(int argc, char** argv) {
     }
     count++;
 
-    if(test_get_message_stats_json() == 0) {
+    if(test_concurrent_updates() == 0) {
         LOGINFO("Success!\n");
         success++;
     } else {
@@ -575,7 +700,6 @@ int main(int argc, char** argv) {
     }
     count++;
 
-
     LOGINFO("Tests: %d, Success: %d, Failure: %d\n", count, success, failure);
     return 0;
 }
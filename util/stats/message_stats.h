@@ -77,6 +77,7 @@
  |                                  INCLUDES                                  |
  |                                                                            |
 \*----------------------------------------------------------------------------*/
+#include <stdint.h>
 #include <json/json.h>
 
 /*----------------------------------------------------------------------------*\
@@ -91,12 +92,24 @@
 #define MSG_COUNT_KEY "count"
 #define MSG_OK_COUNT_KEY "success_count"
 #define MSG_FAIL_COUNT_KEY "failure_count"
-#define STATS_ENABLED_KEY "enabled" //tracks state of the stats system, if disabled, stats aren't collected
+#define MSG_P50_KEY "p50"
+#define MSG_P99_KEY "p99"
+#define MSG_P999_KEY "p999"
 
-#define MSG_MEAN_INIT 0
 #define MSG_MIN_INIT -1
 #define MSG_MAX_INIT -1
-#define MSG_COUNT_INIT 0
+
+#define MSG_STATS_MAGIC                  0x4d534731 //!< "MSG1", marks an initialized table (the CC keeps it in a file that survives restarts)
+#define MSG_STATS_MAX_TYPES                     128 //!< Number of distinct message names a table can track
+#define MSG_STATS_NAME_LEN                       64 //!< Longest message name, including the '\0'
+
+//! @{
+//! @name Latency histogram layout: values below 2^MSG_STATS_HIST_SUB_BITS ms get a bucket each, larger
+//!       ones get 2^MSG_STATS_HIST_SUB_BITS buckets per power of two (about 3% relative error, HDR style)
+#define MSG_STATS_HIST_SUB_BITS                   5
+#define MSG_STATS_HIST_MAX_MS            ((1 << 24) - 1)    //!< Longer timings (4.6 hours) are counted as this
+#define MSG_STATS_HIST_BUCKETS           ((24 - MSG_STATS_HIST_SUB_BITS + 1) << MSG_STATS_HIST_SUB_BITS)
+//! @}
 
 /*----------------------------------------------------------------------------*\
  |                                                                            |
@@ -116,6 +129,26 @@
  |                                                                            |
 \*----------------------------------------------------------------------------*/
 
+//! Counters of one message type since the last sensor pass. Only touched with atomic operations.
+typedef struct message_stats_entry_t {
+    uint32_t state;                    //!< 0 if free, 1 while the name is being written, 2 once in use
+    char name[MSG_STATS_NAME_LEN];     //!< the message name, valid once state is 2
+    uint64_t count;                    //!< number of messages
+    uint64_t failures;                 //!< number of failed messages
+    uint64_t sum_ms;                   //!< total time spent, for the mean
+    int64_t min_ms;                    //!< shortest time or MSG_MIN_INIT
+    int64_t max_ms;                    //!< longest time or MSG_MAX_INIT
+    uint64_t buckets[MSG_STATS_HIST_BUCKETS];   //!< latency histogram
+} message_stats_entry;
+
+//! Fixed-layout table of message statistics. It contains no pointers, so the CC can keep it in
+//! memory shared between its processes and every process can update it without taking a lock.
+typedef struct message_stats_table_t {
+    uint32_t magic;                    //!< MSG_STATS_MAGIC once initialized
+    uint32_t enabled;                  //!< collect statistics only if set
+    message_stats_entry entries[MSG_STATS_MAX_TYPES];   //!< open addressed on the hash of the name
+} message_stats_table;
+
 /*----------------------------------------------------------------------------*\
  |                                                                            |
  |                             EXPORTED VARIABLES                             |
@@ -131,23 +164,21 @@
 //! Update stats for the message
 //! failed = 1 indicates the message was an error/failure
 //! failed = 0 indicates the message was a successful operation 
-int update_message_stats(json_object *stats_state, const char *message_name, int timing_ms, int failed);
+int update_message_stats(message_stats_table *stats_state, const char *message_name, int timing_ms, int failed);
 
 //Iterate through and reset all message metrics for next interval
-int reset_message_stats(json_object **stats_state);
+int reset_message_stats(message_stats_table *stats_state);
 
-//! Idempotently initialize the message sensor structures. Not threadsafe.
-int initialize_message_stats(json_object **stats_state);
+//! Idempotently initialize the message stats table, keeping the counters of an already initialized one.
+int initialize_message_stats(message_stats_table *stats_state);
 
-//! Get the full set of current message stats as a json object.
-//! Output will be a new allocated structure independent of any state internal
-//! to the stats tracking
-//! @returns json object for give state string, or NULL if error or no string given
-json_object *get_message_stats_json(const char *message_stats_string);
+//! Get the current message stats as a new json object, optionally resetting the counters in the same pass.
+//! @returns json object mapping message names to their stats, or NULL on error
+json_object *get_message_stats_json(message_stats_table *stats_state, int reset);
 
-void enable_stats(json_object *stats_state);
-int is_enabled(json_object *stats_state);
-void disable_stats(json_object *stats_state);
+void enable_stats(message_stats_table *stats_state);
+int is_enabled(message_stats_table *stats_state);
+void disable_stats(message_stats_table *stats_state);
 
 
 /*----------------------------------------------------------------------------*\